@@ -0,0 +1,654 @@
+// minispice_module.cc
+// Python extension module over the C embedding API (src/embed.h)
+//
+// Solutions are returned as NumPy arrays viewing the buffers the simulator
+// wrote them into: each result is owned by a capsule, and a small read-only
+// buffer object exports its data (rows x cols) or scale through the buffer
+// protocol. numpy.asarray() wraps that buffer without copying and keeps it,
+// and through it the result, alive. The module needs no NumPy headers; NumPy
+// is imported on first use and memoryviews are returned without it.
+//
+// Every analysis runs with the GIL released. A circuit is not safe for two
+// threads at once, so each Circuit object holds a lock taken around its
+// calls; distinct circuits run in parallel.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+
+#include <climits>
+#include <vector>
+
+#include "embed.h"
+
+namespace {
+
+// ============================================================================
+// Result buffers
+// ============================================================================
+
+static const char* kResultCapsule = "minispice.result";
+
+static void FreeResultCapsule(PyObject* capsule) {
+  minispice_result_free(static_cast<MiniSpiceResult*>(
+      PyCapsule_GetPointer(capsule, kResultCapsule)));
+}
+
+// Read-only view of double data owned by a result capsule
+struct BufferObject {
+  PyObject_HEAD
+  PyObject* owner;  // Capsule of the result
+  double* data;
+  int ndim;
+  Py_ssize_t shape[2];
+  Py_ssize_t strides[2];
+};
+
+static int BufferGet(PyObject* self, Py_buffer* view, int flags) {
+  BufferObject* b = reinterpret_cast<BufferObject*>(self);
+  if (flags & PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "minispice results are read-only");
+    return -1;
+  }
+  view->buf = b->data;
+  view->obj = self;
+  Py_INCREF(self);
+  view->len = sizeof(double);
+  for (int i = 0; i < b->ndim; i++) view->len *= b->shape[i];
+  view->readonly = 1;
+  view->itemsize = sizeof(double);
+  view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>("d") : nullptr;
+  view->ndim = b->ndim;
+  view->shape = (flags & PyBUF_ND) ? b->shape : nullptr;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? b->strides
+                                                           : nullptr;
+  view->suboffsets = nullptr;
+  view->internal = nullptr;
+  return 0;
+}
+
+static void BufferDealloc(PyObject* self) {
+  Py_XDECREF(reinterpret_cast<BufferObject*>(self)->owner);
+  Py_TYPE(self)->tp_free(self);
+}
+
+static PyBufferProcs kBufferProcs = {BufferGet, nullptr};
+
+static PyTypeObject BufferType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+// NumPy module once imported (nullptr before, Py_None if unavailable)
+static PyObject* numpy = nullptr;
+
+// Array (or memoryview without NumPy) of ndim dimensions over data, owned
+// by the result capsule owner. Returns a new reference, nullptr on error.
+static PyObject* ViewOf(PyObject* owner, double* data, int ndim,
+                        Py_ssize_t rows, Py_ssize_t cols) {
+  BufferObject* b = PyObject_New(BufferObject, &BufferType);
+  if (!b) return nullptr;
+  Py_INCREF(owner);
+  b->owner = owner;
+  b->data = data;
+  b->ndim = ndim;
+  b->shape[0] = rows;
+  b->shape[1] = cols;
+  b->strides[0] = ndim == 2 ? cols * (Py_ssize_t)sizeof(double)
+                            : (Py_ssize_t)sizeof(double);
+  b->strides[1] = sizeof(double);
+  PyObject* buffer = reinterpret_cast<PyObject*>(b);
+
+  if (!numpy) {
+    numpy = PyImport_ImportModule("numpy");
+    if (!numpy) {
+      PyErr_Clear();
+      numpy = Py_None;
+      Py_INCREF(numpy);
+    }
+  }
+  PyObject* view = numpy != Py_None
+                       ? PyObject_CallMethod(numpy, "asarray", "O", buffer)
+                       : PyMemoryView_FromObject(buffer);
+  Py_DECREF(buffer);
+  return view;
+}
+
+// Capsule owning r (freed on failure). Returns a new reference, nullptr on
+// error.
+static PyObject* OwnResult(MiniSpiceResult* r) {
+  PyObject* capsule = PyCapsule_New(r, kResultCapsule, FreeResultCapsule);
+  if (!capsule) minispice_result_free(r);
+  return capsule;
+}
+
+// Solutions of r as a rows x cols array, or a 1-D array of one row if
+// squeeze.
+static PyObject* WrapData(MiniSpiceResult* r, int squeeze) {
+  int rows = minispice_result_rows(r);
+  int cols = minispice_result_cols(r);
+  double* data = const_cast<double*>(minispice_result_data(r));
+  PyObject* owner = OwnResult(r);
+  if (!owner) return nullptr;
+  PyObject* x = squeeze ? ViewOf(owner, data, 1, cols, 0)
+                        : ViewOf(owner, data, 2, rows, cols);
+  Py_DECREF(owner);
+  return x;
+}
+
+// (scale, solutions) of r as a tuple of a 1-D and a 2-D array
+static PyObject* WrapScaled(MiniSpiceResult* r) {
+  int rows = minispice_result_rows(r);
+  int cols = minispice_result_cols(r);
+  double* data = const_cast<double*>(minispice_result_data(r));
+  double* scale = const_cast<double*>(minispice_result_scale(r));
+  PyObject* owner = OwnResult(r);
+  if (!owner) return nullptr;
+  PyObject* s = ViewOf(owner, scale, 1, rows, 0);
+  PyObject* x = s ? ViewOf(owner, data, 2, rows, cols) : nullptr;
+  Py_DECREF(owner);
+  if (!x) {
+    Py_XDECREF(s);
+    return nullptr;
+  }
+  return Py_BuildValue("(NN)", s, x);
+}
+
+// ============================================================================
+// Circuits
+// ============================================================================
+
+struct CircuitObject {
+  PyObject_HEAD
+  MiniSpiceCircuit* circuit;
+  PyThread_type_lock lock;
+};
+
+static PyTypeObject CircuitType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+// Holds a circuit's lock, taken with the GIL released, for one call
+class CircuitLock {
+ public:
+  explicit CircuitLock(CircuitObject* c) : c_(c) {
+    if (!PyThread_acquire_lock(c_->lock, NOWAIT_LOCK)) {
+      Py_BEGIN_ALLOW_THREADS;
+      PyThread_acquire_lock(c_->lock, WAIT_LOCK);
+      Py_END_ALLOW_THREADS;
+    }
+  }
+  ~CircuitLock() { PyThread_release_lock(c_->lock); }
+
+ private:
+  CircuitObject* c_;
+};
+
+static PyObject* SimulationError(const char* what) {
+  PyErr_Format(PyExc_RuntimeError, "minispice: %s failed", what);
+  return nullptr;
+}
+
+static PyObject* NewCircuit(PyTypeObject* type, MiniSpiceCircuit* circuit) {
+  if (!circuit) return nullptr;
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(type->tp_alloc(type, 0));
+  if (!c) {
+    minispice_circuit_free(circuit);
+    return nullptr;
+  }
+  c->circuit = circuit;
+  c->lock = PyThread_allocate_lock();
+  if (!c->lock) {
+    Py_DECREF(c);
+    return PyErr_NoMemory();
+  }
+  return reinterpret_cast<PyObject*>(c);
+}
+
+static PyObject* CircuitNew(PyTypeObject* type, PyObject* args,
+                            PyObject* kwargs) {
+  if (PyTuple_GET_SIZE(args) > 0 || (kwargs && PyDict_Size(kwargs) > 0)) {
+    PyErr_SetString(PyExc_TypeError, "Circuit() takes no arguments");
+    return nullptr;
+  }
+  PyObject* c = NewCircuit(type, minispice_circuit_new());
+  return c || PyErr_Occurred() ? c : PyErr_NoMemory();
+}
+
+static void CircuitDealloc(PyObject* self) {
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  minispice_circuit_free(c->circuit);
+  if (c->lock) PyThread_free_lock(c->lock);
+  Py_TYPE(self)->tp_free(self);
+}
+
+static PyObject* Status(int status, const char* what) {
+  if (status < 0) return SimulationError(what);
+  Py_RETURN_NONE;
+}
+
+// add_resistor and the other two-terminal devices with one value
+typedef int (*AddTwoTerminalFn)(MiniSpiceCircuit*, const char*, const char*,
+                                const char*, double);
+
+static PyObject* AddTwoTerminal(PyObject* self, PyObject* args,
+                                AddTwoTerminalFn add, const char* what) {
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  const char *name, *n1, *n2;
+  double value;
+  if (!PyArg_ParseTuple(args, "sssd", &name, &n1, &n2, &value)) return nullptr;
+  CircuitLock lock(c);
+  return Status(add(c->circuit, name, n1, n2, value), what);
+}
+
+static PyObject* AddResistor(PyObject* self, PyObject* args) {
+  return AddTwoTerminal(self, args, minispice_add_resistor, "add_resistor");
+}
+
+static PyObject* AddCapacitor(PyObject* self, PyObject* args) {
+  return AddTwoTerminal(self, args, minispice_add_capacitor, "add_capacitor");
+}
+
+static PyObject* AddInductor(PyObject* self, PyObject* args) {
+  return AddTwoTerminal(self, args, minispice_add_inductor, "add_inductor");
+}
+
+static PyObject* AddVsource(PyObject* self, PyObject* args) {
+  return AddTwoTerminal(self, args, minispice_add_vsource, "add_vsource");
+}
+
+static PyObject* AddIsource(PyObject* self, PyObject* args) {
+  return AddTwoTerminal(self, args, minispice_add_isource, "add_isource");
+}
+
+static PyObject* AddVpulse(PyObject* self, PyObject* args, PyObject* kwargs) {
+  static const char* kwlist[] = {"name", "n_plus", "n_minus", "v1", "v2",
+                                 "td",   "tr",     "tf",      "pw", "per",
+                                 nullptr};
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  const char *name, *n_plus, *n_minus;
+  double pulse[7] = {0.0};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwargs, "sssddddd|dd", const_cast<char**>(kwlist), &name,
+          &n_plus, &n_minus, &pulse[0], &pulse[1], &pulse[2], &pulse[3],
+          &pulse[4], &pulse[5], &pulse[6])) {
+    return nullptr;
+  }
+  CircuitLock lock(c);
+  return Status(minispice_add_vpulse(c->circuit, name, n_plus, n_minus, pulse),
+                "add_vpulse");
+}
+
+static PyObject* AddDiode(PyObject* self, PyObject* args, PyObject* kwargs) {
+  static const char* kwlist[] = {"name", "anode", "cathode", "i_s", "n",
+                                 nullptr};
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  const char *name, *anode, *cathode;
+  double i_s = 1e-14, n = 1.0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sss|dd",
+                                   const_cast<char**>(kwlist), &name, &anode,
+                                   &cathode, &i_s, &n)) {
+    return nullptr;
+  }
+  CircuitLock lock(c);
+  return Status(minispice_add_diode(c->circuit, name, anode, cathode, i_s, n),
+                "add_diode");
+}
+
+static PyObject* AddMosfet(PyObject* self, PyObject* args) {
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  const char *name, *drain, *gate, *source, *bulk;
+  double w, l;
+  if (!PyArg_ParseTuple(args, "sssssdd", &name, &drain, &gate, &source, &bulk,
+                        &w, &l)) {
+    return nullptr;
+  }
+  CircuitLock lock(c);
+  return Status(minispice_add_mosfet(c->circuit, name, drain, gate, source,
+                                     bulk, w, l),
+                "add_mosfet");
+}
+
+static PyObject* Finalize(PyObject* self, PyObject*) {
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  CircuitLock lock(c);
+  return Status(minispice_finalize(c->circuit), "finalize");
+}
+
+static PyObject* SetParam(PyObject* self, PyObject* args) {
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  const char *device, *param;
+  double value;
+  if (!PyArg_ParseTuple(args, "ssd", &device, &param, &value)) return nullptr;
+  CircuitLock lock(c);
+  return Status(minispice_set_param(c->circuit, device, param, value),
+                "set_param");
+}
+
+static PyObject* SetTolerances(PyObject* self, PyObject* args,
+                               PyObject* kwargs) {
+  static const char* kwlist[] = {"max_iter", "tol_abs", "tol_rel", nullptr};
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  int max_iter = 100;
+  double tol_abs = 1e-9, tol_rel = 1e-6;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|idd",
+                                   const_cast<char**>(kwlist), &max_iter,
+                                   &tol_abs, &tol_rel)) {
+    return nullptr;
+  }
+  CircuitLock lock(c);
+  return Status(minispice_set_tolerances(c->circuit, max_iter, tol_abs,
+                                         tol_rel),
+                "set_tolerances");
+}
+
+static PyObject* VarNames(PyObject* self, PyObject*) {
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  CircuitLock lock(c);
+  int n = minispice_num_vars(c->circuit);
+  if (n < 0) return SimulationError("var_names (circuit not finalized)");
+  PyObject* names = PyList_New(n);
+  for (int i = 0; names && i < n; i++) {
+    PyObject* name = PyUnicode_FromString(minispice_var_name(c->circuit, i));
+    if (!name) {
+      Py_CLEAR(names);
+      break;
+    }
+    PyList_SET_ITEM(names, i, name);
+  }
+  return names;
+}
+
+static PyObject* VarIndex(PyObject* self, PyObject* args) {
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  const char* name;
+  if (!PyArg_ParseTuple(args, "s", &name)) return nullptr;
+  CircuitLock lock(c);
+  int i = minispice_var_index(c->circuit, name);
+  if (i < 0) {
+    PyErr_Format(PyExc_KeyError, "no variable %s", name);
+    return nullptr;
+  }
+  return PyLong_FromLong(i);
+}
+
+static PyObject* NumVars(PyObject* self, void*) {
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  CircuitLock lock(c);
+  return PyLong_FromLong(minispice_num_vars(c->circuit));
+}
+
+static PyObject* Dc(PyObject* self, PyObject*) {
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  CircuitLock lock(c);
+  MiniSpiceResult* r;
+  Py_BEGIN_ALLOW_THREADS;
+  r = minispice_dc(c->circuit);
+  Py_END_ALLOW_THREADS;
+  return r ? WrapData(r, 1) : SimulationError("dc");
+}
+
+static PyObject* DcSweep(PyObject* self, PyObject* args) {
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  const char* source;
+  double start, stop, step;
+  if (!PyArg_ParseTuple(args, "sddd", &source, &start, &stop, &step)) {
+    return nullptr;
+  }
+  CircuitLock lock(c);
+  MiniSpiceResult* r;
+  Py_BEGIN_ALLOW_THREADS;
+  r = minispice_dc_sweep(c->circuit, source, start, stop, step);
+  Py_END_ALLOW_THREADS;
+  return r ? WrapScaled(r) : SimulationError("dc_sweep");
+}
+
+static PyObject* Transient(PyObject* self, PyObject* args) {
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  double tstep, tstop;
+  if (!PyArg_ParseTuple(args, "dd", &tstep, &tstop)) return nullptr;
+  CircuitLock lock(c);
+  MiniSpiceResult* r;
+  Py_BEGIN_ALLOW_THREADS;
+  r = minispice_transient(c->circuit, tstep, tstop);
+  Py_END_ALLOW_THREADS;
+  return r ? WrapScaled(r) : SimulationError("transient");
+}
+
+// Copy of values, a sequence of num_params-long sequences of numbers, into
+// flat. Returns the number of sets, or -1 with an exception set.
+static Py_ssize_t CopyValues(PyObject* values, Py_ssize_t num_params,
+                             std::vector<double>* flat) {
+  PyObject* sets = PySequence_Fast(values, "values must be a sequence");
+  if (!sets) return -1;
+  Py_ssize_t num_sets = PySequence_Fast_GET_SIZE(sets);
+  flat->reserve(num_sets * num_params);
+  for (Py_ssize_t s = 0; s < num_sets; s++) {
+    PyObject* set = PySequence_Fast(PySequence_Fast_GET_ITEM(sets, s),
+                                    "values must hold sequences");
+    if (set && PySequence_Fast_GET_SIZE(set) != num_params) {
+      PyErr_SetString(PyExc_ValueError,
+                      "every set of values needs one value per parameter");
+      Py_CLEAR(set);
+    }
+    if (!set) {
+      Py_DECREF(sets);
+      return -1;
+    }
+    for (Py_ssize_t k = 0; k < num_params; k++) {
+      flat->push_back(PyFloat_AsDouble(PySequence_Fast_GET_ITEM(set, k)));
+    }
+    Py_DECREF(set);
+    if (PyErr_Occurred()) {
+      Py_DECREF(sets);
+      return -1;
+    }
+  }
+  Py_DECREF(sets);
+  return num_sets;
+}
+
+static PyObject* DcBatch(PyObject* self, PyObject* args, PyObject* kwargs) {
+  static const char* kwlist[] = {"params", "values", "threads", nullptr};
+  CircuitObject* c = reinterpret_cast<CircuitObject*>(self);
+  PyObject *params_arg, *values_arg;
+  int threads = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|i",
+                                   const_cast<char**>(kwlist), &params_arg,
+                                   &values_arg, &threads)) {
+    return nullptr;
+  }
+
+  // (device, param) pairs; the names stay owned by params
+  PyObject* params = PySequence_Fast(params_arg, "params must be a sequence");
+  if (!params) return nullptr;
+  Py_ssize_t num_params = PySequence_Fast_GET_SIZE(params);
+  std::vector<const char*> devices(num_params), names(num_params);
+  for (Py_ssize_t k = 0; k < num_params; k++) {
+    PyObject* pair = PySequence_Fast_GET_ITEM(params, k);
+    if (!PyTuple_Check(pair) ||
+        !PyArg_ParseTuple(pair, "ss", &devices[k], &names[k])) {
+      PyErr_SetString(PyExc_TypeError,
+                      "params must hold (device, param) tuples");
+      Py_DECREF(params);
+      return nullptr;
+    }
+  }
+
+  // Values straight from a C-contiguous buffer of doubles (a NumPy array of
+  // shape (sets, params)), or copied from nested sequences
+  Py_buffer buffer;
+  std::vector<double> copy;
+  const double* values = nullptr;
+  Py_ssize_t num_sets = -1;
+  int have_buffer = 0;
+  if (PyObject_GetBuffer(values_arg, &buffer,
+                         PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) == 0) {
+    have_buffer = 1;
+    const char* format = buffer.format ? buffer.format : "B";
+    if ((format[0] == '=' || format[0] == '<' || format[0] == '@') &&
+        format[1]) {
+      format++;
+    }
+    if (format[0] != 'd' || format[1] || num_params == 0 ||
+        buffer.len % (num_params * (Py_ssize_t)sizeof(double)) != 0) {
+      PyErr_SetString(PyExc_ValueError,
+                      "values must hold float64 values, one per parameter "
+                      "per set");
+    } else {
+      values = static_cast<const double*>(buffer.buf);
+      num_sets = buffer.len / (num_params * (Py_ssize_t)sizeof(double));
+    }
+  } else {
+    PyErr_Clear();
+    num_sets = CopyValues(values_arg, num_params, &copy);
+    values = copy.data();
+  }
+  if (num_sets < 0 || num_sets > INT_MAX) {
+    if (num_sets > INT_MAX) PyErr_SetString(PyExc_ValueError, "too many sets");
+    if (have_buffer) PyBuffer_Release(&buffer);
+    Py_DECREF(params);
+    return nullptr;
+  }
+
+  MiniSpiceResult* r;
+  {
+    CircuitLock lock(c);
+    Py_BEGIN_ALLOW_THREADS;
+    r = minispice_dc_batch(c->circuit, devices.data(), names.data(),
+                           (int)num_params, values, (int)num_sets, threads);
+    Py_END_ALLOW_THREADS;
+  }
+  if (have_buffer) PyBuffer_Release(&buffer);
+  Py_DECREF(params);
+  return r ? WrapData(r, 0) : SimulationError("dc_batch");
+}
+
+static PyMethodDef kCircuitMethods[] = {
+    {"add_resistor", AddResistor, METH_VARARGS,
+     "add_resistor(name, n1, n2, r)"},
+    {"add_capacitor", AddCapacitor, METH_VARARGS,
+     "add_capacitor(name, n1, n2, c)"},
+    {"add_inductor", AddInductor, METH_VARARGS,
+     "add_inductor(name, n1, n2, l)"},
+    {"add_vsource", AddVsource, METH_VARARGS,
+     "add_vsource(name, n_plus, n_minus, dc)"},
+    {"add_isource", AddIsource, METH_VARARGS,
+     "add_isource(name, n_plus, n_minus, dc)"},
+    {"add_vpulse", reinterpret_cast<PyCFunction>(AddVpulse),
+     METH_VARARGS | METH_KEYWORDS,
+     "add_vpulse(name, n_plus, n_minus, v1, v2, td, tr, tf, pw=0, per=0)"},
+    {"add_diode", reinterpret_cast<PyCFunction>(AddDiode),
+     METH_VARARGS | METH_KEYWORDS,
+     "add_diode(name, anode, cathode, i_s=1e-14, n=1)"},
+    {"add_mosfet", AddMosfet, METH_VARARGS,
+     "add_mosfet(name, drain, gate, source, bulk, w, l)"},
+    {"finalize", Finalize, METH_NOARGS,
+     "Assign the solution variables; no devices can be added afterwards"},
+    {"set_param", SetParam, METH_VARARGS,
+     "set_param(device, param, value): edit a device parameter in place"},
+    {"set_tolerances", reinterpret_cast<PyCFunction>(SetTolerances),
+     METH_VARARGS | METH_KEYWORDS,
+     "set_tolerances(max_iter=100, tol_abs=1e-9, tol_rel=1e-6)"},
+    {"var_names", VarNames, METH_NOARGS,
+     "Names of the solution variables, V(node) and I(device), by index"},
+    {"var_index", VarIndex, METH_VARARGS,
+     "var_index(name): index of a solution variable"},
+    {"dc", Dc, METH_NOARGS,
+     "DC operating point, warm-started from the last one: x[num_vars]"},
+    {"dc_sweep", DcSweep, METH_VARARGS,
+     "dc_sweep(source, start, stop, step) -> (values[points], "
+     "x[points, num_vars])"},
+    {"transient", Transient, METH_VARARGS,
+     "transient(tstep, tstop) -> (t[points], x[points, num_vars])"},
+    {"dc_batch", reinterpret_cast<PyCFunction>(DcBatch),
+     METH_VARARGS | METH_KEYWORDS,
+     "dc_batch(params, values, threads=0) -> x[sets, num_vars]\n\n"
+     "Operating points of many parameter sets in one call: params is a list\n"
+     "of (device, param) pairs and values[sets, len(params)] their values.\n"
+     "The circuit's own parameters are left unchanged."},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+static PyGetSetDef kCircuitGetSet[] = {
+    {"num_vars", NumVars, nullptr, "Number of solution variables (-1 before "
+     "finalize)", nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr},
+};
+
+// ============================================================================
+// Module
+// ============================================================================
+
+static PyObject* Parse(PyObject*, PyObject* args) {
+  const char* netlist;
+  if (!PyArg_ParseTuple(args, "s", &netlist)) return nullptr;
+  MiniSpiceCircuit* c;
+  Py_BEGIN_ALLOW_THREADS;
+  c = minispice_circuit_parse(netlist);
+  Py_END_ALLOW_THREADS;
+  return c ? NewCircuit(&CircuitType, c) : SimulationError("parse");
+}
+
+static PyObject* Load(PyObject*, PyObject* args) {
+  PyObject* path;
+  if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path)) {
+    return nullptr;
+  }
+  MiniSpiceCircuit* c;
+  Py_BEGIN_ALLOW_THREADS;
+  c = minispice_circuit_load(PyBytes_AS_STRING(path));
+  Py_END_ALLOW_THREADS;
+  Py_DECREF(path);
+  return c ? NewCircuit(&CircuitType, c) : SimulationError("load");
+}
+
+static PyMethodDef kModuleMethods[] = {
+    {"parse", Parse, METH_VARARGS, "parse(netlist) -> finalized Circuit"},
+    {"load", Load, METH_VARARGS, "load(path) -> finalized Circuit"},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+static PyModuleDef kModule = {
+    PyModuleDef_HEAD_INIT,
+    "minispice",
+    "In-process mini-spice circuit simulation.\n\n"
+    "Results are read-only NumPy arrays viewing the simulator's buffers.",
+    -1,
+    kModuleMethods,
+};
+
+}  // namespace
+
+PyMODINIT_FUNC PyInit_minispice(void) {
+  BufferType.tp_name = "minispice._Buffer";
+  BufferType.tp_basicsize = sizeof(BufferObject);
+  BufferType.tp_dealloc = BufferDealloc;
+  BufferType.tp_as_buffer = &kBufferProcs;
+  BufferType.tp_flags = Py_TPFLAGS_DEFAULT;
+  BufferType.tp_doc = "Read-only buffer over a simulation result";
+
+  CircuitType.tp_name = "minispice.Circuit";
+  CircuitType.tp_basicsize = sizeof(CircuitObject);
+  CircuitType.tp_dealloc = CircuitDealloc;
+  CircuitType.tp_flags = Py_TPFLAGS_DEFAULT;
+  CircuitType.tp_doc =
+      "Circuit() -> empty circuit to build with the add_* methods";
+  CircuitType.tp_methods = kCircuitMethods;
+  CircuitType.tp_getset = kCircuitGetSet;
+  CircuitType.tp_new = CircuitNew;
+
+  if (PyType_Ready(&BufferType) < 0 || PyType_Ready(&CircuitType) < 0) {
+    return nullptr;
+  }
+  if (minispice_embed_version() != MINISPICE_EMBED_VERSION) {
+    PyErr_SetString(PyExc_ImportError, "minispice: embedding API mismatch");
+    return nullptr;
+  }
+
+  PyObject* m = PyModule_Create(&kModule);
+  if (!m) return nullptr;
+  Py_INCREF(&CircuitType);
+  if (PyModule_AddObject(m, "Circuit",
+                         reinterpret_cast<PyObject*>(&CircuitType)) < 0) {
+    Py_DECREF(&CircuitType);
+    Py_DECREF(m);
+    return nullptr;
+  }
+  return m;
+}
@@ -0,0 +1,125 @@
+"""Tests of the minispice Python module (run with the module on PYTHONPATH)."""
+
+import array
+import math
+import threading
+import unittest
+
+import minispice
+
+try:
+    import numpy as np
+except ImportError:
+    np = None
+
+DIODE = "V1 in 0 1\nR1 in a 100\nD1 a 0 Is=1e-14 n=1\nC1 a 0 1u\n"
+
+
+class MiniSpiceTest(unittest.TestCase):
+    def assertClose(self, a, b, tol=1e-9):
+        # Batches warm-start each set from a worker's previous one, so
+        # solutions agree to the Newton tolerance, not bit for bit
+        self.assertEqual(len(a), len(b))
+        for row_a, row_b in zip(a, b):
+            for u, v in zip(row_a, row_b):
+                self.assertAlmostEqual(u, v, delta=tol)
+
+    def test_built_circuit_matches_parsed(self):
+        c = minispice.Circuit()
+        c.add_vsource("V1", "in", "0", 1.0)
+        c.add_resistor("R1", "in", "a", 100.0)
+        c.add_diode("D1", "a", "0", i_s=1e-14)
+        c.add_capacitor("C1", "a", "0", 1e-6)
+        self.assertEqual(c.num_vars, -1)
+        c.finalize()
+        with self.assertRaises(RuntimeError):
+            c.add_resistor("R2", "a", "0", 1.0)
+
+        p = minispice.parse(DIODE)
+        self.assertEqual(sorted(c.var_names()), sorted(p.var_names()))
+        x, y = c.dc(), p.dc()
+        self.assertEqual(len(x), p.num_vars)
+        for name in p.var_names():
+            self.assertAlmostEqual(x[c.var_index(name)], y[p.var_index(name)],
+                                   places=9)
+        with self.assertRaises(KeyError):
+            p.var_index("V(nowhere)")
+
+    def test_results_view_simulator_buffers(self):
+        c = minispice.parse(DIODE)
+        a = c.var_index("V(a)")
+        x = c.dc()
+        va = x[a]
+        c.set_param("R1", "r", 1000.0)
+        self.assertLess(c.dc()[a], va)
+        del c
+        self.assertEqual(x[a], va)
+        if np is not None:
+            self.assertIsInstance(x, np.ndarray)
+            self.assertFalse(x.flags.owndata)
+            self.assertFalse(x.flags.writeable)
+        else:
+            self.assertTrue(memoryview(x).readonly)
+
+    def test_sweep_and_transient(self):
+        c = minispice.parse(DIODE)
+        values, x = c.dc_sweep("V1", 0.0, 2.0, 0.25)
+        self.assertEqual(len(values), 9)
+        self.assertEqual(x.shape, (9, c.num_vars))
+        self.assertAlmostEqual(x[8, c.var_index("V(in)")], 2.0, places=9)
+
+        rc = minispice.Circuit()
+        rc.add_vpulse("V1", "in", "0", 0.0, 1.0, 0.0, 1e-9, 1e-9, pw=1.0)
+        rc.add_resistor("R1", "in", "out", 1e3)
+        rc.add_capacitor("C1", "out", "0", 1e-6)
+        rc.finalize()
+        t, x = rc.transient(1e-5, 5e-3)
+        self.assertEqual(t[0], 0.0)
+        self.assertAlmostEqual(t[len(t) - 1], 5e-3, places=12)
+        vout = x[len(t) - 1, rc.var_index("V(out)")]
+        self.assertAlmostEqual(vout, 1.0 - math.exp(-5.0), delta=1e-2)
+
+    def test_batch_matches_edited_solves(self):
+        c = minispice.parse(DIODE)
+        check = minispice.parse(DIODE)
+        sets = [[50.0 + 25.0 * s, 0.5 + 0.1 * (s % 5)] for s in range(24)]
+        params = [("R1", "r"), ("V1", "dc")]
+        x = c.dc_batch(params, sets, threads=2)
+        self.assertEqual(x.shape, (24, c.num_vars))
+        flat = array.array("d", [v for s in sets for v in s])
+        self.assertClose(c.dc_batch(params, flat).tolist(), x.tolist())
+        if np is not None:
+            y = c.dc_batch(params, np.array(sets))
+            self.assertClose(y.tolist(), x.tolist())
+        for s, (r, v) in enumerate(sets):
+            check.set_param("R1", "r", r)
+            check.set_param("V1", "dc", v)
+            ref = check.dc()
+            for i in range(c.num_vars):
+                self.assertAlmostEqual(x[s, i], ref[i], places=8)
+        with self.assertRaises(RuntimeError):
+            c.dc_batch([("R9", "r")], [[1.0]])
+        with self.assertRaises(ValueError):
+            c.dc_batch(params, [[1.0]])
+
+    def test_circuits_run_on_threads(self):
+        circuits = [minispice.parse(DIODE) for _ in range(4)]
+        results = [None] * len(circuits)
+
+        def run(k):
+            results[k] = circuits[k].dc_batch([("R1", "r")],
+                                              [[100.0 * (s + 1)]
+                                               for s in range(50)])
+
+        threads = [threading.Thread(target=run, args=(k,))
+                   for k in range(len(circuits))]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        for x in results:
+            self.assertClose(x.tolist(), results[0].tolist())
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,258 @@
+// AC small-signal analysis implementation
+//
+// Linearizes the circuit into the G and C value arrays of one sparse
+// pattern, then solves the frequency points with a parallel for loop, one
+// complex factorization object per worker.
+//
+
+#include "ac.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "device.h"
+#include "sparse.h"
+
+namespace minispice {
+
+namespace {
+
+// Circuit linearized at the operating point: the AC matrix of frequency f
+// is g + j 2 pi f c on the entries of pattern
+struct AcSystem {
+  SparseMatrix* pattern = nullptr;
+  SparseOrdering* ordering = nullptr;
+  std::vector<double> g;
+  std::vector<double> c;
+  std::vector<std::complex<double>> b;
+};
+
+// Per-worker solver state
+struct AcWorker {
+  SparseComplexLu* lu = nullptr;
+  std::vector<std::complex<double>> values;
+  int factored = 0;  // 1 if lu holds the factors of an earlier point
+  SimStats stats;
+};
+
+struct AcJob {
+  const AcSpec* ac;
+  const AcSystem* sys;
+  std::complex<double>* results;
+  int profile;
+  std::vector<AcWorker> workers;
+  std::atomic<int> failed{0};
+};
+
+// Phase timer: start time when profiling, 0 otherwise
+static double PhaseStart(int profile) {
+  return profile ? SimClockSeconds() : 0.0;
+}
+
+static void PhaseEnd(int profile, SimStats* s, SimPhase phase, double start) {
+  if (!profile) return;
+  s->phase_seconds[phase] += SimClockSeconds() - start;
+  s->phase_calls[phase]++;
+}
+
+// Add the values of triplets to their entries of pattern in values
+static int AccumulateTriplets(const SparseMatrix* pattern,
+                              const Triplet* triplets, size_t count,
+                              std::vector<double>* values) {
+  std::vector<int> slots(count);
+  if (SparseFindSlots(pattern, triplets, count, slots.data()) != 0) return -1;
+  values->assign(pattern->nnz, 0.0);
+  for (size_t k = 0; k < count; k++) (*values)[slots[k]] += triplets[k].val;
+  return 0;
+}
+
+// Stamp G, C and b at x_op (see ac.h). Returns 0 on success, -1 on
+// allocation failure.
+static int LinearizeCircuit(Circuit* c, const double* x_op, AcSystem* sys,
+                            SimStats* stats) {
+  int n = c->num_vars;
+  StampContext* ctx = CtxCreate(n);
+  if (!ctx) return -1;
+
+  // G: the DC stamps at the operating point, without limiting or bypass
+  std::vector<double> x(x_op, x_op + n);
+  IterationState it = {0, x.data(), 0.0, 0.0, NewtonPolicy{}, nullptr, 0.0};
+  CtxReset(ctx);
+  for (Device* d = c->devices; d; d = d->next) {
+    if (!d->vt || !d->vt->StampNonlinear) continue;
+    d->vt->StampNonlinear(d, ctx, &it);
+    int type = DeviceTypeId(d);
+    if (type >= 0) stats->device_stamps[type]++;
+  }
+  size_t num_g;
+  const Triplet* tg = CtxGetTriplets(ctx, &num_g);
+  std::vector<Triplet> triplets(tg, tg + num_g);
+
+  // C and b
+  std::vector<double> b_re(n, 0.0), b_im(n, 0.0);
+  CtxReset(ctx);
+  for (Device* d = c->devices; d; d = d->next) {
+    if (!d->vt || !d->vt->StampAc) continue;
+    d->vt->StampAc(d, ctx, x_op, b_re.data(), b_im.data());
+  }
+  size_t num_c;
+  const Triplet* tc = CtxGetTriplets(ctx, &num_c);
+  triplets.insert(triplets.end(), tc, tc + num_c);
+
+  sys->pattern = SparseCreateFromTriplets(n, triplets.data(), triplets.size());
+  int result = -1;
+  if (sys->pattern &&
+      AccumulateTriplets(sys->pattern, triplets.data(), num_g, &sys->g) == 0 &&
+      AccumulateTriplets(sys->pattern, triplets.data() + num_g, num_c,
+                         &sys->c) == 0) {
+    sys->ordering = SparseOrderingCompute(sys->pattern);
+    result = sys->ordering ? 0 : -1;
+  }
+  CtxFree(ctx);
+
+  sys->b.resize(n);
+  for (int i = 0; i < n; i++) sys->b[i] = {b_re[i], b_im[i]};
+  return result;
+}
+
+static void SolveAcPoint(void* user, int thread, int p) {
+  AcJob* job = static_cast<AcJob*>(user);
+  AcWorker& w = job->workers[thread];
+  const AcSystem* sys = job->sys;
+  int nnz = sys->pattern->nnz;
+
+  double omega = 2.0 * M_PI * AcSweepFrequency(job->ac, p);
+  for (int k = 0; k < nnz; k++) w.values[k] = {sys->g[k], omega * sys->c[k]};
+
+  // Reuse the pivot sequence of the previous point; pick new pivots when
+  // one of them has become too small
+  double start = PhaseStart(job->profile);
+  int result = -1;
+  if (w.factored) {
+    result = SparseComplexLuRefactor(w.lu, sys->pattern, w.values.data());
+    w.stats.factorizations++;
+  }
+  if (result != 0) {
+    result = SparseComplexLuFactor(w.lu, sys->pattern, w.values.data());
+    w.stats.factorizations++;
+  }
+  PhaseEnd(job->profile, &w.stats, kSimPhaseFactor, start);
+  w.factored = result == 0;
+  if (result != 0) {
+    fprintf(stderr, "AC analysis: singular matrix at %g Hz\n",
+            AcSweepFrequency(job->ac, p));
+    job->failed.store(1, std::memory_order_relaxed);
+    return;
+  }
+
+  start = PhaseStart(job->profile);
+  SparseComplexLuSolve(w.lu, sys->b.data(),
+                       job->results + (size_t)p * sys->pattern->n);
+  PhaseEnd(job->profile, &w.stats, kSimPhaseSolve, start);
+  w.stats.newton_iterations++;
+}
+
+}  // namespace
+
+// ============================================================================
+// AC Analysis API Implementation
+// ============================================================================
+
+int AcSweepNumPoints(const AcSpec* ac) {
+  if (!ac || ac->points <= 0 || !(ac->fstop >= ac->fstart)) return 0;
+
+  switch (ac->type) {
+    case kAcLinear:
+      return ac->fstart >= 0.0 ? ac->points : 0;
+    case kAcDecade:
+    case kAcOctave: {
+      if (!(ac->fstart > 0.0)) return 0;
+      double span = ac->type == kAcDecade ? log10(ac->fstop / ac->fstart)
+                                          : log2(ac->fstop / ac->fstart);
+      // The tolerance keeps fstop when the span is a whole number of steps
+      return (int)floor(span * ac->points + 1e-9) + 1;
+    }
+  }
+  return 0;
+}
+
+double AcSweepFrequency(const AcSpec* ac, int p) {
+  switch (ac->type) {
+    case kAcLinear:
+      if (ac->points <= 1) return ac->fstart;
+      return ac->fstart + (ac->fstop - ac->fstart) * p / (ac->points - 1);
+    case kAcOctave:
+      return ac->fstart * exp2((double)p / ac->points);
+    default:
+      return ac->fstart * pow(10.0, (double)p / ac->points);
+  }
+}
+
+int CircuitAcAnalysis(Circuit* c, ThreadPool* pool, const AcSpec* ac,
+                      const double* x_op, std::complex<double>* results,
+                      SimStats* stats) {
+  SimStatsClear(stats);
+  if (!c || !c->finalized || !ac || !x_op || !results) return -1;
+
+  int total = AcSweepNumPoints(ac);
+  if (total <= 0) {
+    fprintf(stderr, "AC analysis: invalid sweep specification\n");
+    return -1;
+  }
+
+  SimStats linearize;
+  SimStatsClear(&linearize);
+  double start = PhaseStart(c->profile);
+  AcSystem sys;
+  int result = LinearizeCircuit(c, x_op, &sys, &linearize);
+  PhaseEnd(c->profile, &linearize, kSimPhaseStamp, start);
+
+  AcJob job;
+  job.ac = ac;
+  job.sys = &sys;
+  job.results = results;
+  job.profile = c->profile;
+  job.workers.resize(pool ? ThreadPoolSize(pool) : 1);
+  for (AcWorker& w : job.workers) {
+    SimStatsClear(&w.stats);
+    if (result != 0) break;
+    w.lu = SparseComplexLuCreate(sys.pattern, sys.ordering);
+    if (!w.lu) {
+      result = -1;
+      break;
+    }
+    w.values.resize(sys.pattern->nnz);
+  }
+
+  if (result == 0) {
+    if (pool) {
+      ThreadPoolParallelFor(pool, total, SolveAcPoint, &job);
+    } else {
+      for (int p = 0; p < total; p++) SolveAcPoint(&job, 0, p);
+    }
+    result = job.failed.load() ? -1 : total;
+  }
+
+  if (stats) {
+    SimStatsAdd(stats, &linearize);
+    stats->num_vars = c->num_vars;
+    stats->sparse = 1;
+    stats->blocks = 1;
+    stats->matrix_nnz = sys.pattern ? sys.pattern->nnz : 0;
+  }
+  for (AcWorker& w : job.workers) {
+    if (stats) {
+      w.stats.lu_nnz = SparseComplexLuNnz(w.lu);
+      SimStatsAdd(stats, &w.stats);
+    }
+    SparseComplexLuFree(w.lu);
+  }
+  SparseOrderingFree(sys.ordering);
+  SparseFree(sys.pattern);
+  return result;
+}
+
+}  // namespace minispice
@@ -0,0 +1,51 @@
+// ac.h
+// AC small-signal analysis
+//
+// The circuit is linearized once at its DC operating point: the DC Jacobian
+// G, the capacitance matrix C of the charges and fluxes (DeviceVTable::
+// StampAc) and the phasors b of the sources' AC excitations are stamped
+// into value arrays over one sparse pattern, the union of the patterns of G
+// and C. Every frequency f then solves (G + j 2 pi f C) x = b with the
+// complex sparse LU. No device is stamped again after the linearization.
+//
+// The points are distributed over a ThreadPool. All workers share the
+// pattern and its column ordering; each refactors its own factors with the
+// pivot sequence of the last point it solved (SparseComplexLuRefactor), so
+// a sweep costs one numeric factorization per point.
+
+#ifndef MINI_SPICE_AC_H_
+#define MINI_SPICE_AC_H_
+
+#include <complex>
+
+#include "circuit.h"
+#include "sim_stats.h"
+#include "thread_pool.h"
+
+namespace minispice {
+
+// Number of frequencies of an AC sweep, from fstart to fstop inclusive;
+// 0 if the sweep is invalid (no points, fstop below fstart, or fstart not
+// positive for a logarithmic sweep)
+int AcSweepNumPoints(const AcSpec* ac);
+
+// Frequency of point p (0 <= p < AcSweepNumPoints) in Hz
+double AcSweepFrequency(const AcSpec* ac, int p);
+
+// Perform an AC sweep of a finalized circuit linearized at the DC operating
+// point x_op (length num_vars, e.g., from CircuitDcAnalysis). results must
+// hold AcSweepNumPoints * num_vars values; the solution phasors of point p
+// are stored at results + p * num_vars. pool may be nullptr to solve every
+// point on the calling thread. Apart from the evaluation caches of the
+// nonlinear devices (refreshed at x_op) the circuit is not modified. stats
+// may be nullptr; otherwise it receives the statistics of the sweep (the
+// linearization stamps and the factorizations of all workers).
+// Returns the number of points, or -1 on error (invalid sweep, the matrix
+// is singular at some frequency, allocation failure).
+int CircuitAcAnalysis(Circuit* c, ThreadPool* pool, const AcSpec* ac,
+                      const double* x_op, std::complex<double>* results,
+                      SimStats* stats);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_AC_H_
@@ -0,0 +1,220 @@
+// ac_test.cc
+// Unit tests for the AC small-signal analysis
+
+#include "ac.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#include "device.h"
+#include "parser.h"
+
+using namespace minispice;
+
+typedef std::complex<double> Complex;
+
+// Run the circuit's .AC sweep at its DC operating point
+static int RunAc(Circuit* c, ThreadPool* pool, std::vector<Complex>* results,
+                 SimStats* stats) {
+  std::vector<double> x_op(c->num_vars, 0.0);
+  if (CircuitDcAnalysis(c, x_op.data(), 100, 1e-12, 1e-9) < 0) return -1;
+  results->assign((size_t)AcSweepNumPoints(&c->ac) * c->num_vars, 0.0);
+  return CircuitAcAnalysis(c, pool, &c->ac, x_op.data(), results->data(),
+                           stats);
+}
+
+static Complex NodePhasor(Circuit* c, const std::vector<Complex>& results,
+                          int p, const char* node) {
+  return results[(size_t)p * c->num_vars +
+                 c->nodes[CircuitGetNode(c, node)].var_index];
+}
+
+TEST(AcSweepTest, NumPointsAndFrequencies) {
+  AcSpec dec = {kAcDecade, 10, 1.0, 1e6};
+  EXPECT_EQ(AcSweepNumPoints(&dec), 61);
+  EXPECT_DOUBLE_EQ(AcSweepFrequency(&dec, 0), 1.0);
+  EXPECT_NEAR(AcSweepFrequency(&dec, 60), 1e6, 1e-6);
+  EXPECT_NEAR(AcSweepFrequency(&dec, 10), 10.0, 1e-12);
+
+  AcSpec oct = {kAcOctave, 2, 1.0, 8.0};
+  EXPECT_EQ(AcSweepNumPoints(&oct), 7);
+  EXPECT_NEAR(AcSweepFrequency(&oct, 1), sqrt(2.0), 1e-12);
+
+  AcSpec lin = {kAcLinear, 5, 1.0, 5.0};
+  EXPECT_EQ(AcSweepNumPoints(&lin), 5);
+  EXPECT_DOUBLE_EQ(AcSweepFrequency(&lin, 3), 4.0);
+
+  AcSpec bad = {kAcDecade, 10, 0.0, 1e3};
+  EXPECT_EQ(AcSweepNumPoints(&bad), 0);
+  bad = {kAcLinear, 10, 1e3, 1.0};
+  EXPECT_EQ(AcSweepNumPoints(&bad), 0);
+  bad = {kAcLinear, 0, 1.0, 1e3};
+  EXPECT_EQ(AcSweepNumPoints(&bad), 0);
+}
+
+TEST(AcParserTest, DirectiveAndSourceExcitation) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 DC 2 AC 1 45\nI1 0 out PULSE(0 1m 0 1n 1n 1u 2u) AC 3m\n"
+      "R1 in out 1k\nR2 out 0 1k\n.AC OCT 4 10 40\n");
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(c->ac.type, kAcOctave);
+  EXPECT_EQ(c->ac.points, 4);
+  EXPECT_DOUBLE_EQ(c->ac.fstart, 10.0);
+  EXPECT_DOUBLE_EQ(c->ac.fstop, 40.0);
+
+  double v = 0.0;
+  ASSERT_EQ(DeviceGetValue(CircuitFindDevice(c, "V1"), &v), 0);
+  EXPECT_DOUBLE_EQ(v, 2.0);
+
+  // V(out) = V1 / 2 + I1 * 500 ohms
+  std::vector<Complex> results;
+  ASSERT_EQ(RunAc(c, nullptr, &results, nullptr), 9);
+  Complex expected = 0.5 * std::polar(1.0, M_PI / 4.0) + 1.5;
+  EXPECT_LT(std::abs(NodePhasor(c, results, 0, "out") - expected), 1e-12);
+  circuit_free(c);
+
+  // An invalid .AC line leaves the circuit without an AC sweep
+  c = parse_netlist_string("V1 in 0 AC 1\nR1 in 0 1k\n.AC FOO 10 1 1k\n");
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(c->ac.points, 0);
+  circuit_free(c);
+}
+
+TEST(AcAnalysisTest, RcLowPass) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 DC 1 AC 1\nR1 in out 1k\nC1 out 0 1u\n.AC DEC 10 1 1Meg\n");
+  ASSERT_NE(c, nullptr);
+
+  std::vector<Complex> results;
+  SimStats stats;
+  int points = RunAc(c, nullptr, &results, &stats);
+  ASSERT_EQ(points, 61);
+
+  for (int p = 0; p < points; p++) {
+    double omega = 2.0 * M_PI * AcSweepFrequency(&c->ac, p);
+    Complex expected = 1.0 / Complex(1.0, omega * 1e-3);
+    EXPECT_LT(std::abs(NodePhasor(c, results, p, "out") - expected), 1e-9)
+        << "point " << p;
+    EXPECT_LT(std::abs(NodePhasor(c, results, p, "in") - 1.0), 1e-12);
+  }
+
+  // One linearization and one numeric factorization per frequency
+  EXPECT_EQ(stats.factorizations, points);
+  EXPECT_EQ(stats.newton_iterations, points);
+  long stamps = 0;
+  for (int k = 0; k < kNumDeviceTypes; k++) stamps += stats.device_stamps[k];
+  EXPECT_EQ(stamps, c->num_devices);
+  EXPECT_EQ(stats.num_vars, c->num_vars);
+  EXPECT_EQ(stats.sparse, 1);
+
+  circuit_free(c);
+}
+
+TEST(AcAnalysisTest, InductorAndPhasedCurrentSource) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 AC 1\nR1 in out 1k\nL1 out 0 10m\n"
+      "I1 0 b AC 2m 90\nR2 b 0 1k\n.AC LIN 5 1k 100k\n");
+  ASSERT_NE(c, nullptr);
+
+  std::vector<Complex> results;
+  int points = RunAc(c, nullptr, &results, nullptr);
+  ASSERT_EQ(points, 5);
+
+  Device* l1 = CircuitFindDevice(c, "L1");
+  for (int p = 0; p < points; p++) {
+    double omega = 2.0 * M_PI * AcSweepFrequency(&c->ac, p);
+    Complex zl(0.0, omega * 10e-3);
+    EXPECT_LT(std::abs(NodePhasor(c, results, p, "out") - zl / (1e3 + zl)),
+              1e-9);
+    EXPECT_LT(std::abs(results[(size_t)p * c->num_vars + l1->extra_var] -
+                       1.0 / (1e3 + zl)),
+              1e-12);
+    // I1 drives 2 mA at 90 degrees into b
+    EXPECT_LT(std::abs(NodePhasor(c, results, p, "b") - Complex(0.0, 2.0)),
+              1e-9);
+  }
+
+  circuit_free(c);
+}
+
+TEST(AcAnalysisTest, MosfetGainMatchesDcDerivative) {
+  static const char* kNetlist =
+      "VDD vdd 0 3\nVIN g 0 DC 1 AC 1\nRD vdd out 10k\n"
+      "M1 out g 0 0 W=10u L=1u\nCL out 0 1p\n.AC DEC 5 1 10G\n";
+  Circuit* c = parse_netlist_string(kNetlist);
+  ASSERT_NE(c, nullptr);
+
+  std::vector<Complex> results;
+  int points = RunAc(c, nullptr, &results, nullptr);
+  ASSERT_GT(points, 0);
+
+  // The low-frequency gain is the derivative of the DC transfer curve
+  Device* vin = CircuitFindDevice(c, "VIN");
+  int out = c->nodes[CircuitGetNode(c, "out")].var_index;
+  std::vector<double> x(c->num_vars, 0.0);
+  const double dv = 1e-5;
+  ASSERT_EQ(DeviceSetValue(vin, 1.0 + dv), 0);
+  ASSERT_GE(CircuitDcAnalysis(c, x.data(), 100, 1e-14, 1e-12), 0);
+  double v_hi = x[out];
+  ASSERT_EQ(DeviceSetValue(vin, 1.0 - dv), 0);
+  ASSERT_GE(CircuitDcAnalysis(c, x.data(), 100, 1e-14, 1e-12), 0);
+  double gain = (v_hi - x[out]) / (2.0 * dv);
+  ASSERT_GT(std::abs(gain), 0.1);
+
+  Complex low = NodePhasor(c, results, 0, "out");
+  EXPECT_NEAR(low.real(), gain, 1e-4 * std::abs(gain));
+  EXPECT_LT(std::abs(low.imag()), 1e-4 * std::abs(gain));
+
+  // The load and device capacitances shape the response at high frequency
+  EXPECT_GT(std::abs(NodePhasor(c, results, points - 1, "out") - low),
+            0.1 * std::abs(gain));
+
+  circuit_free(c);
+}
+
+TEST(AcAnalysisTest, ThreadedMatchesSerial) {
+  Circuit* c = parse_netlist_string(
+      "VDD vdd 0 3\nVIN g 0 DC 1 AC 1\nRD vdd out 10k\nRG g g2 1k\n"
+      "M1 out g2 0 0 W=10u L=1u\nCL out 0 1p\nL1 vdd d2 1u\nC2 d2 0 1n\n"
+      ".AC DEC 20 1 10G\n");
+  ASSERT_NE(c, nullptr);
+
+  std::vector<Complex> serial, threaded;
+  SimStats serial_stats, threaded_stats;
+  int points = RunAc(c, nullptr, &serial, &serial_stats);
+  ASSERT_GT(points, 0);
+
+  ThreadPool* pool = ThreadPoolCreate(4);
+  ASSERT_NE(pool, nullptr);
+  ASSERT_EQ(RunAc(c, pool, &threaded, &threaded_stats), points);
+  ThreadPoolFree(pool);
+
+  ASSERT_EQ(serial.size(), threaded.size());
+  for (size_t k = 0; k < serial.size(); k++) {
+    EXPECT_LT(std::abs(serial[k] - threaded[k]),
+              1e-12 * (1.0 + std::abs(serial[k])));
+  }
+  EXPECT_GE(threaded_stats.factorizations, points);
+  EXPECT_EQ(threaded_stats.matrix_nnz, serial_stats.matrix_nnz);
+
+  circuit_free(c);
+}
+
+TEST(AcAnalysisTest, InvalidArguments) {
+  Circuit* c = parse_netlist_string("V1 in 0 AC 1\nR1 in 0 1k\n");
+  ASSERT_NE(c, nullptr);
+  std::vector<double> x_op(c->num_vars, 0.0);
+  std::vector<Complex> results(c->num_vars);
+
+  AcSpec bad = {kAcDecade, 10, 0.0, 1e3};
+  EXPECT_EQ(CircuitAcAnalysis(c, nullptr, &bad, x_op.data(), results.data(),
+                              nullptr),
+            -1);
+  EXPECT_EQ(CircuitAcAnalysis(c, nullptr, nullptr, x_op.data(),
+                              results.data(), nullptr),
+            -1);
+  circuit_free(c);
+}
@@ -0,0 +1,483 @@
+// Block triangular form implementation
+//
+// The permuted matrix keeps the blocks contiguous: position t holds row
+// row_perm[t] and column col_perm[t] of A, and block k covers the positions
+// [start, start + size). Each block owns a CSC copy of its entries (local
+// indices) with the position in A of every entry, and its off-diagonal
+// entries row by row, so factoring and solving a block touch nothing that
+// another block of the same level writes.
+//
+
+#include "btf.h"
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "sparse.h"
+#include "stamp.h"
+#include "thread_pool.h"
+
+namespace minispice {
+
+struct BtfBlock {
+  int start;  // First position of the block
+  int size;
+
+  SparseMatrix* matrix;     // Diagonal block, local indices
+  SparseLu* lu;
+  std::vector<int> source;  // A->values position of every matrix entry
+
+  // Off-diagonal entries of the block's rows (CSR over the local rows):
+  // column position and A->values position, and the values of the last
+  // factorization
+  std::vector<int> off_ptr;
+  std::vector<int> off_col;
+  std::vector<int> off_source;
+  std::vector<double> off_values;
+
+  int result;  // Factorization result of the last SparseBtfFactor
+};
+
+struct SparseBtf {
+  int n;
+  int nnz;  // Entries of the pattern of creation
+  std::vector<int> row_perm;
+  std::vector<int> col_perm;
+  std::vector<BtfBlock> blocks;  // In solve order
+
+  // Blocks grouped by level: level l holds the blocks
+  // level_blocks[level_ptr[l] .. level_ptr[l + 1]), with level_nnz[l]
+  // matrix entries in total
+  std::vector<int> level_ptr;
+  std::vector<int> level_blocks;
+  std::vector<long> level_nnz;
+
+  // Solve scratch in position order: right-hand side and solution
+  std::vector<double> rhs;
+  std::vector<double> x;
+
+  bool factored;
+};
+
+namespace {
+
+// Maximum transversal: q[i] receives a column of A with a structural
+// nonzero in row i, every column used once. Each column searches for an
+// unmatched row, first among its own rows, then depth-first through the
+// columns of the matched rows it contains (augmenting path), with an
+// explicit stack.
+// Returns false if A is structurally singular.
+static bool MaxTransversal(const SparseMatrix* A, std::vector<int>* q) {
+  int n = A->n;
+  const int* col_ptr = A->col_ptr;
+  const int* row_idx = A->row_idx;
+  std::vector<int>& row_match = *q;  // Column matched to each row
+  row_match.assign(n, -1);
+  std::vector<int> cheap(col_ptr, col_ptr + n);  // Next row to try first
+  std::vector<int> visited(n, -1);  // Last search that visited the column
+  std::vector<int> cols(n);
+  std::vector<int> pos(n);
+
+  for (int k = 0; k < n; k++) {
+    int top = 0;
+    int found = -1;
+    cols[0] = k;
+    while (top >= 0) {
+      int j = cols[top];
+      int end = col_ptr[j + 1];
+      if (visited[j] != k) {
+        visited[j] = k;
+        // Rows before cheap[j] were matched when they were tried and stay
+        // matched
+        for (int p = cheap[j]; p < end; p++) {
+          if (row_match[row_idx[p]] < 0) {
+            found = row_idx[p];
+            cheap[j] = p + 1;
+            break;
+          }
+        }
+        if (found >= 0) break;
+        cheap[j] = end;
+        pos[top] = col_ptr[j];
+      }
+
+      int p = pos[top];
+      while (p < end && visited[row_match[row_idx[p]]] == k) p++;
+      if (p < end) {
+        pos[top] = p + 1;
+        cols[++top] = row_match[row_idx[p]];
+      } else {
+        top--;
+      }
+    }
+    if (found < 0) return false;
+
+    // Flip the path: the found row goes to the top column, and so on down
+    // the stack to column k
+    int i = found;
+    for (int t = top; t >= 0; t--) {
+      row_match[i] = cols[t];
+      if (t > 0) i = row_idx[pos[t - 1] - 1];
+    }
+  }
+  return true;
+}
+
+// Strongly connected components (Tarjan, iterative) of the graph of the
+// column-permuted matrix B = A(:, q): an edge from j to every row i of
+// column q[j]. comp[j] receives the component of j; a component is
+// numbered after every component reachable from it.
+// Returns the number of components.
+static int StrongComponents(const SparseMatrix* A, const std::vector<int>& q,
+                            std::vector<int>* comp) {
+  int n = A->n;
+  const int* col_ptr = A->col_ptr;
+  const int* row_idx = A->row_idx;
+  std::vector<int> index(n, -1);
+  std::vector<int> low(n);
+  std::vector<char> on_stack(n, 0);
+  std::vector<int> stack;
+  std::vector<int> calls(n);
+  std::vector<int> edge(n);
+  stack.reserve(n);
+  comp->assign(n, -1);
+
+  int counter = 0;
+  int num_comps = 0;
+  for (int s = 0; s < n; s++) {
+    if (index[s] >= 0) continue;
+    int top = 0;
+    calls[0] = s;
+    edge[0] = col_ptr[q[s]];
+    index[s] = low[s] = counter++;
+    stack.push_back(s);
+    on_stack[s] = 1;
+
+    while (top >= 0) {
+      int v = calls[top];
+      if (edge[top] < col_ptr[q[v] + 1]) {
+        int w = row_idx[edge[top]++];
+        if (index[w] < 0) {
+          index[w] = low[w] = counter++;
+          stack.push_back(w);
+          on_stack[w] = 1;
+          calls[++top] = w;
+          edge[top] = col_ptr[q[w]];
+        } else if (on_stack[w]) {
+          low[v] = std::min(low[v], index[w]);
+        }
+        continue;
+      }
+
+      if (low[v] == index[v]) {
+        int w;
+        do {
+          w = stack.back();
+          stack.pop_back();
+          on_stack[w] = 0;
+          (*comp)[w] = num_comps;
+        } while (w != v);
+        num_comps++;
+      }
+      if (--top >= 0) {
+        int u = calls[top];
+        low[u] = std::min(low[u], low[v]);
+      }
+    }
+  }
+  return num_comps;
+}
+
+// Split the entries of A into the diagonal blocks and their off-diagonal
+// rows, given the block of every position (pos_block) and the position of
+// every row (row_pos) and column (col_pos) of A
+static bool BuildBlocks(SparseBtf* btf, const SparseMatrix* A,
+                        const std::vector<int>& row_pos,
+                        const std::vector<int>& col_pos,
+                        const std::vector<int>& pos_block) {
+  int num_blocks = (int)btf->blocks.size();
+  std::vector<std::vector<Triplet>> triplets(num_blocks);
+  std::vector<std::vector<int>> sources(num_blocks);
+
+  for (BtfBlock& blk : btf->blocks) blk.off_ptr.assign(blk.size + 1, 0);
+  for (int c = 0; c < A->n; c++) {
+    int u = col_pos[c];
+    for (int p = A->col_ptr[c]; p < A->col_ptr[c + 1]; p++) {
+      int t = row_pos[A->row_idx[p]];
+      int k = pos_block[t];
+      BtfBlock& blk = btf->blocks[k];
+      if (pos_block[u] == k) {
+        triplets[k].push_back({t - blk.start, u - blk.start, 0.0});
+        sources[k].push_back(p);
+      } else {
+        blk.off_ptr[t - blk.start + 1]++;
+      }
+    }
+  }
+
+  for (BtfBlock& blk : btf->blocks) {
+    for (int r = 0; r < blk.size; r++) blk.off_ptr[r + 1] += blk.off_ptr[r];
+    blk.off_col.resize(blk.off_ptr[blk.size]);
+    blk.off_source.resize(blk.off_ptr[blk.size]);
+    blk.off_values.assign(blk.off_ptr[blk.size], 0.0);
+  }
+  std::vector<int> next(btf->n);
+  for (BtfBlock& blk : btf->blocks) {
+    for (int r = 0; r < blk.size; r++) next[blk.start + r] = blk.off_ptr[r];
+  }
+  for (int c = 0; c < A->n; c++) {
+    int u = col_pos[c];
+    for (int p = A->col_ptr[c]; p < A->col_ptr[c + 1]; p++) {
+      int t = row_pos[A->row_idx[p]];
+      BtfBlock& blk = btf->blocks[pos_block[t]];
+      if (pos_block[u] == pos_block[t]) continue;
+      int e = next[t]++;
+      blk.off_col[e] = u;
+      blk.off_source[e] = p;
+    }
+  }
+
+  // Block matrices, with the A position of every (merged, column-sorted)
+  // entry found through its slot
+  for (int k = 0; k < num_blocks; k++) {
+    BtfBlock& blk = btf->blocks[k];
+    const std::vector<Triplet>& tr = triplets[k];
+    blk.matrix = SparseCreateFromTriplets(blk.size, tr.data(), tr.size());
+    if (!blk.matrix) return false;
+    std::vector<int> slots(tr.size());
+    if (SparseFindSlots(blk.matrix, tr.data(), tr.size(), slots.data()) != 0) {
+      return false;
+    }
+    blk.source.assign(blk.matrix->nnz, 0);
+    for (size_t e = 0; e < tr.size(); e++) blk.source[slots[e]] = sources[k][e];
+    blk.lu = SparseLuCreate(blk.matrix);
+    if (!blk.lu) return false;
+  }
+  return true;
+}
+
+// Group the blocks into levels: a block is one level above the highest
+// block its off-diagonal entries refer to
+static void BuildLevels(SparseBtf* btf, const std::vector<int>& pos_block) {
+  int num_blocks = (int)btf->blocks.size();
+  std::vector<int> level(num_blocks, 0);
+  int num_levels = 0;
+  for (int k = 0; k < num_blocks; k++) {
+    const BtfBlock& blk = btf->blocks[k];
+    for (int col : blk.off_col) {
+      level[k] = std::max(level[k], level[pos_block[col]] + 1);
+    }
+    num_levels = std::max(num_levels, level[k] + 1);
+  }
+
+  btf->level_ptr.assign(num_levels + 1, 0);
+  btf->level_nnz.assign(num_levels, 0);
+  for (int k = 0; k < num_blocks; k++) {
+    btf->level_ptr[level[k] + 1]++;
+    btf->level_nnz[level[k]] +=
+        btf->blocks[k].matrix->nnz + (long)btf->blocks[k].off_col.size();
+  }
+  for (int l = 0; l < num_levels; l++) {
+    btf->level_ptr[l + 1] += btf->level_ptr[l];
+  }
+  btf->level_blocks.resize(num_blocks);
+  std::vector<int> next(btf->level_ptr.begin(), btf->level_ptr.end() - 1);
+  for (int k = 0; k < num_blocks; k++) {
+    btf->level_blocks[next[level[k]]++] = k;
+  }
+}
+
+// Gather the values of a block and factor it
+static void FactorBlock(BtfBlock* blk, const SparseMatrix* A) {
+  for (int e = 0; e < blk->matrix->nnz; e++) {
+    blk->matrix->values[e] = A->values[blk->source[e]];
+  }
+  for (size_t e = 0; e < blk->off_source.size(); e++) {
+    blk->off_values[e] = A->values[blk->off_source[e]];
+  }
+  blk->result = SparseLuRefactor(blk->lu, blk->matrix);
+  if (blk->result != 0) blk->result = SparseLuFactor(blk->lu, blk->matrix);
+}
+
+// Subtract the solved variables of earlier blocks from the block's
+// right-hand side and solve it
+static void SolveBlock(SparseBtf* btf, BtfBlock* blk, const double* b) {
+  double* rhs = btf->rhs.data() + blk->start;
+  const double* x = btf->x.data();
+  for (int r = 0; r < blk->size; r++) {
+    double sum = b[btf->row_perm[blk->start + r]];
+    for (int e = blk->off_ptr[r]; e < blk->off_ptr[r + 1]; e++) {
+      sum -= blk->off_values[e] * x[blk->off_col[e]];
+    }
+    rhs[r] = sum;
+  }
+  SparseLuSolve(blk->lu, rhs, btf->x.data() + blk->start);
+}
+
+// Parallel loop bodies over the blocks of one level
+struct LevelTask {
+  SparseBtf* btf;
+  int level;
+  const SparseMatrix* A;  // Factor
+  const double* b;        // Solve
+};
+
+static void FactorTask(void* user, int thread, int index) {
+  (void)thread;
+  LevelTask* task = static_cast<LevelTask*>(user);
+  SparseBtf* btf = task->btf;
+  int k = btf->level_blocks[btf->level_ptr[task->level] + index];
+  FactorBlock(&btf->blocks[k], task->A);
+}
+
+static void SolveTask(void* user, int thread, int index) {
+  (void)thread;
+  LevelTask* task = static_cast<LevelTask*>(user);
+  SparseBtf* btf = task->btf;
+  int k = btf->level_blocks[btf->level_ptr[task->level] + index];
+  SolveBlock(btf, &btf->blocks[k], task->b);
+}
+
+// Run fn over the blocks of every level in order, in parallel where the
+// level is large enough
+static void ForEachLevel(SparseBtf* btf, ThreadPool* pool, ParallelForFn fn,
+                         LevelTask* task) {
+  int num_levels = (int)btf->level_nnz.size();
+  for (int l = 0; l < num_levels; l++) {
+    task->level = l;
+    int count = btf->level_ptr[l + 1] - btf->level_ptr[l];
+    if (pool && count > 1 && btf->level_nnz[l] >= kSparseBtfParallelMinNnz) {
+      ThreadPoolParallelFor(pool, count, fn, task);
+    } else {
+      for (int i = 0; i < count; i++) fn(task, 0, i);
+    }
+  }
+}
+
+}  // namespace
+
+// ============================================================================
+// SparseBtf API Implementation
+// ============================================================================
+
+SparseBtf* SparseBtfCreate(const SparseMatrix* A, int max_block) {
+  if (!A || A->n <= 0) return nullptr;
+
+  SparseBtf* btf = new (std::nothrow) SparseBtf;
+  if (!btf) return nullptr;
+  int n = A->n;
+  btf->n = n;
+  btf->nnz = A->nnz;
+  btf->factored = false;
+  bool ok = false;
+  try {
+    std::vector<int> q;
+    std::vector<int> comp;
+    if (MaxTransversal(A, &q)) {
+      int num_blocks = StrongComponents(A, q, &comp);
+
+      // Solve order is the reverse of the numbering: positions by block
+      std::vector<int> start(num_blocks + 1, 0);
+      for (int j = 0; j < n; j++) start[num_blocks - comp[j]]++;
+      for (int k = 0; k < num_blocks; k++) start[k + 1] += start[k];
+      btf->blocks.resize(num_blocks);
+      bool small = true;
+      for (int k = 0; k < num_blocks; k++) {
+        BtfBlock& blk = btf->blocks[k];
+        blk.start = start[k];
+        blk.size = start[k + 1] - start[k];
+        blk.matrix = nullptr;
+        blk.lu = nullptr;
+        blk.result = -1;
+        if (blk.size > max_block) small = false;
+      }
+
+      if (small) {
+        btf->row_perm.resize(n);
+        btf->col_perm.resize(n);
+        std::vector<int> row_pos(n);
+        std::vector<int> col_pos(n);
+        std::vector<int> pos_block(n);
+        for (int j = 0; j < n; j++) {
+          int k = num_blocks - 1 - comp[j];
+          int t = start[k]++;
+          btf->row_perm[t] = j;
+          btf->col_perm[t] = q[j];
+          row_pos[j] = t;
+          col_pos[q[j]] = t;
+          pos_block[t] = k;
+        }
+
+        if (BuildBlocks(btf, A, row_pos, col_pos, pos_block)) {
+          BuildLevels(btf, pos_block);
+          btf->rhs.assign(n, 0.0);
+          btf->x.assign(n, 0.0);
+          ok = true;
+        }
+      }
+    }
+  } catch (...) {
+    ok = false;
+  }
+  if (!ok) {
+    SparseBtfFree(btf);
+    return nullptr;
+  }
+  return btf;
+}
+
+void SparseBtfFree(SparseBtf* btf) {
+  if (!btf) return;
+  for (BtfBlock& blk : btf->blocks) {
+    SparseLuFree(blk.lu);
+    SparseFree(blk.matrix);
+  }
+  delete btf;
+}
+
+int SparseBtfNumBlocks(const SparseBtf* btf) {
+  return btf ? (int)btf->blocks.size() : 0;
+}
+
+int SparseBtfMaxBlockSize(const SparseBtf* btf) {
+  int size = 0;
+  if (btf) {
+    for (const BtfBlock& blk : btf->blocks) size = std::max(size, blk.size);
+  }
+  return size;
+}
+
+int SparseBtfFactor(SparseBtf* btf, const SparseMatrix* A, ThreadPool* pool) {
+  if (!btf || !A || A->n != btf->n || A->nnz != btf->nnz) return -2;
+
+  btf->factored = false;
+  LevelTask task = {btf, 0, A, nullptr};
+  ForEachLevel(btf, pool, FactorTask, &task);
+  for (const BtfBlock& blk : btf->blocks) {
+    if (blk.result != 0) return -2;
+  }
+  btf->factored = true;
+  return 0;
+}
+
+int SparseBtfSolve(SparseBtf* btf, const double* b, double* x,
+                   ThreadPool* pool) {
+  if (!btf || !btf->factored || !b || !x) return -1;
+
+  LevelTask task = {btf, 0, nullptr, b};
+  ForEachLevel(btf, pool, SolveTask, &task);
+  for (int t = 0; t < btf->n; t++) x[btf->col_perm[t]] = btf->x[t];
+  return 0;
+}
+
+int SparseBtfNnz(const SparseBtf* btf) {
+  if (!btf) return 0;
+  int nnz = 0;
+  for (const BtfBlock& blk : btf->blocks) {
+    nnz += SparseLuNnz(blk.lu) + (int)blk.off_col.size();
+  }
+  return nnz;
+}
+
+}  // namespace minispice
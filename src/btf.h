@@ -0,0 +1,82 @@
+// btf.h
+// Block triangular form of sparse MNA matrices and block-wise LU solves
+//
+// Netlists made of disconnected or one-way coupled sub-networks (stages
+// driven through MOSFET gates, independent nets sharing only the ground)
+// give MNA matrices that are reducible: some permutation of their rows and
+// columns is block lower triangular. SparseBtfCreate finds that form:
+//
+//   1. A maximum transversal (depth-first augmenting paths) permutes the
+//      columns so the diagonal has no structural zeros; it matches, e.g.,
+//      the zero-diagonal branch row of a voltage source with a node column.
+//   2. The strongly connected components of the graph of the permuted
+//      matrix (Tarjan) are the diagonal blocks, in an order where every
+//      block depends only on the blocks before it.
+//
+// Only the diagonal blocks are factored, each with its own sparse LU and
+// minimum-degree ordering, so the factors of small blocks stay in cache and
+// no fill-in crosses a block boundary. The solve runs the blocks in order,
+// subtracting the off-diagonal entries of the variables already solved.
+//
+// Blocks are grouped into levels: a block's level is one more than the
+// highest level it depends on. The blocks of a level are independent and,
+// given a thread pool, are factored and solved in parallel; disconnected
+// sub-networks all fall into level 0.
+
+#ifndef MINI_SPICE_BTF_H_
+#define MINI_SPICE_BTF_H_
+
+namespace minispice {
+
+struct SparseMatrix;
+struct ThreadPool;
+
+// Levels below this many matrix entries are factored and solved on the
+// calling thread: waking the pool costs more than their work
+constexpr int kSparseBtfParallelMinNnz = 20000;
+
+// The analysis workspaces factor by blocks only when the largest block holds
+// at most this fraction of the variables. A form that only splits off a few
+// small blocks (e.g., the branch rows of grounded voltage sources) saves
+// the single LU almost nothing.
+constexpr double kSparseBtfMaxBlockFraction = 0.75;
+
+// Opaque block triangular decomposition with the factors of its blocks
+struct SparseBtf;
+
+// Compute the block triangular form of the pattern of A and create the
+// factorization objects of its diagonal blocks, unless a block has more
+// than max_block rows (A->n for no limit).
+// Returns nullptr if A is structurally singular (no zero-free diagonal
+// exists), if a block is too large, or on allocation failure.
+SparseBtf* SparseBtfCreate(const SparseMatrix* A, int max_block);
+
+// Free a decomposition and the factors of its blocks
+void SparseBtfFree(SparseBtf* btf);
+
+// Number of diagonal blocks (1 if A is irreducible)
+int SparseBtfNumBlocks(const SparseBtf* btf);
+
+// Dimension of the largest diagonal block
+int SparseBtfMaxBlockSize(const SparseBtf* btf);
+
+// Numerically factor the diagonal blocks of A (same pattern as the matrix
+// given to SparseBtfCreate), reusing each block's pivot sequence when its
+// pivots stay acceptable. pool may be nullptr to factor on the calling
+// thread.
+// Returns 0 on success, -2 if a block is singular.
+int SparseBtfFactor(SparseBtf* btf, const SparseMatrix* A, ThreadPool* pool);
+
+// Solve A * x = b with the last successful factorization. b and x are
+// length n and may not alias. pool may be nullptr.
+// Returns 0 on success, -1 if there is no valid factorization.
+int SparseBtfSolve(SparseBtf* btf, const double* b, double* x,
+                   ThreadPool* pool);
+
+// Stored entries of the block factors (see SparseLuNnz) plus the
+// off-diagonal entries kept for the solve
+int SparseBtfNnz(const SparseBtf* btf);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_BTF_H_
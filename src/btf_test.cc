@@ -0,0 +1,214 @@
+// btf_test.cc
+// Unit tests for the block triangular form and its use by the analysis
+// workspace
+
+#include "btf.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "circuit.h"
+#include "parser.h"
+#include "sparse.h"
+#include "thread_pool.h"
+#include "workspace.h"
+
+using namespace minispice;
+
+// num_nets resistor chains of k nodes with an MNA voltage source at the
+// head of each (zero diagonal on its branch row), every chain after the
+// first driven one-way from the last node of the previous one (a
+// transconductance) if coupled. The source splits its net into three
+// blocks: its branch row fixes the head voltage, the other nodes follow,
+// and the head row then gives the branch current.
+static SparseMatrix* ChainsMatrix(int num_nets, int k, bool coupled) {
+  std::vector<Triplet> t;
+  int per_net = k + 1;
+  for (int net = 0; net < num_nets; net++) {
+    int base = net * per_net;
+    int branch = base + k;
+    for (int i = 0; i < k; i++) {
+      int node = base + i;
+      t.push_back({node, node, 1e-3 * (1 + i % 3)});
+      if (i + 1 < k) {
+        t.push_back({node, node, 1.0});
+        t.push_back({node + 1, node + 1, 1.0});
+        t.push_back({node, node + 1, -1.0});
+        t.push_back({node + 1, node, -1.0});
+      }
+    }
+    t.push_back({base, branch, 1.0});
+    t.push_back({branch, base, 1.0});
+    if (coupled && net > 0) t.push_back({base + 1, base - 2, 0.5});
+  }
+  return SparseCreateFromTriplets(num_nets * per_net, t.data(), t.size());
+}
+
+static std::vector<double> Multiply(const SparseMatrix* A,
+                                    const std::vector<double>& x) {
+  std::vector<double> y(A->n, 0.0);
+  for (int j = 0; j < A->n; j++) {
+    for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+      y[A->row_idx[p]] += A->values[p] * x[j];
+    }
+  }
+  return y;
+}
+
+TEST(SparseBtfTest, SolvesIndependentAndChainedBlocks) {
+  for (bool coupled : {false, true}) {
+    SparseMatrix* A = ChainsMatrix(8, 40, coupled);
+    ASSERT_NE(A, nullptr);
+    int n = A->n;
+    SparseBtf* btf = SparseBtfCreate(A, A->n);
+    ASSERT_NE(btf, nullptr);
+    EXPECT_EQ(SparseBtfNumBlocks(btf), 3 * 8);
+    EXPECT_EQ(SparseBtfMaxBlockSize(btf), 39);
+
+    std::vector<double> expected(n);
+    for (int i = 0; i < n; i++) expected[i] = sin(0.37 * i) + 0.1 * i;
+    std::vector<double> b = Multiply(A, expected);
+    std::vector<double> x(n, 0.0);
+    EXPECT_EQ(SparseBtfSolve(btf, b.data(), x.data(), nullptr), -1);
+    ASSERT_EQ(SparseBtfFactor(btf, A, nullptr), 0);
+    ASSERT_EQ(SparseBtfSolve(btf, b.data(), x.data(), nullptr), 0);
+    for (int i = 0; i < n; i++) EXPECT_NEAR(x[i], expected[i], 1e-9);
+
+    // New values on the same pattern, refactored reusing the pivots
+    for (int p = 0; p < A->nnz; p++) A->values[p] *= 2.0;
+    ASSERT_EQ(SparseBtfFactor(btf, A, nullptr), 0);
+    ASSERT_EQ(SparseBtfSolve(btf, b.data(), x.data(), nullptr), 0);
+    for (int i = 0; i < n; i++) EXPECT_NEAR(x[i], 0.5 * expected[i], 1e-9);
+    EXPECT_GE(SparseBtfNnz(btf), A->nnz);
+
+    SparseBtfFree(btf);
+    SparseFree(A);
+  }
+}
+
+TEST(SparseBtfTest, ParallelLevelsMatchSerial) {
+  // Large enough blocks for the levels to run on the pool
+  SparseMatrix* A = ChainsMatrix(16, 2000, false);
+  ASSERT_NE(A, nullptr);
+  int n = A->n;
+  ThreadPool* pool = ThreadPoolCreate(4);
+  ASSERT_NE(pool, nullptr);
+  SparseBtf* serial = SparseBtfCreate(A, A->n);
+  SparseBtf* parallel = SparseBtfCreate(A, A->n);
+  ASSERT_NE(serial, nullptr);
+  ASSERT_NE(parallel, nullptr);
+
+  std::vector<double> b(n);
+  for (int i = 0; i < n; i++) b[i] = cos(0.11 * i);
+  std::vector<double> x(n), y(n);
+  ASSERT_EQ(SparseBtfFactor(serial, A, nullptr), 0);
+  ASSERT_EQ(SparseBtfFactor(parallel, A, pool), 0);
+  ASSERT_EQ(SparseBtfSolve(serial, b.data(), x.data(), nullptr), 0);
+  ASSERT_EQ(SparseBtfSolve(parallel, b.data(), y.data(), pool), 0);
+  for (int i = 0; i < n; i++) EXPECT_EQ(y[i], x[i]);
+
+  SparseBtfFree(serial);
+  SparseBtfFree(parallel);
+  ThreadPoolFree(pool);
+  SparseFree(A);
+}
+
+TEST(SparseBtfTest, IrreducibleAndSingularPatterns) {
+  // Resistor ring with a conductance to ground
+  std::vector<Triplet> t;
+  for (int i = 0; i < 50; i++) {
+    int j = (i + 1) % 50;
+    t.push_back({i, i, i == 0 ? 2.0 : 1.0});
+    t.push_back({j, j, 1.0});
+    t.push_back({i, j, -1.0});
+    t.push_back({j, i, -1.0});
+  }
+  SparseMatrix* A = SparseCreateFromTriplets(50, t.data(), t.size());
+  ASSERT_NE(A, nullptr);
+  SparseBtf* btf = SparseBtfCreate(A, A->n);
+  ASSERT_NE(btf, nullptr);
+  EXPECT_EQ(SparseBtfNumBlocks(btf), 1);
+  SparseBtfFree(btf);
+  SparseFree(A);
+
+  // Two rows with entries only in the same column: no zero-free diagonal
+  t = {{0, 0, 1.0}, {1, 0, 1.0}, {2, 2, 1.0}};
+  A = SparseCreateFromTriplets(3, t.data(), t.size());
+  ASSERT_NE(A, nullptr);
+  EXPECT_EQ(SparseBtfCreate(A, A->n), nullptr);
+  SparseFree(A);
+
+  // Numerically singular block
+  t = {{0, 0, 1.0}, {1, 1, 0.0}, {1, 0, 2.0}};
+  A = SparseCreateFromTriplets(2, t.data(), t.size());
+  ASSERT_NE(A, nullptr);
+  btf = SparseBtfCreate(A, A->n);
+  ASSERT_NE(btf, nullptr);
+  EXPECT_EQ(SparseBtfNumBlocks(btf), 2);
+  EXPECT_EQ(SparseBtfFactor(btf, A, nullptr), -2);
+  SparseBtfFree(btf);
+  SparseFree(A);
+}
+
+// One sub-network: a driven resistor ladder loaded by a diode. Node and
+// device names carry the copy number.
+static std::string SubNetwork(int copy, int stages) {
+  std::string s = std::to_string(copy);
+  std::string netlist = "V" + s + " a" + s + "_0 0 " +
+                        std::to_string(0.5 + 0.25 * copy) + "\n";
+  for (int k = 0; k < stages; k++) {
+    std::string a = "a" + s + "_" + std::to_string(k);
+    std::string b = "a" + s + "_" + std::to_string(k + 1);
+    netlist += "R" + s + "_" + std::to_string(k) + " " + a + " " + b + " 50\n";
+  }
+  netlist += "D" + s + " a" + s + "_" + std::to_string(stages) +
+             " 0 Is=1e-14 n=1\n";
+  return netlist;
+}
+
+TEST(SparseBtfTest, WorkspaceSolvesDisconnectedNetworksByBlocks) {
+  const int kCopies = 6;
+  const int kStages = 30;
+  std::string netlist;
+  for (int copy = 0; copy < kCopies; copy++) {
+    netlist += SubNetwork(copy, kStages);
+  }
+
+  for (int threads : {1, 4}) {
+    Circuit* c = parse_netlist_string(netlist.c_str());
+    ASSERT_NE(c, nullptr);
+    c->linear_solver.threads = threads;
+    std::vector<double> x(c->num_vars, 0.0);
+    ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+
+    SimStats s;
+    SimWorkspaceGetStats(c->workspace, &s);
+    EXPECT_EQ(s.sparse, 1);
+    EXPECT_EQ(s.blocks, 3 * kCopies);  // Source, ladder, branch current
+
+    // Every copy matches the copy solved alone (on the dense path)
+    for (int copy = 0; copy < kCopies; copy++) {
+      std::string single_netlist = SubNetwork(copy, kStages);
+      Circuit* single = parse_netlist_string(single_netlist.c_str());
+      ASSERT_NE(single, nullptr);
+      ASSERT_LT(single->num_vars, kSparseSolverThreshold);
+      std::vector<double> y(single->num_vars, 0.0);
+      ASSERT_GT(CircuitDcAnalysis(single, y.data(), 100, 1e-12, 1e-9), 0);
+      for (int k = 0; k <= kStages; k++) {
+        std::string name =
+            "a" + std::to_string(copy) + "_" + std::to_string(k);
+        int vc = CircuitGetVarIndex(c, CircuitGetNode(c, name.c_str()));
+        int vs = CircuitGetVarIndex(single,
+                                    CircuitGetNode(single, name.c_str()));
+        ASSERT_GE(vc, 0);
+        ASSERT_GE(vs, 0);
+        EXPECT_NEAR(x[vc], y[vs], 1e-9);
+      }
+      circuit_free(single);
+    }
+    circuit_free(c);
+  }
+}
@@ -12,6 +12,11 @@
 #include <cstring>
 
 #include "device.h"
+#include "device_arena.h"
+#include "sparse.h"
+#include "string_arena.h"
+#include "table_model.h"
+#include "workspace.h"
 
 namespace minispice {
 
@@ -20,86 +25,235 @@ namespace {
 // Internal Utilities
 // =============================================================================
 
-static bool IsGroundName(const char* name) {
-  if (!name) return false;
-  if (strcmp(name, "0") == 0) return true;
-  if (strcasecmp(name, "gnd") == 0) return true;
-  if (strcasecmp(name, "ground") == 0) return true;
-  return false;
+// Initial capacity of the node hash index (power of two)
+constexpr int kInitialNodeTableCapacity = 32;
+
+// FNV-1a hash of a node name
+static unsigned HashName(const char* name, size_t len) {
+  unsigned h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  }
+  return h;
 }
 
-// Simple dense linear solver using Gaussian elimination with partial pivoting
-static int SolveDenseSystem(int n, double* A, double* b, double* x) {
-  // A is row-major n x n, b and x are length n
-  // Uses in-place elimination on copies
-
-  // Work arrays - copy A and b
-  double* M = (double*)malloc(n * n * sizeof(double));
-  double* rhs = (double*)malloc(n * sizeof(double));
-  if (!M || !rhs) {
-    free(M);
-    free(rhs);
-    return -1;
+// Slot of the node named name (len bytes) in the hash index, or of the
+// empty slot where it would be inserted
+static int FindNodeSlot(const Circuit* c, const char* name, size_t len,
+                        unsigned hash) {
+  int mask = c->node_table_capacity - 1;
+  for (int slot = (int)(hash & mask);; slot = (slot + 1) & mask) {
+    int idx = c->node_table[slot];
+    if (idx < 0) return slot;
+    const char* stored = c->nodes[idx].name;
+    if (c->nodes[idx].hash == hash && strncmp(stored, name, len) == 0 &&
+        stored[len] == '\0') {
+      return slot;
+    }
+  }
+}
+
+// Rebuild the hash index with the given capacity (power of two).
+// Returns 0 on success, -1 on allocation failure.
+static int ResizeNodeTable(Circuit* c, int capacity) {
+  int* table = (int*)malloc(capacity * sizeof(int));
+  if (!table) return -1;
+  for (int i = 0; i < capacity; i++) table[i] = -1;
+
+  free(c->node_table);
+  c->node_table = table;
+  c->node_table_capacity = capacity;
+  for (int i = 1; i < c->num_nodes; i++) {
+    const char* name = c->nodes[i].name;
+    c->node_table[FindNodeSlot(c, name, strlen(name), c->nodes[i].hash)] = i;
   }
+  return 0;
+}
+
+// Newton-Raphson iteration starting from the guess in x, under the
+// circuit's Newton policy (junction limiting in the device stamps, damping
+// of the update here) and with gmin from every node to ground. On return x
+// holds the last iterate and *converged tells whether the tolerances were
+// met.
+// Returns the number of iterations, or -1 if the linear solve failed.
+static int NewtonSolve(Circuit* c, SimWorkspace* ws, double* x, int max_iter,
+                       double tol_abs, double tol_rel, double gmin,
+                       bool* converged) {
+  int n = c->num_vars;
+  double* x_new = ws->x_new;
+  *converged = false;
+
+  IterationState it;
+  it.tol_abs = tol_abs;
+  it.tol_rel = tol_rel;
+  it.policy = c->newton;
+  it.counts = &ws->eval_counts;
+  it.gmin = gmin;
+  bool line_search =
+      !c->is_linear && it.policy.damping == kNewtonDampingLineSearch;
+  double residual = INFINITY;
 
-  memcpy(M, A, n * n * sizeof(double));
-  memcpy(rhs, b, n * sizeof(double));
+  int iter;
+  for (iter = 0; iter < max_iter; iter++) {
+    it.iter = iter;
+    it.x_current = x;
 
-  // Gaussian elimination with partial pivoting
-  for (int k = 0; k < n; k++) {
-    // Find pivot
-    int p = k;
-    double maxv = fabs(M[k * n + k]);
-    for (int i = k + 1; i < n; i++) {
-      double v = fabs(M[i * n + k]);
-      if (v > maxv) {
-        maxv = v;
-        p = i;
+    // Stamp (backtracking the last step if the residual grew) and solve
+    // A * x_new = z
+    int solve_result = SimWorkspaceAssemble(ws, c, &it);
+    if (solve_result == 0 && line_search) {
+      solve_result = SimWorkspaceLineSearch(ws, c, &it, nullptr, &residual);
+    }
+    if (solve_result == 0) {
+      solve_result = SimWorkspaceSolve(ws);
+    }
+    if (solve_result != 0) {
+      if (gmin == 0.0) {
+        fprintf(stderr, "DC analysis: solver failed at iteration %d\n", iter);
       }
+      return -1;
     }
 
-    if (maxv < 1e-15) {
-      // Singular matrix
-      free(M);
-      free(rhs);
-      return -2;
+    // Linear circuits reach the exact solution on the first iteration
+    if (c->is_linear) {
+      memcpy(x, x_new, n * sizeof(double));
+      *converged = true;
+      iter++;
+      break;
     }
 
-    // Swap rows if needed
-    if (p != k) {
-      for (int j = 0; j < n; j++) {
-        double tmp = M[k * n + j];
-        M[k * n + j] = M[p * n + j];
-        M[p * n + j] = tmp;
+    // Check if the full Newton step is within the tolerances
+    *converged = true;
+    for (int i = 0; i < n; i++) {
+      double threshold = tol_abs + tol_rel * fabs(x_new[i]);
+      if (fabs(x_new[i] - x[i]) > threshold) {
+        *converged = false;
+        break;
       }
-      double tmp = rhs[k];
-      rhs[k] = rhs[p];
-      rhs[p] = tmp;
     }
 
-    // Eliminate below pivot
-    double pivot = M[k * n + k];
-    for (int i = k + 1; i < n; i++) {
-      double factor = M[i * n + k] / pivot;
-      for (int j = k; j < n; j++) {
-        M[i * n + j] -= factor * M[k * n + j];
-      }
-      rhs[i] -= factor * rhs[k];
+    // Update solution
+    SimWorkspaceUpdateSolution(ws, x, &it.policy);
+
+    if (*converged) {
+      iter++;
+      break;
     }
   }
 
-  // Back substitution
-  for (int i = n - 1; i >= 0; i--) {
-    double sum = rhs[i];
-    for (int j = i + 1; j < n; j++) {
-      sum -= M[i * n + j] * x[j];
+  return iter;
+}
+
+// Gmin stepping from the zero guess: Newton with kGminSteppingStart from
+// every node to ground, each solution the start of the next solve with gmin
+// divided by kGminSteppingFactor, until a last solve without gmin once gmin
+// falls below kGminSteppingStop. Adds the Newton iterations to *iterations.
+// Returns 0 if the last solve converged, -1 otherwise.
+static int GminStepping(Circuit* c, SimWorkspace* ws, double* x, int max_iter,
+                        double tol_abs, double tol_rel, int* iterations) {
+  memset(x, 0, c->num_vars * sizeof(double));
+  double gmin = kGminSteppingStart;
+  for (;;) {
+    bool converged;
+    int iters =
+        NewtonSolve(c, ws, x, max_iter, tol_abs, tol_rel, gmin, &converged);
+    if (iters < 0 || !converged) return -1;
+    *iterations += iters;
+    if (gmin == 0.0) return 0;
+    gmin /= kGminSteppingFactor;
+    if (gmin < kGminSteppingStop) gmin = 0.0;
+  }
+}
+
+// Source stepping: every independent source scaled by s, ramped from 0
+// (where x = 0 solves the circuit) to 1. Each scale is solved by Newton from
+// the solution of the last one; the scale step doubles after a converged
+// solve and is quartered after a failed one, giving up below
+// kSourceSteppingMinStep. The source values are restored on return. Adds
+// the Newton iterations to *iterations.
+// Returns 0 if the full-scale solve converged, -1 otherwise.
+static int SourceStepping(Circuit* c, SimWorkspace* ws, double* x,
+                          int max_iter, double tol_abs, double tol_rel,
+                          int* iterations) {
+  int num_sources = 0;
+  for (Device* d = c->devices; d; d = d->next) {
+    double value;
+    if (DeviceGetValue(d, &value) == 0) num_sources++;
+  }
+  if (num_sources == 0) return -1;
+  Device** src = (Device**)malloc(num_sources * sizeof(Device*));
+  double* values = (double*)malloc(num_sources * sizeof(double));
+  if (!src || !values) {
+    free(src);
+    free(values);
+    return -1;
+  }
+  int k = 0;
+  for (Device* d = c->devices; d; d = d->next) {
+    if (DeviceGetValue(d, &values[k]) == 0) src[k++] = d;
+  }
+
+  int n = c->num_vars;
+  double* x_good = ws->x_continuation;
+  memset(x_good, 0, n * sizeof(double));
+  double scale = 0.0;
+  double step = kSourceSteppingInitialStep;
+  int result = -1;
+  while (step >= kSourceSteppingMinStep) {
+    double next = fmin(scale + step, 1.0);
+    for (int i = 0; i < num_sources; i++) {
+      DeviceSetValue(src[i], next * values[i]);
+    }
+    memcpy(x, x_good, n * sizeof(double));
+    bool converged;
+    int iters =
+        NewtonSolve(c, ws, x, max_iter, tol_abs, tol_rel, 0.0, &converged);
+    if (iters > 0) *iterations += iters;
+    if (iters < 0 || !converged) {
+      step *= 0.25;
+      continue;
+    }
+    scale = next;
+    memcpy(x_good, x, n * sizeof(double));
+    if (scale == 1.0) {
+      result = 0;
+      break;
     }
-    x[i] = sum / M[i * n + i];
+    step *= 2.0;
   }
 
-  free(M);
-  free(rhs);
-  return 0;
+  for (int i = 0; i < num_sources; i++) DeviceSetValue(src[i], values[i]);
+  free(src);
+  free(values);
+  return result;
+}
+
+// DC solve of a nonlinear circuit with continuation: Newton from the guess
+// in x, then the strategies enabled by the circuit's Newton policy, each
+// from scratch. ws->dc_strategy receives the strategy that converged.
+// Returns the number of Newton iterations of all attempts, or -1 if none
+// converged.
+static int DcSolve(Circuit* c, SimWorkspace* ws, double* x, int max_iter,
+                   double tol_abs, double tol_rel) {
+  ws->dc_strategy = kDcNewton;
+  bool converged;
+  int iterations =
+      NewtonSolve(c, ws, x, max_iter, tol_abs, tol_rel, 0.0, &converged);
+  if (iterations >= 0 && converged) return iterations;
+  if (c->is_linear) return -1;  // The solve itself failed
+  if (iterations < 0) iterations = 0;
+
+  if (c->newton.gmin_stepping &&
+      GminStepping(c, ws, x, max_iter, tol_abs, tol_rel, &iterations) == 0) {
+    ws->dc_strategy = kDcGminStepping;
+    return iterations;
+  }
+  if (c->newton.source_stepping &&
+      SourceStepping(c, ws, x, max_iter, tol_abs, tol_rel, &iterations) == 0) {
+    ws->dc_strategy = kDcSourceStepping;
+    return iterations;
+  }
+  return -1;
 }
 
 }  // namespace
@@ -120,16 +274,36 @@ Circuit* circuit_create(void) {
     return nullptr;
   }
 
-  // Add ground node at index 0
-  strcpy(c->nodes[0].name, "0");
+  c->names = StringArenaCreate();
+  c->device_arena = c->names ? DeviceArenaCreate(c->names) : nullptr;
+  c->node_table_capacity = kInitialNodeTableCapacity;
+  c->node_table = (int*)malloc(c->node_table_capacity * sizeof(int));
+  if (!c->names || !c->device_arena || !c->node_table) {
+    circuit_free(c);
+    return nullptr;
+  }
+  for (int i = 0; i < c->node_table_capacity; i++) c->node_table[i] = -1;
+
+  // Add ground node at index 0 (not in the hash index)
+  c->nodes[0].name = StringArenaAdd(c->names, "0", 1);
   c->nodes[0].var_index = -1;  // Ground is not a variable
+  c->nodes[0].hash = HashName("0", 1);
   c->num_nodes = 1;
+  if (!c->nodes[0].name) {
+    circuit_free(c);
+    return nullptr;
+  }
 
   c->devices = nullptr;
   c->num_devices = 0;
   c->num_vars = 0;
   c->num_extra_vars = 0;
   c->finalized = 0;
+  c->workspace = nullptr;
+  c->newton = kDefaultNewtonPolicy;
+  c->linear_solver = kDefaultLinearSolverOptions;
+  c->stamp_threads = 1;
+  c->num_dc_sweeps = 0;
 
   return c;
 }
@@ -137,19 +311,118 @@ Circuit* circuit_create(void) {
 void circuit_free(Circuit* c) {
   if (!c) return;
 
-  // Free all devices
-  Device* d = c->devices;
-  while (d) {
+  // Free the devices not held by the arena
+  for (Device* d = c->devices; d && c->num_heap_devices > 0;) {
     Device* next = d->next;
-    DeviceFree(d);
+    if (!(d->flags & kDeviceArena)) {
+      DeviceFree(d);
+      c->num_heap_devices--;
+    }
     d = next;
   }
+  DeviceArenaFree(c->device_arena);
 
+  SimWorkspaceFree(c->workspace);
+  SparseOrderingFree(c->sparse_ordering);
+  TableModelsFree(c->table_models);
   free(c->nodes);
+  free(c->node_table);
+  StringArenaFree(c->names);
   free(c);
 }
 
+Circuit* CircuitClone(const Circuit* c, int own_params) {
+  if (!c || !c->finalized) return nullptr;
+
+  Circuit* copy = (Circuit*)calloc(1, sizeof(Circuit));
+  if (!copy) return nullptr;
+
+  // Own copies of the names; the hash index layout is unchanged
+  copy->nodes = (Node*)malloc(c->nodes_capacity * sizeof(Node));
+  copy->names = StringArenaCreate();
+  copy->device_arena = copy->names ? DeviceArenaCreate(copy->names) : nullptr;
+  copy->node_table = (int*)malloc(c->node_table_capacity * sizeof(int));
+  if (!copy->nodes || !copy->names || !copy->device_arena ||
+      !copy->node_table) {
+    circuit_free(copy);
+    return nullptr;
+  }
+  memcpy(copy->nodes, c->nodes, c->num_nodes * sizeof(Node));
+  copy->num_nodes = c->num_nodes;
+  copy->nodes_capacity = c->nodes_capacity;
+  for (int i = 0; i < c->num_nodes; i++) {
+    const char* name = c->nodes[i].name;
+    copy->nodes[i].name = StringArenaAdd(copy->names, name, strlen(name));
+    if (!copy->nodes[i].name) {
+      circuit_free(copy);
+      return nullptr;
+    }
+  }
+  memcpy(copy->node_table, c->node_table,
+         c->node_table_capacity * sizeof(int));
+  copy->node_table_capacity = c->node_table_capacity;
+
+  // Keep the device order: compiled stamping numbers devices by position
+  Device** tail = &copy->devices;
+  for (const Device* d = c->devices; d; d = d->next) {
+    int share_params = !own_params && !(d->vt && d->vt->SetValue);
+    Device* dc = DeviceClone(d, share_params, copy->device_arena);
+    if (!dc) {
+      circuit_free(copy);
+      return nullptr;
+    }
+    *tail = dc;
+    tail = &dc->next;
+    copy->num_devices++;
+  }
+
+  copy->num_vars = c->num_vars;
+  copy->num_extra_vars = c->num_extra_vars;
+  copy->finalized = 1;
+  copy->is_linear = c->is_linear;
+  copy->workspace = nullptr;
+  copy->newton = c->newton;
+  copy->linear_solver = c->linear_solver;
+  copy->stamp_threads = c->stamp_threads;
+  copy->profile = c->profile;
+  memcpy(copy->dc_sweeps, c->dc_sweeps, sizeof(c->dc_sweeps));
+  copy->num_dc_sweeps = c->num_dc_sweeps;
+  for (int k = 0; k < c->num_dc_sweeps; k++) {
+    const char* source = c->dc_sweeps[k].source;
+    copy->dc_sweeps[k].source =
+        StringArenaAdd(copy->names, source, strlen(source));
+    if (!copy->dc_sweeps[k].source) {
+      circuit_free(copy);
+      return nullptr;
+    }
+  }
+  copy->tran = c->tran;
+  copy->ac = c->ac;
+  if (c->sparse_ordering) {
+    copy->sparse_ordering = SparseOrderingCopy(c->sparse_ordering);
+    if (!copy->sparse_ordering) {
+      circuit_free(copy);
+      return nullptr;
+    }
+  }
+
+  return copy;
+}
+
 int CircuitAddNode(Circuit* c, const char* name) {
+  if (name == nullptr) return -1;
+  return CircuitAddNodeN(c, name, strlen(name));
+}
+
+int CircuitIsGroundName(const char* name, size_t len) {
+  if (!name) return 0;
+  if (len == 1 && name[0] == '0') return 1;
+  if (len == 3 && strncasecmp(name, "gnd", 3) == 0) return 1;
+  if (len == 6 && strncasecmp(name, "ground", 6) == 0) return 1;
+  return 0;
+}
+
+int CircuitAddNodeN(Circuit* c, const char* name, size_t len) {
   if (c == nullptr || name == nullptr) {
     return -1;
   }
@@ -160,15 +433,15 @@ int CircuitAddNode(Circuit* c, const char* name) {
   }
 
   // Check for ground
-  if (IsGroundName(name)) {
+  if (CircuitIsGroundName(name, len)) {
     return 0;  // Ground is always index 0
   }
 
   // Check if node already exists
-  for (int i = 0; i < c->num_nodes; i++) {
-    if (strcmp(c->nodes[i].name, name) == 0) {
-      return i;
-    }
+  unsigned hash = HashName(name, len);
+  int slot = FindNodeSlot(c, name, len, hash);
+  if (c->node_table[slot] >= 0) {
+    return c->node_table[slot];
   }
 
   // Need to add new node - check capacity
@@ -182,28 +455,35 @@ int CircuitAddNode(Circuit* c, const char* name) {
 
   // Add the node
   int idx = c->num_nodes;
-  strncpy(c->nodes[idx].name, name, kMaxNodeNameLen - 1);
-  c->nodes[idx].name[kMaxNodeNameLen - 1] = '\0';
+  const char* stored = StringArenaAdd(c->names, name, len);
+  if (!stored) return -1;
+  c->nodes[idx].name = stored;
   c->nodes[idx].var_index = -1;  // Will be assigned during finalize
+  c->nodes[idx].hash = hash;
   c->num_nodes++;
 
+  // Keep the index at most half full
+  if (2 * c->num_nodes > c->node_table_capacity) {
+    if (ResizeNodeTable(c, 2 * c->node_table_capacity) != 0) {
+      c->num_nodes--;
+      return -1;
+    }
+  } else {
+    c->node_table[slot] = idx;
+  }
+
   return idx;
 }
 
 int CircuitGetNode(Circuit* c, const char* name) {
   if (!c || !name) return -1;
 
-  if (IsGroundName(name)) {
+  size_t len = strlen(name);
+  if (CircuitIsGroundName(name, len)) {
     return 0;
   }
 
-  for (int i = 0; i < c->num_nodes; i++) {
-    if (strcmp(c->nodes[i].name, name) == 0) {
-      return i;
-    }
-  }
-
-  return -1;
+  return c->node_table[FindNodeSlot(c, name, len, HashName(name, len))];
 }
 
 int CircuitGetVarIndex(Circuit* c, int node_index) {
@@ -213,6 +493,15 @@ int CircuitGetVarIndex(Circuit* c, int node_index) {
   return c->nodes[node_index].var_index;
 }
 
+Device* CircuitFindDevice(Circuit* c, const char* name) {
+  if (!c || !name) return nullptr;
+
+  for (Device* d = c->devices; d; d = d->next) {
+    if (strcasecmp(d->name, name) == 0) return d;
+  }
+  return nullptr;
+}
+
 Device* CircuitAddDevice(Circuit* c, Device* d) {
   if (!c || !d) return nullptr;
   if (c->finalized) return nullptr;
@@ -221,6 +510,7 @@ Device* CircuitAddDevice(Circuit* c, Device* d) {
   d->next = c->devices;
   c->devices = d;
   c->num_devices++;
+  if (!(d->flags & kDeviceArena)) c->num_heap_devices++;
 
   return d;
 }
@@ -245,6 +535,7 @@ int CircuitFinalize(Circuit* c) {
   }
 
   c->num_extra_vars = 0;
+  c->is_linear = 1;
 
   // Second pass to initialize devices and count extra variables needed
   for (Device* d = c->devices; d; d = d->next) {
@@ -258,6 +549,8 @@ int CircuitFinalize(Circuit* c) {
       d->extra_var = c->num_vars + c->num_extra_vars;
       c->num_extra_vars++;
     }
+
+    if (d->vt && !d->vt->is_linear) c->is_linear = 0;
   }
 
   c->num_vars += c->num_extra_vars;
@@ -271,109 +564,184 @@ int CircuitDcAnalysis(Circuit* c, double* x, int max_iter, double tol_abs,
   if (!c || !x) return -1;
   if (!c->finalized) return -1;
 
-  int n = c->num_vars;
-  if (n == 0) return -1;
-
-  // Allocate working arrays
-  double* A = (double*)calloc(n * n, sizeof(double));
-  double* z = (double*)calloc(n, sizeof(double));
-  double* x_new = (double*)calloc(n, sizeof(double));
-  double* delta = (double*)calloc(n, sizeof(double));
-
-  if (!A || !z || !x_new || !delta) {
-    free(A);
-    free(z);
-    free(x_new);
-    free(delta);
-    return -1;
+  // Default workspace, kept on the circuit so repeated analyses reuse it
+  if (!c->workspace) {
+    c->workspace = SimWorkspaceCreate(c);
+    if (!c->workspace) return -1;
   }
 
+  return CircuitDcAnalysisWithWorkspace(c, c->workspace, x, max_iter, tol_abs,
+                                        tol_rel);
+}
+
+int CircuitDcAnalysisWithWorkspace(Circuit* c, SimWorkspace* ws, double* x,
+                                   int max_iter, double tol_abs,
+                                   double tol_rel) {
+  if (!c || !ws || !x) return -1;
+  if (!c->finalized) return -1;
+
+  int n = c->num_vars;
+  if (n == 0 || ws->n != n) return -1;
+
   // Initialize solution guess to zero
   memset(x, 0, n * sizeof(double));
 
-  StampContext* ctx = CtxCreate(n);
-  if (!ctx) {
-    free(A);
-    free(z);
-    free(x_new);
-    free(delta);
-    return -1;
+  int iterations = DcSolve(c, ws, x, max_iter, tol_abs, tol_rel);
+  if (iterations < 0 && !c->is_linear) {
+    fprintf(stderr, "DC analysis: no convergence\n");
   }
+  return iterations;
+}
 
-  IterationState it;
-  it.tol_abs = tol_abs;
-  it.tol_rel = tol_rel;
+int CircuitDcAnalysisWarmStart(Circuit* c, SimWorkspace* ws, double* x,
+                               int max_iter, double tol_abs, double tol_rel) {
+  if (!c || !ws || !x) return -1;
+  if (!c->finalized) return -1;
+  if (c->num_vars == 0 || ws->n != c->num_vars) return -1;
 
-  int iter;
-  for (iter = 0; iter < max_iter; iter++) {
-    it.iter = iter;
-    it.x_current = x;
+  bool converged;
+  int iters =
+      NewtonSolve(c, ws, x, max_iter, tol_abs, tol_rel, 0.0, &converged);
+  if (iters >= 0 && !converged) return -2;
+  return iters;
+}
 
-    // Reset and stamp
-    CtxReset(ctx);
+int CircuitSetDeviceParam(Circuit* c, const char* device, const char* param,
+                          double value) {
+  if (!c || !c->finalized || !param) return -1;
 
-    for (Device* d = c->devices; d; d = d->next) {
-      if (d->vt && d->vt->StampNonlinear) {
-        d->vt->StampNonlinear(d, ctx, &it);
-      }
+  Device* d = CircuitFindDevice(c, device);
+  if (!d || DeviceSetParam(d, param, value) != 0) return -1;
+  c->param_edits++;
+  return 0;
+}
+
+int CircuitDcResolve(Circuit* c, SimWorkspace* ws, double* x, int max_iter,
+                     double tol_abs, double tol_rel) {
+  if (!c || !x) return -1;
+  if (!c->finalized) return -1;
+
+  if (!ws) {
+    if (!c->workspace) {
+      c->workspace = SimWorkspaceCreate(c);
+      if (!c->workspace) return -1;
     }
+    ws = c->workspace;
+  }
+  int n = c->num_vars;
+  if (n == 0 || ws->n != n) return -1;
+
+  int low_rank_updates = ws->low_rank_updates;
+  ws->low_rank_updates = 1;
+  bool converged;
+  int iters =
+      NewtonSolve(c, ws, x, max_iter, tol_abs, tol_rel, 0.0, &converged);
+  ws->low_rank_updates = low_rank_updates;
+  if (iters >= 0 && converged) return iters;
+  if (c->is_linear) return -1;
+
+  // Warm start failed: solve from zero, with continuation
+  memset(x, 0, n * sizeof(double));
+  iters = DcSolve(c, ws, x, max_iter, tol_abs, tol_rel);
+  if (iters < 0) fprintf(stderr, "DC analysis: no convergence\n");
+  return iters;
+}
 
-    // Assemble matrix
-    memset(A, 0, n * n * sizeof(double));
-    CtxAssembleDense(ctx, A);
+int DcSweepNumPoints(const DcSweep* s) {
+  if (!s) return 0;
 
-    // Get RHS
-    double* rhs = CtxGetZ(ctx);
-    memcpy(z, rhs, n * sizeof(double));
+  double span = s->stop - s->start;
+  if (span == 0.0) return 1;
+  if (s->step == 0.0 || span / s->step < 0.0) return 0;
 
-    // Solve A * x_new = z
-    int solve_result = SolveDenseSystem(n, A, z, x_new);
-    if (solve_result != 0) {
-      fprintf(stderr, "DC analysis: solver failed at iteration %d\n", iter);
-      CtxFree(ctx);
-      free(A);
-      free(z);
-      free(x_new);
-      free(delta);
-      return -1;
+  // Tolerate rounding so that stop itself is included
+  return (int)floor(span / s->step + 1e-9) + 1;
+}
+
+int CircuitDcSweep(Circuit* c, SimWorkspace* ws, const DcSweep* sweeps,
+                   int num_sweeps, double* x, int max_iter, double tol_abs,
+                   double tol_rel, DcSweepCallback cb, void* user) {
+  if (!c || !sweeps || !x) return -1;
+  if (!c->finalized) return -1;
+  if (num_sweeps < 1 || num_sweeps > kMaxDcSweeps) return -1;
+
+  if (!ws) {
+    if (!c->workspace) {
+      c->workspace = SimWorkspaceCreate(c);
+      if (!c->workspace) return -1;
     }
+    ws = c->workspace;
+  }
 
-    // Check convergence
-    double max_delta = 0.0;
-    for (int i = 0; i < n; i++) {
-      delta[i] = x_new[i] - x[i];
-      double abs_delta = fabs(delta[i]);
-      if (abs_delta > max_delta) max_delta = abs_delta;
+  int n = c->num_vars;
+  if (ws->n != n) return -1;
+
+  // Resolve the swept sources and remember their values
+  Device* src[kMaxDcSweeps];
+  double saved[kMaxDcSweeps];
+  int points[kMaxDcSweeps] = {1, 1};
+  for (int k = 0; k < num_sweeps; k++) {
+    src[k] = CircuitFindDevice(c, sweeps[k].source);
+    if (!src[k] || DeviceGetValue(src[k], &saved[k]) != 0) {
+      fprintf(stderr, "DC sweep: no sweepable source %s\n", sweeps[k].source);
+      return -1;
+    }
+    points[k] = DcSweepNumPoints(&sweeps[k]);
+    if (points[k] <= 0) {
+      fprintf(stderr, "DC sweep: invalid step for %s\n", sweeps[k].source);
+      return -1;
     }
+  }
 
-    // Update solution
-    memcpy(x, x_new, n * sizeof(double));
+  // Starting guess for the next outer step (first point of the current one)
+  double* x_outer = nullptr;
+  if (num_sweeps > 1) {
+    x_outer = (double*)calloc(n, sizeof(double));
+    if (!x_outer) return -1;
+  }
 
-    // For linear circuits, first iteration gives exact solution
-    // Check if converged
-    bool converged = true;
-    for (int i = 0; i < n; i++) {
-      double threshold = tol_abs + tol_rel * fabs(x[i]);
-      if (fabs(delta[i]) > threshold) {
-        converged = false;
+  memset(x, 0, n * sizeof(double));
+
+  double values[kMaxDcSweeps];
+  int solved = 0;
+  for (int o = 0; o < points[1] && solved >= 0; o++) {
+    if (num_sweeps > 1) {
+      values[1] = sweeps[1].start + o * sweeps[1].step;
+      DeviceSetValue(src[1], values[1]);
+      if (o > 0) memcpy(x, x_outer, n * sizeof(double));
+    }
+
+    for (int i = 0; i < points[0]; i++) {
+      values[0] = sweeps[0].start + i * sweeps[0].step;
+      DeviceSetValue(src[0], values[0]);
+
+      bool converged;
+      int iters =
+          NewtonSolve(c, ws, x, max_iter, tol_abs, tol_rel, 0.0, &converged);
+      if (iters < 0 || !converged) {
+        // Warm start failed: retry the point from zero, with continuation
+        memset(x, 0, n * sizeof(double));
+        iters = DcSolve(c, ws, x, max_iter, tol_abs, tol_rel);
+      }
+      if (iters < 0) {
+        fprintf(stderr, "DC sweep: no convergence at %s = %g\n",
+                sweeps[0].source, values[0]);
+        solved = -1;
         break;
       }
-    }
 
-    if (converged || iter == 0) {
-      // For linear circuits, converge after first iteration
-      iter++;
-      break;
+      if (i == 0 && x_outer) memcpy(x_outer, x, n * sizeof(double));
+      if (cb) cb(user, values, x, n);
+      solved++;
     }
   }
 
-  CtxFree(ctx);
-  free(A);
-  free(z);
-  free(x_new);
-  free(delta);
+  for (int k = 0; k < num_sweeps; k++) {
+    DeviceSetValue(src[k], saved[k]);
+  }
+  free(x_outer);
 
-  return iter;
+  return solved;
 }
 
 void CircuitPrintSummary(Circuit* c) {
@@ -5,17 +5,68 @@
 #define MINI_SPICE_CIRCUIT_H_
 
 #include "device.h"
+#include "krylov.h"
 #include "stamp.h"
 
 namespace minispice {
 
-// Maximum length for node names
-constexpr int kMaxNodeNameLen = 64;
+struct DeviceArena;
+struct SimWorkspace;
+struct SparseOrdering;
+struct StringArena;
+struct TableModels;
+
+// Circuits with at least this many MNA variables are solved with the sparse
+// LU solver instead of dense Gaussian elimination
+constexpr int kSparseSolverThreshold = 100;
+
+// Maximum number of nested .DC sweep sources
+constexpr int kMaxDcSweeps = 2;
+
+// Linear sweep of an independent V or I source value (.DC)
+struct DcSweep {
+  const char* source;  // Name of the swept source (matches Device::name);
+                       // in Circuit::names for a .DC directive
+  double start;        // First value
+  double stop;         // Last value
+  double step;         // Increment (sign must match stop - start)
+};
+
+// Transient run requested by a .TRAN directive
+struct TranSpec {
+  double tstep;   // Suggested step
+  double tstop;   // End time (0 if no .TRAN was given)
+  double tstart;  // Time before which results are not printed
+  double tmax;    // Maximum step (0 for the default)
+};
+
+// Frequency spacing of an .AC sweep
+enum AcSweepType {
+  kAcDecade = 0,  // points per decade, logarithmic
+  kAcOctave,      // points per octave, logarithmic
+  kAcLinear,      // points in total, linear
+};
+
+// AC sweep requested by an .AC directive
+struct AcSpec {
+  AcSweepType type;
+  int points;     // Points per decade or octave, or in total (0 if no .AC
+                  // was given)
+  double fstart;  // First frequency (Hz)
+  double fstop;   // Last frequency (Hz)
+};
+
+// Called for every solved sweep point. values[k] is the current value of
+// sweeps[k]; x is the solution (length num_vars) and is only valid during
+// the call.
+typedef void (*DcSweepCallback)(void* user, const double* values,
+                                const double* x, int num_vars);
 
 // Node information
 struct Node {
-  char name[kMaxNodeNameLen];  // Node name (e.g., "1", "out", "gnd")
-  int var_index;               // Variable index in MNA system (-1 for ground)
+  const char* name;  // Node name (e.g., "1", "out"), stored in Circuit::names
+  int var_index;     // Variable index in MNA system (-1 for ground)
+  unsigned hash;     // Hash of name, used by the node index
 };
 
 // Circuit structure
@@ -24,12 +75,78 @@ struct Circuit {
   int num_nodes;       // Number of nodes including ground
   int nodes_capacity;  // Allocated capacity for nodes array
 
+  // Open-addressing (linear probing) hash index over the non-ground node
+  // names: node_table[slot] is a node index or -1. The capacity is a power
+  // of two, kept at least twice the number of nodes.
+  int* node_table;
+  int node_table_capacity;
+
+  StringArena* names;  // Storage of the node, device and sweep source names
+
   Device* devices;  // Linked list of devices
   int num_devices;  // Number of devices
 
+  // Storage of the devices created for this circuit (by the parser,
+  // CircuitClone and snapshots), freed at once with it. Only the
+  // num_heap_devices devices created without an arena are freed one by one.
+  DeviceArena* device_arena;
+  int num_heap_devices;
+
   int num_vars;        // Total MNA variables (node voltages + extra)
   int num_extra_vars;  // Number of extra variables (V-sources, inductors)
   int finalized;       // 1 if circuit is finalized, 0 otherwise
+
+  // 1 if every device is linear (set by CircuitFinalize). The MNA matrix of
+  // a linear circuit is constant for DC and for a fixed time step, so the
+  // analyses factor it once and only back-substitute for new right-hand
+  // sides.
+  int is_linear;
+
+  // Newton policy of the DC and transient analyses (kDefaultNewtonPolicy
+  // unless changed by the caller)
+  NewtonPolicy newton;
+
+  // Linear solver of the workspaces created for the circuit
+  // (kDefaultLinearSolverOptions, the direct LU, unless changed by the
+  // caller; see krylov.h)
+  LinearSolverOptions linear_solver;
+
+  // Threads the workspaces created for the circuit stamp the devices on
+  // (SimWorkspace::stamp_pool; <= 0 for the number of hardware threads).
+  // The assembled systems do not depend on it. 1 (serial) by default.
+  int stamp_threads;
+
+  // 1 if the workspaces created for the circuit time the analysis phases
+  // (SimWorkspace::profile, see sim_stats.h); 0 by default
+  int profile;
+
+  // Default analysis workspace used by CircuitDcAnalysis. Created on the
+  // first analysis after finalization and reused by later analyses.
+  SimWorkspace* workspace;
+
+  // Column ordering of the sparse MNA matrix, restored from a snapshot (see
+  // snapshot.h) so the workspaces skip the ordering step; nullptr if none
+  SparseOrdering* sparse_ordering;
+
+  // Shared device tables of table-model mode (see table_model.h); nullptr
+  // when devices are evaluated exactly
+  TableModels* table_models;
+
+  // Number of device parameter changes made by CircuitSetDeviceParam. A
+  // workspace re-reads the params it caches (the device batches) when the
+  // count differs from the one it last saw.
+  long param_edits;
+
+  // DC sweep requested by a .DC directive (num_dc_sweeps = 0 if none).
+  // dc_sweeps[0] is the inner sweep.
+  DcSweep dc_sweeps[kMaxDcSweeps];
+  int num_dc_sweeps;
+
+  // Transient run requested by a .TRAN directive (tran.tstop = 0 if none)
+  TranSpec tran;
+
+  // AC sweep requested by an .AC directive (ac.points = 0 if none)
+  AcSpec ac;
 };
 
 // Circuit Creation and Management
@@ -46,20 +163,41 @@ void circuit_free(Circuit* c);
 //       "GND", "ground").
 int CircuitAddNode(Circuit* c, const char* name);
 
+// Same as CircuitAddNode for a name of len bytes that need not be
+// NUL-terminated (e.g., a token inside a netlist buffer)
+int CircuitAddNodeN(Circuit* c, const char* name, size_t len);
+
+// 1 if the len bytes at name spell a ground name ("0", "gnd", "ground" in
+// any case), 0 otherwise
+int CircuitIsGroundName(const char* name, size_t len);
+
 // Get node index by name. Returns -1 if not found.
 int CircuitGetNode(Circuit* c, const char* name);
 
 // Get variable index for a given node index. Returns -1 if invalid node index
 int CircuitGetVarIndex(Circuit* c, int node_index);
 
-// Add a device to the circuit. Returns the device pointer on success, nullptr
-// on error.
+// Find a device by name (case-insensitive). Returns nullptr if not found.
+Device* CircuitFindDevice(Circuit* c, const char* name);
+
+// Add a device to the circuit. The circuit takes ownership of it; a device
+// created in an arena must come from c->device_arena. Returns the device
+// pointer on success, nullptr on error.
 Device* CircuitAddDevice(Circuit* c, Device* d);
 
 // Finalize the circuit: assign variable indices and prepare for analysis
 // Returns 0 on success, -1 on error
 int CircuitFinalize(Circuit* c);
 
+// Clone a finalized circuit for use on another thread. The clone has its own
+// nodes, device list (same order), device state and workspace. Device params
+// are shared read-only with the original, except those of independent
+// sources, which are copied so that each clone can sweep them. With
+// own_params every device's params are copied, so that the clone can also
+// edit them (CircuitSetDeviceParam). The original must outlive its clones.
+// Returns nullptr if the circuit is not finalized or on allocation failure.
+Circuit* CircuitClone(const Circuit* c, int own_params = 0);
+
 // PascalCase aliases for consumers expecting that style
 inline Circuit* CircuitCreate() { return circuit_create(); }
 inline void CircuitFree(Circuit* c) { circuit_free(c); }
@@ -68,10 +206,83 @@ inline void CircuitFree(Circuit* c) { circuit_free(c); }
 // Analysis Functions
 // =============================================================================
 
-// Perform DC analysis using Newton-Raphson iteration
+// DC continuation of NewtonPolicy::gmin_stepping: gmin from kGminSteppingStart
+// down by kGminSteppingFactor per solve to kGminSteppingStop, then removed
+constexpr double kGminSteppingStart = 1e-2;
+constexpr double kGminSteppingFactor = 10.0;
+constexpr double kGminSteppingStop = 1e-12;
+
+// DC continuation of NewtonPolicy::source_stepping: first and smallest
+// increment of the source scale
+constexpr double kSourceSteppingInitialStep = 0.1;
+constexpr double kSourceSteppingMinStep = 1e-3;
+
+// Perform DC analysis using Newton-Raphson iteration with the circuit's
+// default workspace
 int CircuitDcAnalysis(Circuit* c, double* x, int max_iter, double tol_abs,
                       double tol_rel);
 
+// Perform DC analysis with a caller-owned workspace created for this circuit
+// by SimWorkspaceCreate. No heap allocations are made once the workspace has
+// been through its first analysis.
+// If Newton from the zero guess does not converge within max_iter, the
+// continuation strategies enabled by the circuit's Newton policy are tried
+// in turn, each solve with up to max_iter iterations: gmin stepping (a
+// conductance from every node to ground, reduced solve by solve until it
+// is removed), then source stepping (every independent source ramped up
+// from zero; the only step that allocates, for its list of sources).
+// ws->dc_strategy tells which one converged.
+// Returns the number of iterations of all attempts, or -1 on error or if no
+// strategy converged.
+int CircuitDcAnalysisWithWorkspace(Circuit* c, SimWorkspace* ws, double* x,
+                                   int max_iter, double tol_abs,
+                                   double tol_rel);
+
+// Perform DC analysis with a workspace, starting Newton from the guess
+// already in x instead of zero (e.g., a neighbouring sweep point).
+// Returns the number of iterations, -2 if not converged within max_iter, or
+// -1 on error.
+int CircuitDcAnalysisWarmStart(Circuit* c, SimWorkspace* ws, double* x,
+                               int max_iter, double tol_abs, double tol_rel);
+
+// Set a model parameter of the named device (case-insensitive) of a
+// finalized circuit in place, as DeviceSetParam, for the next analysis with
+// any of its workspaces.
+// Returns 0 on success, -1 if there is no such device or the parameter is
+// rejected.
+int CircuitSetDeviceParam(Circuit* c, const char* device, const char* param,
+                          double value);
+
+// Re-solve the DC operating point after parameter edits, starting from the
+// previous solution in x. A linear circuit's matrix differs from the one
+// last factored only in the rows of the edited devices: the workspace solves
+// it by a low-rank (Sherman-Morrison-Woodbury) update of the kept factors
+// when few rows changed, refactoring otherwise. A nonlinear circuit is
+// warm-started from x as by CircuitDcAnalysisWarmStart and, if that does not
+// converge, solved again from zero as by CircuitDcAnalysisWithWorkspace.
+// ws may be nullptr to use the circuit's default workspace.
+// Returns the number of iterations, or -1 on error or if no strategy
+// converged.
+int CircuitDcResolve(Circuit* c, SimWorkspace* ws, double* x, int max_iter,
+                     double tol_abs, double tol_rel);
+
+// Number of points of a sweep from start to stop (inclusive).
+// Returns 0 if the step is zero or points away from stop.
+int DcSweepNumPoints(const DcSweep* s);
+
+// Perform a DC sweep. sweeps[0] is swept for every value of sweeps[1] (if
+// num_sweeps is 2). The source values are changed in place and restored
+// afterwards. Each point is warm-started from the previous solution; the
+// first point of an outer step starts from the first point of the previous
+// outer step. A point whose warm start fails is solved again from zero as by
+// CircuitDcAnalysisWithWorkspace (with continuation). ws may be nullptr to
+// use the circuit's default workspace.
+// x (length num_vars) receives the solution of the last point.
+// Returns the number of points solved, or -1 on error.
+int CircuitDcSweep(Circuit* c, SimWorkspace* ws, const DcSweep* sweeps,
+                   int num_sweeps, double* x, int max_iter, double tol_abs,
+                   double tol_rel, DcSweepCallback cb, void* user);
+
 // Print circuit summary (number of nodes, devices, variables, etc.)
 void CircuitPrintSummary(Circuit* c);
 
@@ -5,8 +5,15 @@
 #include <gtest/gtest.h>
 
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
 
+#include "device.h"
+#include "device_batch.h"
 #include "parser.h"
+#include "workspace.h"
 
 namespace minispice {
 
@@ -70,6 +77,38 @@ TEST_F(CircuitTest, DuplicateNodes) {
   EXPECT_EQ(c->num_nodes, 2);  // Only one node added + ground
 }
 
+// Hash index lookups across many index resizes
+TEST_F(CircuitTest, ManyNodesLookup) {
+  const int kNodes = 20000;
+  for (int i = 1; i <= kNodes; i++) {
+    ASSERT_EQ(CircuitAddNode(c, ("n" + std::to_string(i)).c_str()), i);
+  }
+  EXPECT_EQ(c->num_nodes, kNodes + 1);
+  EXPECT_GE(c->node_table_capacity, 2 * c->num_nodes);
+
+  for (int i = kNodes; i >= 1; i--) {
+    std::string name = "n" + std::to_string(i);
+    EXPECT_EQ(CircuitGetNode(c, name.c_str()), i);
+    EXPECT_EQ(CircuitAddNode(c, name.c_str()), i);  // Existing node
+    EXPECT_STREQ(c->nodes[i].name, name.c_str());
+  }
+  EXPECT_EQ(c->num_nodes, kNodes + 1);
+  EXPECT_EQ(CircuitGetNode(c, "n0"), -1);
+  EXPECT_EQ(CircuitGetNode(c, "missing"), -1);
+  EXPECT_EQ(CircuitGetNode(c, "gnd"), 0);
+}
+
+// Names are stored in full (no fixed-size buffer)
+TEST_F(CircuitTest, LongNodeNames) {
+  std::string base(200, 'a');
+  int n1 = CircuitAddNode(c, (base + "1").c_str());
+  int n2 = CircuitAddNode(c, (base + "2").c_str());
+
+  EXPECT_NE(n1, n2);
+  EXPECT_EQ(CircuitGetNode(c, (base + "2").c_str()), n2);
+  EXPECT_EQ(std::string(c->nodes[n1].name), base + "1");
+}
+
 TEST_F(CircuitTest, AddDevices) {
   int n1 = CircuitAddNode(c, "1");
   int n2 = CircuitAddNode(c, "2");
@@ -341,4 +380,718 @@ C1 out 0 1u
   circuit_free(c);
 }
 
+TEST(ParserTest, LargeLadderUsesSparseSolver) {
+  // Series chain of resistors driven by a 1V source. Large enough to take
+  // the sparse solver path; node k sits at (N + 1 - k) / (N + 1) volts.
+  const int kResistors = 2 * kSparseSolverThreshold;
+  std::string netlist = "V1 n0 0 1\n";
+  for (int k = 0; k < kResistors - 1; k++) {
+    netlist += "R" + std::to_string(k) + " n" + std::to_string(k) + " n" +
+               std::to_string(k + 1) + " 1k\n";
+  }
+  netlist += "Rlast n" + std::to_string(kResistors - 1) + " 0 1k\n";
+
+  Circuit* c = parse_netlist_string(netlist.c_str());
+  ASSERT_NE(c, nullptr);
+  ASSERT_GE(c->num_vars, kSparseSolverThreshold);
+
+  double* x = (double*)calloc(c->num_vars, sizeof(double));
+  ASSERT_NE(x, nullptr);
+
+  int iters = CircuitDcAnalysis(c, x, 100, 1e-9, 1e-6);
+  EXPECT_GT(iters, 0);
+
+  for (int k = 0; k < kResistors; k++) {
+    std::string name = "n" + std::to_string(k);
+    int node = CircuitGetNode(c, name.c_str());
+    ASSERT_GE(node, 0);
+    double expected = double(kResistors - k) / kResistors;
+    EXPECT_NEAR(x[c->nodes[node].var_index], expected, 1e-9);
+  }
+
+  free(x);
+  circuit_free(c);
+}
+
+TEST(ParserTest, LargeDiodeCircuitIterates) {
+  // Diode biased through a resistor, padded with a grounded resistor chain so
+  // the sparse path (with factorization reuse) is taken. Newton must iterate
+  // several times and the converged point must satisfy KCL at the anode.
+  std::string netlist = "V1 in 0 5\nR1 in a 1k\nD1 a 0 Is=1e-14 n=1\n";
+  for (int k = 0; k < kSparseSolverThreshold; k++) {
+    netlist += "RP" + std::to_string(k) + " p" + std::to_string(k) + " p" +
+               std::to_string(k + 1) + " 1k\n";
+  }
+  netlist += "RP0G p0 in 1k\nRPG p" + std::to_string(kSparseSolverThreshold) +
+             " 0 1k\n";
+
+  Circuit* c = parse_netlist_string(netlist.c_str());
+  ASSERT_NE(c, nullptr);
+  ASSERT_GE(c->num_vars, kSparseSolverThreshold);
+
+  double* x = (double*)calloc(c->num_vars, sizeof(double));
+  ASSERT_NE(x, nullptr);
+
+  int iters = CircuitDcAnalysis(c, x, 100, 1e-12, 1e-9);
+  EXPECT_GT(iters, 2);
+  ASSERT_NE(c->workspace, nullptr);
+  EXPECT_NE(c->workspace->lu, nullptr);
+
+  double va = x[c->nodes[CircuitGetNode(c, "a")].var_index];
+  double i_r = (5.0 - va) / 1000.0;
+  double i_d = 1e-14 * (std::exp(va / 0.025852) - 1.0);
+  EXPECT_NEAR(i_r, i_d, 1e-9);
+  EXPECT_NEAR(va, 0.69, 0.01);
+
+  free(x);
+  circuit_free(c);
+}
+
+// Sweep points collected by the DC sweep tests
+struct SweepRecord {
+  std::vector<std::vector<double>> values;
+  std::vector<std::vector<double>> x;
+};
+
+static void RecordSweepPoint(void* user, const double* values,
+                             const double* x, int num_vars) {
+  SweepRecord* r = static_cast<SweepRecord*>(user);
+  r->values.push_back({values[0], values[1]});
+  r->x.push_back(std::vector<double>(x, x + num_vars));
+}
+
+TEST(ParserTest, DcDirective) {
+  Circuit* c = parse_netlist_string(
+      "V1 1 0 1\nI1 0 1 1m\nR1 1 0 1k\n.dc V1 0 5 0.5 I1 0 1m 0.5m\n");
+  ASSERT_NE(c, nullptr);
+
+  ASSERT_EQ(c->num_dc_sweeps, 2);
+  EXPECT_STREQ(c->dc_sweeps[0].source, "V1");
+  EXPECT_DOUBLE_EQ(c->dc_sweeps[0].start, 0.0);
+  EXPECT_DOUBLE_EQ(c->dc_sweeps[0].stop, 5.0);
+  EXPECT_DOUBLE_EQ(c->dc_sweeps[0].step, 0.5);
+  EXPECT_STREQ(c->dc_sweeps[1].source, "I1");
+  EXPECT_DOUBLE_EQ(c->dc_sweeps[1].stop, 1e-3);
+  EXPECT_EQ(DcSweepNumPoints(&c->dc_sweeps[0]), 11);
+  EXPECT_EQ(DcSweepNumPoints(&c->dc_sweeps[1]), 3);
+
+  circuit_free(c);
+}
+
+TEST(ParserTest, DcSweepNumPoints) {
+  DcSweep s = {"V1", 0.0, 1.0, 0.1};
+  EXPECT_EQ(DcSweepNumPoints(&s), 11);
+  s.step = -0.1;
+  EXPECT_EQ(DcSweepNumPoints(&s), 0);
+  s.step = 0.0;
+  EXPECT_EQ(DcSweepNumPoints(&s), 0);
+  s = {"V1", 1.0, -1.0, -0.5};
+  EXPECT_EQ(DcSweepNumPoints(&s), 5);
+  s = {"V1", 2.0, 2.0, 0.0};
+  EXPECT_EQ(DcSweepNumPoints(&s), 1);
+}
+
+TEST(ParserTest, DcSweepMatchesColdSolves) {
+  // Diode I-V sweep: every warm-started point must match an independent
+  // operating point computed from zero
+  const char* netlist = "V1 in 0 0\nR1 in a 100\nD1 a 0 Is=1e-14 n=1\n";
+  Circuit* c = parse_netlist_string(netlist);
+  ASSERT_NE(c, nullptr);
+
+  DcSweep sweep = {"V1", 0.0, 2.0, 0.25};
+  SweepRecord rec;
+  std::vector<double> x(c->num_vars);
+  int points = CircuitDcSweep(c, nullptr, &sweep, 1, x.data(), 100, 1e-12,
+                              1e-9, RecordSweepPoint, &rec);
+  ASSERT_EQ(points, 9);
+  ASSERT_EQ(rec.x.size(), 9u);
+
+  // Source value is restored after the sweep
+  double v = -1.0;
+  ASSERT_EQ(DeviceGetValue(CircuitFindDevice(c, "v1"), &v), 0);
+  EXPECT_DOUBLE_EQ(v, 0.0);
+
+  Circuit* ref = parse_netlist_string(netlist);
+  ASSERT_NE(ref, nullptr);
+  std::vector<double> x_ref(ref->num_vars);
+  for (int k = 0; k < points; k++) {
+    EXPECT_DOUBLE_EQ(rec.values[k][0], 0.25 * k);
+    DeviceSetValue(CircuitFindDevice(ref, "V1"), rec.values[k][0]);
+    ASSERT_GT(CircuitDcAnalysis(ref, x_ref.data(), 100, 1e-12, 1e-9), 0);
+    for (int i = 0; i < c->num_vars; i++) {
+      EXPECT_NEAR(rec.x[k][i], x_ref[i], 1e-9);
+    }
+  }
+
+  circuit_free(ref);
+  circuit_free(c);
+}
+
+TEST(ParserTest, NestedDcSweep) {
+  // V(1) = V1 for the source-driven node; V(2) = I1 * 1k from the current
+  // source. Inner sweep is V1, outer sweep is I1.
+  Circuit* c = parse_netlist_string(
+      "V1 1 0 0\nR1 1 0 1k\nI1 0 2 0\nR2 2 0 1k\n"
+      ".DC V1 0 1 0.5 I1 0 2m 1m\n");
+  ASSERT_NE(c, nullptr);
+  ASSERT_EQ(c->num_dc_sweeps, 2);
+
+  SweepRecord rec;
+  std::vector<double> x(c->num_vars);
+  int points = CircuitDcSweep(c, nullptr, c->dc_sweeps, c->num_dc_sweeps,
+                              x.data(), 100, 1e-9, 1e-6, RecordSweepPoint,
+                              &rec);
+  ASSERT_EQ(points, 9);
+
+  int v1 = c->nodes[CircuitGetNode(c, "1")].var_index;
+  int v2 = c->nodes[CircuitGetNode(c, "2")].var_index;
+  for (int k = 0; k < points; k++) {
+    EXPECT_NEAR(rec.values[k][0], 0.5 * (k % 3), 1e-12);
+    EXPECT_NEAR(rec.values[k][1], 1e-3 * (k / 3), 1e-12);
+    EXPECT_NEAR(rec.x[k][v1], rec.values[k][0], 1e-9);
+    EXPECT_NEAR(rec.x[k][v2], rec.values[k][1] * 1000.0, 1e-9);
+  }
+
+  circuit_free(c);
+}
+
+TEST(ParserTest, DcSweepUnknownSource) {
+  Circuit* c = parse_netlist_string("V1 1 0 1\nR1 1 0 1k\n");
+  ASSERT_NE(c, nullptr);
+
+  DcSweep sweep = {"V9", 0.0, 1.0, 0.5};
+  std::vector<double> x(c->num_vars);
+  EXPECT_EQ(CircuitDcSweep(c, nullptr, &sweep, 1, x.data(), 100, 1e-9, 1e-6,
+                           nullptr, nullptr),
+            -1);
+
+  // Resistors have no sweepable value
+  DcSweep bad = {"R1", 0.0, 1.0, 0.5};
+  EXPECT_EQ(CircuitDcSweep(c, nullptr, &bad, 1, x.data(), 100, 1e-9, 1e-6,
+                           nullptr, nullptr),
+            -1);
+
+  circuit_free(c);
+}
+
+TEST(ParserTest, ValueSuffixes) {
+  Circuit* c = parse_netlist_string(
+      "R1 1 0 1k\nI1 0 1 +2\nI2 0 1 4.7k\nI3 0 1 2meg\nI4 0 1 3MIL\n"
+      "I5 0 1 100m\nI6 0 1 1.5e3\nI7 0 1 .5T\nI8 0 1 10Kohm\nI9 0 1 DC 3f\n");
+  ASSERT_NE(c, nullptr);
+
+  const double values[] = {2.0,   4.7e3,  2e6,  3 * 25.4e-6, 100e-3,
+                           1.5e3, 0.5e12, 10e3, 3e-15};
+  for (int i = 0; i < 9; i++) {
+    std::string name = "I" + std::to_string(i + 1);
+    double v = 0.0;
+    ASSERT_EQ(DeviceGetValue(CircuitFindDevice(c, name.c_str()), &v), 0);
+    EXPECT_DOUBLE_EQ(v, values[i]) << name;
+  }
+
+  circuit_free(c);
+}
+
+TEST(ParserTest, MalformedValuesSkipLine) {
+  // Malformed numbers report an error and drop the line instead of aborting
+  Circuit* c = parse_netlist_string(
+      "V1 1 0 5\nR1 1 0 abc\nR2 1 0\nD1 1 0 Is=x\nR3 1 0 1k\n"
+      "V2 2 0 PULSE(0 oops)\nR4 2 0 1k\n.TRAN 1n zz\n");
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(c->num_devices, 3);
+  EXPECT_EQ(CircuitFindDevice(c, "R1"), nullptr);
+  EXPECT_EQ(CircuitFindDevice(c, "D1"), nullptr);
+  EXPECT_EQ(CircuitFindDevice(c, "V2"), nullptr);
+  EXPECT_NE(CircuitFindDevice(c, "R3"), nullptr);
+  EXPECT_EQ(c->tran.tstop, 0.0);
+
+  circuit_free(c);
+}
+
+TEST(ParserTest, BufferWithoutTrailingNewline) {
+  // Not NUL-terminated: the buffer stops one character short of the string
+  const char* text = "V1 1 0 5\r\nR1 1 0 1k\r\nI1 0 1 25";
+  Circuit* c = parse_netlist_buffer(text, strlen(text) - 1, 1);
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(c->num_devices, 3);
+  double v = 0.0;
+  ASSERT_EQ(DeviceGetValue(CircuitFindDevice(c, "I1"), &v), 0);
+  EXPECT_DOUBLE_EQ(v, 2.0);
+  circuit_free(c);
+}
+
+TEST(ParserTest, ParseFile) {
+  std::string path = ::testing::TempDir() + "parser_test.net";
+  FILE* f = fopen(path.c_str(), "w");
+  ASSERT_NE(f, nullptr);
+  fputs("* divider\nV1 in 0 10\nR1 in out 1k\nR2 out 0 1k", f);
+  fclose(f);
+
+  Circuit* c = parse_netlist_file(path.c_str());
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(c->num_devices, 3);
+  std::vector<double> x(c->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-9, 1e-6), 0);
+  EXPECT_NEAR(x[c->nodes[CircuitGetNode(c, "out")].var_index], 5.0, 1e-9);
+  circuit_free(c);
+  remove(path.c_str());
+
+  EXPECT_EQ(parse_netlist_file("/nonexistent/netlist.net"), nullptr);
+  EXPECT_EQ(parse_netlist_file(::testing::TempDir().c_str()), nullptr);
+}
+
+TEST(ParserTest, ParallelTokenizationMatchesSerial) {
+  // A few MB of mixed elements, split into many chunks
+  std::string netlist = "V1 n0 0 PULSE(0 1 1u 1n 1n 1u 2u)\n.tran 1n 1u\n";
+  const int kStages = 40000;
+  for (int k = 0; k < kStages; k++) {
+    std::string a = "n" + std::to_string(k), b = "n" + std::to_string(k + 1);
+    netlist += "R" + std::to_string(k) + " " + a + " " + b + " 1k\n";
+    netlist += "* stage " + std::to_string(k) + "\n";
+    netlist += "C" + std::to_string(k) + " " + b + " 0 1p\n";
+    if (k % 100 == 0) {
+      netlist += "D" + std::to_string(k) + " " + b + " 0 Is=1e-15 n=1.5\n";
+    }
+  }
+
+  Circuit* serial = parse_netlist_buffer(netlist.data(), netlist.size(), 1);
+  Circuit* parallel = parse_netlist_buffer(netlist.data(), netlist.size(), 4);
+  ASSERT_NE(serial, nullptr);
+  ASSERT_NE(parallel, nullptr);
+
+  ASSERT_EQ(parallel->num_nodes, serial->num_nodes);
+  ASSERT_EQ(parallel->num_devices, serial->num_devices);
+  ASSERT_EQ(parallel->num_vars, serial->num_vars);
+  EXPECT_EQ(parallel->num_devices, 2 * kStages + kStages / 100 + 1);
+  EXPECT_DOUBLE_EQ(parallel->tran.tstop, 1e-6);
+  for (int i = 0; i < serial->num_nodes; i++) {
+    EXPECT_STREQ(parallel->nodes[i].name, serial->nodes[i].name);
+    EXPECT_EQ(parallel->nodes[i].var_index, serial->nodes[i].var_index);
+  }
+  for (Device *d = serial->devices, *e = parallel->devices; d && e;
+       d = d->next, e = e->next) {
+    ASSERT_STREQ(d->name, e->name);
+    for (int i = 0; i < 4; i++) EXPECT_EQ(d->nodes[i], e->nodes[i]);
+    double v = 0.0, w = 0.0;
+    EXPECT_EQ(DeviceGetValue(d, &v), DeviceGetValue(e, &w));
+    EXPECT_EQ(v, w);
+  }
+
+  circuit_free(serial);
+  circuit_free(parallel);
+}
+
+TEST(ParserTest, MosfetCommonSource) {
+  // Saturated common-source stage: Id = k/2 (Vgs - Vth)^2 with
+  // k = mu Cox W / L
+  Circuit* c = parse_netlist_string(
+      "VDD vdd 0 5\nVG g 0 1\nRD vdd d 100\n"
+      "M1 d g 0 0 W=100u L=1u mu=0.05 Cox=2.3e-2 VTO=0.5\n"
+      "M2 d g 0\nM3 x g 0 0 L=0\n");
+  ASSERT_NE(c, nullptr);
+  Device* m = CircuitFindDevice(c, "M1");
+  ASSERT_NE(m, nullptr);
+  EXPECT_EQ(CircuitFindDevice(c, "M2"), nullptr);  // Too few terminals
+  EXPECT_EQ(CircuitFindDevice(c, "M3"), nullptr);  // Invalid length
+  MosfetParams p;
+  ASSERT_EQ(MosfetGetParams(m, &p), 0);
+  EXPECT_DOUBLE_EQ(p.w, 100e-6);
+  EXPECT_DOUBLE_EQ(p.vth0, 0.5);
+  EXPECT_DOUBLE_EQ(p.beta, 0.5);  // Default
+
+  std::vector<double> x(c->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+  double k = 0.05 * 2.3e-2 * 100e-6 / 1e-6;
+  double id = 0.5 * k * 0.5 * 0.5;
+  double vd = x[c->nodes[CircuitGetNode(c, "d")].var_index];
+  EXPECT_NEAR(vd, 5.0 - 100.0 * id, 1e-6);
+
+  circuit_free(c);
+}
+
+TEST(ParserTest, NewtonPolicy) {
+  // A MOSFET switched hard on and a diode clamp driven far into forward
+  // bias from the zero initial guess
+  const char* netlist =
+      "VDD vdd 0 5\nVG g 0 5\nRD vdd d 1k\nM1 d g 0 0\n"
+      "VIN in 0 50\nR1 in a 1\nD1 a 0 Is=1e-9\nD2 a 0 Is=1e-9\n";
+  Circuit* c = parse_netlist_string(netlist);
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(c->newton.limit_junctions, 1);
+  EXPECT_EQ(c->newton.damping, kNewtonDampingNone);
+
+  std::vector<double> x(c->num_vars), y(c->num_vars);
+  int limited = CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9);
+  ASSERT_GT(limited, 0);
+  c->newton.limit_junctions = 0;
+  int plain = CircuitDcAnalysis(c, y.data(), 100, 1e-12, 1e-9);
+  ASSERT_GT(plain, 0);
+  EXPECT_LT(limited, plain);
+  for (int i = 0; i < c->num_vars; i++) {
+    EXPECT_NEAR(y[i], x[i], 1e-6 * std::fabs(x[i]) + 1e-9);
+  }
+
+  // Damped updates converge to the same solution; clones keep the policy
+  for (NewtonDamping damping :
+       {kNewtonDampingMaxStep, kNewtonDampingLineSearch}) {
+    c->newton = kDefaultNewtonPolicy;
+    c->newton.damping = damping;
+    Circuit* clone = CircuitClone(c);
+    ASSERT_NE(clone, nullptr);
+    EXPECT_EQ(clone->newton.damping, damping);
+    ASSERT_GT(CircuitDcAnalysis(clone, y.data(), 100, 1e-12, 1e-9), 0);
+    for (int i = 0; i < c->num_vars; i++) {
+      EXPECT_NEAR(y[i], x[i], 1e-6 * std::fabs(x[i]) + 1e-9) << damping;
+    }
+    circuit_free(clone);
+  }
+
+  circuit_free(c);
+}
+
+TEST(ParserTest, DcContinuation) {
+  // Series diode string into a 20V source: with junction limiting, Newton
+  // from zero needs more than 5 iterations
+  const char* diodes =
+      "V1 in 0 20\nR1 in a 1\nD1 a b\nD2 b c\nD3 c 0\nR2 b 0 1meg\n";
+  // Back-to-back diodes with a steep third junction: without limiting,
+  // Newton from zero needs about 40 iterations
+  const char* steep =
+      "V1 in 0 10\nR1 in a 10\nD1 a 0 Is=1e-16\nD2 0 a Is=1e-16\n"
+      "R2 a b 1\nD3 b 0 Is=1e-9 n=0.5\n";
+  struct Case {
+    const char* netlist;
+    int limit_junctions;
+    int max_iter;
+    int gmin_stepping;
+    DcStrategy strategy;
+  } cases[] = {
+      {diodes, 1, 5, 1, kDcGminStepping},
+      {steep, 0, 20, 1, kDcSourceStepping},  // Gmin stepping fails
+      {steep, 0, 20, 0, kDcSourceStepping},
+  };
+  for (const Case& k : cases) {
+    Circuit* c = parse_netlist_string(k.netlist);
+    ASSERT_NE(c, nullptr);
+    EXPECT_EQ(c->newton.gmin_stepping, 1);
+    EXPECT_EQ(c->newton.source_stepping, 1);
+    std::vector<double> x(c->num_vars), y(c->num_vars);
+    ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+    EXPECT_EQ(c->workspace->dc_strategy, kDcNewton);
+
+    c->newton.limit_junctions = k.limit_junctions;
+    c->newton.gmin_stepping = k.gmin_stepping;
+    int iters = CircuitDcAnalysis(c, y.data(), k.max_iter, 1e-12, 1e-9);
+    ASSERT_GT(iters, k.max_iter);
+    EXPECT_EQ(c->workspace->dc_strategy, k.strategy);
+    for (int i = 0; i < c->num_vars; i++) {
+      EXPECT_NEAR(y[i], x[i], 1e-6 * std::fabs(x[i]) + 1e-9);
+    }
+    double v1;
+    ASSERT_EQ(DeviceGetValue(CircuitFindDevice(c, "V1"), &v1), 0);
+    EXPECT_EQ(v1, k.netlist == diodes ? 20.0 : 10.0);  // Restored
+
+    // Without continuation the analysis fails
+    c->newton.gmin_stepping = 0;
+    c->newton.source_stepping = 0;
+    EXPECT_EQ(CircuitDcAnalysis(c, y.data(), k.max_iter, 1e-12, 1e-9), -1);
+    circuit_free(c);
+  }
+}
+
+TEST(ParserTest, SubcircuitMatchesFlatNetlist) {
+  // Instances before the definitions, a nested instance and a source
+  // inside a subcircuit
+  static const char* kHierarchical =
+      "V1 in 0 10\n"
+      "X1 in a div\n"
+      "X2 a b half\n"
+      ".subckt half p q\n"
+      "Xinner p q div\n"
+      "Ibias q 0 1m\n"
+      ".ends half\n"
+      ".SUBCKT div top out\n"
+      "R1 top mid 1k\n"
+      "R2 mid out 1k\n"
+      "R3 out gnd 2k\n"
+      ".ENDS\n";
+  static const char* kFlat =
+      "V1 in 0 10\n"
+      "R1 in m1 1k\nR2 m1 a 1k\nR3 a 0 2k\n"
+      "R4 a m2 1k\nR5 m2 b 1k\nR6 b 0 2k\nI1 b 0 1m\n";
+
+  Circuit* flat = parse_netlist_string(kFlat);
+  ASSERT_NE(flat, nullptr);
+  std::vector<double> y(flat->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(flat, y.data(), 100, 1e-12, 1e-9), 0);
+
+  for (int threads : {1, 4}) {
+    Circuit* c =
+        parse_netlist_buffer(kHierarchical, strlen(kHierarchical), threads);
+    ASSERT_NE(c, nullptr);
+    EXPECT_EQ(c->num_devices, flat->num_devices);
+    EXPECT_EQ(c->num_nodes, flat->num_nodes);
+
+    std::vector<double> x(c->num_vars);
+    ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+    const char* nodes[][2] = {{"a", "a"}, {"b", "b"}, {"X1.mid", "m1"},
+                              {"X2.Xinner.mid", "m2"}};
+    for (const auto& n : nodes) {
+      int i = CircuitGetNode(c, n[0]);
+      ASSERT_GE(i, 0) << n[0];
+      EXPECT_NEAR(x[c->nodes[i].var_index],
+                  y[flat->nodes[CircuitGetNode(flat, n[1])].var_index], 1e-9);
+    }
+
+    // Instances share the params of their template, but for sources
+    Device* r1 = CircuitFindDevice(c, "X1.R1");
+    Device* r1_nested = CircuitFindDevice(c, "X2.Xinner.R1");
+    ASSERT_NE(r1, nullptr);
+    ASSERT_NE(r1_nested, nullptr);
+    EXPECT_EQ(r1->params, r1_nested->params);
+    EXPECT_TRUE(r1->flags & kDeviceSharedParams);
+    Device* ibias = CircuitFindDevice(c, "X2.Ibias");
+    ASSERT_NE(ibias, nullptr);
+    EXPECT_FALSE(ibias->flags & kDeviceSharedParams);
+    circuit_free(c);
+  }
+  circuit_free(flat);
+}
+
+TEST(ParserTest, SubcircuitErrors) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 1\nR0 in 0 1k\n"
+      ".subckt load a\nR1 a 0 1k\n.ends\n"
+      ".subckt loop a\nX1 a loop\n.ends\n"
+      ".subckt load a\nR9 a 0 1\n.ends\n"   // Duplicate: ignored
+      ".subckt bad a 0\nR1 a 0 1\n.ends\n"  // Ground port
+      "X1 in load\n"
+      "X2 in in load\n"  // Wrong port count
+      "X3 in nothere\n"  // Unknown subcircuit
+      "X4 in loop\n"     // Recursive
+      "X5 in bad\n"
+      ".subckt open a\nR1 a 0 1k\n");  // Missing .ENDS
+  ASSERT_NE(c, nullptr);
+  EXPECT_NE(CircuitFindDevice(c, "X1.R1"), nullptr);
+  EXPECT_EQ(CircuitFindDevice(c, "X1.R9"), nullptr);
+  EXPECT_EQ(CircuitFindDevice(c, "X2.R1"), nullptr);
+  EXPECT_EQ(CircuitFindDevice(c, "X5.R1"), nullptr);
+
+  std::vector<double> x(c->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+  Device* v1 = CircuitFindDevice(c, "V1");
+  EXPECT_NEAR(x[v1->extra_var], -2e-3, 1e-12);  // R0 and X1.R1
+  circuit_free(c);
+}
+
+TEST(ParserTest, LongHierarchicalNames) {
+  // Flattened names well past 32 characters that differ only at the end
+  static const char* kNetlist =
+      "V1 in 0 1\n"
+      "Xfirst_stage_of_the_amplifier in a stage\n"
+      "Xfirst_stage_of_the_amplifier_b a 0 stage\n"
+      ".subckt stage p q\n"
+      "Xbias_network_with_a_long_name p q bias\n"
+      ".ends\n"
+      ".subckt bias t u\n"
+      "Vsense_current_of_the_bias_leg t m 0\n"
+      "Rload_of_the_bias_leg m u 1k\n"
+      ".ends\n"
+      ".dc Xfirst_stage_of_the_amplifier_b.Xbias_network_with_a_long_name."
+      "Vsense_current_of_the_bias_leg 0 1 0.5\n";
+  Circuit* c = parse_netlist_string(kNetlist);
+  ASSERT_NE(c, nullptr);
+  const std::string first =
+      "Xfirst_stage_of_the_amplifier.Xbias_network_with_a_long_name.";
+  const std::string second =
+      "Xfirst_stage_of_the_amplifier_b.Xbias_network_with_a_long_name.";
+  Device* r1 = CircuitFindDevice(c, (first + "Rload_of_the_bias_leg").c_str());
+  Device* r2 = CircuitFindDevice(c, (second + "Rload_of_the_bias_leg").c_str());
+  ASSERT_NE(r1, nullptr);
+  ASSERT_NE(r2, nullptr);
+  EXPECT_NE(r1, r2);
+  EXPECT_STREQ(r2->name, (second + "Rload_of_the_bias_leg").c_str());
+  EXPECT_EQ(CircuitFindDevice(c, (first + "Rload").c_str()), nullptr);
+
+  // The sweep source keeps its full name and is found by it
+  ASSERT_EQ(c->num_dc_sweeps, 1);
+  const std::string source = second + "Vsense_current_of_the_bias_leg";
+  EXPECT_STREQ(c->dc_sweeps[0].source, source.c_str());
+  SweepRecord rec;
+  std::vector<double> x(c->num_vars);
+  ASSERT_EQ(CircuitDcSweep(c, nullptr, c->dc_sweeps, c->num_dc_sweeps,
+                           x.data(), 100, 1e-12, 1e-9, RecordSweepPoint, &rec),
+            3);
+  int a = c->nodes[CircuitGetNode(c, "a")].var_index;
+  for (int k = 0; k < 3; k++) {
+    // V(a) = (1 + V) / 2 through the two equal loads
+    EXPECT_NEAR(rec.x[k][a], (1.0 + 0.5 * k) / 2.0, 1e-9);
+  }
+
+  // Edits by the full name reach the right instance
+  ASSERT_EQ(CircuitSetDeviceParam(c, source.c_str(), "dc", 0.25), 0);
+  ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+  EXPECT_NEAR(x[a], 0.625, 1e-9);
+  circuit_free(c);
+}
+
+// Resistor ladder of `stages` series resistors, each node shunted to ground,
+// with varied values so that edits move every node
+static std::string LadderNetlist(int stages) {
+  std::string netlist = "V1 n0 0 1\nI1 0 n" + std::to_string(stages / 2) +
+                        " 1m\n";
+  for (int k = 0; k < stages; k++) {
+    std::string a = "n" + std::to_string(k);
+    std::string b = "n" + std::to_string(k + 1);
+    netlist += "RS" + std::to_string(k) + " " + a + " " + b + " " +
+               std::to_string(100 + 37 * (k % 7)) + "\n";
+    netlist += "RG" + std::to_string(k) + " " + b + " 0 " +
+               std::to_string(1000 + 211 * (k % 5)) + "\n";
+  }
+  return netlist;
+}
+
+TEST(ParserTest, ParameterEditsResolveByLowRankUpdates) {
+  // Dense, dense mixed precision and sparse: each edit of one or two
+  // resistors is solved from the first factorization and matches a fresh
+  // analysis of the edited circuit
+  struct Case {
+    int stages;
+    int mixed_precision;
+  };
+  for (Case cs : {Case{20, 0}, Case{20, 1},
+                  Case{2 * kSparseSolverThreshold, 0}}) {
+    std::string netlist = LadderNetlist(cs.stages);
+    Circuit* c = parse_netlist_string(netlist.c_str());
+    ASSERT_NE(c, nullptr);
+    c->linear_solver.mixed_precision = cs.mixed_precision;
+    std::vector<double> x(c->num_vars, 0.0);
+    ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+    EXPECT_EQ(c->workspace->use_sparse, cs.stages >= kSparseSolverThreshold);
+
+    Circuit* ref = parse_netlist_string(netlist.c_str());
+    ASSERT_NE(ref, nullptr);
+    std::vector<double> x_ref(ref->num_vars, 0.0);
+
+    const int kEdits = 6;
+    for (int e = 0; e < kEdits; e++) {
+      std::string rs = "RS" + std::to_string((5 * e) % cs.stages);
+      std::string rg = "RG" + std::to_string((3 * e + 1) % cs.stages);
+      double value = 50.0 * (e + 1);
+      ASSERT_EQ(CircuitSetDeviceParam(c, rs.c_str(), "r", value), 0);
+      ASSERT_EQ(CircuitSetDeviceParam(ref, rs.c_str(), "R", value), 0);
+      if (e % 2) {
+        ASSERT_EQ(CircuitSetDeviceParam(c, rg.c_str(), "r", 3 * value), 0);
+        ASSERT_EQ(CircuitSetDeviceParam(ref, rg.c_str(), "r", 3 * value), 0);
+      }
+      ASSERT_EQ(CircuitDcResolve(c, nullptr, x.data(), 100, 1e-12, 1e-9), 1);
+      ASSERT_GT(CircuitDcAnalysis(ref, x_ref.data(), 100, 1e-12, 1e-9), 0);
+      for (int i = 0; i < c->num_vars; i++) {
+        EXPECT_NEAR(x[i], x_ref[i], 1e-9 * (1.0 + fabs(x_ref[i])));
+      }
+    }
+    EXPECT_EQ(c->param_edits, kEdits + kEdits / 2);
+
+    SimStats s;
+    SimWorkspaceGetStats(c->workspace, &s);
+    EXPECT_EQ(s.factorizations, 1);
+    EXPECT_EQ(s.low_rank_solves, kEdits);
+
+    // Too many changed rows for an update: refactored
+    for (int k = 0; k < kMaxUpdateRank; k++) {
+      std::string rg = "RG" + std::to_string(k);
+      ASSERT_EQ(CircuitSetDeviceParam(c, rg.c_str(), "r", 5e3), 0);
+    }
+    ASSERT_EQ(CircuitDcResolve(c, nullptr, x.data(), 100, 1e-12, 1e-9), 1);
+    SimWorkspaceGetStats(c->workspace, &s);
+    EXPECT_EQ(s.factorizations, 2);
+    EXPECT_EQ(s.low_rank_solves, kEdits);
+
+    // Analyses outside CircuitDcResolve refactor after edits
+    ASSERT_EQ(CircuitSetDeviceParam(c, "RS0", "r", 75.0), 0);
+    ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+    SimWorkspaceGetStats(c->workspace, &s);
+    EXPECT_EQ(s.factorizations, 3);
+
+    circuit_free(ref);
+    circuit_free(c);
+  }
+}
+
+TEST(ParserTest, ParameterEditsWarmStartNonlinearCircuits) {
+  // Diodes loaded through resistors, enough of them to be batched: edits of
+  // two of them are re-solved from the previous solution in fewer
+  // iterations than from zero, to the same operating point
+  std::string netlist = "V1 in 0 2\n";
+  for (int k = 0; k < 2 * kDeviceBatchMinSize; k++) {
+    std::string s = std::to_string(k);
+    netlist += "R" + s + " in a" + s + " " + std::to_string(500 + 50 * k) +
+               "\nD" + s + " a" + s + " 0 Is=1e-14 n=1\n";
+  }
+  Circuit* c = parse_netlist_string(netlist.c_str());
+  ASSERT_NE(c, nullptr);
+  std::vector<double> x(c->num_vars, 0.0);
+  int cold = CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9);
+  ASSERT_GT(cold, 0);
+  ASSERT_NE(c->workspace->batches, nullptr);
+
+  Circuit* ref = parse_netlist_string(netlist.c_str());
+  ASSERT_NE(ref, nullptr);
+  ASSERT_EQ(CircuitSetDeviceParam(c, "D3", "Is", 3e-14), 0);
+  ASSERT_EQ(CircuitSetDeviceParam(c, "d7", "n", 1.2), 0);
+  ASSERT_EQ(CircuitSetDeviceParam(ref, "D3", "is", 3e-14), 0);
+  ASSERT_EQ(CircuitSetDeviceParam(ref, "D7", "N", 1.2), 0);
+
+  int warm = CircuitDcResolve(c, nullptr, x.data(), 100, 1e-12, 1e-9);
+  ASSERT_GT(warm, 0);
+  EXPECT_LT(warm, cold);
+  std::vector<double> x_ref(ref->num_vars, 0.0);
+  ASSERT_GT(CircuitDcAnalysis(ref, x_ref.data(), 100, 1e-12, 1e-9), 0);
+  for (int i = 0; i < c->num_vars; i++) EXPECT_NEAR(x[i], x_ref[i], 1e-9);
+
+  // The larger saturation current lowers its diode's forward voltage
+  double v3 = x[CircuitGetVarIndex(c, CircuitGetNode(c, "a3"))];
+  double v4 = x[CircuitGetVarIndex(c, CircuitGetNode(c, "a4"))];
+  EXPECT_LT(v3, v4);
+
+  circuit_free(ref);
+  circuit_free(c);
+}
+
+TEST(ParserTest, ParameterEditErrors) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 1\nR1 in a 1k\nC1 a 0 1n\nD1 a 0 Is=1e-14\n"
+      "M1 a in 0 0 W=10u L=1u\n");
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(CircuitSetDeviceParam(c, "R9", "r", 1.0), -1);
+  EXPECT_EQ(CircuitSetDeviceParam(c, "R1", "c", 1.0), -1);
+  EXPECT_EQ(CircuitSetDeviceParam(c, "R1", "r", 0.0), -1);
+  EXPECT_EQ(CircuitSetDeviceParam(c, "R1", "r", NAN), -1);
+  EXPECT_EQ(CircuitSetDeviceParam(c, "C1", "c", -1e-9), -1);
+  EXPECT_EQ(CircuitSetDeviceParam(c, "D1", "is", 0.0), -1);
+  EXPECT_EQ(CircuitSetDeviceParam(c, "M1", "l", 0.0), -1);
+  EXPECT_EQ(CircuitSetDeviceParam(c, "M1", "beta", 1.5), -1);
+  EXPECT_EQ(CircuitSetDeviceParam(c, "M1", "vth0", -0.2), 0);
+  EXPECT_EQ(CircuitSetDeviceParam(c, "M1", "gamma", 0.0), 0);
+  EXPECT_EQ(CircuitSetDeviceParam(c, "V1", "dc", 2.0), 0);
+  EXPECT_EQ(CircuitSetDeviceParam(c, "R1", "dc", 2.0), -1);
+  EXPECT_EQ(c->param_edits, 3);
+
+  MosfetParams p;
+  ASSERT_EQ(MosfetGetParams(CircuitFindDevice(c, "M1"), &p), 0);
+  EXPECT_DOUBLE_EQ(p.vth0, -0.2);
+  double v;
+  ASSERT_EQ(DeviceGetValue(CircuitFindDevice(c, "V1"), &v), 0);
+  EXPECT_DOUBLE_EQ(v, 2.0);
+
+  // Clones share the params of the original read-only; their sources are
+  // their own
+  Circuit* clone = CircuitClone(c);
+  ASSERT_NE(clone, nullptr);
+  EXPECT_EQ(CircuitSetDeviceParam(clone, "R1", "r", 2e3), -1);
+  EXPECT_EQ(CircuitSetDeviceParam(clone, "V1", "dc", 3.0), 0);
+  circuit_free(clone);
+  circuit_free(c);
+}
+
 }  // namespace minispice
\ No newline at end of file
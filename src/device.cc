@@ -1,6 +1,7 @@
 /**
  * @file device.cc
- * @brief Device implementations for Resistor, Current Source, Voltage Source
+ * @brief Device implementations for Resistor, Current Source, Voltage Source,
+ * Capacitor, Inductor, Diode and MOSFET
  */
 
 #include "device.h"
@@ -10,6 +11,9 @@
 #include <cstring>
 
 #include "circuit.h"
+#include "device_arena.h"
+#include "string_arena.h"
+#include "table_model.h"
 
 namespace minispice {
 
@@ -48,7 +52,7 @@ static void ResistorStampNonlinear(Device* d, StampContext* ctx,
 static void ResistorStampTransient(Device* d, StampContext* ctx,
                                    TimeStepState* ts) {
   (void)ts;
-  IterationState it = {0, nullptr, 0.0, 0.0};
+  IterationState it = {0, nullptr, 0.0, 0.0, NewtonPolicy{}, nullptr, 0.0};
   ResistorStampNonlinear(d, ctx, &it);
 }
 
@@ -60,7 +64,7 @@ static void ResistorUpdateState(Device* d, double* x, TimeStepState* ts) {
 
 static void ResistorFree(Device* d) {
   if (d) {
-    free(d->params);
+    if (!(d->flags & kDeviceSharedParams)) free(d->params);
     free(d->state);
     free(d);
   }
@@ -71,16 +75,31 @@ static const DeviceVTable kResistorVTable = {
     .StampNonlinear = ResistorStampNonlinear,
     .StampTransient = ResistorStampTransient,
     .UpdateState = ResistorUpdateState,
-    .Free = ResistorFree};
+    .Free = ResistorFree,
+    .is_linear = 1,
+    .params_size = sizeof(ResistorParams),
+    .state_size = 0};
 
 // ============================================================================
 // Current Source Implementation
 // ============================================================================
 
 struct CurrentSourceParams {
-  double i;  // Current in amperes
+  double i;             // DC current in amperes
+  int has_pulse;        // 1 if the transient value follows pulse
+  PulseWaveform pulse;  // Transient waveform (amperes)
+  double ac_mag;        // AC excitation magnitude (amperes), 0 if none
+  double ac_phase;      // AC excitation phase (degrees)
 };
 
+// Add sign times the phasor mag at phase degrees to row of (b_re, b_im)
+static void AddAcPhasor(double* b_re, double* b_im, int row, double sign,
+                        double mag, double phase) {
+  double rad = phase * (M_PI / 180.0);
+  b_re[row] += sign * mag * cos(rad);
+  b_im[row] += sign * mag * sin(rad);
+}
+
 static void CurrentSourceInit(Device* d, Circuit* c) {
   (void)d;
   (void)c;
@@ -103,9 +122,15 @@ static void CurrentSourceStampNonlinear(Device* d, StampContext* ctx,
 
 static void CurrentSourceStampTransient(Device* d, StampContext* ctx,
                                         TimeStepState* ts) {
-  (void)ts;
-  IterationState it = {0, nullptr, 0.0, 0.0};
-  CurrentSourceStampNonlinear(d, ctx, &it);
+  CurrentSourceParams* p = static_cast<CurrentSourceParams*>(d->params);
+  if (!p || !ts) return;
+
+  double i = p->has_pulse ? PulseWaveformValue(&p->pulse, ts->t) : p->i;
+  int n1 = d->nodes[0];
+  int n2 = d->nodes[1];
+
+  if (n1 >= 0) CtxAddZ(ctx, n1, -i);
+  if (n2 >= 0) CtxAddZ(ctx, n2, +i);
 }
 
 static void CurrentSourceUpdateState(Device* d, double* x, TimeStepState* ts) {
@@ -116,25 +141,71 @@ static void CurrentSourceUpdateState(Device* d, double* x, TimeStepState* ts) {
 
 static void CurrentSourceFree(Device* d) {
   if (d) {
-    free(d->params);
+    if (!(d->flags & kDeviceSharedParams)) free(d->params);
     free(d->state);
     free(d);
   }
 }
 
+static void CurrentSourceSetValue(Device* d, double value) {
+  CurrentSourceParams* p = static_cast<CurrentSourceParams*>(d->params);
+  if (p) p->i = value;
+}
+
+static double CurrentSourceGetValue(const Device* d) {
+  const CurrentSourceParams* p =
+      static_cast<const CurrentSourceParams*>(d->params);
+  return p ? p->i : 0.0;
+}
+
+static double CurrentSourceNextBreakpoint(const Device* d, double t) {
+  const CurrentSourceParams* p =
+      static_cast<const CurrentSourceParams*>(d->params);
+  if (!p || !p->has_pulse) return INFINITY;
+  return PulseWaveformNextBreakpoint(&p->pulse, t);
+}
+
+static void CurrentSourceStampAc(Device* d, StampContext* ctx,
+                                 const double* x, double* b_re,
+                                 double* b_im) {
+  (void)ctx;
+  (void)x;
+
+  const CurrentSourceParams* p =
+      static_cast<const CurrentSourceParams*>(d->params);
+  if (!p || p->ac_mag == 0.0) return;
+
+  int n1 = d->nodes[0];
+  int n2 = d->nodes[1];
+
+  if (n1 >= 0) AddAcPhasor(b_re, b_im, n1, -1.0, p->ac_mag, p->ac_phase);
+  if (n2 >= 0) AddAcPhasor(b_re, b_im, n2, +1.0, p->ac_mag, p->ac_phase);
+}
+
 static const DeviceVTable kCurrentSourceVTable = {
     .Init = CurrentSourceInit,
     .StampNonlinear = CurrentSourceStampNonlinear,
     .StampTransient = CurrentSourceStampTransient,
     .UpdateState = CurrentSourceUpdateState,
-    .Free = CurrentSourceFree};
+    .Free = CurrentSourceFree,
+    .SetValue = CurrentSourceSetValue,
+    .GetValue = CurrentSourceGetValue,
+    .NextBreakpoint = CurrentSourceNextBreakpoint,
+    .StampAc = CurrentSourceStampAc,
+    .is_linear = 1,
+    .params_size = sizeof(CurrentSourceParams),
+    .state_size = 0};
 
 // ============================================================================
 // Voltage Source Implementation
 // ============================================================================
 
 struct VoltageSourceParams {
-  double v;  // Voltage in volts
+  double v;             // DC voltage in volts
+  int has_pulse;        // 1 if the transient value follows pulse
+  PulseWaveform pulse;  // Transient waveform (volts)
+  double ac_mag;        // AC excitation magnitude (volts), 0 if none
+  double ac_phase;      // AC excitation phase (degrees)
 };
 
 static void VoltageSourceInit(Device* d, Circuit* c) {
@@ -142,15 +213,10 @@ static void VoltageSourceInit(Device* d, Circuit* c) {
   (void)d;
 }
 
-static void VoltageSourceStampNonlinear(Device* d, StampContext* ctx,
-                                        IterationState* it) {
-  (void)it;
-
-  VoltageSourceParams* p = static_cast<VoltageSourceParams*>(d->params);
-  if (!p) return;
+// Branch equation v(n1) - v(n2) = v and the branch current in the KCL rows
+static void VoltageSourceStamp(Device* d, StampContext* ctx, double v) {
   if (d->extra_var < 0) return;
 
-  double v = p->v;
   int n1 = d->nodes[0];
   int n2 = d->nodes[1];
   int k = d->extra_var;
@@ -166,11 +232,23 @@ static void VoltageSourceStampNonlinear(Device* d, StampContext* ctx,
   CtxAddZ(ctx, k, v);
 }
 
+static void VoltageSourceStampNonlinear(Device* d, StampContext* ctx,
+                                        IterationState* it) {
+  (void)it;
+
+  VoltageSourceParams* p = static_cast<VoltageSourceParams*>(d->params);
+  if (!p) return;
+
+  VoltageSourceStamp(d, ctx, p->v);
+}
+
 static void VoltageSourceStampTransient(Device* d, StampContext* ctx,
                                         TimeStepState* ts) {
-  (void)ts;
-  IterationState it = {0, nullptr, 0.0, 0.0};
-  VoltageSourceStampNonlinear(d, ctx, &it);
+  VoltageSourceParams* p = static_cast<VoltageSourceParams*>(d->params);
+  if (!p || !ts) return;
+
+  double v = p->has_pulse ? PulseWaveformValue(&p->pulse, ts->t) : p->v;
+  VoltageSourceStamp(d, ctx, v);
 }
 
 static void VoltageSourceUpdateState(Device* d, double* x, TimeStepState* ts) {
@@ -181,18 +259,56 @@ static void VoltageSourceUpdateState(Device* d, double* x, TimeStepState* ts) {
 
 static void VoltageSourceFree(Device* d) {
   if (d) {
-    free(d->params);
+    if (!(d->flags & kDeviceSharedParams)) free(d->params);
     free(d->state);
     free(d);
   }
 }
 
+static void VoltageSourceSetValue(Device* d, double value) {
+  VoltageSourceParams* p = static_cast<VoltageSourceParams*>(d->params);
+  if (p) p->v = value;
+}
+
+static double VoltageSourceGetValue(const Device* d) {
+  const VoltageSourceParams* p =
+      static_cast<const VoltageSourceParams*>(d->params);
+  return p ? p->v : 0.0;
+}
+
+static double VoltageSourceNextBreakpoint(const Device* d, double t) {
+  const VoltageSourceParams* p =
+      static_cast<const VoltageSourceParams*>(d->params);
+  if (!p || !p->has_pulse) return INFINITY;
+  return PulseWaveformNextBreakpoint(&p->pulse, t);
+}
+
+static void VoltageSourceStampAc(Device* d, StampContext* ctx,
+                                 const double* x, double* b_re,
+                                 double* b_im) {
+  (void)ctx;
+  (void)x;
+
+  const VoltageSourceParams* p =
+      static_cast<const VoltageSourceParams*>(d->params);
+  if (!p || p->ac_mag == 0.0 || d->extra_var < 0) return;
+
+  AddAcPhasor(b_re, b_im, d->extra_var, +1.0, p->ac_mag, p->ac_phase);
+}
+
 static const DeviceVTable kVoltageSourceVTable = {
     .Init = VoltageSourceInit,
     .StampNonlinear = VoltageSourceStampNonlinear,
     .StampTransient = VoltageSourceStampTransient,
     .UpdateState = VoltageSourceUpdateState,
-    .Free = VoltageSourceFree};
+    .Free = VoltageSourceFree,
+    .SetValue = VoltageSourceSetValue,
+    .GetValue = VoltageSourceGetValue,
+    .NextBreakpoint = VoltageSourceNextBreakpoint,
+    .StampAc = VoltageSourceStampAc,
+    .is_linear = 1,
+    .params_size = sizeof(VoltageSourceParams),
+    .state_size = 0};
 
 // ============================================================================
 // Capacitor Implementation
@@ -202,15 +318,9 @@ struct CapacitorParams {
   double c;  // Capacitance in farads
 };
 
-struct CapacitorState {
-  double v_prev;
-  double v_prev2;
-  double i_prev;
-};
-
 static void CapacitorInit(Device* d, Circuit* c) {
   (void)c;
-  d->state = calloc(1, sizeof(CapacitorState));
+  if (!d->state) d->state = calloc(1, sizeof(CapacitorState));
 }
 
 static void CapacitorStampNonlinear(Device* d, StampContext* ctx,
@@ -226,18 +336,18 @@ static void CapacitorStampTransient(Device* d, StampContext* ctx,
   CapacitorState* s = static_cast<CapacitorState*>(d->state);
   if (!p || !ts || !ts->im) return;
 
-  double c = p->c;
-  double h = ts->h;
-  const IntegrationMethod* im = ts->im;
-
-  double g_eq = im->alpha0 * c / h;
-  double i_eq = (im->alpha1 * c / h) * s->v_prev;
-  if (im->required_history >= 2) {
-    i_eq += (im->alpha2 * c / h) * s->v_prev2;
-  }
-
-  if (strcmp(im->name, "trapezoidal") == 0) {
-    i_eq += s->i_prev;
+  double g_eq, i_eq;
+  switch (ts->im->kind) {
+    case kIntegrationTrapezoidal:
+      CapacitorCompanion<kIntegrationTrapezoidal>(p->c, s, ts, &g_eq, &i_eq);
+      break;
+    case kIntegrationGear2:
+      CapacitorCompanion<kIntegrationGear2>(p->c, s, ts, &g_eq, &i_eq);
+      break;
+    default:
+      CapacitorCompanion<kIntegrationBackwardEuler>(p->c, s, ts, &g_eq,
+                                                    &i_eq);
+      break;
   }
 
   int n1 = d->nodes[0];
@@ -250,8 +360,9 @@ static void CapacitorStampTransient(Device* d, StampContext* ctx,
     CtxAddA(ctx, n2, n1, -g_eq);
   }
 
-  if (n1 >= 0) CtxAddZ(ctx, n1, -i_eq);
-  if (n2 >= 0) CtxAddZ(ctx, n2, +i_eq);
+  // Companion current source I_eq drives current into n1
+  if (n1 >= 0) CtxAddZ(ctx, n1, +i_eq);
+  if (n2 >= 0) CtxAddZ(ctx, n2, -i_eq);
 }
 
 static void CapacitorUpdateState(Device* d, double* x, TimeStepState* ts) {
@@ -266,30 +377,76 @@ static void CapacitorUpdateState(Device* d, double* x, TimeStepState* ts) {
   double v2 = (n2 >= 0) ? x[n2] : 0.0;
   double v = v1 - v2;
 
-  if (ts->im && strcmp(ts->im->name, "trapezoidal") == 0) {
-    double c = p->c;
-    double h = ts->h;
-    s->i_prev = (2.0 * c / h) * (v - s->v_prev) - s->i_prev;
+  // Capacitor current at the accepted point, i_n = G_eq * v_n - I_eq
+  IntegrationKind kind = ts->im ? ts->im->kind : kIntegrationBackwardEuler;
+  switch (kind) {
+    case kIntegrationTrapezoidal:
+      CapacitorAdvance<kIntegrationTrapezoidal>(p->c, s, ts, v);
+      break;
+    case kIntegrationGear2:
+      CapacitorAdvance<kIntegrationGear2>(p->c, s, ts, v);
+      break;
+    default:
+      CapacitorAdvance<kIntegrationBackwardEuler>(p->c, s, ts, v);
+      break;
   }
+}
+
+static void CapacitorInitState(Device* d, const double* x) {
+  CapacitorState* s = static_cast<CapacitorState*>(d->state);
+  if (!s || !x) return;
 
-  s->v_prev2 = s->v_prev;
+  int n1 = d->nodes[0];
+  int n2 = d->nodes[1];
+  double v = ((n1 >= 0) ? x[n1] : 0.0) - ((n2 >= 0) ? x[n2] : 0.0);
+
+  // Operating point: no current through the capacitor
   s->v_prev = v;
+  s->v_prev2 = v;
+  s->i_prev = 0.0;
 }
 
 static void CapacitorFree(Device* d) {
   if (d) {
-    free(d->params);
+    if (!(d->flags & kDeviceSharedParams)) free(d->params);
     free(d->state);
     free(d);
   }
 }
 
+// i = C dv/dt: C in the capacitance matrix between the terminals
+static void CapacitorStampAc(Device* d, StampContext* ctx, const double* x,
+                             double* b_re, double* b_im) {
+  (void)x;
+  (void)b_re;
+  (void)b_im;
+
+  const CapacitorParams* p = static_cast<const CapacitorParams*>(d->params);
+  if (!p) return;
+
+  double c = p->c;
+  int n1 = d->nodes[0];
+  int n2 = d->nodes[1];
+
+  if (n1 >= 0) CtxAddA(ctx, n1, n1, +c);
+  if (n2 >= 0) CtxAddA(ctx, n2, n2, +c);
+  if (n1 >= 0 && n2 >= 0) {
+    CtxAddA(ctx, n1, n2, -c);
+    CtxAddA(ctx, n2, n1, -c);
+  }
+}
+
 static const DeviceVTable kCapacitorVTable = {
     .Init = CapacitorInit,
     .StampNonlinear = CapacitorStampNonlinear,
     .StampTransient = CapacitorStampTransient,
     .UpdateState = CapacitorUpdateState,
-    .Free = CapacitorFree};
+    .Free = CapacitorFree,
+    .InitState = CapacitorInitState,
+    .StampAc = CapacitorStampAc,
+    .is_linear = 1,
+    .params_size = sizeof(CapacitorParams),
+    .state_size = sizeof(CapacitorState)};
 
 // ============================================================================
 // Inductor Implementation
@@ -308,7 +465,7 @@ struct InductorState {
 static void InductorInit(Device* d, Circuit* c) {
   (void)c;
   d->extra_var = -2;
-  d->state = calloc(1, sizeof(InductorState));
+  if (!d->state) d->state = calloc(1, sizeof(InductorState));
 }
 
 static void InductorStampNonlinear(Device* d, StampContext* ctx,
@@ -343,13 +500,20 @@ static void InductorStampTransient(Device* d, StampContext* ctx,
   int k = d->extra_var;
 
   double r_eq = im->beta0 * l / h;
-  double v_eq = (im->beta1 * l / h) * s->i_prev;
-  if (im->required_history >= 2) {
-    v_eq += (im->beta2 * l / h) * s->i_prev2;
-  }
-
-  if (strcmp(im->name, "trapezoidal") == 0) {
-    v_eq += s->v_prev;
+  double v_eq;
+  switch (im->kind) {
+    case kIntegrationTrapezoidal:
+      v_eq = CompanionHistory<kIntegrationTrapezoidal>(
+          im->beta1, im->beta2, l, h, s->i_prev, s->i_prev2, s->v_prev);
+      break;
+    case kIntegrationGear2:
+      v_eq = CompanionHistory<kIntegrationGear2>(
+          im->beta1, im->beta2, l, h, s->i_prev, s->i_prev2, s->v_prev);
+      break;
+    default:
+      v_eq = CompanionHistory<kIntegrationBackwardEuler>(
+          im->beta1, im->beta2, l, h, s->i_prev, s->i_prev2, s->v_prev);
+      break;
   }
 
   int n1 = d->nodes[0];
@@ -379,30 +543,138 @@ static void InductorUpdateState(Device* d, double* x, TimeStepState* ts) {
 
   double i = x[k];
 
-  if (ts->im && strcmp(ts->im->name, "trapezoidal") == 0) {
-    double v1 = (n1 >= 0) ? x[n1] : 0.0;
-    double v2 = (n2 >= 0) ? x[n2] : 0.0;
-    s->v_prev = v1 - v2;
-  }
+  // Terminal voltage is kept for every method so that a switch to
+  // trapezoidal has a valid v_{n-1}
+  double v1 = (n1 >= 0) ? x[n1] : 0.0;
+  double v2 = (n2 >= 0) ? x[n2] : 0.0;
+  s->v_prev = v1 - v2;
 
   s->i_prev2 = s->i_prev;
   s->i_prev = i;
 }
 
+static void InductorInitState(Device* d, const double* x) {
+  InductorState* s = static_cast<InductorState*>(d->state);
+  if (!s || !x || d->extra_var < 0) return;
+
+  // Operating point: the inductor is a short with no voltage across it
+  s->i_prev = x[d->extra_var];
+  s->i_prev2 = s->i_prev;
+  s->v_prev = 0.0;
+}
+
 static void InductorFree(Device* d) {
   if (d) {
-    free(d->params);
+    if (!(d->flags & kDeviceSharedParams)) free(d->params);
     free(d->state);
     free(d);
   }
 }
 
+// Branch equation v(n1) - v(n2) - L di/dt = 0: -L on the branch current
+static void InductorStampAc(Device* d, StampContext* ctx, const double* x,
+                            double* b_re, double* b_im) {
+  (void)x;
+  (void)b_re;
+  (void)b_im;
+
+  const InductorParams* p = static_cast<const InductorParams*>(d->params);
+  if (!p || d->extra_var < 0) return;
+
+  CtxAddA(ctx, d->extra_var, d->extra_var, -p->l);
+}
+
 static const DeviceVTable kInductorVTable = {
     .Init = InductorInit,
     .StampNonlinear = InductorStampNonlinear,
     .StampTransient = InductorStampTransient,
     .UpdateState = InductorUpdateState,
-    .Free = InductorFree};
+    .Free = InductorFree,
+    .InitState = InductorInitState,
+    .StampAc = InductorStampAc,
+    .is_linear = 1,
+    .params_size = sizeof(InductorParams),
+    .state_size = sizeof(InductorState)};
+
+// ============================================================================
+// Junction Voltage Limiting
+// ============================================================================
+
+// Limited voltages of a device in two consecutive Newton iterations
+struct VoltageLimitState {
+  int iter;        // Iteration lin belongs to
+  double lin[2];   // Voltages linearized at in iteration iter
+  double base[2];  // Voltages linearized at in iteration iter - 1
+};
+
+// Limiting reference of iteration iter: the voltages of the previous
+// iteration. Starting a new iteration moves lin to base.
+static const double* LimitBase(VoltageLimitState* s, int iter) {
+  if (iter != s->iter) {
+    s->base[0] = s->lin[0];
+    s->base[1] = s->lin[1];
+    s->iter = iter;
+  }
+  return s->base;
+}
+
+double PnjLimit(double vnew, double vold, double n_vt, double vcrit) {
+  if (vnew > vcrit && fabs(vnew - vold) > 2.0 * n_vt) {
+    if (vold > 0.0) {
+      double arg = 1.0 + (vnew - vold) / n_vt;
+      vnew = arg > 0.0 ? vold + n_vt * log(arg) : vcrit;
+    } else {
+      vnew = n_vt * log(vnew / n_vt);
+    }
+  }
+  return vnew;
+}
+
+double FetLimit(double vnew, double vold, double vto) {
+  double vtsthi = fabs(2.0 * (vold - vto)) + 2.0;
+  double vtstlo = fabs(vold - vto) + 1.0;
+  double vtox = vto + 3.5;
+  double delv = vnew - vold;
+
+  if (vold >= vto) {
+    if (vold >= vtox) {
+      if (delv <= 0.0) {
+        // Turning off
+        if (vnew >= vtox) {
+          if (-delv > vtstlo) vnew = vold - vtstlo;
+        } else {
+          vnew = fmax(vnew, vto + 2.0);
+        }
+      } else if (delv >= vtsthi) {
+        vnew = vold + vtsthi;  // Staying on
+      }
+    } else {
+      // Near threshold
+      vnew = delv <= 0.0 ? fmax(vnew, vto - 0.5) : fmin(vnew, vto + 4.0);
+    }
+  } else if (delv <= 0.0) {
+    // Off, going further off
+    if (-delv > vtsthi) vnew = vold - vtsthi;
+  } else {
+    // Off, turning on
+    double vtemp = vto + 0.5;
+    if (vnew <= vtemp) {
+      if (delv > vtstlo) vnew = vold + vtstlo;
+    } else {
+      vnew = vtemp;
+    }
+  }
+  return vnew;
+}
+
+double LimvdsLimit(double vnew, double vold) {
+  if (vold >= 3.5) {
+    if (vnew > vold) return fmin(vnew, 3.0 * vold + 2.0);
+    if (vnew < 3.5) return fmax(vnew, 2.0);
+    return vnew;
+  }
+  return vnew > vold ? fmin(vnew, 4.0) : fmax(vnew, -0.5);
+}
 
 // ============================================================================
 // Diode Implementation
@@ -413,11 +685,65 @@ struct DiodeParams {
   double n;
 };
 
-static constexpr double kVT = 0.025852;
+struct DiodeState {
+  VoltageLimitState limit;  // Junction voltage (lin[0], base[0])
+
+  // Last unlimited linearization, for bypass
+  int cached;        // 1 if vd_eval, g and i_eq are valid
+  int cached_table;  // 1 if it was evaluated from the device table
+  double vd_eval;    // Junction voltage it was evaluated at
+  double g;
+  double i_eq;
+};
 
 static void DiodeInit(Device* d, Circuit* c) {
-  (void)d;
   (void)c;
+  if (!d->state) d->state = calloc(1, sizeof(DiodeState));
+}
+
+double DiodeLimitVoltage(Device* d, double vd, int iter) {
+  const DiodeParams* p = static_cast<const DiodeParams*>(d->params);
+  DiodeState* s = static_cast<DiodeState*>(d->state);
+  if (!p || !s) return vd;
+
+  const double* base = LimitBase(&s->limit, iter);
+  if (iter > 0 && p->i_s > 0.0) {
+    // The stamp is linear above kDiodeVdMax: nothing to limit there
+    double n_vt = p->n * kThermalVoltage;
+    double vcrit = fmin(n_vt * log(n_vt / (sqrt(2.0) * p->i_s)), kDiodeVdMax);
+    if (base[0] > 0.0) {
+      vd = PnjLimit(vd, base[0], n_vt, vcrit);
+    } else {
+      // A junction turning on starts from vcrit (SPICE's initial junction
+      // voltage) rather than from the small step PnjLimit allows out of
+      // reverse bias
+      vd = fmin(vd, vcrit);
+    }
+  }
+  s->limit.lin[0] = vd;
+  return vd;
+}
+
+int DiodeBypass(const Device* d, double vd, const NewtonPolicy* policy,
+                double* g, double* i_eq) {
+  const DiodeState* s = static_cast<const DiodeState*>(d->state);
+  if (!s || !s->cached || !policy->bypass) return 0;
+  if (s->cached_table != (d->table != nullptr)) return 0;
+  if (!(fabs(vd - s->vd_eval) < policy->bypass_vtol)) return 0;
+  *g = s->g;
+  *i_eq = s->i_eq;
+  return 1;
+}
+
+void DiodeCacheLinearization(Device* d, double vd, int limited, double g,
+                             double i_eq) {
+  DiodeState* s = static_cast<DiodeState*>(d->state);
+  if (!s) return;
+  s->cached = !limited;
+  s->cached_table = d->table != nullptr;
+  s->vd_eval = vd;
+  s->g = g;
+  s->i_eq = i_eq;
 }
 
 static void DiodeStampNonlinear(Device* d, StampContext* ctx,
@@ -430,21 +756,33 @@ static void DiodeStampNonlinear(Device* d, StampContext* ctx,
 
   double v_anode = (n_anode >= 0) ? it->x_current[n_anode] : 0.0;
   double v_cathode = (n_cathode >= 0) ? it->x_current[n_cathode] : 0.0;
-  double vd = v_anode - v_cathode;
-
-  double vd_limit = 0.7;
-  if (vd > vd_limit) vd = vd_limit;
-  if (vd < -15.0 * p->n * kVT) vd = -15.0 * p->n * kVT;
-
-  double n_vt = p->n * kVT;
-  double exp_term = exp(vd / n_vt);
-
-  double i_d = p->i_s * (exp_term - 1.0);
-  double g_eq = (p->i_s / n_vt) * exp_term;
-
-  if (g_eq < 1e-12) g_eq = 1e-12;
-
-  double i_eq = i_d - g_eq * vd;
+  double vd_iterate = v_anode - v_cathode;
+
+  double g_eq, i_eq;
+  if (DiodeBypass(d, vd_iterate, &it->policy, &g_eq, &i_eq)) {
+    if (it->counts) it->counts->bypassed++;
+  } else {
+    if (it->counts) it->counts->evaluations++;
+    double vd = vd_iterate;
+    if (it->policy.limit_junctions) vd = DiodeLimitVoltage(d, vd, it->iter);
+    int limited = vd != vd_iterate;
+
+    double n_vt = p->n * kThermalVoltage;
+    if (vd > kDiodeVdMax) vd = kDiodeVdMax;
+    if (vd < -kDiodeVdMinNvt * n_vt) vd = -kDiodeVdMinNvt * n_vt;
+
+    double i_d;
+    if (!d->table || !MonotoneCubicTableEval(d->table, vd, &i_d, &g_eq)) {
+      double exp_term = exp(vd / n_vt);
+      i_d = p->i_s * (exp_term - 1.0);
+      g_eq = (p->i_s / n_vt) * exp_term;
+    }
+
+    if (g_eq < kDiodeGmin) g_eq = kDiodeGmin;
+
+    i_eq = i_d - g_eq * vd;
+    DiodeCacheLinearization(d, vd_iterate, limited, g_eq, i_eq);
+  }
 
   if (n_anode >= 0) CtxAddA(ctx, n_anode, n_anode, +g_eq);
   if (n_cathode >= 0) CtxAddA(ctx, n_cathode, n_cathode, +g_eq);
@@ -459,7 +797,10 @@ static void DiodeStampNonlinear(Device* d, StampContext* ctx,
 
 static void DiodeStampTransient(Device* d, StampContext* ctx,
                                 TimeStepState* ts) {
-  IterationState it = {0, ts->x_prev, 1e-6, 1e-9};
+  // Linearize around the current Newton iterate of the time step
+  double* x = ts->x_current ? ts->x_current : ts->x_prev;
+  IterationState it = {ts->iter, x, 1e-6, 1e-9, ts->policy, ts->counts,
+                       0.0};
   DiodeStampNonlinear(d, ctx, &it);
 }
 
@@ -471,7 +812,7 @@ static void DiodeUpdateState(Device* d, double* x, TimeStepState* ts) {
 
 static void DiodeFree(Device* d) {
   if (d) {
-    free(d->params);
+    if (!(d->flags & kDeviceSharedParams)) free(d->params);
     free(d->state);
     free(d);
   }
@@ -481,149 +822,918 @@ static const DeviceVTable kDiodeVTable = {.Init = DiodeInit,
                                           .StampNonlinear = DiodeStampNonlinear,
                                           .StampTransient = DiodeStampTransient,
                                           .UpdateState = DiodeUpdateState,
-                                          .Free = DiodeFree};
+                                          .Free = DiodeFree,
+                                          .params_size = sizeof(DiodeParams),
+                                          .state_size = sizeof(DiodeState)};
+
+// ============================================================================
+// MOSFET Implementation
+// ============================================================================
+
+// Charge history of the drain, gate and source terminals (the bulk charge
+// of the model is zero)
+struct MosfetState {
+  double q_prev[3];
+  double q_prev2[3];
+  double i_prev[3];
+  VoltageLimitState limit;  // vgs (index 0) and vds (index 1)
+
+  // Last unlimited conduction linearization, for bypass
+  int cached;        // 1 if v_eval, id and g are valid
+  int cached_table;  // 1 if it was evaluated with the device table
+  double v_eval[4];  // Terminal voltages it was evaluated at
+  double id;
+  double g[4];
+
+  // Charges at the last charge evaluation, for bypass
+  int q_cached;
+  int q_cached_table;
+  double v_q[4];
+  double q[3];
+  double c[3][4];
+};
+
+// Terminal voltages of a MOSFET at x (0 for ground)
+static void MosfetVoltages(const Device* d, const double* x, double v[4]) {
+  for (int j = 0; j < 4; j++) v[j] = d->nodes[j] >= 0 ? x[d->nodes[j]] : 0.0;
+}
+
+// Drain-source conduction stamps of the linearized drain current plus gmin
+static void MosfetStampConduction(const Device* d, StampContext* ctx,
+                                  const MosfetOperatingPoint* op,
+                                  const double v[4]) {
+  int nd = d->nodes[kMosfetDrain];
+  int ns = d->nodes[kMosfetSource];
+
+  double g[4];
+  memcpy(g, op->g, sizeof(g));
+  g[kMosfetDrain] += kMosfetGmin;
+  g[kMosfetSource] -= kMosfetGmin;
+  double i_eq = op->id + kMosfetGmin * (v[kMosfetDrain] - v[kMosfetSource]);
+  for (int j = 0; j < 4; j++) i_eq -= g[j] * v[j];
+
+  for (int j = 0; j < 4; j++) {
+    int col = d->nodes[j];
+    if (col < 0) continue;
+    if (nd >= 0) CtxAddA(ctx, nd, col, +g[j]);
+    if (ns >= 0) CtxAddA(ctx, ns, col, -g[j]);
+  }
+  if (nd >= 0) CtxAddZ(ctx, nd, -i_eq);
+  if (ns >= 0) CtxAddZ(ctx, ns, +i_eq);
+}
+
+// History part I_hist of the companion current i = alpha0/h * q - I_hist of
+// terminal r (same form as the capacitor companion model)
+static double MosfetChargeHistory(const MosfetState* s,
+                                  const TimeStepState* ts, int r) {
+  const IntegrationMethod* im = ts->im;
+  switch (im->kind) {
+    case kIntegrationTrapezoidal:
+      return CompanionHistory<kIntegrationTrapezoidal>(
+          im->alpha1, im->alpha2, 1.0, ts->h, s->q_prev[r], s->q_prev2[r],
+          s->i_prev[r]);
+    case kIntegrationGear2:
+      return CompanionHistory<kIntegrationGear2>(im->alpha1, im->alpha2, 1.0,
+                                                 ts->h, s->q_prev[r],
+                                                 s->q_prev2[r], s->i_prev[r]);
+    default:
+      return CompanionHistory<kIntegrationBackwardEuler>(
+          im->alpha1, im->alpha2, 1.0, ts->h, s->q_prev[r], s->q_prev2[r],
+          s->i_prev[r]);
+  }
+}
+
+void MosfetParamsInit(MosfetParams* p) {
+  if (!p) return;
+  p->w = 1e-4;
+  p->l = 1e-6;
+  p->mu = 0.05;
+  p->cox = 2.3e-2;
+  p->vth0 = 0.5;
+  p->gamma = 0.0;
+  p->phi_f = 0.3;
+  p->beta = 0.5;
+}
+
+// MosfetEvaluate with the body-effect threshold shift looked up in table
+// (nullptr for the exact model)
+static void EvaluateMosfet(const MosfetParams* p,
+                           const MonotoneCubicTable* table, const double v[4],
+                           MosfetOperatingPoint* op) {
+  memset(op, 0, sizeof(*op));
+
+  // The terminal at the lower potential acts as the source
+  int reverse = v[kMosfetDrain] < v[kMosfetSource];
+  int dn = reverse ? kMosfetSource : kMosfetDrain;
+  int sn = reverse ? kMosfetDrain : kMosfetSource;
+  double vgs = v[kMosfetGate] - v[sn];
+  double vds = v[dn] - v[sn];
+  double vbs = v[kMosfetBulk] - v[sn];
+
+  // Threshold with body effect and its derivative in vbs
+  double vth = p->vth0;
+  double dvth = 0.0;
+  double shift;
+  if (table && MonotoneCubicTableEval(table, vbs, &shift, &dvth)) {
+    vth += shift;
+  } else if (p->gamma != 0.0) {
+    double arg = 2.0 * p->phi_f - vbs;
+    double root = arg > 0.0 ? sqrt(arg) : 0.0;
+    vth += p->gamma * (root - sqrt(2.0 * p->phi_f));
+    if (root > 0.0) dvth = -p->gamma / (2.0 * root);
+  }
+
+  double vov = vgs - vth;
+  if (vov <= 0.0) return;  // Cut off: no current, no channel charge
+
+  // Square-law current and the channel charge function f, with
+  // Q_channel = -Cox W L f (partial derivatives in vgs, vds, vbs)
+  double k = p->mu * p->cox * p->w / p->l;
+  double ids, gm, gds;
+  double f, f_gs, f_ds;
+  if (vds <= vov) {
+    ids = k * (vov * vds - 0.5 * vds * vds);
+    gm = k * vds;
+    gds = k * (vov - vds);
+    f = vov - 0.5 * vds;
+    f_gs = 1.0;
+    f_ds = -0.5;
+  } else {
+    ids = 0.5 * k * vov * vov;
+    gm = k * vov;
+    gds = 0.0;
+    f = 0.5 * vov;
+    f_gs = 0.5;
+    f_ds = 0.0;
+  }
+  double gmb = -gm * dvth;
+  double f_bs = -f_gs * dvth;
+
+  // Current derivatives per terminal voltage, oriented drain to source
+  double sign = reverse ? -1.0 : 1.0;
+  op->id = sign * ids;
+  op->g[kMosfetGate] = sign * gm;
+  op->g[dn] = sign * gds;
+  op->g[kMosfetBulk] = sign * gmb;
+  op->g[sn] = -sign * (gm + gds + gmb);
+
+  // Gate charge and its partition between the channel ends
+  double df[4];
+  df[kMosfetGate] = f_gs;
+  df[dn] = f_ds;
+  df[kMosfetBulk] = f_bs;
+  df[sn] = -(f_gs + f_ds + f_bs);
+  double cg = p->cox * p->w * p->l;
+  double share[4];
+  share[kMosfetGate] = cg;
+  share[sn] = -p->beta * cg;
+  share[dn] = -(1.0 - p->beta) * cg;
+  share[kMosfetBulk] = 0.0;
+  for (int i = 0; i < 4; i++) {
+    op->q[i] = share[i] * f;
+    for (int j = 0; j < 4; j++) op->c[i][j] = share[i] * df[j];
+  }
+}
+
+void MosfetEvaluate(const MosfetParams* p, const double v[4],
+                    MosfetOperatingPoint* op) {
+  EvaluateMosfet(p, nullptr, v, op);
+}
+
+// 1 if every terminal voltage of v is within policy->bypass_vtol of v0
+static int MosfetVoltagesClose(const double v[4], const double v0[4],
+                               const NewtonPolicy* policy) {
+  for (int j = 0; j < 4; j++) {
+    if (!(fabs(v[j] - v0[j]) < policy->bypass_vtol)) return 0;
+  }
+  return 1;
+}
+
+// Keep the charges of op, evaluated at v, for bypass
+static void MosfetCacheCharges(const Device* d, MosfetState* s,
+                               const double v[4],
+                               const MosfetOperatingPoint* op) {
+  s->q_cached = 1;
+  s->q_cached_table = d->table != nullptr;
+  memcpy(s->v_q, v, sizeof(s->v_q));
+  for (int r = 0; r < 3; r++) {
+    s->q[r] = op->q[r];
+    memcpy(s->c[r], op->c[r], sizeof(s->c[r]));
+  }
+}
+
+int MosfetBypass(const Device* d, const double v[4],
+                 const NewtonPolicy* policy, double v_eval[4], double* id,
+                 double g[4]) {
+  const MosfetState* s = static_cast<const MosfetState*>(d->state);
+  if (!s || !s->cached || !policy->bypass) return 0;
+  if (s->cached_table != (d->table != nullptr)) return 0;
+  if (!MosfetVoltagesClose(v, s->v_eval, policy)) return 0;
+  memcpy(v_eval, s->v_eval, sizeof(s->v_eval));
+  *id = s->id;
+  memcpy(g, s->g, sizeof(s->g));
+  return 1;
+}
+
+void MosfetCacheLinearization(Device* d, const double v[4], int limited,
+                              double id, const double g[4]) {
+  MosfetState* s = static_cast<MosfetState*>(d->state);
+  if (!s) return;
+  s->cached = !limited;
+  s->cached_table = d->table != nullptr;
+  s->q_cached = 0;  // Charges of an older evaluation
+  memcpy(s->v_eval, v, sizeof(s->v_eval));
+  s->id = id;
+  memcpy(s->g, g, sizeof(s->g));
+}
+
+void MosfetStampCharges(Device* d, StampContext* ctx, const TimeStepState* ts,
+                        const double* x) {
+  const MosfetParams* p = static_cast<const MosfetParams*>(d->params);
+  MosfetState* s = static_cast<MosfetState*>(d->state);
+  if (!p || !s || !ts || !ts->im || !x) return;
+
+  // Charges of the last evaluation when the voltages are within the bypass
+  // tolerance, linearized at the voltages they were evaluated at
+  double v[4];
+  MosfetVoltages(d, x, v);
+  if (!(ts->policy.bypass && s->q_cached &&
+        s->q_cached_table == (d->table != nullptr) &&
+        MosfetVoltagesClose(v, s->v_q, &ts->policy))) {
+    MosfetOperatingPoint op;
+    EvaluateMosfet(p, d->table, v, &op);
+    MosfetCacheCharges(d, s, v, &op);
+  }
+
+  // i_r = a0 * q_r(v) - I_hist, linearized: a0 * C v + a0 * (q - C v0)
+  double a0 = ts->im->alpha0 / ts->h;
+  for (int r = 0; r < 3; r++) {
+    int row = d->nodes[r];
+    if (row < 0) continue;
+    double q_lin = s->q[r];
+    for (int j = 0; j < 4; j++) {
+      int col = d->nodes[j];
+      q_lin -= s->c[r][j] * s->v_q[j];
+      if (col >= 0) CtxAddA(ctx, row, col, a0 * s->c[r][j]);
+    }
+    CtxAddZ(ctx, row, MosfetChargeHistory(s, ts, r) - a0 * q_lin);
+  }
+}
+
+static void MosfetInit(Device* d, Circuit* c) {
+  (void)c;
+  if (!d->state) d->state = calloc(1, sizeof(MosfetState));
+}
+
+void MosfetLimitVoltages(Device* d, double v[4], int iter) {
+  const MosfetParams* p = static_cast<const MosfetParams*>(d->params);
+  MosfetState* s = static_cast<MosfetState*>(d->state);
+  if (!p || !s) return;
+
+  const double* base = LimitBase(&s->limit, iter);
+  double vs = v[kMosfetSource];
+  double vgs = v[kMosfetGate] - vs;
+  double vds = v[kMosfetDrain] - vs;
+  if (iter > 0) {
+    double vgs_old = base[0];
+    double vds_old = base[1];
+    if (vds_old >= 0.0) {
+      double vgd = vgs - vds;
+      vgs = FetLimit(vgs, vgs_old, p->vth0);
+      vds = LimvdsLimit(vgs - vgd, vds_old);
+    } else {
+      // Reversed: the drain acts as the source
+      double vgd = FetLimit(vgs - vds, vgs_old - vds_old, p->vth0);
+      vds = -LimvdsLimit(-(vgs - vgd), -vds_old);
+      vgs = vgd + vds;
+    }
+    v[kMosfetGate] = vs + vgs;
+    v[kMosfetDrain] = vs + vds;
+  }
+  s->limit.lin[0] = vgs;
+  s->limit.lin[1] = vds;
+}
+
+static void MosfetStampNonlinear(Device* d, StampContext* ctx,
+                                 IterationState* it) {
+  const MosfetParams* p = static_cast<const MosfetParams*>(d->params);
+  if (!p || !it || !it->x_current) return;
+
+  double v[4];
+  MosfetVoltages(d, it->x_current, v);
+  MosfetOperatingPoint op;
+  double v_lin[4];
+  if (MosfetBypass(d, v, &it->policy, v_lin, &op.id, op.g)) {
+    if (it->counts) it->counts->bypassed++;
+  } else {
+    if (it->counts) it->counts->evaluations++;
+    memcpy(v_lin, v, sizeof(v_lin));
+    if (it->policy.limit_junctions) MosfetLimitVoltages(d, v_lin, it->iter);
+    EvaluateMosfet(p, d->table, v_lin, &op);
+    int limited = memcmp(v, v_lin, sizeof(v)) != 0;
+    MosfetCacheLinearization(d, v, limited, op.id, op.g);
+    MosfetState* s = static_cast<MosfetState*>(d->state);
+    if (s && !limited) {
+      // The charges of this evaluation serve the transient charge stamp
+      MosfetCacheCharges(d, s, v, &op);
+    }
+  }
+  MosfetStampConduction(d, ctx, &op, v_lin);
+}
+
+static void MosfetStampTransient(Device* d, StampContext* ctx,
+                                 TimeStepState* ts) {
+  // Linearize around the current Newton iterate of the time step
+  double* x = ts->x_current ? ts->x_current : ts->x_prev;
+  IterationState it = {ts->iter, x, 1e-6, 1e-9, ts->policy, ts->counts,
+                       0.0};
+  MosfetStampNonlinear(d, ctx, &it);
+  MosfetStampCharges(d, ctx, ts, x);
+}
+
+static void MosfetUpdateState(Device* d, double* x, TimeStepState* ts) {
+  const MosfetParams* p = static_cast<const MosfetParams*>(d->params);
+  MosfetState* s = static_cast<MosfetState*>(d->state);
+  if (!p || !s || !ts) return;
+
+  double v[4];
+  MosfetVoltages(d, x, v);
+  MosfetOperatingPoint op;
+  EvaluateMosfet(p, d->table, v, &op);
+
+  for (int r = 0; r < 3; r++) {
+    // Companion current at the accepted point, kept for trapezoidal
+    if (ts->im && ts->h > 0.0) {
+      s->i_prev[r] =
+          (ts->im->alpha0 / ts->h) * op.q[r] - MosfetChargeHistory(s, ts, r);
+    }
+    s->q_prev2[r] = s->q_prev[r];
+    s->q_prev[r] = op.q[r];
+  }
+}
+
+static void MosfetInitState(Device* d, const double* x) {
+  const MosfetParams* p = static_cast<const MosfetParams*>(d->params);
+  MosfetState* s = static_cast<MosfetState*>(d->state);
+  if (!p || !s || !x) return;
+
+  double v[4];
+  MosfetVoltages(d, x, v);
+  MosfetOperatingPoint op;
+  EvaluateMosfet(p, d->table, v, &op);
+
+  // Operating point: charges at rest, no displacement current
+  for (int r = 0; r < 3; r++) {
+    s->q_prev[r] = op.q[r];
+    s->q_prev2[r] = op.q[r];
+    s->i_prev[r] = 0.0;
+  }
+}
+
+static void MosfetFree(Device* d) {
+  if (d) {
+    if (!(d->flags & kDeviceSharedParams)) free(d->params);
+    free(d->state);
+    free(d);
+  }
+}
+
+// Charge derivatives dq/dv of the drain, gate and source at x (the bulk
+// charge of the model is zero)
+static void MosfetStampAc(Device* d, StampContext* ctx, const double* x,
+                          double* b_re, double* b_im) {
+  (void)b_re;
+  (void)b_im;
+
+  const MosfetParams* p = static_cast<const MosfetParams*>(d->params);
+  if (!p || !x) return;
+
+  double v[4];
+  MosfetVoltages(d, x, v);
+  MosfetOperatingPoint op;
+  EvaluateMosfet(p, d->table, v, &op);
+
+  for (int r = 0; r < 3; r++) {
+    int row = d->nodes[r];
+    if (row < 0) continue;
+    for (int j = 0; j < 4; j++) {
+      int col = d->nodes[j];
+      if (col >= 0) CtxAddA(ctx, row, col, op.c[r][j]);
+    }
+  }
+}
+
+static const DeviceVTable kMosfetVTable = {
+    .Init = MosfetInit,
+    .StampNonlinear = MosfetStampNonlinear,
+    .StampTransient = MosfetStampTransient,
+    .UpdateState = MosfetUpdateState,
+    .Free = MosfetFree,
+    .InitState = MosfetInitState,
+    .StampAc = MosfetStampAc,
+    .params_size = sizeof(MosfetParams),
+    .state_size = sizeof(MosfetState)};
+
+// Device types by type tag. Append only: the position is stored in
+// snapshots.
+static const DeviceVTable* const kDeviceTypes[] = {
+    &kResistorVTable,  &kCurrentSourceVTable, &kVoltageSourceVTable,
+    &kCapacitorVTable, &kInductorVTable,      &kDiodeVTable,
+    &kMosfetVTable};
+static const char* const kDeviceTypeNames[] = {
+    "resistor",  "current_source", "voltage_source", "capacitor",
+    "inductor",  "diode",          "mosfet"};
+static_assert(sizeof(kDeviceTypes) / sizeof(kDeviceTypes[0]) ==
+                  kNumDeviceTypes,
+              "kNumDeviceTypes must match the device type table");
+static_assert(sizeof(kDeviceTypeNames) / sizeof(kDeviceTypeNames[0]) ==
+                  kNumDeviceTypes,
+              "Every device type needs a name");
 
 // ============================================================================
 // Factory Functions
 // ============================================================================
 
-Device* CreateResistor(const char* name, int n1, int n2, double resistance) {
-  Device* d = static_cast<Device*>(calloc(1, sizeof(Device)));
+// Blocks within an arena record start at this alignment
+static size_t RoundUpRecord(size_t n) { return (n + 15) & ~(size_t)15; }
+
+// Copy of a device name of len bytes: in the arena's name storage, or on
+// the heap (freed by DeviceFree) without an arena
+static const char* StoreName(DeviceArena* arena, const char* name,
+                             size_t len) {
+  if (arena) return StringArenaAdd(arena->names, name, len);
+  char* copy = static_cast<char*>(malloc(len + 1));
+  if (!copy) return nullptr;
+  memcpy(copy, name, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+// Allocate a zeroed device of type vt named name. In an arena the device,
+// its params and its state are one record; on the heap the params get their
+// own block (unless the device will share another's) and Init allocates the
+// state.
+static Device* NewDevice(const DeviceVTable* vt, DeviceArena* arena,
+                         int own_params, const char* name) {
+  const char* stored = StoreName(arena, name, strlen(name));
+  if (!stored) return nullptr;
+
+  Device* d;
+  if (arena) {
+    size_t device_size = RoundUpRecord(sizeof(Device));
+    size_t params_size = own_params ? RoundUpRecord(vt->params_size) : 0;
+    int type_id = 0;
+    while (kDeviceTypes[type_id] != vt) type_id++;
+    char* record = static_cast<char*>(DeviceArenaAlloc(
+        arena, type_id, device_size + params_size + vt->state_size));
+    if (!record) return nullptr;
+    d = reinterpret_cast<Device*>(record);
+    if (own_params && vt->params_size > 0) d->params = record + device_size;
+    if (vt->state_size > 0) d->state = record + device_size + params_size;
+    d->flags = kDeviceArena;
+  } else {
+    d = static_cast<Device*>(calloc(1, sizeof(Device)));
+    if (d && own_params && vt->params_size > 0) {
+      d->params = calloc(1, vt->params_size);
+      if (!d->params) {
+        free(d);
+        d = nullptr;
+      }
+    }
+    if (!d) {
+      free(const_cast<char*>(stored));
+      return nullptr;
+    }
+  }
+  d->vt = vt;
+  d->name = stored;
+  return d;
+}
+
+Device* CreateResistor(const char* name, int n1, int n2, double resistance,
+                       DeviceArena* arena) {
+  Device* d = NewDevice(&kResistorVTable, arena, 1, name ? name : "R?");
   if (!d) return nullptr;
 
-  d->vt = &kResistorVTable;
-  strncpy(d->name, name ? name : "R?", sizeof(d->name) - 1);
   d->nodes[0] = n1;
   d->nodes[1] = n2;
   d->nodes[2] = -1;   // Unused
   d->nodes[3] = -1;   // Unused
   d->extra_var = -1;  // No extra variable needed for resistor
 
-  ResistorParams* p =
-      static_cast<ResistorParams*>(malloc(sizeof(ResistorParams)));
-  if (p) {
-    p->r = resistance;
-    d->params = p;
-  }
+  ResistorParams* p = static_cast<ResistorParams*>(d->params);
+  p->r = resistance;
 
   return d;
 }
 
-Device* CreateCurrentSource(const char* name, int n1, int n2, double current) {
-  Device* d = static_cast<Device*>(calloc(1, sizeof(Device)));
+Device* CreateCurrentSource(const char* name, int n1, int n2, double current,
+                            DeviceArena* arena) {
+  Device* d = NewDevice(&kCurrentSourceVTable, arena, 1, name ? name : "I?");
   if (!d) return nullptr;
 
-  d->vt = &kCurrentSourceVTable;
-  strncpy(d->name, name ? name : "I?", sizeof(d->name) - 1);
   d->nodes[0] = n1;
   d->nodes[1] = n2;
   d->nodes[2] = -1;   // Unused
   d->nodes[3] = -1;   // Unused
   d->extra_var = -1;  // No extra variable needed for current source
 
-  CurrentSourceParams* p =
-      static_cast<CurrentSourceParams*>(malloc(sizeof(CurrentSourceParams)));
-  if (p) {
-    p->i = current;
-    d->params = p;
-  }
+  CurrentSourceParams* p = static_cast<CurrentSourceParams*>(d->params);
+  p->i = current;
+  p->has_pulse = 0;
 
   return d;
 }
 
-Device* CreateVoltageSource(const char* name, int n1, int n2, double voltage) {
-  Device* d = static_cast<Device*>(calloc(1, sizeof(Device)));
+Device* CreateVoltageSource(const char* name, int n1, int n2, double voltage,
+                            DeviceArena* arena) {
+  Device* d = NewDevice(&kVoltageSourceVTable, arena, 1, name ? name : "V?");
   if (!d) return nullptr;
 
-  d->vt = &kVoltageSourceVTable;
-  strncpy(d->name, name ? name : "V?", sizeof(d->name) - 1);
   d->nodes[0] = n1;
   d->nodes[1] = n2;
   d->nodes[2] = -1;   // Unused
   d->nodes[3] = -1;   // Unused
   d->extra_var = -2;  // Request extra variable for branch current
 
-  VoltageSourceParams* p =
-      static_cast<VoltageSourceParams*>(malloc(sizeof(VoltageSourceParams)));
-  if (p) {
-    p->v = voltage;
-    d->params = p;
+  VoltageSourceParams* p = static_cast<VoltageSourceParams*>(d->params);
+  p->v = voltage;
+  p->has_pulse = 0;
+
+  return d;
+}
+
+Device* CreatePulseVoltageSource(const char* name, int n1, int n2,
+                                 const PulseWaveform* pulse,
+                                 DeviceArena* arena) {
+  if (!pulse) return nullptr;
+
+  Device* d = CreateVoltageSource(name, n1, n2, pulse->v1, arena);
+  if (d && d->params) {
+    VoltageSourceParams* p = static_cast<VoltageSourceParams*>(d->params);
+    p->has_pulse = 1;
+    p->pulse = *pulse;
   }
+  return d;
+}
 
+Device* CreatePulseCurrentSource(const char* name, int n1, int n2,
+                                 const PulseWaveform* pulse,
+                                 DeviceArena* arena) {
+  if (!pulse) return nullptr;
+
+  Device* d = CreateCurrentSource(name, n1, n2, pulse->v1, arena);
+  if (d && d->params) {
+    CurrentSourceParams* p = static_cast<CurrentSourceParams*>(d->params);
+    p->has_pulse = 1;
+    p->pulse = *pulse;
+  }
   return d;
 }
 
-Device* CreateCapacitor(const char* name, int n1, int n2, double capacitance) {
-  Device* d = static_cast<Device*>(calloc(1, sizeof(Device)));
+Device* CreateCapacitor(const char* name, int n1, int n2, double capacitance,
+                        DeviceArena* arena) {
+  Device* d = NewDevice(&kCapacitorVTable, arena, 1, name ? name : "C?");
   if (!d) return nullptr;
 
-  d->vt = &kCapacitorVTable;
-  strncpy(d->name, name ? name : "C?", sizeof(d->name) - 1);
   d->nodes[0] = n1;
   d->nodes[1] = n2;
   d->nodes[2] = -1;
   d->nodes[3] = -1;
   d->extra_var = -1;
 
-  CapacitorParams* p =
-      static_cast<CapacitorParams*>(malloc(sizeof(CapacitorParams)));
-  if (p) {
-    p->c = capacitance;
-    d->params = p;
-  }
+  CapacitorParams* p = static_cast<CapacitorParams*>(d->params);
+  p->c = capacitance;
 
   return d;
 }
 
-Device* CreateInductor(const char* name, int n1, int n2, double inductance) {
-  Device* d = static_cast<Device*>(calloc(1, sizeof(Device)));
+Device* CreateInductor(const char* name, int n1, int n2, double inductance,
+                       DeviceArena* arena) {
+  Device* d = NewDevice(&kInductorVTable, arena, 1, name ? name : "L?");
   if (!d) return nullptr;
 
-  d->vt = &kInductorVTable;
-  strncpy(d->name, name ? name : "L?", sizeof(d->name) - 1);
   d->nodes[0] = n1;
   d->nodes[1] = n2;
   d->nodes[2] = -1;
   d->nodes[3] = -1;
   d->extra_var = -1;
 
-  InductorParams* p =
-      static_cast<InductorParams*>(malloc(sizeof(InductorParams)));
-  if (p) {
-    p->l = inductance;
-    d->params = p;
-  }
+  InductorParams* p = static_cast<InductorParams*>(d->params);
+  p->l = inductance;
 
   return d;
 }
 
 Device* CreateDiode(const char* name, int n_anode, int n_cathode, double I_s,
-                    double n) {
-  Device* d = static_cast<Device*>(calloc(1, sizeof(Device)));
+                    double n, DeviceArena* arena) {
+  Device* d = NewDevice(&kDiodeVTable, arena, 1, name ? name : "D?");
   if (!d) return nullptr;
 
-  d->vt = &kDiodeVTable;
-  strncpy(d->name, name ? name : "D?", sizeof(d->name) - 1);
   d->nodes[0] = n_anode;
   d->nodes[1] = n_cathode;
   d->nodes[2] = -1;
   d->nodes[3] = -1;
   d->extra_var = -1;
 
-  DiodeParams* p = static_cast<DiodeParams*>(malloc(sizeof(DiodeParams)));
-  if (p) {
-    p->i_s = I_s;
-    p->n = n;
-    d->params = p;
-  }
+  DiodeParams* p = static_cast<DiodeParams*>(d->params);
+  p->i_s = I_s;
+  p->n = n;
+
+  return d;
+}
+
+Device* CreateMosfet(const char* name, int n_drain, int n_gate, int n_source,
+                     int n_bulk, const MosfetParams* params,
+                     DeviceArena* arena) {
+  if (!params || params->l <= 0.0) return nullptr;
+
+  Device* d = NewDevice(&kMosfetVTable, arena, 1, name ? name : "M?");
+  if (!d) return nullptr;
+
+  d->nodes[kMosfetDrain] = n_drain;
+  d->nodes[kMosfetGate] = n_gate;
+  d->nodes[kMosfetSource] = n_source;
+  d->nodes[kMosfetBulk] = n_bulk;
+  d->extra_var = -1;
+
+  MosfetParams* p = static_cast<MosfetParams*>(d->params);
+  *p = *params;
 
   return d;
 }
 
 void DeviceFree(Device* d) {
-  if (d && d->vt && d->vt->Free) {
+  // Arena records (and their names) are released with their arena
+  if (d && d->vt && d->vt->Free && !(d->flags & kDeviceArena)) {
+    free(const_cast<char*>(d->name));
+    d->name = nullptr;
     d->vt->Free(d);
   }
 }
 
+int DeviceSetName(Device* d, const char* name, size_t len,
+                  DeviceArena* arena) {
+  if (!d || !name || (arena != nullptr) != ((d->flags & kDeviceArena) != 0)) {
+    return -1;
+  }
+  const char* stored = StoreName(arena, name, len);
+  if (!stored) return -1;
+  if (!arena) free(const_cast<char*>(d->name));
+  d->name = stored;
+  return 0;
+}
+
+double PulseWaveformValue(const PulseWaveform* p, double t) {
+  if (!p) return 0.0;
+  if (t < p->td) return p->v1;
+
+  double tp = t - p->td;
+  if (p->per > 0.0) tp = fmod(tp, p->per);
+
+  if (tp < p->tr) return p->v1 + (p->v2 - p->v1) * tp / p->tr;
+  tp -= p->tr;
+  if (tp < p->pw) return p->v2;
+  tp -= p->pw;
+  if (tp < p->tf) return p->v2 + (p->v1 - p->v2) * tp / p->tf;
+  return p->v1;
+}
+
+double PulseWaveformNextBreakpoint(const PulseWaveform* p, double t) {
+  if (!p) return INFINITY;
+  if (t < p->td) return p->td;
+
+  if (p->per <= 0.0) {
+    const double corners[4] = {p->td, p->td + p->tr, p->td + p->tr + p->pw,
+                               p->td + p->tr + p->pw + p->tf};
+    for (double corner : corners) {
+      if (corner > t) return corner;
+    }
+    return INFINITY;
+  }
+
+  // Start of the current period. The quotient rounds either way of a
+  // period boundary when per is not exact in binary (t = 0.6, per = 0.1),
+  // so the index is corrected until td + k * per <= t < td + (k + 1) * per:
+  // the next breakpoint is then always later than t.
+  double k = floor((t - p->td) / p->per);
+  while (k > 0.0 && p->td + k * p->per > t) k -= 1.0;
+  while (p->td + (k + 1.0) * p->per <= t) k += 1.0;
+  double base = p->td + k * p->per;
+
+  const double corners[3] = {p->tr, p->tr + p->pw, p->tr + p->pw + p->tf};
+  for (double corner : corners) {
+    if (base + corner > t) return base + corner;
+  }
+  return p->td + (k + 1.0) * p->per;
+}
+
+Device* DeviceClone(const Device* d, int share_params, DeviceArena* arena) {
+  if (!d || !d->vt) return nullptr;
+
+  int own_params = d->params && !share_params;
+  Device* copy = NewDevice(d->vt, arena, own_params, d->name);
+  if (!copy) return nullptr;
+  const char* name = copy->name;
+  void* params = copy->params;
+  void* state = copy->state;
+  int flags = copy->flags;
+  memcpy(copy, d, sizeof(Device));
+  copy->next = nullptr;
+  copy->name = name;
+  copy->params = params;
+  copy->state = state;
+  copy->flags = (d->flags & ~(kDeviceSharedParams | kDeviceArena)) | flags;
+
+  if (d->params && share_params) {
+    copy->params = d->params;
+    copy->flags |= kDeviceSharedParams;
+  } else if (d->params) {
+    memcpy(copy->params, d->params, d->vt->params_size);
+  }
+
+  if (d->state && d->vt->state_size > 0) {
+    if (!copy->state) copy->state = malloc(d->vt->state_size);
+    if (!copy->state) {
+      DeviceFree(copy);
+      return nullptr;
+    }
+    memcpy(copy->state, d->state, d->vt->state_size);
+  }
+  return copy;
+}
+
+int DeviceSetValue(Device* d, double value) {
+  if (!d || !d->vt || !d->vt->SetValue) return -1;
+  d->vt->SetValue(d, value);
+  return 0;
+}
+
+int DeviceGetValue(const Device* d, double* value) {
+  if (!d || !value || !d->vt || !d->vt->GetValue) return -1;
+  *value = d->vt->GetValue(d);
+  return 0;
+}
+
+int DeviceSetAc(Device* d, double mag, double phase) {
+  if (!d || !d->params) return -1;
+  if (d->vt == &kVoltageSourceVTable) {
+    VoltageSourceParams* p = static_cast<VoltageSourceParams*>(d->params);
+    p->ac_mag = mag;
+    p->ac_phase = phase;
+    return 0;
+  }
+  if (d->vt == &kCurrentSourceVTable) {
+    CurrentSourceParams* p = static_cast<CurrentSourceParams*>(d->params);
+    p->ac_mag = mag;
+    p->ac_phase = phase;
+    return 0;
+  }
+  return -1;
+}
+
+// Drop the bypass linearizations and the table of a diode or MOSFET whose
+// params changed
+static void ForgetEvaluations(Device* d) {
+  d->table = nullptr;
+  if (!d->state) return;
+  if (d->vt == &kDiodeVTable) {
+    static_cast<DiodeState*>(d->state)->cached = 0;
+  } else if (d->vt == &kMosfetVTable) {
+    MosfetState* s = static_cast<MosfetState*>(d->state);
+    s->cached = 0;
+    s->q_cached = 0;
+  }
+}
+
+// Field of a MOSFET parameter by name, or nullptr
+static double* MosfetParam(MosfetParams* p, const char* name) {
+  if (strcasecmp(name, "w") == 0) return &p->w;
+  if (strcasecmp(name, "l") == 0) return &p->l;
+  if (strcasecmp(name, "mu") == 0) return &p->mu;
+  if (strcasecmp(name, "cox") == 0) return &p->cox;
+  if (strcasecmp(name, "vth0") == 0) return &p->vth0;
+  if (strcasecmp(name, "gamma") == 0) return &p->gamma;
+  if (strcasecmp(name, "phi_f") == 0) return &p->phi_f;
+  if (strcasecmp(name, "beta") == 0) return &p->beta;
+  return nullptr;
+}
+
+int DeviceSetParam(Device* d, const char* name, double value) {
+  if (!d || !d->vt || !name || !std::isfinite(value)) return -1;
+  if (strcasecmp(name, "dc") == 0) return DeviceSetValue(d, value);
+  if (!d->params || (d->flags & kDeviceSharedParams)) return -1;
+
+  if (d->vt == &kResistorVTable) {
+    if (strcasecmp(name, "r") != 0 || value == 0.0) return -1;
+    static_cast<ResistorParams*>(d->params)->r = value;
+    return 0;
+  }
+  if (d->vt == &kCapacitorVTable) {
+    if (strcasecmp(name, "c") != 0 || !(value > 0.0)) return -1;
+    static_cast<CapacitorParams*>(d->params)->c = value;
+    return 0;
+  }
+  if (d->vt == &kInductorVTable) {
+    if (strcasecmp(name, "l") != 0 || !(value > 0.0)) return -1;
+    static_cast<InductorParams*>(d->params)->l = value;
+    return 0;
+  }
+  if (d->vt == &kDiodeVTable) {
+    DiodeParams* p = static_cast<DiodeParams*>(d->params);
+    double* field = strcasecmp(name, "is") == 0  ? &p->i_s
+                    : strcasecmp(name, "n") == 0 ? &p->n
+                                                 : nullptr;
+    if (!field || !(value > 0.0)) return -1;
+    *field = value;
+    ForgetEvaluations(d);
+    return 0;
+  }
+  if (d->vt == &kMosfetVTable) {
+    MosfetParams* p = static_cast<MosfetParams*>(d->params);
+    double* field = MosfetParam(p, name);
+    if (!field) return -1;
+    if (field == &p->gamma) {
+      if (!(value >= 0.0)) return -1;
+    } else if (field == &p->beta) {
+      if (!(value >= 0.0 && value <= 1.0)) return -1;
+    } else if (field != &p->vth0 && !(value > 0.0)) {
+      return -1;
+    }
+    *field = value;
+    ForgetEvaluations(d);
+    return 0;
+  }
+  return -1;
+}
+
+int DeviceTypeId(const Device* d) {
+  if (!d) return -1;
+  for (int k = 0; k < kNumDeviceTypes; k++) {
+    if (d->vt == kDeviceTypes[k]) return k;
+  }
+  return -1;
+}
+
+const char* DeviceTypeName(int type_id) {
+  if (type_id < 0 || type_id >= kNumDeviceTypes) return nullptr;
+  return kDeviceTypeNames[type_id];
+}
+
+int DeviceTypeDataSizes(int type_id, size_t* params_size, size_t* state_size) {
+  if (type_id < 0 || type_id >= kNumDeviceTypes) return -1;
+  if (params_size) *params_size = kDeviceTypes[type_id]->params_size;
+  if (state_size) *state_size = kDeviceTypes[type_id]->state_size;
+  return 0;
+}
+
+Device* DeviceCreateFromData(int type_id, const char* name, const int nodes[4],
+                             int extra_var, const void* params,
+                             size_t params_size, const void* state,
+                             size_t state_size, DeviceArena* arena) {
+  if (type_id < 0 || type_id >= kNumDeviceTypes || !nodes) return nullptr;
+  const DeviceVTable* vt = kDeviceTypes[type_id];
+  if (params_size != vt->params_size || state_size != vt->state_size) {
+    return nullptr;
+  }
+  if (params_size > 0 && !params) return nullptr;
+
+  Device* d = NewDevice(vt, arena, 1, name ? name : "?");
+  if (!d) return nullptr;
+
+  memcpy(d->nodes, nodes, sizeof(d->nodes));
+  d->extra_var = extra_var;
+
+  if (params_size > 0) memcpy(d->params, params, params_size);
+  if (state_size > 0) {
+    if (!d->state) d->state = calloc(1, state_size);
+    if (!d->state) {
+      DeviceFree(d);
+      return nullptr;
+    }
+    if (state) memcpy(d->state, state, state_size);
+  }
+  return d;
+}
+
+int DiodeGetParams(const Device* d, double* i_s, double* n) {
+  if (!d || d->vt != &kDiodeVTable || !d->params) return -1;
+  const DiodeParams* p = static_cast<const DiodeParams*>(d->params);
+  if (i_s) *i_s = p->i_s;
+  if (n) *n = p->n;
+  return 0;
+}
+
+int CapacitorGetParams(const Device* d, double* c) {
+  if (!d || d->vt != &kCapacitorVTable || !d->params) return -1;
+  if (c) *c = static_cast<const CapacitorParams*>(d->params)->c;
+  return 0;
+}
+
+int MosfetGetParams(const Device* d, MosfetParams* p) {
+  if (!d || d->vt != &kMosfetVTable || !d->params) return -1;
+  if (p) *p = *static_cast<const MosfetParams*>(d->params);
+  return 0;
+}
+
 }  // namespace minispice
@@ -10,31 +10,76 @@
 
 namespace minispice {
 
-// Device vtable - polymorphic interface for all device types
+struct DeviceArena;
+struct MonotoneCubicTable;
+
+// Device vtable - polymorphic interface for all device types. Hooks a
+// vtable leaves out are nullptr.
 struct DeviceVTable {
   // Initialize the device after circuit setup
-  void (*Init)(Device* d, Circuit* c);
+  void (*Init)(Device* d, Circuit* c) = nullptr;
 
   // Stamp contributions for DC/nonlinear analysis
-  void (*StampNonlinear)(Device* d, StampContext* ctx, IterationState* it);
+  void (*StampNonlinear)(Device* d, StampContext* ctx,
+                         IterationState* it) = nullptr;
 
   // Stamp contributions for transient analysis
-  void (*StampTransient)(Device* d, StampContext* ctx, TimeStepState* ts);
+  void (*StampTransient)(Device* d, StampContext* ctx,
+                         TimeStepState* ts) = nullptr;
 
   // Update device state after a converged time step
-  void (*UpdateState)(Device* d, double* x, TimeStepState* ts);
+  void (*UpdateState)(Device* d, double* x, TimeStepState* ts) = nullptr;
 
   // Free device-specific memory
-  void (*Free)(Device* d);
+  void (*Free)(Device* d) = nullptr;
+
+  // Set / get the device's primary value (source voltage or current).
+  // Optional: nullptr for devices without a sweepable value.
+  void (*SetValue)(Device* d, double value) = nullptr;
+  double (*GetValue)(const Device* d) = nullptr;
+
+  // Initialize the transient history from the DC operating point x before
+  // the first time step. Optional.
+  void (*InitState)(Device* d, const double* x) = nullptr;
+
+  // Earliest waveform breakpoint (corner) strictly after time t, or INFINITY
+  // if there is none. Optional: nullptr for devices without breakpoints.
+  double (*NextBreakpoint)(const Device* d, double t) = nullptr;
+
+  // Stamp the AC small-signal model at the DC operating point x: the
+  // derivatives dq/dv of the device's charges and fluxes into the matrix of
+  // ctx (the AC matrix is G + j*omega*C, G being the DC Jacobian at x), and
+  // the phasor of the device's AC excitation into b_re and b_im (length
+  // num_vars). Optional: nullptr for devices with neither.
+  void (*StampAc)(Device* d, StampContext* ctx, const double* x,
+                  double* b_re, double* b_im) = nullptr;
+
+  // 1 if the device's matrix stamps do not depend on the solution: they are
+  // constant for DC and for a fixed step size and integration method (only
+  // RHS contributions may change)
+  int is_linear = 0;
+
+  // Size of the params and state blocks, used to copy devices (0 if none)
+  size_t params_size = 0;
+  size_t state_size = 0;
 };
 
+// Device flags
+// params are owned by another device (clone sharing read-only params) and
+// are not freed with this device
+constexpr int kDeviceSharedParams = 1 << 0;
+// The device is a record of a DeviceArena and is freed with the arena
+constexpr int kDeviceArena = 1 << 1;
+
 // Generic device structure
 struct Device {
   // Pointer to device's vtable
   const DeviceVTable* vt;
 
-  // Device name (e.g., "R1", "V1")
-  char name[32];
+  // Device name (e.g., "R1", "V1", "X1.X2.R1"), of any length. Stored in
+  // the name storage of the device's arena (the circuit's StringArena), or
+  // on the heap for a device created without an arena.
+  const char* name;
 
   // Terminal variable indices (-1 for unused)
   int nodes[4];
@@ -53,39 +98,323 @@ struct Device {
   //   MNA system
   int extra_var;
 
+  // Combination of kDevice* flags
+  int flags;
+
+  // Interpolation table of table-model mode, owned by the circuit (see
+  // table_model.h); nullptr for exact evaluation
+  const MonotoneCubicTable* table;
+
   Device* next;  // Next device in circuit's linked list
 };
 
+// Diode model constants, shared by the scalar stamp and the batched kernel
+// (see device_batch.h)
+constexpr double kThermalVoltage = 0.025852;  // kT/q at 300K
+constexpr double kDiodeVdMax = 0.7;     // Upper clamp of the junction voltage
+constexpr double kDiodeVdMinNvt = 15.0;  // Lower clamp, in units of n * Vt
+constexpr double kDiodeGmin = 1e-12;     // Minimum junction conductance
+
+// PULSE(v1 v2 td tr tf pw per) source waveform. Times are in seconds.
+struct PulseWaveform {
+  double v1;   // Initial value (also the DC value)
+  double v2;   // Pulsed value
+  double td;   // Delay before the first rising edge
+  double tr;   // Rise time
+  double tf;   // Fall time
+  double pw;   // Pulse width (time at v2)
+  double per;  // Period (0 for a single pulse)
+};
+
+// Terminal order of a MOSFET in Device::nodes and in the arrays of
+// MosfetOperatingPoint
+enum MosfetTerminal {
+  kMosfetDrain = 0,
+  kMosfetGate = 1,
+  kMosfetSource = 2,
+  kMosfetBulk = 3
+};
+
+// Drain-source conductance added to every MOSFET stamp, so that a device in
+// cut-off does not leave its drain floating
+constexpr double kMosfetGmin = 1e-12;
+
+// Parameters of the minimal charge-based n-channel MOSFET (see
+// docs/minimal_charge_based_mosfet.md): square-law GCA drain current, body
+// effect on the threshold, and the gate charge split between source and
+// drain with a constant partition factor
+struct MosfetParams {
+  double w;      // Channel width (m)
+  double l;      // Channel length (m)
+  double mu;     // Carrier mobility (m^2/Vs)
+  double cox;    // Oxide capacitance per area (F/m^2)
+  double vth0;   // Threshold voltage at Vbs = 0 (V)
+  double gamma;  // Body effect coefficient (sqrt(V)), 0 for none
+  double phi_f;  // Fermi potential (V)
+  double beta;   // Fraction of the channel charge assigned to the source
+};
+
+// Model evaluation at one bias point. Arrays are indexed by MosfetTerminal.
+struct MosfetOperatingPoint {
+  double id;       // Drain current, into the drain and out of the source
+  double g[4];     // g[j] = d id / d v[j]
+  double q[4];     // Terminal charges (they sum to zero)
+  double c[4][4];  // c[i][j] = d q[i] / d v[j]
+};
+
+// History of a capacitor at the last accepted point (the device state).
+// The current is kept for every method so that a switch to trapezoidal has
+// a valid i_{n-1}.
+struct CapacitorState {
+  double v_prev;   // Voltage v_{n-1}
+  double v_prev2;  // Voltage v_{n-2}
+  double i_prev;   // Current i_{n-1}
+};
+
+// Companion model of a capacitor c with history s for the step of ts by a
+// method of family K (the kind of ts->im): i = g_eq * v_n - i_eq
+template <IntegrationKind K>
+inline void CapacitorCompanion(double c, const CapacitorState* s,
+                               const TimeStepState* ts, double* g_eq,
+                               double* i_eq) {
+  const IntegrationMethod* im = ts->im;
+  *g_eq = im->alpha0 * c / ts->h;
+  *i_eq = CompanionHistory<K>(im->alpha1, im->alpha2, c, ts->h, s->v_prev,
+                              s->v_prev2, s->i_prev);
+}
+
+// Advance the history s of a capacitor c to the accepted voltage v of the
+// step of ts by a method of family K
+template <IntegrationKind K>
+inline void CapacitorAdvance(double c, CapacitorState* s,
+                             const TimeStepState* ts, double v) {
+  if (ts->im && ts->h > 0.0) {
+    const IntegrationMethod* im = ts->im;
+    double h = ts->h;
+    double i = (c / h) * (im->alpha0 * v - im->alpha1 * s->v_prev);
+    if constexpr (K == kIntegrationGear2) {
+      i -= (c / h) * im->alpha2 * s->v_prev2;
+    }
+    if constexpr (K == kIntegrationTrapezoidal) i -= s->i_prev;
+    s->i_prev = i;
+  }
+  s->v_prev2 = s->v_prev;
+  s->v_prev = v;
+}
+
 // ============================================================================
 // Device Factory Functions
 // ============================================================================
+//
+// With an arena the device, its params and its state are allocated as one
+// record in it (see device_arena.h) and DeviceFree leaves them alone: they
+// are released with the arena, so such a device must only be added to the
+// circuit owning the arena (Circuit::device_arena). Without one they are
+// allocated on the heap and freed by DeviceFree.
 
 // Create a resistor device
-Device* CreateResistor(const char* name, int n1, int n2, double resistance);
+Device* CreateResistor(const char* name, int n1, int n2, double resistance,
+                       DeviceArena* arena = nullptr);
 
 // Create a DC current source
-Device* CreateCurrentSource(const char* name, int n1, int n2, double current);
+Device* CreateCurrentSource(const char* name, int n1, int n2, double current,
+                            DeviceArena* arena = nullptr);
 
 // Create a DC voltage source
-Device* CreateVoltageSource(const char* name, int n1, int n2, double voltage);
+Device* CreateVoltageSource(const char* name, int n1, int n2, double voltage,
+                            DeviceArena* arena = nullptr);
+
+// Create a voltage source with a PULSE waveform. DC analyses use pulse->v1.
+Device* CreatePulseVoltageSource(const char* name, int n1, int n2,
+                                 const PulseWaveform* pulse,
+                                 DeviceArena* arena = nullptr);
+
+// Create a current source with a PULSE waveform. DC analyses use pulse->v1.
+Device* CreatePulseCurrentSource(const char* name, int n1, int n2,
+                                 const PulseWaveform* pulse,
+                                 DeviceArena* arena = nullptr);
 
 // Create a capacitor
-Device* CreateCapacitor(const char* name, int n1, int n2, double capacitance);
+Device* CreateCapacitor(const char* name, int n1, int n2, double capacitance,
+                        DeviceArena* arena = nullptr);
 
 // Create an inductor
-Device* CreateInductor(const char* name, int n1, int n2, double inductance);
+Device* CreateInductor(const char* name, int n1, int n2, double inductance,
+                       DeviceArena* arena = nullptr);
 
 // Create a Shockley diode
 Device* CreateDiode(const char* name, int n_anode, int n_cathode, double I_s,
-                    double n);
+                    double n, DeviceArena* arena = nullptr);
+
+// Create a 4-terminal MOSFET. Returns nullptr if params is missing or has a
+// non-positive channel length.
+Device* CreateMosfet(const char* name, int n_drain, int n_gate, int n_source,
+                     int n_bulk, const MosfetParams* params,
+                     DeviceArena* arena = nullptr);
 
 // ============================================================================
 // Device Utility Functions
 // ============================================================================
 
-// Free a device and its associated memory
+// Free a device and its associated memory (nothing for an arena device)
 void DeviceFree(Device* d);
 
+// Rename a device to the len bytes at name (not necessarily NUL-terminated).
+// arena must be the one the device was created in (nullptr for a heap
+// device); an arena device's old name stays in the arena.
+// Returns 0 on success, -1 on error (arena mismatch, allocation failure).
+int DeviceSetName(Device* d, const char* name, size_t len,
+                  DeviceArena* arena);
+
+// Copy a device including its state (e.g., capacitor history). With
+// share_params the copy points at the original's params, which must then
+// outlive it and be treated as read-only; otherwise the params are copied.
+// The copy is not linked into any circuit. arena is as for the factory
+// functions.
+// Returns nullptr on allocation failure.
+Device* DeviceClone(const Device* d, int share_params,
+                    DeviceArena* arena = nullptr);
+
+// Value of a pulse waveform at time t
+double PulseWaveformValue(const PulseWaveform* p, double t);
+
+// Earliest corner of a pulse waveform strictly after time t, or INFINITY
+double PulseWaveformNextBreakpoint(const PulseWaveform* p, double t);
+
+// Set the primary value of a device (e.g., the DC value of a V or I source)
+// in place. Takes effect on the next stamp.
+// Returns 0 on success, -1 if the device has no settable value.
+int DeviceSetValue(Device* d, double value);
+
+// Get the primary value of a device.
+// Returns 0 on success, -1 if the device has no such value.
+int DeviceGetValue(const Device* d, double* value);
+
+// Set the AC excitation of an independent V or I source: magnitude mag
+// (volts or amperes, 0 for none) at phase degrees. The DC and transient
+// values are unaffected.
+// Returns 0 on success, -1 if d is not an independent source.
+int DeviceSetAc(Device* d, double mag, double phase);
+
+// Set a model parameter of a device in place, by case-insensitive name:
+// "r" (resistor, nonzero), "c" (capacitor), "l" (inductor), "is" and "n"
+// (diode), "w", "l", "mu", "cox", "vth0", "gamma", "phi_f" and "beta"
+// (MOSFET), and "dc" for the primary value of a device with one (as
+// DeviceSetValue). Values must be finite; sizes, currents and the diode and
+// MOSFET coefficients other than vth0 must be positive (gamma may be 0 and
+// beta lies in [0, 1]). A diode or MOSFET drops its bypass linearizations
+// and its table (table-model mode is for the params the table was computed
+// from), and is evaluated exactly from then on. Takes effect on the next
+// stamp; workspaces with batched devices must be told through
+// Circuit::param_edits (see CircuitSetDeviceParam).
+// Returns 0 on success, -1 for an unknown parameter, an invalid value or
+// shared params (kDeviceSharedParams).
+int DeviceSetParam(Device* d, const char* name, double value);
+
+// Set the MOSFET parameters to the defaults of scripts/mosfet_model.py
+void MosfetParamsInit(MosfetParams* p);
+
+// Evaluate the MOSFET model at the terminal voltages v (indexed by
+// MosfetTerminal). Current and charge derivatives are closed-form. Drain
+// and source swap roles when v[drain] < v[source]; the current is then
+// negative.
+void MosfetEvaluate(const MosfetParams* p, const double v[4],
+                    MosfetOperatingPoint* op);
+
+// Stamp the charge (capacitive) companion model of a MOSFET for a
+// transient Newton iteration linearized at x. Part of the MOSFET transient
+// stamp; also called by the batched kernel after the conduction stamps.
+// Under bypass the charges of the last evaluation are reused when x is
+// within the bypass tolerance of their voltages.
+void MosfetStampCharges(Device* d, StampContext* ctx, const TimeStepState* ts,
+                        const double* x);
+
+// SPICE-style limits of the Newton step of a junction voltage from vold,
+// the voltage the device was linearized at in the previous iteration, to
+// vnew, the voltage of the new iterate. Each returns the limited voltage.
+// PnjLimit compresses forward steps above vcrit logarithmically (the
+// junction current then grows at most linearly per iteration), FetLimit
+// bounds gate-source steps relative to the threshold vto and LimvdsLimit
+// bounds drain-source steps.
+double PnjLimit(double vnew, double vold, double n_vt, double vcrit);
+double FetLimit(double vnew, double vold, double vto);
+double LimvdsLimit(double vnew, double vold);
+
+// Junction voltage a diode is linearized at in Newton iteration iter, for
+// the junction voltage vd of the iterate: vd itself in iteration 0, then
+// PnjLimit against the voltage of the previous iteration, which the device
+// keeps in its state. Repeated calls within one iteration (e.g., a stamp
+// rediscovery) return the same voltage.
+double DiodeLimitVoltage(Device* d, double vd, int iter);
+
+// MOSFET counterpart of DiodeLimitVoltage: limits the gate-source
+// (FetLimit) and drain-source (LimvdsLimit) steps of the terminal voltages
+// v in place, in the orientation of the previous iteration. Source and bulk
+// voltages are left unchanged.
+void MosfetLimitVoltages(Device* d, double v[4], int iter);
+
+// Device bypass (NewtonPolicy::bypass). A diode or MOSFET keeps the
+// linearization of its last model evaluation in its state. The Bypass
+// functions return 1 and that linearization when bypass is on, the cached
+// evaluation was not limited and used the device's current table mode, and
+// every controlling voltage of the iterate (the junction voltage vd, the
+// terminal voltages v) is within policy->bypass_vtol of the voltages it was
+// evaluated at; they return 0 otherwise. The Cache functions record an
+// evaluation for the iterate voltages (vd, v); limited is 1 if junction
+// limiting moved the voltages it was linearized at, which then cannot be
+// bypassed. A new MOSFET evaluation also drops the cached charges of
+// MosfetStampCharges, which are re-evaluated at the next charge stamp.
+int DiodeBypass(const Device* d, double vd, const NewtonPolicy* policy,
+                double* g, double* i_eq);
+void DiodeCacheLinearization(Device* d, double vd, int limited, double g,
+                             double i_eq);
+// v_eval receives the terminal voltages the current id and its derivatives
+// g were linearized at
+int MosfetBypass(const Device* d, const double v[4],
+                 const NewtonPolicy* policy, double v_eval[4], double* id,
+                 double g[4]);
+void MosfetCacheLinearization(Device* d, const double v[4], int limited,
+                              double id, const double g[4]);
+
+// Get the parameters of a MOSFET.
+// Returns 0 on success, -1 if the device is not a MOSFET.
+int MosfetGetParams(const Device* d, MosfetParams* p);
+
+// Type tag of a device: its position in a fixed table of the device types.
+// Tags are stable across builds (new types are appended) and identify the
+// type in circuit snapshots. Returns -1 for an unknown vtable.
+int DeviceTypeId(const Device* d);
+
+// Number of device types (type tags are 0 .. kNumDeviceTypes - 1)
+constexpr int kNumDeviceTypes = 7;
+
+// Lower-case name of a device type ("resistor", "mosfet", ...), or nullptr
+// for an unknown tag
+const char* DeviceTypeName(int type_id);
+
+// Create a device of type type_id from the raw params and state blocks of
+// a device of that type (e.g., read back from a snapshot). Terminals and
+// extra_var are used as given. params_size and state_size must match the
+// type's vtable; a state block is allocated (zeroed if state is nullptr)
+// whenever the type has state.
+// Returns nullptr on unknown type, size mismatch or allocation failure.
+Device* DeviceCreateFromData(int type_id, const char* name, const int nodes[4],
+                             int extra_var, const void* params,
+                             size_t params_size, const void* state,
+                             size_t state_size, DeviceArena* arena = nullptr);
+
+// Size of the params and state blocks of a device type (0 if none).
+// Returns 0 on success, -1 on unknown type.
+int DeviceTypeDataSizes(int type_id, size_t* params_size, size_t* state_size);
+
+// Get the saturation current and emission coefficient of a diode.
+// Returns 0 on success, -1 if the device is not a diode.
+int DiodeGetParams(const Device* d, double* i_s, double* n);
+
+// Get the capacitance of a capacitor.
+// Returns 0 on success, -1 if the device is not a capacitor.
+int CapacitorGetParams(const Device* d, double* c);
+
 }  // namespace minispice
 
 #endif  // MINI_SPICE_DEVICE_H_
@@ -0,0 +1,97 @@
+// Device arena implementation
+//
+// Blocks are allocated with the records following the block header, which
+// is padded to the record alignment. Records larger than a block get a
+// block of their own.
+//
+
+#include "device_arena.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "string_arena.h"
+
+namespace minispice {
+
+namespace {
+constexpr size_t kBlockSize = 64 * 1024;
+constexpr size_t kAlign = 16;
+
+size_t RoundUp(size_t n) { return (n + kAlign - 1) & ~(kAlign - 1); }
+}  // namespace
+
+struct alignas(16) DeviceArenaBlock {
+  DeviceArenaBlock* next;
+  size_t size;  // Bytes of record storage following the header
+  char* data() { return reinterpret_cast<char*>(this + 1); }
+};
+
+// ============================================================================
+// DeviceArena API Implementation
+// ============================================================================
+
+DeviceArena* DeviceArenaCreate(StringArena* names) {
+  DeviceArena* a = (DeviceArena*)calloc(1, sizeof(DeviceArena));
+  if (!a) return nullptr;
+  a->names = names;
+  if (!names) {
+    a->names = StringArenaCreate();
+    a->owns_names = 1;
+    if (!a->names) {
+      free(a);
+      return nullptr;
+    }
+  }
+  return a;
+}
+
+void DeviceArenaFree(DeviceArena* a) {
+  if (!a) return;
+  if (a->owns_names) StringArenaFree(a->names);
+
+  for (int t = 0; t < kNumDeviceTypes; t++) {
+    DeviceArenaBlock* b = a->blocks[t];
+    while (b) {
+      DeviceArenaBlock* next = b->next;
+      free(b);
+      b = next;
+    }
+  }
+  free(a);
+}
+
+void* DeviceArenaAlloc(DeviceArena* a, int type_id, size_t size) {
+  if (!a || type_id < 0 || type_id >= kNumDeviceTypes) return nullptr;
+
+  size_t need = RoundUp(size > 0 ? size : 1);
+  DeviceArenaBlock*& head = a->blocks[type_id];
+  if (!head || need > a->remaining[type_id]) {
+    size_t bytes = need > kBlockSize ? need : kBlockSize;
+    DeviceArenaBlock* b =
+        (DeviceArenaBlock*)malloc(sizeof(DeviceArenaBlock) + bytes);
+    if (!b) return nullptr;
+    b->size = bytes;
+    if (bytes == need && head) {
+      // Oversized record: keep filling the current block afterwards
+      b->next = head->next;
+      head->next = b;
+      memset(b->data(), 0, need);
+      a->num_records++;
+      a->bytes_used += need;
+      return b->data();
+    }
+    b->next = head;
+    head = b;
+    a->remaining[type_id] = bytes;
+  }
+
+  char* dst = head->data() + (head->size - a->remaining[type_id]);
+  memset(dst, 0, need);
+  a->remaining[type_id] -= need;
+  a->num_records++;
+  a->bytes_used += need;
+  return dst;
+}
+
+}  // namespace minispice
@@ -0,0 +1,50 @@
+// device_arena.h
+// Contiguous storage of the devices of a circuit
+//
+// A DeviceArena hands out zeroed, never-moving records from large blocks,
+// one chain of blocks per device type. A device created in the arena is a
+// single record holding the Device followed by its params and state, so
+// the devices of one type sit next to each other in memory and a circuit
+// of a million elements makes a few hundred allocations instead of three
+// million. Records are only released all at once, with the arena.
+
+#ifndef MINI_SPICE_DEVICE_ARENA_H_
+#define MINI_SPICE_DEVICE_ARENA_H_
+
+#include <stddef.h>
+
+#include "device.h"
+
+namespace minispice {
+
+struct DeviceArenaBlock;
+struct StringArena;
+
+struct DeviceArena {
+  DeviceArenaBlock* blocks[kNumDeviceTypes];  // Most recent block first
+  size_t remaining[kNumDeviceTypes];  // Free bytes in the most recent block
+  long num_records;                   // Records handed out
+  size_t bytes_used;                  // Total bytes of the records
+
+  // Storage of the names of the devices created in the arena
+  StringArena* names;
+  int owns_names;  // 1 if names was created with (and is freed with) the arena
+};
+
+// Create an empty arena whose devices keep their names in names (the
+// circuit's StringArena, which must outlive the arena's devices), or in a
+// StringArena of the arena's own if names is nullptr.
+// Returns nullptr on allocation failure.
+DeviceArena* DeviceArenaCreate(StringArena* names = nullptr);
+
+// Free the arena and every record allocated from it (and its own names)
+void DeviceArenaFree(DeviceArena* a);
+
+// Allocate a zeroed record of size bytes, aligned to 16 bytes, in the block
+// chain of device type type_id. Returns nullptr on an unknown type or
+// allocation failure.
+void* DeviceArenaAlloc(DeviceArena* a, int type_id, size_t size);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_DEVICE_ARENA_H_
@@ -0,0 +1,181 @@
+// device_arena_test.cc
+// Unit tests for the device arena and arena-allocated devices
+
+#include "device_arena.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "circuit.h"
+#include "device.h"
+#include "parser.h"
+
+using namespace minispice;
+
+TEST(DeviceArenaTest, RecordsAreZeroedAlignedAndContiguousPerType) {
+  DeviceArena* a = DeviceArenaCreate();
+  ASSERT_NE(a, nullptr);
+
+  // Interleave two types: each type's records follow one another
+  std::vector<char*> caps, mosfets;
+  for (int i = 0; i < 100; i++) {
+    caps.push_back(static_cast<char*>(DeviceArenaAlloc(a, 3, 120)));
+    mosfets.push_back(static_cast<char*>(DeviceArenaAlloc(a, 6, 300)));
+    ASSERT_NE(caps.back(), nullptr);
+    ASSERT_NE(mosfets.back(), nullptr);
+  }
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(caps[i]) % 16, 0u);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(mosfets[i]) % 16, 0u);
+    for (int k = 0; k < 120; k++) ASSERT_EQ(caps[i][k], 0);
+    if (i > 0) {
+      EXPECT_EQ(caps[i] - caps[i - 1], 128);
+      EXPECT_EQ(mosfets[i] - mosfets[i - 1], 304);
+    }
+  }
+  EXPECT_EQ(a->num_records, 200);
+  EXPECT_EQ(a->bytes_used, 100u * (128 + 304));
+
+  EXPECT_EQ(DeviceArenaAlloc(a, -1, 8), nullptr);
+  EXPECT_EQ(DeviceArenaAlloc(a, kNumDeviceTypes, 8), nullptr);
+
+  DeviceArenaFree(a);
+}
+
+TEST(DeviceArenaTest, PointersStayValidAcrossBlocks) {
+  DeviceArena* a = DeviceArenaCreate();
+  ASSERT_NE(a, nullptr);
+
+  // Enough records to span several blocks, plus records larger than a block
+  std::vector<int*> stored;
+  for (int i = 0; i < 20000; i++) {
+    size_t size = i % 5000 == 0 ? 100000 : 24;
+    int* p = static_cast<int*>(DeviceArenaAlloc(a, 0, size));
+    ASSERT_NE(p, nullptr);
+    *p = i;
+    p[size / sizeof(int) - 1] = -i;
+    stored.push_back(p);
+  }
+  for (int i = 0; i < 20000; i++) {
+    size_t size = i % 5000 == 0 ? 100000 : 24;
+    EXPECT_EQ(*stored[i], i);
+    EXPECT_EQ(stored[i][size / sizeof(int) - 1], -i);
+  }
+
+  DeviceArenaFree(a);
+}
+
+TEST(DeviceArenaTest, DeviceIsOneRecordWithItsParamsAndState) {
+  DeviceArena* a = DeviceArenaCreate();
+  ASSERT_NE(a, nullptr);
+
+  Device* c1 = CreateCapacitor("C1", 1, 0, 1e-12, a);
+  Device* c2 = CreateCapacitor("C2", 2, 0, 2e-12, a);
+  ASSERT_NE(c1, nullptr);
+  ASSERT_NE(c2, nullptr);
+  EXPECT_TRUE(c1->flags & kDeviceArena);
+  EXPECT_STREQ(c1->name, "C1");
+
+  // Params and state live inside the record, before the next device
+  const char* rec = reinterpret_cast<const char*>(c1);
+  const char* next = reinterpret_cast<const char*>(c2);
+  ASSERT_NE(c1->params, nullptr);
+  ASSERT_NE(c1->state, nullptr);
+  EXPECT_GT(static_cast<const char*>(c1->params), rec);
+  EXPECT_LT(static_cast<const char*>(c1->state), next);
+  double c = 0.0;
+  ASSERT_EQ(CapacitorGetParams(c2, &c), 0);
+  EXPECT_EQ(c, 2e-12);
+
+  // Pulse sources and clones go through the same path
+  PulseWaveform pulse = {0.0, 1.0, 0.0, 1e-9, 1e-9, 5e-9, 10e-9};
+  Device* v = CreatePulseVoltageSource("V1", 1, 0, &pulse, a);
+  ASSERT_NE(v, nullptr);
+  EXPECT_TRUE(v->flags & kDeviceArena);
+  Device* copy = DeviceClone(c1, 1, a);
+  ASSERT_NE(copy, nullptr);
+  EXPECT_EQ(copy->flags, kDeviceArena | kDeviceSharedParams);
+  EXPECT_EQ(copy->params, c1->params);
+  EXPECT_NE(copy->state, c1->state);
+
+  // A heap clone of an arena device is freed on its own
+  Device* heap = DeviceClone(c2, 0);
+  ASSERT_NE(heap, nullptr);
+  EXPECT_EQ(heap->flags, 0);
+  ASSERT_EQ(CapacitorGetParams(heap, &c), 0);
+  EXPECT_EQ(c, 2e-12);
+  DeviceFree(heap);
+
+  // Arena devices are released with the arena only
+  DeviceFree(c1);
+  EXPECT_STREQ(c1->name, "C1");
+  DeviceArenaFree(a);
+}
+
+TEST(DeviceArenaTest, ParsedCircuitHoldsItsDevicesInItsArena) {
+  std::string netlist = "* RC ladder\nV1 n0 0 1\n";
+  for (int i = 0; i < 50; i++) {
+    std::string a = "n" + std::to_string(i);
+    std::string b = "n" + std::to_string(i + 1);
+    netlist += "R" + std::to_string(i) + " " + a + " " + b + " 1k\n";
+    netlist += "C" + std::to_string(i) + " " + b + " 0 1p\n";
+  }
+  Circuit* c = parse_netlist_string(netlist.c_str());
+  ASSERT_NE(c, nullptr);
+  ASSERT_NE(c->device_arena, nullptr);
+  EXPECT_EQ(c->num_heap_devices, 0);
+  EXPECT_EQ(c->device_arena->num_records, c->num_devices);
+  for (const Device* d = c->devices; d; d = d->next) {
+    EXPECT_TRUE(d->flags & kDeviceArena) << d->name;
+  }
+
+  std::vector<double> x(c->num_vars), y(c->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+
+  Circuit* copy = CircuitClone(c);
+  ASSERT_NE(copy, nullptr);
+  EXPECT_EQ(copy->num_heap_devices, 0);
+  EXPECT_EQ(copy->device_arena->num_records, c->num_devices);
+  ASSERT_GT(CircuitDcAnalysis(copy, y.data(), 100, 1e-12, 1e-9), 0);
+  EXPECT_EQ(x, y);
+
+  circuit_free(copy);
+  circuit_free(c);
+}
+
+TEST(DeviceArenaTest, CircuitFreesHeapDevicesAddedNextToArenaDevices) {
+  Circuit* c = circuit_create();
+  ASSERT_NE(c, nullptr);
+  int n1 = CircuitAddNode(c, "1");
+  int n2 = CircuitAddNode(c, "2");
+  ASSERT_NE(CircuitAddDevice(c, CreateVoltageSource("V1", n1, 0, 2.0,
+                                                    c->device_arena)),
+            nullptr);
+  ASSERT_NE(CircuitAddDevice(c, CreateResistor("R1", n1, n2, 1e3)), nullptr);
+  ASSERT_NE(CircuitAddDevice(c, CreateResistor("R2", n2, 0, 1e3,
+                                               c->device_arena)),
+            nullptr);
+  EXPECT_EQ(c->num_devices, 3);
+  EXPECT_EQ(c->num_heap_devices, 1);
+  ASSERT_EQ(CircuitFinalize(c), 0);
+
+  // Convert device nodes to var indices
+  for (Device* d = c->devices; d; d = d->next) {
+    for (int i = 0; i < 4; i++) {
+      int node_idx = d->nodes[i];
+      if (node_idx >= 0 && node_idx < c->num_nodes) {
+        d->nodes[i] = c->nodes[node_idx].var_index;
+      }
+    }
+  }
+
+  std::vector<double> x(c->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+  EXPECT_NEAR(x[CircuitGetVarIndex(c, n2)], 1.0, 1e-9);
+
+  circuit_free(c);
+}
@@ -0,0 +1,781 @@
+// Device batch implementation
+//
+// Builds the SoA diode and MOSFET arrays of a circuit and implements the
+// vectorized exponential and the batched stamps.
+//
+
+#include "device_batch.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+// x86-64 builds compile the AVX2 exp kernel for that target alone and pick
+// it at run time when the CPU has AVX2 (always, when the whole library is
+// built for AVX2)
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MINISPICE_EXP_AVX2 1
+#include <immintrin.h>
+#define MINISPICE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#include "circuit.h"
+#include "device.h"
+#include "table_model.h"
+
+namespace minispice {
+
+namespace {
+
+// Arguments are clamped so exp() stays a finite normal number
+constexpr double kExpMin = -708.0;
+constexpr double kExpMax = 709.0;
+
+#if defined(MINISPICE_EXP_AVX2)
+// exp(x) = 2^k * exp(r) with k = round(x / ln2) and |r| <= ln2 / 2. k is
+// rounded by adding kShifter (1.5 * 2^52), which leaves k in the low
+// mantissa bits of the sum; 2^k is then built directly from those bits.
+// ln2 is split so that k * kLn2Hi is exact for |k| < 2^11.
+constexpr double kLog2e = 1.4426950408889634;
+constexpr double kLn2Hi = 6.93147180369123816490e-01;
+constexpr double kLn2Lo = 1.90821492927058770002e-10;
+constexpr double kShifter = 6755399441055744.0;  // 1.5 * 2^52
+
+// Added to the bits of (x * log2e + kShifter) to get the biased exponent of
+// 2^k in the low bits: 1023 - bits(kShifter), modulo 2^64
+constexpr uint64_t kExponentBias = 1023ull - 0x4338000000000000ull;
+
+// Taylor coefficients 1/j! of exp(r) for j = 13 down to 2; degree 13 keeps
+// the truncation error below 1e-17 on |r| <= ln2 / 2
+constexpr double kExpPoly[] = {
+    1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0,
+    1.0 / 3628800.0,    1.0 / 362880.0,    1.0 / 40320.0,
+    1.0 / 5040.0,       1.0 / 720.0,       1.0 / 120.0,
+    1.0 / 24.0,         1.0 / 6.0,         1.0 / 2.0};
+constexpr int kExpPolyTerms = sizeof(kExpPoly) / sizeof(kExpPoly[0]);
+
+// AVX2 kernel for four values. Without AVX2 the C library exp is used: a
+// scalar polynomial kernel is slower than it.
+MINISPICE_TARGET_AVX2 static inline __m256d ExpAvx2(__m256d x) {
+  x = _mm256_max_pd(x, _mm256_set1_pd(kExpMin));
+  x = _mm256_min_pd(x, _mm256_set1_pd(kExpMax));
+
+  const __m256d shifter = _mm256_set1_pd(kShifter);
+  __m256d t = _mm256_add_pd(_mm256_mul_pd(x, _mm256_set1_pd(kLog2e)), shifter);
+  __m256d k = _mm256_sub_pd(t, shifter);
+  __m256d r = _mm256_sub_pd(x, _mm256_mul_pd(k, _mm256_set1_pd(kLn2Hi)));
+  r = _mm256_sub_pd(r, _mm256_mul_pd(k, _mm256_set1_pd(kLn2Lo)));
+
+  __m256d p = _mm256_set1_pd(kExpPoly[0]);
+  for (int j = 1; j < kExpPolyTerms; j++) {
+    p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(kExpPoly[j]));
+  }
+  const __m256d one = _mm256_set1_pd(1.0);
+  p = _mm256_add_pd(_mm256_mul_pd(p, r), one);
+  p = _mm256_add_pd(_mm256_mul_pd(p, r), one);
+
+  __m256i bits = _mm256_add_epi64(_mm256_castpd_si256(t),
+                                  _mm256_set1_epi64x((long long)kExponentBias));
+  bits = _mm256_slli_epi64(bits, 52);
+  return _mm256_mul_pd(p, _mm256_castsi256_pd(bits));
+}
+
+// y[i] = exp(x[i]) for the first count / 4 * 4 values; returns their number
+MINISPICE_TARGET_AVX2 static int ExpBatchAvx2(const double* x, double* y,
+                                              int count) {
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm256_storeu_pd(y + i, ExpAvx2(_mm256_loadu_pd(x + i)));
+  }
+  return i;
+}
+
+static bool CpuHasAvx2() {
+#if defined(__AVX2__)
+  return true;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// Allocate the SoA arrays of a diode batch
+static int DiodeBatchAlloc(DiodeBatch* db, int count) {
+  db->count = count;
+  if (count == 0) return 0;
+  db->device_index = (int*)calloc(count, sizeof(int));
+  db->devices = (Device**)calloc(count, sizeof(Device*));
+  db->anode = (int*)calloc(count, sizeof(int));
+  db->cathode = (int*)calloc(count, sizeof(int));
+  db->i_s = (double*)calloc(count, sizeof(double));
+  db->n_vt = (double*)calloc(count, sizeof(double));
+  db->active = (int*)calloc(count, sizeof(int));
+  db->vd = (double*)calloc(count, sizeof(double));
+  db->v_lin = (double*)calloc(count, sizeof(double));
+  db->limited = (unsigned char*)calloc(count, 1);
+  db->e = (double*)calloc(count, sizeof(double));
+  db->g = (double*)calloc(count, sizeof(double));
+  db->i_eq = (double*)calloc(count, sizeof(double));
+  if (!db->device_index || !db->devices || !db->anode || !db->cathode ||
+      !db->i_s || !db->n_vt || !db->active || !db->vd || !db->v_lin ||
+      !db->limited || !db->e || !db->g || !db->i_eq) {
+    return -1;
+  }
+  return 0;
+}
+
+static void DiodeBatchRelease(DiodeBatch* db) {
+  free(db->device_index);
+  free(db->devices);
+  free(db->anode);
+  free(db->cathode);
+  free(db->i_s);
+  free(db->n_vt);
+  free(db->table);
+  free(db->active);
+  free(db->vd);
+  free(db->v_lin);
+  free(db->limited);
+  free(db->e);
+  free(db->g);
+  free(db->i_eq);
+}
+
+// Evaluate and stamp the diodes [begin, end) of the batch for Newton
+// iteration iter under policy (junction limiting, bypass). Mirrors
+// DiodeStampNonlinear in device.cc. The active list and the arrays indexed
+// by it are used from position begin on, so disjoint ranges can be stamped
+// concurrently.
+static void DiodeBatchStamp(DiodeBatch* db, StampContext* ctx,
+                            const double* x, int iter,
+                            const NewtonPolicy* policy,
+                            DeviceEvalCounts* counts, int begin, int end) {
+  int* active = db->active + begin;
+  unsigned char* limited = db->limited + begin;
+  double* v_lin = db->v_lin + begin;
+  double* exps = db->e + begin;
+
+  // Gather the junction voltages (indirect, scalar)
+  for (int i = begin; i < end; i++) {
+    double va = db->anode[i] >= 0 ? x[db->anode[i]] : 0.0;
+    double vc = db->cathode[i] >= 0 ? x[db->cathode[i]] : 0.0;
+    db->vd[i] = va - vc;
+  }
+
+  // Bypassed diodes take their cached linearization; the others are
+  // evaluated, compacted into the active list
+  int num_active = 0;
+  for (int i = begin; i < end; i++) {
+    if (!DiodeBypass(db->devices[i], db->vd[i], policy, &db->g[i],
+                     &db->i_eq[i])) {
+      active[num_active++] = i;
+    }
+  }
+  if (counts) {
+    counts->evaluations += num_active;
+    counts->bypassed += end - begin - num_active;
+  }
+
+  // Limit, clamp and form the exponent arguments
+  for (int j = 0; j < num_active; j++) {
+    int i = active[j];
+    double vd = db->vd[i];
+    if (policy->limit_junctions) {
+      vd = DiodeLimitVoltage(db->devices[i], vd, iter);
+    }
+    limited[j] = vd != db->vd[i];
+    double vd_min = -kDiodeVdMinNvt * db->n_vt[i];
+    vd = vd > kDiodeVdMax ? kDiodeVdMax : vd;
+    vd = vd < vd_min ? vd_min : vd;
+    v_lin[j] = vd;
+    exps[j] = vd / db->n_vt[i];
+  }
+
+  if (db->table) {
+    // Table-model mode: interpolated current and conductance
+    for (int j = 0; j < num_active; j++) {
+      int i = active[j];
+      double vd = v_lin[j];
+      double i_d, g;
+      const MonotoneCubicTable* t = db->table[i];
+      if (!t || !MonotoneCubicTableEval(t, vd, &i_d, &g)) {
+        double e = exp(exps[j]);
+        i_d = db->i_s[i] * (e - 1.0);
+        g = (db->i_s[i] / db->n_vt[i]) * e;
+      }
+      g = g < kDiodeGmin ? kDiodeGmin : g;
+      db->g[i] = g;
+      db->i_eq[i] = i_d - g * vd;
+    }
+  } else {
+    ExpBatch(exps, exps, num_active);
+
+    // Linearized companion model
+    for (int j = 0; j < num_active; j++) {
+      int i = active[j];
+      double e = exps[j];
+      double i_d = db->i_s[i] * (e - 1.0);
+      double g = (db->i_s[i] / db->n_vt[i]) * e;
+      g = g < kDiodeGmin ? kDiodeGmin : g;
+      db->g[i] = g;
+      db->i_eq[i] = i_d - g * v_lin[j];
+    }
+  }
+  for (int j = 0; j < num_active; j++) {
+    int i = active[j];
+    DiodeCacheLinearization(db->devices[i], db->vd[i], limited[j],
+                            db->g[i], db->i_eq[i]);
+  }
+
+  // Scatter in the same call order as the scalar stamp
+  for (int i = begin; i < end; i++) {
+    int a = db->anode[i];
+    int k = db->cathode[i];
+    double g = db->g[i];
+    double i_eq = db->i_eq[i];
+
+    CtxBeginDevice(ctx, db->device_index[i]);
+    if (a >= 0) CtxAddA(ctx, a, a, +g);
+    if (k >= 0) CtxAddA(ctx, k, k, +g);
+    if (a >= 0 && k >= 0) {
+      CtxAddA(ctx, a, k, -g);
+      CtxAddA(ctx, k, a, -g);
+    }
+    if (a >= 0) CtxAddZ(ctx, a, -i_eq);
+    if (k >= 0) CtxAddZ(ctx, k, +i_eq);
+  }
+}
+
+// Allocate the SoA arrays of a MOSFET batch
+static int MosfetBatchAlloc(MosfetBatch* mb, int count) {
+  mb->count = count;
+  if (count == 0) return 0;
+  mb->device_index = (int*)calloc(count, sizeof(int));
+  mb->devices = (Device**)calloc(count, sizeof(Device*));
+  mb->k = (double*)calloc(count, sizeof(double));
+  mb->vth0 = (double*)calloc(count, sizeof(double));
+  mb->gamma = (double*)calloc(count, sizeof(double));
+  mb->phi2 = (double*)calloc(count, sizeof(double));
+  mb->sqrt_phi2 = (double*)calloc(count, sizeof(double));
+  mb->active = (int*)calloc(count, sizeof(int));
+  mb->limited = (unsigned char*)calloc(count, 1);
+  mb->vth = (double*)calloc(count, sizeof(double));
+  mb->dvth = (double*)calloc(count, sizeof(double));
+  mb->id = (double*)calloc(count, sizeof(double));
+  int ok = mb->device_index && mb->devices && mb->k && mb->vth0 &&
+           mb->gamma && mb->phi2 && mb->sqrt_phi2 && mb->active &&
+           mb->limited && mb->vth && mb->dvth && mb->id;
+  for (int j = 0; j < 4; j++) {
+    mb->terminal[j] = (int*)calloc(count, sizeof(int));
+    mb->u[j] = (double*)calloc(count, sizeof(double));
+    mb->v[j] = (double*)calloc(count, sizeof(double));
+    mb->g[j] = (double*)calloc(count, sizeof(double));
+    ok = ok && mb->terminal[j] && mb->u[j] && mb->v[j] && mb->g[j];
+  }
+  return ok ? 0 : -1;
+}
+
+static void MosfetBatchRelease(MosfetBatch* mb) {
+  free(mb->device_index);
+  free(mb->devices);
+  free(mb->k);
+  free(mb->vth0);
+  free(mb->gamma);
+  free(mb->phi2);
+  free(mb->sqrt_phi2);
+  free(mb->table);
+  free(mb->active);
+  free(mb->limited);
+  free(mb->vth);
+  free(mb->dvth);
+  free(mb->id);
+  for (int j = 0; j < 4; j++) {
+    free(mb->terminal[j]);
+    free(mb->u[j]);
+    free(mb->v[j]);
+    free(mb->g[j]);
+  }
+}
+
+// Evaluate and stamp the MOSFETs [begin, end) of the batch for Newton
+// iteration iter under policy (voltage limiting, bypass). Mirrors
+// MosfetEvaluate and the conduction stamp of MosfetStampNonlinear in
+// device.cc; the charge stamps of transient iterations follow each device's
+// conduction stamps as in MosfetStampTransient. As for diodes, the arrays
+// indexed by the active list are used from position begin on.
+static void MosfetBatchStamp(MosfetBatch* mb, StampContext* ctx,
+                             const double* x, int iter,
+                             const NewtonPolicy* policy,
+                             DeviceEvalCounts* counts,
+                             const TimeStepState* ts, int begin, int end) {
+  int* active = mb->active + begin;
+  unsigned char* limited = mb->limited + begin;
+  double* vd = mb->u[kMosfetDrain] + begin;
+  double* vg = mb->u[kMosfetGate] + begin;
+  double* vs = mb->u[kMosfetSource] + begin;
+  double* vb = mb->u[kMosfetBulk] + begin;
+  double* vths = mb->vth + begin;
+  double* dvths = mb->dvth + begin;
+
+  // Gather the terminal voltages (indirect, scalar)
+  for (int j = 0; j < 4; j++) {
+    const int* t = mb->terminal[j];
+    double* v = mb->v[j];
+    for (int i = begin; i < end; i++) v[i] = t[i] >= 0 ? x[t[i]] : 0.0;
+  }
+
+  // Bypassed MOSFETs take their cached linearization; the others are
+  // evaluated, compacted into the active list with their (limited) voltages
+  int num_active = 0;
+  for (int i = begin; i < end; i++) {
+    double v[4];
+    for (int j = 0; j < 4; j++) v[j] = mb->v[j][i];
+    double v_eval[4], g[4];
+    if (MosfetBypass(mb->devices[i], v, policy, v_eval, &mb->id[i], g)) {
+      for (int j = 0; j < 4; j++) {
+        mb->v[j][i] = v_eval[j];
+        mb->g[j][i] = g[j];
+      }
+      continue;
+    }
+    int a = num_active++;
+    active[a] = i;
+    if (policy->limit_junctions) MosfetLimitVoltages(mb->devices[i], v, iter);
+    limited[a] = 0;
+    for (int j = 0; j < 4; j++) {
+      limited[a] |= v[j] != mb->v[j][i];
+      mb->u[j][begin + a] = v[j];
+    }
+  }
+  if (counts) {
+    counts->evaluations += num_active;
+    counts->bypassed += end - begin - num_active;
+  }
+
+  // Threshold with body effect (unit stride, vectorizable)
+  for (int a = 0; a < num_active; a++) {
+    int i = active[a];
+    double vbs = vb[a] - (vd[a] < vs[a] ? vd[a] : vs[a]);
+    double arg = mb->phi2[i] - vbs;
+    double root = arg > 0.0 ? sqrt(arg) : 0.0;
+    vths[a] = mb->vth0[i] + mb->gamma[i] * (root - mb->sqrt_phi2[i]);
+    dvths[a] = root > 0.0 ? -mb->gamma[i] / (2.0 * root) : 0.0;
+  }
+  if (mb->table) {
+    // Table-model mode: interpolated threshold shift where in range
+    for (int a = 0; a < num_active; a++) {
+      int i = active[a];
+      if (!mb->table[i]) continue;
+      double vbs = vb[a] - (vd[a] < vs[a] ? vd[a] : vs[a]);
+      double shift, dvth;
+      if (MonotoneCubicTableEval(mb->table[i], vbs, &shift, &dvth)) {
+        vths[a] = mb->vth0[i] + shift;
+        dvths[a] = dvth;
+      }
+    }
+  }
+
+  // Square-law model with selects instead of branches (unit stride,
+  // vectorizable)
+  double* gd = mb->g[kMosfetDrain];
+  double* gg = mb->g[kMosfetGate];
+  double* gs = mb->g[kMosfetSource];
+  double* gb = mb->g[kMosfetBulk];
+  for (int a = 0; a < num_active; a++) {
+    int i = active[a];
+    bool reverse = vd[a] < vs[a];
+    double v_sn = reverse ? vd[a] : vs[a];
+    double v_dn = reverse ? vs[a] : vd[a];
+    double vgs = vg[a] - v_sn;
+    double vds = v_dn - v_sn;
+    double vth = vths[a];
+    double dvth = dvths[a];
+
+    double k = mb->k[i];
+    double vov = vgs - vth;
+    bool on = vov > 0.0;
+    bool linear = vds <= vov;
+    double ids =
+        linear ? k * (vov * vds - 0.5 * vds * vds) : 0.5 * k * vov * vov;
+    double gm = linear ? k * vds : k * vov;
+    double gds = linear ? k * (vov - vds) : 0.0;
+    ids = on ? ids : 0.0;
+    gm = on ? gm : 0.0;
+    gds = on ? gds : 0.0;
+    double gmb = -gm * dvth;
+
+    double sign = reverse ? -1.0 : 1.0;
+    double g_dn = sign * gds;
+    double g_sn = -sign * (gm + gds + gmb);
+    mb->id[i] = sign * ids;
+    gg[i] = sign * gm;
+    gb[i] = sign * gmb;
+    gd[i] = reverse ? g_sn : g_dn;
+    gs[i] = reverse ? g_dn : g_sn;
+  }
+
+  // Cache the evaluations at the iterate voltages, then linearize at the
+  // limited ones
+  for (int a = 0; a < num_active; a++) {
+    int i = active[a];
+    double v[4], g[4];
+    for (int j = 0; j < 4; j++) {
+      v[j] = mb->v[j][i];
+      g[j] = mb->g[j][i];
+    }
+    MosfetCacheLinearization(mb->devices[i], v, limited[a], mb->id[i], g);
+    for (int j = 0; j < 4; j++) mb->v[j][i] = mb->u[j][begin + a];
+  }
+
+  // Scatter in the same call order as the scalar stamp
+  for (int i = begin; i < end; i++) {
+    int nd = mb->terminal[kMosfetDrain][i];
+    int ns = mb->terminal[kMosfetSource][i];
+    double g[4];
+    double v[4];
+    for (int j = 0; j < 4; j++) {
+      g[j] = mb->g[j][i];
+      v[j] = mb->v[j][i];
+    }
+    g[kMosfetDrain] += kMosfetGmin;
+    g[kMosfetSource] -= kMosfetGmin;
+    double i_eq =
+        mb->id[i] + kMosfetGmin * (v[kMosfetDrain] - v[kMosfetSource]);
+    for (int j = 0; j < 4; j++) i_eq -= g[j] * v[j];
+
+    CtxBeginDevice(ctx, mb->device_index[i]);
+    for (int j = 0; j < 4; j++) {
+      int col = mb->terminal[j][i];
+      if (col < 0) continue;
+      if (nd >= 0) CtxAddA(ctx, nd, col, +g[j]);
+      if (ns >= 0) CtxAddA(ctx, ns, col, -g[j]);
+    }
+    if (nd >= 0) CtxAddZ(ctx, nd, -i_eq);
+    if (ns >= 0) CtxAddZ(ctx, ns, +i_eq);
+
+    if (ts) MosfetStampCharges(mb->devices[i], ctx, ts, x);
+  }
+}
+
+// Allocate the SoA arrays of a capacitor batch
+static int CapacitorBatchAlloc(CapacitorBatch* cb, int count) {
+  cb->count = count;
+  if (count == 0) return 0;
+  cb->device_index = (int*)calloc(count, sizeof(int));
+  cb->state = (CapacitorState**)calloc(count, sizeof(CapacitorState*));
+  cb->n1 = (int*)calloc(count, sizeof(int));
+  cb->n2 = (int*)calloc(count, sizeof(int));
+  cb->c = (double*)calloc(count, sizeof(double));
+  if (!cb->device_index || !cb->state || !cb->n1 || !cb->n2 || !cb->c) {
+    return -1;
+  }
+  return 0;
+}
+
+static void CapacitorBatchRelease(CapacitorBatch* cb) {
+  free(cb->device_index);
+  free(cb->state);
+  free(cb->n1);
+  free(cb->n2);
+  free(cb->c);
+}
+
+// Stamp the companion models of the capacitors [begin, end) of the batch
+// for a step of a method of family K. Mirrors CapacitorStampTransient in
+// device.cc.
+template <IntegrationKind K>
+static void CapacitorBatchStamp(const CapacitorBatch* cb, StampContext* ctx,
+                                const TimeStepState* ts, int begin, int end) {
+  for (int i = begin; i < end; i++) {
+    double g_eq, i_eq;
+    CapacitorCompanion<K>(cb->c[i], cb->state[i], ts, &g_eq, &i_eq);
+
+    int n1 = cb->n1[i];
+    int n2 = cb->n2[i];
+    CtxBeginDevice(ctx, cb->device_index[i]);
+    if (n1 >= 0) CtxAddA(ctx, n1, n1, +g_eq);
+    if (n2 >= 0) CtxAddA(ctx, n2, n2, +g_eq);
+    if (n1 >= 0 && n2 >= 0) {
+      CtxAddA(ctx, n1, n2, -g_eq);
+      CtxAddA(ctx, n2, n1, -g_eq);
+    }
+    if (n1 >= 0) CtxAddZ(ctx, n1, +i_eq);
+    if (n2 >= 0) CtxAddZ(ctx, n2, -i_eq);
+  }
+}
+
+// Advance the histories of all capacitors to the accepted solution x of a
+// step of a method of family K. Mirrors CapacitorUpdateState in device.cc.
+template <IntegrationKind K>
+static void CapacitorBatchAdvance(const CapacitorBatch* cb, const double* x,
+                                  const TimeStepState* ts) {
+  for (int i = 0; i < cb->count; i++) {
+    int n1 = cb->n1[i];
+    int n2 = cb->n2[i];
+    double v = ((n1 >= 0) ? x[n1] : 0.0) - ((n2 >= 0) ? x[n2] : 0.0);
+    CapacitorAdvance<K>(cb->c[i], cb->state[i], ts, v);
+  }
+}
+
+// Model params of batched diode i from its device d
+static void DiodeBatchSetParams(DiodeBatch* db, int i, const Device* d,
+                                double i_s, double n) {
+  db->i_s[i] = i_s;
+  db->n_vt[i] = n * kThermalVoltage;
+  if (db->table) db->table[i] = d->table;
+}
+
+// Model params of batched MOSFET m from its device d with params p
+static void MosfetBatchSetParams(MosfetBatch* mb, int m, const Device* d,
+                                 const MosfetParams* p) {
+  mb->k[m] = p->mu * p->cox * p->w / p->l;
+  mb->vth0[m] = p->vth0;
+  mb->gamma[m] = p->gamma;
+  mb->phi2[m] = 2.0 * p->phi_f;
+  mb->sqrt_phi2[m] = sqrt(2.0 * p->phi_f);
+  if (mb->table) mb->table[m] = d->table;
+}
+
+}  // namespace
+
+// ============================================================================
+// Device Batch API Implementation
+// ============================================================================
+
+int ExpBatchIsVectorized() {
+#if defined(MINISPICE_EXP_AVX2)
+  static const bool avx2 = CpuHasAvx2();
+  return avx2 ? 1 : 0;
+#else
+  return 0;
+#endif
+}
+
+void ExpBatch(const double* x, double* y, int count) {
+  int i = 0;
+#if defined(MINISPICE_EXP_AVX2)
+  if (ExpBatchIsVectorized()) i = ExpBatchAvx2(x, y, count);
+#endif
+  for (; i < count; i++) {
+    double v = x[i] < kExpMin ? kExpMin : (x[i] > kExpMax ? kExpMax : x[i]);
+    y[i] = exp(v);
+  }
+}
+
+DeviceBatches* DeviceBatchesCreate(const Circuit* c) {
+  if (!c || !c->finalized) return nullptr;
+
+  int num_diodes = 0;
+  int num_mosfets = 0;
+  int num_capacitors = 0;
+  bool diode_tables = false;
+  bool mosfet_tables = false;
+  for (const Device* d = c->devices; d; d = d->next) {
+    if (DiodeGetParams(d, nullptr, nullptr) == 0) {
+      num_diodes++;
+      diode_tables = diode_tables || d->table;
+    }
+    if (MosfetGetParams(d, nullptr) == 0) {
+      num_mosfets++;
+      mosfet_tables = mosfet_tables || d->table;
+    }
+    if (CapacitorGetParams(d, nullptr) == 0 && d->state) num_capacitors++;
+  }
+  if (num_diodes < kDeviceBatchMinSize) num_diodes = 0;
+  if (num_mosfets < kDeviceBatchMinSize) num_mosfets = 0;
+  if (num_capacitors < kDeviceBatchMinSize) num_capacitors = 0;
+  if (num_diodes == 0 && num_mosfets == 0 && num_capacitors == 0) {
+    return nullptr;
+  }
+
+  DeviceBatches* b = (DeviceBatches*)calloc(1, sizeof(DeviceBatches));
+  if (!b) return nullptr;
+  b->num_devices = c->num_devices;
+  b->batched = (unsigned char*)calloc(c->num_devices, 1);
+  if (!b->batched || DiodeBatchAlloc(&b->diodes, num_diodes) != 0 ||
+      MosfetBatchAlloc(&b->mosfets, num_mosfets) != 0 ||
+      CapacitorBatchAlloc(&b->capacitors, num_capacitors) != 0) {
+    DeviceBatchesFree(b);
+    return nullptr;
+  }
+
+  // Table-model mode (see table_model.h)
+  if (num_diodes > 0 && diode_tables) {
+    b->diodes.table = (const MonotoneCubicTable**)calloc(
+        num_diodes, sizeof(MonotoneCubicTable*));
+  }
+  if (num_mosfets > 0 && mosfet_tables) {
+    b->mosfets.table = (const MonotoneCubicTable**)calloc(
+        num_mosfets, sizeof(MonotoneCubicTable*));
+  }
+  if ((num_diodes > 0 && diode_tables && !b->diodes.table) ||
+      (num_mosfets > 0 && mosfet_tables && !b->mosfets.table)) {
+    DeviceBatchesFree(b);
+    return nullptr;
+  }
+
+  DiodeBatch* db = &b->diodes;
+  MosfetBatch* mb = &b->mosfets;
+  CapacitorBatch* cb = &b->capacitors;
+  int i = 0;
+  int m = 0;
+  int j = 0;
+  int k = 0;
+  for (Device* d = c->devices; d; d = d->next, k++) {
+    double i_s, n, cap;
+    MosfetParams p;
+    if (db->count > 0 && DiodeGetParams(d, &i_s, &n) == 0) {
+      b->batched[k] = kBatchStamp;
+      db->device_index[i] = k;
+      db->devices[i] = d;
+      db->anode[i] = d->nodes[0];
+      db->cathode[i] = d->nodes[1];
+      DiodeBatchSetParams(db, i, d, i_s, n);
+      i++;
+    } else if (mb->count > 0 && MosfetGetParams(d, &p) == 0) {
+      b->batched[k] = kBatchStamp;
+      mb->device_index[m] = k;
+      mb->devices[m] = d;
+      for (int j = 0; j < 4; j++) mb->terminal[j][m] = d->nodes[j];
+      MosfetBatchSetParams(mb, m, d, &p);
+      m++;
+    } else if (cb->count > 0 && CapacitorGetParams(d, &cap) == 0 &&
+               d->state) {
+      b->batched[k] = kBatchStamp | kBatchHistory;
+      cb->device_index[j] = k;
+      cb->state[j] = static_cast<CapacitorState*>(d->state);
+      cb->n1[j] = d->nodes[0];
+      cb->n2[j] = d->nodes[1];
+      cb->c[j] = cap;
+      j++;
+    }
+  }
+  return b;
+}
+
+void DeviceBatchesUpdateParams(DeviceBatches* b, const Circuit* c) {
+  if (!b || !c) return;
+
+  DiodeBatch* db = &b->diodes;
+  MosfetBatch* mb = &b->mosfets;
+  CapacitorBatch* cb = &b->capacitors;
+  int i = 0;
+  int m = 0;
+  int j = 0;
+  int k = 0;
+  for (const Device* d = c->devices; d && k < b->num_devices;
+       d = d->next, k++) {
+    if (!b->batched[k]) continue;
+    double i_s, n, cap;
+    MosfetParams p;
+    if (i < db->count && db->device_index[i] == k &&
+        DiodeGetParams(d, &i_s, &n) == 0) {
+      DiodeBatchSetParams(db, i++, d, i_s, n);
+    } else if (m < mb->count && mb->device_index[m] == k &&
+               MosfetGetParams(d, &p) == 0) {
+      MosfetBatchSetParams(mb, m++, d, &p);
+    } else if (j < cb->count && cb->device_index[j] == k &&
+               CapacitorGetParams(d, &cap) == 0) {
+      cb->c[j++] = cap;
+    }
+  }
+}
+
+void DeviceBatchesFree(DeviceBatches* b) {
+  if (!b) return;
+
+  DiodeBatchRelease(&b->diodes);
+  MosfetBatchRelease(&b->mosfets);
+  CapacitorBatchRelease(&b->capacitors);
+  free(b->batched);
+  free(b);
+}
+
+void DeviceBatchesStamp(DeviceBatches* b, StampContext* ctx,
+                        const IterationState* it, const TimeStepState* ts) {
+  DeviceBatchesStampRange(b, ctx, it, ts, 0, DeviceBatchesCount(b));
+}
+
+int DeviceBatchesCount(const DeviceBatches* b) {
+  if (!b) return 0;
+  return b->diodes.count + b->mosfets.count + b->capacitors.count;
+}
+
+void DeviceBatchesStampRange(DeviceBatches* b, StampContext* ctx,
+                             const IterationState* it,
+                             const TimeStepState* ts, int begin, int end) {
+  if (!b || !ctx || (!it && !ts)) return;
+
+  // Transient stamps linearize at the current Newton iterate of the step
+  const double* x;
+  int iter;
+  const NewtonPolicy* policy;
+  DeviceEvalCounts* counts;
+  if (ts) {
+    x = ts->x_current ? ts->x_current : ts->x_prev;
+    iter = ts->iter;
+    policy = &ts->policy;
+    counts = ts->counts;
+  } else {
+    x = it->x_current;
+    iter = it->iter;
+    policy = &it->policy;
+    counts = it->counts;
+  }
+  if (!x) return;
+
+  // Split the range over the diodes, MOSFETs and capacitors
+  int lo = begin;
+  int hi = end < b->diodes.count ? end : b->diodes.count;
+  if (lo < hi) {
+    DiodeBatchStamp(&b->diodes, ctx, x, iter, policy, counts, lo, hi);
+  }
+  int base = b->diodes.count;
+  lo = (begin > base ? begin : base) - base;
+  hi = (end < base + b->mosfets.count ? end : base + b->mosfets.count) - base;
+  if (lo < hi) {
+    MosfetBatchStamp(&b->mosfets, ctx, x, iter, policy, counts, ts, lo, hi);
+  }
+  base += b->mosfets.count;
+  lo = (begin > base ? begin : base) - base;
+  hi = (end < base + b->capacitors.count ? end : base + b->capacitors.count) -
+       base;
+
+  // One dispatch on the method for all capacitors of the range
+  if (ts && ts->im && lo < hi) {
+    switch (ts->im->kind) {
+      case kIntegrationTrapezoidal:
+        CapacitorBatchStamp<kIntegrationTrapezoidal>(&b->capacitors, ctx, ts,
+                                                     lo, hi);
+        break;
+      case kIntegrationGear2:
+        CapacitorBatchStamp<kIntegrationGear2>(&b->capacitors, ctx, ts, lo,
+                                               hi);
+        break;
+      default:
+        CapacitorBatchStamp<kIntegrationBackwardEuler>(&b->capacitors, ctx,
+                                                       ts, lo, hi);
+        break;
+    }
+  }
+}
+
+void DeviceBatchesUpdateState(DeviceBatches* b, const double* x,
+                              const TimeStepState* ts) {
+  if (!b || !x || !ts || b->capacitors.count == 0) return;
+
+  IntegrationKind kind = ts->im ? ts->im->kind : kIntegrationBackwardEuler;
+  switch (kind) {
+    case kIntegrationTrapezoidal:
+      CapacitorBatchAdvance<kIntegrationTrapezoidal>(&b->capacitors, x, ts);
+      break;
+    case kIntegrationGear2:
+      CapacitorBatchAdvance<kIntegrationGear2>(&b->capacitors, x, ts);
+      break;
+    default:
+      CapacitorBatchAdvance<kIntegrationBackwardEuler>(&b->capacitors, x, ts);
+      break;
+  }
+}
+
+}  // namespace minispice
@@ -0,0 +1,174 @@
+// device_batch.h
+// Struct-of-arrays device batches
+//
+// Evaluating devices one at a time through the vtable chases the device
+// list and the heap-allocated params of every device and runs one scalar
+// exp() per junction. A DeviceBatches object groups the diodes and the
+// MOSFETs of a finalized circuit into contiguous arrays (terminal indices,
+// model parameters, last evaluation) and evaluates each group together: the
+// terminal voltages are gathered from the solution, the model is evaluated
+// by unit-stride loops (for diodes, the exponentials by a vectorized kernel:
+// AVX2 on x86-64 CPUs that have it, chosen at run time, the C library exp
+// otherwise) and the stamps are scattered through the stamp context.
+//
+// The batched stamps match the scalar vtable stamps call for call (same
+// positions, same order per device), so compiled stamping and the scalar
+// path can be mixed freely. The MOSFET charge stamps of transient
+// iterations are not batched; they follow each device's conduction stamps
+// through MosfetStampCharges, as in the scalar stamp.
+// In table-model mode (see table_model.h) the batches look up the device
+// tables in place of the exp and sqrt evaluations. Devices whose cached
+// linearization is bypassed (NewtonPolicy::bypass) are dropped from the
+// evaluation loops, which run over the remaining devices only.
+//
+// Capacitors only stamp in transient iterations. Their batch stamps the
+// companion models and advances the capacitor histories of accepted steps
+// with loops compiled once per integration method family (IntegrationKind),
+// picked once per call rather than per device.
+
+#ifndef MINI_SPICE_DEVICE_BATCH_H_
+#define MINI_SPICE_DEVICE_BATCH_H_
+
+#include "stamp.h"
+
+namespace minispice {
+
+struct CapacitorState;
+struct Circuit;
+struct MonotoneCubicTable;
+
+// Circuits with fewer diodes than this are stamped through the vtable
+constexpr int kDeviceBatchMinSize = 16;
+
+// Flags of DeviceBatches::batched
+constexpr unsigned char kBatchStamp = 1;    // Stamped by DeviceBatchesStamp
+constexpr unsigned char kBatchHistory = 2;  // State advanced by
+                                            // DeviceBatchesUpdateState
+
+// SoA arrays of the diodes of a circuit (length count)
+struct DiodeBatch {
+  int count;
+  int* device_index;  // Position in the circuit's device list
+  Device** devices;   // The devices (state for junction limiting)
+  int* anode;         // MNA variable of the anode (-1 for ground)
+  int* cathode;       // MNA variable of the cathode (-1 for ground)
+  double* i_s;        // Saturation current
+  double* n_vt;       // Emission coefficient times the thermal voltage
+  const MonotoneCubicTable** table;  // Current tables of table-model mode
+                                     // (nullptr if no diode has one)
+
+  // Scratch of the last evaluation. Bypassed diodes keep their cached
+  // linearization; the others are compacted into the active list, and the
+  // arrays marked (active) are indexed by position in that list.
+  int* active;             // Evaluated diodes (indices into the batch)
+  double* vd;              // Junction voltage of the iterate
+  double* v_lin;           // Limited, clamped junction voltage (active)
+  unsigned char* limited;  // 1 if limiting moved the voltage (active)
+  double* e;     // exp(v_lin / n_vt) (holds the argument until the exp
+                 // kernel) (active)
+  double* g;     // Linearized conductance
+  double* i_eq;  // Equivalent current source
+};
+
+// SoA arrays of the MOSFETs of a circuit (length count)
+struct MosfetBatch {
+  int count;
+  int* device_index;       // Position in the circuit's device list
+  Device** devices;        // The devices (state for the charge stamps and
+                           // voltage limiting)
+  int* terminal[4];        // MNA variable of each terminal (MosfetTerminal)
+  double* k;               // mu * Cox * W / L
+  double* vth0;            // Threshold voltage at Vbs = 0
+  double* gamma;           // Body effect coefficient
+  double* phi2;            // 2 * phi_f
+  double* sqrt_phi2;       // sqrt(2 * phi_f)
+  const MonotoneCubicTable** table;  // Threshold tables of table-model mode
+                                     // (nullptr if no MOSFET has one)
+
+  // Scratch of the last evaluation, compacted as in DiodeBatch
+  int* active;             // Evaluated MOSFETs (indices into the batch)
+  unsigned char* limited;  // 1 if limiting moved the voltages (active)
+  double* u[4];  // Limited terminal voltages (active)
+  double* v[4];  // Terminal voltages the stamp is linearized at
+  double* vth;   // Threshold voltage and its derivative in vbs (active)
+  double* dvth;
+  double* id;    // Drain current
+  double* g[4];  // Derivatives of the drain current per terminal voltage
+};
+
+// SoA arrays of the capacitors of a circuit (length count)
+struct CapacitorBatch {
+  int count;
+  int* device_index;       // Position in the circuit's device list
+  CapacitorState** state;  // History of each capacitor (its device state)
+  int* n1;                 // MNA variable of the positive terminal (-1 for
+  int* n2;                 // ground) and of the negative terminal
+  double* c;               // Capacitance
+};
+
+// All batched devices of a circuit
+struct DeviceBatches {
+  int num_devices;         // Length of batched
+  unsigned char* batched;  // batched[k]: kBatch flags of device k (0 if the
+                           // device is not in a batch)
+  DiodeBatch diodes;       // count = 0 if the diodes are not batched
+  MosfetBatch mosfets;     // count = 0 if the MOSFETs are not batched
+  CapacitorBatch capacitors;  // count = 0 if the capacitors are not batched
+};
+
+// Group the diodes, the MOSFETs and the capacitors of a finalized circuit
+// into batches. A device type is batched if the circuit has at least
+// kDeviceBatchMinSize devices of that type.
+// Returns nullptr if no type is batched, the circuit is not finalized, or on
+// allocation failure (the caller then stamps every device through its
+// vtable).
+DeviceBatches* DeviceBatchesCreate(const Circuit* c);
+
+// Re-read the model params (and tables) of the batched devices of c, the
+// circuit the batches were created for, after changes in place (see
+// DeviceSetParam). The stamp pattern is unaffected.
+void DeviceBatchesUpdateParams(DeviceBatches* b, const Circuit* c);
+
+// Free the batches and all their arrays
+void DeviceBatchesFree(DeviceBatches* b);
+
+// Stamp every batched device for a DC iteration (it, ts == nullptr) or a
+// transient Newton iteration (ts), linearized at the iterate of it or ts
+// and with junction limiting and device bypass as its policy asks (counted
+// into its counts, if set). The batched conduction stamps are the same for
+// both; transient iterations add the MOSFET charge stamps and the
+// capacitor companion models.
+void DeviceBatchesStamp(DeviceBatches* b, StampContext* ctx,
+                        const IterationState* it, const TimeStepState* ts);
+
+// Number of batched devices DeviceBatchesStampRange indexes: the diodes,
+// then the MOSFETs, then the capacitors (stamped by transient iterations
+// only)
+int DeviceBatchesCount(const DeviceBatches* b);
+
+// DeviceBatchesStamp restricted to the batched devices [begin, end) of the
+// order of DeviceBatchesCount. Disjoint ranges use disjoint scratch and
+// device state and may be stamped concurrently, each into its own context
+// (see CtxCreateWorker) and with its own counts.
+void DeviceBatchesStampRange(DeviceBatches* b, StampContext* ctx,
+                             const IterationState* it,
+                             const TimeStepState* ts, int begin, int end);
+
+// Advance the state of the devices flagged kBatchHistory (the capacitors)
+// to the accepted solution x of the step of ts, as their UpdateState would.
+// The analysis skips their UpdateState.
+void DeviceBatchesUpdateState(DeviceBatches* b, const double* x,
+                              const TimeStepState* ts);
+
+// y[i] = exp(x[i]) for i < count. Accurate to a few ulp; arguments are
+// clamped to the range where the result is a finite normal number. x and y
+// may alias.
+void ExpBatch(const double* x, double* y, int count);
+
+// 1 if ExpBatch runs the AVX2 kernel on this CPU, 0 if it calls the C
+// library exp
+int ExpBatchIsVectorized();
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_DEVICE_BATCH_H_
@@ -0,0 +1,448 @@
+// device_batch_test.cc
+// Unit tests for the SoA device batches and the vectorized exponential
+
+#include "device_batch.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "circuit.h"
+#include "device.h"
+#include "parser.h"
+#include "workspace.h"
+
+using namespace minispice;
+
+// n parallel branches in -> R -> D -> ground, driven by a 5V source
+static std::string DiodeBranches(int n) {
+  std::string netlist = "V1 in 0 5\n";
+  for (int k = 0; k < n; k++) {
+    std::string a = "a" + std::to_string(k);
+    netlist += "R" + std::to_string(k) + " in " + a + " 1k\n";
+    netlist += "D" + std::to_string(k) + " " + a + " 0 Is=1e-14 n=" +
+               std::to_string(1.0 + 0.01 * k) + "\n";
+  }
+  return netlist;
+}
+
+// n MOSFETs between shared nodes, with grounded and floating sources and
+// bulks and a body effect on every other device
+static std::string MosfetArray(int n) {
+  std::string netlist = "V1 vdd 0 3\n";
+  for (int k = 0; k < n; k++) {
+    std::string d = "d" + std::to_string(k % 5);
+    std::string g = "g" + std::to_string(k % 3);
+    std::string s = k % 4 == 0 ? "0" : "s" + std::to_string(k % 2);
+    std::string b = k % 3 == 0 ? "0" : "b";
+    netlist += "M" + std::to_string(k) + " " + d + " " + g + " " + s + " " +
+               b + " W=" + std::to_string(1e-5 * (1 + k % 7)) +
+               (k % 2 ? " GAMMA=0.4" : "") + "\n";
+    netlist += "RM" + std::to_string(k) + " vdd " + d + " 10k\n";
+  }
+  return netlist;
+}
+
+// Assemble two contexts and expect the same matrix and right-hand side
+static void ExpectSameStamps(StampContext* ref, StampContext* bat, int n) {
+  std::vector<double> A_ref((size_t)n * n), A_bat((size_t)n * n);
+  CtxAssembleDense(ref, A_ref.data());
+  CtxAssembleDense(bat, A_bat.data());
+  for (size_t i = 0; i < A_ref.size(); i++) {
+    EXPECT_NEAR(A_bat[i], A_ref[i], 1e-13 * std::fabs(A_ref[i]));
+  }
+  const double* z_ref = CtxGetZ(ref);
+  const double* z_bat = CtxGetZ(bat);
+  for (int i = 0; i < n; i++) {
+    EXPECT_NEAR(z_bat[i], z_ref[i], 1e-13 * std::fabs(z_ref[i]) + 1e-300);
+  }
+}
+
+TEST(ExpBatchTest, MatchesStdExp) {
+  std::vector<double> x;
+  for (double v = -700.0; v <= 700.0; v += 0.37) x.push_back(v);
+  for (double v = -1.0; v <= 1.0; v += 1e-3) x.push_back(v);
+  x.push_back(0.0);
+  x.push_back(1e-300);
+  x.push_back(-1e-300);
+  x.push_back(27.07);  // Diode at the upper clamp (0.7V / Vt)
+
+  std::vector<double> y(x.size());
+  ExpBatch(x.data(), y.data(), (int)x.size());
+  for (size_t i = 0; i < x.size(); i++) {
+    double expected = std::exp(x[i]);
+    EXPECT_NEAR(y[i] / expected, 1.0, 4e-16) << "x = " << x[i];
+  }
+}
+
+TEST(ExpBatchTest, PicksAvx2KernelAtRunTime) {
+#if defined(__x86_64__)
+  EXPECT_EQ(ExpBatchIsVectorized(), __builtin_cpu_supports("avx2") ? 1 : 0);
+#else
+  EXPECT_EQ(ExpBatchIsVectorized(), 0);
+#endif
+}
+
+TEST(ExpBatchTest, TailAndInPlace) {
+  // Lengths that are not a multiple of the vector width, computed in place
+  for (int count = 1; count <= 9; count++) {
+    std::vector<double> x(count);
+    for (int i = 0; i < count; i++) x[i] = 0.5 * i - 2.0;
+    ExpBatch(x.data(), x.data(), count);
+    for (int i = 0; i < count; i++) {
+      EXPECT_NEAR(x[i] / std::exp(0.5 * i - 2.0), 1.0, 4e-16);
+    }
+  }
+}
+
+TEST(ExpBatchTest, ClampsToFiniteRange) {
+  double x[4] = {-1e4, 1e4, -745.0, 710.0};
+  double y[4];
+  ExpBatch(x, y, 4);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(std::isfinite(y[i]));
+    EXPECT_GT(y[i], 0.0);
+  }
+}
+
+TEST(DeviceBatchTest, GroupsDiodes) {
+  Circuit* small = parse_netlist_string(DiodeBranches(2).c_str());
+  ASSERT_NE(small, nullptr);
+  EXPECT_EQ(DeviceBatchesCreate(small), nullptr);
+
+  const int kBranches = 2 * kDeviceBatchMinSize;
+  Circuit* c = parse_netlist_string(DiodeBranches(kBranches).c_str());
+  ASSERT_NE(c, nullptr);
+  DeviceBatches* b = DeviceBatchesCreate(c);
+  ASSERT_NE(b, nullptr);
+  EXPECT_EQ(b->num_devices, c->num_devices);
+  EXPECT_EQ(b->diodes.count, kBranches);
+
+  int k = 0;
+  for (Device* d = c->devices; d; d = d->next, k++) {
+    EXPECT_EQ(b->batched[k], d->name[0] == 'D' ? 1 : 0) << d->name;
+  }
+  for (int i = 0; i < b->diodes.count; i++) {
+    EXPECT_GE(b->diodes.anode[i], 0);
+    EXPECT_EQ(b->diodes.cathode[i], -1);
+    EXPECT_DOUBLE_EQ(b->diodes.i_s[i], 1e-14);
+  }
+
+  DeviceBatchesFree(b);
+  circuit_free(c);
+  circuit_free(small);
+}
+
+TEST(DeviceBatchTest, StampsMatchScalarPath) {
+  // Diodes between two nodes as well as to ground, at voltages covering
+  // both clamps
+  std::string netlist = DiodeBranches(kDeviceBatchMinSize);
+  for (int k = 0; k < kDeviceBatchMinSize; k++) {
+    netlist += "DX" + std::to_string(k) + " a" + std::to_string(k) + " in\n";
+  }
+  Circuit* c = parse_netlist_string(netlist.c_str());
+  ASSERT_NE(c, nullptr);
+  int n = c->num_vars;
+
+  std::vector<double> x(n);
+  srand(7);
+  for (int i = 0; i < n; i++) x[i] = 2.0 * rand() / RAND_MAX - 1.0;
+
+  // Reference: every diode through its vtable
+  StampContext* ref = CtxCreate(n);
+  StampContext* bat = CtxCreate(n);
+  ASSERT_NE(ref, nullptr);
+  ASSERT_NE(bat, nullptr);
+  IterationState it = {0, x.data(), 1e-9, 1e-6, NewtonPolicy{}, nullptr, 0.0};
+  for (Device* d = c->devices; d; d = d->next) {
+    if (DiodeGetParams(d, nullptr, nullptr) == 0) {
+      d->vt->StampNonlinear(d, ref, &it);
+    }
+  }
+
+  DeviceBatches* b = DeviceBatchesCreate(c);
+  ASSERT_NE(b, nullptr);
+  EXPECT_EQ(b->diodes.count, 2 * kDeviceBatchMinSize);
+  DeviceBatchesStamp(b, bat, &it, nullptr);
+  ExpectSameStamps(ref, bat, n);
+
+  // Junction limiting against the previous iteration (kept in the device
+  // states, which the batch shares with the scalar path)
+  std::vector<double> x_prev(n);
+  for (int i = 0; i < n; i++) x_prev[i] = 0.5 * x[i];
+  for (int i = 0; i < n; i++) x[i] *= 4.0;
+  IterationState it0 = {0, x_prev.data(), 1e-9, 1e-6, kDefaultNewtonPolicy,
+                        nullptr, 0.0};
+  IterationState it1 = {1, x.data(), 1e-9, 1e-6, kDefaultNewtonPolicy,
+                        nullptr, 0.0};
+  CtxReset(ref);
+  CtxReset(bat);
+  DeviceBatchesStamp(b, ref, &it0, nullptr);
+  CtxReset(ref);
+  for (Device* d = c->devices; d; d = d->next) {
+    if (DiodeGetParams(d, nullptr, nullptr) == 0) {
+      d->vt->StampNonlinear(d, ref, &it1);
+    }
+  }
+  DeviceBatchesStamp(b, bat, &it1, nullptr);
+  ExpectSameStamps(ref, bat, n);
+
+  DeviceBatchesFree(b);
+  CtxFree(ref);
+  CtxFree(bat);
+  circuit_free(c);
+}
+
+TEST(DeviceBatchTest, DcAnalysisMatchesSingleBranch) {
+  // Every branch of the batched circuit must match the same branch solved
+  // alone (below the batch threshold, through the vtable)
+  const int kBranches = 4 * kDeviceBatchMinSize;
+  Circuit* c = parse_netlist_string(DiodeBranches(kBranches).c_str());
+  ASSERT_NE(c, nullptr);
+  SimWorkspace* ws = SimWorkspaceCreate(c);
+  ASSERT_NE(ws, nullptr);
+  ASSERT_NE(ws->batches, nullptr);
+
+  std::vector<double> x(c->num_vars);
+  ASSERT_GT(CircuitDcAnalysisWithWorkspace(c, ws, x.data(), 100, 1e-12, 1e-9),
+            2);
+
+  for (int k = 0; k < kBranches; k += 7) {
+    std::string single = "V1 in 0 5\nR1 in a 1k\nD1 a 0 Is=1e-14 n=" +
+                         std::to_string(1.0 + 0.01 * k) + "\n";
+    Circuit* s = parse_netlist_string(single.c_str());
+    ASSERT_NE(s, nullptr);
+    std::vector<double> xs(s->num_vars);
+    ASSERT_GT(CircuitDcAnalysis(s, xs.data(), 100, 1e-12, 1e-9), 2);
+    EXPECT_EQ(s->workspace->batches, nullptr);
+
+    std::string a = "a" + std::to_string(k);
+    double va = x[c->nodes[CircuitGetNode(c, a.c_str())].var_index];
+    double va_single = xs[s->nodes[CircuitGetNode(s, "a")].var_index];
+    EXPECT_NEAR(va, va_single, 1e-9) << a;
+    circuit_free(s);
+  }
+
+  SimWorkspaceFree(ws);
+  circuit_free(c);
+}
+
+TEST(DeviceBatchTest, GroupsMosfets) {
+  const int kMosfets = 2 * kDeviceBatchMinSize;
+  Circuit* c = parse_netlist_string(MosfetArray(kMosfets).c_str());
+  ASSERT_NE(c, nullptr);
+  DeviceBatches* b = DeviceBatchesCreate(c);
+  ASSERT_NE(b, nullptr);
+  EXPECT_EQ(b->diodes.count, 0);
+  EXPECT_EQ(b->mosfets.count, kMosfets);
+
+  int k = 0;
+  for (Device* d = c->devices; d; d = d->next, k++) {
+    EXPECT_EQ(b->batched[k], d->name[0] == 'M' ? 1 : 0) << d->name;
+  }
+  for (int i = 0; i < b->mosfets.count; i++) {
+    const Device* d = b->mosfets.devices[i];
+    for (int j = 0; j < 4; j++) {
+      EXPECT_EQ(b->mosfets.terminal[j][i], d->nodes[j]);
+    }
+  }
+
+  DeviceBatchesFree(b);
+  circuit_free(c);
+}
+
+TEST(DeviceBatchTest, MosfetStampsMatchScalarPath) {
+  Circuit* c =
+      parse_netlist_string(MosfetArray(2 * kDeviceBatchMinSize).c_str());
+  ASSERT_NE(c, nullptr);
+  int n = c->num_vars;
+
+  // Random voltages cover cutoff, both regions and reversed devices
+  std::vector<double> x(n), x_prev(n);
+  srand(11);
+  for (int i = 0; i < n; i++) {
+    x[i] = 3.0 * rand() / RAND_MAX - 0.5;
+    x_prev[i] = 3.0 * rand() / RAND_MAX - 0.5;
+  }
+  for (Device* d = c->devices; d; d = d->next) {
+    if (d->vt->InitState) d->vt->InitState(d, x_prev.data());
+  }
+  DeviceBatches* b = DeviceBatchesCreate(c);
+  ASSERT_NE(b, nullptr);
+
+  // DC iteration
+  StampContext* ref = CtxCreate(n);
+  StampContext* bat = CtxCreate(n);
+  ASSERT_NE(ref, nullptr);
+  ASSERT_NE(bat, nullptr);
+  IterationState it = {0, x.data(), 1e-9, 1e-6, NewtonPolicy{}, nullptr, 0.0};
+  for (Device* d = c->devices; d; d = d->next) {
+    if (MosfetGetParams(d, nullptr) == 0) d->vt->StampNonlinear(d, ref, &it);
+  }
+  DeviceBatchesStamp(b, bat, &it, nullptr);
+  ExpectSameStamps(ref, bat, n);
+
+  // Transient iteration, conduction plus charge stamps
+  for (const IntegrationMethod* im : {&kTrapezoidal, &kGear2}) {
+    CtxReset(ref);
+    CtxReset(bat);
+    TimeStepState ts = {1e-9, 1e-10, x_prev.data(), x_prev.data(), im,
+                        x.data(), 0, NewtonPolicy{}, nullptr};
+    for (Device* d = c->devices; d; d = d->next) {
+      if (MosfetGetParams(d, nullptr) == 0) d->vt->StampTransient(d, ref, &ts);
+    }
+    DeviceBatchesStamp(b, bat, nullptr, &ts);
+    ExpectSameStamps(ref, bat, n);
+  }
+
+  // Limited transient iteration following one at x_prev
+  for (int iter = 0; iter < 2; iter++) {
+    CtxReset(ref);
+    CtxReset(bat);
+    TimeStepState ts = {1e-9, 1e-10, x_prev.data(), x_prev.data(), &kGear2,
+                        iter == 0 ? x_prev.data() : x.data(), iter,
+                        kDefaultNewtonPolicy, nullptr};
+    for (Device* d = c->devices; d; d = d->next) {
+      if (MosfetGetParams(d, nullptr) == 0) d->vt->StampTransient(d, ref, &ts);
+    }
+    DeviceBatchesStamp(b, bat, nullptr, &ts);
+    ExpectSameStamps(ref, bat, n);
+  }
+
+  DeviceBatchesFree(b);
+  CtxFree(ref);
+  CtxFree(bat);
+  circuit_free(c);
+}
+
+TEST(DeviceBatchTest, CapacitorsMatchScalarPath) {
+  // RC ladder: grounded and floating capacitors
+  const int kStages = 2 * kDeviceBatchMinSize;
+  std::string netlist = "V1 n0 0 1\n";
+  for (int k = 0; k < kStages; k++) {
+    std::string a = "n" + std::to_string(k), b = "n" + std::to_string(k + 1);
+    netlist += "R" + std::to_string(k) + " " + a + " " + b + " 1k\n";
+    netlist += "C" + std::to_string(k) + " " + b + " " +
+               (k % 2 ? "0" : a) + " " + std::to_string(1e-12 * (1 + k)) +
+               "\n";
+  }
+  Circuit* c = parse_netlist_string(netlist.c_str());
+  ASSERT_NE(c, nullptr);
+  Circuit* clone = CircuitClone(c);
+  ASSERT_NE(clone, nullptr);
+  int n = c->num_vars;
+
+  DeviceBatches* b = DeviceBatchesCreate(clone);
+  ASSERT_NE(b, nullptr);
+  EXPECT_EQ(b->capacitors.count, kStages);
+  EXPECT_EQ(b->diodes.count, 0);
+  int k = 0;
+  for (Device* d = clone->devices; d; d = d->next, k++) {
+    EXPECT_EQ(b->batched[k],
+              d->name[0] == 'C' ? (kBatchStamp | kBatchHistory) : 0)
+        << d->name;
+  }
+
+  std::vector<double> x(n), x_prev(n);
+  srand(3);
+  for (int i = 0; i < n; i++) x_prev[i] = 2.0 * rand() / RAND_MAX - 1.0;
+  for (Circuit* ci : {c, clone}) {
+    for (Device* d = ci->devices; d; d = d->next) {
+      if (d->vt->InitState) d->vt->InitState(d, x_prev.data());
+    }
+  }
+
+  StampContext* ref = CtxCreate(n);
+  StampContext* bat = CtxCreate(n);
+  ASSERT_NE(ref, nullptr);
+  ASSERT_NE(bat, nullptr);
+
+  // Steps of every method family, each from the history of the last one
+  for (const IntegrationMethod* im :
+       {&kBackwardEuler, &kTrapezoidal, &kGear2, &kTrapezoidal}) {
+    for (int i = 0; i < n; i++) x[i] = 2.0 * rand() / RAND_MAX - 1.0;
+    TimeStepState ts = {1e-9, 1e-10, x_prev.data(), x_prev.data(), im,
+                        x.data(), 0, NewtonPolicy{}, nullptr};
+    CtxReset(ref);
+    CtxReset(bat);
+    for (Device* d = c->devices; d; d = d->next) {
+      if (d->name[0] == 'C') d->vt->StampTransient(d, ref, &ts);
+    }
+    DeviceBatchesStamp(b, bat, nullptr, &ts);
+    ExpectSameStamps(ref, bat, n);
+
+    for (Device* d = c->devices; d; d = d->next) {
+      if (d->name[0] == 'C') d->vt->UpdateState(d, x.data(), &ts);
+    }
+    DeviceBatchesUpdateState(b, x.data(), &ts);
+    for (Device *d = c->devices, *e = clone->devices; d;
+         d = d->next, e = e->next) {
+      if (d->name[0] != 'C') continue;
+      const CapacitorState* s = static_cast<const CapacitorState*>(d->state);
+      const CapacitorState* t = static_cast<const CapacitorState*>(e->state);
+      EXPECT_EQ(t->v_prev, s->v_prev) << d->name << " " << im->name;
+      EXPECT_EQ(t->v_prev2, s->v_prev2) << d->name << " " << im->name;
+      EXPECT_EQ(t->i_prev, s->i_prev) << d->name << " " << im->name;
+    }
+    x_prev = x;
+  }
+
+  DeviceBatchesFree(b);
+  CtxFree(ref);
+  CtxFree(bat);
+  circuit_free(clone);
+  circuit_free(c);
+}
+
+TEST(DeviceBatchTest, BypassMatchesScalarPath) {
+  // Clones keep separate caches: the scalar path stamps one, the batches
+  // the other, through iterates that move some devices and not others
+  for (const std::string& netlist :
+       {DiodeBranches(2 * kDeviceBatchMinSize),
+        MosfetArray(2 * kDeviceBatchMinSize)}) {
+    Circuit* c = parse_netlist_string(netlist.c_str());
+    ASSERT_NE(c, nullptr);
+    Circuit* clone = CircuitClone(c);
+    ASSERT_NE(clone, nullptr);
+    int n = c->num_vars;
+    DeviceBatches* b = DeviceBatchesCreate(clone);
+    ASSERT_NE(b, nullptr);
+    StampContext* ref = CtxCreate(n);
+    StampContext* bat = CtxCreate(n);
+
+    std::vector<double> x(n);
+    srand(5);
+    for (int i = 0; i < n; i++) x[i] = 2.0 * rand() / RAND_MAX;
+    DeviceEvalCounts counts_ref = {0, 0};
+    DeviceEvalCounts counts_bat = {0, 0};
+    for (int iter = 0; iter < 4; iter++) {
+      if (iter > 0) {
+        for (int i = 0; i < n; i += 3) x[i] += iter == 2 ? 1e-9 : 1e-2;
+      }
+      IterationState it = {iter, x.data(), 1e-9, 1e-6, kDefaultNewtonPolicy,
+                           &counts_ref, 0.0};
+      CtxReset(ref);
+      CtxReset(bat);
+      for (Device* d = c->devices; d; d = d->next) {
+        if (d->vt->StampNonlinear && d->name[0] != 'R' && d->name[0] != 'V') {
+          d->vt->StampNonlinear(d, ref, &it);
+        }
+      }
+      it.counts = &counts_bat;
+      DeviceBatchesStamp(b, bat, &it, nullptr);
+      ExpectSameStamps(ref, bat, n);
+      EXPECT_EQ(counts_bat.evaluations, counts_ref.evaluations) << iter;
+      EXPECT_EQ(counts_bat.bypassed, counts_ref.bypassed) << iter;
+    }
+    EXPECT_GT(counts_ref.bypassed, 0);
+
+    DeviceBatchesFree(b);
+    CtxFree(ref);
+    CtxFree(bat);
+    circuit_free(clone);
+    circuit_free(c);
+  }
+}
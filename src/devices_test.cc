@@ -8,6 +8,7 @@
 
 #include "device.h"
 #include "stamp.h"
+#include "table_model.h"
 
 using namespace minispice;
 
@@ -46,7 +47,7 @@ TEST_F(DeviceTest, ResistorStamp) {
   Device* r = CreateResistor("R1", 0, 1, 1000.0);
   ASSERT_NE(r, nullptr);
 
-  IterationState it = {0, nullptr, 1e-9, 1e-6};
+  IterationState it = {0, nullptr, 1e-9, 1e-6, NewtonPolicy{}, nullptr, 0.0};
   r->vt->StampNonlinear(r, ctx, &it);
 
   double matrix[16] = {0};
@@ -67,7 +68,7 @@ TEST_F(DeviceTest, ResistorWithGroundNode) {
   Device* r = CreateResistor("R1", 0, -1, 1000.0);
   ASSERT_NE(r, nullptr);
 
-  IterationState it = {0, nullptr, 1e-9, 1e-6};
+  IterationState it = {0, nullptr, 1e-9, 1e-6, NewtonPolicy{}, nullptr, 0.0};
   r->vt->StampNonlinear(r, ctx, &it);
 
   double matrix[16] = {0};
@@ -97,7 +98,7 @@ TEST_F(DeviceTest, CurrentSourceStamp) {
   Device* i = CreateCurrentSource("I1", 0, 1, 0.001);
   ASSERT_NE(i, nullptr);
 
-  IterationState it = {0, nullptr, 1e-9, 1e-6};
+  IterationState it = {0, nullptr, 1e-9, 1e-6, NewtonPolicy{}, nullptr, 0.0};
   i->vt->StampNonlinear(i, ctx, &it);
 
   // Current source only affects RHS
@@ -147,7 +148,7 @@ TEST_F(DeviceTest, VoltageSourceStamp) {
   // Simulate finalization: allocate extra var
   v->extra_var = 2;  // k = 2
 
-  IterationState it = {0, nullptr, 1e-9, 1e-6};
+  IterationState it = {0, nullptr, 1e-9, 1e-6, NewtonPolicy{}, nullptr, 0.0};
   v->vt->StampNonlinear(v, ctx, &it);
 
   double matrix[9] = {0};
@@ -167,6 +168,34 @@ TEST_F(DeviceTest, VoltageSourceStamp) {
   DeviceFree(v);
 }
 
+TEST_F(DeviceTest, SourceValueInPlace) {
+  Device* v = CreateVoltageSource("V1", 0, -1, 5.0);
+  Device* i = CreateCurrentSource("I1", 0, -1, 1e-3);
+  Device* r = CreateResistor("R1", 0, -1, 1000.0);
+  ASSERT_NE(v, nullptr);
+  ASSERT_NE(i, nullptr);
+  ASSERT_NE(r, nullptr);
+
+  double value = 0.0;
+  ASSERT_EQ(DeviceGetValue(v, &value), 0);
+  EXPECT_DOUBLE_EQ(value, 5.0);
+  ASSERT_EQ(DeviceSetValue(v, 2.5), 0);
+  ASSERT_EQ(DeviceGetValue(v, &value), 0);
+  EXPECT_DOUBLE_EQ(value, 2.5);
+
+  ASSERT_EQ(DeviceSetValue(i, -2e-3), 0);
+  ASSERT_EQ(DeviceGetValue(i, &value), 0);
+  EXPECT_DOUBLE_EQ(value, -2e-3);
+
+  // Only independent sources have a sweepable value
+  EXPECT_EQ(DeviceSetValue(r, 1.0), -1);
+  EXPECT_EQ(DeviceGetValue(r, &value), -1);
+
+  DeviceFree(v);
+  DeviceFree(i);
+  DeviceFree(r);
+}
+
 // ============================================================================
 // Capacitor Tests
 // ============================================================================
@@ -178,7 +207,7 @@ TEST_F(DeviceTest, CapacitorDCStamp) {
   // Init to allocate state
   c->vt->Init(c, nullptr);
 
-  IterationState it = {0, nullptr, 1e-9, 1e-6};
+  IterationState it = {0, nullptr, 1e-9, 1e-6, NewtonPolicy{}, nullptr, 0.0};
   c->vt->StampNonlinear(c, ctx, &it);
 
   // In DC, capacitor is open circuit - no stamp
@@ -205,7 +234,7 @@ TEST_F(DeviceTest, InductorDCStamp) {
   l->vt->Init(l, nullptr);
   l->extra_var = 2;
 
-  IterationState it = {0, nullptr, 1e-9, 1e-6};
+  IterationState it = {0, nullptr, 1e-9, 1e-6, NewtonPolicy{}, nullptr, 0.0};
   l->vt->StampNonlinear(l, ctx, &it);
 
   double matrix[9] = {0};
@@ -236,7 +265,7 @@ TEST_F(DeviceTest, DiodeStampAtZeroBias) {
   ASSERT_NE(d, nullptr);
 
   double x[4] = {0.0, 0.0, 0.0, 0.0};  // Zero bias
-  IterationState it = {0, x, 1e-9, 1e-6};
+  IterationState it = {0, x, 1e-9, 1e-6, NewtonPolicy{}, nullptr, 0.0};
   d->vt->StampNonlinear(d, ctx, &it);
 
   // At Vd=0: g_eq = Is/(nVt) * exp(0) = Is/Vt, I_eq = 0 - g_eq * 0 = 0
@@ -255,7 +284,7 @@ TEST_F(DeviceTest, DiodeStampForwardBias) {
   ASSERT_NE(d, nullptr);
 
   double x[4] = {0.6, 0.0, 0.0, 0.0};  // Forward bias ~0.6V
-  IterationState it = {0, x, 1e-9, 1e-6};
+  IterationState it = {0, x, 1e-9, 1e-6, NewtonPolicy{}, nullptr, 0.0};
   d->vt->StampNonlinear(d, ctx, &it);
 
   double matrix[16] = {0};
@@ -272,3 +301,317 @@ TEST_F(DeviceTest, DiodeStampForwardBias) {
 
   DeviceFree(d);
 }
+
+TEST_F(DeviceTest, JunctionStepLimits) {
+  const double n_vt = kThermalVoltage;
+
+  // pnjlim: large forward steps above vcrit grow logarithmically
+  double v = PnjLimit(5.0, 0.6, n_vt, 0.7);
+  EXPECT_NEAR(v, 0.6 + n_vt * log(1.0 + 4.4 / n_vt), 1e-12);
+  EXPECT_LT(v, 0.8);
+  EXPECT_DOUBLE_EQ(PnjLimit(0.62, 0.6, n_vt, 0.5), 0.62);  // Small step
+  EXPECT_DOUBLE_EQ(PnjLimit(-5.0, 0.6, n_vt, 0.7), -5.0);  // Below vcrit
+
+  // fetlim: a device turning on stops just above threshold
+  EXPECT_DOUBLE_EQ(FetLimit(5.0, 0.0, 0.5), 1.0);
+  EXPECT_DOUBLE_EQ(FetLimit(30.0, 4.5, 0.5), 14.5);    // Strongly on
+  EXPECT_DOUBLE_EQ(FetLimit(-30.0, 0.0, 0.5), -3.0);   // Further off
+  EXPECT_DOUBLE_EQ(FetLimit(0.7, 0.6, 0.5), 0.7);      // Small step
+
+  // limvds
+  EXPECT_DOUBLE_EQ(LimvdsLimit(10.0, 1.0), 4.0);
+  EXPECT_DOUBLE_EQ(LimvdsLimit(-3.0, 1.0), -0.5);
+  EXPECT_DOUBLE_EQ(LimvdsLimit(20.0, 4.0), 14.0);
+  EXPECT_DOUBLE_EQ(LimvdsLimit(3.0, 4.0), 3.0);
+}
+
+TEST_F(DeviceTest, DiodeLimitsJunctionVoltage) {
+  const double i_s = 1e-9;
+  Device* d = CreateDiode("D1", 0, 1, i_s, 1.0);
+  ASSERT_NE(d, nullptr);
+  d->vt->Init(d, nullptr);
+  ASSERT_NE(d->state, nullptr);
+  const double n_vt = kThermalVoltage;
+  const double vcrit = n_vt * log(n_vt / (sqrt(2.0) * i_s));
+
+  // Iteration 0 is not limited; turning on starts from vcrit
+  EXPECT_DOUBLE_EQ(DiodeLimitVoltage(d, -1.0, 0), -1.0);
+  EXPECT_DOUBLE_EQ(DiodeLimitVoltage(d, 5.0, 1), vcrit);
+  EXPECT_DOUBLE_EQ(DiodeLimitVoltage(d, 5.0, 1), vcrit);  // Same iteration
+  double v2 = DiodeLimitVoltage(d, 5.0, 2);
+  EXPECT_DOUBLE_EQ(v2, PnjLimit(5.0, vcrit, n_vt, vcrit));
+  EXPECT_DOUBLE_EQ(DiodeLimitVoltage(d, 0.2, 3), 0.2);  // Reverse step
+
+  // The stamp linearizes at the limited voltage when the policy asks
+  double x[4] = {5.0, 0.0, 0.0, 0.0};
+  IterationState it = {4, x, 1e-9, 1e-6, kDefaultNewtonPolicy, nullptr, 0.0};
+  d->vt->StampNonlinear(d, ctx, &it);
+  double matrix[16] = {0};
+  CtxAssembleDense(ctx, matrix);
+  double v4 = PnjLimit(5.0, 0.2, n_vt, vcrit);
+  EXPECT_NEAR(matrix[0], i_s / n_vt * exp(v4 / n_vt), 1e-15);
+
+  DeviceFree(d);
+}
+
+// ============================================================================
+// MOSFET Tests
+// ============================================================================
+
+// Central differences of the current and charges of MosfetEvaluate in
+// terminal voltage j
+static void MosfetFiniteDifferences(const MosfetParams* p, const double v[4],
+                                    int j, double* did, double dq[4]) {
+  const double h = 1e-6;
+  double vp[4], vm[4];
+  memcpy(vp, v, sizeof(vp));
+  memcpy(vm, v, sizeof(vm));
+  vp[j] += h;
+  vm[j] -= h;
+  MosfetOperatingPoint op_p, op_m;
+  MosfetEvaluate(p, vp, &op_p);
+  MosfetEvaluate(p, vm, &op_m);
+  *did = (op_p.id - op_m.id) / (2.0 * h);
+  for (int i = 0; i < 4; i++) dq[i] = (op_p.q[i] - op_m.q[i]) / (2.0 * h);
+}
+
+TEST_F(DeviceTest, MosfetDerivativesMatchFiniteDifferences) {
+  MosfetParams p;
+  MosfetParamsInit(&p);
+  MosfetParams body = p;
+  body.gamma = 0.4;
+
+  // {vd, vg, vs, vb}: linear, saturation, reversed linear, reversed
+  // saturation and both regions with body effect
+  const double biases[][4] = {{0.2, 1.5, 0.0, 0.0},  {2.0, 1.2, 0.0, 0.0},
+                              {0.0, 1.5, 0.3, 0.0},  {0.1, 1.4, 2.0, 0.0},
+                              {0.3, 1.8, 0.1, -0.5}, {2.5, 1.6, 0.2, -1.0}};
+  for (const auto& v : biases) {
+    for (const MosfetParams* model : {&p, &body}) {
+      MosfetOperatingPoint op;
+      MosfetEvaluate(model, v, &op);
+      EXPECT_NE(op.id, 0.0);
+      for (int j = 0; j < 4; j++) {
+        double did, dq[4];
+        MosfetFiniteDifferences(model, v, j, &did, dq);
+        EXPECT_NEAR(op.g[j], did, 1e-6 * std::fabs(did) + 1e-9)
+            << "g[" << j << "] at vd=" << v[0] << " vs=" << v[2];
+        for (int i = 0; i < 4; i++) {
+          EXPECT_NEAR(op.c[i][j], dq[i], 1e-6 * std::fabs(dq[i]) + 1e-18)
+              << "c[" << i << "][" << j << "] at vd=" << v[0];
+        }
+      }
+    }
+  }
+}
+
+TEST_F(DeviceTest, MosfetConservesChargeAndCurrent) {
+  MosfetParams p;
+  MosfetParamsInit(&p);
+  p.gamma = 0.3;
+  const double v[4] = {0.4, 1.6, 0.1, -0.2};
+  MosfetOperatingPoint op;
+  MosfetEvaluate(&p, v, &op);
+
+  // Charges sum to zero, and a common shift of every terminal voltage
+  // changes neither the current nor the charges
+  double q_sum = 0.0;
+  for (int i = 0; i < 4; i++) q_sum += op.q[i];
+  EXPECT_NEAR(q_sum, 0.0, 1e-12 * std::fabs(op.q[kMosfetGate]));
+  double g_sum = 0.0;
+  for (int j = 0; j < 4; j++) g_sum += op.g[j];
+  EXPECT_NEAR(g_sum, 0.0, 1e-12 * std::fabs(op.g[kMosfetGate]));
+  for (int i = 0; i < 4; i++) {
+    double c_sum = 0.0;
+    for (int j = 0; j < 4; j++) c_sum += op.c[i][j];
+    EXPECT_NEAR(c_sum, 0.0, 1e-12 * std::fabs(op.c[kMosfetGate][kMosfetGate]));
+  }
+  EXPECT_DOUBLE_EQ(op.q[kMosfetBulk], 0.0);
+}
+
+TEST_F(DeviceTest, MosfetCutoff) {
+  MosfetParams p;
+  MosfetParamsInit(&p);
+  const double v[4] = {1.0, 0.2, 0.0, 0.0};
+  MosfetOperatingPoint op;
+  MosfetEvaluate(&p, v, &op);
+  EXPECT_DOUBLE_EQ(op.id, 0.0);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_DOUBLE_EQ(op.g[i], 0.0);
+    EXPECT_DOUBLE_EQ(op.q[i], 0.0);
+  }
+}
+
+TEST_F(DeviceTest, MosfetStamp) {
+  MosfetParams p;
+  MosfetParamsInit(&p);
+  EXPECT_EQ(CreateMosfet("M1", 0, 1, 2, 3, nullptr), nullptr);
+  MosfetParams bad = p;
+  bad.l = 0.0;
+  EXPECT_EQ(CreateMosfet("M1", 0, 1, 2, 3, &bad), nullptr);
+
+  // Drain 0, gate 1, source and bulk grounded, in saturation
+  Device* d = CreateMosfet("M1", 0, 1, -1, -1, &p);
+  ASSERT_NE(d, nullptr);
+  MosfetParams got;
+  ASSERT_EQ(MosfetGetParams(d, &got), 0);
+  EXPECT_DOUBLE_EQ(got.w, p.w);
+  Device* diode = CreateDiode("D1", 0, 1, 1e-14, 1.0);
+  EXPECT_EQ(MosfetGetParams(diode, nullptr), -1);
+  DeviceFree(diode);
+
+  double x[4] = {2.0, 1.0, 0.0, 0.0};
+  IterationState it = {0, x, 1e-9, 1e-6, NewtonPolicy{}, nullptr, 0.0};
+  d->vt->StampNonlinear(d, ctx, &it);
+  double matrix[16] = {0};
+  CtxAssembleDense(ctx, matrix);
+
+  double k = p.mu * p.cox * p.w / p.l;
+  double vov = x[1] - p.vth0;
+  EXPECT_NEAR(matrix[0 * 4 + 1], k * vov, 1e-12);    // gm
+  EXPECT_NEAR(matrix[0 * 4 + 0], kMosfetGmin, 1e-18);  // gds = 0 + gmin
+  EXPECT_DOUBLE_EQ(matrix[1 * 4 + 0], 0.0);  // No DC gate current
+
+  // The linearized current at the bias point is the model current
+  const double* z = CtxGetZ(ctx);
+  double i_d = matrix[0 * 4 + 0] * x[0] + matrix[0 * 4 + 1] * x[1] - z[0];
+  EXPECT_NEAR(i_d, 0.5 * k * vov * vov + kMosfetGmin * x[0], 1e-12);
+
+  DeviceFree(d);
+}
+
+TEST_F(DeviceTest, MosfetLimitsGateAndDrainSteps) {
+  MosfetParams p;
+  MosfetParamsInit(&p);
+  Device* d = CreateMosfet("M1", 0, 1, 2, 3, &p);
+  ASSERT_NE(d, nullptr);
+  d->vt->Init(d, nullptr);
+
+  double v[4] = {0.0, 0.0, 0.0, 0.0};
+  MosfetLimitVoltages(d, v, 0);
+  for (int j = 0; j < 4; j++) EXPECT_DOUBLE_EQ(v[j], 0.0);
+
+  // A gate jump from cutoff stops just above threshold, the drain at 4V;
+  // the source and bulk are kept
+  double w[4] = {10.0, 5.0, 0.0, -1.0};
+  MosfetLimitVoltages(d, w, 1);
+  EXPECT_DOUBLE_EQ(w[kMosfetGate], p.vth0 + 0.5);
+  EXPECT_DOUBLE_EQ(w[kMosfetDrain], 4.0);
+  EXPECT_DOUBLE_EQ(w[kMosfetSource], 0.0);
+  EXPECT_DOUBLE_EQ(w[kMosfetBulk], -1.0);
+
+  // Reversed device (drain below source): vgd is limited instead of vgs
+  Device* r = CreateMosfet("M2", 0, 1, 2, 3, &p);
+  ASSERT_NE(r, nullptr);
+  r->vt->Init(r, nullptr);
+  double u[4] = {-1.0, 0.0, 0.0, 0.0};
+  MosfetLimitVoltages(r, u, 0);
+  double q[4] = {-1.0, 6.0, 0.0, 0.0};
+  MosfetLimitVoltages(r, q, 1);
+  EXPECT_DOUBLE_EQ(q[kMosfetGate] - q[kMosfetDrain],
+                   FetLimit(7.0, 1.0, p.vth0));
+  EXPECT_DOUBLE_EQ(q[kMosfetDrain], 0.5);  // -limvds(-1.5, 1)
+  DeviceFree(r);
+
+  DeviceFree(d);
+}
+
+// ============================================================================
+// Device Bypass Tests
+// ============================================================================
+
+static void Linear(const void* user, double x, double* f, double* df) {
+  (void)user;
+  *f = 1e-3 * x;
+  *df = 1e-3;
+}
+
+TEST_F(DeviceTest, DiodeBypassReusesLinearization) {
+  Device* d = CreateDiode("D1", 0, -1, 1e-14, 1.0);
+  ASSERT_NE(d, nullptr);
+  d->vt->Init(d, nullptr);
+
+  DeviceEvalCounts counts = {0, 0};
+  double x[4] = {0.6, 0.0, 0.0, 0.0};
+  IterationState it = {0, x, 1e-9, 1e-6, kDefaultNewtonPolicy, &counts, 0.0};
+  double first[16] = {0}, matrix[16] = {0};
+  d->vt->StampNonlinear(d, ctx, &it);
+  CtxAssembleDense(ctx, first);
+  double z0 = CtxGetZ(ctx)[0];
+  EXPECT_EQ(counts.evaluations, 1);
+  EXPECT_EQ(counts.bypassed, 0);
+
+  // A step below the tolerance keeps the stamp of the last evaluation
+  x[0] = 0.6 + 0.5 * kDefaultNewtonPolicy.bypass_vtol;
+  CtxReset(ctx);
+  d->vt->StampNonlinear(d, ctx, &it);
+  CtxAssembleDense(ctx, matrix);
+  EXPECT_EQ(counts.bypassed, 1);
+  EXPECT_EQ(matrix[0], first[0]);
+  EXPECT_EQ(CtxGetZ(ctx)[0], z0);
+
+  // Larger steps, bypass turned off and a switch to table mode re-evaluate
+  x[0] = 0.61;
+  d->vt->StampNonlinear(d, ctx, &it);
+  EXPECT_EQ(counts.evaluations, 2);
+  it.policy.bypass = 0;
+  d->vt->StampNonlinear(d, ctx, &it);
+  EXPECT_EQ(counts.evaluations, 3);
+  it.policy.bypass = 1;
+  MonotoneCubicTable t;
+  ASSERT_EQ(MonotoneCubicTableBuild(&t, -1.0, 1.0, 5, Linear, nullptr), 0);
+  d->table = &t;
+  d->vt->StampNonlinear(d, ctx, &it);
+  EXPECT_EQ(counts.evaluations, 4);
+  d->vt->StampNonlinear(d, ctx, &it);
+  EXPECT_EQ(counts.bypassed, 2);
+  d->table = nullptr;
+  d->vt->StampNonlinear(d, ctx, &it);
+  EXPECT_EQ(counts.evaluations, 5);
+  MonotoneCubicTableRelease(&t);
+
+  // Limited evaluations are not cached
+  x[0] = 5.0;
+  it.iter = 1;
+  d->vt->StampNonlinear(d, ctx, &it);
+  d->vt->StampNonlinear(d, ctx, &it);
+  EXPECT_EQ(counts.evaluations, 7);
+  EXPECT_EQ(counts.bypassed, 2);
+
+  DeviceFree(d);
+}
+
+TEST_F(DeviceTest, MosfetBypassReusesLinearization) {
+  MosfetParams p;
+  MosfetParamsInit(&p);
+  Device* d = CreateMosfet("M1", 0, 1, 2, 3, &p);
+  ASSERT_NE(d, nullptr);
+  d->vt->Init(d, nullptr);
+
+  DeviceEvalCounts counts = {0, 0};
+  double x[4] = {1.5, 1.2, 0.1, 0.0};
+  IterationState it = {0, x, 1e-9, 1e-6, kDefaultNewtonPolicy, &counts, 0.0};
+  double first[16] = {0}, matrix[16] = {0};
+  d->vt->StampNonlinear(d, ctx, &it);
+  CtxAssembleDense(ctx, first);
+  double z0 = CtxGetZ(ctx)[0];
+
+  // Every terminal within the tolerance: the shifted iterate is stamped
+  // with the linearization at the evaluated voltages
+  for (int j = 0; j < 4; j++) x[j] += 0.5 * kDefaultNewtonPolicy.bypass_vtol;
+  CtxReset(ctx);
+  d->vt->StampNonlinear(d, ctx, &it);
+  CtxAssembleDense(ctx, matrix);
+  EXPECT_EQ(counts.evaluations, 1);
+  EXPECT_EQ(counts.bypassed, 1);
+  for (int i = 0; i < 16; i++) EXPECT_EQ(matrix[i], first[i]);
+  EXPECT_EQ(CtxGetZ(ctx)[0], z0);
+
+  // One terminal beyond it
+  x[kMosfetBulk] -= 1e-3;
+  d->vt->StampNonlinear(d, ctx, &it);
+  EXPECT_EQ(counts.evaluations, 2);
+  EXPECT_EQ(counts.bypassed, 1);
+
+  DeviceFree(d);
+}
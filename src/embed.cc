@@ -0,0 +1,514 @@
+// Embedding API implementation
+//
+// Thin C-linkage wrappers over the circuit, parser, sweep and transient
+// APIs. Results are allocated at their final size when it is known (DC
+// points, sweeps, batches) and grown in place by the transient callback, so
+// the analyses write straight into the buffers handed to the caller.
+//
+
+#include "embed.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "circuit.h"
+#include "device.h"
+#include "parser.h"
+#include "sweep.h"
+#include "thread_pool.h"
+#include "transient.h"
+#include "waveform.h"
+
+using namespace minispice;
+
+struct MiniSpiceCircuit {
+  Circuit* circuit;
+
+  // Newton settings of the analyses
+  int max_iter;
+  double tol_abs;
+  double tol_rel;
+
+  // Last DC solution (num_vars), the warm start of the next; solved is 1
+  // once it holds one
+  double* x;
+  int solved;
+
+  // Every solution variable and the name of each, by index (num_vars;
+  // pointing into sel)
+  WaveformSelection sel;
+  const char** var_names;
+};
+
+struct MiniSpiceResult {
+  int rows;
+  int cols;
+  size_t capacity;  // Rows allocated
+  double* data;     // rows x cols, row-major
+  double* scale;    // One per row, or nullptr
+};
+
+namespace {
+
+// Initial rows of a result grown point by point (transient)
+constexpr size_t kInitialResultRows = 256;
+
+// Result of rows x cols with a scale if with_scale, contents zero
+static MiniSpiceResult* NewResult(int rows, int cols, int with_scale) {
+  MiniSpiceResult* r = (MiniSpiceResult*)calloc(1, sizeof(MiniSpiceResult));
+  if (!r) return nullptr;
+  r->rows = rows;
+  r->cols = cols;
+  r->capacity = rows > 0 ? rows : 1;
+  r->data = (double*)calloc(r->capacity * cols, sizeof(double));
+  if (with_scale) r->scale = (double*)calloc(r->capacity, sizeof(double));
+  if (!r->data || (with_scale && !r->scale)) {
+    minispice_result_free(r);
+    return nullptr;
+  }
+  return r;
+}
+
+// Append a row (and its scale value) to a result, doubling its capacity
+// when full.
+// Returns 0 on success, -1 on allocation failure.
+static int AppendRow(MiniSpiceResult* r, double scale, const double* x) {
+  if ((size_t)r->rows == r->capacity) {
+    size_t capacity = 2 * r->capacity;
+    double* data =
+        (double*)realloc(r->data, capacity * r->cols * sizeof(double));
+    if (!data) return -1;
+    r->data = data;
+    double* s = (double*)realloc(r->scale, capacity * sizeof(double));
+    if (!s) return -1;
+    r->scale = s;
+    r->capacity = capacity;
+  }
+  memcpy(r->data + (size_t)r->rows * r->cols, x, r->cols * sizeof(double));
+  r->scale[r->rows] = scale;
+  r->rows++;
+  return 0;
+}
+
+// Add a device created from node indices to a circuit being built.
+// Returns 0 on success, -1 on error (the device is freed).
+static int AddDevice(MiniSpiceCircuit* c, Device* d) {
+  if (!d) return -1;
+  if (!CircuitAddDevice(c->circuit, d)) {
+    DeviceFree(d);
+    return -1;
+  }
+  return 0;
+}
+
+// 1 if devices can be added (a circuit being built), 0 otherwise
+static int Building(const MiniSpiceCircuit* c) {
+  return c && c->circuit && !c->circuit->finalized;
+}
+
+// Node indices of up to 4 named nodes of a circuit being built.
+// Returns 0 on success, -1 on error.
+static int NodeIndices(MiniSpiceCircuit* c, const char* const* names,
+                       int count, int* nodes) {
+  if (!Building(c)) return -1;
+  for (int i = 0; i < count; i++) {
+    if (!names[i]) return -1;
+    nodes[i] = CircuitAddNode(c->circuit, names[i]);
+    if (nodes[i] < 0) return -1;
+  }
+  return 0;
+}
+
+// Allocate the per-variable state of a finalized circuit: the warm start
+// and the variable names.
+// Returns 0 on success, -1 on allocation failure.
+static int SetupVariables(MiniSpiceCircuit* c) {
+  Circuit* circuit = c->circuit;
+  int n = circuit->num_vars;
+  c->x = (double*)calloc(n, sizeof(double));
+  c->var_names = (const char**)calloc(n, sizeof(const char*));
+  if (!c->x || !c->var_names) return -1;
+
+  if (CircuitSelectWaveform(circuit, nullptr, &c->sel) != 0) return -1;
+  for (int i = 0; i < c->sel.num_vars; i++) {
+    int v = c->sel.var_index[i];
+    if (v >= 0 && v < n) c->var_names[v] = c->sel.names[i];
+  }
+  return 0;
+}
+
+// Handle around a parsed (finalized) or new (empty) circuit; the circuit is
+// freed on failure
+static MiniSpiceCircuit* WrapCircuit(Circuit* circuit) {
+  if (!circuit) return nullptr;
+  MiniSpiceCircuit* c =
+      (MiniSpiceCircuit*)calloc(1, sizeof(MiniSpiceCircuit));
+  if (!c) {
+    circuit_free(circuit);
+    return nullptr;
+  }
+  c->circuit = circuit;
+  c->max_iter = 100;
+  c->tol_abs = 1e-9;
+  c->tol_rel = 1e-6;
+  if (circuit->finalized && SetupVariables(c) != 0) {
+    minispice_circuit_free(c);
+    return nullptr;
+  }
+  return c;
+}
+
+// 1 if analyses can run (a finalized circuit), 0 otherwise
+static int Ready(const MiniSpiceCircuit* c) {
+  return c && c->circuit && c->circuit->finalized && c->x;
+}
+
+struct SweepRows {
+  MiniSpiceResult* result;
+  int row;
+};
+
+static void StoreSweepPoint(void* user, const double* values, const double* x,
+                            int num_vars) {
+  SweepRows* rows = static_cast<SweepRows*>(user);
+  MiniSpiceResult* r = rows->result;
+  if (rows->row >= r->rows) return;
+  memcpy(r->data + (size_t)rows->row * r->cols, x, num_vars * sizeof(double));
+  r->scale[rows->row] = values[0];
+  rows->row++;
+}
+
+struct TransientRows {
+  MiniSpiceResult* result;
+  int failed;
+};
+
+static void StoreTimePoint(void* user, double t, const double* x,
+                           int num_vars) {
+  (void)num_vars;
+  TransientRows* rows = static_cast<TransientRows*>(user);
+  if (!rows->failed && AppendRow(rows->result, t, x) != 0) rows->failed = 1;
+}
+
+}  // namespace
+
+// ============================================================================
+// Embedding API Implementation
+// ============================================================================
+
+extern "C" {
+
+int minispice_embed_version(void) { return MINISPICE_EMBED_VERSION; }
+
+MiniSpiceCircuit* minispice_circuit_new(void) {
+  return WrapCircuit(circuit_create());
+}
+
+MiniSpiceCircuit* minispice_circuit_parse(const char* netlist) {
+  if (!netlist) return nullptr;
+  return WrapCircuit(parse_netlist_string(netlist));
+}
+
+MiniSpiceCircuit* minispice_circuit_load(const char* path) {
+  if (!path) return nullptr;
+  return WrapCircuit(parse_netlist_file(path));
+}
+
+void minispice_circuit_free(MiniSpiceCircuit* c) {
+  if (!c) return;
+  circuit_free(c->circuit);
+  free(c->x);
+  free(c->var_names);
+  WaveformSelectionRelease(&c->sel);
+  free(c);
+}
+
+int minispice_add_resistor(MiniSpiceCircuit* c, const char* name,
+                           const char* n1, const char* n2, double r) {
+  const char* names[2] = {n1, n2};
+  int nodes[2];
+  if (!name || NodeIndices(c, names, 2, nodes) != 0) return -1;
+  return AddDevice(c, CreateResistor(name, nodes[0], nodes[1], r,
+                                     c->circuit->device_arena));
+}
+
+int minispice_add_capacitor(MiniSpiceCircuit* c, const char* name,
+                            const char* n1, const char* n2, double value) {
+  const char* names[2] = {n1, n2};
+  int nodes[2];
+  if (!name || NodeIndices(c, names, 2, nodes) != 0) return -1;
+  return AddDevice(c, CreateCapacitor(name, nodes[0], nodes[1], value,
+                                      c->circuit->device_arena));
+}
+
+int minispice_add_inductor(MiniSpiceCircuit* c, const char* name,
+                           const char* n1, const char* n2, double value) {
+  const char* names[2] = {n1, n2};
+  int nodes[2];
+  if (!name || NodeIndices(c, names, 2, nodes) != 0) return -1;
+  return AddDevice(c, CreateInductor(name, nodes[0], nodes[1], value,
+                                     c->circuit->device_arena));
+}
+
+int minispice_add_vsource(MiniSpiceCircuit* c, const char* name,
+                          const char* n_plus, const char* n_minus,
+                          double dc) {
+  const char* names[2] = {n_plus, n_minus};
+  int nodes[2];
+  if (!name || NodeIndices(c, names, 2, nodes) != 0) return -1;
+  return AddDevice(c, CreateVoltageSource(name, nodes[0], nodes[1], dc,
+                                          c->circuit->device_arena));
+}
+
+int minispice_add_isource(MiniSpiceCircuit* c, const char* name,
+                          const char* n_plus, const char* n_minus,
+                          double dc) {
+  const char* names[2] = {n_plus, n_minus};
+  int nodes[2];
+  if (!name || NodeIndices(c, names, 2, nodes) != 0) return -1;
+  return AddDevice(c, CreateCurrentSource(name, nodes[0], nodes[1], dc,
+                                          c->circuit->device_arena));
+}
+
+int minispice_add_vpulse(MiniSpiceCircuit* c, const char* name,
+                         const char* n_plus, const char* n_minus,
+                         const double pulse[7]) {
+  const char* names[2] = {n_plus, n_minus};
+  int nodes[2];
+  if (!name || !pulse || NodeIndices(c, names, 2, nodes) != 0) return -1;
+  PulseWaveform p = {pulse[0], pulse[1], pulse[2], pulse[3],
+                     pulse[4], pulse[5], pulse[6]};
+  return AddDevice(c, CreatePulseVoltageSource(name, nodes[0], nodes[1], &p,
+                                               c->circuit->device_arena));
+}
+
+int minispice_add_diode(MiniSpiceCircuit* c, const char* name,
+                        const char* anode, const char* cathode, double i_s,
+                        double n) {
+  const char* names[2] = {anode, cathode};
+  int nodes[2];
+  if (!name || NodeIndices(c, names, 2, nodes) != 0) return -1;
+  return AddDevice(c, CreateDiode(name, nodes[0], nodes[1], i_s, n,
+                                  c->circuit->device_arena));
+}
+
+int minispice_add_mosfet(MiniSpiceCircuit* c, const char* name,
+                         const char* drain, const char* gate,
+                         const char* source, const char* bulk, double w,
+                         double l) {
+  const char* names[4] = {drain, gate, source, bulk};
+  int nodes[4];
+  if (!name || NodeIndices(c, names, 4, nodes) != 0) return -1;
+  MosfetParams p;
+  MosfetParamsInit(&p);
+  p.w = w;
+  p.l = l;
+  return AddDevice(c, CreateMosfet(name, nodes[0], nodes[1], nodes[2],
+                                   nodes[3], &p, c->circuit->device_arena));
+}
+
+int minispice_finalize(MiniSpiceCircuit* c) {
+  if (!Building(c)) return -1;
+  Circuit* circuit = c->circuit;
+  if (CircuitFinalize(circuit) != 0) return -1;
+
+  // Device terminals switch from node indices to MNA variable indices, as
+  // for parsed circuits
+  for (Device* d = circuit->devices; d; d = d->next) {
+    for (int i = 0; i < 4; i++) {
+      int node = d->nodes[i];
+      if (node >= 0 && node < circuit->num_nodes) {
+        d->nodes[i] = circuit->nodes[node].var_index;
+      }
+    }
+  }
+  return SetupVariables(c);
+}
+
+int minispice_set_param(MiniSpiceCircuit* c, const char* device,
+                        const char* param, double value) {
+  if (!c || !c->circuit) return -1;
+  if (c->circuit->finalized) {
+    return CircuitSetDeviceParam(c->circuit, device, param, value);
+  }
+  Device* d = CircuitFindDevice(c->circuit, device);
+  return d ? DeviceSetParam(d, param, value) : -1;
+}
+
+int minispice_set_tolerances(MiniSpiceCircuit* c, int max_iter,
+                             double tol_abs, double tol_rel) {
+  if (!c || max_iter <= 0 || !(tol_abs > 0.0) || !(tol_rel >= 0.0)) {
+    return -1;
+  }
+  c->max_iter = max_iter;
+  c->tol_abs = tol_abs;
+  c->tol_rel = tol_rel;
+  return 0;
+}
+
+int minispice_num_vars(const MiniSpiceCircuit* c) {
+  return Ready(c) ? c->circuit->num_vars : -1;
+}
+
+const char* minispice_var_name(const MiniSpiceCircuit* c, int i) {
+  if (!Ready(c) || i < 0 || i >= c->circuit->num_vars) return nullptr;
+  return c->var_names[i];
+}
+
+int minispice_var_index(MiniSpiceCircuit* c, const char* name) {
+  if (!Ready(c) || !name) return -1;
+
+  // Node names are exact, device names in any case (as CircuitSelectWaveform)
+  int n = c->circuit->num_vars;
+  for (int i = 0; i < n; i++) {
+    if (c->var_names[i] && strcmp(c->var_names[i], name) == 0) return i;
+  }
+  for (int i = 0; i < n; i++) {
+    const char* var = c->var_names[i];
+    if (var && var[0] == 'I' && (name[0] == 'I' || name[0] == 'i') &&
+        strcasecmp(var, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+MiniSpiceResult* minispice_dc(MiniSpiceCircuit* c) {
+  if (!Ready(c)) return nullptr;
+  Circuit* circuit = c->circuit;
+
+  int iters;
+  if (c->solved) {
+    iters = CircuitDcResolve(circuit, nullptr, c->x, c->max_iter, c->tol_abs,
+                             c->tol_rel);
+  } else {
+    iters = CircuitDcAnalysis(circuit, c->x, c->max_iter, c->tol_abs,
+                              c->tol_rel);
+  }
+  c->solved = iters >= 0;
+  if (iters < 0) return nullptr;
+
+  MiniSpiceResult* r = NewResult(1, circuit->num_vars, 0);
+  if (r) memcpy(r->data, c->x, circuit->num_vars * sizeof(double));
+  return r;
+}
+
+MiniSpiceResult* minispice_dc_sweep(MiniSpiceCircuit* c, const char* source,
+                                    double start, double stop, double step) {
+  if (!Ready(c) || !source) return nullptr;
+  Circuit* circuit = c->circuit;
+
+  DcSweep sweep = {};
+  sweep.source = source;
+  sweep.start = start;
+  sweep.stop = stop;
+  sweep.step = step;
+  int points = DcSweepNumPoints(&sweep);
+  if (points <= 0) {
+    fprintf(stderr, "DC sweep: invalid step for %s\n", source);
+    return nullptr;
+  }
+  MiniSpiceResult* r = NewResult(points, circuit->num_vars, 1);
+  double* x = (double*)calloc(circuit->num_vars, sizeof(double));
+  if (!r || !x) {
+    minispice_result_free(r);
+    free(x);
+    return nullptr;
+  }
+
+  SweepRows rows = {r, 0};
+  int solved = CircuitDcSweep(circuit, nullptr, &sweep, 1, x, c->max_iter,
+                              c->tol_abs, c->tol_rel, StoreSweepPoint, &rows);
+  free(x);
+  if (solved != points) {
+    minispice_result_free(r);
+    return nullptr;
+  }
+  return r;
+}
+
+MiniSpiceResult* minispice_transient(MiniSpiceCircuit* c, double tstep,
+                                     double tstop) {
+  if (!Ready(c) || !(tstop > 0.0) || !(tstep > 0.0)) return nullptr;
+  Circuit* circuit = c->circuit;
+
+  TransientOptions opts;
+  TransientOptionsInit(&opts, tstep, tstop);
+  opts.tmax = tstep;
+  opts.max_iter = c->max_iter;
+  opts.tol_abs = c->tol_abs;
+  opts.tol_rel = c->tol_rel;
+
+  MiniSpiceResult* r = NewResult(kInitialResultRows, circuit->num_vars, 1);
+  double* x = (double*)calloc(circuit->num_vars, sizeof(double));
+  if (!r || !x) {
+    minispice_result_free(r);
+    free(x);
+    return nullptr;
+  }
+  r->rows = 0;
+
+  TransientRows rows = {r, 0};
+  int steps = CircuitTransientAnalysis(circuit, nullptr, &opts, x,
+                                       StoreTimePoint, &rows, nullptr);
+  free(x);
+  if (steps < 0 || rows.failed) {
+    minispice_result_free(r);
+    return nullptr;
+  }
+  return r;
+}
+
+MiniSpiceResult* minispice_dc_batch(MiniSpiceCircuit* c,
+                                    const char* const* devices,
+                                    const char* const* params, int num_params,
+                                    const double* values, int num_sets,
+                                    int num_threads) {
+  if (!Ready(c) || num_params < 0 || num_sets < 0) return nullptr;
+  if (num_params > 0 && (!devices || !params || !values)) return nullptr;
+  Circuit* circuit = c->circuit;
+
+  DeviceParamRef* refs = (DeviceParamRef*)calloc(
+      num_params > 0 ? num_params : 1, sizeof(DeviceParamRef));
+  MiniSpiceResult* r = NewResult(num_sets, circuit->num_vars, 0);
+  ThreadPool* pool = ThreadPoolCreate(num_threads);
+  int solved = -1;
+  if (refs && r && pool) {
+    for (int k = 0; k < num_params; k++) {
+      refs[k].device = devices[k];
+      refs[k].param = params[k];
+    }
+    solved = CircuitDcBatchParallel(circuit, pool, refs, num_params, values,
+                                    num_sets, r->data, c->max_iter,
+                                    c->tol_abs, c->tol_rel, nullptr);
+  }
+  ThreadPoolFree(pool);
+  free(refs);
+  if (solved != num_sets) {
+    minispice_result_free(r);
+    return nullptr;
+  }
+  return r;
+}
+
+int minispice_result_rows(const MiniSpiceResult* r) { return r ? r->rows : -1; }
+
+int minispice_result_cols(const MiniSpiceResult* r) { return r ? r->cols : -1; }
+
+const double* minispice_result_data(const MiniSpiceResult* r) {
+  return r ? r->data : nullptr;
+}
+
+const double* minispice_result_scale(const MiniSpiceResult* r) {
+  return r ? r->scale : nullptr;
+}
+
+void minispice_result_free(MiniSpiceResult* r) {
+  if (!r) return;
+  free(r->data);
+  free(r->scale);
+  free(r);
+}
+
+}  // extern "C"
@@ -0,0 +1,144 @@
+// embed.h
+// Stable C embedding API
+//
+// A flat C interface over the simulator for programs and language bindings
+// that embed it in-process (see python/ for the Python module). It exposes
+// no C++ types: circuits and results are opaque handles, nodes and devices
+// are named by strings, and every function has C linkage.
+//
+// A circuit is built by parsing a netlist or by adding devices between
+// named nodes and finalizing it; its parameters can then be edited in
+// place (minispice_set_param) and every DC analysis after the first warm
+// starts from the last solution (see CircuitDcResolve). Each analysis
+// returns a result owning the buffers the simulator wrote the solutions
+// into: callers read them through the result's pointers, without copying,
+// until they free the result. Results are independent of the circuit and of
+// each other and may outlive the circuit.
+//
+// A circuit must not be used by two threads at once; distinct circuits and
+// results may. Functions returning int return 0 (or a count) on success
+// and -1 on error, those returning pointers nullptr; diagnostics are
+// printed to stderr as by the rest of the simulator.
+
+#ifndef MINI_SPICE_EMBED_H_
+#define MINI_SPICE_EMBED_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Version of this interface, incremented when a function is added or
+// changed
+#define MINISPICE_EMBED_VERSION 1
+
+typedef struct MiniSpiceCircuit MiniSpiceCircuit;
+typedef struct MiniSpiceResult MiniSpiceResult;
+
+int minispice_embed_version(void);
+
+// ----------------------------------------------------------------------------
+// Circuits
+// ----------------------------------------------------------------------------
+
+// Empty circuit to build with the minispice_add_* functions
+MiniSpiceCircuit* minispice_circuit_new(void);
+
+// Finalized circuit from a netlist string or file (see parser.h)
+MiniSpiceCircuit* minispice_circuit_parse(const char* netlist);
+MiniSpiceCircuit* minispice_circuit_load(const char* path);
+
+void minispice_circuit_free(MiniSpiceCircuit* c);
+
+// Add a device between named nodes ("0", "gnd" and "ground" are ground) of
+// a circuit that is not finalized yet. Values are in SI units; pulse holds
+// v1 v2 td tr tf pw per. A MOSFET takes the default model parameters but
+// for w and l; minispice_set_param changes the others.
+int minispice_add_resistor(MiniSpiceCircuit* c, const char* name,
+                           const char* n1, const char* n2, double r);
+int minispice_add_capacitor(MiniSpiceCircuit* c, const char* name,
+                            const char* n1, const char* n2, double value);
+int minispice_add_inductor(MiniSpiceCircuit* c, const char* name,
+                           const char* n1, const char* n2, double value);
+int minispice_add_vsource(MiniSpiceCircuit* c, const char* name,
+                          const char* n_plus, const char* n_minus, double dc);
+int minispice_add_isource(MiniSpiceCircuit* c, const char* name,
+                          const char* n_plus, const char* n_minus, double dc);
+int minispice_add_vpulse(MiniSpiceCircuit* c, const char* name,
+                         const char* n_plus, const char* n_minus,
+                         const double pulse[7]);
+int minispice_add_diode(MiniSpiceCircuit* c, const char* name,
+                        const char* anode, const char* cathode, double i_s,
+                        double n);
+int minispice_add_mosfet(MiniSpiceCircuit* c, const char* name,
+                         const char* drain, const char* gate,
+                         const char* source, const char* bulk, double w,
+                         double l);
+
+// Finalize a built circuit (parsed circuits already are): assigns the
+// solution variables. No devices can be added afterwards.
+int minispice_finalize(MiniSpiceCircuit* c);
+
+// Set a device parameter in place (names as DeviceSetParam: "r", "c", "l",
+// "is", "n", the MOSFET's "w" ... "beta", "dc" for sources)
+int minispice_set_param(MiniSpiceCircuit* c, const char* device,
+                        const char* param, double value);
+
+// Newton settings of the analyses (defaults 100, 1e-9, 1e-6)
+int minispice_set_tolerances(MiniSpiceCircuit* c, int max_iter,
+                             double tol_abs, double tol_rel);
+
+// Solution variables of a finalized circuit: their number, the name of
+// variable i ("V(node)" or "I(device)", valid while the circuit lives) and
+// the index of a name (-1 if unknown)
+int minispice_num_vars(const MiniSpiceCircuit* c);
+const char* minispice_var_name(const MiniSpiceCircuit* c, int i);
+int minispice_var_index(MiniSpiceCircuit* c, const char* name);
+
+// ----------------------------------------------------------------------------
+// Analyses
+// ----------------------------------------------------------------------------
+
+// DC operating point: one row
+MiniSpiceResult* minispice_dc(MiniSpiceCircuit* c);
+
+// DC sweep of the value of a source from start to stop: one row per point,
+// the source values as the scale. The source is restored afterwards.
+MiniSpiceResult* minispice_dc_sweep(MiniSpiceCircuit* c, const char* source,
+                                    double start, double stop, double step);
+
+// Transient analysis from the DC operating point to tstop in steps of at
+// most tstep: one row per accepted time point (t = 0 included), the times as
+// the scale. Device state (capacitor and inductor histories) is advanced in
+// place.
+MiniSpiceResult* minispice_transient(MiniSpiceCircuit* c, double tstep,
+                                     double tstop);
+
+// DC operating points of num_sets parameter sets on num_threads threads
+// (<= 0 for the hardware threads): set s assigns values[s * num_params + k]
+// to parameter params[k] of device devices[k]. One row per set. The
+// circuit's own parameters are left unchanged.
+MiniSpiceResult* minispice_dc_batch(MiniSpiceCircuit* c,
+                                    const char* const* devices,
+                                    const char* const* params, int num_params,
+                                    const double* values, int num_sets,
+                                    int num_threads);
+
+// ----------------------------------------------------------------------------
+// Results
+// ----------------------------------------------------------------------------
+
+// Rows and columns (solution variables) of a result and its row-major
+// rows x cols solutions; the scale holds one value per row (sweep values,
+// times), or is nullptr for operating points
+int minispice_result_rows(const MiniSpiceResult* r);
+int minispice_result_cols(const MiniSpiceResult* r);
+const double* minispice_result_data(const MiniSpiceResult* r);
+const double* minispice_result_scale(const MiniSpiceResult* r);
+
+void minispice_result_free(MiniSpiceResult* r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // MINI_SPICE_EMBED_H_
@@ -0,0 +1,214 @@
+// embed_test.cc
+// Unit tests for the C embedding API
+
+#include "embed.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+static const char* kDiodeNetlist =
+    "V1 in 0 1\nR1 in a 100\nD1 a 0 Is=1e-14 n=1\nC1 a 0 1u\n";
+
+TEST(EmbedTest, BuiltCircuitMatchesParsedOne) {
+  MiniSpiceCircuit* built = minispice_circuit_new();
+  ASSERT_NE(built, nullptr);
+  EXPECT_EQ(minispice_add_vsource(built, "V1", "in", "0", 1.0), 0);
+  EXPECT_EQ(minispice_add_resistor(built, "R1", "in", "a", 100.0), 0);
+  EXPECT_EQ(minispice_add_diode(built, "D1", "a", "gnd", 1e-14, 1.0), 0);
+  EXPECT_EQ(minispice_add_capacitor(built, "C1", "a", "0", 1e-6), 0);
+
+  // Analyses need a finalized circuit, devices a circuit being built
+  EXPECT_EQ(minispice_num_vars(built), -1);
+  EXPECT_EQ(minispice_dc(built), nullptr);
+  ASSERT_EQ(minispice_finalize(built), 0);
+  EXPECT_EQ(minispice_add_resistor(built, "R2", "a", "0", 1.0), -1);
+  EXPECT_EQ(minispice_finalize(built), -1);
+
+  MiniSpiceCircuit* parsed = minispice_circuit_parse(kDiodeNetlist);
+  ASSERT_NE(parsed, nullptr);
+  ASSERT_EQ(minispice_num_vars(built), minispice_num_vars(parsed));
+  int n = minispice_num_vars(parsed);
+  EXPECT_EQ(n, 3);
+
+  MiniSpiceResult* a = minispice_dc(built);
+  MiniSpiceResult* b = minispice_dc(parsed);
+  ASSERT_NE(a, nullptr);
+  ASSERT_NE(b, nullptr);
+  EXPECT_EQ(minispice_result_rows(a), 1);
+  EXPECT_EQ(minispice_result_cols(a), n);
+  EXPECT_EQ(minispice_result_scale(a), nullptr);
+  for (int i = 0; i < n; i++) {
+    const char* name = minispice_var_name(parsed, i);
+    ASSERT_NE(name, nullptr);
+    int j = minispice_var_index(built, name);
+    ASSERT_GE(j, 0) << name;
+    EXPECT_NEAR(minispice_result_data(a)[j], minispice_result_data(b)[i],
+                1e-9)
+        << name;
+  }
+  int v_in = minispice_var_index(parsed, "V(in)");
+  int v_a = minispice_var_index(parsed, "V(a)");
+  ASSERT_GE(v_in, 0);
+  ASSERT_GE(v_a, 0);
+  EXPECT_EQ(minispice_var_index(parsed, "i(v1)"),
+            minispice_var_index(parsed, "I(V1)"));
+  EXPECT_EQ(minispice_var_index(parsed, "V(nowhere)"), -1);
+  EXPECT_DOUBLE_EQ(minispice_result_data(b)[v_in], 1.0);
+  EXPECT_GT(minispice_result_data(b)[v_a], 0.3);
+  EXPECT_LT(minispice_result_data(b)[v_a], 0.7);
+
+  minispice_result_free(a);
+  minispice_result_free(b);
+  minispice_circuit_free(built);
+  minispice_circuit_free(parsed);
+}
+
+TEST(EmbedTest, ResultsOutliveTheCircuit) {
+  MiniSpiceCircuit* c = minispice_circuit_parse(kDiodeNetlist);
+  ASSERT_NE(c, nullptr);
+  int v_a = minispice_var_index(c, "V(a)");
+  MiniSpiceResult* first = minispice_dc(c);
+  ASSERT_NE(first, nullptr);
+  double va = minispice_result_data(first)[v_a];
+
+  // Edits re-solve from the previous solution; earlier results keep theirs
+  ASSERT_EQ(minispice_set_param(c, "R1", "r", 1000.0), 0);
+  MiniSpiceResult* second = minispice_dc(c);
+  ASSERT_NE(second, nullptr);
+  EXPECT_LT(minispice_result_data(second)[v_a], va);
+  EXPECT_DOUBLE_EQ(minispice_result_data(first)[v_a], va);
+  EXPECT_EQ(minispice_set_param(c, "R1", "r", 0.0), -1);
+  EXPECT_EQ(minispice_set_param(c, "R9", "r", 1.0), -1);
+
+  minispice_circuit_free(c);
+  EXPECT_DOUBLE_EQ(minispice_result_data(first)[v_a], va);
+  minispice_result_free(first);
+  minispice_result_free(second);
+  minispice_result_free(nullptr);
+}
+
+TEST(EmbedTest, SweepAndTransientRows) {
+  MiniSpiceCircuit* c = minispice_circuit_parse(kDiodeNetlist);
+  ASSERT_NE(c, nullptr);
+  int n = minispice_num_vars(c);
+  int v_in = minispice_var_index(c, "V(in)");
+  int v_a = minispice_var_index(c, "V(a)");
+
+  MiniSpiceResult* sweep = minispice_dc_sweep(c, "V1", 0.0, 2.0, 0.25);
+  ASSERT_NE(sweep, nullptr);
+  ASSERT_EQ(minispice_result_rows(sweep), 9);
+  EXPECT_EQ(minispice_result_cols(sweep), n);
+  const double* scale = minispice_result_scale(sweep);
+  const double* data = minispice_result_data(sweep);
+  ASSERT_NE(scale, nullptr);
+  for (int p = 0; p < 9; p++) {
+    EXPECT_NEAR(scale[p], 0.25 * p, 1e-12);
+    EXPECT_NEAR(data[p * n + v_in], 0.25 * p, 1e-9);
+    if (p > 0) {
+      EXPECT_GE(data[p * n + v_a], data[(p - 1) * n + v_a]);
+    }
+  }
+  EXPECT_EQ(minispice_dc_sweep(c, "V9", 0.0, 1.0, 0.5), nullptr);
+  EXPECT_EQ(minispice_dc_sweep(c, "V1", 0.0, 1.0, -0.5), nullptr);
+  minispice_result_free(sweep);
+
+  // A pulse into an RC: more rows than the initial capacity of the result
+  MiniSpiceCircuit* rc = minispice_circuit_new();
+  ASSERT_NE(rc, nullptr);
+  const double pulse[7] = {0.0, 1.0, 0.0, 1e-9, 1e-9, 1.0, 0.0};
+  ASSERT_EQ(minispice_add_vpulse(rc, "V1", "in", "0", pulse), 0);
+  ASSERT_EQ(minispice_add_resistor(rc, "R1", "in", "out", 1e3), 0);
+  ASSERT_EQ(minispice_add_capacitor(rc, "C1", "out", "0", 1e-6), 0);
+  ASSERT_EQ(minispice_finalize(rc), 0);
+  int v_out = minispice_var_index(rc, "V(out)");
+  MiniSpiceResult* tran = minispice_transient(rc, 1e-5, 5e-3);
+  ASSERT_NE(tran, nullptr);
+  int rows = minispice_result_rows(tran);
+  EXPECT_GT(rows, 256);
+  const double* t = minispice_result_scale(tran);
+  EXPECT_EQ(t[0], 0.0);
+  EXPECT_NEAR(t[rows - 1], 5e-3, 1e-12);
+  for (int p = 1; p < rows; p++) ASSERT_GT(t[p], t[p - 1]);
+  double vout = minispice_result_data(tran)[(size_t)(rows - 1) *
+                                                minispice_result_cols(tran) +
+                                            v_out];
+  EXPECT_NEAR(vout, 1.0 - std::exp(-5.0), 1e-2);
+  EXPECT_EQ(minispice_transient(rc, 1e-5, 0.0), nullptr);
+  minispice_result_free(tran);
+
+  minispice_circuit_free(rc);
+  minispice_circuit_free(c);
+}
+
+TEST(EmbedTest, BatchMatchesEditedSolves) {
+  MiniSpiceCircuit* c = minispice_circuit_parse(kDiodeNetlist);
+  ASSERT_NE(c, nullptr);
+  int n = minispice_num_vars(c);
+
+  const char* devices[2] = {"R1", "V1"};
+  const char* params[2] = {"r", "dc"};
+  const int kSets = 24;
+  std::vector<double> values(2 * kSets);
+  for (int s = 0; s < kSets; s++) {
+    values[2 * s] = 50.0 + 25.0 * s;
+    values[2 * s + 1] = 0.5 + 0.1 * (s % 5);
+  }
+  MiniSpiceResult* batch =
+      minispice_dc_batch(c, devices, params, 2, values.data(), kSets, 2);
+  ASSERT_NE(batch, nullptr);
+  ASSERT_EQ(minispice_result_rows(batch), kSets);
+  EXPECT_EQ(minispice_result_cols(batch), n);
+  EXPECT_EQ(minispice_result_scale(batch), nullptr);
+
+  MiniSpiceCircuit* check = minispice_circuit_parse(kDiodeNetlist);
+  ASSERT_NE(check, nullptr);
+  for (int s = 0; s < kSets; s++) {
+    ASSERT_EQ(minispice_set_param(check, "R1", "r", values[2 * s]), 0);
+    ASSERT_EQ(minispice_set_param(check, "V1", "dc", values[2 * s + 1]), 0);
+    MiniSpiceResult* dc = minispice_dc(check);
+    ASSERT_NE(dc, nullptr);
+    for (int i = 0; i < n; i++) {
+      EXPECT_NEAR(minispice_result_data(batch)[s * n + i],
+                  minispice_result_data(dc)[i], 1e-8)
+          << "set " << s;
+    }
+    minispice_result_free(dc);
+  }
+
+  // The batch leaves the circuit's own parameters alone
+  MiniSpiceResult* own = minispice_dc(c);
+  ASSERT_NE(own, nullptr);
+  int v_in = minispice_var_index(c, "V(in)");
+  EXPECT_DOUBLE_EQ(minispice_result_data(own)[v_in], 1.0);
+  minispice_result_free(own);
+
+  const char* bad[1] = {"R9"};
+  EXPECT_EQ(minispice_dc_batch(c, bad, params, 1, values.data(), 1, 1),
+            nullptr);
+  minispice_result_free(batch);
+  minispice_circuit_free(check);
+  minispice_circuit_free(c);
+}
+
+TEST(EmbedTest, Errors) {
+  EXPECT_EQ(minispice_embed_version(), MINISPICE_EMBED_VERSION);
+  EXPECT_EQ(minispice_circuit_parse("R1 a\n"), nullptr);
+  EXPECT_EQ(minispice_circuit_load("/nonexistent/netlist.cir"), nullptr);
+  EXPECT_EQ(minispice_circuit_parse(nullptr), nullptr);
+  EXPECT_EQ(minispice_dc(nullptr), nullptr);
+  EXPECT_EQ(minispice_num_vars(nullptr), -1);
+  EXPECT_EQ(minispice_result_rows(nullptr), -1);
+  minispice_circuit_free(nullptr);
+
+  MiniSpiceCircuit* c = minispice_circuit_new();
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(minispice_add_resistor(c, "R1", nullptr, "0", 1.0), -1);
+  EXPECT_EQ(minispice_set_tolerances(c, 0, 1e-9, 1e-6), -1);
+  EXPECT_EQ(minispice_set_tolerances(c, 50, 0.0, 1e-6), -1);
+  EXPECT_EQ(minispice_set_tolerances(c, 50, 1e-12, 1e-9), 0);
+  EXPECT_EQ(minispice_var_name(c, 0), nullptr);
+  minispice_circuit_free(c);
+}
@@ -0,0 +1,455 @@
+// Krylov solver implementation
+//
+// The preconditioner works on a row-wise (CSR) copy of the pattern plus the
+// diagonal; setup scatters the CSC values into it through a map computed
+// at creation. The matrix products read the CSC matrix directly.
+//
+
+#include "krylov.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "sparse.h"
+
+namespace minispice {
+
+const LinearSolverOptions kDefaultLinearSolverOptions = {
+    .method = kLinearSolverDirect,
+    .preconditioner = kPreconditionerIlu0,
+    .tol = 1e-10,
+    .max_iter = 1000,
+    .restart = 50,
+    .threads = 1,
+    .mixed_precision = 0,
+};
+
+// ILU(0) pivots below this fraction of their row's largest entry are
+// replaced by it (with their sign)
+constexpr double kIluPivotFloor = 1e-10;
+
+struct KrylovSolver {
+  LinearSolverOptions opts;
+  int n;
+  int nnz;  // Entries of the pattern of creation
+
+  // Preconditioner: CSR pattern of A plus the diagonal, with the position
+  // of every CSC entry of A in it (Jacobi and ILU(0))
+  std::vector<int> row_ptr;
+  std::vector<int> col_idx;
+  std::vector<int> diag;     // Position of (i, i) in row i
+  std::vector<int> csr_pos;  // CSC entry p of A is csr[csr_pos[p]]
+  std::vector<double> csr;   // ILU(0): L below and U on/above the diagonal
+  std::vector<double> inv_diag;  // Jacobi
+  std::vector<int> marker;       // ILU(0) setup scratch (length n, -1)
+
+  // Iteration vectors (length n): r, w, z for both methods; GMRES also
+  // the basis v (restart + 1 vectors) and the Hessenberg system, BiCGStab
+  // r_hat, p, s, t, u
+  std::vector<double> r, w, z;
+  std::vector<double> v;
+  std::vector<double> h, cs, sn, g, y;
+  std::vector<double> r_hat, p, s, t, u;
+};
+
+namespace {
+
+static double Dot(int n, const double* a, const double* b) {
+  double sum = 0.0;
+  for (int i = 0; i < n; i++) sum += a[i] * b[i];
+  return sum;
+}
+
+static double Norm(int n, const double* a) { return sqrt(Dot(n, a, a)); }
+
+// y = A x
+static void MatVec(const SparseMatrix* A, const double* x, double* y) {
+  memset(y, 0, A->n * sizeof(double));
+  for (int j = 0; j < A->n; j++) {
+    double xj = x[j];
+    if (xj == 0.0) continue;
+    for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+      y[A->row_idx[p]] += A->values[p] * xj;
+    }
+  }
+}
+
+// r = b - A x
+static void Residual(const SparseMatrix* A, const double* b, const double* x,
+                     double* r) {
+  MatVec(A, x, r);
+  for (int i = 0; i < A->n; i++) r[i] = b[i] - r[i];
+}
+
+// z = M^-1 v
+static void ApplyPreconditioner(const KrylovSolver* s, const double* v,
+                                double* z) {
+  int n = s->n;
+  switch (s->opts.preconditioner) {
+    case kPreconditionerJacobi:
+      for (int i = 0; i < n; i++) z[i] = s->inv_diag[i] * v[i];
+      return;
+    case kPreconditionerIlu0:
+      // Unit lower solve, then upper solve
+      for (int i = 0; i < n; i++) {
+        double sum = v[i];
+        for (int q = s->row_ptr[i]; q < s->diag[i]; q++) {
+          sum -= s->csr[q] * z[s->col_idx[q]];
+        }
+        z[i] = sum;
+      }
+      for (int i = n - 1; i >= 0; i--) {
+        double sum = z[i];
+        for (int q = s->diag[i] + 1; q < s->row_ptr[i + 1]; q++) {
+          sum -= s->csr[q] * z[s->col_idx[q]];
+        }
+        z[i] = sum / s->csr[s->diag[i]];
+      }
+      return;
+    default:
+      memcpy(z, v, n * sizeof(double));
+      return;
+  }
+}
+
+// Build the CSR pattern of A plus its diagonal and the CSC-to-CSR map
+static void BuildRowPattern(KrylovSolver* s, const SparseMatrix* A) {
+  int n = A->n;
+  std::vector<int> has_diag(n, 0);
+  std::vector<int> count(n, 0);
+  for (int j = 0; j < n; j++) {
+    for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+      count[A->row_idx[p]]++;
+      if (A->row_idx[p] == j) has_diag[j] = 1;
+    }
+  }
+  s->row_ptr.assign(n + 1, 0);
+  for (int i = 0; i < n; i++) {
+    s->row_ptr[i + 1] = s->row_ptr[i] + count[i] + !has_diag[i];
+  }
+
+  // Columns are visited in increasing order, so every row comes out sorted;
+  // a missing diagonal is inserted when the walk passes it
+  int total = s->row_ptr[n];
+  s->col_idx.assign(total, 0);
+  s->diag.assign(n, -1);
+  s->csr_pos.assign(A->nnz, 0);
+  std::vector<int> next(s->row_ptr.begin(), s->row_ptr.end() - 1);
+  for (int j = 0; j < n; j++) {
+    for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+      int i = A->row_idx[p];
+      if (!has_diag[i] && s->diag[i] < 0 && j > i) {
+        s->diag[i] = next[i];
+        s->col_idx[next[i]++] = i;
+      }
+      if (i == j) s->diag[i] = next[i];
+      s->csr_pos[p] = next[i];
+      s->col_idx[next[i]++] = j;
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    if (s->diag[i] < 0) {  // Diagonal after the last entry of the row
+      s->diag[i] = next[i];
+      s->col_idx[next[i]++] = i;
+    }
+  }
+  s->csr.assign(total, 0.0);
+}
+
+// ILU(0) of the values in s->csr, in place (IKJ order)
+static void FactorIlu0(KrylovSolver* s) {
+  int n = s->n;
+  std::vector<int>& marker = s->marker;
+  for (int i = 0; i < n; i++) {
+    int begin = s->row_ptr[i];
+    int end = s->row_ptr[i + 1];
+    double row_max = 0.0;
+    for (int q = begin; q < end; q++) {
+      marker[s->col_idx[q]] = q;
+      row_max = fmax(row_max, fabs(s->csr[q]));
+    }
+
+    for (int q = begin; q < s->diag[i]; q++) {
+      int k = s->col_idx[q];
+      double l = s->csr[q] / s->csr[s->diag[k]];
+      s->csr[q] = l;
+      for (int e = s->diag[k] + 1; e < s->row_ptr[k + 1]; e++) {
+        int m = marker[s->col_idx[e]];
+        if (m >= 0) s->csr[m] -= l * s->csr[e];
+      }
+    }
+
+    double floor = kIluPivotFloor * (row_max > 0.0 ? row_max : 1.0);
+    double& pivot = s->csr[s->diag[i]];
+    if (!(fabs(pivot) >= floor)) pivot = pivot < 0.0 ? -floor : floor;
+
+    for (int q = begin; q < end; q++) marker[s->col_idx[q]] = -1;
+  }
+}
+
+// Restarted GMRES(m). Returns the iterations, or -1 without convergence.
+static int SolveGmres(KrylovSolver* s, const SparseMatrix* A, const double* b,
+                      double* x, double target) {
+  int n = s->n;
+  int m = s->opts.restart;
+  double* v = s->v.data();
+  double* h = s->h.data();  // h[j * (m + 1) + i]: row i of column j
+  double* r = s->r.data();
+  double* w = s->w.data();
+  double* z = s->z.data();
+
+  int total = 0;
+  Residual(A, b, x, r);
+  double beta = Norm(n, r);
+  while (beta > target) {
+    if (total >= s->opts.max_iter) return -1;
+
+    for (int i = 0; i < n; i++) v[i] = r[i] / beta;
+    s->g.assign(m + 1, 0.0);
+    s->g[0] = beta;
+
+    int j = 0;
+    while (j < m && total < s->opts.max_iter) {
+      double* hj = h + (size_t)j * (m + 1);
+      double* vj = v + (size_t)j * n;
+      double* vnext = v + (size_t)(j + 1) * n;
+
+      // Arnoldi step on A M^-1
+      ApplyPreconditioner(s, vj, z);
+      MatVec(A, z, w);
+      for (int i = 0; i <= j; i++) {
+        const double* vi = v + (size_t)i * n;
+        hj[i] = Dot(n, w, vi);
+        for (int k = 0; k < n; k++) w[k] -= hj[i] * vi[k];
+      }
+      hj[j + 1] = Norm(n, w);
+      if (hj[j + 1] > 0.0) {
+        for (int k = 0; k < n; k++) vnext[k] = w[k] / hj[j + 1];
+      }
+
+      // Reduce the new column to upper triangular form
+      for (int i = 0; i < j; i++) {
+        double a = hj[i];
+        hj[i] = s->cs[i] * a + s->sn[i] * hj[i + 1];
+        hj[i + 1] = -s->sn[i] * a + s->cs[i] * hj[i + 1];
+      }
+      double d = hypot(hj[j], hj[j + 1]);
+      s->cs[j] = d > 0.0 ? hj[j] / d : 1.0;
+      s->sn[j] = d > 0.0 ? hj[j + 1] / d : 0.0;
+      hj[j] = d;
+      hj[j + 1] = 0.0;
+      s->g[j + 1] = -s->sn[j] * s->g[j];
+      s->g[j] = s->cs[j] * s->g[j];
+
+      j++;
+      total++;
+      if (fabs(s->g[j]) <= target || d == 0.0) break;
+    }
+
+    // x += M^-1 V y with H y = g
+    for (int i = j - 1; i >= 0; i--) {
+      double sum = s->g[i];
+      for (int k = i + 1; k < j; k++) {
+        sum -= h[(size_t)k * (m + 1) + i] * s->y[k];
+      }
+      double diag = h[(size_t)i * (m + 1) + i];
+      s->y[i] = diag != 0.0 ? sum / diag : 0.0;
+    }
+    memset(w, 0, n * sizeof(double));
+    for (int i = 0; i < j; i++) {
+      const double* vi = v + (size_t)i * n;
+      for (int k = 0; k < n; k++) w[k] += s->y[i] * vi[k];
+    }
+    ApplyPreconditioner(s, w, z);
+    for (int k = 0; k < n; k++) x[k] += z[k];
+
+    double previous = beta;
+    Residual(A, b, x, r);
+    beta = Norm(n, r);
+    if (beta > target && !(beta < previous)) return -1;  // Stagnated
+  }
+  return total;
+}
+
+// Right-preconditioned BiCGStab. Returns the iterations, or -1 without
+// convergence.
+static int SolveBicgstab(KrylovSolver* s, const SparseMatrix* A,
+                         const double* b, double* x, double target) {
+  int n = s->n;
+  double* r = s->r.data();
+  double* r_hat = s->r_hat.data();
+  double* p = s->p.data();
+  double* v = s->w.data();
+  double* p_hat = s->z.data();
+  double* q = s->s.data();  // The intermediate residual s
+  double* t = s->t.data();
+  double* q_hat = s->u.data();
+
+  Residual(A, b, x, r);
+  int total = 0;
+  while (Norm(n, r) > target) {
+    // (Re)start the recurrences from the true residual
+    memcpy(r_hat, r, n * sizeof(double));
+    memset(p, 0, n * sizeof(double));
+    memset(v, 0, n * sizeof(double));
+    double rho = 1.0, alpha = 1.0, omega = 1.0;
+    bool restart = false;
+
+    while (!restart) {
+      if (total >= s->opts.max_iter) return -1;
+      total++;
+
+      double rho_next = Dot(n, r_hat, r);
+      if (rho_next == 0.0) break;
+      double beta = (rho_next / rho) * (alpha / omega);
+      rho = rho_next;
+      for (int i = 0; i < n; i++) p[i] = r[i] + beta * (p[i] - omega * v[i]);
+
+      ApplyPreconditioner(s, p, p_hat);
+      MatVec(A, p_hat, v);
+      double rv = Dot(n, r_hat, v);
+      if (rv == 0.0) break;
+      alpha = rho / rv;
+      for (int i = 0; i < n; i++) q[i] = r[i] - alpha * v[i];
+      if (Norm(n, q) <= target) {
+        for (int i = 0; i < n; i++) x[i] += alpha * p_hat[i];
+        break;
+      }
+
+      ApplyPreconditioner(s, q, q_hat);
+      MatVec(A, q_hat, t);
+      double tt = Dot(n, t, t);
+      omega = tt > 0.0 ? Dot(n, t, q) / tt : 0.0;
+      for (int i = 0; i < n; i++) {
+        x[i] += alpha * p_hat[i] + omega * q_hat[i];
+        r[i] = q[i] - omega * t[i];
+      }
+      // Converged by the recurrence (checked below on the true residual),
+      // or broken down
+      restart = Norm(n, r) <= target || omega == 0.0;
+    }
+
+    Residual(A, b, x, r);
+  }
+  return total;
+}
+
+}  // namespace
+
+// ============================================================================
+// KrylovSolver API Implementation
+// ============================================================================
+
+KrylovSolver* KrylovSolverCreate(const SparseMatrix* A,
+                                 const LinearSolverOptions* opts) {
+  if (!A || !opts || A->n <= 0) return nullptr;
+  if (opts->method != kLinearSolverGmres &&
+      opts->method != kLinearSolverBicgstab) {
+    return nullptr;
+  }
+  if (!(opts->tol > 0.0) || opts->max_iter <= 0 ||
+      (opts->method == kLinearSolverGmres && opts->restart <= 0)) {
+    return nullptr;
+  }
+
+  KrylovSolver* s = new (std::nothrow) KrylovSolver;
+  if (!s) return nullptr;
+  s->opts = *opts;
+  int n = A->n;
+  s->n = n;
+  s->nnz = A->nnz;
+  try {
+    switch (opts->preconditioner) {
+      case kPreconditionerIlu0:
+        BuildRowPattern(s, A);
+        s->marker.assign(n, -1);
+        break;
+      case kPreconditionerJacobi:
+        s->inv_diag.assign(n, 1.0);
+        break;
+      default:
+        break;
+    }
+    s->r.assign(n, 0.0);
+    s->w.assign(n, 0.0);
+    s->z.assign(n, 0.0);
+    if (opts->method == kLinearSolverGmres) {
+      int m = opts->restart;
+      s->v.assign((size_t)(m + 1) * n, 0.0);
+      s->h.assign((size_t)m * (m + 1), 0.0);
+      s->cs.assign(m, 0.0);
+      s->sn.assign(m, 0.0);
+      s->g.assign(m + 1, 0.0);
+      s->y.assign(m, 0.0);
+    } else {
+      s->r_hat.assign(n, 0.0);
+      s->p.assign(n, 0.0);
+      s->s.assign(n, 0.0);
+      s->t.assign(n, 0.0);
+      s->u.assign(n, 0.0);
+    }
+  } catch (...) {
+    delete s;
+    return nullptr;
+  }
+  return s;
+}
+
+void KrylovSolverFree(KrylovSolver* s) { delete s; }
+
+int KrylovSolverSetup(KrylovSolver* s, const SparseMatrix* A) {
+  if (!s || !A || A->n != s->n || A->nnz != s->nnz) return -1;
+
+  switch (s->opts.preconditioner) {
+    case kPreconditionerJacobi:
+      for (int i = 0; i < s->n; i++) s->inv_diag[i] = 1.0;
+      for (int j = 0; j < A->n; j++) {
+        for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+          if (A->row_idx[p] == j && A->values[p] != 0.0) {
+            s->inv_diag[j] = 1.0 / A->values[p];
+          }
+        }
+      }
+      break;
+    case kPreconditionerIlu0:
+      std::fill(s->csr.begin(), s->csr.end(), 0.0);
+      for (int p = 0; p < A->nnz; p++) s->csr[s->csr_pos[p]] = A->values[p];
+      FactorIlu0(s);
+      break;
+    default:
+      break;
+  }
+  return 0;
+}
+
+int KrylovSolverSolve(KrylovSolver* s, const SparseMatrix* A, const double* b,
+                      double* x) {
+  if (!s || !A || !b || !x || A->n != s->n) return -1;
+
+  double target = s->opts.tol * Norm(s->n, b);
+  if (target == 0.0) {
+    memset(x, 0, s->n * sizeof(double));
+    return 0;
+  }
+  if (s->opts.method == kLinearSolverGmres) {
+    return SolveGmres(s, A, b, x, target);
+  }
+  return SolveBicgstab(s, A, b, x, target);
+}
+
+long KrylovSolverNnz(const KrylovSolver* s) {
+  if (!s) return 0;
+  switch (s->opts.preconditioner) {
+    case kPreconditionerIlu0:
+      return (long)s->csr.size();
+    case kPreconditionerJacobi:
+      return s->n;
+    default:
+      return 0;
+  }
+}
+
+}  // namespace minispice
@@ -0,0 +1,95 @@
+// krylov.h
+// Preconditioned Krylov solvers for large sparse MNA systems
+//
+// The direct sparse LU stores the fill-in of its factors, which on meshes
+// (power grids, substrate networks) grows much faster than the matrix. The
+// iterative solvers here keep only the matrix, a preconditioner with the
+// pattern of the matrix and a few vectors, so their memory scales with nnz:
+//
+//   GMRES     Restarted GMRES(m) with modified Gram-Schmidt and Givens
+//             rotations; robust on the nonsymmetric MNA matrices
+//   BiCGStab  Short recurrences, two matrix products per iteration and no
+//             basis storage
+//
+// Both are right-preconditioned, so the convergence test is on the true
+// residual ||b - A x|| <= tol ||b||. Preconditioners:
+//
+//   Jacobi  Inverse of the diagonal (1 where it is zero, e.g., the branch
+//           rows of voltage sources); for diagonally dominant grids
+//   ILU(0)  Incomplete LU on the pattern of the matrix plus its diagonal.
+//           With the node variables numbered before the branch currents the
+//           elimination of the nodes fills the zero branch diagonals; pivots
+//           that stay (near) zero are replaced by a small fraction of their
+//           row's largest entry.
+//
+// A SimWorkspace uses these when the circuit selects an iterative method
+// (Circuit::linear_solver), starting each solve from the previous solution.
+
+#ifndef MINI_SPICE_KRYLOV_H_
+#define MINI_SPICE_KRYLOV_H_
+
+namespace minispice {
+
+struct SparseMatrix;
+
+enum LinearSolverMethod {
+  kLinearSolverDirect = 0,  // Dense or sparse LU (see workspace.h)
+  kLinearSolverGmres,
+  kLinearSolverBicgstab,
+};
+
+enum Preconditioner {
+  kPreconditionerNone = 0,
+  kPreconditionerJacobi,
+  kPreconditionerIlu0,
+};
+
+// Linear solver of the analyses
+struct LinearSolverOptions {
+  LinearSolverMethod method;
+  Preconditioner preconditioner;  // Iterative methods only
+  double tol;    // Relative residual ||b - A x|| / ||b|| to reach
+  int max_iter;  // Krylov iterations per solve
+  int restart;   // GMRES: basis vectors between restarts
+  int threads;   // Direct sparse: workers of the block solves (see btf.h);
+                 // <= 0 for the hardware threads
+  int mixed_precision;  // Direct dense: 1 to factor in float and refine the
+                        // solutions in double (see workspace.h)
+};
+
+// Direct solve in double on one thread; GMRES settings ILU(0), tol 1e-10, 1000
+// iterations, restart 50 once an iterative method is picked (set by
+// circuit_create)
+extern const LinearSolverOptions kDefaultLinearSolverOptions;
+
+// Opaque Krylov solver: preconditioner storage and iteration vectors for
+// one sparse pattern
+struct KrylovSolver;
+
+// Create a solver for matrices with the pattern of A (opts->method must be
+// iterative).
+// Returns nullptr on invalid options or allocation failure.
+KrylovSolver* KrylovSolverCreate(const SparseMatrix* A,
+                                 const LinearSolverOptions* opts);
+
+// Free a solver
+void KrylovSolverFree(KrylovSolver* s);
+
+// Compute the preconditioner of the values of A (the pattern of creation).
+// Returns 0 on success, -1 if A does not have the pattern of creation.
+int KrylovSolverSetup(KrylovSolver* s, const SparseMatrix* A);
+
+// Solve A x = b with the preconditioner of the last setup. x holds the
+// initial guess on entry (e.g., the previous solution) and the solution on
+// return; b and x are length n and may not alias.
+// Returns the number of iterations, or -1 if the residual did not reach
+// tol within max_iter iterations (x then holds the last iterate).
+int KrylovSolverSolve(KrylovSolver* s, const SparseMatrix* A, const double* b,
+                      double* x);
+
+// Stored entries of the preconditioner (0 for none, n for Jacobi)
+long KrylovSolverNnz(const KrylovSolver* s);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_KRYLOV_H_
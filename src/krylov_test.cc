@@ -0,0 +1,198 @@
+// krylov_test.cc
+// Unit tests for the preconditioned Krylov solvers and their use by the
+// analysis workspace
+
+#include "krylov.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "circuit.h"
+#include "parser.h"
+#include "sparse.h"
+#include "transient.h"
+#include "workspace.h"
+
+using namespace minispice;
+
+// Conductance matrix of a k x k resistor mesh (1 S branches) with 1 mS from
+// every node to ground, plus a few nonsymmetric couplings
+static SparseMatrix* MeshMatrix(int k) {
+  std::vector<Triplet> t;
+  auto branch = [&](int a, int b) {
+    t.push_back({a, a, 1.0});
+    t.push_back({b, b, 1.0});
+    t.push_back({a, b, -1.0});
+    t.push_back({b, a, -1.0});
+  };
+  for (int i = 0; i < k; i++) {
+    for (int j = 0; j < k; j++) {
+      int node = i * k + j;
+      t.push_back({node, node, 1e-3});
+      if (j + 1 < k) branch(node, node + 1);
+      if (i + 1 < k) branch(node, node + k);
+      if (node % 7 == 0 && node + 1 < k * k) t.push_back({node, node + 1, 0.1});
+    }
+  }
+  return SparseCreateFromTriplets(k * k, t.data(), t.size());
+}
+
+static double ResidualNorm(const SparseMatrix* A, const std::vector<double>& x,
+                           const std::vector<double>& b) {
+  std::vector<double> r(b);
+  for (int j = 0; j < A->n; j++) {
+    for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+      r[A->row_idx[p]] -= A->values[p] * x[j];
+    }
+  }
+  double norm = 0.0;
+  for (double v : r) norm += v * v;
+  return sqrt(norm);
+}
+
+TEST(KrylovTest, EveryMethodAndPreconditionerSolvesMesh) {
+  SparseMatrix* A = MeshMatrix(20);
+  ASSERT_NE(A, nullptr);
+  int n = A->n;
+  std::vector<double> b(n, 0.0);
+  b[0] = 1.0;
+  b[n - 1] = -0.5;
+  double b_norm = sqrt(1.25);
+
+  const LinearSolverMethod methods[] = {kLinearSolverGmres,
+                                        kLinearSolverBicgstab};
+  const Preconditioner preconditioners[] = {
+      kPreconditionerNone, kPreconditionerJacobi, kPreconditionerIlu0};
+  int iterations[2][3];
+  for (int m = 0; m < 2; m++) {
+    for (int p = 0; p < 3; p++) {
+      LinearSolverOptions opts = kDefaultLinearSolverOptions;
+      opts.method = methods[m];
+      opts.preconditioner = preconditioners[p];
+      opts.max_iter = 5000;
+      KrylovSolver* s = KrylovSolverCreate(A, &opts);
+      ASSERT_NE(s, nullptr);
+      ASSERT_EQ(KrylovSolverSetup(s, A), 0);
+
+      std::vector<double> x(n, 0.0);
+      iterations[m][p] = KrylovSolverSolve(s, A, b.data(), x.data());
+      EXPECT_GT(iterations[m][p], 0) << m << " " << p;
+      EXPECT_LE(ResidualNorm(A, x, b), 1e-10 * b_norm * 1.0001);
+
+      // Warm start from the solution: nothing left to do
+      EXPECT_EQ(KrylovSolverSolve(s, A, b.data(), x.data()), 0);
+      KrylovSolverFree(s);
+    }
+    // ILU(0) beats no preconditioning
+    EXPECT_LT(iterations[m][2], iterations[m][0]);
+  }
+
+  SparseFree(A);
+}
+
+TEST(KrylovTest, Ilu0HandlesZeroDiagonals) {
+  // MNA of a 1 V source driving 1 k to ground: the branch row has no
+  // diagonal entry
+  std::vector<Triplet> t = {{0, 0, 1e-3}, {0, 1, 1.0}, {1, 0, 1.0}};
+  SparseMatrix* A = SparseCreateFromTriplets(2, t.data(), t.size());
+  LinearSolverOptions opts = kDefaultLinearSolverOptions;
+  opts.method = kLinearSolverGmres;
+  KrylovSolver* s = KrylovSolverCreate(A, &opts);
+  ASSERT_NE(s, nullptr);
+  ASSERT_EQ(KrylovSolverSetup(s, A), 0);
+  EXPECT_EQ(KrylovSolverNnz(s), 4);  // Diagonal added
+
+  double b[2] = {0.0, 1.0};
+  double x[2] = {0.0, 0.0};
+  ASSERT_GE(KrylovSolverSolve(s, A, b, x), 0);
+  EXPECT_NEAR(x[0], 1.0, 1e-9);
+  EXPECT_NEAR(x[1], -1e-3, 1e-12);
+  KrylovSolverFree(s);
+  SparseFree(A);
+}
+
+TEST(KrylovTest, InvalidOptionsAndNonConvergence) {
+  SparseMatrix* A = MeshMatrix(10);
+  LinearSolverOptions opts = kDefaultLinearSolverOptions;
+  EXPECT_EQ(KrylovSolverCreate(A, &opts), nullptr);  // Direct
+  opts.method = kLinearSolverGmres;
+  opts.restart = 0;
+  EXPECT_EQ(KrylovSolverCreate(A, &opts), nullptr);
+
+  opts.restart = 5;
+  opts.max_iter = 3;
+  opts.preconditioner = kPreconditionerNone;
+  KrylovSolver* s = KrylovSolverCreate(A, &opts);
+  ASSERT_NE(s, nullptr);
+  ASSERT_EQ(KrylovSolverSetup(s, A), 0);
+  std::vector<double> b(A->n, 1.0), x(A->n, 0.0);
+  EXPECT_EQ(KrylovSolverSolve(s, A, b.data(), x.data()), -1);
+  KrylovSolverFree(s);
+  SparseFree(A);
+}
+
+// RC ladder of n stages driven by V1, with a diode clamp at the end
+static std::string LadderNetlist(int n, const char* source) {
+  std::string netlist = std::string("V1 n0 0 ") + source + "\n";
+  for (int k = 0; k < n; k++) {
+    std::string a = "n" + std::to_string(k), b = "n" + std::to_string(k + 1);
+    netlist += "R" + std::to_string(k) + " " + a + " " + b + " 100\n";
+    netlist += "C" + std::to_string(k) + " " + b + " 0 1p\n";
+  }
+  netlist += "RL n" + std::to_string(n) + " 0 10k\n";
+  netlist += "D1 n" + std::to_string(n) + " 0 Is=1e-14 n=1\n";
+  return netlist;
+}
+
+TEST(KrylovTest, WorkspaceDcAndTransientMatchDirect) {
+  for (LinearSolverMethod method :
+       {kLinearSolverGmres, kLinearSolverBicgstab}) {
+    // Operating point
+    std::string netlist = LadderNetlist(150, "1");
+    Circuit* direct = parse_netlist_string(netlist.c_str());
+    Circuit* iterative = parse_netlist_string(netlist.c_str());
+    ASSERT_NE(direct, nullptr);
+    ASSERT_NE(iterative, nullptr);
+    iterative->linear_solver.method = method;
+    iterative->linear_solver.tol = 1e-13;
+    int n = direct->num_vars;
+    std::vector<double> x(n, 0.0), y(n, 0.0);
+    ASSERT_GT(CircuitDcAnalysis(direct, x.data(), 100, 1e-12, 1e-9), 0);
+    ASSERT_GT(CircuitDcAnalysis(iterative, y.data(), 100, 1e-12, 1e-9), 0);
+    for (int i = 0; i < n; i++) EXPECT_NEAR(y[i], x[i], 1e-7);
+
+    SimStats s;
+    SimWorkspaceGetStats(iterative->workspace, &s);
+    EXPECT_GT(s.krylov_iterations, 0);
+    EXPECT_EQ(s.sparse, 1);
+    EXPECT_LE(s.lu_nnz, s.matrix_nnz + n);  // No fill-in
+
+    circuit_free(direct);
+    circuit_free(iterative);
+
+    // Pulse response
+    netlist = LadderNetlist(150, "PULSE(0 1 0 1n 1n 1u 2u)");
+    direct = parse_netlist_string(netlist.c_str());
+    iterative = parse_netlist_string(netlist.c_str());
+    ASSERT_NE(direct, nullptr);
+    ASSERT_NE(iterative, nullptr);
+    iterative->linear_solver.method = method;
+    iterative->linear_solver.tol = 1e-13;
+    TransientOptions opts;
+    TransientOptionsInit(&opts, 2e-9, 100e-9);
+    ASSERT_GT(CircuitTransientAnalysis(direct, nullptr, &opts, x.data(),
+                                       nullptr, nullptr, nullptr),
+              0);
+    ASSERT_GT(CircuitTransientAnalysis(iterative, nullptr, &opts, y.data(),
+                                       nullptr, nullptr, nullptr),
+              0);
+    for (int i = 0; i < n; i++) EXPECT_NEAR(y[i], x[i], 1e-6);
+
+    circuit_free(direct);
+    circuit_free(iterative);
+  }
+}
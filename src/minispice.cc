@@ -3,12 +3,24 @@
 // Command-line interface for the mini-spice simulator.
 //
 
+#include <cmath>
+#include <complex>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include "ac.h"
 #include "circuit.h"
+#include "device.h"
+#include "device_batch.h"
 #include "parser.h"
+#include "sim_stats.h"
+#include "snapshot.h"
+#include "sweep.h"
+#include "table_model.h"
+#include "transient.h"
+#include "waveform.h"
+#include "workspace.h"
 
 namespace minispice {
 
@@ -20,6 +32,380 @@ static void print_usage(const char* prog) {
   printf("  --max-iter N   Maximum NR iterations (default: 100)\n");
   printf("  --tol-abs T    Absolute tolerance (default: 1e-9)\n");
   printf("  --tol-rel T    Relative tolerance (default: 1e-6)\n");
+  printf("  --threads N    Worker threads for .DC sweeps and .AC points\n");
+  printf("                 (default: 1)\n");
+  printf("  --save-snapshot FILE\n");
+  printf("                 Write a binary snapshot of the parsed circuit;\n");
+  printf("                 snapshots are accepted in place of netlists\n");
+  printf("  --table-models Evaluate diodes and MOSFETs from interpolation\n");
+  printf("                 tables (faster, approximate)\n");
+  printf("  --no-limiting  Disable junction voltage limiting in Newton\n");
+  printf("  --damping MODE Newton update damping: none (default), max-step\n");
+  printf("                 or line-search\n");
+  printf("  --no-bypass    Re-evaluate every device in every Newton "
+         "iteration\n");
+  printf("  --stats FILE   Write profiling statistics as JSON (- for "
+         "stdout)\n");
+  printf("  --wave FILE    Write .DC, .AC and .TRAN results to a binary\n");
+  printf("                 waveform file instead of printing them\n");
+  printf("  --wave-format FORMAT\n");
+  printf("                 Waveform format: chunked (default) or raw (SPICE\n");
+  printf("                 raw, as read by ngspice and waveform viewers)\n");
+  printf("  --wave-float32 Store chunked waveforms in single precision\n");
+  printf("  --wave-compress\n");
+  printf("                 Compress chunked waveforms without loss\n");
+  printf("  --save LIST    Waveform variables, e.g. \"V(out),I(V1)\"\n");
+  printf("                 (default: all)\n");
+  printf("  --solver METHOD Linear solver: direct (LU, default), gmres or\n");
+  printf("                 bicgstab (preconditioned Krylov, memory linear\n");
+  printf("                 in the matrix size)\n");
+  printf("  --precond TYPE Krylov preconditioner: ilu0 (default), jacobi or\n");
+  printf("                 none\n");
+  printf("  --solver-tol T Krylov relative residual (default: 1e-10)\n");
+  printf("  --solver-restart M, --solver-maxiter N\n");
+  printf("                 GMRES restart length (default: 50) and Krylov\n");
+  printf("                 iteration limit per solve (default: 1000)\n");
+  printf("  --solver-threads N\n");
+  printf("                 Workers of the block-wise sparse LU, for\n");
+  printf("                 netlists of independent sub-networks (default:\n");
+  printf("                 1; 0 for all cores)\n");
+  printf("  --mixed-precision\n");
+  printf("                 Factor dense systems (direct solver, fewer than\n");
+  printf("                 %d variables) in float and refine the solutions\n",
+         kSparseSolverThreshold);
+  printf("                 in double; --stats reports whether it applied\n");
+  printf("  --stamp-threads N\n");
+  printf("                 Threads the device stamps of large circuits are\n");
+  printf("                 evaluated on; results do not depend on it\n");
+  printf("                 (default: 1; 0 for all cores)\n");
+  printf("  --no-gmin-stepping, --no-source-stepping\n");
+  printf("                 Disable a DC continuation fallback for operating\n");
+  printf("                 points Newton alone does not converge to\n");
+  printf("\nThe batched diode exponentials use an AVX2 kernel on CPUs that\n");
+  printf("have it (here: %s)\n",
+         ExpBatchIsVectorized() ? "AVX2" : "C library exp");
+}
+
+// Print the column label prefix(name) right-aligned in 14 characters
+static void print_label(const char* prefix, const char* name) {
+  int len = (int)(strlen(prefix) + strlen(name) + 2);
+  printf("%*s%s(%s)", len < 14 ? 14 - len : 0, "", prefix, name);
+}
+
+// Print the V(node) and I(device) column labels of a result table row
+static void print_solution_header(Circuit* c) {
+  for (int i = 1; i < c->num_nodes; i++) {
+    print_label("V", c->nodes[i].name);
+  }
+  for (Device* d = c->devices; d; d = d->next) {
+    if (d->extra_var >= 0) print_label("I", d->name);
+  }
+  printf("\n");
+}
+
+// Print the solution values of a result table row
+static void print_solution_row(Circuit* c, const double* x) {
+  for (int i = 1; i < c->num_nodes; i++) {
+    printf("%14.6g", x[c->nodes[i].var_index]);
+  }
+  for (Device* d = c->devices; d; d = d->next) {
+    if (d->extra_var >= 0) printf("%14.6g", x[d->extra_var]);
+  }
+  printf("\n");
+}
+
+// Print the column header of the .DC sweep table
+static void print_sweep_header(Circuit* c) {
+  for (int k = 0; k < c->num_dc_sweeps; k++) {
+    printf("%14s", c->dc_sweeps[k].source);
+  }
+  print_solution_header(c);
+}
+
+// Print one row of the .DC sweep table
+static void print_sweep_point(void* user, const double* values,
+                              const double* x, int num_vars) {
+  Circuit* c = static_cast<Circuit*>(user);
+  (void)num_vars;
+  for (int k = 0; k < c->num_dc_sweeps; k++) {
+    printf("%14.6g", values[k]);
+  }
+  print_solution_row(c, x);
+}
+
+// Print one row of the .TRAN table (from tstart on)
+static void print_tran_point(void* user, double t, const double* x,
+                             int num_vars) {
+  Circuit* c = static_cast<Circuit*>(user);
+  (void)num_vars;
+  if (t < c->tran.tstart) return;
+  printf("%14.6g", t);
+  print_solution_row(c, x);
+}
+
+// Waveform file output of one analysis
+struct WaveOutput {
+  Circuit* c;
+  WaveformWriter* writer;
+  WaveformSelection sel;
+  int num_scales;  // Leading columns: time, or the values of the sweeps
+  double* row;     // num_scales + sel.num_vars values of a point
+  int failed;      // 1 once a write has failed
+};
+
+// Open the waveform plot plot_name with the num_scales leading columns
+// scales and the variables selected by save.
+// Returns 0 on success, -1 on error.
+static int open_wave_output(WaveOutput* out, Circuit* c, const char* path,
+                            const WaveformOptions* opts, const char* save,
+                            const char* plot_name, int num_scales,
+                            const char* const* scales) {
+  memset(out, 0, sizeof(*out));
+  out->c = c;
+  out->num_scales = num_scales;
+  if (CircuitSelectWaveform(c, save, &out->sel) != 0) return -1;
+
+  int num_vars = num_scales + out->sel.num_vars;
+  const char** names = (const char**)malloc(num_vars * sizeof(char*));
+  out->row = (double*)malloc(num_vars * sizeof(double));
+  if (names && out->row) {
+    for (int k = 0; k < num_scales; k++) names[k] = scales[k];
+    for (int v = 0; v < out->sel.num_vars; v++) {
+      names[num_scales + v] = out->sel.names[v];
+    }
+    out->writer = WaveformWriterOpen(path, plot_name, num_vars, names, opts);
+  }
+  free(names);
+  if (!out->writer) {
+    fprintf(stderr, "Error: Cannot write waveform file: %s\n", path);
+    WaveformSelectionRelease(&out->sel);
+    free(out->row);
+    return -1;
+  }
+  return 0;
+}
+
+// Append one point: the scale values and the selected variables of x
+static void write_wave_point(WaveOutput* out, const double* scales,
+                             const double* x) {
+  for (int k = 0; k < out->num_scales; k++) out->row[k] = scales[k];
+  for (int v = 0; v < out->sel.num_vars; v++) {
+    out->row[out->num_scales + v] = x[out->sel.var_index[v]];
+  }
+  if (WaveformWriterAppend(out->writer, out->row) != 0) out->failed = 1;
+}
+
+// Complete the waveform plot and free out.
+// Returns 0 on success, -1 if a write failed.
+static int close_wave_output(WaveOutput* out, const char* path) {
+  int result = WaveformWriterClose(out->writer) == 0 && !out->failed ? 0 : -1;
+  if (result != 0) {
+    fprintf(stderr, "Error: Failed to write waveform file: %s\n", path);
+  }
+  WaveformSelectionRelease(&out->sel);
+  free(out->row);
+  return result;
+}
+
+// Write one .DC sweep point to the waveform file
+static void wave_sweep_point(void* user, const double* values,
+                             const double* x, int num_vars) {
+  (void)num_vars;
+  write_wave_point(static_cast<WaveOutput*>(user), values, x);
+}
+
+// Write one .TRAN point (from tstart on) to the waveform file
+static void wave_tran_point(void* user, double t, const double* x,
+                            int num_vars) {
+  WaveOutput* out = static_cast<WaveOutput*>(user);
+  (void)num_vars;
+  if (t < out->c->tran.tstart) return;
+  write_wave_point(out, &t, x);
+}
+
+// Write the .AC results to the waveform plot "AC Analysis": the frequency,
+// then the magnitude and the phase in degrees of every selected variable
+// (VM(node), VP(node), IM(device), IP(device)).
+// Returns 0 on success, -1 on error.
+static int write_ac_wave(Circuit* c, const std::complex<double>* results,
+                         int points, const char* path,
+                         const WaveformOptions* opts, const char* save) {
+  WaveformSelection sel;
+  if (CircuitSelectWaveform(c, save, &sel) != 0) return -1;
+
+  int num_vars = 1 + 2 * sel.num_vars;
+  char(*labels)[kWaveformNameLen] =
+      (char(*)[kWaveformNameLen])malloc(num_vars * kWaveformNameLen);
+  const char** names = (const char**)malloc(num_vars * sizeof(char*));
+  double* row = (double*)malloc(num_vars * sizeof(double));
+  WaveformWriter* writer = nullptr;
+  if (labels && names && row) {
+    names[0] = "frequency";
+    for (int v = 0; v < sel.num_vars; v++) {
+      // V(out) -> VM(out), VP(out)
+      const char* name = sel.names[v];
+      snprintf(labels[2 * v + 1], kWaveformNameLen, "%cM%s", name[0],
+               name + 1);
+      snprintf(labels[2 * v + 2], kWaveformNameLen, "%cP%s", name[0],
+               name + 1);
+      names[2 * v + 1] = labels[2 * v + 1];
+      names[2 * v + 2] = labels[2 * v + 2];
+    }
+    writer = WaveformWriterOpen(path, "AC Analysis", num_vars, names, opts);
+  }
+  int result = writer ? 0 : -1;
+  if (!writer) fprintf(stderr, "Error: Cannot write waveform file: %s\n", path);
+
+  for (int p = 0; writer && p < points; p++) {
+    const std::complex<double>* x = results + (size_t)p * c->num_vars;
+    row[0] = AcSweepFrequency(&c->ac, p);
+    for (int v = 0; v < sel.num_vars; v++) {
+      std::complex<double> value = x[sel.var_index[v]];
+      row[2 * v + 1] = std::abs(value);
+      row[2 * v + 2] = std::arg(value) * 180.0 / M_PI;
+    }
+    if (WaveformWriterAppend(writer, row) != 0) result = -1;
+  }
+  if (writer && WaveformWriterClose(writer) != 0) result = -1;
+  if (writer && result != 0) {
+    fprintf(stderr, "Error: Failed to write waveform file: %s\n", path);
+  }
+
+  free(row);
+  free(names);
+  free(labels);
+  WaveformSelectionRelease(&sel);
+  return result;
+}
+
+// Print the .AC results: the frequency, then the magnitude and the phase in
+// degrees of every node voltage and branch current
+static void print_ac_results(Circuit* c, const std::complex<double>* results,
+                             int points) {
+  printf("%14s", "frequency");
+  for (int i = 1; i < c->num_nodes; i++) {
+    print_label("VM", c->nodes[i].name);
+    print_label("VP", c->nodes[i].name);
+  }
+  for (Device* d = c->devices; d; d = d->next) {
+    if (d->extra_var >= 0) {
+      print_label("IM", d->name);
+      print_label("IP", d->name);
+    }
+  }
+  printf("\n");
+
+  for (int p = 0; p < points; p++) {
+    const std::complex<double>* x = results + (size_t)p * c->num_vars;
+    printf("%14.6g", AcSweepFrequency(&c->ac, p));
+    for (int i = 1; i < c->num_nodes; i++) {
+      std::complex<double> v = x[c->nodes[i].var_index];
+      printf("%14.6g%14.6g", std::abs(v), std::arg(v) * 180.0 / M_PI);
+    }
+    for (Device* d = c->devices; d; d = d->next) {
+      if (d->extra_var < 0) continue;
+      std::complex<double> i = x[d->extra_var];
+      printf("%14.6g%14.6g", std::abs(i), std::arg(i) * 180.0 / M_PI);
+    }
+    printf("\n");
+  }
+}
+
+// Run the .AC sweep at the DC operating point, its frequencies on a worker
+// pool of threads threads, and print or write the results.
+// Returns the number of points, or -1 on error.
+static int run_ac_sweep(Circuit* c, int threads, int max_iter, double tol_abs,
+                        double tol_rel, SimStats* stats, const char* wave_file,
+                        const WaveformOptions* wave_opts, const char* save) {
+  int total = AcSweepNumPoints(&c->ac);
+  if (total <= 0) return -1;
+
+  double* x_op = (double*)calloc(c->num_vars, sizeof(double));
+  std::complex<double>* results = (std::complex<double>*)malloc(
+      (size_t)total * c->num_vars * sizeof(std::complex<double>));
+  if (!x_op || !results) {
+    free(x_op);
+    free(results);
+    return -1;
+  }
+
+  int points = -1;
+  if (CircuitDcAnalysis(c, x_op, max_iter, tol_abs, tol_rel) >= 0) {
+    ThreadPool* pool = threads > 1 ? ThreadPoolCreate(threads) : nullptr;
+    if (threads <= 1 || pool) {
+      SimStats ac_stats;
+      points = CircuitAcAnalysis(c, pool, &c->ac, x_op, results, &ac_stats);
+      SimStatsAdd(stats, &ac_stats);
+    }
+    ThreadPoolFree(pool);
+  }
+
+  if (points > 0) {
+    if (wave_file) {
+      if (write_ac_wave(c, results, points, wave_file, wave_opts, save) != 0) {
+        points = -1;
+      }
+    } else {
+      print_ac_results(c, results, points);
+    }
+  }
+
+  free(results);
+  free(x_op);
+  return points;
+}
+
+// Solve the .DC sweep on a worker pool and pass the points to cb in point
+// order
+static int run_parallel_sweep(Circuit* c, int threads, int max_iter,
+                              double tol_abs, double tol_rel,
+                              SimStats* stats, DcSweepCallback cb,
+                              void* user) {
+  int total = DcSweepTotalPoints(c->dc_sweeps, c->num_dc_sweeps);
+  if (total <= 0) return -1;
+
+  ThreadPool* pool = ThreadPoolCreate(threads);
+  double* results =
+      (double*)malloc((size_t)total * c->num_vars * sizeof(double));
+  int points = -1;
+  if (pool && results) {
+    points = CircuitDcSweepParallel(c, pool, c->dc_sweeps, c->num_dc_sweeps,
+                                    results, max_iter, tol_abs, tol_rel,
+                                    stats);
+  }
+  for (int p = 0; p < points; p++) {
+    double values[kMaxDcSweeps];
+    DcSweepPointValues(c->dc_sweeps, c->num_dc_sweeps, p, values);
+    cb(user, values, results + (size_t)p * c->num_vars, c->num_vars);
+  }
+
+  free(results);
+  ThreadPoolFree(pool);
+  return points;
+}
+
+// Write the --stats report: load and analysis times and the statistics of
+// the default workspace and of the parallel sweep workers.
+// Returns 0 on success, -1 on error.
+static int write_stats(const char* path, Circuit* c, const SimStats* workers,
+                       double load_seconds, double analysis_seconds) {
+  FILE* f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "Error: Cannot write stats file: %s\n", path);
+    return -1;
+  }
+  SimStats s;
+  SimWorkspaceGetStats(c->workspace, &s);
+  SimStatsAdd(&s, workers);
+  fprintf(f, "{\n  \"load_seconds\": %.9g,\n", load_seconds);
+  fprintf(f, "  \"analysis_seconds\": %.9g,\n", analysis_seconds);
+  fprintf(f, "  \"simulation\": ");
+  int result = SimStatsWriteJson(&s, f, 2);
+  fprintf(f, "\n}\n");
+  if (ferror(f)) result = -1;
+  if (f != stdout && fclose(f) != 0) result = -1;
+  if (result != 0) fprintf(stderr, "Error: Failed to write stats\n");
+  return result;
 }
 
 int main(int argc, char** argv) {
@@ -33,6 +419,17 @@ int main(int argc, char** argv) {
   int max_iter = 100;
   double tol_abs = 1e-9;
   double tol_rel = 1e-6;
+  int threads = 1;
+  const char* snapshot_file = nullptr;
+  bool table_models = false;
+  NewtonPolicy newton = kDefaultNewtonPolicy;
+  LinearSolverOptions linear_solver = kDefaultLinearSolverOptions;
+  int stamp_threads = 1;
+  const char* stats_file = nullptr;
+  const char* wave_file = nullptr;
+  const char* wave_save = nullptr;
+  WaveformOptions wave_opts;
+  WaveformOptionsInit(&wave_opts);
 
   // Parse arguments
   for (int i = 1; i < argc; i++) {
@@ -48,6 +445,92 @@ int main(int argc, char** argv) {
       tol_abs = atof(argv[++i]);
     } else if (strcmp(argv[i], "--tol-rel") == 0 && i + 1 < argc) {
       tol_rel = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--save-snapshot") == 0 && i + 1 < argc) {
+      snapshot_file = argv[++i];
+    } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+      stats_file = argv[++i];
+    } else if (strcmp(argv[i], "--wave") == 0 && i + 1 < argc) {
+      wave_file = argv[++i];
+    } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+      wave_save = argv[++i];
+    } else if (strcmp(argv[i], "--wave-float32") == 0) {
+      wave_opts.float32 = 1;
+    } else if (strcmp(argv[i], "--wave-compress") == 0) {
+      wave_opts.compress = 1;
+    } else if (strcmp(argv[i], "--wave-format") == 0 && i + 1 < argc) {
+      const char* format = argv[++i];
+      if (strcmp(format, "chunked") == 0) {
+        wave_opts.format = kWaveformChunked;
+      } else if (strcmp(format, "raw") == 0) {
+        wave_opts.format = kWaveformRaw;
+      } else {
+        fprintf(stderr, "Unknown waveform format: %s\n", format);
+        print_usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--table-models") == 0) {
+      table_models = true;
+    } else if (strcmp(argv[i], "--no-limiting") == 0) {
+      newton.limit_junctions = 0;
+    } else if (strcmp(argv[i], "--no-bypass") == 0) {
+      newton.bypass = 0;
+    } else if (strcmp(argv[i], "--no-gmin-stepping") == 0) {
+      newton.gmin_stepping = 0;
+    } else if (strcmp(argv[i], "--no-source-stepping") == 0) {
+      newton.source_stepping = 0;
+    } else if (strcmp(argv[i], "--solver") == 0 && i + 1 < argc) {
+      const char* method = argv[++i];
+      if (strcmp(method, "direct") == 0) {
+        linear_solver.method = kLinearSolverDirect;
+      } else if (strcmp(method, "gmres") == 0) {
+        linear_solver.method = kLinearSolverGmres;
+      } else if (strcmp(method, "bicgstab") == 0) {
+        linear_solver.method = kLinearSolverBicgstab;
+      } else {
+        fprintf(stderr, "Unknown linear solver: %s\n", method);
+        print_usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--precond") == 0 && i + 1 < argc) {
+      const char* precond = argv[++i];
+      if (strcmp(precond, "ilu0") == 0) {
+        linear_solver.preconditioner = kPreconditionerIlu0;
+      } else if (strcmp(precond, "jacobi") == 0) {
+        linear_solver.preconditioner = kPreconditionerJacobi;
+      } else if (strcmp(precond, "none") == 0) {
+        linear_solver.preconditioner = kPreconditionerNone;
+      } else {
+        fprintf(stderr, "Unknown preconditioner: %s\n", precond);
+        print_usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--solver-tol") == 0 && i + 1 < argc) {
+      linear_solver.tol = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--solver-restart") == 0 && i + 1 < argc) {
+      linear_solver.restart = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--solver-maxiter") == 0 && i + 1 < argc) {
+      linear_solver.max_iter = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--solver-threads") == 0 && i + 1 < argc) {
+      linear_solver.threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--mixed-precision") == 0) {
+      linear_solver.mixed_precision = 1;
+    } else if (strcmp(argv[i], "--stamp-threads") == 0 && i + 1 < argc) {
+      stamp_threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--damping") == 0 && i + 1 < argc) {
+      const char* mode = argv[++i];
+      if (strcmp(mode, "none") == 0) {
+        newton.damping = kNewtonDampingNone;
+      } else if (strcmp(mode, "max-step") == 0) {
+        newton.damping = kNewtonDampingMaxStep;
+      } else if (strcmp(mode, "line-search") == 0) {
+        newton.damping = kNewtonDampingLineSearch;
+      } else {
+        fprintf(stderr, "Unknown damping mode: %s\n", mode);
+        print_usage(argv[0]);
+        return 1;
+      }
     } else if (argv[i][0] != '-') {
       netlist_file = argv[i];
     } else {
@@ -63,19 +546,62 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  // Parse netlist
-  printf("Parsing netlist: %s\n", netlist_file);
-  Circuit* c = parse_netlist_file(netlist_file);
+  // Parse netlist, or restore a snapshot written by an earlier run
+  double t_start = SimClockSeconds();
+  Circuit* c = nullptr;
+  if (IsCircuitSnapshot(netlist_file)) {
+    printf("Loading snapshot: %s\n", netlist_file);
+    c = CircuitLoadSnapshot(netlist_file);
+  } else {
+    printf("Parsing netlist: %s\n", netlist_file);
+    c = parse_netlist_file(netlist_file);
+  }
   if (!c) {
     fprintf(stderr, "Error: Failed to parse netlist\n");
     return 1;
   }
 
+  if (snapshot_file) {
+    if (CircuitSaveSnapshot(c, snapshot_file) != 0) {
+      fprintf(stderr, "Error: Failed to write snapshot\n");
+      circuit_free(c);
+      return 1;
+    }
+    printf("Wrote snapshot: %s\n", snapshot_file);
+  }
+
+  c->newton = newton;
+  c->linear_solver = linear_solver;
+  if (linear_solver.mixed_precision &&
+      (c->num_vars >= kSparseSolverThreshold ||
+       linear_solver.method != kLinearSolverDirect)) {
+    fprintf(stderr,
+            "Warning: --mixed-precision applies only to the direct solver "
+            "on fewer than %d variables; solving in double\n",
+            kSparseSolverThreshold);
+  }
+  c->stamp_threads = stamp_threads;
+  c->profile = stats_file != nullptr;
+
+  if (table_models) {
+    int tables = CircuitEnableTableModels(c);
+    if (tables < 0) {
+      fprintf(stderr, "Error: Failed to build device tables\n");
+      circuit_free(c);
+      return 1;
+    }
+    if (verbose) printf("Device tables: %d\n", tables);
+  }
+
   if (verbose) {
     CircuitPrintSummary(c);
     printf("\n");
   }
 
+  double load_seconds = SimClockSeconds() - t_start;
+  SimStats sweep_stats;
+  SimStatsClear(&sweep_stats);
+
   // Allocate solution vector
   double* x = (double*)calloc(c->num_vars, sizeof(double));
   if (!x) {
@@ -84,29 +610,144 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  // Run the .DC sweep, .AC sweep and .TRAN analysis if requested,
+  // otherwise the operating point
+  if (c->num_dc_sweeps > 0 || c->ac.points > 0 || c->tran.tstop > 0.0) {
+    int result = 0;
+    if (c->num_dc_sweeps > 0) {
+      printf("Running DC sweep...\n");
+      DcSweepCallback cb = print_sweep_point;
+      void* user = c;
+      WaveOutput wave;
+      if (wave_file) {
+        const char* scales[kMaxDcSweeps];
+        for (int k = 0; k < c->num_dc_sweeps; k++) {
+          scales[k] = c->dc_sweeps[k].source;
+        }
+        result = open_wave_output(&wave, c, wave_file, &wave_opts, wave_save,
+                                  "DC transfer characteristic",
+                                  c->num_dc_sweeps, scales);
+        cb = wave_sweep_point;
+        user = &wave;
+      } else {
+        print_sweep_header(c);
+      }
+      if (result >= 0) {
+        if (threads > 1) {
+          result = run_parallel_sweep(c, threads, max_iter, tol_abs, tol_rel,
+                                      &sweep_stats, cb, user);
+        } else {
+          result = CircuitDcSweep(c, nullptr, c->dc_sweeps, c->num_dc_sweeps,
+                                  x, max_iter, tol_abs, tol_rel, cb, user);
+        }
+        if (result < 0) fprintf(stderr, "Error: DC sweep failed\n");
+        if (wave_file && close_wave_output(&wave, wave_file) != 0) {
+          result = -1;
+        }
+      }
+    }
+
+    if (result >= 0 && c->ac.points > 0) {
+      printf("Running AC analysis...\n");
+      // After a .DC sweep the AC sweep is the second plot of the file
+      WaveformOptions ac_opts = wave_opts;
+      ac_opts.append = c->num_dc_sweeps > 0;
+      result = run_ac_sweep(c, threads, max_iter, tol_abs, tol_rel,
+                            &sweep_stats, wave_file, &ac_opts, wave_save);
+      if (result < 0) fprintf(stderr, "Error: AC analysis failed\n");
+    }
+
+    if (result >= 0 && c->tran.tstop > 0.0) {
+      printf("Running transient analysis...\n");
+      TransientOptions opts;
+      TransientOptionsInit(&opts, c->tran.tstep, c->tran.tstop);
+      opts.tmax = c->tran.tmax;
+      opts.max_iter = max_iter;
+      opts.tol_abs = tol_abs;
+      opts.tol_rel = tol_rel;
+
+      TransientCallback cb = print_tran_point;
+      void* user = c;
+      WaveOutput wave;
+      if (wave_file) {
+        // After a .DC or .AC sweep the transient is a later plot of the file
+        WaveformOptions tran_opts = wave_opts;
+        tran_opts.append = c->num_dc_sweeps > 0 || c->ac.points > 0;
+        const char* scale = "time";
+        result = open_wave_output(&wave, c, wave_file, &tran_opts, wave_save,
+                                  "Transient Analysis", 1, &scale);
+        cb = wave_tran_point;
+        user = &wave;
+      } else {
+        printf("%14s", "time");
+        print_solution_header(c);
+      }
+      TransientStats stats;
+      if (result >= 0) {
+        result =
+            CircuitTransientAnalysis(c, nullptr, &opts, x, cb, user, &stats);
+        if (result < 0) fprintf(stderr, "Error: Transient analysis failed\n");
+        if (wave_file && close_wave_output(&wave, wave_file) != 0) {
+          result = -1;
+        }
+      }
+      if (result >= 0 && verbose) {
+        printf("\n%d accepted step(s), %d rejected, %d Newton iteration(s)\n",
+               stats.accepted_steps, stats.rejected_steps,
+               stats.newton_iterations);
+        printf("%ld device evaluation(s), %ld bypassed\n",
+               stats.device_evaluations, stats.bypassed_evaluations);
+      }
+    }
+
+    if (stats_file &&
+        write_stats(stats_file, c, &sweep_stats, load_seconds,
+                    SimClockSeconds() - t_start - load_seconds) != 0) {
+      result = -1;
+    }
+    free(x);
+    circuit_free(c);
+    return result < 0 ? 1 : 0;
+  }
+
   // Run DC analysis
   printf("Running DC analysis...\n");
   int iterations = CircuitDcAnalysis(c, x, max_iter, tol_abs, tol_rel);
+  double analysis_seconds = SimClockSeconds() - t_start - load_seconds;
 
   if (iterations < 0) {
     fprintf(stderr, "Error: DC analysis failed\n");
-    free(x);
-    circuit_free(c);
-    return 1;
-  }
+  } else {
+    if (verbose) {
+      printf("Converged in %d iteration(s)\n", iterations);
+      if (c->workspace && c->workspace->dc_strategy != kDcNewton) {
+        printf("Converged by %s stepping\n",
+               c->workspace->dc_strategy == kDcGminStepping ? "gmin"
+                                                            : "source");
+      }
+      if (c->workspace) {
+        printf("%ld device evaluation(s), %ld bypassed\n",
+               c->workspace->eval_counts.evaluations,
+               c->workspace->eval_counts.bypassed);
+      }
+      printf("\n");
+    }
 
-  if (verbose) {
-    printf("Converged in %d iteration(s)\n\n", iterations);
+    // Print results
+    CircuitPrintSolution(c, x);
   }
 
-  // Print results
-  CircuitPrintSolution(c, x);
+  int result = iterations < 0 ? 1 : 0;
+  if (stats_file && write_stats(stats_file, c, &sweep_stats, load_seconds,
+                                analysis_seconds) != 0) {
+    result = 1;
+  }
 
   // Cleanup
   free(x);
   circuit_free(c);
 
-  return 0;
+  return result;
 }
 
 }  // namespace minispice
\ No newline at end of file
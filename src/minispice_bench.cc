@@ -0,0 +1,474 @@
+// minispice_bench.cc
+// Benchmarks of parsing, finalization, assembly, linear solves and full
+// analyses on synthetic circuits of 10 to 10^6 nodes
+//
+// Circuit families (the node count is the benchmark argument):
+//   mesh      square resistor mesh driven at one corner, loaded at the other
+//   ladder    RC ladder driven by a pulse
+//   diodes    diode array, each diode fed by its own resistor
+//   inverters chain of resistive-load NMOS inverters with load capacitors
+//
+// Each family is generated once per size as an element list, from which the
+// netlist text (parse benchmarks) or an unfinalized circuit built with the
+// device factories (finalize benchmarks) is derived. Run with
+// --benchmark_filter to select families or sizes, e.g.
+//   minispice_bench --benchmark_filter='DcAnalysis/ladder'
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "circuit.h"
+#include "device.h"
+#include "parser.h"
+#include "sim_stats.h"
+#include "stamp.h"
+#include "transient.h"
+#include "workspace.h"
+
+using namespace minispice;
+
+namespace {
+
+// ============================================================================
+// Synthetic Circuits
+// ============================================================================
+
+// One element of a generated circuit. Nodes are numbers: 0 is ground and
+// k > 0 the node "n<k>".
+struct BenchElement {
+  char type;  // 'R', 'C', 'V', 'D', 'M'
+  int nodes[4];
+  double value;  // R, C, DC or pulsed voltage, diode Is (unused for M)
+  bool pulse;    // V: kBenchPulse from 0 V to value
+};
+
+struct BenchCircuit {
+  int num_nodes;  // Non-ground nodes, numbered 1 .. num_nodes
+  std::vector<BenchElement> elements;
+  double tstop;  // Transient run length
+  double tstep;
+  const IntegrationMethod* method;
+};
+
+// Waveform of the pulsed sources (v2 is replaced by the element value)
+const PulseWaveform kBenchPulse = {0.0, 1.0, 1e-9, 1e-9, 1e-9, 5e-9, 0.0};
+
+// Inverter transistor geometry: long and narrow, so that the gain of a stage
+// (gm times the load) stays near 1 even in the first Newton iterates and
+// long chains do not run into the singular-pivot threshold
+constexpr double kBenchMosfetW = 1e-6;
+constexpr double kBenchMosfetL = 1e-5;
+
+void Add(BenchCircuit* b, char type, int n0, int n1, int n2, int n3,
+         double value, bool pulse = false) {
+  BenchElement e = {type, {n0, n1, n2, n3}, value, pulse};
+  b->elements.push_back(e);
+}
+
+// side x side resistor mesh, side = round(sqrt(nodes))
+BenchCircuit ResistorMesh(int nodes) {
+  int side = (int)std::lround(std::sqrt((double)nodes));
+  if (side < 2) side = 2;
+  BenchCircuit b = {side * side, {}, 1e-8, 1e-10, &kTrapezoidal};
+  auto node = [side](int i, int j) { return i * side + j + 1; };
+  Add(&b, 'V', node(0, 0), 0, 0, 0, 1.0);
+  for (int i = 0; i < side; i++) {
+    for (int j = 0; j < side; j++) {
+      if (j + 1 < side) Add(&b, 'R', node(i, j), node(i, j + 1), 0, 0, 1e3);
+      if (i + 1 < side) Add(&b, 'R', node(i, j), node(i + 1, j), 0, 0, 1e3);
+    }
+  }
+  Add(&b, 'R', node(side - 1, side - 1), 0, 0, 0, 1e3);
+  return b;
+}
+
+// Pulse source into nodes - 1 RC sections
+BenchCircuit RcLadder(int nodes) {
+  BenchCircuit b = {nodes, {}, 2e-8, 1e-10, &kTrapezoidal};
+  Add(&b, 'V', 1, 0, 0, 0, 1.0, true);
+  for (int k = 2; k <= nodes; k++) {
+    Add(&b, 'R', k - 1, k, 0, 0, 100.0);
+    Add(&b, 'C', k, 0, 0, 0, 1e-13);
+  }
+  return b;
+}
+
+// Source node 1 feeding nodes - 1 resistor-diode branches, with saturation
+// currents spread over a decade
+BenchCircuit DiodeArray(int nodes) {
+  BenchCircuit b = {nodes, {}, 1e-8, 1e-10, &kTrapezoidal};
+  Add(&b, 'V', 1, 0, 0, 0, 2.0);
+  for (int k = 2; k <= nodes; k++) {
+    Add(&b, 'R', 1, k, 0, 0, 1e3);
+    Add(&b, 'D', k, 0, 0, 0, 1e-14 * (1.0 + 9.0 * (k % 10) / 10.0));
+  }
+  return b;
+}
+
+// Supply node 1, input node 2 (pulsed) and nodes - 2 inverter outputs,
+// output k driving the gate of stage k + 1. Integrated with Gear2: the gate
+// capacitance steps from zero to Cox W L / 2 at threshold, on which the
+// trapezoidal rule rings until the step size collapses.
+BenchCircuit InverterChain(int nodes) {
+  if (nodes < 3) nodes = 3;
+  BenchCircuit b = {nodes, {}, 2e-8, 1e-10, &kGear2};
+  Add(&b, 'V', 1, 0, 0, 0, 5.0);
+  Add(&b, 'V', 2, 0, 0, 0, 5.0, true);
+  for (int k = 3; k <= nodes; k++) {
+    Add(&b, 'R', 1, k, 0, 0, 1e3);
+    Add(&b, 'M', k, k - 1, 0, 0, 0.0);
+    Add(&b, 'C', k, 0, 0, 0, 1e-14);
+  }
+  return b;
+}
+
+typedef BenchCircuit (*BenchGenerator)(int nodes);
+
+void AppendNode(std::string* s, int node) {
+  *s += ' ';
+  *s += node ? "n" + std::to_string(node) : "0";
+}
+
+// Netlist text of a generated circuit
+std::string BenchNetlist(const BenchCircuit& b) {
+  std::string s;
+  s.reserve(b.elements.size() * 32);
+  char value[96];
+  int count = 0;
+  for (const BenchElement& e : b.elements) {
+    s += e.type;
+    s += std::to_string(++count);
+    int terminals = e.type == 'M' ? 4 : 2;
+    for (int t = 0; t < terminals; t++) AppendNode(&s, e.nodes[t]);
+    if (e.pulse) {
+      const PulseWaveform& p = kBenchPulse;
+      snprintf(value, sizeof(value), " PULSE(%g %g %g %g %g %g %g)", p.v1,
+               e.value, p.td, p.tr, p.tf, p.pw, p.per);
+    } else if (e.type == 'D') {
+      snprintf(value, sizeof(value), " Is=%.17g", e.value);
+    } else if (e.type == 'M') {
+      snprintf(value, sizeof(value), " W=%g L=%g", kBenchMosfetW,
+               kBenchMosfetL);
+    } else {
+      snprintf(value, sizeof(value), " %.17g", e.value);
+    }
+    s += value;
+    s += '\n';
+  }
+  return s;
+}
+
+// Unfinalized circuit with the elements of b, built with the device
+// factories. Returns nullptr on error.
+Circuit* BenchBuild(const BenchCircuit& b) {
+  Circuit* c = circuit_create();
+  if (!c) return nullptr;
+  std::string name;
+  for (int k = 1; k <= b.num_nodes; k++) {
+    name = "n" + std::to_string(k);
+    if (CircuitAddNode(c, name.c_str()) != k) {
+      circuit_free(c);
+      return nullptr;
+    }
+  }
+  MosfetParams mp;
+  MosfetParamsInit(&mp);
+  mp.w = kBenchMosfetW;
+  mp.l = kBenchMosfetL;
+  DeviceArena* arena = c->device_arena;
+  int count = 0;
+  for (const BenchElement& e : b.elements) {
+    name = e.type + std::to_string(++count);
+    const int* n = e.nodes;
+    Device* d = nullptr;
+    if (e.type == 'R') {
+      d = CreateResistor(name.c_str(), n[0], n[1], e.value, arena);
+    } else if (e.type == 'C') {
+      d = CreateCapacitor(name.c_str(), n[0], n[1], e.value, arena);
+    } else if (e.type == 'V' && e.pulse) {
+      PulseWaveform p = kBenchPulse;
+      p.v2 = e.value;
+      d = CreatePulseVoltageSource(name.c_str(), n[0], n[1], &p, arena);
+    } else if (e.type == 'V') {
+      d = CreateVoltageSource(name.c_str(), n[0], n[1], e.value, arena);
+    } else if (e.type == 'D') {
+      d = CreateDiode(name.c_str(), n[0], n[1], e.value, 1.0, arena);
+    } else if (e.type == 'M') {
+      d = CreateMosfet(name.c_str(), n[0], n[1], n[2], n[3], &mp, arena);
+    }
+    if (!d || !CircuitAddDevice(c, d)) {
+      DeviceFree(d);
+      circuit_free(c);
+      return nullptr;
+    }
+  }
+  return c;
+}
+
+struct BenchFamily {
+  const char* name;
+  BenchGenerator generate;
+  int max_nodes;            // Largest size of the parse and finalize runs
+  int max_workspace_nodes;  // Largest size of the runs that build a workspace
+};
+
+// The mesh LU fills in faster than the mesh grows, and the minimum-degree
+// ordering of the sparse LU takes time quadratic in the degree of a hub
+// node (the source of the diode array, the supply of the inverter chain)
+const BenchFamily kBenchFamilies[] = {
+    {"mesh", ResistorMesh, 1000000, 100000},
+    {"ladder", RcLadder, 1000000, 1000000},
+    {"diodes", DiodeArray, 1000000, 1000000},
+    {"inverters", InverterChain, 1000000, 100000},
+};
+
+// Finalized circuit of a family, parsed from its netlist
+Circuit* BenchCircuitCreate(const BenchFamily* f, int nodes) {
+  std::string text = BenchNetlist(f->generate(nodes));
+  return parse_netlist_buffer(text.data(), text.size(), 0);
+}
+
+void ReportSize(benchmark::State& state, const Circuit* c) {
+  state.counters["vars"] = c->num_vars;
+  state.SetItemsProcessed(state.iterations() * (int64_t)c->num_vars);
+}
+
+// Solver counters of the workspace, per benchmark iteration
+void ReportStats(benchmark::State& state, const SimWorkspace* ws) {
+  SimStats s;
+  SimWorkspaceGetStats(ws, &s);
+  double n = (double)state.iterations();
+  state.counters["newton"] = s.newton_iterations / n;
+  state.counters["lu_nnz"] = (double)s.lu_nnz;
+}
+
+// ============================================================================
+// Benchmarks
+// ============================================================================
+
+void BM_Parse(benchmark::State& state, const BenchFamily* f) {
+  std::string text = BenchNetlist(f->generate((int)state.range(0)));
+  Circuit* c = nullptr;
+  for (auto _ : state) {
+    circuit_free(c);
+    c = parse_netlist_buffer(text.data(), text.size(), 0);
+    if (!c) {
+      state.SkipWithError("parse failed");
+      return;
+    }
+  }
+  ReportSize(state, c);
+  state.SetBytesProcessed(state.iterations() * (int64_t)text.size());
+  circuit_free(c);
+}
+
+void BM_Finalize(benchmark::State& state, const BenchFamily* f) {
+  BenchCircuit b = f->generate((int)state.range(0));
+  Circuit* c = nullptr;
+  for (auto _ : state) {
+    state.PauseTiming();
+    circuit_free(c);
+    c = BenchBuild(b);
+    state.ResumeTiming();
+    if (!c || CircuitFinalize(c) != 0) {
+      state.SkipWithError("finalize failed");
+      return;
+    }
+  }
+  ReportSize(state, c);
+  circuit_free(c);
+}
+
+// First assembly of a new workspace: stamp pattern discovery, matrix
+// storage and the ordering of the sparse LU
+void BM_Compile(benchmark::State& state, const BenchFamily* f) {
+  Circuit* c = BenchCircuitCreate(f, (int)state.range(0));
+  if (!c) {
+    state.SkipWithError("setup failed");
+    return;
+  }
+  std::vector<double> x(c->num_vars, 0.0);
+  IterationState it = {0, x.data(), 1e-9, 1e-12, NewtonPolicy{}, nullptr, 0.0};
+  for (auto _ : state) {
+    state.PauseTiming();
+    SimWorkspace* ws = SimWorkspaceCreate(c);
+    state.ResumeTiming();
+    int result = ws ? SimWorkspaceAssemble(ws, c, &it) : -1;
+    state.PauseTiming();
+    SimWorkspaceFree(ws);
+    state.ResumeTiming();
+    if (result != 0) {
+      state.SkipWithError("assembly failed");
+      break;
+    }
+  }
+  ReportSize(state, c);
+  circuit_free(c);
+}
+
+// One DC Newton assembly at the zero guess (first assembly excluded: it
+// discovers and compiles the pattern)
+void BM_Assemble(benchmark::State& state, const BenchFamily* f) {
+  Circuit* c = BenchCircuitCreate(f, (int)state.range(0));
+  SimWorkspace* ws = c ? SimWorkspaceCreate(c) : nullptr;
+  if (!ws) {
+    state.SkipWithError("setup failed");
+    circuit_free(c);
+    return;
+  }
+  std::vector<double> x(c->num_vars, 0.0);
+  IterationState it = {0, x.data(), 1e-9, 1e-12, NewtonPolicy{}, nullptr, 0.0};
+  SimWorkspaceAssemble(ws, c, &it);
+  for (auto _ : state) {
+    if (SimWorkspaceAssemble(ws, c, &it) != 0) {
+      state.SkipWithError("assembly failed");
+      break;
+    }
+    benchmark::ClobberMemory();
+  }
+  ReportSize(state, c);
+  SimWorkspaceFree(ws);
+  circuit_free(c);
+}
+
+// Factor and solve of the matrix assembled at the zero guess; the
+// reassembly before every solve and the first solve (symbolic analysis)
+// are not timed
+void BM_Solve(benchmark::State& state, const BenchFamily* f) {
+  Circuit* c = BenchCircuitCreate(f, (int)state.range(0));
+  SimWorkspace* ws = c ? SimWorkspaceCreate(c) : nullptr;
+  if (!ws) {
+    state.SkipWithError("setup failed");
+    circuit_free(c);
+    return;
+  }
+  std::vector<double> x(c->num_vars, 0.0);
+  IterationState it = {0, x.data(), 1e-9, 1e-12, NewtonPolicy{}, nullptr, 0.0};
+  if (SimWorkspaceAssemble(ws, c, &it) != 0 || SimWorkspaceSolve(ws) != 0) {
+    state.SkipWithError("solve failed");
+  }
+  SimWorkspaceClearStats(ws);
+  for (auto _ : state) {
+    if (SimWorkspaceAssemble(ws, c, &it) != 0) {
+      state.SkipWithError("assembly failed");
+      break;
+    }
+    double start = SimClockSeconds();
+    if (SimWorkspaceSolve(ws) != 0) {
+      state.SkipWithError("solve failed");
+      break;
+    }
+    state.SetIterationTime(SimClockSeconds() - start);
+  }
+  ReportSize(state, c);
+  ReportStats(state, ws);
+  SimWorkspaceFree(ws);
+  circuit_free(c);
+}
+
+// Complete DC operating point from the zero guess with a workspace reused
+// from an untimed first analysis
+void BM_DcAnalysis(benchmark::State& state, const BenchFamily* f) {
+  Circuit* c = BenchCircuitCreate(f, (int)state.range(0));
+  SimWorkspace* ws = c ? SimWorkspaceCreate(c) : nullptr;
+  if (!ws) {
+    state.SkipWithError("setup failed");
+    circuit_free(c);
+    return;
+  }
+  std::vector<double> x(c->num_vars);
+  if (CircuitDcAnalysisWithWorkspace(c, ws, x.data(), 100, 1e-12, 1e-9) < 0) {
+    state.SkipWithError("DC analysis failed");
+  }
+  SimWorkspaceClearStats(ws);
+  for (auto _ : state) {
+    if (CircuitDcAnalysisWithWorkspace(c, ws, x.data(), 100, 1e-12, 1e-9) <
+        0) {
+      state.SkipWithError("DC analysis failed");
+      break;
+    }
+  }
+  ReportSize(state, c);
+  ReportStats(state, ws);
+  SimWorkspaceFree(ws);
+  circuit_free(c);
+}
+
+// Transient run of the family's tstop on a new circuit and workspace, first
+// assembly and operating point included
+void BM_Transient(benchmark::State& state, const BenchFamily* f) {
+  BenchCircuit b = f->generate((int)state.range(0));
+  std::string text = BenchNetlist(b);
+  Circuit* c = parse_netlist_buffer(text.data(), text.size(), 0);
+  SimWorkspace* ws = c ? SimWorkspaceCreate(c) : nullptr;
+  if (!ws) {
+    state.SkipWithError("setup failed");
+    circuit_free(c);
+    return;
+  }
+  TransientOptions opts;
+  TransientOptionsInit(&opts, b.tstep, b.tstop);
+  opts.method = b.method;
+  std::vector<double> x(c->num_vars);
+  TransientStats ts = {};
+  for (auto _ : state) {
+    // Device transient state is advanced in place: restart from a fresh
+    // circuit every run
+    state.PauseTiming();
+    SimWorkspaceFree(ws);
+    circuit_free(c);
+    c = parse_netlist_buffer(text.data(), text.size(), 0);
+    ws = c ? SimWorkspaceCreate(c) : nullptr;
+    state.ResumeTiming();
+    if (!ws || CircuitTransientAnalysis(c, ws, &opts, x.data(), nullptr,
+                                        nullptr, &ts) < 0) {
+      state.SkipWithError("transient analysis failed");
+      break;
+    }
+  }
+  if (ws) {
+    ReportSize(state, c);
+    state.counters["newton"] = ts.newton_iterations;
+    state.counters["steps"] = ts.accepted_steps;
+  }
+  SimWorkspaceFree(ws);
+  circuit_free(c);
+}
+
+// Register bench for every family, sizes 10, 100, ... up to the family's
+// limit (max_workspace_nodes if the benchmark builds a workspace)
+void Register(const char* name,
+              void (*bench)(benchmark::State&, const BenchFamily*),
+              bool workspace, bool manual_time = false) {
+  for (const BenchFamily& f : kBenchFamilies) {
+    std::string full = std::string(name) + "/" + f.name;
+    benchmark::internal::Benchmark* b =
+        benchmark::RegisterBenchmark(full.c_str(), bench, &f);
+    b->RangeMultiplier(10)
+        ->Range(10, workspace ? f.max_workspace_nodes : f.max_nodes)
+        ->Unit(benchmark::kMicrosecond);
+    if (manual_time) b->UseManualTime();
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Register("Parse", BM_Parse, false);
+  Register("Finalize", BM_Finalize, false);
+  Register("Compile", BM_Compile, true);
+  Register("Assemble", BM_Assemble, true);
+  Register("Solve", BM_Solve, true, true);
+  Register("DcAnalysis", BM_DcAnalysis, true);
+  Register("Transient", BM_Transient, true);
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -1,308 +1,940 @@
-
 // Netlist parser implementation
 //
-// Parses SPICE-style netlists into Circuit structures.
+// Parses SPICE-style netlists into Circuit structures. Files are memory
+// mapped and tokenized in place (std::string_view tokens, std::from_chars
+// numbers); nothing is copied until names are interned by the circuit.
+// Large inputs are split into chunks at line boundaries whose lines are
+// tokenized in parallel, then devices are created serially in file order.
+//
+// A .SUBCKT definition becomes a template when it is read: its elements are
+// created once as prototype devices whose terminals are local node numbers.
+// Instances (X lines) are expanded after the whole netlist is read, so a
+// definition may follow its use. Every instance device is a clone of its
+// prototype sharing the params (but for sources, whose values are set per
+// device), with its own terminals and state.
 //
 
 #include "parser.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <cctype>
+#include <charconv>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <fstream>
-#include <sstream>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "device.h"
+#include "string_arena.h"
+#include "thread_pool.h"
 
 namespace minispice {
 
+// Inputs of at least this size are tokenized in parallel when the thread
+// count is automatic
+constexpr size_t kParallelParseMinBytes = 4u << 20;
+
+// Bounds of the chunk size for parallel tokenization
+constexpr size_t kParseChunkMinBytes = 64u << 10;
+constexpr size_t kParseChunkMaxBytes = 8u << 20;
+
+// Maximum number of fields of a PULSE(...) specification
+constexpr int kPulseFields = 7;
+
+// Deepest nesting of subcircuit instances (catches recursive definitions)
+constexpr int kMaxSubcktDepth = 64;
+
+// Number of values of a tokenized line (the PULSE fields or the MOSFET
+// parameters, whichever is more)
+constexpr int kRecordValues = 8;
+
 // ============================================================================
 // Utility Functions
 // ============================================================================
 
-static std::string trim(const std::string& s) {
-  size_t start = s.find_first_not_of(" \t\r\n");
-  if (start == std::string::npos) return "";
-  size_t end = s.find_last_not_of(" \t\r\n");
-  return s.substr(start, end - start + 1);
+static bool is_space(char ch) {
+  return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n' || ch == '\v' ||
+         ch == '\f';
+}
+
+static std::string_view trim(std::string_view s) {
+  size_t start = 0;
+  while (start < s.size() && is_space(s[start])) start++;
+  size_t end = s.size();
+  while (end > start && is_space(s[end - 1])) end--;
+  return s.substr(start, end - start);
 }
 
-static std::string to_upper(const std::string& s) {
-  std::string result = s;
-  for (char& c : result) {
-    c = std::toupper(static_cast<unsigned char>(c));
+// Split the next whitespace-separated token off the front of rest.
+// Returns false if rest holds no more tokens.
+static bool next_token(std::string_view* rest, std::string_view* token) {
+  size_t start = 0;
+  while (start < rest->size() && is_space((*rest)[start])) start++;
+  size_t end = start;
+  while (end < rest->size() && !is_space((*rest)[end])) end++;
+  if (start == end) {
+    *rest = std::string_view();
+    return false;
   }
-  return result;
+  *token = rest->substr(start, end - start);
+  *rest = rest->substr(end);
+  return true;
 }
 
-// Parse value with optional suffix (k, M, G, m, u, n, p, f)
-static double parse_value(const std::string& str) {
-  if (str.empty()) return 0.0;
+// Case-insensitive prefix test against an upper-case literal
+static bool starts_with_upper(std::string_view s, const char* prefix) {
+  size_t n = strlen(prefix);
+  if (s.size() < n) return false;
+  for (size_t i = 0; i < n; i++) {
+    if (std::toupper(static_cast<unsigned char>(s[i])) != prefix[i]) {
+      return false;
+    }
+  }
+  return true;
+}
 
-  size_t idx = 0;
-  double value = std::stod(str, &idx);
+static bool equals_upper(std::string_view s, const char* upper) {
+  return s.size() == strlen(upper) && starts_with_upper(s, upper);
+}
+
+// Parse value with optional suffix (T, G, MEG, k, m, MIL, u, n, p, f).
+// Returns false if str does not start with a number.
+static bool parse_value(std::string_view str, double* value) {
+  const char* first = str.data();
+  const char* last = str.data() + str.size();
+  if (first < last && *first == '+') first++;  // from_chars rejects '+'
+
+  double v;
+  std::from_chars_result res = std::from_chars(first, last, v);
+  if (res.ec != std::errc()) return false;
 
-  if (idx < str.size()) {
-    char suffix = std::tolower(static_cast<unsigned char>(str[idx]));
-    switch (suffix) {
+  std::string_view suffix(res.ptr, last - res.ptr);
+  if (!suffix.empty()) {
+    switch (std::tolower(static_cast<unsigned char>(suffix[0]))) {
       case 't':
-        value *= 1e12;
+        v *= 1e12;
         break;
       case 'g':
-        value *= 1e9;
+        v *= 1e9;
         break;
       case 'x':  // MEG
       case 'm':
-        if (idx + 2 < str.size() && std::tolower(str[idx + 1]) == 'e' &&
-            std::tolower(str[idx + 2]) == 'g') {
-          value *= 1e6;
-        } else if (idx + 2 < str.size() && std::tolower(str[idx + 1]) == 'i' &&
-                   std::tolower(str[idx + 2]) == 'l') {
-          value *= 25.4e-6;  // mil
+        if (starts_with_upper(suffix.substr(1), "EG")) {
+          v *= 1e6;
+        } else if (starts_with_upper(suffix.substr(1), "IL")) {
+          v *= 25.4e-6;  // mil
         } else {
-          value *= 1e-3;  // milli
+          v *= 1e-3;  // milli
         }
         break;
       case 'k':
-        value *= 1e3;
+        v *= 1e3;
         break;
       case 'u':
-        value *= 1e-6;
+        v *= 1e-6;
         break;
       case 'n':
-        value *= 1e-9;
+        v *= 1e-9;
         break;
       case 'p':
-        value *= 1e-12;
+        v *= 1e-12;
         break;
       case 'f':
-        value *= 1e-15;
+        v *= 1e-15;
         break;
       default:
         break;
     }
   }
 
-  return value;
+  *value = v;
+  return true;
 }
 
-// Parse key=value parameter
-static bool parse_param(const std::string& token, const std::string& key,
-                        double* value) {
-  std::string upper_token = to_upper(token);
-  std::string upper_key = to_upper(key) + "=";
-
-  if (upper_token.find(upper_key) == 0) {
-    std::string val_str = token.substr(upper_key.length());
-    *value = parse_value(val_str);
-    return true;
+// Match a key=value parameter (key given in upper case, matched
+// case-insensitively). Returns false if token is not that parameter;
+// otherwise stores the value text in value.
+static bool parse_param(std::string_view token, const char* key,
+                        std::string_view* value) {
+  size_t n = strlen(key);
+  if (token.size() <= n || token[n] != '=' || !starts_with_upper(token, key)) {
+    return false;
   }
-  return false;
+  *value = token.substr(n + 1);
+  return true;
 }
 
 // ============================================================================
-// Parser Implementation
+// Line Tokenization
 // ============================================================================
 
-static Circuit* parse_lines(const std::vector<std::string>& lines) {
-  Circuit* c = circuit_create();
-  if (!c) return nullptr;
+// One netlist line, tokenized and converted off the main thread. Devices and
+// nodes are created from it later, in file order.
+struct LineRecord {
+  std::string_view line;  // Trimmed line (directives and messages)
+  std::string_view name;  // Element name
+  std::string_view n1;    // First terminal
+  std::string_view n2;    // Second terminal
+  std::string_view n3;    // Third and fourth terminals (MOSFET source, bulk)
+  std::string_view n4;
+  double v[kRecordValues];  // Value; diode Is, n; the pulse fields; or the
+                            // MOSFET w, l, mu, cox, vth0, gamma, phi_f, beta
+  char type;                // Element letter in upper case, '.' for a
+                            // directive, 0 for a blank line or comment
+  bool has_pulse;           // V/I source with a PULSE waveform
+  bool has_ac;              // V/I source with an AC excitation
+  double ac[2];             // Its magnitude and phase in degrees
+  bool error;               // Malformed line, reported and skipped
+};
+
+// AC excitation "mag [phase]", rest starting after the AC keyword. The
+// phase defaults to zero. Returns false if malformed.
+static bool parse_ac_value(std::string_view rest, LineRecord* r) {
+  std::string_view mag, phase;
+  r->ac[1] = 0.0;
+  if (!next_token(&rest, &mag) || !parse_value(mag, &r->ac[0])) return false;
+  if (next_token(&rest, &phase) && !parse_value(phase, &r->ac[1])) {
+    return false;
+  }
+  r->has_ac = true;
+  return true;
+}
+
+// Source value: "value", "DC value" or "PULSE(v1 v2 td tr tf pw per)",
+// optionally followed by "AC mag [phase]", or "AC mag [phase]" alone (DC
+// value zero). rest starts at the value. Missing pulse fields default to
+// zero. Returns false if malformed.
+static bool parse_source_value(std::string_view rest, LineRecord* r) {
+  std::string_view first;
+  if (!next_token(&rest, &first)) return false;
 
-  for (const auto& raw_line : lines) {
-    std::string line = trim(raw_line);
-
-    // Skip empty lines and comments
-    if (line.empty()) continue;
-    if (line[0] == '*' || line[0] == '#') continue;
-    if (line.size() >= 2 && line[0] == '/' && line[1] == '/') continue;
-    if (line[0] == '.') continue;  // Skip directives for now
-
-    // Tokenize
-    std::istringstream iss(line);
-    std::vector<std::string> tokens;
-    std::string token;
-    while (iss >> token) {
-      tokens.push_back(token);
+  if (equals_upper(first, "AC")) {
+    r->v[0] = 0.0;
+    return parse_ac_value(rest, r);
+  }
+  if (!starts_with_upper(first, "PULSE")) {
+    if (equals_upper(first, "DC") && !next_token(&rest, &first)) return false;
+    if (!parse_value(first, &r->v[0])) return false;
+    // Anything after the value but an AC excitation is ignored
+    std::string_view token;
+    if (next_token(&rest, &token) && equals_upper(token, "AC")) {
+      return parse_ac_value(rest, r);
     }
+    return true;
+  }
 
-    if (tokens.empty()) continue;
+  // Fields of "PULSE(0 5 ...)" / "PULSE 0 5 ..." separated by whitespace,
+  // parentheses or commas
+  const char* p = first.data() + 5;
+  const char* end = rest.data() + rest.size();
+  int count = 0;
+  for (int i = 0; i < kPulseFields; i++) r->v[i] = 0.0;
+  while (p < end) {
+    while (p < end && (is_space(*p) || *p == '(' || *p == ')' || *p == ',')) {
+      p++;
+    }
+    const char* q = p;
+    while (q < end && !is_space(*q) && *q != '(' && *q != ')' && *q != ',') {
+      q++;
+    }
+    if (q == p) break;
+    if (equals_upper(std::string_view(p, q - p), "AC")) {
+      if (!parse_ac_value(std::string_view(q, end - q), r)) return false;
+      break;
+    }
+    if (count == kPulseFields) return false;
+    if (!parse_value(std::string_view(p, q - p), &r->v[count])) return false;
+    count++;
+    p = q;
+  }
+  if (count < 2) return false;
+  r->has_pulse = true;
+  return true;
+}
 
-    std::string name = tokens[0];
-    char type = std::toupper(static_cast<unsigned char>(name[0]));
+// Tokenize one raw line into r. Thread-safe: touches nothing but r.
+static void tokenize_line(std::string_view raw, LineRecord* r) {
+  std::string_view line = trim(raw);
+  r->line = line;
+  r->type = 0;
+  r->has_pulse = false;
+  r->has_ac = false;
+  r->error = false;
 
-    if (type == 'R') {
-      // Resistor: Rname n1 n2 value
-      if (tokens.size() < 4) {
-        fprintf(stderr, "Parser error: Invalid resistor line: %s\n",
-                line.c_str());
-        continue;
-      }
-      int n1 = CircuitAddNode(c, tokens[1].c_str());
-      int n2 = CircuitAddNode(c, tokens[2].c_str());
-      double value = parse_value(tokens[3]);
-
-      int v1 = CircuitGetVarIndex(c, n1);
-      int v2 = CircuitGetVarIndex(c, n2);
-      // For now, store node indices; var indices assigned after finalize
-      // We'll use a different approach - store node indices and convert later
-
-      Device* d = CreateResistor(name.c_str(), n1, n2, value);
-      if (d) CircuitAddDevice(c, d);
-
-    } else if (type == 'I') {
-      // Current Source: Iname n1 n2 value
-      if (tokens.size() < 4) {
-        fprintf(stderr, "Parser error: Invalid current source line: %s\n",
-                line.c_str());
-        continue;
-      }
-      int n1 = CircuitAddNode(c, tokens[1].c_str());
-      int n2 = CircuitAddNode(c, tokens[2].c_str());
-      double value = parse_value(tokens[3]);
-
-      Device* d = CreateCurrentSource(name.c_str(), n1, n2, value);
-      if (d) CircuitAddDevice(c, d);
-
-    } else if (type == 'V') {
-      // Voltage Source: Vname n1 n2 value
-      if (tokens.size() < 4) {
-        fprintf(stderr, "Parser error: Invalid voltage source line: %s\n",
-                line.c_str());
-        continue;
-      }
-      int n1 = CircuitAddNode(c, tokens[1].c_str());
-      int n2 = CircuitAddNode(c, tokens[2].c_str());
-      double value = parse_value(tokens[3]);
-
-      Device* d = CreateVoltageSource(name.c_str(), n1, n2, value);
-      if (d) CircuitAddDevice(c, d);
-
-    } else if (type == 'C') {
-      // Capacitor: Cname n1 n2 value
-      if (tokens.size() < 4) {
-        fprintf(stderr, "Parser error: Invalid capacitor line: %s\n",
-                line.c_str());
-        continue;
-      }
-      int n1 = CircuitAddNode(c, tokens[1].c_str());
-      int n2 = CircuitAddNode(c, tokens[2].c_str());
-      double value = parse_value(tokens[3]);
-
-      Device* d = CreateCapacitor(name.c_str(), n1, n2, value);
-      if (d) CircuitAddDevice(c, d);
-
-    } else if (type == 'L') {
-      // Inductor: Lname n1 n2 value
-      if (tokens.size() < 4) {
-        fprintf(stderr, "Parser error: Invalid inductor line: %s\n",
-                line.c_str());
-        continue;
-      }
-      int n1 = CircuitAddNode(c, tokens[1].c_str());
-      int n2 = CircuitAddNode(c, tokens[2].c_str());
-      double value = parse_value(tokens[3]);
-
-      Device* d = CreateInductor(name.c_str(), n1, n2, value);
-      if (d) CircuitAddDevice(c, d);
-
-    } else if (type == 'D') {
-      // Diode: Dname anode cathode [Is=value] [n=value]
-      if (tokens.size() < 3) {
-        fprintf(stderr, "Parser error: Invalid diode line: %s\n", line.c_str());
-        continue;
+  // Skip empty lines and comments
+  if (line.empty()) return;
+  if (line[0] == '*' || line[0] == '#') return;
+  if (line.size() >= 2 && line[0] == '/' && line[1] == '/') return;
+
+  if (line[0] == '.') {
+    r->type = '.';
+    return;
+  }
+
+  std::string_view rest = line;
+  next_token(&rest, &r->name);
+  r->type = (char)std::toupper(static_cast<unsigned char>(r->name[0]));
+
+  switch (r->type) {
+    case 'R':
+    case 'C':
+    case 'L': {
+      // Rname n1 n2 value (likewise C, L)
+      std::string_view value;
+      r->error = !next_token(&rest, &r->n1) || !next_token(&rest, &r->n2) ||
+                 !next_token(&rest, &value) || !parse_value(value, &r->v[0]);
+      break;
+    }
+    case 'V':
+    case 'I':
+      // Vname n1 n2 value | DC value | PULSE(...) [AC mag [phase]]
+      // (likewise I)
+      r->error = !next_token(&rest, &r->n1) || !next_token(&rest, &r->n2) ||
+                 !parse_source_value(rest, r);
+      break;
+    case 'D': {
+      // Dname anode cathode [Is=value] [n=value]
+      r->error = !next_token(&rest, &r->n1) || !next_token(&rest, &r->n2);
+      r->v[0] = 1e-14;
+      r->v[1] = 1.0;
+      std::string_view token;
+      while (!r->error && next_token(&rest, &token)) {
+        std::string_view value;
+        if (parse_param(token, "IS", &value)) {
+          r->error = !parse_value(value, &r->v[0]);
+        } else if (parse_param(token, "N", &value)) {
+          r->error = !parse_value(value, &r->v[1]);
+        }
       }
-      int n_anode = CircuitAddNode(c, tokens[1].c_str());
-      int n_cathode = CircuitAddNode(c, tokens[2].c_str());
-
-      // Default diode parameters
-      double I_s = 1e-14;
-      double n = 1.0;
-
-      // Parse optional parameters
-      for (size_t i = 3; i < tokens.size(); i++) {
-        double val;
-        if (parse_param(tokens[i], "Is", &val)) {
-          I_s = val;
-        } else if (parse_param(tokens[i], "n", &val)) {
-          n = val;
+      break;
+    }
+    case 'M': {
+      // Mname drain gate source bulk [W=] [L=] [MU=] [COX=] [VTH0=|VTO=]
+      // [GAMMA=] [PHIF=] [BETA=]
+      r->error = !next_token(&rest, &r->n1) || !next_token(&rest, &r->n2) ||
+                 !next_token(&rest, &r->n3) || !next_token(&rest, &r->n4);
+      MosfetParams p;
+      MosfetParamsInit(&p);
+      double* fields[] = {&p.w,    &p.l,     &p.mu,    &p.cox,  &p.vth0,
+                          &p.vth0, &p.gamma, &p.phi_f, &p.beta};
+      static const char* const kKeys[] = {"W",    "L",     "MU",
+                                          "COX",  "VTH0",  "VTO",
+                                          "GAMMA", "PHIF", "BETA"};
+      std::string_view token;
+      while (!r->error && next_token(&rest, &token)) {
+        std::string_view value;
+        for (size_t k = 0; k < sizeof(kKeys) / sizeof(kKeys[0]); k++) {
+          if (parse_param(token, kKeys[k], &value)) {
+            r->error = !parse_value(value, fields[k]);
+            break;
+          }
         }
       }
+      if (p.l <= 0.0) r->error = true;
+      double values[kRecordValues] = {p.w,    p.l,     p.mu,    p.cox,
+                                      p.vth0, p.gamma, p.phi_f, p.beta};
+      memcpy(r->v, values, sizeof(values));
+      break;
+    }
+    default:
+      break;  // Unknown element type, reported when building
+  }
+}
+
+// Tokenize every line of [data, data + size) into records (cleared first)
+static void tokenize_chunk(const char* data, size_t size,
+                           std::vector<LineRecord>* records) {
+  records->clear();
+  const char* p = data;
+  const char* end = data + size;
+  while (p < end) {
+    const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+    const char* line_end = nl ? nl : end;
+    LineRecord r;
+    tokenize_line(std::string_view(p, line_end - p), &r);
+    if (r.type != 0) records->push_back(r);
+    p = nl ? nl + 1 : end;
+  }
+}
 
-      Device* d = CreateDiode(name.c_str(), n_anode, n_cathode, I_s, n);
-      if (d) CircuitAddDevice(c, d);
+// ============================================================================
+// Parser Implementation
+// ============================================================================
 
-    } else {
-      // Unknown element type - skip
-      fprintf(stderr, "Parser warning: Unknown element type: %s\n",
-              name.c_str());
+// .TRAN tstep tstop [tstart [tmax]]
+static void parse_tran_directive(Circuit* c,
+                                 const std::vector<std::string_view>& tokens,
+                                 std::string_view line) {
+  TranSpec tran = {0.0, 0.0, 0.0, 0.0};
+  bool ok = tokens.size() >= 3 && tokens.size() <= 5 &&
+            parse_value(tokens[1], &tran.tstep) &&
+            parse_value(tokens[2], &tran.tstop) &&
+            (tokens.size() < 4 || parse_value(tokens[3], &tran.tstart)) &&
+            (tokens.size() < 5 || parse_value(tokens[4], &tran.tmax));
+  if (!ok || tran.tstep <= 0.0 || tran.tstop <= 0.0) {
+    fprintf(stderr, "Parser error: Invalid .TRAN line: %.*s\n",
+            (int)line.size(), line.data());
+    return;
+  }
+  c->tran = tran;
+}
+
+// .AC DEC|OCT|LIN points fstart fstop
+static void parse_ac_directive(Circuit* c,
+                               const std::vector<std::string_view>& tokens,
+                               std::string_view line) {
+  AcSpec ac = {kAcDecade, 0, 0.0, 0.0};
+  double points = 0.0;
+  bool ok = tokens.size() == 5 && parse_value(tokens[2], &points) &&
+            parse_value(tokens[3], &ac.fstart) &&
+            parse_value(tokens[4], &ac.fstop);
+  if (ok && equals_upper(tokens[1], "OCT")) {
+    ac.type = kAcOctave;
+  } else if (ok && equals_upper(tokens[1], "LIN")) {
+    ac.type = kAcLinear;
+  } else {
+    ok = ok && equals_upper(tokens[1], "DEC");
+  }
+  ac.points = ok && points >= 1.0 && points < 1e9 ? (int)points : 0;
+  if (ac.points == 0 || ac.fstart <= 0.0 || ac.fstop < ac.fstart) {
+    fprintf(stderr, "Parser error: Invalid .AC line: %.*s\n",
+            (int)line.size(), line.data());
+    return;
+  }
+  c->ac = ac;
+}
+
+// .DC src start stop step [src2 start2 stop2 step2]
+// The sources are looked up when the sweep runs, so they may be defined
+// after the directive.
+static void parse_dc_directive(Circuit* c,
+                               const std::vector<std::string_view>& tokens,
+                               std::string_view line) {
+  size_t num_sweeps = (tokens.size() - 1) / 4;
+  bool ok = tokens.size() == 1 + 4 * num_sweeps && num_sweeps >= 1 &&
+            num_sweeps <= (size_t)kMaxDcSweeps;
+
+  DcSweep sweeps[kMaxDcSweeps];
+  for (size_t k = 0; ok && k < num_sweeps; k++) {
+    DcSweep* s = &sweeps[k];
+    s->source = StringArenaAdd(c->names, tokens[1 + 4 * k].data(),
+                               tokens[1 + 4 * k].size());
+    ok = s->source && parse_value(tokens[2 + 4 * k], &s->start) &&
+         parse_value(tokens[3 + 4 * k], &s->stop) &&
+         parse_value(tokens[4 + 4 * k], &s->step);
+  }
+  if (!ok) {
+    fprintf(stderr, "Parser error: Invalid .DC line: %.*s\n",
+            (int)line.size(), line.data());
+    return;
+  }
+
+  memcpy(c->dc_sweeps, sweeps, num_sweeps * sizeof(DcSweep));
+  c->num_dc_sweeps = (int)num_sweeps;
+}
+
+static void parse_directive(Circuit* c, std::string_view line) {
+  std::vector<std::string_view> tokens;
+  std::string_view rest = line;
+  std::string_view token;
+  while (next_token(&rest, &token)) tokens.push_back(token);
+
+  // Only .DC, .AC and .TRAN are understood; other directives are skipped
+  if (equals_upper(tokens[0], ".DC")) {
+    parse_dc_directive(c, tokens, line);
+  } else if (equals_upper(tokens[0], ".AC")) {
+    parse_ac_directive(c, tokens, line);
+  } else if (equals_upper(tokens[0], ".TRAN")) {
+    parse_tran_directive(c, tokens, line);
+  }
+}
+
+static const char* element_kind(char type) {
+  switch (type) {
+    case 'R':
+      return "resistor";
+    case 'C':
+      return "capacitor";
+    case 'L':
+      return "inductor";
+    case 'V':
+      return "voltage source";
+    case 'I':
+      return "current source";
+    case 'M':
+      return "mosfet";
+    case 'X':
+      return "subcircuit instance";
+    default:
+      return "diode";
+  }
+}
+
+// Create the device of a tokenized element line with the terminals nodes
+// (circuit node indices, or the local node numbers of a subcircuit
+// template). The device is not added to the circuit.
+static Device* create_device(Circuit* c, const LineRecord& r,
+                             const int nodes[4]) {
+  std::string name_copy(r.name);
+  const char* name = name_copy.c_str();
+  int n1 = nodes[0];
+  int n2 = nodes[1];
+
+  DeviceArena* arena = c->device_arena;
+  Device* d = nullptr;
+  switch (r.type) {
+    case 'R':
+      d = CreateResistor(name, n1, n2, r.v[0], arena);
+      break;
+    case 'C':
+      d = CreateCapacitor(name, n1, n2, r.v[0], arena);
+      break;
+    case 'L':
+      d = CreateInductor(name, n1, n2, r.v[0], arena);
+      break;
+    case 'V':
+    case 'I': {
+      PulseWaveform pulse = {r.v[0], r.v[1], r.v[2], r.v[3],
+                             r.v[4], r.v[5], r.v[6]};
+      if (r.type == 'V') {
+        d = r.has_pulse
+                ? CreatePulseVoltageSource(name, n1, n2, &pulse, arena)
+                : CreateVoltageSource(name, n1, n2, r.v[0], arena);
+      } else {
+        d = r.has_pulse
+                ? CreatePulseCurrentSource(name, n1, n2, &pulse, arena)
+                : CreateCurrentSource(name, n1, n2, r.v[0], arena);
+      }
+      if (d && r.has_ac) DeviceSetAc(d, r.ac[0], r.ac[1]);
+      break;
+    }
+    case 'D':
+      d = CreateDiode(name, n1, n2, r.v[0], r.v[1], arena);
+      break;
+    case 'M': {
+      MosfetParams p = {r.v[0], r.v[1], r.v[2], r.v[3],
+                        r.v[4], r.v[5], r.v[6], r.v[7]};
+      d = CreateMosfet(name, n1, n2, nodes[2], nodes[3], &p, arena);
+      break;
     }
   }
+  return d;
+}
 
-  // After parsing, we need to update device node indices to var indices
-  // This happens during circuit_finalize, but devices store node indices
-  // We'll fix up device nodes after finalization
+// Terminal tokens of a tokenized element line (n3 and n4 for MOSFETs only)
+static int num_terminals(const LineRecord& r) { return r.type == 'M' ? 4 : 2; }
 
-  return c;
+static std::string_view terminal(const LineRecord& r, int k) {
+  const std::string_view* terminals[4] = {&r.n1, &r.n2, &r.n3, &r.n4};
+  return *terminals[k];
 }
 
 // ============================================================================
-// Public API
+// Subcircuits
 // ============================================================================
 
-extern "C" {
+// Subcircuit instance line: Xname node... subckt. Parameters (name=value)
+// are not supported and end the line.
+struct InstanceLine {
+  std::string_view line;
+  std::string_view name;
+  std::string_view subckt;
+  std::vector<std::string_view> nodes;
+};
 
-Circuit* parse_netlist_file(const char* filepath) {
-  if (!filepath) return nullptr;
+// Split an X line. Returns false if it has no subcircuit name.
+static bool split_instance_line(std::string_view line, InstanceLine* x) {
+  x->line = line;
+  x->nodes.clear();
+  std::string_view rest = line;
+  std::string_view token;
+  next_token(&rest, &x->name);
+  while (next_token(&rest, &token) &&
+         token.find('=') == std::string_view::npos) {
+    x->nodes.push_back(token);
+  }
+  if (x->nodes.empty()) return false;
+  x->subckt = x->nodes.back();
+  x->nodes.pop_back();
+  return true;
+}
 
-  std::ifstream file(filepath);
-  if (!file) {
-    fprintf(stderr, "Parser error: Cannot open file: %s\n", filepath);
-    return nullptr;
+// Element of a subcircuit template: a prototype device, or a nested
+// instance whose subcircuit is looked up when the template is expanded
+struct SubcktElement {
+  Device* proto;  // Prototype (terminals are local node numbers) or nullptr
+
+  // Nested instance: its line, name, subcircuit and the local numbers of
+  // the nodes it connects to
+  std::string_view line;
+  std::string_view name;
+  std::string_view subckt;
+  std::vector<int> nodes;
+};
+
+// Parsed .SUBCKT definition. Local node 0 is ground, 1 .. num_ports the
+// ports in order, then the internal nodes. Names point into the netlist
+// buffer, which outlives the templates.
+struct SubcktTemplate {
+  std::string_view name;
+  int num_ports = 0;
+  std::vector<std::string_view> node_names;  // By local number ([0] unused)
+  std::unordered_map<std::string_view, int> node_index;
+  std::vector<SubcktElement> elements;
+};
+
+// Top-level instance, expanded once the netlist is read
+struct PendingInstance {
+  std::string_view line;
+  std::string_view name;
+  std::string_view subckt;
+  std::vector<int> nodes;  // Circuit node indices
+};
+
+// State of building a circuit from the records of a netlist, in order
+struct NetlistBuilder {
+  Circuit* c;
+  // Templates by upper-case name
+  std::unordered_map<std::string, std::unique_ptr<SubcktTemplate>> subckts;
+  std::unique_ptr<SubcktTemplate> defining;  // Between .SUBCKT and .ENDS
+  bool discard_defining;  // The definition being read is reported bad
+  std::vector<PendingInstance> instances;
+};
+
+static std::string upper_name(std::string_view name) {
+  std::string upper(name);
+  for (char& ch : upper) {
+    ch = (char)std::toupper(static_cast<unsigned char>(ch));
   }
+  return upper;
+}
+
+// Local number of a node of the template being defined (added if new)
+static int local_node(SubcktTemplate* t, std::string_view name) {
+  if (CircuitIsGroundName(name.data(), name.size())) return 0;
+  auto it = t->node_index.find(name);
+  if (it != t->node_index.end()) return it->second;
+  int index = (int)t->node_names.size();
+  t->node_names.push_back(name);
+  t->node_index.emplace(name, index);
+  return index;
+}
 
-  std::vector<std::string> lines;
-  std::string line;
-  while (std::getline(file, line)) {
-    lines.push_back(line);
+// .SUBCKT name port...
+static void begin_subckt(NetlistBuilder* b, std::string_view line) {
+  if (b->defining) {
+    fprintf(stderr, "Parser error: Nested .SUBCKT definition: %.*s\n",
+            (int)line.size(), line.data());
+    return;
   }
 
-  Circuit* c = parse_lines(lines);
-  if (!c) return nullptr;
+  std::unique_ptr<SubcktTemplate> t(new SubcktTemplate);
+  t->node_names.push_back(std::string_view());  // Ground
+  std::string_view rest = line;
+  std::string_view token;
+  next_token(&rest, &token);
+  bool ok = next_token(&rest, &t->name);
+  while (ok && next_token(&rest, &token) &&
+         token.find('=') == std::string_view::npos &&
+         !equals_upper(token, "PARAMS:")) {
+    // Ports are distinct and not ground
+    size_t count = t->node_names.size();
+    ok = local_node(t.get(), token) == (int)count;
+  }
+  t->num_ports = (int)t->node_names.size() - 1;
 
-  // Finalize: assigns var indices and initializes devices
-  // But first, we need to fix up device node indices to var indices
-  if (CircuitFinalize(c) != 0) {
-    circuit_free(c);
-    return nullptr;
+  b->discard_defining = !ok || b->subckts.count(upper_name(t->name)) > 0;
+  if (!ok) {
+    fprintf(stderr, "Parser error: Invalid .SUBCKT line: %.*s\n",
+            (int)line.size(), line.data());
+  } else if (b->discard_defining) {
+    fprintf(stderr, "Parser error: Duplicate subcircuit: %.*s\n",
+            (int)t->name.size(), t->name.data());
   }
+  b->defining = std::move(t);
+}
 
-  // Now update device node arrays from node indices to var indices
-  for (Device* d = c->devices; d; d = d->next) {
-    for (int i = 0; i < 4; i++) {
-      int node_idx = d->nodes[i];
-      if (node_idx >= 0 && node_idx < c->num_nodes) {
-        d->nodes[i] = c->nodes[node_idx].var_index;
+// .ENDS [name]
+static void end_subckt(NetlistBuilder* b, std::string_view line) {
+  if (!b->defining) {
+    fprintf(stderr, "Parser error: .ENDS without .SUBCKT: %.*s\n",
+            (int)line.size(), line.data());
+    return;
+  }
+  if (!b->discard_defining) {
+    std::string key = upper_name(b->defining->name);
+    b->subckts.emplace(key, std::move(b->defining));
+  }
+  b->defining.reset();
+}
+
+// Add an element line to the template being defined
+static void add_subckt_element(NetlistBuilder* b, const LineRecord& r) {
+  SubcktTemplate* t = b->defining.get();
+  SubcktElement e;
+  e.proto = nullptr;
+  if (r.type == 'X') {
+    InstanceLine x;
+    if (!split_instance_line(r.line, &x)) {
+      fprintf(stderr, "Parser error: Invalid %s line: %.*s\n",
+              element_kind(r.type), (int)r.line.size(), r.line.data());
+      return;
+    }
+    e.line = x.line;
+    e.name = x.name;
+    e.subckt = x.subckt;
+    for (std::string_view node : x.nodes) {
+      e.nodes.push_back(local_node(t, node));
+    }
+  } else {
+    int nodes[4] = {-1, -1, -1, -1};
+    for (int k = 0; k < num_terminals(r); k++) {
+      nodes[k] = local_node(t, terminal(r, k));
+    }
+    e.proto = create_device(b->c, r, nodes);
+    if (!e.proto) return;
+  }
+  t->elements.push_back(std::move(e));
+}
+
+// Add the devices of instance path of t to the circuit. map holds the
+// circuit node of every local node number of t up to its ports; the
+// internal nodes are added as "path.node". Returns false on error
+// (reported).
+static bool expand_instance(NetlistBuilder* b, const SubcktTemplate* t,
+                            const std::string& path, std::vector<int>* map,
+                            int depth) {
+  Circuit* c = b->c;
+  if (depth > kMaxSubcktDepth) {
+    fprintf(stderr, "Parser error: Subcircuit nesting too deep: %s\n",
+            path.c_str());
+    return false;
+  }
+
+  std::string name;
+  for (size_t i = map->size(); i < t->node_names.size(); i++) {
+    name.assign(path).append(".").append(t->node_names[i]);
+    int node = CircuitAddNodeN(c, name.data(), name.size());
+    if (node < 0) return false;
+    map->push_back(node);
+  }
+
+  for (const SubcktElement& e : t->elements) {
+    if (e.proto) {
+      int share_params = !e.proto->vt->SetValue;
+      Device* d = DeviceClone(e.proto, share_params, c->device_arena);
+      if (!d) return false;
+      for (int k = 0; k < 4; k++) {
+        if (d->nodes[k] >= 0) d->nodes[k] = (*map)[d->nodes[k]];
+      }
+      name.assign(path).append(".").append(e.proto->name);
+      if (DeviceSetName(d, name.data(), name.size(), c->device_arena) != 0) {
+        return false;
       }
+      CircuitAddDevice(c, d);
+      continue;
     }
+
+    auto it = b->subckts.find(upper_name(e.subckt));
+    if (it == b->subckts.end()) {
+      fprintf(stderr, "Parser error: Unknown subcircuit: %.*s\n",
+              (int)e.subckt.size(), e.subckt.data());
+      return false;
+    }
+    const SubcktTemplate* sub = it->second.get();
+    if ((int)e.nodes.size() != sub->num_ports) {
+      fprintf(stderr, "Parser error: Invalid %s line: %.*s\n",
+              element_kind('X'), (int)e.line.size(), e.line.data());
+      return false;
+    }
+    std::vector<int> sub_map(1, 0);
+    for (int node : e.nodes) sub_map.push_back((*map)[node]);
+    name.assign(path).append(".").append(e.name);
+    if (!expand_instance(b, sub, name, &sub_map, depth + 1)) return false;
+  }
+  return true;
+}
+
+// Close the netlist: report an unterminated definition and expand the
+// top-level instances in file order
+static void finish_subckts(NetlistBuilder* b) {
+  if (b->defining) {
+    fprintf(stderr, "Parser error: Missing .ENDS for subcircuit: %.*s\n",
+            (int)b->defining->name.size(), b->defining->name.data());
+    b->defining.reset();
   }
 
-  return c;
+  for (const PendingInstance& x : b->instances) {
+    auto it = b->subckts.find(upper_name(x.subckt));
+    if (it == b->subckts.end()) {
+      fprintf(stderr, "Parser error: Unknown subcircuit: %.*s\n",
+              (int)x.subckt.size(), x.subckt.data());
+      continue;
+    }
+    const SubcktTemplate* t = it->second.get();
+    if ((int)x.nodes.size() != t->num_ports) {
+      fprintf(stderr, "Parser error: Invalid %s line: %.*s\n",
+              element_kind('X'), (int)x.line.size(), x.line.data());
+      continue;
+    }
+    std::vector<int> map(1, 0);
+    map.insert(map.end(), x.nodes.begin(), x.nodes.end());
+    expand_instance(b, t, std::string(x.name), &map, 1);
+  }
+  b->instances.clear();
 }
 
-Circuit* parse_netlist_string(const char* netlist) {
-  if (!netlist) return nullptr;
+// Record a top-level X line; its ports are added as nodes in file order
+static void add_instance(NetlistBuilder* b, const LineRecord& r) {
+  InstanceLine x;
+  if (!split_instance_line(r.line, &x)) {
+    fprintf(stderr, "Parser error: Invalid %s line: %.*s\n",
+            element_kind(r.type), (int)r.line.size(), r.line.data());
+    return;
+  }
+  PendingInstance p;
+  p.line = x.line;
+  p.name = x.name;
+  p.subckt = x.subckt;
+  for (std::string_view node : x.nodes) {
+    p.nodes.push_back(CircuitAddNodeN(b->c, node.data(), node.size()));
+  }
+  b->instances.push_back(std::move(p));
+}
+
+// Create the nodes and devices of tokenized lines, in order (instances are
+// only recorded, see finish_subckts)
+static void build_records(NetlistBuilder* b,
+                          const std::vector<LineRecord>& records) {
+  Circuit* c = b->c;
+  for (const LineRecord& r : records) {
+    if (r.type == '.') {
+      std::string_view rest = r.line;
+      std::string_view directive;
+      next_token(&rest, &directive);
+      if (equals_upper(directive, ".SUBCKT")) {
+        begin_subckt(b, r.line);
+      } else if (equals_upper(directive, ".ENDS")) {
+        end_subckt(b, r.line);
+      } else if (!b->defining) {
+        // Directives inside a definition are ignored
+        parse_directive(c, r.line);
+      }
+      continue;
+    }
+    if (!strchr("RCLVIDMX", r.type)) {
+      // Unknown element type - skip
+      fprintf(stderr, "Parser warning: Unknown element type: %.*s\n",
+              (int)r.name.size(), r.name.data());
+      continue;
+    }
+    if (r.error) {
+      fprintf(stderr, "Parser error: Invalid %s line: %.*s\n",
+              element_kind(r.type), (int)r.line.size(), r.line.data());
+      continue;
+    }
+
+    if (b->defining) {
+      add_subckt_element(b, r);
+      continue;
+    }
+    if (r.type == 'X') {
+      add_instance(b, r);
+      continue;
+    }
 
-  std::vector<std::string> lines;
-  std::istringstream iss(netlist);
-  std::string line;
-  while (std::getline(iss, line)) {
-    lines.push_back(line);
+    int nodes[4] = {-1, -1, -1, -1};
+    for (int k = 0; k < num_terminals(r); k++) {
+      std::string_view node = terminal(r, k);
+      nodes[k] = CircuitAddNodeN(c, node.data(), node.size());
+    }
+    Device* d = create_device(c, r, nodes);
+    if (d) CircuitAddDevice(c, d);
   }
+}
+
+// Chunks of one parallel tokenization round
+struct ChunkBatch {
+  const char* const* begin;  // begin[k], end[k]: byte range of chunk k
+  const char* const* end;
+  std::vector<LineRecord>* records;  // Output of chunk k
+};
+
+static void tokenize_chunk_task(void* user, int thread, int index) {
+  (void)thread;
+  ChunkBatch* b = static_cast<ChunkBatch*>(user);
+  tokenize_chunk(b->begin[index], b->end[index] - b->begin[index],
+                 &b->records[index]);
+}
+
+// Parse a whole buffer into a new (not yet finalized) circuit
+static Circuit* parse_buffer(const char* data, size_t size, int num_threads) {
+  Circuit* c = circuit_create();
+  if (!c) return nullptr;
+
+  ThreadPool* pool = nullptr;
+  if (num_threads != 1 && size > 0 &&
+      (num_threads > 1 || size >= kParallelParseMinBytes)) {
+    pool = ThreadPoolCreate(num_threads);
+  }
+
+  NetlistBuilder b;
+  b.c = c;
+  b.discard_defining = false;
+  if (!pool) {
+    std::vector<LineRecord> records;
+    tokenize_chunk(data, size, &records);
+    build_records(&b, records);
+    finish_subckts(&b);
+    return c;
+  }
+
+  // Split at line boundaries into a few chunks per thread
+  int threads = ThreadPoolSize(pool);
+  size_t chunk = size / (4 * (size_t)threads);
+  if (chunk < kParseChunkMinBytes) chunk = kParseChunkMinBytes;
+  if (chunk > kParseChunkMaxBytes) chunk = kParseChunkMaxBytes;
 
-  Circuit* c = parse_lines(lines);
+  std::vector<const char*> begins, ends;
+  const char* end = data + size;
+  for (const char* p = data; p < end;) {
+    const char* q = p + chunk < end ? p + chunk : end;
+    if (q < end) {
+      const char* nl = static_cast<const char*>(memchr(q, '\n', end - q));
+      q = nl ? nl + 1 : end;
+    }
+    begins.push_back(p);
+    ends.push_back(q);
+    p = q;
+  }
+
+  // Rounds of 2 chunks per thread bound the memory held in records
+  int round = 2 * threads;
+  std::vector<std::vector<LineRecord>> records(round);
+  int num_chunks = (int)begins.size();
+  for (int first = 0; first < num_chunks; first += round) {
+    int count = num_chunks - first < round ? num_chunks - first : round;
+    ChunkBatch batch = {&begins[first], &ends[first], records.data()};
+    ThreadPoolParallelFor(pool, count, tokenize_chunk_task, &batch);
+    for (int k = 0; k < count; k++) build_records(&b, records[k]);
+  }
+  finish_subckts(&b);
+
+  ThreadPoolFree(pool);
+  return c;
+}
+
+// Finalize a parsed circuit and switch device terminals from node indices
+// to MNA variable indices. Frees the circuit and returns nullptr on failure.
+static Circuit* finish_circuit(Circuit* c) {
   if (!c) return nullptr;
 
   if (CircuitFinalize(c) != 0) {
@@ -310,7 +942,6 @@ Circuit* parse_netlist_string(const char* netlist) {
     return nullptr;
   }
 
-  // Update device node arrays from node indices to var indices
   for (Device* d = c->devices; d; d = d->next) {
     for (int i = 0; i < 4; i++) {
       int node_idx = d->nodes[i];
@@ -323,6 +954,72 @@ Circuit* parse_netlist_string(const char* netlist) {
   return c;
 }
 
+// Read a file that cannot be mapped (pipe, character device) into memory
+static bool read_stream(int fd, std::vector<char>* buffer) {
+  char block[64 * 1024];
+  for (;;) {
+    ssize_t n = read(fd, block, sizeof(block));
+    if (n < 0) return false;
+    if (n == 0) return true;
+    buffer->insert(buffer->end(), block, block + n);
+  }
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+extern "C" {
+
+Circuit* parse_netlist_file(const char* filepath) {
+  if (!filepath) return nullptr;
+
+  int fd = open(filepath, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || S_ISDIR(st.st_mode)) {
+    fprintf(stderr, "Parser error: Cannot open file: %s\n", filepath);
+    if (fd >= 0) close(fd);
+    return nullptr;
+  }
+
+  Circuit* c = nullptr;
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    // Tokens point into the mapping; names are copied by the circuit
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      fprintf(stderr, "Parser error: Cannot map file: %s\n", filepath);
+      return nullptr;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    c = parse_buffer(static_cast<const char*>(map), size, 0);
+    munmap(map, size);
+  } else {
+    std::vector<char> buffer;
+    bool ok = read_stream(fd, &buffer);
+    close(fd);
+    if (!ok) {
+      fprintf(stderr, "Parser error: Cannot read file: %s\n", filepath);
+      return nullptr;
+    }
+    c = parse_buffer(buffer.data(), buffer.size(), 0);
+  }
+
+  return finish_circuit(c);
+}
+
+Circuit* parse_netlist_string(const char* netlist) {
+  if (!netlist) return nullptr;
+  return finish_circuit(parse_buffer(netlist, strlen(netlist), 0));
+}
+
+Circuit* parse_netlist_buffer(const char* data, size_t size,
+                              int num_threads) {
+  if (!data && size > 0) return nullptr;
+  return finish_circuit(parse_buffer(data, size, num_threads));
+}
+
 }  // extern "C"
 
-}  // namespace minispice
\ No newline at end of file
+}  // namespace minispice
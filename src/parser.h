@@ -18,10 +18,32 @@ extern "C" {
 //   Resistor:       Rname n1 n2 value
 //   Current Source: Iname n1 n2 value
 //   Voltage Source: Vname n1 n2 value
+//   Source values may also be written "DC value" or
+//   "PULSE(v1 v2 td tr tf pw per)" (transient waveform, DC value v1),
+//   optionally followed by "AC mag [phase]" (small-signal excitation,
+//   phase in degrees; "AC mag [phase]" alone gives DC value 0)
 //   Capacitor:      Cname n1 n2 value
 //   Inductor:       Lname n1 n2 value
 //   Diode:          Dname anode cathode [Is=value] [n=value]
+//   MOSFET:         Mname drain gate source bulk [W=] [L=] [MU=] [COX=]
+//                   [VTH0=] [GAMMA=] [PHIF=] [BETA=] (VTO= is accepted for
+//                   VTH0=; missing parameters take the MosfetParamsInit
+//                   defaults)
+//   Subcircuit:     Xname node... subckt
+// Supported directives:
+//   DC sweep:       .DC src start stop step [src2 start2 stop2 step2]
+//   AC sweep:       .AC DEC|OCT|LIN points fstart fstop
+//   Transient:      .TRAN tstep tstop [tstart [tmax]]
+//   Subcircuits:    .SUBCKT name port... / element lines / .ENDS [name]
+//                   Definitions may not nest but may instantiate other
+//                   subcircuits, defined before or after. The devices and
+//                   internal nodes of instance X1 are named "X1.R1",
+//                   "X1.node" (nested: "X1.X2.R1") and follow the top-level
+//                   devices; directives inside a definition are ignored.
+// Other directives (lines starting with '.') are ignored.
 // Comments start with * or # or //
+// The file is memory mapped and tokenized in place; files of a few MB or
+// more are tokenized in parallel (devices are still added in file order).
 // @param filepath Path to netlist file
 // @return Pointer to new Circuit, or NULL on error
 Circuit* parse_netlist_file(const char* filepath);
@@ -31,6 +53,13 @@ Circuit* parse_netlist_file(const char* filepath);
 // Returns Pointer to new Circuit, or NULL on error
 Circuit* parse_netlist_string(const char* netlist);
 
+// Parse a netlist from a buffer of size bytes (need not be NUL-terminated)
+// Same format as parse_netlist_file. Lines are tokenized on num_threads
+// threads (0 = hardware threads for large buffers, serial for small ones;
+// 1 = serial). The resulting circuit does not depend on num_threads.
+// Returns Pointer to new Circuit, or NULL on error
+Circuit* parse_netlist_buffer(const char* data, size_t size, int num_threads);
+
 #ifdef __cplusplus
 }
 #endif
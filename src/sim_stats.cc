@@ -0,0 +1,108 @@
+// Profiling counters and phase timers implementation
+//
+// Accumulation of per-workspace statistics and their JSON report.
+//
+
+#include "sim_stats.h"
+
+#include <chrono>
+#include <cstring>
+
+namespace minispice {
+
+namespace {
+
+const char* const kSimPhaseNames[kNumSimPhases] = {"stamp", "assemble",
+                                                   "factor", "solve"};
+
+}  // namespace
+
+// ============================================================================
+// SimStats API Implementation
+// ============================================================================
+
+double SimClockSeconds() {
+  using Clock = std::chrono::steady_clock;
+  return std::chrono::duration<double>(Clock::now().time_since_epoch())
+      .count();
+}
+
+const char* SimPhaseName(SimPhase phase) {
+  if (phase < 0 || phase >= kNumSimPhases) return nullptr;
+  return kSimPhaseNames[phase];
+}
+
+void SimStatsClear(SimStats* s) {
+  if (s) memset(s, 0, sizeof(*s));
+}
+
+void SimStatsAdd(SimStats* total, const SimStats* s) {
+  if (!total || !s) return;
+  for (int p = 0; p < kNumSimPhases; p++) {
+    total->phase_seconds[p] += s->phase_seconds[p];
+    total->phase_calls[p] += s->phase_calls[p];
+  }
+  total->newton_iterations += s->newton_iterations;
+  total->factorizations += s->factorizations;
+  total->krylov_iterations += s->krylov_iterations;
+  total->refinement_steps += s->refinement_steps;
+  total->precision_fallbacks += s->precision_fallbacks;
+  total->low_rank_solves += s->low_rank_solves;
+  total->pattern_compiles += s->pattern_compiles;
+  for (int k = 0; k < kNumDeviceTypes; k++) {
+    total->device_stamps[k] += s->device_stamps[k];
+  }
+  total->device_evaluations += s->device_evaluations;
+  total->bypassed_evaluations += s->bypassed_evaluations;
+
+  if (s->num_vars > total->num_vars ||
+      (s->num_vars == total->num_vars && s->lu_nnz > total->lu_nnz)) {
+    total->num_vars = s->num_vars;
+    total->sparse = s->sparse;
+    total->matrix_nnz = s->matrix_nnz;
+    total->lu_nnz = s->lu_nnz;
+    total->blocks = s->blocks;
+    total->mixed_precision = s->mixed_precision;
+  }
+}
+
+int SimStatsWriteJson(const SimStats* s, FILE* f, int indent) {
+  if (!s || !f) return -1;
+  int in = indent + 2;
+
+  fprintf(f, "{\n%*s\"phases\": {", in, "");
+  for (int p = 0; p < kNumSimPhases; p++) {
+    fprintf(f, "%s\n%*s\"%s\": {\"seconds\": %.9g, \"calls\": %ld}",
+            p ? "," : "", in + 2, "", kSimPhaseNames[p], s->phase_seconds[p],
+            s->phase_calls[p]);
+  }
+  fprintf(f, "\n%*s},\n", in, "");
+  fprintf(f, "%*s\"newton_iterations\": %ld,\n", in, "", s->newton_iterations);
+  fprintf(f, "%*s\"factorizations\": %ld,\n", in, "", s->factorizations);
+  fprintf(f, "%*s\"krylov_iterations\": %ld,\n", in, "",
+          s->krylov_iterations);
+  fprintf(f, "%*s\"refinement_steps\": %ld,\n", in, "", s->refinement_steps);
+  fprintf(f, "%*s\"precision_fallbacks\": %ld,\n", in, "",
+          s->precision_fallbacks);
+  fprintf(f, "%*s\"low_rank_solves\": %ld,\n", in, "", s->low_rank_solves);
+  fprintf(f, "%*s\"pattern_compiles\": %ld,\n", in, "", s->pattern_compiles);
+  fprintf(f, "%*s\"device_stamps\": {", in, "");
+  for (int k = 0; k < kNumDeviceTypes; k++) {
+    fprintf(f, "%s\"%s\": %ld", k ? ", " : "", DeviceTypeName(k),
+            s->device_stamps[k]);
+  }
+  fprintf(f, "},\n");
+  fprintf(f, "%*s\"device_evaluations\": %ld,\n", in, "",
+          s->device_evaluations);
+  fprintf(f, "%*s\"bypassed_evaluations\": %ld,\n", in, "",
+          s->bypassed_evaluations);
+  fprintf(f, "%*s\"matrix\": {\"num_vars\": %d, \"sparse\": %s, ", in, "",
+          s->num_vars, s->sparse ? "true" : "false");
+  fprintf(f, "\"nnz\": %ld, \"lu_nnz\": %ld, \"blocks\": %d, ",
+          s->matrix_nnz, s->lu_nnz, s->blocks);
+  fprintf(f, "\"mixed_precision\": %s}\n%*s}",
+          s->mixed_precision ? "true" : "false", indent, "");
+  return ferror(f) ? -1 : 0;
+}
+
+}  // namespace minispice
@@ -0,0 +1,91 @@
+// sim_stats.h
+// Profiling counters and phase timers of the analyses
+//
+// Every SimWorkspace counts the work of the analyses run with it: Newton
+// iterations (one linear solve each), LU factorizations, stamp pattern
+// compilations, device stamps per device type and the model evaluations
+// skipped by device bypass. When the workspace profiles (SimWorkspace::
+// profile, set from Circuit::profile for the workspaces the library creates)
+// it also times the phases of every iteration with a steady clock:
+//
+//   stamp     resetting the matrix and stamping every device
+//   assemble  discovering the stamp pattern and compiling the stamp context
+//             against the matrix storage (first iteration, pattern changes)
+//   factor    LU factorization of the assembled matrix
+//   solve     forward and back substitution
+//
+// Timing costs two clock reads per phase and iteration, which shows on
+// circuits of a few nodes, so it is off by default; the counters are
+// always kept.
+
+#ifndef MINI_SPICE_SIM_STATS_H_
+#define MINI_SPICE_SIM_STATS_H_
+
+#include <cstdio>
+
+#include "device.h"
+
+namespace minispice {
+
+// Timed phases of a Newton iteration
+enum SimPhase {
+  kSimPhaseStamp = 0,
+  kSimPhaseAssemble,
+  kSimPhaseFactor,
+  kSimPhaseSolve,
+  kNumSimPhases
+};
+
+struct SimStats {
+  // Phase timers (zero unless profiling)
+  double phase_seconds[kNumSimPhases];
+  long phase_calls[kNumSimPhases];
+
+  long newton_iterations;  // Linear solves (one per Newton iteration)
+  long factorizations;     // LU factorizations (numeric refactorizations
+                           // included) or Krylov preconditioner setups
+  long krylov_iterations;  // Iterations of the Krylov solves
+  long refinement_steps;   // Iterative refinement steps of the mixed
+                           // precision dense solves
+  long precision_fallbacks;  // Mixed precision solves redone in double
+  long low_rank_solves;    // Linear solves by a low-rank update of the kept
+                           // factors instead of a factorization
+  long pattern_compiles;   // Stamp pattern discoveries
+  long device_stamps[kNumDeviceTypes];  // Stamp calls per DeviceTypeId
+  long device_evaluations;  // Diode and MOSFET model evaluations
+  long bypassed_evaluations;
+
+  // MNA matrix (of the largest workspace when summed)
+  int num_vars;
+  int sparse;       // 1 if solved with the sparse LU
+  long matrix_nnz;  // Stored entries of the matrix (n * n when dense)
+  long lu_nnz;      // Entries of the L and U factors (n * n when dense;
+                    // of the preconditioner with a Krylov solver)
+  int blocks;       // Diagonal blocks factored apart (see btf.h; 1 unless
+                    // the sparse LU found a block triangular form)
+  int mixed_precision;  // 1 if the dense LU was factored in float (only
+                        // dense systems honour LinearSolverOptions'
+                        // mixed_precision)
+};
+
+// Seconds on a steady clock with an arbitrary origin
+double SimClockSeconds();
+
+// Name of a phase in reports ("stamp", "assemble", "factor", "solve")
+const char* SimPhaseName(SimPhase phase);
+
+// Zero every counter
+void SimStatsClear(SimStats* s);
+
+// Add the counters and timers of s to total (e.g., the workspaces of the
+// workers of a parallel sweep); the matrix fields keep the larger system
+void SimStatsAdd(SimStats* total, const SimStats* s);
+
+// Write s as one JSON object (no trailing newline), its members indented
+// by indent + 2 spaces.
+// Returns 0 on success, -1 on write error.
+int SimStatsWriteJson(const SimStats* s, FILE* f, int indent);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_SIM_STATS_H_
@@ -0,0 +1,180 @@
+// sim_stats_test.cc
+// Unit tests for the profiling counters and phase timers
+
+#include "sim_stats.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "circuit.h"
+#include "device.h"
+#include "parser.h"
+#include "workspace.h"
+
+using namespace minispice;
+
+static const char* kDiodeDeck = "V1 in 0 5\nR1 in a 1k\nR2 a b 1k\nD1 b 0\n";
+
+static int TypeOf(Circuit* c, const char* name) {
+  return DeviceTypeId(CircuitFindDevice(c, name));
+}
+
+TEST(SimStatsTest, Names) {
+  EXPECT_STREQ(SimPhaseName(kSimPhaseStamp), "stamp");
+  EXPECT_STREQ(SimPhaseName(kSimPhaseSolve), "solve");
+  EXPECT_EQ(SimPhaseName(kNumSimPhases), nullptr);
+  for (int k = 0; k < kNumDeviceTypes; k++) {
+    EXPECT_NE(DeviceTypeName(k), nullptr);
+  }
+  EXPECT_EQ(DeviceTypeName(kNumDeviceTypes), nullptr);
+}
+
+TEST(SimStatsTest, CountsDcAnalysis) {
+  Circuit* c = parse_netlist_string(kDiodeDeck);
+  ASSERT_NE(c, nullptr);
+  std::vector<double> x(c->num_vars);
+  int iterations = CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9);
+  ASSERT_GT(iterations, 0);
+
+  SimStats s;
+  SimWorkspaceGetStats(c->workspace, &s);
+  EXPECT_EQ(s.newton_iterations, iterations);
+  EXPECT_GE(s.factorizations, 1);
+  EXPECT_GE(s.pattern_compiles, 1);
+  long stamps = s.device_stamps[TypeOf(c, "D1")];
+  EXPECT_GE(stamps, iterations);
+  EXPECT_EQ(s.device_stamps[TypeOf(c, "R1")], 2 * stamps);
+  EXPECT_EQ(s.device_stamps[TypeOf(c, "V1")], stamps);
+  EXPECT_EQ(s.num_vars, c->num_vars);
+  EXPECT_EQ(s.sparse, 0);
+  EXPECT_EQ(s.matrix_nnz, (long)c->num_vars * c->num_vars);
+
+  // Timers are off unless the circuit profiles
+  for (int p = 0; p < kNumSimPhases; p++) {
+    EXPECT_EQ(s.phase_calls[p], 0);
+    EXPECT_EQ(s.phase_seconds[p], 0.0);
+  }
+
+  // A second analysis accumulates until cleared
+  ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+  SimStats t;
+  SimWorkspaceGetStats(c->workspace, &t);
+  EXPECT_GT(t.newton_iterations, s.newton_iterations);
+  SimWorkspaceClearStats(c->workspace);
+  SimWorkspaceGetStats(c->workspace, &t);
+  EXPECT_EQ(t.newton_iterations, 0);
+  EXPECT_EQ(t.factorizations, 0);
+  EXPECT_EQ(t.device_stamps[TypeOf(c, "D1")], 0);
+  EXPECT_EQ(t.num_vars, c->num_vars);  // Sizes are current, not counted
+  circuit_free(c);
+}
+
+TEST(SimStatsTest, TimesPhasesWhenProfiling) {
+  Circuit* c = parse_netlist_string(kDiodeDeck);
+  ASSERT_NE(c, nullptr);
+  c->profile = 1;
+  std::vector<double> x(c->num_vars);
+  int iterations = CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9);
+  ASSERT_GT(iterations, 0);
+
+  SimStats s;
+  SimWorkspaceGetStats(c->workspace, &s);
+  EXPECT_GE(s.phase_calls[kSimPhaseStamp], iterations);
+  EXPECT_EQ(s.phase_calls[kSimPhaseAssemble], s.pattern_compiles);
+  EXPECT_EQ(s.phase_calls[kSimPhaseFactor], s.factorizations);
+  EXPECT_EQ(s.phase_calls[kSimPhaseSolve], iterations);
+  for (int p = 0; p < kNumSimPhases; p++) {
+    EXPECT_GE(s.phase_seconds[p], 0.0) << SimPhaseName((SimPhase)p);
+  }
+
+  // Clones profile like the original
+  Circuit* clone = CircuitClone(c);
+  ASSERT_NE(clone, nullptr);
+  EXPECT_EQ(clone->profile, 1);
+  circuit_free(clone);
+  circuit_free(c);
+}
+
+TEST(SimStatsTest, SparseMatrixSizes) {
+  std::string netlist = "V1 n0 0 1\n";
+  for (int k = 0; k < 120; k++) {
+    netlist += "R" + std::to_string(k) + " n" + std::to_string(k) + " n" +
+               std::to_string(k + 1) + " 1k\n";
+  }
+  netlist += "RL n120 0 1k\n";
+  Circuit* c = parse_netlist_string(netlist.c_str());
+  ASSERT_NE(c, nullptr);
+  std::vector<double> x(c->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+
+  SimStats s;
+  SimWorkspaceGetStats(c->workspace, &s);
+  EXPECT_EQ(s.sparse, 1);
+  EXPECT_GT(s.matrix_nnz, c->num_vars);
+  EXPECT_LT(s.matrix_nnz, (long)c->num_vars * c->num_vars / 10);
+  EXPECT_GE(s.lu_nnz, s.matrix_nnz);
+  circuit_free(c);
+}
+
+TEST(SimStatsTest, AddKeepsLargerMatrix) {
+  SimStats a, b;
+  SimStatsClear(&a);
+  SimStatsClear(&b);
+  a.newton_iterations = 3;
+  a.phase_seconds[kSimPhaseFactor] = 0.5;
+  a.device_stamps[1] = 4;
+  a.num_vars = 10;
+  a.lu_nnz = 100;
+  b.newton_iterations = 5;
+  b.phase_seconds[kSimPhaseFactor] = 0.25;
+  b.device_stamps[1] = 6;
+  b.num_vars = 20;
+  b.sparse = 1;
+  b.lu_nnz = 80;
+
+  SimStatsAdd(&a, &b);
+  EXPECT_EQ(a.newton_iterations, 8);
+  EXPECT_EQ(a.phase_seconds[kSimPhaseFactor], 0.75);
+  EXPECT_EQ(a.device_stamps[1], 10);
+  EXPECT_EQ(a.num_vars, 20);
+  EXPECT_EQ(a.sparse, 1);
+  EXPECT_EQ(a.lu_nnz, 80);
+}
+
+TEST(SimStatsTest, WritesJson) {
+  SimStats s;
+  SimStatsClear(&s);
+  s.newton_iterations = 42;
+  s.phase_calls[kSimPhaseSolve] = 42;
+  s.device_stamps[5] = 7;
+  s.num_vars = 3;
+  s.matrix_nnz = 9;
+  s.lu_nnz = 9;
+  s.blocks = 1;
+
+  FILE* f = tmpfile();
+  ASSERT_NE(f, nullptr);
+  ASSERT_EQ(SimStatsWriteJson(&s, f, 0), 0);
+  long size = ftell(f);
+  rewind(f);
+  std::string json(size, '\0');
+  ASSERT_EQ(fread(&json[0], 1, size, f), (size_t)size);
+  fclose(f);
+
+  EXPECT_EQ(json.front(), '{');
+  EXPECT_EQ(json.back(), '}');
+  EXPECT_NE(json.find("\"newton_iterations\": 42,"), std::string::npos);
+  EXPECT_NE(json.find("\"solve\": {\"seconds\": 0, \"calls\": 42}"),
+            std::string::npos);
+  EXPECT_NE(json.find(std::string("\"") + DeviceTypeName(5) + "\": 7"),
+            std::string::npos);
+  EXPECT_NE(json.find("\"matrix\": {\"num_vars\": 3, \"sparse\": false, "
+                      "\"nnz\": 9, \"lu_nnz\": 9, \"blocks\": 1, "
+                      "\"mixed_precision\": false}"),
+            std::string::npos);
+  EXPECT_EQ(SimStatsWriteJson(nullptr, stdout, 0), -1);
+}
@@ -0,0 +1,495 @@
+// Circuit snapshot implementation
+//
+// A snapshot file is a fixed header followed by 8-byte aligned sections.
+// The header locates every section (offset and size in bytes); the loader
+// checks each section against the counts in the header before touching it.
+//
+
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "circuit.h"
+#include "device.h"
+#include "sparse.h"
+#include "string_arena.h"
+#include "workspace.h"
+
+namespace minispice {
+
+namespace {
+
+// File signature
+constexpr char kSnapshotMagic[8] = {'M', 'S', 'P', 'S', 'N', 'A', 'P', '\0'};
+
+// Written in host byte order; reads back differently on the other order
+constexpr uint32_t kByteOrderMark = 0x01020304u;
+
+// Values of a .DC sweep; its source name is in kSweepNames
+struct SnapshotSweep {
+  double start;
+  double stop;
+  double step;
+};
+
+// Sizes of the structures stored raw, packed into SnapshotHeader::layout
+constexpr uint32_t kLayout =
+    (uint32_t)(sizeof(SnapshotSweep) | sizeof(TranSpec) << 16);
+
+// Sections of a snapshot file
+enum SnapshotSectionId {
+  kNodeVarIndex,    // int32[num_nodes]: MNA variable of each node
+  kNodeNameEnd,     // uint64[num_nodes]: end offset of each name in kNodeNames
+  kNodeNames,       // char[]: node names, not NUL-terminated
+  kDeviceType,      // int32[num_devices]: DeviceTypeId of each device
+  kDeviceNodes,     // int32[4 * num_devices]: terminal variables
+  kDeviceExtraVar,  // int32[num_devices]: extra variable or -1
+  kDeviceNameEnd,   // uint64[num_devices]: end offset of each name in
+                    // kDeviceNames
+  kDeviceNames,     // char[]: device names, not NUL-terminated
+  kDeviceDataEnd,   // uint64[num_devices]: end offset in kDeviceData
+  kDeviceData,      // Params block then state block of each device
+  kOrderColPtr,     // int32[ordering_n + 1]: pattern of the sparse ordering
+  kOrderRowIdx,     // int32[ordering_nnz]
+  kOrder,           // int32[ordering_n]: column ordering
+  kSweepNameEnd,    // uint64[num_dc_sweeps]: end offset of each source name
+                    // in kSweepNames
+  kSweepNames,      // char[]: .DC source names, not NUL-terminated
+  kNumSections
+};
+
+struct SnapshotSection {
+  uint64_t offset;  // From the start of the file, 8-byte aligned
+  uint64_t size;    // In bytes
+};
+
+struct SnapshotHeader {
+  char magic[8];        // kSnapshotMagic
+  uint32_t version;     // kSnapshotVersion
+  uint32_t byte_order;  // kByteOrderMark
+  uint32_t header_size;  // sizeof(SnapshotHeader)
+  uint32_t layout;       // kLayout
+  uint64_t file_size;
+
+  int32_t num_nodes;  // Including ground
+  int32_t num_devices;
+  int32_t num_vars;
+  int32_t num_extra_vars;
+  int32_t is_linear;
+  int32_t num_dc_sweeps;
+  int32_t ordering_n;    // 0 if the snapshot has no sparse ordering
+  int32_t ordering_nnz;
+
+  SnapshotSweep dc_sweeps[kMaxDcSweeps];
+  TranSpec tran;
+  AcSpec ac;
+
+  SnapshotSection sections[kNumSections];
+};
+
+// ============================================================================
+// Writing
+// ============================================================================
+
+// Snapshot contents assembled in memory before the single write
+struct SnapshotWriter {
+  std::vector<char> data;
+  SnapshotHeader header;
+};
+
+// Append a section of size bytes at the next 8-byte boundary
+static void AddSection(SnapshotWriter* w, int id, const void* bytes,
+                       size_t size) {
+  w->data.resize((w->data.size() + 7) & ~(size_t)7, 0);
+  w->header.sections[id].offset = w->data.size();
+  w->header.sections[id].size = size;
+  const char* p = static_cast<const char*>(bytes);
+  if (size > 0) w->data.insert(w->data.end(), p, p + size);
+}
+
+template <typename T>
+static void AddSection(SnapshotWriter* w, int id, const std::vector<T>& v) {
+  AddSection(w, id, v.data(), v.size() * sizeof(T));
+}
+
+// Ordering of the sparse MNA pattern (see SimWorkspaceDiscoverOrdering),
+// found through the default workspace. Returns nullptr on failure.
+static SparseOrdering* DiscoverOrdering(Circuit* c) {
+  if (!c->workspace) {
+    c->workspace = SimWorkspaceCreate(c);
+    if (!c->workspace) return nullptr;
+  }
+  return SimWorkspaceDiscoverOrdering(c->workspace, c);
+}
+
+// ============================================================================
+// Reading
+// ============================================================================
+
+// Bytes of section id, or nullptr if it does not hold exactly size bytes
+// inside the file
+static const char* SectionData(const char* base, const SnapshotHeader* h,
+                               int id, uint64_t size) {
+  const SnapshotSection* s = &h->sections[id];
+  if (s->size != size || s->offset % 8 != 0 || s->offset > h->file_size ||
+      s->size > h->file_size - s->offset) {
+    return nullptr;
+  }
+  return base + s->offset;
+}
+
+// 1 if the header belongs to this format and build
+static int HeaderValid(const SnapshotHeader* h, size_t file_size) {
+  return memcmp(h->magic, kSnapshotMagic, sizeof(kSnapshotMagic)) == 0 &&
+         h->version == kSnapshotVersion && h->byte_order == kByteOrderMark &&
+         h->header_size == sizeof(SnapshotHeader) && h->layout == kLayout &&
+         h->file_size == file_size && h->num_nodes >= 1 &&
+         h->num_devices >= 0 && h->num_vars > 0 && h->num_extra_vars >= 0 &&
+         h->num_dc_sweeps >= 0 && h->num_dc_sweeps <= kMaxDcSweeps &&
+         (h->ordering_n == 0 || h->ordering_n == h->num_vars) &&
+         h->ordering_nnz >= 0;
+}
+
+// Rebuild the circuit described by a validated header. Returns nullptr if a
+// section is malformed.
+static Circuit* RestoreCircuit(const char* base, const SnapshotHeader* h) {
+  int num_nodes = h->num_nodes;
+  int num_devices = h->num_devices;
+  int num_vars = h->num_vars;
+
+  const int32_t* var_index = (const int32_t*)SectionData(
+      base, h, kNodeVarIndex, (uint64_t)num_nodes * sizeof(int32_t));
+  const uint64_t* name_end = (const uint64_t*)SectionData(
+      base, h, kNodeNameEnd, (uint64_t)num_nodes * sizeof(uint64_t));
+  const char* names = SectionData(base, h, kNodeNames,
+                                  h->sections[kNodeNames].size);
+  const int32_t* types = (const int32_t*)SectionData(
+      base, h, kDeviceType, (uint64_t)num_devices * sizeof(int32_t));
+  const int32_t* terminals = (const int32_t*)SectionData(
+      base, h, kDeviceNodes, (uint64_t)num_devices * 4 * sizeof(int32_t));
+  const int32_t* extra_vars = (const int32_t*)SectionData(
+      base, h, kDeviceExtraVar, (uint64_t)num_devices * sizeof(int32_t));
+  const uint64_t* device_name_end = (const uint64_t*)SectionData(
+      base, h, kDeviceNameEnd, (uint64_t)num_devices * sizeof(uint64_t));
+  const char* device_names = SectionData(base, h, kDeviceNames,
+                                         h->sections[kDeviceNames].size);
+  const uint64_t* data_end = (const uint64_t*)SectionData(
+      base, h, kDeviceDataEnd, (uint64_t)num_devices * sizeof(uint64_t));
+  const char* data = SectionData(base, h, kDeviceData,
+                                 h->sections[kDeviceData].size);
+  if (!var_index || !name_end || !names || !types || !terminals ||
+      !extra_vars || !device_name_end || !device_names || !data_end ||
+      !data) {
+    return nullptr;
+  }
+  uint64_t names_size = h->sections[kNodeNames].size;
+  uint64_t device_names_size = h->sections[kDeviceNames].size;
+  uint64_t data_size = h->sections[kDeviceData].size;
+
+  Circuit* c = circuit_create();
+  if (!c) return nullptr;
+
+  // Nodes in index order; ground (node 0) already exists
+  for (int i = 1; i < num_nodes; i++) {
+    uint64_t begin = name_end[i - 1];
+    uint64_t end = name_end[i];
+    int v = var_index[i];
+    if (begin > end || end > names_size || v < 0 || v >= num_vars ||
+        CircuitAddNodeN(c, names + begin, end - begin) != i) {
+      circuit_free(c);
+      return nullptr;
+    }
+    c->nodes[i].var_index = v;
+  }
+
+  // Devices in list order
+  Device** tail = &c->devices;
+  uint64_t data_begin = 0;
+  uint64_t name_begin = 0;
+  std::string name;
+  for (int k = 0; k < num_devices; k++) {
+    size_t params_size, state_size;
+    Device* d = nullptr;
+    uint64_t end = data_end[k];
+    uint64_t name_end_k = device_name_end[k];
+    int ok = DeviceTypeDataSizes(types[k], &params_size, &state_size) == 0 &&
+             data_begin <= end && end <= data_size &&
+             end - data_begin == params_size + state_size &&
+             name_begin <= name_end_k && name_end_k <= device_names_size &&
+             extra_vars[k] >= -1 && extra_vars[k] < num_vars;
+    for (int i = 0; ok && i < 4; i++) {
+      ok = terminals[4 * k + i] >= -1 && terminals[4 * k + i] < num_vars;
+    }
+    if (ok) {
+      name.assign(device_names + name_begin, name_end_k - name_begin);
+      int nodes[4];
+      memcpy(nodes, terminals + 4 * k, sizeof(nodes));
+      const char* block = data + data_begin;
+      d = DeviceCreateFromData(types[k], name.c_str(), nodes, extra_vars[k],
+                               block, params_size, block + params_size,
+                               state_size, c->device_arena);
+    }
+    if (!d) {
+      circuit_free(c);
+      return nullptr;
+    }
+    *tail = d;
+    tail = &d->next;
+    c->num_devices++;
+    data_begin = end;
+    name_begin = name_end_k;
+  }
+
+  c->num_vars = num_vars;
+  c->num_extra_vars = h->num_extra_vars;
+  c->is_linear = h->is_linear;
+  c->finalized = 1;
+  int num_sweeps = h->num_dc_sweeps;
+  const uint64_t* sweep_name_end = (const uint64_t*)SectionData(
+      base, h, kSweepNameEnd, (uint64_t)num_sweeps * sizeof(uint64_t));
+  const char* sweep_names =
+      SectionData(base, h, kSweepNames, h->sections[kSweepNames].size);
+  if (!sweep_name_end || !sweep_names) {
+    circuit_free(c);
+    return nullptr;
+  }
+  uint64_t sweep_begin = 0;
+  for (int k = 0; k < num_sweeps; k++) {
+    uint64_t sweep_end = sweep_name_end[k];
+    DcSweep* s = &c->dc_sweeps[k];
+    if (sweep_begin > sweep_end ||
+        sweep_end > h->sections[kSweepNames].size) {
+      circuit_free(c);
+      return nullptr;
+    }
+    s->source = StringArenaAdd(c->names, sweep_names + sweep_begin,
+                               sweep_end - sweep_begin);
+    if (!s->source) {
+      circuit_free(c);
+      return nullptr;
+    }
+    s->start = h->dc_sweeps[k].start;
+    s->stop = h->dc_sweeps[k].stop;
+    s->step = h->dc_sweeps[k].step;
+    sweep_begin = sweep_end;
+  }
+  c->num_dc_sweeps = num_sweeps;
+  c->tran = h->tran;
+  c->ac = h->ac;
+  if (c->ac.type < kAcDecade || c->ac.type > kAcLinear || c->ac.points < 0) {
+    c->ac.points = 0;  // Not a valid sweep: none
+  }
+
+  if (h->ordering_n > 0) {
+    int n = h->ordering_n;
+    int nnz = h->ordering_nnz;
+    const char* col_ptr = SectionData(base, h, kOrderColPtr,
+                                      (uint64_t)(n + 1) * sizeof(int32_t));
+    const char* row_idx =
+        SectionData(base, h, kOrderRowIdx, (uint64_t)nnz * sizeof(int32_t));
+    const char* order =
+        SectionData(base, h, kOrder, (uint64_t)n * sizeof(int32_t));
+    SparseOrdering* o = SparseOrderingAlloc(n, nnz);
+    if (!col_ptr || !row_idx || !order || !o) {
+      SparseOrderingFree(o);
+      circuit_free(c);
+      return nullptr;
+    }
+    memcpy(o->col_ptr, col_ptr, (n + 1) * sizeof(int));
+    memcpy(o->row_idx, row_idx, nnz * sizeof(int));
+    memcpy(o->order, order, n * sizeof(int));
+    c->sparse_ordering = o;
+  }
+
+  return c;
+}
+
+}  // namespace
+
+// ============================================================================
+// Snapshot API Implementation
+// ============================================================================
+
+int CircuitSaveSnapshot(Circuit* c, const char* path) {
+  if (!c || !c->finalized || !path) return -1;
+
+  SnapshotWriter w;
+  SnapshotHeader* h = &w.header;
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+  h->version = kSnapshotVersion;
+  h->byte_order = kByteOrderMark;
+  h->header_size = sizeof(SnapshotHeader);
+  h->layout = kLayout;
+  h->num_nodes = c->num_nodes;
+  h->num_devices = c->num_devices;
+  h->num_vars = c->num_vars;
+  h->num_extra_vars = c->num_extra_vars;
+  h->is_linear = c->is_linear;
+  h->num_dc_sweeps = c->num_dc_sweeps;
+  for (int k = 0; k < c->num_dc_sweeps; k++) {
+    h->dc_sweeps[k].start = c->dc_sweeps[k].start;
+    h->dc_sweeps[k].stop = c->dc_sweeps[k].stop;
+    h->dc_sweeps[k].step = c->dc_sweeps[k].step;
+  }
+  h->tran = c->tran;
+  h->ac = c->ac;
+  w.data.resize(sizeof(SnapshotHeader));
+
+  // Nodes
+  std::vector<int32_t> var_index(c->num_nodes);
+  std::vector<uint64_t> name_end(c->num_nodes);
+  std::vector<char> names;
+  for (int i = 0; i < c->num_nodes; i++) {
+    const char* name = c->nodes[i].name;
+    names.insert(names.end(), name, name + strlen(name));
+    var_index[i] = c->nodes[i].var_index;
+    name_end[i] = names.size();
+  }
+  AddSection(&w, kNodeVarIndex, var_index);
+  AddSection(&w, kNodeNameEnd, name_end);
+  AddSection(&w, kNodeNames, names);
+
+  // Devices, one array per field
+  int m = c->num_devices;
+  std::vector<int32_t> types(m), terminals(4 * (size_t)m), extra_vars(m);
+  std::vector<uint64_t> device_name_end(m);
+  std::vector<char> device_names;
+  std::vector<uint64_t> data_end(m);
+  std::vector<char> data;
+  int k = 0;
+  for (const Device* d = c->devices; d; d = d->next, k++) {
+    types[k] = DeviceTypeId(d);
+    if (types[k] < 0) {
+      fprintf(stderr, "Snapshot error: Unsupported device: %s\n", d->name);
+      return -1;
+    }
+    memcpy(&terminals[4 * (size_t)k], d->nodes, sizeof(d->nodes));
+    extra_vars[k] = d->extra_var;
+    device_names.insert(device_names.end(), d->name,
+                        d->name + strlen(d->name));
+    device_name_end[k] = device_names.size();
+
+    // Missing blocks are stored as zeros
+    size_t sizes[2] = {d->vt->params_size, d->vt->state_size};
+    const void* blocks[2] = {d->params, d->state};
+    for (int b = 0; b < 2; b++) {
+      size_t at = data.size();
+      data.resize(at + sizes[b], 0);
+      if (blocks[b] && sizes[b] > 0) memcpy(&data[at], blocks[b], sizes[b]);
+    }
+    data_end[k] = data.size();
+  }
+  AddSection(&w, kDeviceType, types);
+  AddSection(&w, kDeviceNodes, terminals);
+  AddSection(&w, kDeviceExtraVar, extra_vars);
+  AddSection(&w, kDeviceNameEnd, device_name_end);
+  AddSection(&w, kDeviceNames, device_names);
+  AddSection(&w, kDeviceDataEnd, data_end);
+  AddSection(&w, kDeviceData, data);
+
+  // .DC source names
+  std::vector<uint64_t> sweep_name_end(c->num_dc_sweeps);
+  std::vector<char> sweep_names;
+  for (int s = 0; s < c->num_dc_sweeps; s++) {
+    const char* source = c->dc_sweeps[s].source;
+    sweep_names.insert(sweep_names.end(), source, source + strlen(source));
+    sweep_name_end[s] = sweep_names.size();
+  }
+  AddSection(&w, kSweepNameEnd, sweep_name_end);
+  AddSection(&w, kSweepNames, sweep_names);
+
+  // Sparse ordering (kept from a loaded snapshot or discovered now)
+  SparseOrdering* discovered = nullptr;
+  const SparseOrdering* o = c->sparse_ordering;
+  if (!o && c->num_vars >= kSparseSolverThreshold) {
+    discovered = DiscoverOrdering(c);
+    o = discovered;
+  }
+  if (o) {
+    h->ordering_n = o->n;
+    h->ordering_nnz = o->nnz;
+    AddSection(&w, kOrderColPtr, o->col_ptr, (o->n + 1) * sizeof(int));
+    AddSection(&w, kOrderRowIdx, o->row_idx, o->nnz * sizeof(int));
+    AddSection(&w, kOrder, o->order, o->n * sizeof(int));
+  }
+  SparseOrderingFree(discovered);
+
+  h->file_size = w.data.size();
+  memcpy(w.data.data(), h, sizeof(*h));
+
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    fprintf(stderr, "Snapshot error: Cannot create file: %s\n", path);
+    return -1;
+  }
+  size_t written = fwrite(w.data.data(), 1, w.data.size(), f);
+  if (fclose(f) != 0 || written != w.data.size()) {
+    fprintf(stderr, "Snapshot error: Cannot write file: %s\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+Circuit* CircuitLoadSnapshot(const char* path) {
+  if (!path) return nullptr;
+
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    fprintf(stderr, "Snapshot error: Cannot open file: %s\n", path);
+    if (fd >= 0) close(fd);
+    return nullptr;
+  }
+  size_t size = (size_t)st.st_size;
+  if (size < sizeof(SnapshotHeader)) {
+    fprintf(stderr, "Snapshot error: Not a snapshot: %s\n", path);
+    close(fd);
+    return nullptr;
+  }
+
+  void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Snapshot error: Cannot map file: %s\n", path);
+    return nullptr;
+  }
+
+  const char* base = static_cast<const char*>(map);
+  SnapshotHeader h;
+  memcpy(&h, base, sizeof(h));
+  Circuit* c = nullptr;
+  if (!HeaderValid(&h, size)) {
+    fprintf(stderr,
+            "Snapshot error: Not a snapshot of this format version: %s\n",
+            path);
+  } else {
+    c = RestoreCircuit(base, &h);
+    if (!c) fprintf(stderr, "Snapshot error: Corrupt snapshot: %s\n", path);
+  }
+
+  munmap(map, size);
+  return c;
+}
+
+int IsCircuitSnapshot(const char* path) {
+  if (!path) return 0;
+
+  FILE* f = fopen(path, "rb");
+  if (!f) return 0;
+  char magic[sizeof(kSnapshotMagic)];
+  size_t n = fread(magic, 1, sizeof(magic), f);
+  fclose(f);
+  return n == sizeof(magic) && memcmp(magic, kSnapshotMagic, n) == 0;
+}
+
+}  // namespace minispice
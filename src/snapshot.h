@@ -0,0 +1,46 @@
+// snapshot.h
+// Binary snapshots of finalized circuits
+//
+// A snapshot stores everything a finalized circuit needs to run analyses
+// without parsing its netlist again: the node names and variable indices,
+// the devices as structure-of-arrays sections (type tag, terminals, extra
+// variable, name, raw params and state blocks), the analysis directives and,
+// for sparse-solved circuits (with one LU or by blocks), the pattern of the
+// MNA matrix and its fill-reducing column ordering. Loading maps the file
+// and rebuilds the circuit with a few bulk copies; the minimum-degree
+// ordering is skipped.
+//
+// The format is tied to the build that wrote it: the header records a
+// format version, the byte order and the sizes of the structures copied
+// raw, and a snapshot whose header does not match is rejected.
+
+#ifndef MINI_SPICE_SNAPSHOT_H_
+#define MINI_SPICE_SNAPSHOT_H_
+
+#include <stdint.h>
+
+namespace minispice {
+
+struct Circuit;
+
+// Version of the snapshot layout; bump on any change to it
+constexpr uint32_t kSnapshotVersion = 3;
+
+// Write a snapshot of a finalized circuit to path. For sparse-solved
+// circuits without an ordering yet, the matrix pattern is discovered by one
+// assembly at the zero solution through the circuit's default workspace.
+// Returns 0 on success, -1 on error (not finalized, I/O failure).
+int CircuitSaveSnapshot(Circuit* c, const char* path);
+
+// Load a circuit from a snapshot written by CircuitSaveSnapshot. The
+// circuit is finalized and independent of the file.
+// Returns nullptr if the file cannot be read or is not a valid snapshot of
+// this format version.
+Circuit* CircuitLoadSnapshot(const char* path);
+
+// 1 if path starts with the snapshot file signature, 0 otherwise
+int IsCircuitSnapshot(const char* path);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_SNAPSHOT_H_
@@ -0,0 +1,259 @@
+// snapshot_test.cc
+// Unit tests for binary circuit snapshots
+
+#include "snapshot.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "circuit.h"
+#include "device.h"
+#include "parser.h"
+#include "sparse.h"
+#include "workspace.h"
+
+using namespace minispice;
+
+static std::string SnapshotPath(const char* name) {
+  return ::testing::TempDir() + name;
+}
+
+// Resistor ladder with a diode at every tenth stage (sparse-solved)
+static std::string Ladder(int stages) {
+  std::string netlist = "V1 n0 0 5\n.dc V1 0 5 1\n";
+  for (int k = 0; k < stages; k++) {
+    std::string a = "n" + std::to_string(k), b = "n" + std::to_string(k + 1);
+    netlist += "R" + std::to_string(k) + " " + a + " " + b + " 1k\n";
+    netlist += "RG" + std::to_string(k) + " " + b + " 0 10k\n";
+    if (k % 10 == 0) netlist += "D" + std::to_string(k) + " " + b + " 0\n";
+  }
+  return netlist;
+}
+
+// Read a whole file
+static std::vector<char> ReadFile(const std::string& path) {
+  std::vector<char> bytes;
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) return bytes;
+  char block[4096];
+  size_t n;
+  while ((n = fread(block, 1, sizeof(block), f)) > 0) {
+    bytes.insert(bytes.end(), block, block + n);
+  }
+  fclose(f);
+  return bytes;
+}
+
+static void WriteFile(const std::string& path, const std::vector<char>& b) {
+  FILE* f = fopen(path.c_str(), "wb");
+  ASSERT_NE(f, nullptr);
+  fwrite(b.data(), 1, b.size(), f);
+  fclose(f);
+}
+
+TEST(SnapshotTest, RoundTripSmallCircuit) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 PULSE(0 1 1u 1n 1n 1u 2u)\nR1 in out 1k\nC1 out 0 1n\n"
+      "L1 out mid 1m\nD1 mid 0 Is=2e-14 n=1.2\nI1 0 out 1m\n"
+      ".dc V1 0 1 0.5\n.tran 1n 10u 0 5n\n.ac dec 10 1 1meg\n");
+  ASSERT_NE(c, nullptr);
+  std::string path = SnapshotPath("small.snap");
+  ASSERT_EQ(CircuitSaveSnapshot(c, path.c_str()), 0);
+  EXPECT_EQ(IsCircuitSnapshot(path.c_str()), 1);
+
+  Circuit* r = CircuitLoadSnapshot(path.c_str());
+  ASSERT_NE(r, nullptr);
+  EXPECT_EQ(r->finalized, 1);
+  EXPECT_EQ(r->num_nodes, c->num_nodes);
+  EXPECT_EQ(r->num_devices, c->num_devices);
+  EXPECT_EQ(r->num_vars, c->num_vars);
+  EXPECT_EQ(r->num_extra_vars, c->num_extra_vars);
+  EXPECT_EQ(r->is_linear, c->is_linear);
+  EXPECT_EQ(r->sparse_ordering, nullptr);  // Dense-solved
+  for (int i = 0; i < c->num_nodes; i++) {
+    EXPECT_STREQ(r->nodes[i].name, c->nodes[i].name);
+    EXPECT_EQ(r->nodes[i].var_index, c->nodes[i].var_index);
+    EXPECT_EQ(CircuitGetNode(r, c->nodes[i].name), i);
+  }
+  for (Device *d = c->devices, *e = r->devices; d || e;
+       d = d->next, e = e->next) {
+    ASSERT_TRUE(d && e);
+    EXPECT_STREQ(e->name, d->name);
+    EXPECT_EQ(e->vt, d->vt);
+    EXPECT_EQ(e->extra_var, d->extra_var);
+    for (int i = 0; i < 4; i++) EXPECT_EQ(e->nodes[i], d->nodes[i]);
+  }
+  double i_s, n;
+  ASSERT_EQ(DiodeGetParams(CircuitFindDevice(r, "D1"), &i_s, &n), 0);
+  EXPECT_DOUBLE_EQ(i_s, 2e-14);
+  EXPECT_DOUBLE_EQ(n, 1.2);
+  ASSERT_EQ(r->num_dc_sweeps, 1);
+  EXPECT_STREQ(r->dc_sweeps[0].source, "V1");
+  EXPECT_DOUBLE_EQ(r->dc_sweeps[0].step, 0.5);
+  EXPECT_DOUBLE_EQ(r->tran.tstop, 10e-6);
+  EXPECT_DOUBLE_EQ(r->tran.tmax, 5e-9);
+  EXPECT_EQ(r->ac.type, kAcDecade);
+  EXPECT_EQ(r->ac.points, 10);
+  EXPECT_DOUBLE_EQ(r->ac.fstop, 1e6);
+
+  std::vector<double> x(c->num_vars), y(r->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+  ASSERT_GT(CircuitDcAnalysis(r, y.data(), 100, 1e-12, 1e-9), 0);
+  for (int i = 0; i < c->num_vars; i++) EXPECT_EQ(y[i], x[i]);
+
+  circuit_free(r);
+  circuit_free(c);
+  remove(path.c_str());
+}
+
+TEST(SnapshotTest, RoundTripLongNames) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 1\nXinput_stage_with_a_rather_long_name in out stage\n"
+      "Rout out 0 1k\n"
+      ".subckt stage p q\nVbias_source_of_the_input_stage p m 0.5\n"
+      "Rseries_resistor_of_the_input_stage m q 1k\n.ends\n"
+      ".dc Xinput_stage_with_a_rather_long_name."
+      "Vbias_source_of_the_input_stage 0 1 0.5\n");
+  ASSERT_NE(c, nullptr);
+  std::string path = SnapshotPath("names.snap");
+  ASSERT_EQ(CircuitSaveSnapshot(c, path.c_str()), 0);
+  Circuit* r = CircuitLoadSnapshot(path.c_str());
+  ASSERT_NE(r, nullptr);
+  for (Device *d = c->devices, *e = r->devices; d || e;
+       d = d->next, e = e->next) {
+    ASSERT_TRUE(d && e);
+    EXPECT_STREQ(e->name, d->name);
+  }
+  const char* source =
+      "Xinput_stage_with_a_rather_long_name.Vbias_source_of_the_input_stage";
+  EXPECT_NE(CircuitFindDevice(r, source), nullptr);
+  ASSERT_EQ(r->num_dc_sweeps, 1);
+  EXPECT_STREQ(r->dc_sweeps[0].source, source);
+  EXPECT_DOUBLE_EQ(r->dc_sweeps[0].stop, 1.0);
+  circuit_free(r);
+  circuit_free(c);
+  remove(path.c_str());
+}
+
+TEST(SnapshotTest, SparseOrderingIsRestored) {
+  Circuit* c = parse_netlist_string(Ladder(200).c_str());
+  ASSERT_NE(c, nullptr);
+  ASSERT_GE(c->num_vars, kSparseSolverThreshold);
+  std::string path = SnapshotPath("ladder.snap");
+  ASSERT_EQ(CircuitSaveSnapshot(c, path.c_str()), 0);
+
+  Circuit* r = CircuitLoadSnapshot(path.c_str());
+  ASSERT_NE(r, nullptr);
+  ASSERT_NE(r->sparse_ordering, nullptr);
+  EXPECT_EQ(r->sparse_ordering->n, r->num_vars);
+
+  // A snapshot of the restored circuit is byte-identical (before any
+  // analysis updates the junction limiting state of its devices)
+  std::string again = SnapshotPath("ladder2.snap");
+  ASSERT_EQ(CircuitSaveSnapshot(r, again.c_str()), 0);
+  EXPECT_EQ(ReadFile(again), ReadFile(path));
+
+  std::vector<double> x(c->num_vars), y(r->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+  ASSERT_GT(CircuitDcAnalysis(r, y.data(), 100, 1e-12, 1e-9), 0);
+  for (int i = 0; i < c->num_vars; i++) EXPECT_EQ(y[i], x[i]);
+
+  // The restored ordering gives the same factors as a fresh minimum-degree
+  // ordering
+  ASSERT_TRUE(SparseOrderingMatches(r->sparse_ordering,
+                                    r->workspace->jacobian));
+  EXPECT_EQ(SparseLuNnz(r->workspace->lu), SparseLuNnz(c->workspace->lu));
+
+  // Clones keep the ordering
+  Circuit* clone = CircuitClone(r);
+  ASSERT_NE(clone, nullptr);
+  ASSERT_NE(clone->sparse_ordering, nullptr);
+  EXPECT_NE(clone->sparse_ordering, r->sparse_ordering);
+  circuit_free(clone);
+
+  circuit_free(r);
+  circuit_free(c);
+  remove(path.c_str());
+  remove(again.c_str());
+}
+
+TEST(SnapshotTest, OrderingOfBlockSolvedCircuit) {
+  // Independent driven ladders: the workspace factors them by blocks of the
+  // block triangular form, with no single LU to take the ordering from
+  std::string netlist;
+  for (int copy = 0; copy < 4; copy++) {
+    std::string s = std::to_string(copy);
+    netlist += "V" + s + " a" + s + "_0 0 " + std::to_string(1 + copy) + "\n";
+    for (int k = 0; k < 30; k++) {
+      std::string a = "a" + s + "_" + std::to_string(k);
+      std::string b = "a" + s + "_" + std::to_string(k + 1);
+      netlist += "R" + s + "_" + std::to_string(k) + " " + a + " " + b +
+                 " 50\n";
+    }
+    netlist += "D" + s + " a" + s + "_30 0\n";
+  }
+  Circuit* c = parse_netlist_string(netlist.c_str());
+  ASSERT_NE(c, nullptr);
+  ASSERT_GE(c->num_vars, kSparseSolverThreshold);
+  std::vector<double> x(c->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+  ASSERT_EQ(c->workspace->lu, nullptr);
+  ASSERT_NE(c->workspace->btf, nullptr);
+
+  std::string path = SnapshotPath("blocks.snap");
+  ASSERT_EQ(CircuitSaveSnapshot(c, path.c_str()), 0);
+  Circuit* r = CircuitLoadSnapshot(path.c_str());
+  ASSERT_NE(r, nullptr);
+  ASSERT_NE(r->sparse_ordering, nullptr);
+  EXPECT_EQ(r->sparse_ordering->n, r->num_vars);
+
+  std::vector<double> y(r->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(r, y.data(), 100, 1e-12, 1e-9), 0);
+  for (int i = 0; i < c->num_vars; i++) EXPECT_EQ(y[i], x[i]);
+  EXPECT_TRUE(SparseOrderingMatches(r->sparse_ordering,
+                                    r->workspace->jacobian));
+
+  circuit_free(r);
+  circuit_free(c);
+  remove(path.c_str());
+}
+
+TEST(SnapshotTest, RejectsInvalidFiles) {
+  Circuit* c = parse_netlist_string("V1 1 0 5\nR1 1 2 1k\nR2 2 0 1k\n");
+  ASSERT_NE(c, nullptr);
+  std::string path = SnapshotPath("valid.snap");
+  ASSERT_EQ(CircuitSaveSnapshot(c, path.c_str()), 0);
+  std::vector<char> bytes = ReadFile(path);
+  ASSERT_GT(bytes.size(), 64u);
+  std::string bad = SnapshotPath("bad.snap");
+
+  // Truncated
+  std::vector<char> truncated(bytes.begin(), bytes.end() - 8);
+  WriteFile(bad, truncated);
+  EXPECT_EQ(CircuitLoadSnapshot(bad.c_str()), nullptr);
+
+  // Other format version (follows the 8-byte signature)
+  std::vector<char> version = bytes;
+  version[8] ^= 0x40;
+  WriteFile(bad, version);
+  EXPECT_EQ(IsCircuitSnapshot(bad.c_str()), 1);
+  EXPECT_EQ(CircuitLoadSnapshot(bad.c_str()), nullptr);
+
+  // A netlist is not a snapshot
+  WriteFile(bad, std::vector<char>{'V', '1', ' ', '1', ' ', '0', ' ', '5'});
+  EXPECT_EQ(IsCircuitSnapshot(bad.c_str()), 0);
+  EXPECT_EQ(CircuitLoadSnapshot(bad.c_str()), nullptr);
+  EXPECT_EQ(CircuitLoadSnapshot("/nonexistent/circuit.snap"), nullptr);
+
+  // Unfinalized circuits have no snapshot
+  Circuit* open = circuit_create();
+  EXPECT_EQ(CircuitSaveSnapshot(open, path.c_str()), -1);
+  circuit_free(open);
+
+  circuit_free(c);
+  remove(path.c_str());
+  remove(bad.c_str());
+}
@@ -0,0 +1,840 @@
+// Sparse matrix and sparse LU implementation
+//
+// Implements the CSC matrix helpers and the sparse LU factorization declared
+// in sparse.h. The factorization follows the classic left-looking
+// Gilbert-Peierls algorithm: each column of L and U is obtained from a sparse
+// triangular solve whose nonzero pattern is found by a depth-first search
+// over the columns of L computed so far.
+//
+
+#include "sparse.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace minispice {
+
+// Relative threshold for accepting a diagonal pivot over the largest
+// candidate in the column (same default as KLU).
+static constexpr double kPivotTolerance = 1e-3;
+
+// Absolute magnitude below which a pivot is considered zero, matching the
+// dense solver in circuit.cc.
+static constexpr double kSingularPivot = 1e-15;
+
+// ============================================================================
+// Internal representation of SparseLu
+// ============================================================================
+
+// Factorization data, templated on the scalar type of the factors: double
+// for SparseLu, std::complex<double> for SparseComplexLu
+template <typename T>
+struct SparseLuData {
+  int n_;
+
+  // Fill-reducing column ordering: column k of the permuted matrix is
+  // column q_[k] of A
+  std::vector<int> q_;
+
+  // Row permutation: pinv_[i] is the pivot position of original row i
+  std::vector<int> pinv_;
+
+  // L factor in CSC, unit diagonal stored first in each column.
+  // Row indices are pivot positions.
+  std::vector<int> lp_;
+  std::vector<int> li_;
+  std::vector<T> lx_;
+
+  // U factor in CSC, diagonal stored last in each column.
+  // Row indices are pivot positions.
+  std::vector<int> up_;
+  std::vector<int> ui_;
+  std::vector<T> ux_;
+
+  // Work arrays for the factorization and solve
+  std::vector<T> x_;
+  std::vector<int> xi_;
+  std::vector<int> stack_;
+  std::vector<int> pstack_;
+  std::vector<char> mark_;
+  mutable std::vector<T> y_;
+
+  bool factored_;
+};
+
+struct SparseLu : SparseLuData<double> {};
+struct SparseComplexLu : SparseLuData<std::complex<double>> {};
+
+namespace {
+
+// ============================================================================
+// Approximate minimum-degree ordering
+// ============================================================================
+
+// Vertex states of the quotient graph
+enum : char {
+  kVariable,  // Not yet eliminated (principal variable)
+  kMerged,    // Indistinguishable from a principal variable, ordered with it
+  kElement,   // Eliminated; stands for the clique of its variables
+  kAbsorbed,  // Element contained in a later element
+  kDense,     // Ordered last
+};
+
+// Compute an approximate minimum-degree order (Amestoy, Davis and Duff) on
+// the symmetric pattern of A + A^T. The elimination graph is never formed:
+// an eliminated vertex becomes an element standing for the clique of its
+// neighbours, the elements it covers are absorbed, variables with the same
+// adjacency are eliminated together, and degrees are upper bounds from the
+// element sizes instead of exact unions. A step costs about the adjacency of
+// the new element, so hubs such as supply nets do not make the ordering
+// quadratic; vertices of very high degree are ordered last. Ties are broken
+// by the lowest vertex index so the ordering is deterministic.
+static void MinimumDegreeOrder(const SparseMatrix* A, std::vector<int>* order) {
+  int n = A->n;
+  std::vector<std::vector<int>> vars(n);     // Variable neighbours
+  std::vector<std::vector<int>> elems(n);    // Element neighbours
+  std::vector<std::vector<int>> members(n);  // Variables of an element
+
+  for (int j = 0; j < n; j++) {
+    for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+      int i = A->row_idx[p];
+      if (i == j) continue;
+      vars[i].push_back(j);
+      vars[j].push_back(i);
+    }
+  }
+  for (auto& a : vars) {
+    std::sort(a.begin(), a.end());
+    a.erase(std::unique(a.begin(), a.end()), a.end());
+  }
+
+  std::vector<char> state(n, kVariable);
+  std::vector<int> weight(n, 1);  // Variables a principal variable stands for
+  // Approximate external degree of a variable, total weight of an element
+  std::vector<int> degree(n);
+  std::vector<int> next(n, -1), last(n);  // Variables merged into a variable
+  std::vector<int> mark(n, 0);            // Variables of the new element
+  std::vector<int> wmark(n, 0);           // Elements with a valid outside
+  std::vector<int> outside(n);            // Weight of an element not in it
+  for (int v = 0; v < n; v++) last[v] = v;
+
+  int dense = std::max(16, static_cast<int>(10.0 * std::sqrt(double(n))));
+  std::vector<int> dense_vars;
+  for (int v = 0; v < n; v++) {
+    if (static_cast<int>(vars[v].size()) > dense) {
+      state[v] = kDense;
+      dense_vars.push_back(v);
+    }
+  }
+  int remaining = n - static_cast<int>(dense_vars.size());
+
+  using Entry = std::pair<int, int>;  // (degree, vertex)
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+  for (int v = 0; v < n; v++) {
+    if (state[v] != kVariable) continue;
+    if (!dense_vars.empty()) {
+      vars[v].erase(std::remove_if(vars[v].begin(), vars[v].end(),
+                                   [&](int u) { return state[u] == kDense; }),
+                    vars[v].end());
+    }
+    degree[v] = static_cast<int>(vars[v].size());
+    heap.push({degree[v], v});
+  }
+
+  order->clear();
+  order->reserve(n);
+  std::vector<std::pair<unsigned, int>> hashes;
+  int stamp = 0;
+
+  while (!heap.empty()) {
+    Entry top = heap.top();
+    heap.pop();
+    int p = top.second;
+    if (state[p] != kVariable || top.first != degree[p]) continue;  // Stale
+
+    for (int v = p; v >= 0; v = next[v]) order->push_back(v);
+    remaining -= weight[p];
+    state[p] = kElement;
+
+    // The new element: variables of the elements of p, which it absorbs,
+    // and the variable neighbours of p
+    stamp++;
+    std::vector<int>& lp = members[p];
+    int lp_weight = 0;
+    auto add = [&](int i) {
+      if (state[i] != kVariable || mark[i] == stamp) return;
+      mark[i] = stamp;
+      lp.push_back(i);
+      lp_weight += weight[i];
+    };
+    for (int e : elems[p]) {
+      if (state[e] != kElement) continue;
+      for (int i : members[e]) add(i);
+      state[e] = kAbsorbed;
+      std::vector<int>().swap(members[e]);
+    }
+    for (int i : vars[p]) add(i);
+    std::vector<int>().swap(vars[p]);
+    std::vector<int>().swap(elems[p]);
+    degree[p] = lp_weight;
+
+    // Weight of each element adjacent to the new one outside of it
+    for (int i : lp) {
+      for (int e : elems[i]) {
+        if (state[e] != kElement) continue;
+        if (wmark[e] != stamp) {
+          wmark[e] = stamp;
+          outside[e] = degree[e];
+        }
+        outside[e] -= weight[i];
+      }
+    }
+
+    // Drop absorbed elements and the variables now covered by p, absorb the
+    // elements p covers entirely
+    hashes.clear();
+    for (int i : lp) {
+      unsigned h = static_cast<unsigned>(p);
+      size_t k = 0;
+      for (int e : elems[i]) {
+        if (state[e] != kElement) continue;
+        if (outside[e] == 0) {
+          state[e] = kAbsorbed;
+          std::vector<int>().swap(members[e]);
+          continue;
+        }
+        elems[i][k++] = e;
+        h += static_cast<unsigned>(e);
+      }
+      elems[i].resize(k);
+      elems[i].push_back(p);
+      k = 0;
+      for (int j : vars[i]) {
+        if (state[j] != kVariable || mark[j] == stamp) continue;
+        vars[i][k++] = j;
+        h += static_cast<unsigned>(j);
+      }
+      vars[i].resize(k);
+      hashes.push_back({h, i});
+    }
+
+    // Merge indistinguishable variables: same elements, same variables
+    std::sort(hashes.begin(), hashes.end());
+    for (size_t a = 0; a < hashes.size(); a++) {
+      int i = hashes[a].second;
+      if (state[i] != kVariable) continue;
+      std::sort(elems[i].begin(), elems[i].end());
+      std::sort(vars[i].begin(), vars[i].end());
+      for (size_t b = a + 1;
+           b < hashes.size() && hashes[b].first == hashes[a].first; b++) {
+        int j = hashes[b].second;
+        if (state[j] != kVariable) continue;
+        std::sort(elems[j].begin(), elems[j].end());
+        std::sort(vars[j].begin(), vars[j].end());
+        if (elems[j] != elems[i] || vars[j] != vars[i]) continue;
+        weight[i] += weight[j];
+        weight[j] = 0;
+        state[j] = kMerged;
+        next[last[i]] = j;
+        last[i] = last[j];
+        std::vector<int>().swap(vars[j]);
+        std::vector<int>().swap(elems[j]);
+      }
+    }
+
+    // Approximate degrees: the new element, the other elements outside of
+    // it, and the remaining variable neighbours
+    for (int i : lp) {
+      if (state[i] != kVariable) continue;
+      int ext = 0;
+      for (int e : elems[i]) {
+        if (e != p && state[e] == kElement) ext += outside[e];
+      }
+      for (int j : vars[i]) ext += weight[j];
+      int others = lp_weight - weight[i];
+      int d = std::min({degree[i] + others, ext + others,
+                        remaining - weight[i]});
+      degree[i] = std::max(d, 0);
+      heap.push({degree[i], i});
+    }
+  }
+  order->insert(order->end(), dense_vars.begin(), dense_vars.end());
+}
+
+// ============================================================================
+// Sparse triangular solve helpers
+// ============================================================================
+
+// Depth-first search from original row j through the columns of L computed
+// so far. Reached rows are pushed onto xi[top-1], xi[top-2], ... in reverse
+// topological order. Returns the new top.
+template <typename T>
+static int Dfs(SparseLuData<T>* lu, int j, int top) {
+  int* xi = lu->xi_.data();
+  int* stack = lu->stack_.data();
+  int* pstack = lu->pstack_.data();
+  char* mark = lu->mark_.data();
+  const int* pinv = lu->pinv_.data();
+
+  int head = 0;
+  stack[0] = j;
+  while (head >= 0) {
+    j = stack[head];
+    int jnew = pinv[j];
+    if (!mark[j]) {
+      mark[j] = 1;
+      pstack[head] = (jnew < 0) ? 0 : lu->lp_[jnew] + 1;  // Skip unit diag
+    }
+    bool done = true;
+    int p2 = (jnew < 0) ? 0 : lu->lp_[jnew + 1];
+    for (int p = pstack[head]; p < p2; p++) {
+      int i = lu->li_[p];
+      if (mark[i]) continue;
+      pstack[head] = p + 1;
+      stack[++head] = i;
+      done = false;
+      break;
+    }
+    if (done) {
+      head--;
+      xi[--top] = j;
+    }
+  }
+  return top;
+}
+
+// Solve L * x = A(:, col) for the rows reachable from the pattern of column
+// col, with the values of A taken from values. On return x holds the
+// solution on the pattern xi[top..n-1].
+template <typename T>
+static int SparseLowerSolve(SparseLuData<T>* lu, const SparseMatrix* A,
+                            const T* values, int col) {
+  int n = lu->n_;
+  int top = n;
+
+  for (int p = A->col_ptr[col]; p < A->col_ptr[col + 1]; p++) {
+    int i = A->row_idx[p];
+    if (!lu->mark_[i]) top = Dfs(lu, i, top);
+  }
+  for (int p = top; p < n; p++) lu->mark_[lu->xi_[p]] = 0;
+
+  T* x = lu->x_.data();
+  for (int p = top; p < n; p++) x[lu->xi_[p]] = T(0);
+  for (int p = A->col_ptr[col]; p < A->col_ptr[col + 1]; p++) {
+    x[A->row_idx[p]] = values[p];
+  }
+
+  for (int px = top; px < n; px++) {
+    int j = lu->xi_[px];
+    int jnew = lu->pinv_[j];
+    if (jnew < 0) continue;  // Row j not yet pivotal
+    T xj = x[j];
+    for (int p = lu->lp_[jnew] + 1; p < lu->lp_[jnew + 1]; p++) {
+      x[lu->li_[p]] -= lu->lx_[p] * xj;
+    }
+  }
+  return top;
+}
+
+// ============================================================================
+// Factorization kernels shared by the real and complex LU
+// ============================================================================
+
+// Set up the work arrays of a factorization of dimension n with an empty
+// ordering
+template <typename T>
+static void InitLu(SparseLuData<T>* lu, int n) {
+  lu->n_ = n;
+  lu->pinv_.assign(n, -1);
+  lu->lp_.assign(n + 1, 0);
+  lu->up_.assign(n + 1, 0);
+  lu->x_.assign(n, T(0));
+  lu->xi_.assign(n, 0);
+  lu->stack_.assign(n, 0);
+  lu->pstack_.assign(n, 0);
+  lu->mark_.assign(n, 0);
+  lu->y_.assign(n, T(0));
+  lu->factored_ = false;
+}
+
+// Copy the ordering o into lu if it is a permutation computed for the
+// pattern of A. Returns false otherwise.
+template <typename T>
+static bool SetOrdering(SparseLuData<T>* lu, const SparseMatrix* A,
+                        const SparseOrdering* o) {
+  if (!SparseOrderingMatches(o, A)) return false;
+
+  // The ordering must be a permutation of the columns
+  int n = A->n;
+  std::vector<char> seen(n, 0);
+  for (int k = 0; k < n; k++) {
+    int j = o->order[k];
+    if (j < 0 || j >= n || seen[j]) return false;
+    seen[j] = 1;
+  }
+  lu->q_.assign(o->order, o->order + n);
+  return true;
+}
+
+template <typename T>
+static int Factor(SparseLuData<T>* lu, const SparseMatrix* A,
+                  const T* values) {
+  int n = lu->n_;
+  lu->factored_ = false;
+  std::fill(lu->pinv_.begin(), lu->pinv_.end(), -1);
+  lu->li_.clear();
+  lu->lx_.clear();
+  lu->ui_.clear();
+  lu->ux_.clear();
+  std::fill(lu->x_.begin(), lu->x_.end(), T(0));
+  T* x = lu->x_.data();
+
+  for (int k = 0; k < n; k++) {
+    lu->lp_[k] = static_cast<int>(lu->li_.size());
+    lu->up_[k] = static_cast<int>(lu->ui_.size());
+
+    int col = lu->q_[k];
+    int top = SparseLowerSolve(lu, A, values, col);
+
+    // Split the solution into U(:, k) and pivot candidates
+    int ipiv = -1;
+    double amax = -1.0;
+    for (int p = top; p < n; p++) {
+      int i = lu->xi_[p];
+      if (lu->pinv_[i] < 0) {
+        double t = std::abs(x[i]);
+        if (t > amax) {
+          amax = t;
+          ipiv = i;
+        }
+      } else {
+        lu->ui_.push_back(lu->pinv_[i]);
+        lu->ux_.push_back(x[i]);
+      }
+    }
+
+    if (ipiv < 0 || amax < kSingularPivot) {
+      return -2;
+    }
+
+    // Prefer the diagonal entry of the symmetrically permuted matrix
+    if (lu->pinv_[col] < 0 && std::abs(x[col]) >= amax * kPivotTolerance) {
+      ipiv = col;
+    }
+
+    T pivot = x[ipiv];
+    lu->ui_.push_back(k);
+    lu->ux_.push_back(pivot);
+    lu->pinv_[ipiv] = k;
+
+    lu->li_.push_back(ipiv);
+    lu->lx_.push_back(T(1));
+    for (int p = top; p < n; p++) {
+      int i = lu->xi_[p];
+      if (lu->pinv_[i] < 0) {
+        lu->li_.push_back(i);
+        lu->lx_.push_back(x[i] / pivot);
+      }
+      x[i] = T(0);
+    }
+  }
+
+  lu->lp_[n] = static_cast<int>(lu->li_.size());
+  lu->up_[n] = static_cast<int>(lu->ui_.size());
+
+  // Rows of L were recorded as original rows; map them to pivot positions
+  for (int& i : lu->li_) i = lu->pinv_[i];
+
+  lu->factored_ = true;
+  return 0;
+}
+
+template <typename T>
+static int Refactor(SparseLuData<T>* lu, const SparseMatrix* A,
+                    const T* values) {
+  int n = lu->n_;
+  const int* pinv = lu->pinv_.data();
+  const int* lp = lu->lp_.data();
+  const int* li = lu->li_.data();
+  const int* up = lu->up_.data();
+  const int* ui = lu->ui_.data();
+  T* lx = lu->lx_.data();
+  T* ux = lu->ux_.data();
+
+  // Dense work column indexed by pivot position; zero outside each pass
+  T* x = lu->x_.data();
+
+  for (int k = 0; k < n; k++) {
+    int col = lu->q_[k];
+    for (int p = A->col_ptr[col]; p < A->col_ptr[col + 1]; p++) {
+      x[pinv[A->row_idx[p]]] = values[p];
+    }
+
+    // U(:, k) entries are stored in topological order, so each one is final
+    // by the time it is reached
+    int pd = up[k + 1] - 1;
+    for (int p = up[k]; p < pd; p++) {
+      int j = ui[p];
+      T ujk = x[j];
+      ux[p] = ujk;
+      x[j] = T(0);
+      for (int q = lp[j] + 1; q < lp[j + 1]; q++) {
+        x[li[q]] -= lx[q] * ujk;
+      }
+    }
+
+    T pivot = x[k];
+    x[k] = T(0);
+
+    double amax = std::abs(pivot);
+    for (int q = lp[k] + 1; q < lp[k + 1]; q++) {
+      amax = std::max(amax, static_cast<double>(std::abs(x[li[q]])));
+    }
+    if (std::abs(pivot) < kSingularPivot ||
+        std::abs(pivot) < amax * kPivotTolerance) {
+      for (int q = lp[k] + 1; q < lp[k + 1]; q++) x[li[q]] = T(0);
+      lu->factored_ = false;
+      return -3;
+    }
+
+    ux[pd] = pivot;
+    for (int q = lp[k] + 1; q < lp[k + 1]; q++) {
+      lx[q] = x[li[q]] / pivot;
+      x[li[q]] = T(0);
+    }
+  }
+
+  return 0;
+}
+
+template <typename T>
+static void Solve(const SparseLuData<T>* lu, const T* b, T* x) {
+  int n = lu->n_;
+  T* y = lu->y_.data();
+
+  // y = P * b
+  for (int i = 0; i < n; i++) y[lu->pinv_[i]] = b[i];
+
+  // Forward substitution with unit lower triangular L
+  for (int j = 0; j < n; j++) {
+    T yj = y[j];
+    if (yj == T(0)) continue;
+    for (int p = lu->lp_[j] + 1; p < lu->lp_[j + 1]; p++) {
+      y[lu->li_[p]] -= lu->lx_[p] * yj;
+    }
+  }
+
+  // Back substitution with U (diagonal stored last)
+  for (int j = n - 1; j >= 0; j--) {
+    int pd = lu->up_[j + 1] - 1;
+    y[j] /= lu->ux_[pd];
+    T yj = y[j];
+    if (yj == T(0)) continue;
+    for (int p = lu->up_[j]; p < pd; p++) {
+      y[lu->ui_[p]] -= lu->ux_[p] * yj;
+    }
+  }
+
+  // x = Q * y
+  for (int k = 0; k < n; k++) x[lu->q_[k]] = y[k];
+}
+
+}  // namespace
+
+// ============================================================================
+// SparseMatrix API Implementation
+// ============================================================================
+
+SparseMatrix* SparseCreateFromTriplets(int n, const Triplet* triplets,
+                                       size_t count) {
+  if (n <= 0) return nullptr;
+
+  SparseMatrix* A = static_cast<SparseMatrix*>(calloc(1, sizeof(SparseMatrix)));
+  if (!A) return nullptr;
+  A->n = n;
+
+  // Count entries per column, then bucket the triplets by column
+  std::vector<int> counts(n + 1, 0);
+  for (size_t k = 0; k < count; k++) {
+    const Triplet& t = triplets[k];
+    if (t.row < 0 || t.row >= n || t.col < 0 || t.col >= n) continue;
+    counts[t.col + 1]++;
+  }
+  for (int j = 0; j < n; j++) counts[j + 1] += counts[j];
+
+  std::vector<std::pair<int, double>> bucket(counts[n]);
+  std::vector<int> next(counts.begin(), counts.end() - 1);
+  for (size_t k = 0; k < count; k++) {
+    const Triplet& t = triplets[k];
+    if (t.row < 0 || t.row >= n || t.col < 0 || t.col >= n) continue;
+    bucket[next[t.col]++] = {t.row, t.val};
+  }
+
+  // Sort each column by row (stable, so duplicates sum in stamping order)
+  // and merge duplicates
+  A->col_ptr = static_cast<int*>(malloc((n + 1) * sizeof(int)));
+  A->row_idx = static_cast<int*>(malloc((bucket.size() + 1) * sizeof(int)));
+  A->values =
+      static_cast<double*>(malloc((bucket.size() + 1) * sizeof(double)));
+  if (!A->col_ptr || !A->row_idx || !A->values) {
+    SparseFree(A);
+    return nullptr;
+  }
+
+  int nz = 0;
+  for (int j = 0; j < n; j++) {
+    A->col_ptr[j] = nz;
+    auto first = bucket.begin() + counts[j];
+    auto last = bucket.begin() + counts[j + 1];
+    std::stable_sort(first, last, [](const auto& a, const auto& b) {
+      return a.first < b.first;
+    });
+    for (auto it = first; it != last; ++it) {
+      if (nz > A->col_ptr[j] && A->row_idx[nz - 1] == it->first) {
+        A->values[nz - 1] += it->second;
+      } else {
+        A->row_idx[nz] = it->first;
+        A->values[nz] = it->second;
+        nz++;
+      }
+    }
+  }
+  A->col_ptr[n] = nz;
+  A->nnz = nz;
+
+  return A;
+}
+
+void SparseFree(SparseMatrix* A) {
+  if (!A) return;
+  free(A->col_ptr);
+  free(A->row_idx);
+  free(A->values);
+  free(A);
+}
+
+// Position of (row, col) in the value array of A, or -1 if not stored
+static int FindEntry(const SparseMatrix* A, int row, int col) {
+  if (row < 0 || row >= A->n || col < 0 || col >= A->n) return -1;
+
+  const int* first = A->row_idx + A->col_ptr[col];
+  const int* last = A->row_idx + A->col_ptr[col + 1];
+  const int* it = std::lower_bound(first, last, row);
+  if (it == last || *it != row) return -1;
+  return static_cast<int>(it - A->row_idx);
+}
+
+int SparseAssembleTriplets(SparseMatrix* A, const Triplet* triplets,
+                           size_t count) {
+  if (!A) return -1;
+
+  std::fill(A->values, A->values + A->nnz, 0.0);
+
+  int n = A->n;
+  for (size_t k = 0; k < count; k++) {
+    const Triplet& t = triplets[k];
+    if (t.row < 0 || t.row >= n || t.col < 0 || t.col >= n) continue;
+
+    int p = FindEntry(A, t.row, t.col);
+    if (p < 0) return -1;
+    A->values[p] += t.val;
+  }
+  return 0;
+}
+
+int SparseFindSlots(const SparseMatrix* A, const Triplet* triplets,
+                    size_t count, int* slots) {
+  if (!A) return -1;
+
+  for (size_t k = 0; k < count; k++) {
+    slots[k] = FindEntry(A, triplets[k].row, triplets[k].col);
+    if (slots[k] < 0) return -1;
+  }
+  return 0;
+}
+
+// ============================================================================
+// SparseLu API Implementation
+// ============================================================================
+
+SparseLu* SparseLuCreate(const SparseMatrix* A) {
+  if (!A || A->n <= 0) return nullptr;
+
+  SparseLu* lu = new (std::nothrow) SparseLu;
+  if (!lu) return nullptr;
+  InitLu(lu, A->n);
+  MinimumDegreeOrder(A, &lu->q_);
+  return lu;
+}
+
+SparseLu* SparseLuCreateWithOrdering(const SparseMatrix* A,
+                                     const SparseOrdering* o) {
+  if (!A || A->n <= 0) return nullptr;
+
+  SparseLu* lu = new (std::nothrow) SparseLu;
+  if (!lu) return nullptr;
+  InitLu(lu, A->n);
+  if (!SetOrdering(lu, A, o)) {
+    delete lu;
+    return nullptr;
+  }
+  return lu;
+}
+
+void SparseLuFree(SparseLu* lu) {
+  if (lu) {
+    delete lu;
+  }
+}
+
+int SparseLuFactor(SparseLu* lu, const SparseMatrix* A) {
+  if (!lu || !A || A->n != lu->n_) return -2;
+  return Factor(lu, A, A->values);
+}
+
+int SparseLuRefactor(SparseLu* lu, const SparseMatrix* A) {
+  if (!lu || !A || A->n != lu->n_ || !lu->factored_) return -1;
+  return Refactor(lu, A, A->values);
+}
+
+int SparseLuSolve(const SparseLu* lu, const double* b, double* x) {
+  if (!lu || !lu->factored_ || !b || !x) return -1;
+  Solve(lu, b, x);
+  return 0;
+}
+
+int SparseLuNnz(const SparseLu* lu) {
+  if (!lu || !lu->factored_) return 0;
+  return static_cast<int>(lu->li_.size() + lu->ui_.size());
+}
+
+// ============================================================================
+// SparseComplexLu API Implementation
+// ============================================================================
+
+SparseComplexLu* SparseComplexLuCreate(const SparseMatrix* A,
+                                       const SparseOrdering* o) {
+  if (!A || A->n <= 0) return nullptr;
+
+  SparseComplexLu* lu = new (std::nothrow) SparseComplexLu;
+  if (!lu) return nullptr;
+  InitLu(lu, A->n);
+  if (!o) {
+    MinimumDegreeOrder(A, &lu->q_);
+  } else if (!SetOrdering(lu, A, o)) {
+    delete lu;
+    return nullptr;
+  }
+  return lu;
+}
+
+void SparseComplexLuFree(SparseComplexLu* lu) {
+  if (lu) {
+    delete lu;
+  }
+}
+
+int SparseComplexLuFactor(SparseComplexLu* lu, const SparseMatrix* A,
+                          const std::complex<double>* values) {
+  if (!lu || !A || !values || A->n != lu->n_) return -2;
+  return Factor(lu, A, values);
+}
+
+int SparseComplexLuRefactor(SparseComplexLu* lu, const SparseMatrix* A,
+                            const std::complex<double>* values) {
+  if (!lu || !A || !values || A->n != lu->n_ || !lu->factored_) return -1;
+  return Refactor(lu, A, values);
+}
+
+int SparseComplexLuSolve(const SparseComplexLu* lu,
+                         const std::complex<double>* b,
+                         std::complex<double>* x) {
+  if (!lu || !lu->factored_ || !b || !x) return -1;
+  Solve(lu, b, x);
+  return 0;
+}
+
+int SparseComplexLuNnz(const SparseComplexLu* lu) {
+  if (!lu || !lu->factored_) return 0;
+  return static_cast<int>(lu->li_.size() + lu->ui_.size());
+}
+
+// ============================================================================
+// SparseOrdering API Implementation
+// ============================================================================
+
+SparseOrdering* SparseOrderingAlloc(int n, int nnz) {
+  if (n <= 0 || nnz < 0) return nullptr;
+
+  SparseOrdering* o = (SparseOrdering*)calloc(1, sizeof(SparseOrdering));
+  if (!o) return nullptr;
+  o->n = n;
+  o->nnz = nnz;
+  o->col_ptr = (int*)malloc((n + 1) * sizeof(int));
+  o->row_idx = (int*)malloc((nnz > 0 ? nnz : 1) * sizeof(int));
+  o->order = (int*)malloc(n * sizeof(int));
+  if (!o->col_ptr || !o->row_idx || !o->order) {
+    SparseOrderingFree(o);
+    return nullptr;
+  }
+  return o;
+}
+
+SparseOrdering* SparseOrderingCreate(const SparseMatrix* A,
+                                     const SparseLu* lu) {
+  if (!A || !lu || lu->n_ != A->n) return nullptr;
+
+  SparseOrdering* o = SparseOrderingAlloc(A->n, A->nnz);
+  if (!o) return nullptr;
+  memcpy(o->col_ptr, A->col_ptr, (A->n + 1) * sizeof(int));
+  memcpy(o->row_idx, A->row_idx, A->nnz * sizeof(int));
+  memcpy(o->order, lu->q_.data(), A->n * sizeof(int));
+  return o;
+}
+
+SparseOrdering* SparseOrderingCompute(const SparseMatrix* A) {
+  if (!A || A->n <= 0) return nullptr;
+
+  std::vector<int> order;
+  MinimumDegreeOrder(A, &order);
+  SparseOrdering* o = SparseOrderingAlloc(A->n, A->nnz);
+  if (!o) return nullptr;
+  memcpy(o->col_ptr, A->col_ptr, (A->n + 1) * sizeof(int));
+  memcpy(o->row_idx, A->row_idx, A->nnz * sizeof(int));
+  memcpy(o->order, order.data(), A->n * sizeof(int));
+  return o;
+}
+
+SparseOrdering* SparseOrderingCopy(const SparseOrdering* o) {
+  if (!o) return nullptr;
+
+  SparseOrdering* copy = SparseOrderingAlloc(o->n, o->nnz);
+  if (!copy) return nullptr;
+  memcpy(copy->col_ptr, o->col_ptr, (o->n + 1) * sizeof(int));
+  memcpy(copy->row_idx, o->row_idx, o->nnz * sizeof(int));
+  memcpy(copy->order, o->order, o->n * sizeof(int));
+  return copy;
+}
+
+void SparseOrderingFree(SparseOrdering* o) {
+  if (!o) return;
+
+  free(o->col_ptr);
+  free(o->row_idx);
+  free(o->order);
+  free(o);
+}
+
+int SparseOrderingMatches(const SparseOrdering* o, const SparseMatrix* A) {
+  if (!o || !A || o->n != A->n || o->nnz != A->nnz) return 0;
+  return memcmp(o->col_ptr, A->col_ptr, (A->n + 1) * sizeof(int)) == 0 &&
+         memcmp(o->row_idx, A->row_idx, A->nnz * sizeof(int)) == 0;
+}
+
+}  // namespace minispice
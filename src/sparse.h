@@ -0,0 +1,189 @@
+// sparse.h
+// Compressed sparse column (CSC) matrices and a sparse LU factorization
+//
+// The sparse path is used by the DC analysis for circuits that are too large
+// for the dense Gaussian elimination solver. Triplets collected by the
+// StampContext are compressed into CSC form, a fill-reducing column ordering
+// is computed, and the matrix is factored with a left-looking
+// (Gilbert-Peierls) LU with threshold partial pivoting. The AC analysis
+// factors complex matrices on the same patterns with the same algorithm
+// (SparseComplexLu).
+
+#ifndef MINI_SPICE_SPARSE_H_
+#define MINI_SPICE_SPARSE_H_
+
+#include <stddef.h>
+
+#include <complex>
+
+#include "stamp.h"
+
+namespace minispice {
+
+// Square sparse matrix in compressed sparse column format.
+// Row indices within each column are sorted and unique.
+struct SparseMatrix {
+  int n;           // Matrix dimension (n x n)
+  int nnz;         // Number of stored entries
+  int* col_ptr;    // Column start offsets (length n + 1)
+  int* row_idx;    // Row index of each stored entry (length nnz)
+  double* values;  // Value of each stored entry (length nnz)
+};
+
+// Opaque sparse LU factorization (ordering + L and U factors)
+struct SparseLu;
+
+// Opaque complex sparse LU factorization
+struct SparseComplexLu;
+
+// Column ordering computed for a sparse pattern. Kept to skip the
+// minimum-degree step when a matrix with the same pattern is factored again
+// (e.g., after restoring a circuit snapshot).
+struct SparseOrdering {
+  int n;         // Matrix dimension
+  int nnz;       // Number of entries of the pattern
+  int* col_ptr;  // Pattern the ordering belongs to (length n + 1)
+  int* row_idx;  // (length nnz)
+  int* order;    // Column k of the permuted matrix is column order[k]
+};
+
+// ============================================================================
+// SparseMatrix API
+// ============================================================================
+
+// Build a CSC matrix from COO triplets. Duplicate (row, col) entries are
+// summed. Out-of-range triplets are ignored.
+// Returns nullptr on allocation failure or invalid dimension.
+SparseMatrix* SparseCreateFromTriplets(int n, const Triplet* triplets,
+                                       size_t count);
+
+// Free a sparse matrix and its arrays
+void SparseFree(SparseMatrix* A);
+
+// Overwrite the values of A with the sum of the given triplets, keeping the
+// existing pattern. Entries of the pattern not hit by any triplet become zero.
+// Returns 0 on success, -1 if a triplet falls outside the pattern (values are
+// then unspecified and the matrix should be rebuilt).
+int SparseAssembleTriplets(SparseMatrix* A, const Triplet* triplets,
+                           size_t count);
+
+// Find the position in A->values of every triplet: slots[k] receives the
+// value index of (triplets[k].row, triplets[k].col). Used to compile stamp
+// call sequences against the matrix storage.
+// Returns 0 on success, -1 if a triplet falls outside the pattern.
+int SparseFindSlots(const SparseMatrix* A, const Triplet* triplets,
+                    size_t count, int* slots);
+
+// ============================================================================
+// SparseLu API
+// ============================================================================
+
+// Create a factorization object for matrices with the pattern of A.
+// Computes an approximate minimum-degree column ordering on the pattern of
+// A + A^T.
+// Returns nullptr on allocation failure.
+SparseLu* SparseLuCreate(const SparseMatrix* A);
+
+// Same as SparseLuCreate with the ordering o instead of a minimum-degree
+// ordering. Returns nullptr if o was computed for a different pattern, is not
+// a permutation, or on allocation failure.
+SparseLu* SparseLuCreateWithOrdering(const SparseMatrix* A,
+                                     const SparseOrdering* o);
+
+// Free a factorization object
+void SparseLuFree(SparseLu* lu);
+
+// Numerically factor A (same dimension as the matrix given to SparseLuCreate)
+// with threshold partial pivoting. Diagonal pivots are preferred when they
+// are within the pivot tolerance of the largest candidate.
+// Returns 0 on success, -2 if the matrix is structurally or numerically
+// singular.
+int SparseLuFactor(SparseLu* lu, const SparseMatrix* A);
+
+// Numerically refactor A reusing the pivot sequence and the L/U nonzero
+// pattern of the last successful SparseLuFactor. A must have the same pattern
+// as the matrix given to that call. No ordering, graph search or pivot search
+// is performed, only the numeric elimination.
+// Returns 0 on success, -1 if there is no previous factorization, -3 if a
+// reused pivot became too small relative to its column (call SparseLuFactor
+// to pick new pivots).
+int SparseLuRefactor(SparseLu* lu, const SparseMatrix* A);
+
+// Solve A * x = b using a previously computed factorization.
+// b and x are length n and may not alias.
+// Returns 0 on success, -1 if the factorization is not valid.
+int SparseLuSolve(const SparseLu* lu, const double* b, double* x);
+
+// Number of stored entries in L and U (including the diagonals).
+// Useful to judge the fill-in produced by the ordering.
+int SparseLuNnz(const SparseLu* lu);
+
+// ============================================================================
+// SparseComplexLu API
+// ============================================================================
+//
+// Complex matrices are given as the pattern of a SparseMatrix (its values
+// are ignored) and an array of nnz complex values in the order of the
+// pattern's entries. Pivoting, reuse of the pivot sequence and the return
+// codes are those of the real SparseLu functions.
+
+// Create a complex factorization object for the pattern of A, with the
+// column ordering o, or a minimum-degree ordering if o is nullptr. Several
+// factorization objects (e.g., one per thread) can share one ordering.
+// Returns nullptr if o was computed for a different pattern, is not a
+// permutation, or on allocation failure.
+SparseComplexLu* SparseComplexLuCreate(const SparseMatrix* A,
+                                       const SparseOrdering* o);
+
+// Free a complex factorization object
+void SparseComplexLuFree(SparseComplexLu* lu);
+
+// Numerically factor the matrix with the pattern of A and the given values
+// (see SparseLuFactor)
+int SparseComplexLuFactor(SparseComplexLu* lu, const SparseMatrix* A,
+                          const std::complex<double>* values);
+
+// Refactor reusing the pivot sequence of the last successful factorization
+// (see SparseLuRefactor)
+int SparseComplexLuRefactor(SparseComplexLu* lu, const SparseMatrix* A,
+                            const std::complex<double>* values);
+
+// Solve with the factored matrix. b and x are length n and may not alias.
+// Returns 0 on success, -1 if the factorization is not valid.
+int SparseComplexLuSolve(const SparseComplexLu* lu,
+                         const std::complex<double>* b,
+                         std::complex<double>* x);
+
+// Number of stored entries in L and U (including the diagonals)
+int SparseComplexLuNnz(const SparseComplexLu* lu);
+
+// ============================================================================
+// SparseOrdering API
+// ============================================================================
+
+// Allocate an ordering with uninitialized arrays for an n x n pattern with
+// nnz entries. Returns nullptr on allocation failure or invalid sizes.
+SparseOrdering* SparseOrderingAlloc(int n, int nnz);
+
+// Copy the pattern of A and the column ordering of lu (created for A).
+// Returns nullptr on allocation failure or mismatched dimensions.
+SparseOrdering* SparseOrderingCreate(const SparseMatrix* A,
+                                     const SparseLu* lu);
+
+// Copy the pattern of A and compute its minimum-degree column ordering
+// (the ordering of SparseLuCreate). Returns nullptr on allocation failure or
+// invalid dimension.
+SparseOrdering* SparseOrderingCompute(const SparseMatrix* A);
+
+// Deep copy of an ordering. Returns nullptr on allocation failure.
+SparseOrdering* SparseOrderingCopy(const SparseOrdering* o);
+
+// Free an ordering and its arrays
+void SparseOrderingFree(SparseOrdering* o);
+
+// 1 if o was computed for exactly the pattern of A, 0 otherwise
+int SparseOrderingMatches(const SparseOrdering* o, const SparseMatrix* A);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_SPARSE_H_
@@ -0,0 +1,348 @@
+// sparse_test.cc
+// Unit tests for the CSC matrix helpers and sparse LU factorization
+
+#include "sparse.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <complex>
+#include <vector>
+
+using namespace minispice;
+
+// Multiply CSC matrix by vector: y = A * x
+static std::vector<double> MatVec(const SparseMatrix* A,
+                                  const std::vector<double>& x) {
+  std::vector<double> y(A->n, 0.0);
+  for (int j = 0; j < A->n; j++) {
+    for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+      y[A->row_idx[p]] += A->values[p] * x[j];
+    }
+  }
+  return y;
+}
+
+// ============================================================================
+// SparseMatrix Tests
+// ============================================================================
+
+TEST(SparseMatrixTest, CreateFromTriplets) {
+  std::vector<Triplet> t = {{1, 0, 3.0}, {0, 0, 1.0}, {1, 1, 4.0},
+                            {0, 1, 2.0}};
+  SparseMatrix* A = SparseCreateFromTriplets(2, t.data(), t.size());
+  ASSERT_NE(A, nullptr);
+
+  EXPECT_EQ(A->n, 2);
+  EXPECT_EQ(A->nnz, 4);
+  EXPECT_EQ(A->col_ptr[0], 0);
+  EXPECT_EQ(A->col_ptr[1], 2);
+  EXPECT_EQ(A->col_ptr[2], 4);
+
+  // Rows are sorted within each column
+  EXPECT_EQ(A->row_idx[0], 0);
+  EXPECT_EQ(A->row_idx[1], 1);
+  EXPECT_DOUBLE_EQ(A->values[0], 1.0);
+  EXPECT_DOUBLE_EQ(A->values[1], 3.0);
+
+  SparseFree(A);
+}
+
+TEST(SparseMatrixTest, DuplicatesAreSummed) {
+  std::vector<Triplet> t = {{0, 0, 1.0}, {0, 0, 2.0}, {0, 0, 3.0}};
+  SparseMatrix* A = SparseCreateFromTriplets(1, t.data(), t.size());
+  ASSERT_NE(A, nullptr);
+
+  EXPECT_EQ(A->nnz, 1);
+  EXPECT_DOUBLE_EQ(A->values[0], 6.0);
+
+  SparseFree(A);
+}
+
+TEST(SparseMatrixTest, IgnoreOutOfBounds) {
+  std::vector<Triplet> t = {{-1, 0, 1.0}, {0, 2, 1.0}, {1, 1, 5.0}};
+  SparseMatrix* A = SparseCreateFromTriplets(2, t.data(), t.size());
+  ASSERT_NE(A, nullptr);
+
+  EXPECT_EQ(A->nnz, 1);
+  EXPECT_EQ(A->row_idx[0], 1);
+
+  SparseFree(A);
+}
+
+TEST(SparseMatrixTest, InvalidDimension) {
+  EXPECT_EQ(SparseCreateFromTriplets(0, nullptr, 0), nullptr);
+}
+
+// ============================================================================
+// SparseLu Tests
+// ============================================================================
+
+TEST(SparseLuTest, SolveSmallSystem) {
+  // [ 2, -1 ] x = [ 1 ]  ->  x = [1, 1]
+  // [-1,  2 ]     [ 1 ]
+  std::vector<Triplet> t = {{0, 0, 2.0}, {0, 1, -1.0}, {1, 0, -1.0},
+                            {1, 1, 2.0}};
+  SparseMatrix* A = SparseCreateFromTriplets(2, t.data(), t.size());
+  SparseLu* lu = SparseLuCreate(A);
+  ASSERT_NE(lu, nullptr);
+  ASSERT_EQ(SparseLuFactor(lu, A), 0);
+
+  double b[2] = {1.0, 1.0};
+  double x[2] = {0.0, 0.0};
+  ASSERT_EQ(SparseLuSolve(lu, b, x), 0);
+  EXPECT_NEAR(x[0], 1.0, 1e-12);
+  EXPECT_NEAR(x[1], 1.0, 1e-12);
+
+  SparseLuFree(lu);
+  SparseFree(A);
+}
+
+TEST(SparseLuTest, ZeroDiagonalRequiresPivoting) {
+  // MNA system of a voltage source V=5 across a 1k resistor:
+  //   [ g  1 ] [v]   [0]
+  //   [ 1  0 ] [i] = [5]
+  std::vector<Triplet> t = {{0, 0, 1e-3}, {0, 1, 1.0}, {1, 0, 1.0}};
+  SparseMatrix* A = SparseCreateFromTriplets(2, t.data(), t.size());
+  SparseLu* lu = SparseLuCreate(A);
+  ASSERT_EQ(SparseLuFactor(lu, A), 0);
+
+  double b[2] = {0.0, 5.0};
+  double x[2];
+  ASSERT_EQ(SparseLuSolve(lu, b, x), 0);
+  EXPECT_NEAR(x[0], 5.0, 1e-12);
+  EXPECT_NEAR(x[1], -5e-3, 1e-12);
+
+  SparseLuFree(lu);
+  SparseFree(A);
+}
+
+TEST(SparseLuTest, SingularMatrix) {
+  std::vector<Triplet> t = {{0, 0, 1.0}, {0, 1, 1.0}, {1, 0, 1.0},
+                            {1, 1, 1.0}};
+  SparseMatrix* A = SparseCreateFromTriplets(2, t.data(), t.size());
+  SparseLu* lu = SparseLuCreate(A);
+  EXPECT_EQ(SparseLuFactor(lu, A), -2);
+
+  double b[2] = {1.0, 1.0};
+  double x[2];
+  EXPECT_EQ(SparseLuSolve(lu, b, x), -1);
+
+  SparseLuFree(lu);
+  SparseFree(A);
+}
+
+TEST(SparseLuTest, ResistorGridResidual) {
+  // 2D resistor mesh with every node tied to ground through a conductance
+  // and an unsymmetric coupling term, solved against a known solution.
+  const int nx = 12;
+  const int n = nx * nx;
+  std::vector<Triplet> t;
+  for (int r = 0; r < nx; r++) {
+    for (int c = 0; c < nx; c++) {
+      int i = r * nx + c;
+      t.push_back({i, i, 0.1});
+      if (c + 1 < nx) {
+        int j = i + 1;
+        t.push_back({i, i, 1.0});
+        t.push_back({j, j, 1.0});
+        t.push_back({i, j, -1.0});
+        t.push_back({j, i, -0.5});
+      }
+      if (r + 1 < nx) {
+        int j = i + nx;
+        t.push_back({i, i, 2.0});
+        t.push_back({j, j, 2.0});
+        t.push_back({i, j, -2.0});
+        t.push_back({j, i, -2.0});
+      }
+    }
+  }
+
+  SparseMatrix* A = SparseCreateFromTriplets(n, t.data(), t.size());
+  SparseLu* lu = SparseLuCreate(A);
+  ASSERT_EQ(SparseLuFactor(lu, A), 0);
+
+  // Fill-reducing ordering keeps the factors far below dense storage
+  EXPECT_LT(SparseLuNnz(lu), n * n / 4);
+
+  std::vector<double> x_ref(n);
+  for (int i = 0; i < n; i++) x_ref[i] = std::sin(0.1 * i) + 1.0;
+  std::vector<double> b = MatVec(A, x_ref);
+
+  std::vector<double> x(n, 0.0);
+  ASSERT_EQ(SparseLuSolve(lu, b.data(), x.data()), 0);
+  for (int i = 0; i < n; i++) {
+    EXPECT_NEAR(x[i], x_ref[i], 1e-10);
+  }
+
+  SparseLuFree(lu);
+  SparseFree(A);
+}
+
+TEST(SparseLuTest, HubsKeepOrderingSparse) {
+  // A resistor chain whose every node also connects to one supply net, and
+  // every tenth node to a local bus of ten taps: the supply is eliminated
+  // last and neither hub fills the factors
+  const int n = 20001;
+  const int hub = n - 1;
+  std::vector<Triplet> t;
+  for (int i = 0; i < hub; i++) {
+    t.push_back({i, i, 3.0});
+    t.push_back({hub, hub, 1.0});
+    t.push_back({i, hub, -1.0});
+    t.push_back({hub, i, -1.0});
+    if (i + 1 < hub) {
+      t.push_back({i, i + 1, -1.0});
+      t.push_back({i + 1, i, -1.0});
+    }
+    int bus = i / 100 * 100;
+    if (i % 10 == 0 && i != bus) {
+      t.push_back({i, bus, -0.5});
+      t.push_back({bus, i, -0.5});
+      t.push_back({bus, bus, 0.5});
+    }
+  }
+  t.push_back({hub, hub, 1.0});
+
+  SparseMatrix* A = SparseCreateFromTriplets(n, t.data(), t.size());
+  ASSERT_NE(A, nullptr);
+  SparseOrdering* o = SparseOrderingCompute(A);
+  ASSERT_NE(o, nullptr);
+  std::vector<char> seen(n, 0);
+  for (int k = 0; k < n; k++) {
+    ASSERT_GE(o->order[k], 0);
+    ASSERT_LT(o->order[k], n);
+    ASSERT_FALSE(seen[o->order[k]]);
+    seen[o->order[k]] = 1;
+  }
+  EXPECT_EQ(o->order[n - 1], hub);
+  SparseOrderingFree(o);
+
+  SparseLu* lu = SparseLuCreate(A);
+  ASSERT_NE(lu, nullptr);
+  ASSERT_EQ(SparseLuFactor(lu, A), 0);
+  EXPECT_LT(SparseLuNnz(lu), 8 * n);
+
+  std::vector<double> x_ref(n);
+  for (int i = 0; i < n; i++) x_ref[i] = std::cos(0.01 * i);
+  std::vector<double> b = MatVec(A, x_ref);
+  std::vector<double> x(n, 0.0);
+  ASSERT_EQ(SparseLuSolve(lu, b.data(), x.data()), 0);
+  for (int i = 0; i < n; i++) EXPECT_NEAR(x[i], x_ref[i], 1e-9);
+
+  SparseLuFree(lu);
+  SparseFree(A);
+}
+
+TEST(SparseLuTest, AssembleTripletsKeepsPattern) {
+  std::vector<Triplet> t = {{0, 0, 1.0}, {1, 1, 1.0}, {1, 0, 1.0}};
+  SparseMatrix* A = SparseCreateFromTriplets(2, t.data(), t.size());
+  ASSERT_NE(A, nullptr);
+
+  // Subset of the pattern: missing entries become zero
+  std::vector<Triplet> t2 = {{0, 0, 3.0}, {0, 0, 1.0}, {1, 1, 2.0}};
+  ASSERT_EQ(SparseAssembleTriplets(A, t2.data(), t2.size()), 0);
+  EXPECT_EQ(A->nnz, 3);
+  EXPECT_DOUBLE_EQ(A->values[0], 4.0);  // A[0][0]
+  EXPECT_DOUBLE_EQ(A->values[1], 0.0);  // A[1][0]
+  EXPECT_DOUBLE_EQ(A->values[2], 2.0);  // A[1][1]
+
+  // Entry outside the pattern is reported
+  std::vector<Triplet> t3 = {{0, 1, 1.0}};
+  EXPECT_EQ(SparseAssembleTriplets(A, t3.data(), t3.size()), -1);
+
+  SparseFree(A);
+}
+
+TEST(SparseLuTest, RefactorReusesPivots) {
+  std::vector<Triplet> t = {{0, 0, 4.0}, {0, 1, 1.0}, {1, 0, 1.0},
+                            {1, 1, 3.0}, {1, 2, 1.0}, {2, 1, 1.0},
+                            {2, 2, 2.0}};
+  SparseMatrix* A = SparseCreateFromTriplets(3, t.data(), t.size());
+  SparseLu* lu = SparseLuCreate(A);
+  ASSERT_EQ(SparseLuFactor(lu, A), 0);
+  int nnz = SparseLuNnz(lu);
+
+  // New values on the same pattern
+  for (int p = 0; p < A->nnz; p++) A->values[p] *= 2.0;
+  A->values[0] += 1.0;
+  ASSERT_EQ(SparseLuRefactor(lu, A), 0);
+  EXPECT_EQ(SparseLuNnz(lu), nnz);
+
+  std::vector<double> x_ref = {1.0, -2.0, 3.0};
+  std::vector<double> b = MatVec(A, x_ref);
+  double x[3];
+  ASSERT_EQ(SparseLuSolve(lu, b.data(), x), 0);
+  for (int i = 0; i < 3; i++) EXPECT_NEAR(x[i], x_ref[i], 1e-12);
+
+  SparseLuFree(lu);
+  SparseFree(A);
+}
+
+TEST(SparseLuTest, RefactorDetectsUnstablePivot) {
+  std::vector<Triplet> t = {{0, 0, 1.0}, {0, 1, 1.0}, {1, 0, 1.0},
+                            {1, 1, 2.0}};
+  SparseMatrix* A = SparseCreateFromTriplets(2, t.data(), t.size());
+  SparseLu* lu = SparseLuCreate(A);
+  ASSERT_EQ(SparseLuFactor(lu, A), 0);
+
+  // Zero out the first diagonal: the reused diagonal pivot is no longer usable
+  // but a full factorization with pivoting still succeeds
+  A->values[0] = 0.0;
+  EXPECT_EQ(SparseLuRefactor(lu, A), -3);
+  ASSERT_EQ(SparseLuFactor(lu, A), 0);
+
+  std::vector<double> x_ref = {2.0, 1.0};
+  std::vector<double> b = MatVec(A, x_ref);
+  double x[2];
+  ASSERT_EQ(SparseLuSolve(lu, b.data(), x), 0);
+  EXPECT_NEAR(x[0], 2.0, 1e-12);
+  EXPECT_NEAR(x[1], 1.0, 1e-12);
+
+  SparseLuFree(lu);
+  SparseFree(A);
+}
+
+// ============================================================================
+// SparseComplexLu Tests
+// ============================================================================
+
+TEST(SparseComplexLuTest, SolveAndRefactor) {
+  // Pattern of a 3x3 system with a zero first diagonal (pivoting needed)
+  std::vector<Triplet> t = {{1, 0, 0.0}, {0, 1, 0.0}, {1, 1, 0.0},
+                            {2, 1, 0.0}, {1, 2, 0.0}, {2, 2, 0.0}};
+  SparseMatrix* A = SparseCreateFromTriplets(3, t.data(), t.size());
+  ASSERT_NE(A, nullptr);
+  SparseOrdering* o = SparseOrderingCompute(A);
+  ASSERT_NE(o, nullptr);
+  SparseComplexLu* lu = SparseComplexLuCreate(A, o);
+  ASSERT_NE(lu, nullptr);
+
+  typedef std::complex<double> Complex;
+  std::vector<Complex> x_ref = {{1.0, 2.0}, {-1.0, 0.5}, {0.0, -3.0}};
+  for (double omega : {1.0, 10.0}) {
+    std::vector<Complex> values(A->nnz);
+    for (int p = 0; p < A->nnz; p++) {
+      values[p] = Complex(1.0 + p, omega * (p % 2 ? 1.0 : -0.5));
+    }
+    int result = omega == 1.0
+                     ? SparseComplexLuFactor(lu, A, values.data())
+                     : SparseComplexLuRefactor(lu, A, values.data());
+    ASSERT_EQ(result, 0);
+
+    std::vector<Complex> b(3, 0.0), x(3);
+    for (int j = 0; j < 3; j++) {
+      for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+        b[A->row_idx[p]] += values[p] * x_ref[j];
+      }
+    }
+    ASSERT_EQ(SparseComplexLuSolve(lu, b.data(), x.data()), 0);
+    for (int i = 0; i < 3; i++) EXPECT_LT(std::abs(x[i] - x_ref[i]), 1e-12);
+  }
+  EXPECT_GE(SparseComplexLuNnz(lu), A->nnz);
+
+  SparseComplexLuFree(lu);
+  SparseOrderingFree(o);
+  SparseFree(A);
+}
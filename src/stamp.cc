@@ -28,8 +28,77 @@ struct StampContext {
 
   // RHS vector (length = num_vars_)
   std::vector<double> z_;
+
+  // Stamping mode: 0 = triplets, 1 = discovery, 2 = compiled, 3 = deferred
+  int mode_;
+
+  // Per-device offset into the recorded call sequence (-1 if no stamps)
+  // and into the recorded CtxAddZ sequence
+  std::vector<int> device_offsets_;
+  std::vector<int> device_z_offsets_;
+  std::vector<int> z_call_rows_;  // Index of every recorded CtxAddZ call
+
+  // Compiled call sequence: expected (row, col) and target slot of each call
+  std::vector<int> call_rows_;
+  std::vector<int> call_cols_;
+  std::vector<int> call_slots_;
+
+  // Bound value array for compiled mode (owned by the caller)
+  double* values_;
+  size_t num_values_;
+
+  // Position in the compiled call sequence and number of mismatched calls
+  size_t cursor_;
+  size_t misses_;
+
+  // Deferred mode: value of every compiled CtxAddA and CtxAddZ call of the
+  // current assembly, and the calls of every value slot and RHS entry in
+  // call order (CSR, built on the first deferred assembly)
+  std::vector<double> call_values_;
+  std::vector<double> z_call_values_;
+  std::vector<int> slot_ptr_;
+  std::vector<int> slot_calls_;
+  std::vector<int> z_ptr_;
+  std::vector<int> z_calls_;
+  size_t z_cursor_;
+
+  // Worker contexts: the context whose call sequence and deferred buffers
+  // they stamp into (nullptr otherwise)
+  StampContext* parent_;
 };
 
+namespace {
+constexpr int kModeTriplets = 0;
+constexpr int kModeDiscover = 1;
+constexpr int kModeCompiled = 2;
+constexpr int kModeDeferred = 3;
+
+// Group the call indices of an indexed sequence by target (CSR): the calls
+// of target t are calls[ptr[t] .. ptr[t + 1]), in increasing order
+static void GroupCalls(const std::vector<int>& targets, size_t num_targets,
+                       std::vector<int>* ptr, std::vector<int>* calls) {
+  ptr->assign(num_targets + 1, 0);
+  for (int t : targets) (*ptr)[t + 1]++;
+  for (size_t t = 0; t < num_targets; t++) (*ptr)[t + 1] += (*ptr)[t];
+  calls->resize(targets.size());
+  std::vector<int> next(ptr->begin(), ptr->end() - 1);
+  for (size_t k = 0; k < targets.size(); k++) {
+    (*calls)[next[targets[k]]++] = (int)k;
+  }
+}
+
+// Sum the deferred values of every target in call order into out
+static void SumCalls(const std::vector<int>& ptr, const std::vector<int>& calls,
+                     const std::vector<double>& values, double* out) {
+  size_t num_targets = ptr.size() - 1;
+  for (size_t t = 0; t < num_targets; t++) {
+    double sum = 0.0;
+    for (int e = ptr[t]; e < ptr[t + 1]; e++) sum += values[calls[e]];
+    out[t] = sum;
+  }
+}
+}  // namespace
+
 // ============================================================================
 // Predefined Integration Methods
 // ============================================================================
@@ -42,7 +111,8 @@ const IntegrationMethod kBackwardEuler = {.name = "backward_euler",
                                           .beta0 = 1.0,
                                           .beta1 = 1.0,
                                           .beta2 = 0.0,
-                                          .required_history = 1};
+                                          .required_history = 1,
+                                          .kind = kIntegrationBackwardEuler};
 
 const IntegrationMethod kTrapezoidal = {.name = "trapezoidal",
                                         .order = 2,
@@ -52,7 +122,8 @@ const IntegrationMethod kTrapezoidal = {.name = "trapezoidal",
                                         .beta0 = 2.0,
                                         .beta1 = 2.0,
                                         .beta2 = 0.0,
-                                        .required_history = 1};
+                                        .required_history = 1,
+                                        .kind = kIntegrationTrapezoidal};
 
 const IntegrationMethod kGear2 = {.name = "gear2",
                                   .order = 2,
@@ -62,7 +133,21 @@ const IntegrationMethod kGear2 = {.name = "gear2",
                                   .beta0 = 1.5,
                                   .beta1 = 2.0,
                                   .beta2 = -0.5,
-                                  .required_history = 2};
+                                  .required_history = 2,
+                                  .kind = kIntegrationGear2};
+
+// ============================================================================
+// Default Newton Policy
+// ============================================================================
+
+const NewtonPolicy kDefaultNewtonPolicy = {.limit_junctions = 1,
+                                           .damping = kNewtonDampingNone,
+                                           .max_step = 2.0,
+                                           .max_backtracks = 4,
+                                           .bypass = 1,
+                                           .bypass_vtol = 1e-6,
+                                           .gmin_stepping = 1,
+                                           .source_stepping = 1};
 
 // ============================================================================
 // StampContext API Implementation
@@ -82,6 +167,13 @@ StampContext* CtxCreate(int num_vars) {
   ctx->num_extra_allocated_ = 0;
   ctx->triplets_.reserve(64);  // Initial capacity for typical small circuits
   ctx->z_.resize(num_vars, 0.0);
+  ctx->mode_ = kModeTriplets;
+  ctx->values_ = nullptr;
+  ctx->num_values_ = 0;
+  ctx->cursor_ = 0;
+  ctx->misses_ = 0;
+  ctx->z_cursor_ = 0;
+  ctx->parent_ = nullptr;
 
   return ctx;
 }
@@ -97,13 +189,54 @@ void CtxReset(StampContext* ctx) {
 
   ctx->triplets_.clear();
   std::fill(ctx->z_.begin(), ctx->z_.end(), 0.0);
+
+  if (ctx->mode_ == kModeDeferred) ctx->mode_ = kModeCompiled;
+  if (ctx->mode_ == kModeCompiled) {
+    std::fill(ctx->values_, ctx->values_ + ctx->num_values_, 0.0);
+  } else if (ctx->mode_ == kModeDiscover) {
+    ctx->device_offsets_.clear();
+    ctx->device_z_offsets_.clear();
+    ctx->z_call_rows_.clear();
+  }
+  ctx->cursor_ = 0;
+  ctx->misses_ = 0;
+  ctx->z_cursor_ = 0;
 }
 
 void CtxAddA(StampContext* ctx, int row, int col, double val) {
   if (!ctx) return;
   if (row < 0 || row >= ctx->num_vars_) return;
   if (col < 0 || col >= ctx->num_vars_) return;
-  if (val == 0.0) return;  // Skip zero entries for efficiency
+
+  if (ctx->mode_ == kModeCompiled) {
+    size_t k = ctx->cursor_;
+    if (k < ctx->call_slots_.size() && ctx->call_rows_[k] == row &&
+        ctx->call_cols_[k] == col) {
+      ctx->values_[ctx->call_slots_[k]] += val;
+      ctx->cursor_ = k + 1;
+      return;
+    }
+    ctx->misses_++;
+    ctx->triplets_.push_back({row, col, val});
+    return;
+  }
+  if (ctx->mode_ == kModeDeferred) {
+    // Store at the call's own position; a mismatch only counts, the caller
+    // rediscovers
+    StampContext* seq = ctx->parent_ ? ctx->parent_ : ctx;
+    size_t k = ctx->cursor_;
+    if (k < seq->call_values_.size() && seq->call_rows_[k] == row &&
+        seq->call_cols_[k] == col) {
+      seq->call_values_[k] = val;
+      ctx->cursor_ = k + 1;
+    } else {
+      ctx->misses_++;
+    }
+    return;
+  }
+
+  // Skip zero entries for efficiency, except while discovering the pattern
+  if (val == 0.0 && ctx->mode_ != kModeDiscover) return;
 
   ctx->triplets_.push_back({row, col, val});
 }
@@ -112,6 +245,18 @@ void CtxAddZ(StampContext* ctx, int idx, double val) {
   if (!ctx) return;
   if (idx < 0 || idx >= ctx->num_vars_) return;
 
+  if (ctx->mode_ == kModeDeferred) {
+    StampContext* seq = ctx->parent_ ? ctx->parent_ : ctx;
+    size_t k = ctx->z_cursor_;
+    if (k < seq->z_call_values_.size() && seq->z_call_rows_[k] == idx) {
+      seq->z_call_values_[k] = val;
+      ctx->z_cursor_ = k + 1;
+    } else {
+      ctx->misses_++;
+    }
+    return;
+  }
+  if (ctx->mode_ == kModeDiscover) ctx->z_call_rows_.push_back(idx);
   ctx->z_[idx] += val;
 }
 
@@ -165,4 +310,143 @@ void CtxAssembleDense(StampContext* ctx, double* matrix) {
   }
 }
 
+// ============================================================================
+// Compiled Stamping
+// ============================================================================
+
+void CtxBeginDiscovery(StampContext* ctx) {
+  if (!ctx) return;
+
+  ctx->mode_ = kModeDiscover;
+  ctx->values_ = nullptr;
+  ctx->num_values_ = 0;
+  ctx->call_rows_.clear();
+  ctx->call_cols_.clear();
+  ctx->call_slots_.clear();
+  ctx->slot_ptr_.clear();
+  ctx->z_ptr_.clear();
+  CtxReset(ctx);
+}
+
+void CtxBeginDevice(StampContext* ctx, int device_index) {
+  if (!ctx || device_index < 0) return;
+
+  if (ctx->mode_ == kModeDiscover) {
+    if (ctx->device_offsets_.size() <= static_cast<size_t>(device_index)) {
+      ctx->device_offsets_.resize(device_index + 1, -1);
+      ctx->device_z_offsets_.resize(device_index + 1, -1);
+    }
+    ctx->device_offsets_[device_index] =
+        static_cast<int>(ctx->triplets_.size());
+    ctx->device_z_offsets_[device_index] =
+        static_cast<int>(ctx->z_call_rows_.size());
+  } else if (ctx->mode_ == kModeCompiled || ctx->mode_ == kModeDeferred) {
+    const StampContext* seq = ctx->parent_ ? ctx->parent_ : ctx;
+    if (static_cast<size_t>(device_index) < seq->device_offsets_.size() &&
+        seq->device_offsets_[device_index] >= 0) {
+      ctx->cursor_ = seq->device_offsets_[device_index];
+      ctx->z_cursor_ = seq->device_z_offsets_[device_index];
+    } else {
+      // Unknown device: all misses
+      ctx->cursor_ = seq->call_slots_.size();
+      ctx->z_cursor_ = seq->z_call_rows_.size();
+    }
+  }
+}
+
+int CtxCompile(StampContext* ctx, const int* slots, double* values,
+               size_t num_values) {
+  if (!ctx || ctx->mode_ != kModeDiscover) return -1;
+
+  size_t count = ctx->triplets_.size();
+  if (count > 0 && (!slots || !values)) return -1;
+  for (size_t k = 0; k < count; k++) {
+    if (slots[k] < 0 || static_cast<size_t>(slots[k]) >= num_values) {
+      return -1;
+    }
+  }
+
+  ctx->call_rows_.resize(count);
+  ctx->call_cols_.resize(count);
+  ctx->call_slots_.assign(slots, slots + count);
+  for (size_t k = 0; k < count; k++) {
+    ctx->call_rows_[k] = ctx->triplets_[k].row;
+    ctx->call_cols_[k] = ctx->triplets_[k].col;
+  }
+
+  ctx->values_ = values;
+  ctx->num_values_ = num_values;
+  ctx->mode_ = kModeCompiled;
+  ctx->triplets_.clear();
+  ctx->cursor_ = 0;
+  ctx->misses_ = 0;
+  return 0;
+}
+
+int CtxIsCompiled(StampContext* ctx) {
+  if (!ctx) return 0;
+  return ctx->mode_ == kModeCompiled || ctx->mode_ == kModeDeferred ? 1 : 0;
+}
+
+size_t CtxGetPatternMisses(StampContext* ctx) {
+  if (!ctx) return 0;
+  return ctx->misses_;
+}
+
+// ============================================================================
+// Deferred Stamping
+// ============================================================================
+
+int CtxBeginDeferred(StampContext* ctx) {
+  if (!ctx || ctx->parent_) return -1;
+  if (ctx->mode_ != kModeCompiled && ctx->mode_ != kModeDeferred) return -1;
+
+  if (ctx->slot_ptr_.empty()) {
+    GroupCalls(ctx->call_slots_, ctx->num_values_, &ctx->slot_ptr_,
+               &ctx->slot_calls_);
+    GroupCalls(ctx->z_call_rows_, ctx->z_.size(), &ctx->z_ptr_,
+               &ctx->z_calls_);
+  }
+  ctx->call_values_.assign(ctx->call_slots_.size(), 0.0);
+  ctx->z_call_values_.assign(ctx->z_call_rows_.size(), 0.0);
+  ctx->triplets_.clear();
+  ctx->mode_ = kModeDeferred;
+  ctx->cursor_ = 0;
+  ctx->z_cursor_ = 0;
+  ctx->misses_ = 0;
+  return 0;
+}
+
+StampContext* CtxCreateWorker(StampContext* ctx) {
+  if (!ctx || ctx->parent_) return nullptr;
+
+  StampContext* w = CtxCreate(ctx->num_vars_);
+  if (!w) return nullptr;
+  w->mode_ = kModeDeferred;
+  w->parent_ = ctx;
+  return w;
+}
+
+void CtxBeginWorker(StampContext* worker) {
+  if (!worker || !worker->parent_) return;
+  worker->cursor_ = 0;
+  worker->z_cursor_ = 0;
+  worker->misses_ = 0;
+}
+
+int CtxResolveDeferred(StampContext* ctx, StampContext* const* workers,
+                       int num_workers) {
+  if (!ctx || ctx->mode_ != kModeDeferred) return -1;
+
+  for (int k = 0; k < num_workers; k++) {
+    if (workers[k] && workers[k]->parent_ == ctx) {
+      ctx->misses_ += workers[k]->misses_;
+    }
+  }
+  SumCalls(ctx->slot_ptr_, ctx->slot_calls_, ctx->call_values_, ctx->values_);
+  SumCalls(ctx->z_ptr_, ctx->z_calls_, ctx->z_call_values_, ctx->z_.data());
+  ctx->mode_ = kModeCompiled;
+  return 0;
+}
+
 }  // namespace minispice
@@ -24,6 +24,45 @@ struct StampContext;
 struct Circuit;
 struct Device;
 
+// Damping of the Newton update x <- x + delta applied by the analyses
+enum NewtonDamping {
+  kNewtonDampingNone = 0,    // Full Newton step
+  kNewtonDampingMaxStep,     // Scale delta so no variable moves by more than
+                             // max_step
+  kNewtonDampingLineSearch,  // Halve the step while the KCL residual grows
+};
+
+// Newton policy of the nonlinear analyses. Devices read limit_junctions
+// and bypass; the analyses apply the damping and the DC continuation.
+struct NewtonPolicy {
+  // 1 if nonlinear devices limit the change of their junction voltages
+  // between iterations (pnjlim for diodes, fetlim/limvds for MOSFETs)
+  int limit_junctions;
+  NewtonDamping damping;
+  double max_step;     // kNewtonDampingMaxStep: largest change per variable
+  int max_backtracks;  // kNewtonDampingLineSearch: halvings per iteration
+  // 1 if nonlinear devices whose controlling voltages all moved by less
+  // than bypass_vtol since their last (unlimited) evaluation re-stamp that
+  // linearization instead of evaluating their model
+  int bypass;
+  double bypass_vtol;
+  // DC analyses whose Newton iteration from the zero guess fails retry with
+  // gmin stepping (if gmin_stepping), then source stepping (if
+  // source_stepping); see CircuitDcAnalysisWithWorkspace
+  int gmin_stepping;
+  int source_stepping;
+};
+
+// Junction limiting, bypass and DC continuation on, no damping (set by
+// circuit_create)
+extern const NewtonPolicy kDefaultNewtonPolicy;
+
+// Model evaluation counters of the nonlinear devices
+struct DeviceEvalCounts {
+  long evaluations;  // Stamps that evaluated the device model
+  long bypassed;     // Stamps that re-stamped a cached linearization
+};
+
 // State passed to devices during Newton-Raphson iterations
 struct IterationState {
   // Current iteration number (0-based)
@@ -37,6 +76,26 @@ struct IterationState {
 
   // Absolute convergence tolerance
   double tol_abs;
+
+  // Newton policy of the analysis (all zero: no limiting, no damping, no
+  // bypass)
+  NewtonPolicy policy;
+
+  // Evaluation counters devices add to (nullptr: not counted)
+  DeviceEvalCounts* counts;
+
+  // Conductance from every node to ground added by the analysis during
+  // gmin stepping (0 otherwise); stamped by the workspace, not the devices
+  double gmin;
+};
+
+// Families of integration methods. The device transient kernels are compiled
+// once per family (see CompanionHistory) and pick the family of the step's
+// method once, instead of testing the method's terms for every device.
+enum IntegrationKind {
+  kIntegrationBackwardEuler = 0,
+  kIntegrationTrapezoidal,  // Adds the derivative of the last point
+  kIntegrationGear2,        // Adds the v_{n-2} term
 };
 
 // Integration method coefficients for time discretization
@@ -57,6 +116,7 @@ struct IntegrationMethod {
   double beta2; /**< Coefficient for i_{n-2} (multi-step only) */
 
   int required_history; /**< Number of history steps needed */
+  IntegrationKind kind; /**< Family of the method (form of the history) */
 };
 
 /**
@@ -68,6 +128,10 @@ struct TimeStepState {
   double* x_prev;  /**< Solution from previous time step */
   double* x_prev2; /**< Solution from two steps ago (for multi-step) */
   const IntegrationMethod* im; /**< Current integration method */
+  double* x_current; /**< Current Newton iterate at t (nonlinear devices) */
+  int iter;          /**< Newton iteration of the step (0-based) */
+  NewtonPolicy policy; /**< Newton policy (see IterationState) */
+  DeviceEvalCounts* counts; /**< Evaluation counters (nullable) */
 };
 
 /**
@@ -80,6 +144,27 @@ inline const IntegrationMethod& BACKWARD_EULER = kBackwardEuler;
 inline const IntegrationMethod& TRAPEZOIDAL = kTrapezoidal;
 inline const IntegrationMethod& GEAR2 = kGear2;
 
+/**
+ * @brief History term of a companion model, specialized on the method family
+ *
+ * For y = k * u (a capacitor charge, an inductor flux, a MOSFET terminal
+ * charge with k = 1) a step h of a method of family K approximates
+ * dy/dt ~ (c0 * k / h) * u_n - hist with
+ *   hist = (c1 * k / h) * u1 + (c2 * k / h) * u2 (Gear2 only) + d1
+ *          (trapezoidal only)
+ * where (c0, c1, c2) are the alpha or beta coefficients of the method, u1
+ * and u2 the previous two values of u and d1 the derivative dy/dt at the
+ * previous point.
+ */
+template <IntegrationKind K>
+inline double CompanionHistory(double c1, double c2, double k, double h,
+                               double u1, double u2, double d1) {
+  double hist = (c1 * k / h) * u1;
+  if constexpr (K == kIntegrationGear2) hist += (c2 * k / h) * u2;
+  if constexpr (K == kIntegrationTrapezoidal) hist += d1;
+  return hist;
+}
+
 /* ============================================================================
  * StampContext API
  * ============================================================================
@@ -101,7 +186,8 @@ void CtxFree(StampContext* ctx);
 /**
  * @brief Reset the StampContext for a new assembly pass
  *
- * Clears all accumulated triplets and resets the RHS vector to zero.
+ * Clears all accumulated triplets and resets the RHS vector to zero. In
+ * compiled mode the bound value array is zeroed as well.
  * Call this before each new matrix assembly (each NR iteration or time step).
  */
 void CtxReset(StampContext* ctx);
@@ -171,6 +257,136 @@ double* CtxGetZ(StampContext* ctx);
  */
 void CtxAssembleDense(StampContext* ctx, double* matrix);
 
+/* ============================================================================
+ * Compiled Stamping
+ * ============================================================================
+ *
+ * The sequence of CtxAddA calls made by a device does not depend on the
+ * operating point, so the matrix positions it touches can be recorded once
+ * and reused. In compiled mode each CtxAddA call accumulates directly into a
+ * precomputed slot of a caller-owned value array (dense matrix storage or
+ * CSC values) instead of appending a triplet.
+ *
+ * Typical flow:
+ *   CtxBeginDiscovery(ctx);
+ *   for each device k: CtxBeginDevice(ctx, k); stamp device;
+ *   map each recorded triplet to a slot in the matrix storage;
+ *   CtxCompile(ctx, slots, values, num_values);
+ *   ...
+ *   CtxReset(ctx);  // zeroes values and RHS
+ *   for each device k: CtxBeginDevice(ctx, k); stamp device;
+ *   if (CtxGetPatternMisses(ctx) > 0) rediscover;
+ */
+
+/**
+ * @brief Reset the context and start a discovery pass
+ *
+ * Behaves like triplet mode, except that zero-valued CtxAddA calls are also
+ * recorded so the recorded triplets describe the complete call sequence.
+ * Leaves compiled mode if it was active.
+ */
+void CtxBeginDiscovery(StampContext* ctx);
+
+/**
+ * @brief Mark the start of the stamps of device number device_index
+ *
+ * During discovery this records the device's offset into the call sequence.
+ * In compiled mode it positions the cursor at that offset, so devices may be
+ * stamped in any order. Ignored in plain triplet mode.
+ */
+void CtxBeginDevice(StampContext* ctx, int device_index);
+
+/**
+ * @brief Switch to compiled mode after a discovery pass
+ *
+ * @param ctx The StampContext (must have just completed a discovery pass)
+ * @param slots slots[k] is the index into values for the k-th recorded
+ *              triplet (as returned by CtxGetTriplets)
+ * @param values Caller-owned value array the stamps accumulate into; it must
+ *               stay valid while the context is compiled
+ * @param num_values Length of values (zeroed by CtxReset)
+ * @return 0 on success, -1 if a slot is out of range or no discovery pass
+ *         was made
+ */
+int CtxCompile(StampContext* ctx, const int* slots, double* values,
+               size_t num_values);
+
+/**
+ * @brief Return 1 if the context is in compiled mode, 0 otherwise
+ */
+int CtxIsCompiled(StampContext* ctx);
+
+/**
+ * @brief Number of CtxAddA calls since the last reset that did not match the
+ * compiled call sequence
+ *
+ * Mismatched calls are kept as triplets (see CtxGetTriplets). A nonzero count
+ * means the compiled slot map is stale and a new discovery pass is needed.
+ */
+size_t CtxGetPatternMisses(StampContext* ctx);
+
+/* ============================================================================
+ * Deferred Stamping
+ * ============================================================================
+ *
+ * Parallel assembly of a compiled context. Every recorded CtxAddA and CtxAddZ
+ * call has its own position in the call sequence, so devices stamped on
+ * different threads never write the same location: in deferred mode each
+ * call stores its value at its position instead of accumulating it.
+ * CtxResolveDeferred then sums the stored values of every matrix slot and
+ * RHS entry in call-sequence order, the order in which the serial compiled
+ * assembly accumulates them, so the assembled system is bit-identical to the
+ * serial one whatever the number of threads and the scheduling.
+ *
+ * Typical flow (after CtxCompile):
+ *   CtxBeginDeferred(ctx);
+ *   on each thread t: CtxBeginWorker(worker[t]);
+ *                     for its devices k: CtxBeginDevice(worker[t], k); stamp;
+ *   CtxResolveDeferred(ctx, worker, num_threads);
+ *   if (CtxGetPatternMisses(ctx) > 0) rediscover (serially);
+ *
+ * The CtxAddZ calls of the devices are recorded by the discovery pass along
+ * with the CtxAddA calls; a call that leaves either sequence is a pattern
+ * miss (and is dropped).
+ */
+
+/**
+ * @brief Start a deferred assembly of a compiled context
+ *
+ * Clears the stored call values. Devices may also be stamped through ctx
+ * itself (on the calling thread) until CtxResolveDeferred.
+ *
+ * @return 0 on success, -1 if ctx is not compiled or is a worker
+ */
+int CtxBeginDeferred(StampContext* ctx);
+
+/**
+ * @brief Create a worker context stamping into the deferred assembly of ctx
+ *
+ * The worker follows the call sequence of ctx, including later
+ * recompilations. Use one worker per thread; free it with CtxFree before ctx.
+ *
+ * @return The worker, or nullptr if ctx is a worker or on allocation failure
+ */
+StampContext* CtxCreateWorker(StampContext* ctx);
+
+/**
+ * @brief Clear the miss count of a worker before a deferred assembly
+ */
+void CtxBeginWorker(StampContext* worker);
+
+/**
+ * @brief Finish a deferred assembly
+ *
+ * Sums the stored call values into the bound value array and the RHS, adds
+ * the pattern misses of the workers to those of ctx and returns ctx to
+ * compiled mode. No worker may still be stamping.
+ *
+ * @return 0 on success, -1 if no deferred assembly was started
+ */
+int CtxResolveDeferred(StampContext* ctx, StampContext* const* workers,
+                       int num_workers);
+
 }  // namespace minispice
 
 #endif  // MINI_SPICE_STAMP_H_
@@ -6,6 +6,7 @@
 #include <gtest/gtest.h>
 
 #include <cstring>
+#include <vector>
 
 using namespace minispice;
 
@@ -145,6 +146,157 @@ TEST_F(StampContextTest, IgnoreZeroValues) {
   EXPECT_EQ(count, 0u);  // Zero entries should be skipped
 }
 
+// ============================================================================
+// Compiled Stamping Tests
+// ============================================================================
+
+TEST_F(StampContextTest, DiscoveryRecordsZeros) {
+  CtxBeginDiscovery(ctx);
+  CtxAddA(ctx, 0, 0, 0.0);
+  CtxAddA(ctx, 1, 1, 2.0);
+
+  size_t count;
+  CtxGetTriplets(ctx, &count);
+  EXPECT_EQ(count, 2u);  // Zero entry kept so the call sequence is complete
+}
+
+TEST_F(StampContextTest, CompiledStampsIntoSlots) {
+  // Two "devices" stamping into a 2x2 dense matrix
+  CtxBeginDiscovery(ctx);
+  CtxBeginDevice(ctx, 0);
+  CtxAddA(ctx, 0, 0, 1.0);
+  CtxAddA(ctx, 0, 1, -1.0);
+  CtxBeginDevice(ctx, 1);
+  CtxAddA(ctx, 0, 0, 5.0);
+
+  size_t count;
+  const Triplet* t = CtxGetTriplets(ctx, &count);
+  ASSERT_EQ(count, 3u);
+  int slots[3];
+  for (size_t k = 0; k < count; k++) slots[k] = t[k].row * 2 + t[k].col;
+
+  double values[4] = {0};
+  ASSERT_EQ(CtxCompile(ctx, slots, values, 4), 0);
+  EXPECT_EQ(CtxIsCompiled(ctx), 1);
+
+  // Stamp in a different device order with new values
+  CtxReset(ctx);
+  CtxBeginDevice(ctx, 1);
+  CtxAddA(ctx, 0, 0, 3.0);
+  CtxBeginDevice(ctx, 0);
+  CtxAddA(ctx, 0, 0, 2.0);
+  CtxAddA(ctx, 0, 1, -2.0);
+  CtxAddZ(ctx, 1, 4.0);
+
+  EXPECT_EQ(CtxGetPatternMisses(ctx), 0u);
+  CtxGetTriplets(ctx, &count);
+  EXPECT_EQ(count, 0u);  // No triplets in compiled mode
+  EXPECT_DOUBLE_EQ(values[0], 5.0);
+  EXPECT_DOUBLE_EQ(values[1], -2.0);
+  EXPECT_DOUBLE_EQ(CtxGetZ(ctx)[1], 4.0);
+
+  // Reset zeroes the bound values
+  CtxReset(ctx);
+  EXPECT_DOUBLE_EQ(values[0], 0.0);
+}
+
+TEST_F(StampContextTest, CompiledDetectsPatternMiss) {
+  CtxBeginDiscovery(ctx);
+  CtxBeginDevice(ctx, 0);
+  CtxAddA(ctx, 0, 0, 1.0);
+
+  int slots[1] = {0};
+  double values[16] = {0};
+  ASSERT_EQ(CtxCompile(ctx, slots, values, 16), 0);
+
+  CtxReset(ctx);
+  CtxBeginDevice(ctx, 0);
+  CtxAddA(ctx, 0, 0, 1.0);
+  CtxAddA(ctx, 2, 3, 7.0);  // Not recorded during discovery
+
+  EXPECT_EQ(CtxGetPatternMisses(ctx), 1u);
+  size_t count;
+  const Triplet* t = CtxGetTriplets(ctx, &count);
+  ASSERT_EQ(count, 1u);
+  EXPECT_EQ(t[0].row, 2);
+  EXPECT_EQ(t[0].col, 3);
+}
+
+TEST_F(StampContextTest, CompileRejectsBadSlots) {
+  // Compile without a discovery pass
+  EXPECT_EQ(CtxCompile(ctx, nullptr, nullptr, 0), -1);
+
+  CtxBeginDiscovery(ctx);
+  CtxAddA(ctx, 0, 0, 1.0);
+  int slots[1] = {4};
+  double values[4] = {0};
+  EXPECT_EQ(CtxCompile(ctx, slots, values, 4), -1);
+  EXPECT_EQ(CtxIsCompiled(ctx), 0);
+}
+
+// Stamps of three "devices" whose sums round differently in another order
+static void StampDevice(StampContext* ctx, int device, double scale) {
+  CtxBeginDevice(ctx, device);
+  CtxAddA(ctx, 0, 0, scale * (0.1 + device));
+  CtxAddA(ctx, 1, 1, scale * 1e16);
+  CtxAddA(ctx, 1, 0, -scale * 0.3 * (device + 1));
+  CtxAddZ(ctx, 1, scale * (device == 1 ? -1e16 : 1.0));
+}
+
+TEST_F(StampContextTest, DeferredMatchesCompiledBitForBit) {
+  EXPECT_EQ(CtxBeginDeferred(ctx), -1);  // Not compiled
+
+  CtxBeginDiscovery(ctx);
+  for (int device = 0; device < 3; device++) StampDevice(ctx, device, 1.0);
+  size_t count;
+  const Triplet* t = CtxGetTriplets(ctx, &count);
+  std::vector<int> slots(count);
+  for (size_t k = 0; k < count; k++) slots[k] = t[k].row * 4 + t[k].col;
+  double values[16] = {0};
+  ASSERT_EQ(CtxCompile(ctx, slots.data(), values, 16), 0);
+
+  // Serial compiled assembly
+  CtxReset(ctx);
+  for (int device = 0; device < 3; device++) StampDevice(ctx, device, 0.7);
+  double expected[16];
+  double expected_z[4];
+  memcpy(expected, values, sizeof(values));
+  memcpy(expected_z, CtxGetZ(ctx), sizeof(expected_z));
+
+  // Deferred, devices spread in reverse over two workers and the context
+  StampContext* workers[2] = {CtxCreateWorker(ctx), CtxCreateWorker(ctx)};
+  ASSERT_NE(workers[0], nullptr);
+  ASSERT_NE(workers[1], nullptr);
+  EXPECT_EQ(CtxCreateWorker(workers[0]), nullptr);
+  CtxReset(ctx);
+  ASSERT_EQ(CtxBeginDeferred(ctx), 0);
+  EXPECT_EQ(CtxIsCompiled(ctx), 1);
+  CtxBeginWorker(workers[0]);
+  CtxBeginWorker(workers[1]);
+  StampDevice(workers[1], 2, 0.7);
+  StampDevice(ctx, 1, 0.7);
+  StampDevice(workers[0], 0, 0.7);
+  ASSERT_EQ(CtxResolveDeferred(ctx, workers, 2), 0);
+  EXPECT_EQ(CtxGetPatternMisses(ctx), 0u);
+  EXPECT_EQ(memcmp(values, expected, sizeof(values)), 0);
+  EXPECT_EQ(memcmp(CtxGetZ(ctx), expected_z, sizeof(expected_z)), 0);
+  EXPECT_EQ(CtxResolveDeferred(ctx, workers, 2), -1);
+
+  // A worker call outside the pattern is a miss of the context
+  ASSERT_EQ(CtxBeginDeferred(ctx), 0);
+  CtxBeginWorker(workers[0]);
+  CtxBeginWorker(workers[1]);
+  StampDevice(workers[0], 0, 1.0);
+  CtxBeginDevice(workers[1], 1);
+  CtxAddA(workers[1], 2, 3, 1.0);
+  CtxAddZ(workers[1], 3, 1.0);
+  ASSERT_EQ(CtxResolveDeferred(ctx, workers, 2), 0);
+  EXPECT_EQ(CtxGetPatternMisses(ctx), 2u);
+
+  CtxFree(workers[0]);
+  CtxFree(workers[1]);
+}
+
 // Test integration methods are defined correctly
 TEST(IntegrationMethodTest, BackwardEulerCoefficients) {
   EXPECT_STREQ(BACKWARD_EULER.name, "backward_euler");
@@ -152,6 +304,7 @@ TEST(IntegrationMethodTest, BackwardEulerCoefficients) {
   EXPECT_DOUBLE_EQ(BACKWARD_EULER.alpha0, 1.0);
   EXPECT_DOUBLE_EQ(BACKWARD_EULER.alpha1, 1.0);
   EXPECT_DOUBLE_EQ(BACKWARD_EULER.alpha2, 0.0);
+  EXPECT_EQ(BACKWARD_EULER.kind, kIntegrationBackwardEuler);
 }
 
 TEST(IntegrationMethodTest, TrapezoidalCoefficients) {
@@ -159,6 +312,7 @@ TEST(IntegrationMethodTest, TrapezoidalCoefficients) {
   EXPECT_EQ(TRAPEZOIDAL.order, 2);
   EXPECT_DOUBLE_EQ(TRAPEZOIDAL.alpha0, 2.0);
   EXPECT_DOUBLE_EQ(TRAPEZOIDAL.alpha1, 2.0);
+  EXPECT_EQ(TRAPEZOIDAL.kind, kIntegrationTrapezoidal);
 }
 
 TEST(IntegrationMethodTest, Gear2Coefficients) {
@@ -168,4 +322,18 @@ TEST(IntegrationMethodTest, Gear2Coefficients) {
   EXPECT_DOUBLE_EQ(GEAR2.alpha1, 2.0);
   EXPECT_DOUBLE_EQ(GEAR2.alpha2, -0.5);
   EXPECT_EQ(GEAR2.required_history, 2);
+  EXPECT_EQ(GEAR2.kind, kIntegrationGear2);
+}
+
+TEST(IntegrationMethodTest, CompanionHistoryTermsPerKind) {
+  // (c1 k / h) u1, plus (c2 k / h) u2 for Gear2, plus d1 for trapezoidal
+  double be = CompanionHistory<kIntegrationBackwardEuler>(2.0, -0.5, 3.0, 0.5,
+                                                          1.0, 4.0, 7.0);
+  double trap = CompanionHistory<kIntegrationTrapezoidal>(2.0, -0.5, 3.0, 0.5,
+                                                          1.0, 4.0, 7.0);
+  double gear = CompanionHistory<kIntegrationGear2>(2.0, -0.5, 3.0, 0.5, 1.0,
+                                                    4.0, 7.0);
+  EXPECT_DOUBLE_EQ(be, 12.0);
+  EXPECT_DOUBLE_EQ(trap, 19.0);
+  EXPECT_DOUBLE_EQ(gear, 0.0);
 }
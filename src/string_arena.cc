@@ -0,0 +1,76 @@
+// String arena implementation
+//
+// Blocks are allocated with the string bytes following the block header.
+// Strings larger than a block get a block of their own.
+//
+
+#include "string_arena.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace minispice {
+
+namespace {
+constexpr size_t kBlockSize = 64 * 1024;
+}  // namespace
+
+struct StringArenaBlock {
+  StringArenaBlock* next;
+  size_t size;  // Bytes of string storage following the header
+  char* data() { return reinterpret_cast<char*>(this + 1); }
+};
+
+// ============================================================================
+// StringArena API Implementation
+// ============================================================================
+
+StringArena* StringArenaCreate(void) {
+  return (StringArena*)calloc(1, sizeof(StringArena));
+}
+
+void StringArenaFree(StringArena* a) {
+  if (!a) return;
+
+  StringArenaBlock* b = a->blocks;
+  while (b) {
+    StringArenaBlock* next = b->next;
+    free(b);
+    b = next;
+  }
+  free(a);
+}
+
+const char* StringArenaAdd(StringArena* a, const char* s, size_t len) {
+  if (!a || !s) return nullptr;
+
+  size_t need = len + 1;
+  if (!a->blocks || need > a->remaining) {
+    size_t size = need > kBlockSize ? need : kBlockSize;
+    StringArenaBlock* b =
+        (StringArenaBlock*)malloc(sizeof(StringArenaBlock) + size);
+    if (!b) return nullptr;
+    b->size = size;
+    if (size == need && a->blocks) {
+      // Oversized string: keep filling the current block afterwards
+      b->next = a->blocks->next;
+      a->blocks->next = b;
+      memcpy(b->data(), s, len);
+      b->data()[len] = '\0';
+      a->bytes_used += need;
+      return b->data();
+    }
+    b->next = a->blocks;
+    a->blocks = b;
+    a->remaining = size;
+  }
+
+  char* dst = a->blocks->data() + (a->blocks->size - a->remaining);
+  memcpy(dst, s, len);
+  dst[len] = '\0';
+  a->remaining -= need;
+  a->bytes_used += need;
+  return dst;
+}
+
+}  // namespace minispice
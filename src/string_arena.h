@@ -0,0 +1,35 @@
+// string_arena.h
+// Append-only string storage
+//
+// A StringArena copies strings into large blocks. Strings never move, so the
+// returned pointers stay valid until the arena is freed, and many short
+// strings (node names) share a few allocations instead of one each.
+
+#ifndef MINI_SPICE_STRING_ARENA_H_
+#define MINI_SPICE_STRING_ARENA_H_
+
+#include <stddef.h>
+
+namespace minispice {
+
+struct StringArenaBlock;
+
+struct StringArena {
+  StringArenaBlock* blocks;  // Most recent block first
+  size_t remaining;          // Free bytes in the most recent block
+  size_t bytes_used;         // Total bytes of the stored strings
+};
+
+// Create an empty arena. Returns nullptr on allocation failure.
+StringArena* StringArenaCreate(void);
+
+// Free the arena and every string stored in it
+void StringArenaFree(StringArena* a);
+
+// Copy the first len bytes of s into the arena, followed by a terminating
+// '\0'. Returns the stored copy, or nullptr on allocation failure.
+const char* StringArenaAdd(StringArena* a, const char* s, size_t len);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_STRING_ARENA_H_
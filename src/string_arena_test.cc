@@ -0,0 +1,58 @@
+// string_arena_test.cc
+// Unit tests for the append-only string arena
+
+#include "string_arena.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace minispice;
+
+TEST(StringArenaTest, StoresTerminatedCopies) {
+  StringArena* a = StringArenaCreate();
+  ASSERT_NE(a, nullptr);
+
+  const char* src = "node_out_extra";
+  const char* s1 = StringArenaAdd(a, src, 8);
+  const char* s2 = StringArenaAdd(a, "", 0);
+  ASSERT_NE(s1, nullptr);
+  ASSERT_NE(s2, nullptr);
+  EXPECT_STREQ(s1, "node_out");
+  EXPECT_STREQ(s2, "");
+  EXPECT_NE(s1, src);
+  EXPECT_EQ(a->bytes_used, 10u);
+
+  StringArenaFree(a);
+}
+
+TEST(StringArenaTest, PointersStayValidAcrossBlocks) {
+  StringArena* a = StringArenaCreate();
+  ASSERT_NE(a, nullptr);
+
+  // Enough names to span several blocks, plus strings larger than a block
+  std::vector<const char*> stored;
+  std::vector<std::string> expected;
+  for (int i = 0; i < 20000; i++) {
+    std::string name = "n" + std::to_string(i);
+    if (i % 5000 == 0) name += std::string(100000, 'x');
+    stored.push_back(StringArenaAdd(a, name.c_str(), name.size()));
+    expected.push_back(name);
+    ASSERT_NE(stored.back(), nullptr);
+  }
+  for (size_t i = 0; i < stored.size(); i++) {
+    EXPECT_EQ(expected[i], stored[i]);
+  }
+
+  StringArenaFree(a);
+}
+
+TEST(StringArenaTest, NullArguments) {
+  EXPECT_EQ(StringArenaAdd(nullptr, "a", 1), nullptr);
+  StringArena* a = StringArenaCreate();
+  EXPECT_EQ(StringArenaAdd(a, nullptr, 0), nullptr);
+  StringArenaFree(a);
+  StringArenaFree(nullptr);
+}
@@ -0,0 +1,333 @@
+// Parallel DC sweep implementation
+//
+// Builds one circuit clone per worker and solves the sweep points with a
+// work-stealing parallel for loop.
+//
+
+#include "sweep.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "device.h"
+#include "sparse.h"
+#include "workspace.h"
+
+namespace minispice {
+
+namespace {
+
+// Per-worker solver state
+struct SweepWorker {
+  Circuit* circuit = nullptr;      // Private clone
+  Device* src[kMaxDcSweeps] = {};  // Swept sources of the clone
+  std::vector<double> x;           // Last solution (warm start)
+  int last_point = -1;             // Point index of x, -1 if none
+};
+
+struct SweepJob {
+  const DcSweep* sweeps;
+  int num_sweeps;
+  double* results;
+  int max_iter;
+  double tol_abs;
+  double tol_rel;
+  std::vector<SweepWorker> workers;
+  std::atomic<int> failed{0};
+};
+
+static void SolveSweepPoint(void* user, int thread, int p) {
+  SweepJob* job = static_cast<SweepJob*>(user);
+  SweepWorker& w = job->workers[thread];
+  Circuit* c = w.circuit;
+  int n = c->num_vars;
+
+  double values[kMaxDcSweeps];
+  DcSweepPointValues(job->sweeps, job->num_sweeps, p, values);
+  for (int k = 0; k < job->num_sweeps; k++) {
+    DeviceSetValue(w.src[k], values[k]);
+  }
+
+  // Warm start from the last point this worker solved (usually p - 1)
+  int iters = -1;
+  if (w.last_point >= 0) {
+    iters = CircuitDcAnalysisWarmStart(c, c->workspace, w.x.data(),
+                                       job->max_iter, job->tol_abs,
+                                       job->tol_rel);
+  }
+  if (iters < 0) {
+    // No previous point or the warm start failed: solve the point from
+    // zero, with continuation
+    iters = CircuitDcAnalysisWithWorkspace(c, c->workspace, w.x.data(),
+                                           job->max_iter, job->tol_abs,
+                                           job->tol_rel);
+  }
+
+  if (iters < 0) {
+    fprintf(stderr, "DC sweep: no convergence at %s = %g\n",
+            job->sweeps[0].source, values[0]);
+    job->failed.store(1, std::memory_order_relaxed);
+    w.last_point = -1;
+    return;
+  }
+
+  memcpy(job->results + (size_t)p * n, w.x.data(), n * sizeof(double));
+  w.last_point = p;
+}
+
+// Per-worker state of a parameter batch
+struct BatchWorker {
+  Circuit* circuit = nullptr;   // Private clone owning its params
+  std::vector<Device*> devices;  // Device of each varied parameter
+  std::vector<double> x;         // Last solution (warm start)
+  int solved = 0;                // 1 if x is a solution
+};
+
+struct BatchJob {
+  const DeviceParamRef* params;
+  int num_params;
+  const double* values;
+  double* results;
+  int max_iter;
+  double tol_abs;
+  double tol_rel;
+  std::vector<BatchWorker> workers;
+  std::atomic<int> failed{0};
+};
+
+static void SolveBatchSet(void* user, int thread, int s) {
+  BatchJob* job = static_cast<BatchJob*>(user);
+  BatchWorker& w = job->workers[thread];
+  Circuit* c = w.circuit;
+  int n = c->num_vars;
+
+  const double* values = job->values + (size_t)s * job->num_params;
+  for (int k = 0; k < job->num_params; k++) {
+    if (DeviceSetParam(w.devices[k], job->params[k].param, values[k]) != 0) {
+      fprintf(stderr, "DC batch: invalid value %g of %s %s in set %d\n",
+              values[k], job->params[k].device, job->params[k].param, s);
+      job->failed.store(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  c->param_edits++;
+
+  // Warm start from the last set this worker solved
+  int iters;
+  if (w.solved) {
+    iters = CircuitDcResolve(c, c->workspace, w.x.data(), job->max_iter,
+                             job->tol_abs, job->tol_rel);
+  } else {
+    iters = CircuitDcAnalysisWithWorkspace(c, c->workspace, w.x.data(),
+                                           job->max_iter, job->tol_abs,
+                                           job->tol_rel);
+  }
+  if (iters < 0) {
+    fprintf(stderr, "DC batch: no convergence in set %d\n", s);
+    job->failed.store(1, std::memory_order_relaxed);
+    w.solved = 0;
+    return;
+  }
+
+  memcpy(job->results + (size_t)s * n, w.x.data(), n * sizeof(double));
+  w.solved = 1;
+}
+
+// Create the workspace of the clone of worker `index`. Unless the circuit
+// keeps an ordering (Circuit::sparse_ordering), the first clone finds the
+// ordering of its sparse LU by one assembly into *shared and the others get
+// a copy, so that the workers do not each compute one on their first solve.
+// Returns 0 on success, -1 on failure.
+static int CreateWorkerWorkspace(Circuit* clone, int index,
+                                 SparseOrdering** shared) {
+  if (!clone->sparse_ordering && *shared) {
+    clone->sparse_ordering = SparseOrderingCopy(*shared);
+    if (!clone->sparse_ordering) return -1;
+  }
+  clone->workspace = SimWorkspaceCreate(clone);
+  if (!clone->workspace) return -1;
+
+  SimWorkspace* ws = clone->workspace;
+  if (index == 0 && !clone->sparse_ordering && ws->use_sparse &&
+      ws->solver.method == kLinearSolverDirect) {
+    *shared = SimWorkspaceDiscoverOrdering(ws, clone);
+    if (!ws->lu) {
+      // Factored by blocks, which order themselves
+      SparseOrderingFree(*shared);
+      *shared = nullptr;
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+// ============================================================================
+// Parallel Sweep API Implementation
+// ============================================================================
+
+int DcSweepTotalPoints(const DcSweep* sweeps, int num_sweeps) {
+  if (!sweeps || num_sweeps < 1 || num_sweeps > kMaxDcSweeps) return 0;
+
+  int total = 1;
+  for (int k = 0; k < num_sweeps; k++) {
+    total *= DcSweepNumPoints(&sweeps[k]);
+  }
+  return total;
+}
+
+void DcSweepPointValues(const DcSweep* sweeps, int num_sweeps, int p,
+                        double* values) {
+  for (int k = 0; k < num_sweeps; k++) {
+    int points = DcSweepNumPoints(&sweeps[k]);
+    int i = points > 0 ? p % points : 0;
+    values[k] = sweeps[k].start + i * sweeps[k].step;
+    if (points > 0) p /= points;
+  }
+}
+
+int CircuitDcSweepParallel(Circuit* c, ThreadPool* pool,
+                           const DcSweep* sweeps, int num_sweeps,
+                           double* results, int max_iter, double tol_abs,
+                           double tol_rel, SimStats* stats) {
+  SimStatsClear(stats);
+  if (!c || !pool || !sweeps || !results) return -1;
+  if (!c->finalized) return -1;
+
+  int total = DcSweepTotalPoints(sweeps, num_sweeps);
+  if (total <= 0) {
+    fprintf(stderr, "DC sweep: invalid sweep specification\n");
+    return -1;
+  }
+
+  SweepJob job;
+  job.sweeps = sweeps;
+  job.num_sweeps = num_sweeps;
+  job.results = results;
+  job.max_iter = max_iter;
+  job.tol_abs = tol_abs;
+  job.tol_rel = tol_rel;
+  job.workers.resize(ThreadPoolSize(pool));
+
+  // One clone per worker with its own workspace and swept sources
+  int result = 0;
+  SparseOrdering* ordering = nullptr;
+  for (size_t i = 0; i < job.workers.size(); i++) {
+    SweepWorker& w = job.workers[i];
+    w.circuit = CircuitClone(c);
+    if (!w.circuit) {
+      result = -1;
+      break;
+    }
+    // The sweep points already keep every worker busy: stamp and solve the
+    // blocks of each point on its own worker
+    w.circuit->linear_solver.threads = 1;
+    w.circuit->stamp_threads = 1;
+    if (CreateWorkerWorkspace(w.circuit, (int)i, &ordering) != 0) {
+      result = -1;
+      break;
+    }
+    for (int k = 0; k < num_sweeps; k++) {
+      w.src[k] = CircuitFindDevice(w.circuit, sweeps[k].source);
+      double value;
+      if (!w.src[k] || DeviceGetValue(w.src[k], &value) != 0) {
+        fprintf(stderr, "DC sweep: no sweepable source %s\n",
+                sweeps[k].source);
+        result = -1;
+        break;
+      }
+    }
+    if (result != 0) break;
+    w.x.assign(c->num_vars, 0.0);
+  }
+
+  if (result == 0) {
+    ThreadPoolParallelFor(pool, total, SolveSweepPoint, &job);
+    result = job.failed.load() ? -1 : total;
+  }
+
+  for (SweepWorker& w : job.workers) {
+    if (stats && w.circuit) {
+      SimStats worker;
+      SimWorkspaceGetStats(w.circuit->workspace, &worker);
+      SimStatsAdd(stats, &worker);
+    }
+    circuit_free(w.circuit);
+  }
+  SparseOrderingFree(ordering);
+  return result;
+}
+
+int CircuitDcBatchParallel(Circuit* c, ThreadPool* pool,
+                           const DeviceParamRef* params, int num_params,
+                           const double* values, int num_sets,
+                           double* results, int max_iter, double tol_abs,
+                           double tol_rel, SimStats* stats) {
+  SimStatsClear(stats);
+  if (!c || !pool || (num_params > 0 && (!params || !values)) || !results) {
+    return -1;
+  }
+  if (!c->finalized || num_params < 0 || num_sets < 0) return -1;
+
+  BatchJob job;
+  job.params = params;
+  job.num_params = num_params;
+  job.values = values;
+  job.results = results;
+  job.max_iter = max_iter;
+  job.tol_abs = tol_abs;
+  job.tol_rel = tol_rel;
+  job.workers.resize(ThreadPoolSize(pool));
+
+  // One clone per worker with its own params and workspace
+  int result = 0;
+  SparseOrdering* ordering = nullptr;
+  for (size_t i = 0; i < job.workers.size(); i++) {
+    BatchWorker& w = job.workers[i];
+    w.circuit = CircuitClone(c, 1);
+    if (!w.circuit) {
+      result = -1;
+      break;
+    }
+    // The sets already keep every worker busy (as for the sweep points)
+    w.circuit->linear_solver.threads = 1;
+    w.circuit->stamp_threads = 1;
+    if (CreateWorkerWorkspace(w.circuit, (int)i, &ordering) != 0) {
+      result = -1;
+      break;
+    }
+    w.devices.resize(num_params);
+    for (int k = 0; k < num_params; k++) {
+      w.devices[k] = CircuitFindDevice(w.circuit, params[k].device);
+      if (!w.devices[k] || !params[k].param) {
+        fprintf(stderr, "DC batch: no device %s\n",
+                params[k].device ? params[k].device : "(null)");
+        result = -1;
+        break;
+      }
+    }
+    if (result != 0) break;
+    w.x.assign(c->num_vars, 0.0);
+  }
+
+  if (result == 0) {
+    ThreadPoolParallelFor(pool, num_sets, SolveBatchSet, &job);
+    result = job.failed.load() ? -1 : num_sets;
+  }
+
+  for (BatchWorker& w : job.workers) {
+    if (stats && w.circuit) {
+      SimStats worker;
+      SimWorkspaceGetStats(w.circuit->workspace, &worker);
+      SimStatsAdd(stats, &worker);
+    }
+    circuit_free(w.circuit);
+  }
+  SparseOrderingFree(ordering);
+  return result;
+}
+
+}  // namespace minispice
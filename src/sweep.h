@@ -0,0 +1,61 @@
+// sweep.h
+// Parallel multi-point DC sweeps
+//
+// Independent sweep points are distributed over a ThreadPool. Each worker
+// solves on its own CircuitClone (private device state, source values and
+// workspace) and warm-starts from the last point it solved.
+
+#ifndef MINI_SPICE_SWEEP_H_
+#define MINI_SPICE_SWEEP_H_
+
+#include "circuit.h"
+#include "sim_stats.h"
+#include "thread_pool.h"
+
+namespace minispice {
+
+// Total number of points of a (nested) sweep, 0 if any sweep is invalid
+int DcSweepTotalPoints(const DcSweep* sweeps, int num_sweeps);
+
+// Source values of point index p (0 <= p < DcSweepTotalPoints). Points are
+// ordered with sweeps[0] varying fastest, as in CircuitDcSweep.
+void DcSweepPointValues(const DcSweep* sweeps, int num_sweeps, int p,
+                        double* values);
+
+// Perform a DC sweep on all workers of pool. results must hold
+// DcSweepTotalPoints * num_vars doubles; the solution of point p is stored
+// at results + p * num_vars. The circuit itself is not modified. stats may
+// be nullptr; otherwise it receives the statistics of the workers'
+// workspaces, summed (see sim_stats.h).
+// Returns the number of points, or -1 on error or if a point did not
+// converge.
+int CircuitDcSweepParallel(Circuit* c, ThreadPool* pool,
+                           const DcSweep* sweeps, int num_sweeps,
+                           double* results, int max_iter, double tol_abs,
+                           double tol_rel, SimStats* stats);
+
+// A device parameter varied by CircuitDcBatchParallel (see DeviceSetParam
+// for the names)
+struct DeviceParamRef {
+  const char* device;  // Device name (case-insensitive)
+  const char* param;   // Parameter name
+};
+
+// Solve the DC operating point of num_sets parameter sets on all workers of
+// pool. Set s assigns values[s * num_params + k] to params[k]; the solution
+// of set s is stored at results + s * num_vars. Each worker solves on a
+// clone owning its params and re-solves every set from the last one it
+// solved (CircuitDcResolve), so that a linear circuit is factored once per
+// worker. The circuit itself is not modified. stats may be nullptr;
+// otherwise it receives the statistics of the workers' workspaces, summed.
+// Returns num_sets, or -1 on error (unknown device or parameter, rejected
+// value) or if a set did not converge.
+int CircuitDcBatchParallel(Circuit* c, ThreadPool* pool,
+                           const DeviceParamRef* params, int num_params,
+                           const double* values, int num_sets,
+                           double* results, int max_iter, double tol_abs,
+                           double tol_rel, SimStats* stats);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_SWEEP_H_
@@ -0,0 +1,286 @@
+// sweep_test.cc
+// Unit tests for circuit clones and the parallel DC sweep
+
+#include "sweep.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "device.h"
+#include "parser.h"
+#include "workspace.h"
+
+using namespace minispice;
+
+static const char* kDiodeNetlist =
+    "V1 in 0 0\nR1 in a 100\nD1 a 0 Is=1e-14 n=1\nC1 a 0 1u\n";
+
+TEST(CloneTest, CloneSharesParamsButNotState) {
+  Circuit* c = parse_netlist_string(kDiodeNetlist);
+  ASSERT_NE(c, nullptr);
+
+  Circuit* copy = CircuitClone(c);
+  ASSERT_NE(copy, nullptr);
+  EXPECT_EQ(copy->num_vars, c->num_vars);
+  EXPECT_EQ(copy->num_devices, c->num_devices);
+  EXPECT_EQ(copy->workspace, nullptr);
+
+  // Same device order and topology
+  const Device* d = c->devices;
+  const Device* e = copy->devices;
+  for (; d && e; d = d->next, e = e->next) {
+    EXPECT_STREQ(d->name, e->name);
+    for (int i = 0; i < 4; i++) EXPECT_EQ(d->nodes[i], e->nodes[i]);
+    EXPECT_EQ(d->extra_var, e->extra_var);
+    if (d->state) {
+      EXPECT_NE(d->state, e->state);
+    }
+  }
+  EXPECT_EQ(d, nullptr);
+  EXPECT_EQ(e, nullptr);
+
+  // Own node names with a working index
+  ASSERT_EQ(copy->num_nodes, c->num_nodes);
+  for (int i = 1; i < c->num_nodes; i++) {
+    EXPECT_STREQ(copy->nodes[i].name, c->nodes[i].name);
+    EXPECT_NE(copy->nodes[i].name, c->nodes[i].name);
+    EXPECT_EQ(CircuitGetNode(copy, c->nodes[i].name), i);
+  }
+
+  // Model params are shared; source values are private
+  Device* d1 = CircuitFindDevice(c, "D1");
+  Device* d1_copy = CircuitFindDevice(copy, "D1");
+  EXPECT_EQ(d1->params, d1_copy->params);
+  EXPECT_TRUE(d1_copy->flags & kDeviceSharedParams);
+
+  ASSERT_EQ(DeviceSetValue(CircuitFindDevice(copy, "V1"), 3.0), 0);
+  double v = -1.0;
+  ASSERT_EQ(DeviceGetValue(CircuitFindDevice(c, "V1"), &v), 0);
+  EXPECT_DOUBLE_EQ(v, 0.0);
+
+  // The clone is freed first; the original still owns the params
+  circuit_free(copy);
+  std::vector<double> x(c->num_vars);
+  EXPECT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-9, 1e-6), 0);
+  circuit_free(c);
+}
+
+TEST(CloneTest, RequiresFinalizedCircuit) {
+  Circuit* c = circuit_create();
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(CircuitClone(c), nullptr);
+  circuit_free(c);
+}
+
+TEST(SweepTest, PointValuesOrdering) {
+  DcSweep sweeps[2] = {{"V1", 0.0, 1.0, 0.5}, {"I1", 0.0, 2e-3, 1e-3}};
+  EXPECT_EQ(DcSweepTotalPoints(sweeps, 1), 3);
+  EXPECT_EQ(DcSweepTotalPoints(sweeps, 2), 9);
+
+  double values[2];
+  DcSweepPointValues(sweeps, 2, 5, values);
+  EXPECT_DOUBLE_EQ(values[0], 1.0);
+  EXPECT_DOUBLE_EQ(values[1], 1e-3);
+
+  sweeps[1].step = 0.0;
+  EXPECT_EQ(DcSweepTotalPoints(sweeps, 2), 0);
+}
+
+TEST(SweepTest, ParallelMatchesSerial) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 0\nR1 in a 100\nD1 a 0 Is=1e-14 n=1\nI1 0 a 0\n");
+  ASSERT_NE(c, nullptr);
+  int n = c->num_vars;
+
+  DcSweep sweeps[2] = {{"V1", 0.0, 2.0, 0.05}, {"I1", 0.0, 2e-3, 5e-4}};
+  int total = DcSweepTotalPoints(sweeps, 2);
+  ASSERT_EQ(total, 41 * 5);
+
+  ThreadPool* pool = ThreadPoolCreate(4);
+  ASSERT_NE(pool, nullptr);
+
+  std::vector<double> results((size_t)total * n);
+  SimStats stats;
+  ASSERT_EQ(CircuitDcSweepParallel(c, pool, sweeps, 2, results.data(), 100,
+                                   1e-12, 1e-9, &stats),
+            total);
+  EXPECT_GE(stats.newton_iterations, total);
+
+  // The shared circuit is left untouched
+  double v = -1.0;
+  ASSERT_EQ(DeviceGetValue(CircuitFindDevice(c, "V1"), &v), 0);
+  EXPECT_DOUBLE_EQ(v, 0.0);
+  EXPECT_EQ(c->workspace, nullptr);
+
+  // Compare against cold single-point solves
+  std::vector<double> x(n);
+  for (int p = 0; p < total; p++) {
+    double values[2];
+    DcSweepPointValues(sweeps, 2, p, values);
+    DeviceSetValue(CircuitFindDevice(c, "V1"), values[0]);
+    DeviceSetValue(CircuitFindDevice(c, "I1"), values[1]);
+    ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+    for (int i = 0; i < n; i++) {
+      EXPECT_NEAR(results[(size_t)p * n + i], x[i], 1e-9) << "point " << p;
+    }
+  }
+
+  ThreadPoolFree(pool);
+  circuit_free(c);
+}
+
+TEST(SweepTest, UnknownSourceFails) {
+  Circuit* c = parse_netlist_string("V1 1 0 1\nR1 1 0 1k\n");
+  ASSERT_NE(c, nullptr);
+
+  ThreadPool* pool = ThreadPoolCreate(2);
+  ASSERT_NE(pool, nullptr);
+
+  DcSweep sweep = {"V9", 0.0, 1.0, 0.5};
+  std::vector<double> results(3 * c->num_vars);
+  EXPECT_EQ(CircuitDcSweepParallel(c, pool, &sweep, 1, results.data(), 100,
+                                   1e-9, 1e-6, nullptr),
+            -1);
+
+  ThreadPoolFree(pool);
+  circuit_free(c);
+}
+
+TEST(CloneTest, CloneWithOwnParamsCanEditThem) {
+  Circuit* c = parse_netlist_string(kDiodeNetlist);
+  ASSERT_NE(c, nullptr);
+  Circuit* copy = CircuitClone(c, 1);
+  ASSERT_NE(copy, nullptr);
+
+  Device* d1 = CircuitFindDevice(c, "D1");
+  Device* d1_copy = CircuitFindDevice(copy, "D1");
+  EXPECT_NE(d1->params, d1_copy->params);
+  EXPECT_FALSE(d1_copy->flags & kDeviceSharedParams);
+  ASSERT_EQ(CircuitSetDeviceParam(copy, "D1", "is", 2e-14), 0);
+  double i_s = 0.0;
+  ASSERT_EQ(DiodeGetParams(d1, &i_s, nullptr), 0);
+  EXPECT_DOUBLE_EQ(i_s, 1e-14);
+
+  circuit_free(copy);
+  circuit_free(c);
+}
+
+TEST(SweepTest, ParameterBatchMatchesSingleSolves) {
+  // Linear and nonlinear circuits: every set matches the edited circuit
+  // solved from zero; a linear circuit is factored once per worker
+  const char* netlists[] = {
+      "V1 in 0 1\nR1 in a 1k\nR2 a 0 2k\nR3 a b 500\nR4 b 0 1k\n",
+      "V1 in 0 2\nR1 in a 100\nD1 a 0 Is=1e-14 n=1\nR2 a 0 10k\n",
+  };
+  const DeviceParamRef params[][2] = {{{"R2", "r"}, {"V1", "dc"}},
+                                      {{"D1", "is"}, {"R1", "r"}}};
+  for (int k = 0; k < 2; k++) {
+    Circuit* c = parse_netlist_string(netlists[k]);
+    ASSERT_NE(c, nullptr);
+    int n = c->num_vars;
+
+    const int kSets = 40;
+    std::vector<double> values(2 * kSets);
+    for (int s = 0; s < kSets; s++) {
+      values[2 * s] = k == 0 ? 500.0 + 100.0 * s : 1e-14 * (1 + s);
+      values[2 * s + 1] = k == 0 ? 0.5 + 0.1 * (s % 7) : 50.0 + 10.0 * s;
+    }
+
+    ThreadPool* pool = ThreadPoolCreate(3);
+    ASSERT_NE(pool, nullptr);
+    std::vector<double> results((size_t)kSets * n);
+    SimStats stats;
+    ASSERT_EQ(CircuitDcBatchParallel(c, pool, params[k], 2, values.data(),
+                                     kSets, results.data(), 100, 1e-12, 1e-9,
+                                     &stats),
+              kSets);
+    if (k == 0) {
+      EXPECT_LE(stats.factorizations, ThreadPoolSize(pool));
+      EXPECT_GE(stats.low_rank_solves, kSets - ThreadPoolSize(pool));
+    }
+    EXPECT_EQ(c->workspace, nullptr);
+    EXPECT_EQ(c->param_edits, 0);
+
+    std::vector<double> x(n);
+    for (int s = 0; s < kSets; s++) {
+      for (int j = 0; j < 2; j++) {
+        ASSERT_EQ(CircuitSetDeviceParam(c, params[k][j].device,
+                                        params[k][j].param, values[2 * s + j]),
+                  0);
+      }
+      ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+      for (int i = 0; i < n; i++) {
+        EXPECT_NEAR(results[(size_t)s * n + i], x[i], 1e-9) << "set " << s;
+      }
+    }
+
+    // Unknown devices and rejected values fail the batch
+    DeviceParamRef bad = {"R9", "r"};
+    EXPECT_EQ(CircuitDcBatchParallel(c, pool, &bad, 1, values.data(), 1,
+                                     results.data(), 100, 1e-12, 1e-9,
+                                     nullptr),
+              -1);
+    double zero = 0.0;
+    EXPECT_EQ(CircuitDcBatchParallel(c, pool, params[k], 1, &zero, 1,
+                                     results.data(), 100, 1e-12, 1e-9,
+                                     nullptr),
+              -1);
+
+    ThreadPoolFree(pool);
+    circuit_free(c);
+  }
+}
+
+TEST(SweepTest, SparseClonesShareOneOrdering) {
+  // A ladder above the sparse threshold: the first clone orders the pattern
+  // and the others reuse its ordering
+  std::string netlist = "V1 n0 0 1\n";
+  for (int k = 0; k < 120; k++) {
+    std::string a = "n" + std::to_string(k), b = "n" + std::to_string(k + 1);
+    netlist += "R" + std::to_string(k) + " " + a + " " + b + " 100\n";
+    netlist += "RG" + std::to_string(k) + " " + b + " 0 10k\n";
+    if (k % 20 == 0) netlist += "D" + std::to_string(k) + " " + b + " 0\n";
+  }
+  Circuit* c = parse_netlist_string(netlist.c_str());
+  ASSERT_NE(c, nullptr);
+  ASSERT_GE(c->num_vars, kSparseSolverThreshold);
+  int n = c->num_vars;
+
+  DcSweep sweep = {"V1", 0.0, 2.0, 0.1};
+  int total = DcSweepTotalPoints(&sweep, 1);
+  ThreadPool* pool = ThreadPoolCreate(3);
+  ASSERT_NE(pool, nullptr);
+  std::vector<double> results((size_t)total * n);
+  SimStats stats;
+  ASSERT_EQ(CircuitDcSweepParallel(c, pool, &sweep, 1, results.data(), 100,
+                                   1e-12, 1e-9, &stats),
+            total);
+  EXPECT_EQ(stats.sparse, 1);
+  EXPECT_EQ(stats.blocks, 1);
+  EXPECT_EQ(c->workspace, nullptr);
+  EXPECT_EQ(c->sparse_ordering, nullptr);
+
+  const DeviceParamRef param = {"V1", "dc"};
+  std::vector<double> values(total);
+  for (int p = 0; p < total; p++) values[p] = 0.1 * p;
+  std::vector<double> batch((size_t)total * n);
+  ASSERT_EQ(CircuitDcBatchParallel(c, pool, &param, 1, values.data(), total,
+                                   batch.data(), 100, 1e-12, 1e-9, nullptr),
+            total);
+
+  std::vector<double> x(n);
+  for (int p = 0; p < total; p++) {
+    DeviceSetValue(CircuitFindDevice(c, "V1"), values[p]);
+    ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+    for (int i = 0; i < n; i++) {
+      EXPECT_NEAR(results[(size_t)p * n + i], x[i], 1e-9) << "point " << p;
+      EXPECT_NEAR(batch[(size_t)p * n + i], x[i], 1e-9) << "set " << p;
+    }
+  }
+
+  ThreadPoolFree(pool);
+  circuit_free(c);
+}
@@ -0,0 +1,238 @@
+// table_model.cc
+// Monotone cubic tables and the table-model mode of diodes and MOSFETs
+
+#include "table_model.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <utility>
+
+#include "circuit.h"
+#include "device.h"
+#include "workspace.h"
+
+namespace minispice {
+
+// Tables of one circuit, referenced by Device::table
+struct TableModels {
+  MonotoneCubicTable* tables;
+  int num_tables;
+};
+
+namespace {
+
+// Parameters a table depends on, used to share tables between devices
+typedef std::pair<double, double> TableKey;
+
+struct DiodeTableParams {
+  double i_s;
+  double n_vt;
+};
+
+// Diode current and conductance (unclamped)
+void DiodeCurrent(const void* user, double vd, double* f, double* df) {
+  const DiodeTableParams* p = static_cast<const DiodeTableParams*>(user);
+  double e = exp(vd / p->n_vt);
+  *f = p->i_s * (e - 1.0);
+  *df = (p->i_s / p->n_vt) * e;
+}
+
+struct MosfetTableParams {
+  double gamma;
+  double phi2;
+};
+
+// Body-effect threshold shift and its derivative in vbs
+void MosfetThresholdShift(const void* user, double vbs, double* f,
+                          double* df) {
+  const MosfetTableParams* p = static_cast<const MosfetTableParams*>(user);
+  double root = sqrt(p->phi2 - vbs);
+  *f = p->gamma * (root - sqrt(p->phi2));
+  *df = -p->gamma / (2.0 * root);
+}
+
+// Key of the table a device needs; false if the device has none
+bool DeviceTableKey(const Device* d, char* type, TableKey* key) {
+  double i_s, n;
+  MosfetParams p;
+  if (DiodeGetParams(d, &i_s, &n) == 0) {
+    if (!(n > 0.0)) return false;
+    *type = 'D';
+    *key = TableKey(i_s, n);
+    return true;
+  }
+  if (MosfetGetParams(d, &p) == 0) {
+    // The threshold table spans vbs up to phi_f, inside the sqrt domain
+    if (p.gamma == 0.0 || !(p.phi_f > 0.0)) return false;
+    *type = 'M';
+    *key = TableKey(p.gamma, p.phi_f);
+    return true;
+  }
+  return false;
+}
+
+int BuildDeviceTable(MonotoneCubicTable* t, char type, const TableKey& key) {
+  if (type == 'D') {
+    DiodeTableParams p = {key.first, key.second * kThermalVoltage};
+    double x0 = -kDiodeVdMinNvt * p.n_vt;
+    double x1 = kDiodeVdMax;
+    int n = (int)ceil((x1 - x0) / p.n_vt * kDiodeTablePointsPerNvt) + 1;
+    return MonotoneCubicTableBuild(t, x0, x1, n, DiodeCurrent, &p);
+  }
+  MosfetTableParams p = {key.first, 2.0 * key.second};
+  double x1 = key.second;
+  int n = (int)ceil((x1 - kMosfetTableVbsMin) / kMosfetTableVbsStep) + 1;
+  return MonotoneCubicTableBuild(t, kMosfetTableVbsMin, x1, n,
+                                 MosfetThresholdShift, &p);
+}
+
+}  // namespace
+
+// ============================================================================
+// Monotone Cubic Tables
+// ============================================================================
+
+int MonotoneCubicTableBuild(MonotoneCubicTable* t, double x0, double x1, int n,
+                            TableFunction f, const void* user) {
+  if (!t || !f || n < 2 || !(x1 > x0)) return -1;
+
+  double* y = (double*)malloc(n * sizeof(double));
+  double* m = (double*)malloc(n * sizeof(double));
+  double* coef = (double*)malloc(4 * (n - 1) * sizeof(double));
+  if (!y || !m || !coef) {
+    free(y);
+    free(m);
+    free(coef);
+    return -1;
+  }
+
+  double dx = (x1 - x0) / (n - 1);
+  for (int i = 0; i < n; i++) {
+    double x = i == n - 1 ? x1 : x0 + i * dx;
+    f(user, x, &y[i], &m[i]);
+  }
+
+  // Fritsch-Carlson limiting of the slopes
+  for (int k = 0; k + 1 < n; k++) {
+    double delta = (y[k + 1] - y[k]) / dx;
+    if (delta == 0.0) {
+      m[k] = 0.0;
+      m[k + 1] = 0.0;
+      continue;
+    }
+    if (m[k] * delta < 0.0) m[k] = 0.0;
+    if (m[k + 1] * delta < 0.0) m[k + 1] = 0.0;
+    double a = m[k] / delta;
+    double b = m[k + 1] / delta;
+    double tau = a * a + b * b;
+    if (tau > 9.0) {
+      double s = 3.0 / sqrt(tau);
+      m[k] = s * a * delta;
+      m[k + 1] = s * b * delta;
+    }
+  }
+
+  // Hermite pieces in power form: p(u) = c0 + c1 u + c2 u^2 + c3 u^3
+  for (int k = 0; k + 1 < n; k++) {
+    double y0 = y[k];
+    double y1 = y[k + 1];
+    double s0 = m[k] * dx;
+    double s1 = m[k + 1] * dx;
+    double* c = coef + 4 * k;
+    c[0] = y0;
+    c[1] = s0;
+    c[2] = 3.0 * (y1 - y0) - 2.0 * s0 - s1;
+    c[3] = 2.0 * (y0 - y1) + s0 + s1;
+  }
+  free(y);
+  free(m);
+
+  t->x0 = x0;
+  t->x1 = x1;
+  t->inv_dx = 1.0 / dx;
+  t->num_intervals = n - 1;
+  t->coef = coef;
+  return 0;
+}
+
+void MonotoneCubicTableRelease(MonotoneCubicTable* t) {
+  if (!t) return;
+  free(t->coef);
+  t->coef = nullptr;
+  t->num_intervals = 0;
+}
+
+// ============================================================================
+// Table-Model Mode
+// ============================================================================
+
+void TableModelsFree(TableModels* m) {
+  if (!m) return;
+  for (int i = 0; i < m->num_tables; i++) {
+    MonotoneCubicTableRelease(&m->tables[i]);
+  }
+  free(m->tables);
+  free(m);
+}
+
+// Drop the default workspace: its device batches hold the table pointers
+static void ResetDefaultWorkspace(Circuit* c) {
+  SimWorkspaceFree(c->workspace);
+  c->workspace = nullptr;
+}
+
+int CircuitEnableTableModels(Circuit* c) {
+  if (!c || !c->finalized) return -1;
+  CircuitDisableTableModels(c);
+
+  // One table per distinct key, in order of first use
+  std::map<std::pair<char, TableKey>, int> index;
+  for (const Device* d = c->devices; d; d = d->next) {
+    char type;
+    TableKey key;
+    if (DeviceTableKey(d, &type, &key)) {
+      index.emplace(std::make_pair(type, key), (int)index.size());
+    }
+  }
+
+  TableModels* m = (TableModels*)calloc(1, sizeof(TableModels));
+  if (!m) return -1;
+  if (!index.empty()) {
+    m->tables =
+        (MonotoneCubicTable*)calloc(index.size(), sizeof(MonotoneCubicTable));
+    if (!m->tables) {
+      free(m);
+      return -1;
+    }
+  }
+  m->num_tables = (int)index.size();
+  for (const auto& entry : index) {
+    MonotoneCubicTable* t = &m->tables[entry.second];
+    if (BuildDeviceTable(t, entry.first.first, entry.first.second) != 0) {
+      TableModelsFree(m);
+      return -1;
+    }
+  }
+
+  for (Device* d = c->devices; d; d = d->next) {
+    char type;
+    TableKey key;
+    if (DeviceTableKey(d, &type, &key)) {
+      d->table = &m->tables[index[std::make_pair(type, key)]];
+    }
+  }
+  c->table_models = m;
+  ResetDefaultWorkspace(c);
+  return m->num_tables;
+}
+
+void CircuitDisableTableModels(Circuit* c) {
+  if (!c || !c->table_models) return;
+  for (Device* d = c->devices; d; d = d->next) d->table = nullptr;
+  TableModelsFree(c->table_models);
+  c->table_models = nullptr;
+  ResetDefaultWorkspace(c);
+}
+
+}  // namespace minispice
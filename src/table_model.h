@@ -0,0 +1,93 @@
+// table_model.h
+// Tabulated device models for fast characterization runs
+//
+// In table-model mode the diode and MOSFET stamps replace their
+// transcendental evaluations with lookups in monotone piecewise-cubic
+// tables built once per circuit: the diode current over the clamped
+// junction voltage range (instead of exp) and the body-effect threshold
+// shift over the bulk-source voltage (instead of sqrt). The square-law
+// MOSFET current and charges are polynomials in the threshold-referred
+// voltages and stay closed-form. Derivatives are those of the interpolant,
+// so Newton converges on the tabulated model as it does on the exact one.
+//
+// Devices share a table when the parameters it depends on match (Is and n
+// for diodes, gamma and phi_f for MOSFETs). Outside a table's range the
+// exact model is evaluated.
+
+#ifndef MINI_SPICE_TABLE_MODEL_H_
+#define MINI_SPICE_TABLE_MODEL_H_
+
+namespace minispice {
+
+struct Circuit;
+struct TableModels;
+
+// Grid density of the diode current table, in points per n * Vt. The
+// interpolation error of exp is about 6e-7 relative.
+constexpr int kDiodeTablePointsPerNvt = 8;
+
+// Range and spacing of the MOSFET threshold table: vbs from
+// kMosfetTableVbsMin up to phi_f (forward bulk bias beyond phi_f and the
+// square-root corner at 2 phi_f use the exact model)
+constexpr double kMosfetTableVbsMin = -10.0;
+constexpr double kMosfetTableVbsStep = 0.02;
+
+// Piecewise-cubic function of one voltage on a uniform grid. Interval k
+// covers [x0 + k / inv_dx, x0 + (k + 1) / inv_dx] and holds the power
+// coefficients coef[4k .. 4k + 3] in the local coordinate t in [0, 1].
+struct MonotoneCubicTable {
+  double x0;        // First grid point
+  double x1;        // Last grid point
+  double inv_dx;    // 1 / grid spacing
+  int num_intervals;
+  double* coef;
+};
+
+// Function to tabulate: value f and derivative df at x
+typedef void (*TableFunction)(const void* user, double x, double* f,
+                              double* df);
+
+// Tabulate f on n >= 2 grid points spanning [x0, x1]. The cubic pieces are
+// Hermite interpolants of f with the derivatives of f as slopes, limited
+// (Fritsch-Carlson) so that the interpolant is monotone wherever the grid
+// values are.
+// Returns 0 on success, -1 on error (invalid range, allocation failure).
+int MonotoneCubicTableBuild(MonotoneCubicTable* t, double x0, double x1, int n,
+                            TableFunction f, const void* user);
+
+// Free the coefficients of a table built by MonotoneCubicTableBuild
+void MonotoneCubicTableRelease(MonotoneCubicTable* t);
+
+// Interpolated value and derivative at x. Returns 0 if x lies outside the
+// table (y, dy unchanged), 1 otherwise. Inline: this is the stamp hot path.
+inline int MonotoneCubicTableEval(const MonotoneCubicTable* t, double x,
+                                  double* y, double* dy) {
+  if (!(x >= t->x0 && x <= t->x1)) return 0;
+  double s = (x - t->x0) * t->inv_dx;
+  int k = (int)s;
+  if (k >= t->num_intervals) k = t->num_intervals - 1;
+  double u = s - k;
+  const double* c = t->coef + 4 * k;
+  *y = c[0] + u * (c[1] + u * (c[2] + u * c[3]));
+  *dy = (c[1] + u * (2.0 * c[2] + 3.0 * u * c[3])) * t->inv_dx;
+  return 1;
+}
+
+// Build the tables of every diode and MOSFET of a finalized circuit
+// (replacing tables built earlier) and switch those devices to table
+// evaluation. The circuit owns the tables; clones made afterwards share
+// them. The default workspace is rebuilt; workspaces created by the caller
+// before this call keep their device batches and must be recreated.
+// Returns the number of distinct tables, or -1 on error (not finalized,
+// allocation failure; the circuit is then left in exact mode).
+int CircuitEnableTableModels(Circuit* c);
+
+// Switch every device back to exact evaluation and free the tables
+void CircuitDisableTableModels(Circuit* c);
+
+// Free the tables of a circuit (called by circuit_free)
+void TableModelsFree(TableModels* m);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_TABLE_MODEL_H_
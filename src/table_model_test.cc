@@ -0,0 +1,190 @@
+// table_model_test.cc
+// Unit tests for monotone cubic tables and table-model mode
+
+#include "table_model.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "circuit.h"
+#include "device.h"
+#include "device_batch.h"
+#include "parser.h"
+#include "workspace.h"
+
+using namespace minispice;
+
+static void Cubic(const void* user, double x, double* f, double* df) {
+  (void)user;
+  *f = x * x * x + x;
+  *df = 3.0 * x * x + 1.0;
+}
+
+static void Step(const void* user, double x, double* f, double* df) {
+  (void)user;
+  *f = tanh(20.0 * x);
+  *df = 20.0 / (cosh(20.0 * x) * cosh(20.0 * x));
+}
+
+static double NodeVoltage(Circuit* c, const double* x, const char* name) {
+  return x[c->nodes[CircuitGetNode(c, name)].var_index];
+}
+
+TEST(MonotoneCubicTableTest, ReproducesCubics) {
+  MonotoneCubicTable t;
+  ASSERT_EQ(MonotoneCubicTableBuild(&t, -1.0, 2.0, 7, Cubic, nullptr), 0);
+  for (double x = -1.0; x <= 2.0; x += 0.013) {
+    double y, dy;
+    ASSERT_EQ(MonotoneCubicTableEval(&t, x, &y, &dy), 1);
+    EXPECT_NEAR(y, x * x * x + x, 1e-12);
+    EXPECT_NEAR(dy, 3.0 * x * x + 1.0, 1e-12);
+  }
+  double y = 7.0, dy = 7.0;
+  EXPECT_EQ(MonotoneCubicTableEval(&t, -1.5, &y, &dy), 0);
+  EXPECT_EQ(MonotoneCubicTableEval(&t, 2.5, &y, &dy), 0);
+  EXPECT_EQ(MonotoneCubicTableEval(&t, NAN, &y, &dy), 0);
+  EXPECT_EQ(y, 7.0);
+  ASSERT_EQ(MonotoneCubicTableEval(&t, 2.0, &y, &dy), 1);  // Last point
+  EXPECT_NEAR(y, 10.0, 1e-12);
+  MonotoneCubicTableRelease(&t);
+
+  EXPECT_EQ(MonotoneCubicTableBuild(&t, 1.0, 1.0, 7, Cubic, nullptr), -1);
+  EXPECT_EQ(MonotoneCubicTableBuild(&t, 0.0, 1.0, 1, Cubic, nullptr), -1);
+}
+
+TEST(MonotoneCubicTableTest, StaysMonotone) {
+  // A coarse grid across a steep step: the exact slopes would overshoot
+  MonotoneCubicTable t;
+  ASSERT_EQ(MonotoneCubicTableBuild(&t, -1.0, 1.0, 9, Step, nullptr), 0);
+  double prev = -INFINITY;
+  for (double x = -1.0; x <= 1.0; x += 1e-3) {
+    double y, dy;
+    ASSERT_EQ(MonotoneCubicTableEval(&t, x, &y, &dy), 1);
+    EXPECT_GE(y, prev) << x;
+    EXPECT_GE(dy, 0.0) << x;
+    EXPECT_LE(std::fabs(y), 1.0 + 1e-12) << x;
+    prev = y;
+  }
+  MonotoneCubicTableRelease(&t);
+}
+
+TEST(TableModelTest, DevicesShareTables) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 1\nR1 in a 1k\nD1 a 0\nD2 a 0\nD3 a 0 n=1.5\n"
+      "M1 in a 0 0 GAMMA=0.4\nM2 in a 0 0 GAMMA=0.4 W=20u\nM3 in a 0 0\n");
+  ASSERT_NE(c, nullptr);
+  Circuit* open = circuit_create();
+  EXPECT_EQ(CircuitEnableTableModels(open), -1);  // Not finalized
+  circuit_free(open);
+
+  // D1 and D2, D3, M1 and M2 (the table ignores W); M3 has no body effect
+  ASSERT_EQ(CircuitEnableTableModels(c), 3);
+  Device* d1 = CircuitFindDevice(c, "D1");
+  Device* m1 = CircuitFindDevice(c, "M1");
+  EXPECT_NE(d1->table, nullptr);
+  EXPECT_EQ(CircuitFindDevice(c, "D2")->table, d1->table);
+  EXPECT_NE(CircuitFindDevice(c, "D3")->table, d1->table);
+  EXPECT_NE(m1->table, nullptr);
+  EXPECT_EQ(CircuitFindDevice(c, "M2")->table, m1->table);
+  EXPECT_EQ(CircuitFindDevice(c, "M3")->table, nullptr);
+  EXPECT_EQ(CircuitFindDevice(c, "R1")->table, nullptr);
+
+  // Enabling again rebuilds; clones share the tables
+  ASSERT_EQ(CircuitEnableTableModels(c), 3);
+  Circuit* clone = CircuitClone(c);
+  ASSERT_NE(clone, nullptr);
+  EXPECT_EQ(CircuitFindDevice(clone, "D1")->table,
+            CircuitFindDevice(c, "D1")->table);
+  circuit_free(clone);
+
+  CircuitDisableTableModels(c);
+  EXPECT_EQ(c->table_models, nullptr);
+  for (Device* d = c->devices; d; d = d->next) EXPECT_EQ(d->table, nullptr);
+  circuit_free(c);
+}
+
+TEST(TableModelTest, DcMatchesExactModels) {
+  // Diode clamp plus a source-degenerated MOSFET with body effect (vbs < 0)
+  const char* netlist =
+      "VDD vdd 0 3\nVG g 0 2\nR1 vdd a 1k\nD1 a 0 Is=1e-15 n=1.3\n"
+      "RD vdd d 2k\nM1 d g s 0 W=10u L=1u GAMMA=0.5 PHIF=0.35\nRS s 0 500\n";
+  Circuit* exact = parse_netlist_string(netlist);
+  Circuit* table = parse_netlist_string(netlist);
+  ASSERT_NE(exact, nullptr);
+  ASSERT_NE(table, nullptr);
+  ASSERT_EQ(CircuitEnableTableModels(table), 2);
+
+  std::vector<double> x(exact->num_vars), y(table->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(exact, x.data(), 100, 1e-12, 1e-9), 0);
+  ASSERT_GT(CircuitDcAnalysis(table, y.data(), 100, 1e-12, 1e-9), 0);
+  for (const char* node : {"a", "d", "s"}) {
+    double v_exact = NodeVoltage(exact, x.data(), node);
+    EXPECT_NEAR(NodeVoltage(table, y.data(), node), v_exact,
+                1e-6 * std::fabs(v_exact))
+        << node;
+  }
+  EXPECT_GT(NodeVoltage(exact, x.data(), "s"), 0.1);  // Body effect active
+
+  // Back to exact evaluation, bit for bit
+  CircuitDisableTableModels(table);
+  ASSERT_GT(CircuitDcAnalysis(table, y.data(), 100, 1e-12, 1e-9), 0);
+  for (int i = 0; i < exact->num_vars; i++) EXPECT_EQ(y[i], x[i]);
+
+  circuit_free(exact);
+  circuit_free(table);
+}
+
+TEST(TableModelTest, BatchesMatchScalarTableStamps) {
+  // Diode branches and body-biased MOSFETs, enough of each to be batched
+  std::string netlist = "V1 in 0 5\n";
+  for (int k = 0; k < kDeviceBatchMinSize; k++) {
+    std::string a = "a" + std::to_string(k);
+    netlist += "R" + std::to_string(k) + " in " + a + " 1k\n";
+    netlist += "D" + std::to_string(k) + " " + a + " 0 n=" +
+               std::to_string(1.0 + 0.1 * (k % 3)) + "\n";
+    netlist += "M" + std::to_string(k) + " in " + a + " s" +
+               std::to_string(k % 4) + " 0 GAMMA=0.4\n";
+    netlist += "RS" + std::to_string(k) + " s" + std::to_string(k % 4) +
+               " 0 1k\n";
+  }
+  Circuit* c = parse_netlist_string(netlist.c_str());
+  ASSERT_NE(c, nullptr);
+  std::vector<double> x(c->num_vars), y(c->num_vars);
+  ASSERT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+
+  ASSERT_EQ(CircuitEnableTableModels(c), 4);
+  EXPECT_EQ(c->workspace, nullptr);
+  DeviceBatches* b = DeviceBatchesCreate(c);
+  ASSERT_NE(b, nullptr);
+  ASSERT_NE(b->diodes.table, nullptr);
+  ASSERT_NE(b->mosfets.table, nullptr);
+
+  // Batched and scalar table evaluations stamp the same values
+  int n = c->num_vars;
+  StampContext* ref = CtxCreate(n);
+  StampContext* bat = CtxCreate(n);
+  IterationState it = {0, x.data(), 1e-9, 1e-6, NewtonPolicy{}, nullptr, 0.0};
+  for (Device* d = c->devices; d; d = d->next) {
+    if (d->table) d->vt->StampNonlinear(d, ref, &it);
+  }
+  DeviceBatchesStamp(b, bat, &it, nullptr);
+  std::vector<double> A_ref((size_t)n * n), A_bat((size_t)n * n);
+  CtxAssembleDense(ref, A_ref.data());
+  CtxAssembleDense(bat, A_bat.data());
+  for (size_t i = 0; i < A_ref.size(); i++) EXPECT_EQ(A_bat[i], A_ref[i]);
+  for (int i = 0; i < n; i++) EXPECT_EQ(CtxGetZ(bat)[i], CtxGetZ(ref)[i]);
+  CtxFree(ref);
+  CtxFree(bat);
+  DeviceBatchesFree(b);
+
+  // The tabulated solution stays close to the exact one
+  ASSERT_GT(CircuitDcAnalysis(c, y.data(), 100, 1e-12, 1e-9), 0);
+  ASSERT_NE(c->workspace->batches, nullptr);
+  for (int i = 0; i < c->num_vars; i++) {
+    EXPECT_NEAR(y[i], x[i], 1e-6 * std::fabs(x[i]) + 1e-12);
+  }
+  circuit_free(c);
+}
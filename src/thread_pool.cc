@@ -0,0 +1,190 @@
+// Worker pool implementation
+//
+// Every worker owns an index range protected by its own mutex. The owner
+// pops indices from the front; thieves split off the back half. Ranges are
+// only ever locked one at a time, so there is no lock ordering to respect.
+//
+
+#include "thread_pool.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace minispice {
+
+namespace {
+
+// Index range owned by one worker, padded to its own cache line
+struct alignas(64) WorkRange {
+  std::mutex mutex;
+  int begin = 0;
+  int end = 0;
+};
+
+}  // namespace
+
+struct ThreadPool {
+  std::vector<std::thread> threads;               // Workers 1..n-1
+  std::vector<std::unique_ptr<WorkRange>> ranges;  // One per worker
+
+  std::mutex mutex;
+  std::condition_variable start_cv;  // Signals a new loop or shutdown
+  std::condition_variable done_cv;   // Signals the last worker finished
+  uint64_t generation = 0;           // Incremented for every loop
+  int active = 0;                    // Background workers still running
+  bool stop = false;
+
+  ParallelForFn fn = nullptr;
+  void* user = nullptr;
+};
+
+namespace {
+
+// Take the next index from the worker's own range
+static bool PopOwn(ThreadPool* pool, int id, int* index) {
+  WorkRange* r = pool->ranges[id].get();
+  std::lock_guard<std::mutex> lock(r->mutex);
+  if (r->begin >= r->end) return false;
+  *index = r->begin++;
+  return true;
+}
+
+// Move the upper half of the largest remaining range into the worker's own
+// range. Returns false once every range is empty.
+static bool Steal(ThreadPool* pool, int id) {
+  int n = (int)pool->ranges.size();
+  for (;;) {
+    int victim = -1;
+    int best = 0;
+    for (int k = 1; k < n; k++) {
+      int v = (id + k) % n;
+      WorkRange* r = pool->ranges[v].get();
+      std::lock_guard<std::mutex> lock(r->mutex);
+      if (r->end - r->begin > best) {
+        best = r->end - r->begin;
+        victim = v;
+      }
+    }
+    if (victim < 0) return false;
+
+    int begin, end;
+    {
+      WorkRange* r = pool->ranges[victim].get();
+      std::lock_guard<std::mutex> lock(r->mutex);
+      if (r->begin >= r->end) continue;  // Drained meanwhile: rescan
+      begin = r->begin + (r->end - r->begin) / 2;
+      end = r->end;
+      r->end = begin;
+    }
+
+    WorkRange* own = pool->ranges[id].get();
+    std::lock_guard<std::mutex> lock(own->mutex);
+    own->begin = begin;
+    own->end = end;
+    return true;
+  }
+}
+
+// Process indices until no work is left anywhere
+static void RunWorker(ThreadPool* pool, int id) {
+  for (;;) {
+    int index;
+    if (PopOwn(pool, id, &index)) {
+      pool->fn(pool->user, id, index);
+    } else if (!Steal(pool, id)) {
+      return;
+    }
+  }
+}
+
+static void WorkerMain(ThreadPool* pool, int id) {
+  uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(pool->mutex);
+      pool->start_cv.wait(
+          lock, [&] { return pool->stop || pool->generation != seen; });
+      if (pool->stop) return;
+      seen = pool->generation;
+    }
+
+    RunWorker(pool, id);
+
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    if (--pool->active == 0) pool->done_cv.notify_one();
+  }
+}
+
+}  // namespace
+
+// ============================================================================
+// ThreadPool API Implementation
+// ============================================================================
+
+ThreadPool* ThreadPoolCreate(int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = (int)std::thread::hardware_concurrency();
+    if (num_threads <= 0) num_threads = 1;
+  }
+
+  ThreadPool* pool = new (std::nothrow) ThreadPool();
+  if (!pool) return nullptr;
+
+  for (int k = 0; k < num_threads; k++) {
+    pool->ranges.emplace_back(new WorkRange());
+  }
+  for (int k = 1; k < num_threads; k++) {
+    pool->threads.emplace_back(WorkerMain, pool, k);
+  }
+  return pool;
+}
+
+void ThreadPoolFree(ThreadPool* pool) {
+  if (!pool) return;
+
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->stop = true;
+  }
+  pool->start_cv.notify_all();
+  for (std::thread& t : pool->threads) t.join();
+  delete pool;
+}
+
+int ThreadPoolSize(const ThreadPool* pool) {
+  return pool ? (int)pool->ranges.size() : 0;
+}
+
+void ThreadPoolParallelFor(ThreadPool* pool, int count, ParallelForFn fn,
+                           void* user) {
+  if (!pool || !fn || count <= 0) return;
+
+  // Split the index range into one contiguous block per worker
+  int n = (int)pool->ranges.size();
+  for (int k = 0; k < n; k++) {
+    WorkRange* r = pool->ranges[k].get();
+    std::lock_guard<std::mutex> lock(r->mutex);
+    r->begin = (int)((int64_t)count * k / n);
+    r->end = (int)((int64_t)count * (k + 1) / n);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->fn = fn;
+    pool->user = user;
+    pool->active = n - 1;
+    pool->generation++;
+  }
+  pool->start_cv.notify_all();
+
+  RunWorker(pool, 0);
+
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  pool->done_cv.wait(lock, [&] { return pool->active == 0; });
+}
+
+}  // namespace minispice
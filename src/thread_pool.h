@@ -0,0 +1,41 @@
+// thread_pool.h
+// Fixed-size worker pool with a work-stealing parallel for loop
+//
+// Used to run independent analysis points (sweep points, Monte Carlo
+// samples) concurrently. Each worker starts with a contiguous block of the
+// index range and processes it in increasing order, so consecutive points
+// usually land on the same worker (good for warm starts). A worker that runs
+// out of work steals the upper half of the largest remaining block.
+
+#ifndef MINI_SPICE_THREAD_POOL_H_
+#define MINI_SPICE_THREAD_POOL_H_
+
+namespace minispice {
+
+// Opaque worker pool
+struct ThreadPool;
+
+// Loop body: called once for every index. thread is the worker id in
+// [0, ThreadPoolSize) and can be used to select per-thread data.
+typedef void (*ParallelForFn)(void* user, int thread, int index);
+
+// Create a pool with num_threads workers (including the calling thread).
+// num_threads <= 0 uses the number of hardware threads.
+// Returns nullptr on failure.
+ThreadPool* ThreadPoolCreate(int num_threads);
+
+// Stop and join all workers
+void ThreadPoolFree(ThreadPool* pool);
+
+// Number of workers, including the calling thread
+int ThreadPoolSize(const ThreadPool* pool);
+
+// Run fn(user, thread, i) for every i in [0, count). The calling thread
+// takes part as worker 0. Blocks until every index has been processed.
+// Calls must not be nested or made concurrently on the same pool.
+void ThreadPoolParallelFor(ThreadPool* pool, int count, ParallelForFn fn,
+                           void* user);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_THREAD_POOL_H_
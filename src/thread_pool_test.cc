@@ -0,0 +1,75 @@
+// thread_pool_test.cc
+// Unit tests for the work-stealing worker pool
+
+#include "thread_pool.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace minispice;
+
+struct CountJob {
+  std::vector<std::atomic<int>> hits;
+  std::vector<std::atomic<int>> per_thread;
+  CountJob(int count, int threads) : hits(count), per_thread(threads) {}
+};
+
+static void CountIndex(void* user, int thread, int index) {
+  CountJob* job = static_cast<CountJob*>(user);
+  job->hits[index].fetch_add(1);
+  job->per_thread[thread].fetch_add(1);
+}
+
+TEST(ThreadPoolTest, CreateAndSize) {
+  ThreadPool* pool = ThreadPoolCreate(3);
+  ASSERT_NE(pool, nullptr);
+  EXPECT_EQ(ThreadPoolSize(pool), 3);
+  ThreadPoolFree(pool);
+
+  pool = ThreadPoolCreate(0);
+  ASSERT_NE(pool, nullptr);
+  EXPECT_GE(ThreadPoolSize(pool), 1);
+  ThreadPoolFree(pool);
+}
+
+TEST(ThreadPoolTest, EveryIndexRunsOnce) {
+  ThreadPool* pool = ThreadPoolCreate(4);
+  ASSERT_NE(pool, nullptr);
+
+  // Repeated loops on the same pool, including fewer indices than workers
+  for (int count : {1, 3, 100, 1000}) {
+    CountJob job(count, ThreadPoolSize(pool));
+    ThreadPoolParallelFor(pool, count, CountIndex, &job);
+    for (int i = 0; i < count; i++) {
+      EXPECT_EQ(job.hits[i].load(), 1) << "count " << count << " index " << i;
+    }
+  }
+
+  ThreadPoolFree(pool);
+}
+
+static void SlowFirstBlock(void* user, int thread, int index) {
+  // Indices of worker 0's initial block are slow: the others must steal
+  if (index < 16) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  CountIndex(user, thread, index);
+}
+
+TEST(ThreadPoolTest, IdleWorkersSteal) {
+  ThreadPool* pool = ThreadPoolCreate(4);
+  ASSERT_NE(pool, nullptr);
+
+  const int count = 64;
+  CountJob job(count, ThreadPoolSize(pool));
+  ThreadPoolParallelFor(pool, count, SlowFirstBlock, &job);
+
+  for (int i = 0; i < count; i++) EXPECT_EQ(job.hits[i].load(), 1);
+
+  // Worker 0 started with 16 slow indices; some were taken by thieves
+  EXPECT_LT(job.per_thread[0].load(), count / 4);
+
+  ThreadPoolFree(pool);
+}
@@ -0,0 +1,345 @@
+// Transient analysis implementation
+//
+// Time stepping with LTE-based step control, step rejection and automatic
+// method switching at breakpoints.
+//
+
+#include "transient.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "device.h"
+#include "device_batch.h"
+#include "workspace.h"
+
+namespace minispice {
+
+namespace {
+
+// Number of accepted solutions kept for the LTE estimate (order 2 needs the
+// new point plus three previous ones)
+constexpr int kHistoryPoints = 3;
+
+// Leading coefficient of the local truncation error of each method,
+// LTE = C * h^(k+1) * x^(k+1)
+static double ErrorConstant(const IntegrationMethod* im) {
+  switch (im->kind) {
+    case kIntegrationTrapezoidal:
+      return 1.0 / 12.0;
+    case kIntegrationGear2:
+      return 2.0 / 9.0;
+    default:
+      return 0.5;  // Backward Euler
+  }
+}
+
+// Gear2 (BDF2) coefficients for a step h following a step h_prev. Reduces to
+// kGear2 for equal steps.
+static IntegrationMethod VariableGear2(double h, double h_prev) {
+  IntegrationMethod im = kGear2;
+  double w = h / h_prev;
+  im.alpha0 = im.beta0 = (1.0 + 2.0 * w) / (1.0 + w);
+  im.alpha1 = im.beta1 = 1.0 + w;
+  im.alpha2 = im.beta2 = -w * w / (1.0 + w);
+  return im;
+}
+
+// Earliest device breakpoint later than t + hmin, capped at tstop
+static double NextBreakpoint(Circuit* c, double t, double hmin, double tstop) {
+  double next = tstop;
+  for (Device* d = c->devices; d; d = d->next) {
+    if (!d->vt || !d->vt->NextBreakpoint) continue;
+    double b = d->vt->NextBreakpoint(d, t);
+    while (b <= t + hmin) {
+      // A breakpoint that fails to advance is probed past, and the device
+      // is ignored if that does not advance either
+      double after = d->vt->NextBreakpoint(d, b);
+      if (!(after > b)) after = d->vt->NextBreakpoint(d, b + hmin);
+      if (!(after > b)) {
+        b = INFINITY;
+        break;
+      }
+      b = after;
+    }
+    if (b < next) next = b;
+  }
+  return next;
+}
+
+// Newton-Raphson solve of one time step under the Newton policy of ts. x
+// holds the initial guess and receives the solution. Returns the iteration
+// count, or -1 if the step did not converge.
+static int SolveTimeStep(Circuit* c, SimWorkspace* ws, TimeStepState* ts,
+                         double* x, const TransientOptions* opts) {
+  int n = c->num_vars;
+  bool line_search =
+      !c->is_linear && ts->policy.damping == kNewtonDampingLineSearch;
+  double residual = INFINITY;
+  for (int iter = 0; iter < opts->max_iter; iter++) {
+    ts->x_current = x;
+    ts->iter = iter;
+    if (SimWorkspaceAssembleTransient(ws, c, ts) != 0) return -1;
+    if (line_search &&
+        SimWorkspaceLineSearch(ws, c, nullptr, ts, &residual) != 0) {
+      return -1;
+    }
+    if (SimWorkspaceSolve(ws) != 0) return -1;
+
+    // Linear circuits are solved exactly by the first iteration
+    if (c->is_linear) {
+      memcpy(x, ws->x_new, n * sizeof(double));
+      return iter + 1;
+    }
+
+    bool converged = true;
+    for (int i = 0; i < n; i++) {
+      double delta = ws->x_new[i] - x[i];
+      if (fabs(delta) > opts->tol_abs + opts->tol_rel * fabs(ws->x_new[i])) {
+        converged = false;
+      }
+    }
+    SimWorkspaceUpdateSolution(ws, x, &ts->policy);
+    if (converged) return iter + 1;
+  }
+  return -1;
+}
+
+// Ratio of the estimated LTE to its tolerance (maximum over all variables)
+// for a step to (t, x) of the given order. hist holds order + 1 previous
+// solutions, newest first.
+static double LteRatio(int n, double t, const double* x, double* const* hist,
+                       const double* t_hist, const IntegrationMethod* im,
+                       double h, const TransientOptions* opts) {
+  int order = im->order;
+  int m = order + 2;  // Points in the divided difference
+
+  double tau[kHistoryPoints + 1];
+  tau[0] = t;
+  for (int j = 1; j < m; j++) tau[j] = t_hist[j - 1];
+
+  // (k+1)! * C * h^(k+1)
+  double scale = ErrorConstant(im);
+  for (int j = 1; j <= order + 1; j++) scale *= j * h;
+
+  double worst = 0.0;
+  for (int i = 0; i < n; i++) {
+    double v[kHistoryPoints + 1];
+    v[0] = x[i];
+    for (int j = 1; j < m; j++) v[j] = hist[j - 1][i];
+
+    for (int level = 1; level < m; level++) {
+      for (int j = 0; j + level < m; j++) {
+        v[j] = (v[j] - v[j + 1]) / (tau[j] - tau[j + level]);
+      }
+    }
+
+    double lte = scale * fabs(v[0]);
+    double tol = opts->lte_reltol * fmax(fabs(x[i]), fabs(hist[0][i])) +
+                 opts->lte_abstol;
+    double ratio = lte / (opts->trtol * tol);
+    if (ratio > worst) worst = ratio;
+  }
+  return worst;
+}
+
+}  // namespace
+
+// ============================================================================
+// Transient API Implementation
+// ============================================================================
+
+void TransientOptionsInit(TransientOptions* opts, double tstep, double tstop) {
+  if (!opts) return;
+
+  opts->tstep = tstep;
+  opts->tstop = tstop;
+  opts->tmax = 0.0;
+  opts->hmin = 0.0;
+  opts->method = &kTrapezoidal;
+  opts->lte_reltol = 1e-3;
+  opts->lte_abstol = 1e-6;
+  opts->trtol = 7.0;
+  opts->max_iter = 100;
+  opts->tol_abs = 1e-9;
+  opts->tol_rel = 1e-6;
+}
+
+int CircuitTransientAnalysis(Circuit* c, SimWorkspace* ws,
+                             const TransientOptions* opts, double* x,
+                             TransientCallback cb, void* user,
+                             TransientStats* stats) {
+  if (!c || !opts || !x) return -1;
+  if (!c->finalized) return -1;
+  if (opts->tstop <= 0.0 || opts->tstep <= 0.0 || !opts->method) return -1;
+
+  if (!ws) {
+    if (!c->workspace) {
+      c->workspace = SimWorkspaceCreate(c);
+      if (!c->workspace) return -1;
+    }
+    ws = c->workspace;
+  }
+
+  int n = c->num_vars;
+  if (ws->n != n) return -1;
+
+  double tstop = opts->tstop;
+  double tmax = opts->tmax > 0.0 ? opts->tmax : tstop / 50.0;
+  double hmin = opts->hmin > 0.0 ? opts->hmin : tstop * 1e-12;
+  double h_start = 0.1 * fmin(opts->tstep, tmax);
+
+  TransientStats local_stats = {0, 0, 0, 0, 0};
+  if (!stats) stats = &local_stats;
+  *stats = local_stats;
+  DeviceEvalCounts counts_start = ws->eval_counts;
+
+  // Operating point and initial device history
+  if (CircuitDcAnalysisWithWorkspace(c, ws, x, opts->max_iter, opts->tol_abs,
+                                     opts->tol_rel) < 0) {
+    fprintf(stderr, "Transient analysis: operating point failed\n");
+    return -1;
+  }
+  for (Device* d = c->devices; d; d = d->next) {
+    if (d->vt && d->vt->InitState) d->vt->InitState(d, x);
+  }
+  if (cb) cb(user, 0.0, x, n);
+
+  // Accepted solutions since the last breakpoint, newest first
+  std::vector<double> storage((size_t)kHistoryPoints * n);
+  double* hist[kHistoryPoints];
+  double t_hist[kHistoryPoints];
+  for (int j = 0; j < kHistoryPoints; j++) hist[j] = &storage[(size_t)j * n];
+  memcpy(hist[0], x, n * sizeof(double));
+  t_hist[0] = 0.0;
+  int num_hist = 1;
+
+  std::vector<double> x_trial(n);
+
+  double t = 0.0;
+  double h = h_start;
+  double h_prev = 0.0;
+  bool after_breakpoint = true;  // The next step restarts with BE
+
+  while (t < tstop - hmin) {
+    double next_bp = NextBreakpoint(c, t, hmin, tstop);
+
+    // Land exactly on the next breakpoint and avoid a tiny step before it
+    h = fmin(h, tmax);
+    bool lands = false;
+    if (t + h >= next_bp - hmin) {
+      h = next_bp - t;
+      lands = true;
+    } else if (t + 2.0 * h > next_bp) {
+      h = 0.5 * (next_bp - t);
+    }
+
+    // First order after breakpoints, the requested method otherwise
+    IntegrationMethod im = after_breakpoint ? kBackwardEuler : *opts->method;
+    if (!after_breakpoint && im.kind == kIntegrationGear2) {
+      im = VariableGear2(h, h_prev);
+    }
+
+    TimeStepState ts;
+    ts.t = t + h;
+    ts.h = h;
+    ts.x_prev = hist[0];
+    ts.x_prev2 = num_hist > 1 ? hist[1] : nullptr;
+    ts.im = &im;
+    ts.x_current = nullptr;
+    ts.iter = 0;
+    ts.policy = c->newton;
+    ts.counts = &ws->eval_counts;
+
+    // Predict with the last solution and solve the step
+    memcpy(x_trial.data(), hist[0], n * sizeof(double));
+    int iters = SolveTimeStep(c, ws, &ts, x_trial.data(), opts);
+    if (iters < 0) {
+      stats->rejected_steps++;
+      h *= 0.125;
+      if (h < hmin) {
+        fprintf(stderr, "Transient analysis: time step too small at t = %g\n",
+                t);
+        return -1;
+      }
+      continue;
+    }
+    stats->newton_iterations += iters;
+
+    // LTE check needs order + 1 previous points since the breakpoint; the
+    // step ending on a breakpoint is accepted as is (its waveform corner
+    // lies exactly at the end of the step)
+    double ratio = -1.0;
+    if (!lands && num_hist >= im.order + 1) {
+      ratio = LteRatio(n, ts.t, x_trial.data(), hist, t_hist, &im, h, opts);
+      if (ratio > 1.0) {
+        stats->rejected_steps++;
+        h *= fmax(0.25, 0.9 * pow(ratio, -1.0 / (im.order + 1)));
+        if (h < hmin) {
+          fprintf(stderr,
+                  "Transient analysis: time step too small at t = %g\n", t);
+          return -1;
+        }
+        continue;
+      }
+    }
+
+    // Accept: advance device history (batched capacitors together) and the
+    // solution history
+    DeviceBatches* batches = ws->batches;
+    int k = 0;
+    for (Device* d = c->devices; d; d = d->next, k++) {
+      if (batches && k < batches->num_devices &&
+          (batches->batched[k] & kBatchHistory)) {
+        continue;
+      }
+      if (d->vt && d->vt->UpdateState) {
+        d->vt->UpdateState(d, x_trial.data(), &ts);
+      }
+    }
+    DeviceBatchesUpdateState(batches, x_trial.data(), &ts);
+
+    double* oldest = hist[kHistoryPoints - 1];
+    for (int j = kHistoryPoints - 1; j > 0; j--) {
+      hist[j] = hist[j - 1];
+      t_hist[j] = t_hist[j - 1];
+    }
+    hist[0] = oldest;
+    memcpy(hist[0], x_trial.data(), n * sizeof(double));
+    t_hist[0] = ts.t;
+    if (num_hist < kHistoryPoints) num_hist++;
+
+    t = ts.t;
+    h_prev = h;
+    stats->accepted_steps++;
+    if (cb) cb(user, t, hist[0], n);
+
+    // Next step size
+    if (lands) {
+      num_hist = 1;
+      after_breakpoint = true;
+      h = fmin(h, h_start);
+    } else {
+      after_breakpoint = false;
+      double grow = 2.0;
+      if (ratio > 0.0) {
+        grow = fmin(2.0, 0.9 * pow(ratio, -1.0 / (im.order + 1)));
+      }
+      // Linear circuits only grow the step by doubling, so runs of equal
+      // steps reuse the factored matrix
+      if (c->is_linear && grow > 1.0 && grow < 2.0) grow = 1.0;
+      h *= grow;
+    }
+  }
+
+  memcpy(x, hist[0], n * sizeof(double));
+  stats->device_evaluations =
+      ws->eval_counts.evaluations - counts_start.evaluations;
+  stats->bypassed_evaluations =
+      ws->eval_counts.bypassed - counts_start.bypassed;
+  return stats->accepted_steps;
+}
+
+}  // namespace minispice
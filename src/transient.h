@@ -0,0 +1,75 @@
+// transient.h
+// Transient analysis with adaptive time stepping
+//
+// The engine starts from the DC operating point and advances in time with a
+// Newton-Raphson solve per step. The step size is controlled by an estimate
+// of the local truncation error (LTE) computed from divided differences of
+// the accepted solutions. Steps whose LTE exceeds the tolerance, or whose
+// Newton iteration fails, are rejected and retried with a smaller step.
+// Source waveform corners are breakpoints: the engine lands on them exactly
+// and restarts with Backward Euler and a small step after each one, then
+// returns to the requested second-order method.
+
+#ifndef MINI_SPICE_TRANSIENT_H_
+#define MINI_SPICE_TRANSIENT_H_
+
+#include "circuit.h"
+#include "stamp.h"
+
+namespace minispice {
+
+// Transient analysis settings
+struct TransientOptions {
+  double tstep;  // Suggested step, sets the initial step size
+  double tstop;  // End time
+  double tmax;   // Maximum step (0: tstop / 50)
+  double hmin;   // Minimum step before giving up (0: tstop * 1e-12)
+
+  // Method used between breakpoints: &kTrapezoidal or &kGear2
+  // (&kBackwardEuler disables the switch to second order)
+  const IntegrationMethod* method;
+
+  // LTE tolerance per variable: lte_reltol * |x| + lte_abstol, relaxed by
+  // trtol (SPICE's overestimation factor)
+  double lte_reltol;
+  double lte_abstol;
+  double trtol;
+
+  // Newton-Raphson settings for the operating point and every time step
+  int max_iter;
+  double tol_abs;
+  double tol_rel;
+};
+
+// Counters reported by CircuitTransientAnalysis
+struct TransientStats {
+  int accepted_steps;     // Time points after t = 0
+  int rejected_steps;     // Steps retried (LTE or Newton failure)
+  int newton_iterations;  // Total Newton iterations of all time steps
+
+  // Diode and MOSFET model evaluations of the run (operating point
+  // included) and the evaluations skipped by device bypass
+  long device_evaluations;
+  long bypassed_evaluations;
+};
+
+// Called for t = 0 and every accepted time point; x is only valid during the
+// call
+typedef void (*TransientCallback)(void* user, double t, const double* x,
+                                  int num_vars);
+
+// Fill opts with the default settings for a run to tstop
+void TransientOptionsInit(TransientOptions* opts, double tstep, double tstop);
+
+// Run a transient analysis. ws may be nullptr to use the circuit's default
+// workspace. x (length num_vars) receives the solution at tstop; stats may
+// be nullptr. Device transient state is advanced in place.
+// Returns the number of accepted time steps, or -1 on error.
+int CircuitTransientAnalysis(Circuit* c, SimWorkspace* ws,
+                             const TransientOptions* opts, double* x,
+                             TransientCallback cb, void* user,
+                             TransientStats* stats);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_TRANSIENT_H_
@@ -0,0 +1,388 @@
+// transient_test.cc
+// Unit tests for the adaptive transient analysis
+
+#include "transient.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+#include "device.h"
+#include "parser.h"
+#include "workspace.h"
+
+using namespace minispice;
+
+// Accepted time points and the value of one variable
+struct Trace {
+  int var = 0;
+  std::vector<double> t;
+  std::vector<double> v;
+};
+
+static void RecordTrace(void* user, double t, const double* x, int num_vars) {
+  Trace* tr = static_cast<Trace*>(user);
+  ASSERT_LT(tr->var, num_vars);
+  tr->t.push_back(t);
+  tr->v.push_back(x[tr->var]);
+}
+
+// RC low-pass driven by a 1V step at t = 1us (tau = 1us)
+static const char* kRcNetlist =
+    "V1 in 0 PULSE(0 1 1u 1n 1n 1 0)\nR1 in out 1k\nC1 out 0 1n\n";
+
+// Exact response to the 1ns ramp followed by the step (tau = 1us)
+static double RcResponse(double t) {
+  const double tau = 1e-6, t0 = 1e-6, tr = 1e-9;
+  if (t <= t0) return 0.0;
+  auto ramp = [&](double s) {
+    // Response to a unit-slope ramp starting at 0
+    return s - tau * (1.0 - std::exp(-s / tau));
+  };
+  return (ramp(t - t0) - ramp(std::fmax(t - t0 - tr, 0.0))) / tr;
+}
+
+TEST(PulseTest, ValueAndBreakpoints) {
+  PulseWaveform p = {0.0, 5.0, 1.0, 0.5, 0.5, 2.0, 10.0};
+  EXPECT_DOUBLE_EQ(PulseWaveformValue(&p, 0.5), 0.0);
+  EXPECT_DOUBLE_EQ(PulseWaveformValue(&p, 1.25), 2.5);
+  EXPECT_DOUBLE_EQ(PulseWaveformValue(&p, 2.0), 5.0);
+  EXPECT_DOUBLE_EQ(PulseWaveformValue(&p, 3.75), 2.5);
+  EXPECT_DOUBLE_EQ(PulseWaveformValue(&p, 5.0), 0.0);
+  EXPECT_DOUBLE_EQ(PulseWaveformValue(&p, 12.0), 5.0);  // Second period
+
+  EXPECT_DOUBLE_EQ(PulseWaveformNextBreakpoint(&p, 0.0), 1.0);
+  EXPECT_DOUBLE_EQ(PulseWaveformNextBreakpoint(&p, 1.0), 1.5);
+  EXPECT_DOUBLE_EQ(PulseWaveformNextBreakpoint(&p, 1.5), 3.5);
+  EXPECT_DOUBLE_EQ(PulseWaveformNextBreakpoint(&p, 3.5), 4.0);
+  EXPECT_DOUBLE_EQ(PulseWaveformNextBreakpoint(&p, 4.0), 11.0);
+
+  p.per = 0.0;
+  EXPECT_TRUE(std::isinf(PulseWaveformNextBreakpoint(&p, 4.0)));
+}
+
+TEST(PulseTest, BreakpointsAdvanceAtInexactPeriodBoundaries) {
+  // per = 0.1 is not exact in binary: period boundaries such as 0.5 + 0.1
+  // round below td + k * per, and must still give a later breakpoint
+  PulseWaveform p = {0.0, 1.0, 0.0, 0.01, 0.01, 0.02, 0.1};
+  for (int k = 1; k < 100; k++) {
+    double starts[2] = {k * 0.1, (k - 1) * 0.1 + 0.1};
+    for (double t : starts) {
+      double b = PulseWaveformNextBreakpoint(&p, t);
+      EXPECT_GT(b, t) << "t = " << t;
+      EXPECT_LT(b, t + 0.1) << "t = " << t;
+    }
+  }
+
+  // Walking the breakpoints visits four per period
+  double t = 0.0;
+  int count = 0;
+  while (t < 1.0 && count < 1000) {
+    t = PulseWaveformNextBreakpoint(&p, t);
+    count++;
+  }
+  EXPECT_EQ(count, 40);
+}
+
+TEST(TransientTest, PeriodicPulseWithInexactPeriodFinishes) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 PULSE(0 1 0 0.01 0.01 0.02 0.1)\nR1 in out 1k\n"
+      "C1 out 0 1u\n");
+  ASSERT_NE(c, nullptr);
+
+  Trace tr;
+  tr.var = c->nodes[CircuitGetNode(c, "out")].var_index;
+  TransientOptions opts;
+  TransientOptionsInit(&opts, 0.01, 1.0);
+  std::vector<double> x(c->num_vars);
+  ASSERT_GT(CircuitTransientAnalysis(c, nullptr, &opts, x.data(), RecordTrace,
+                                     &tr, nullptr),
+            0);
+  EXPECT_NEAR(tr.t.back(), 1.0, 1e-12);
+
+  // Every period's rising edge is a time point
+  for (int k = 1; k < 10; k++) {
+    bool hit = false;
+    for (double t : tr.t) hit |= std::fabs(t - 0.1 * k) < 1e-12;
+    EXPECT_TRUE(hit) << "period " << k;
+  }
+
+  circuit_free(c);
+}
+
+TEST(TransientTest, TranDirectiveAndPulseSource) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 PULSE(0 1 1u 1n 1n 10u 20u)\nI1 0 in DC 1m\nR1 in 0 1k\n"
+      ".tran 0.1u 50u 0 1u\n");
+  ASSERT_NE(c, nullptr);
+
+  EXPECT_DOUBLE_EQ(c->tran.tstep, 0.1e-6);
+  EXPECT_DOUBLE_EQ(c->tran.tstop, 50e-6);
+  EXPECT_DOUBLE_EQ(c->tran.tmax, 1e-6);
+
+  double v = -1.0;
+  ASSERT_EQ(DeviceGetValue(CircuitFindDevice(c, "V1"), &v), 0);
+  EXPECT_DOUBLE_EQ(v, 0.0);  // DC value is v1
+  ASSERT_EQ(DeviceGetValue(CircuitFindDevice(c, "I1"), &v), 0);
+  EXPECT_DOUBLE_EQ(v, 1e-3);
+
+  circuit_free(c);
+}
+
+TEST(TransientTest, RcStepResponseTracksExactSolution) {
+  Circuit* c = parse_netlist_string(kRcNetlist);
+  ASSERT_NE(c, nullptr);
+
+  Trace tr;
+  tr.var = c->nodes[CircuitGetNode(c, "out")].var_index;
+
+  TransientOptions opts;
+  TransientOptionsInit(&opts, 0.1e-6, 10e-6);
+  opts.lte_reltol = 1e-5;
+  std::vector<double> x(c->num_vars);
+  TransientStats stats;
+  int steps =
+      CircuitTransientAnalysis(c, nullptr, &opts, x.data(), RecordTrace, &tr,
+                               &stats);
+  ASSERT_GT(steps, 0);
+  EXPECT_EQ(stats.accepted_steps, steps);
+  EXPECT_EQ((int)tr.t.size(), steps + 1);  // Plus t = 0
+
+  // Lands on the breakpoints and ends exactly at tstop
+  bool hit_edge = false;
+  for (double t : tr.t) hit_edge |= std::fabs(t - 1e-6) < 1e-15;
+  EXPECT_TRUE(hit_edge);
+  EXPECT_NEAR(tr.t.back(), 10e-6, 1e-15);
+
+  // The first step after each breakpoint is Backward Euler without an error
+  // estimate; its error over the 1ns ramp bounds the global error
+  for (size_t k = 0; k < tr.t.size(); k++) {
+    EXPECT_NEAR(tr.v[k], RcResponse(tr.t[k]), 1e-3) << "t = " << tr.t[k];
+  }
+  EXPECT_NEAR(x[tr.var], RcResponse(10e-6), 1e-4);
+
+  circuit_free(c);
+}
+
+TEST(TransientTest, StepControlAdaptsToTolerance) {
+  // Tighter LTE tolerance takes more steps and gets closer to the exact
+  // response; long flat stretches use few steps compared to a fixed tstep
+  double errors[2];
+  int steps[2];
+  const double reltol[2] = {1e-3, 1e-5};
+  for (int run = 0; run < 2; run++) {
+    Circuit* c = parse_netlist_string(kRcNetlist);
+    ASSERT_NE(c, nullptr);
+    Trace tr;
+    tr.var = c->nodes[CircuitGetNode(c, "out")].var_index;
+
+    TransientOptions opts;
+    TransientOptionsInit(&opts, 1e-9, 20e-6);
+    opts.lte_reltol = reltol[run];
+    std::vector<double> x(c->num_vars);
+    steps[run] = CircuitTransientAnalysis(c, nullptr, &opts, x.data(),
+                                          RecordTrace, &tr, nullptr);
+    ASSERT_GT(steps[run], 0);
+
+    errors[run] = 0.0;
+    for (size_t k = 0; k < tr.t.size(); k++) {
+      errors[run] =
+          std::fmax(errors[run], std::fabs(tr.v[k] - RcResponse(tr.t[k])));
+    }
+    circuit_free(c);
+  }
+
+  EXPECT_LT(steps[0], steps[1]);
+  EXPECT_LT(errors[1], errors[0]);
+  EXPECT_LT(errors[0], 1e-2);
+  // A fixed 1ns step would need 20000 steps
+  EXPECT_LT(steps[1], 2000);
+}
+
+TEST(TransientTest, Gear2AndBackwardEuler) {
+  int steps[2];
+  const IntegrationMethod* methods[2] = {&kGear2, &kBackwardEuler};
+  for (int run = 0; run < 2; run++) {
+    const IntegrationMethod* im = methods[run];
+    Circuit* c = parse_netlist_string(kRcNetlist);
+    ASSERT_NE(c, nullptr);
+    Trace tr;
+    tr.var = c->nodes[CircuitGetNode(c, "out")].var_index;
+
+    TransientOptions opts;
+    TransientOptionsInit(&opts, 0.1e-6, 10e-6);
+    opts.method = im;
+    opts.lte_reltol = 1e-5;
+    std::vector<double> x(c->num_vars);
+    steps[run] = CircuitTransientAnalysis(c, nullptr, &opts, x.data(),
+                                          RecordTrace, &tr, nullptr);
+    ASSERT_GT(steps[run], 0) << im->name;
+    // First-order error accumulates over the run
+    double max_error = run == 0 ? 1e-3 : 5e-3;
+    for (size_t k = 0; k < tr.t.size(); k++) {
+      EXPECT_NEAR(tr.v[k], RcResponse(tr.t[k]), max_error) << im->name;
+    }
+    circuit_free(c);
+  }
+  // Backward Euler needs smaller steps for the same LTE
+  EXPECT_GT(steps[1], steps[0]);
+}
+
+TEST(TransientTest, RlCurrentRise) {
+  // i(t) = V/R * (1 - exp(-t R / L)) after the source steps at t = 0+
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 PULSE(0 1 0 1n 1n 1 0)\nR1 in a 100\nL1 a 0 1m\n");
+  ASSERT_NE(c, nullptr);
+
+  Device* l1 = CircuitFindDevice(c, "L1");
+  ASSERT_NE(l1, nullptr);
+  Trace tr;
+  tr.var = l1->extra_var;
+
+  TransientOptions opts;
+  TransientOptionsInit(&opts, 0.1e-6, 50e-6);
+  opts.lte_reltol = 1e-5;
+  std::vector<double> x(c->num_vars);
+  ASSERT_GT(CircuitTransientAnalysis(c, nullptr, &opts, x.data(), RecordTrace,
+                                     &tr, nullptr),
+            0);
+
+  const double tau = 1e-3 / 100.0;
+  for (size_t k = 0; k < tr.t.size(); k++) {
+    double t = tr.t[k];
+    if (t < 10e-9) continue;  // Source ramp
+    double expected = 0.01 * (1.0 - std::exp(-(t - 0.5e-9) / tau));
+    EXPECT_NEAR(tr.v[k], expected, 1e-5) << "t = " << t;
+  }
+
+  circuit_free(c);
+}
+
+TEST(TransientTest, DiodeRectifierConverges) {
+  // Half-wave rectifier with a pulse train: exercises Newton per step and
+  // repeated breakpoints
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 PULSE(-2 2 0 1u 1u 4u 10u)\nD1 in out\nR1 out 0 1k\n"
+      "C1 out 0 10n\n");
+  ASSERT_NE(c, nullptr);
+
+  TransientOptions opts;
+  TransientOptionsInit(&opts, 0.1e-6, 50e-6);
+  std::vector<double> x(c->num_vars);
+  TransientStats stats;
+  int steps = CircuitTransientAnalysis(c, nullptr, &opts, x.data(), nullptr,
+                                       nullptr, &stats);
+  ASSERT_GT(steps, 0);
+  EXPECT_GT(stats.newton_iterations, steps);
+
+  // Output stays between ground and the peak input minus a diode drop
+  double vout = x[c->nodes[CircuitGetNode(c, "out")].var_index];
+  EXPECT_GT(vout, 0.0);
+  EXPECT_LT(vout, 2.0);
+
+  circuit_free(c);
+}
+
+TEST(TransientTest, MosfetInverterConverges) {
+  // Resistor-loaded inverter driving a MOSFET gate: exercises the charge
+  // stamps and their history across gate transitions. The channel charge
+  // switches on with a capacitance step at threshold, so the run uses Gear2
+  // (trapezoidal rings at nodes whose only capacitance is channel charge).
+  Circuit* c = parse_netlist_string(
+      "VDD vdd 0 2\nV1 src 0 PULSE(0 2 1n 1n 1n 10n 20n)\nRG src in 1k\n"
+      "R1 vdd out 10k\nM1 out in 0 0 W=10u L=1u\nM2 0 out 0 0 W=100u L=10u\n");
+  ASSERT_NE(c, nullptr);
+
+  TransientOptions opts;
+  TransientOptionsInit(&opts, 0.1e-9, 10e-9);
+  opts.method = &kGear2;
+  Trace tr;
+  tr.var = c->nodes[CircuitGetNode(c, "out")].var_index;
+  std::vector<double> x(c->num_vars);
+  TransientStats stats;
+  int steps = CircuitTransientAnalysis(c, nullptr, &opts, x.data(),
+                                       RecordTrace, &tr, &stats);
+  ASSERT_GT(steps, 0);
+
+  // Output starts high and is pulled low once the input switches
+  ASSERT_FALSE(tr.v.empty());
+  EXPECT_NEAR(tr.v.front(), 2.0, 1e-6);
+  EXPECT_LT(x[tr.var], 0.5);
+  EXPECT_GT(x[tr.var], 0.0);
+
+  circuit_free(c);
+}
+
+TEST(TransientTest, BypassMatchesFullEvaluation) {
+  // The inverter of MosfetInverterConverges next to a biased diode string
+  // that stays at its operating point: its devices are bypassed
+  const char* netlist =
+      "VDD vdd 0 2\nV1 src 0 PULSE(0 2 1n 1n 1n 10n 20n)\nRG src in 1k\n"
+      "R1 vdd out 10k\nM1 out in 0 0 W=10u L=1u\nM2 0 out 0 0 W=100u L=10u\n"
+      "R2 vdd a 1k\nD1 a b\nD2 b 0\nM3 a a 0 0\n";
+  TransientOptions opts;
+  TransientOptionsInit(&opts, 0.1e-9, 10e-9);
+  opts.method = &kGear2;
+
+  std::vector<double> x[2];
+  TransientStats stats[2];
+  for (int bypass = 0; bypass < 2; bypass++) {
+    Circuit* c = parse_netlist_string(netlist);
+    ASSERT_NE(c, nullptr);
+    c->newton.bypass = bypass;
+    x[bypass].resize(c->num_vars);
+    ASSERT_GT(CircuitTransientAnalysis(c, nullptr, &opts, x[bypass].data(),
+                                       nullptr, nullptr, &stats[bypass]),
+              0);
+    EXPECT_EQ(c->workspace->eval_counts.evaluations,
+              stats[bypass].device_evaluations);
+    circuit_free(c);
+  }
+  EXPECT_EQ(stats[0].bypassed_evaluations, 0);
+  EXPECT_GT(stats[1].bypassed_evaluations, stats[1].device_evaluations / 4);
+  EXPECT_LT(stats[1].device_evaluations, stats[0].device_evaluations);
+  for (size_t i = 0; i < x[0].size(); i++) {
+    EXPECT_NEAR(x[1][i], x[0][i], 1e-5 * std::fabs(x[0][i]) + 1e-9) << i;
+  }
+}
+
+TEST(TransientTest, InvalidOptions) {
+  Circuit* c = parse_netlist_string(kRcNetlist);
+  ASSERT_NE(c, nullptr);
+
+  TransientOptions opts;
+  TransientOptionsInit(&opts, 0.0, 1e-6);
+  std::vector<double> x(c->num_vars);
+  EXPECT_EQ(CircuitTransientAnalysis(c, nullptr, &opts, x.data(), nullptr,
+                                     nullptr, nullptr),
+            -1);
+
+  circuit_free(c);
+}
+
+TEST(TransientTest, LinearCircuitReusesFactorization) {
+  Circuit* c = parse_netlist_string(kRcNetlist);
+  ASSERT_NE(c, nullptr);
+  ASSERT_EQ(c->is_linear, 1);
+
+  SimWorkspace* ws = SimWorkspaceCreate(c);
+  ASSERT_NE(ws, nullptr);
+
+  TransientOptions opts;
+  TransientOptionsInit(&opts, 0.1e-6, 100e-6);
+  opts.tmax = 0.5e-6;
+  std::vector<double> x(c->num_vars);
+  TransientStats stats;
+  int steps = CircuitTransientAnalysis(c, ws, &opts, x.data(), nullptr,
+                                       nullptr, &stats);
+  ASSERT_GT(steps, 150);
+  EXPECT_NEAR(x[c->nodes[CircuitGetNode(c, "out")].var_index], 1.0, 1e-3);
+
+  // One Newton iteration per step, and steps at tmax share one factorization
+  EXPECT_EQ(stats.newton_iterations, steps);
+  EXPECT_LT(ws->num_factorizations, steps / 4);
+
+  SimWorkspaceFree(ws);
+  circuit_free(c);
+}
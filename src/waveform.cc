@@ -0,0 +1,771 @@
+// Waveform writer implementation
+//
+// The writer thread owns the encoding and the file writes; the analysis
+// thread only fills buffers. Buffers change hands under one mutex: the
+// analysis hands over a full buffer once the thread has finished the
+// previous one, so at most one buffer is in flight while the other fills.
+//
+
+#include "waveform.h"
+
+#include <strings.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "circuit.h"
+#include "device.h"
+
+namespace minispice {
+
+namespace {
+
+// ============================================================================
+// Chunked Layout
+// ============================================================================
+
+// Plot signature; a chunk starts with kChunkTag instead
+constexpr char kWaveformMagic[8] = {'M', 'S', 'P', 'W', 'A', 'V', 'E', '\0'};
+constexpr uint32_t kChunkTag = 0x4B4E4843u;  // "CHNK"
+
+// Written in host byte order; reads back differently on the other order
+constexpr uint32_t kByteOrderMark = 0x01020304u;
+
+constexpr uint32_t kFlagFloat32 = 1u;
+constexpr uint32_t kFlagCompress = 2u;
+
+// Start of every plot, followed by num_vars names of kWaveformNameLen bytes
+struct WaveformHeader {
+  char magic[8];        // kWaveformMagic
+  uint32_t version;     // kWaveformVersion
+  uint32_t byte_order;  // kByteOrderMark
+  uint32_t flags;       // kFlagFloat32 | kFlagCompress
+  int32_t num_vars;
+  char plot_name[kWaveformNameLen];
+};
+
+// Start of every chunk, followed by the uint64 byte sizes of the num_vars
+// columns and then the columns
+struct ChunkHeader {
+  uint32_t tag;  // kChunkTag
+  uint32_t num_points;
+};
+
+// 1 if column v is stored as float
+inline int ColumnIsFloat(uint32_t flags, int v) {
+  return v > 0 && (flags & kFlagFloat32);
+}
+
+// ============================================================================
+// XOR Compression
+// ============================================================================
+
+// MSB-first bit packing into a byte vector
+struct BitWriter {
+  std::vector<uint8_t>* out;
+  uint64_t acc;
+  int num_bits;  // Bits pending in acc (< 8 between calls)
+};
+
+// Append the low bits of value (bits <= 32)
+inline void PutBits32(BitWriter* b, uint64_t value, int bits) {
+  b->acc = (b->acc << bits) | (value & ((1ull << bits) - 1));
+  b->num_bits += bits;
+  while (b->num_bits >= 8) {
+    b->num_bits -= 8;
+    b->out->push_back((uint8_t)(b->acc >> b->num_bits));
+  }
+  b->acc &= (1ull << b->num_bits) - 1;
+}
+
+// Append the low bits of value (bits <= 64)
+inline void PutBits(BitWriter* b, uint64_t value, int bits) {
+  if (bits > 32) {
+    PutBits32(b, value >> 32, bits - 32);
+    bits = 32;
+  }
+  if (bits > 0) PutBits32(b, value, bits);
+}
+
+inline void FlushBits(BitWriter* b) {
+  if (b->num_bits > 0) PutBits32(b, 0, 8 - b->num_bits);
+}
+
+struct BitReader {
+  const uint8_t* data;
+  size_t size;
+  size_t pos;  // In bits
+};
+
+// Read bits (<= 64) MSB-first. Returns false past the end of the data.
+inline bool GetBits(BitReader* b, int bits, uint64_t* value) {
+  if (bits > (int64_t)(b->size * 8 - b->pos)) return false;
+  uint64_t v = 0;
+  for (int k = 0; k < bits; k++, b->pos++) {
+    v = (v << 1) | ((b->data[b->pos >> 3] >> (7 - (b->pos & 7))) & 1u);
+  }
+  *value = v;
+  return true;
+}
+
+// Bits of the value predicted for words[i] (i >= 1) of width bits (double
+// for 64, float for 32): the linear extrapolation 2 w[i-1] - w[i-2], or
+// w[i-1] for the second word. Encoder and decoder compute it alike, so any
+// rounding cancels out.
+inline uint64_t PredictWord(const uint64_t* words, int i, int width) {
+  if (i < 2) return words[i - 1];
+  if (width == 64) {
+    double a, b;
+    memcpy(&a, &words[i - 1], sizeof(a));
+    memcpy(&b, &words[i - 2], sizeof(b));
+    double p = 2.0 * a - b;
+    uint64_t u;
+    memcpy(&u, &p, sizeof(u));
+    return u;
+  }
+  uint32_t ua = (uint32_t)words[i - 1], ub = (uint32_t)words[i - 2];
+  float a, b;
+  memcpy(&a, &ua, sizeof(a));
+  memcpy(&b, &ub, sizeof(b));
+  float p = 2.0f * a - b;
+  uint32_t u;
+  memcpy(&u, &p, sizeof(u));
+  return u;
+}
+
+// Compress n words of width bits (64 or 32): the first verbatim, then per
+// word the XOR with its prediction as
+//   0                         equal to the prediction
+//   10 <bits>                 within the previous window of meaningful bits
+//   11 <lead:6> <len-1:6> <bits>  new window
+void CompressWords(const uint64_t* words, int n, int width,
+                   std::vector<uint8_t>* out) {
+  BitWriter b = {out, 0, 0};
+  if (n <= 0) return;
+  PutBits(&b, words[0], width);
+  int lead = -1;
+  int trail = 0;
+  for (int i = 1; i < n; i++) {
+    uint64_t x = words[i] ^ PredictWord(words, i, width);
+    if (x == 0) {
+      PutBits(&b, 0, 1);
+      continue;
+    }
+    int lz = __builtin_clzll(x) - (64 - width);
+    int tz = __builtin_ctzll(x);
+    if (lead >= 0 && lz >= lead && tz >= trail) {
+      PutBits(&b, 2, 2);
+      PutBits(&b, x >> trail, width - lead - trail);
+    } else {
+      int len = width - lz - tz;
+      PutBits(&b, 3, 2);
+      PutBits(&b, lz, 6);
+      PutBits(&b, len - 1, 6);
+      PutBits(&b, x >> tz, len);
+      lead = lz;
+      trail = tz;
+    }
+  }
+  FlushBits(&b);
+}
+
+// Inverse of CompressWords. Returns false on malformed data.
+bool DecompressWords(const uint8_t* data, size_t size, int n, int width,
+                     uint64_t* words) {
+  BitReader b = {data, size, 0};
+  if (n <= 0) return true;
+  if (!GetBits(&b, width, &words[0])) return false;
+  int lead = -1;
+  int trail = 0;
+  for (int i = 1; i < n; i++) {
+    uint64_t bit, x;
+    if (!GetBits(&b, 1, &bit)) return false;
+    if (bit == 0) {
+      words[i] = PredictWord(words, i, width);
+      continue;
+    }
+    if (!GetBits(&b, 1, &bit)) return false;
+    if (bit == 1) {
+      uint64_t lz, len;
+      if (!GetBits(&b, 6, &lz) || !GetBits(&b, 6, &len)) return false;
+      lead = (int)lz;
+      trail = width - lead - (int)len - 1;
+      if (trail < 0) return false;
+    } else if (lead < 0) {
+      return false;
+    }
+    if (!GetBits(&b, width - lead - trail, &x)) return false;
+    words[i] = PredictWord(words, i, width) ^ (x << trail);
+  }
+  return true;
+}
+
+// ============================================================================
+// Writer
+// ============================================================================
+
+// Points of every variable, column-major: columns[v * capacity + p]
+struct WaveformBuffer {
+  std::vector<double> columns;
+  int num_points = 0;
+};
+
+}  // namespace
+
+struct WaveformWriter {
+  FILE* f = nullptr;
+  WaveformOptions opts;
+  int num_vars = 0;
+  long num_points = 0;
+  long points_field = -1;  // Raw: file offset of the "No. Points:" value
+
+  WaveformBuffer buffers[2];
+  int active = 0;  // Buffer filled by WaveformWriterAppend
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;  // Signals a handed-over buffer or its write
+  int pending = -1;            // Buffer being written, -1 if none
+  bool stop = false;
+  bool failed = false;
+  bool dropping = false;  // A submit failed: Append drops every later point
+
+  // Encoding scratch of the writer thread
+  std::vector<uint8_t> bytes;
+  std::vector<uint64_t> words;
+  std::vector<double> rows;
+};
+
+namespace {
+
+// Append a chunk with the points of buf
+bool WriteChunk(WaveformWriter* w, const WaveformBuffer* buf) {
+  int n = buf->num_points;
+  int cap = w->opts.chunk_points;
+  uint32_t flags = (w->opts.float32 ? kFlagFloat32 : 0) |
+                   (w->opts.compress ? kFlagCompress : 0);
+
+  // Encode every column back to back, recording the sizes
+  std::vector<uint64_t> sizes(w->num_vars);
+  w->bytes.clear();
+  w->words.resize(n);
+  for (int v = 0; v < w->num_vars; v++) {
+    const double* col = buf->columns.data() + (size_t)v * cap;
+    size_t start = w->bytes.size();
+    int is_float = ColumnIsFloat(flags, v);
+    if (!w->opts.compress) {
+      size_t width = is_float ? sizeof(float) : sizeof(double);
+      w->bytes.resize(start + n * width);
+      uint8_t* p = w->bytes.data() + start;
+      for (int i = 0; i < n; i++, p += width) {
+        if (is_float) {
+          float x = (float)col[i];
+          memcpy(p, &x, sizeof(x));
+        } else {
+          memcpy(p, &col[i], sizeof(double));
+        }
+      }
+    } else {
+      for (int i = 0; i < n; i++) {
+        if (is_float) {
+          float x = (float)col[i];
+          uint32_t u;
+          memcpy(&u, &x, sizeof(u));
+          w->words[i] = u;
+        } else {
+          memcpy(&w->words[i], &col[i], sizeof(double));
+        }
+      }
+      CompressWords(w->words.data(), n, is_float ? 32 : 64, &w->bytes);
+    }
+    sizes[v] = w->bytes.size() - start;
+  }
+
+  ChunkHeader h = {kChunkTag, (uint32_t)n};
+  return fwrite(&h, sizeof(h), 1, w->f) == 1 &&
+         fwrite(sizes.data(), sizeof(uint64_t), sizes.size(), w->f) ==
+             sizes.size() &&
+         fwrite(w->bytes.data(), 1, w->bytes.size(), w->f) == w->bytes.size();
+}
+
+// Append the points of buf as raw rows of doubles
+bool WriteRawRows(WaveformWriter* w, const WaveformBuffer* buf) {
+  int n = buf->num_points;
+  int cap = w->opts.chunk_points;
+  w->rows.resize((size_t)n * w->num_vars);
+  for (int v = 0; v < w->num_vars; v++) {
+    const double* col = buf->columns.data() + (size_t)v * cap;
+    for (int i = 0; i < n; i++) w->rows[(size_t)i * w->num_vars + v] = col[i];
+  }
+  return fwrite(w->rows.data(), sizeof(double), w->rows.size(), w->f) ==
+         w->rows.size();
+}
+
+// Writer thread: write every handed-over buffer until stopped
+void WriterLoop(WaveformWriter* w) {
+  std::unique_lock<std::mutex> lock(w->mutex);
+  for (;;) {
+    w->cv.wait(lock, [w] { return w->pending >= 0 || w->stop; });
+    if (w->pending < 0) return;
+
+    const WaveformBuffer* buf = &w->buffers[w->pending];
+    bool ok = !w->failed;
+    lock.unlock();
+    if (ok) {
+      ok = w->opts.format == kWaveformRaw ? WriteRawRows(w, buf)
+                                          : WriteChunk(w, buf);
+    }
+    lock.lock();
+    if (!ok) w->failed = true;
+    w->pending = -1;
+    w->cv.notify_all();
+  }
+}
+
+// Hand the active buffer to the writer thread and switch to the other one
+// (waiting for its write to finish).
+// Returns 0 on success, -1 if a write has failed (the active buffer is
+// emptied and its points are lost).
+int SubmitBuffer(WaveformWriter* w) {
+  std::unique_lock<std::mutex> lock(w->mutex);
+  w->cv.wait(lock, [w] { return w->pending < 0; });
+  if (w->failed) {
+    w->buffers[w->active].num_points = 0;
+    w->dropping = true;
+    return -1;
+  }
+  w->pending = w->active;
+  w->cv.notify_all();
+  w->active ^= 1;
+  w->buffers[w->active].num_points = 0;
+  return 0;
+}
+
+// SPICE raw type of a variable, from its name
+const char* RawVariableType(const char* name, int index) {
+  if (index == 0 && strcasecmp(name, "time") == 0) return "time";
+  if (name[0] == 'I' || name[0] == 'i') return "current";
+  return "voltage";
+}
+
+bool WriteRawHeader(WaveformWriter* w, const char* plot_name,
+                    const char* const* names) {
+  time_t now = time(nullptr);
+  char date[64];
+  strftime(date, sizeof(date), "%a %b %d %H:%M:%S %Y", localtime(&now));
+  fprintf(w->f, "Title: mini-spice\nDate: %s\nPlotname: %s\n", date,
+          plot_name);
+  fprintf(w->f, "Flags: real\nNo. Variables: %d\nNo. Points: ", w->num_vars);
+  w->points_field = ftell(w->f);
+  fprintf(w->f, "%-20d\nVariables:\n", 0);
+  for (int v = 0; v < w->num_vars; v++) {
+    fprintf(w->f, "\t%d\t%s\t%s\n", v, names[v], RawVariableType(names[v], v));
+  }
+  fprintf(w->f, "Binary:\n");
+  return !ferror(w->f);
+}
+
+bool WriteChunkedHeader(WaveformWriter* w, const char* plot_name,
+                        const char* const* names) {
+  WaveformHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, kWaveformMagic, sizeof(h.magic));
+  h.version = kWaveformVersion;
+  h.byte_order = kByteOrderMark;
+  h.flags = (w->opts.float32 ? kFlagFloat32 : 0) |
+            (w->opts.compress ? kFlagCompress : 0);
+  h.num_vars = w->num_vars;
+  strncpy(h.plot_name, plot_name, sizeof(h.plot_name) - 1);
+  if (fwrite(&h, sizeof(h), 1, w->f) != 1) return false;
+  for (int v = 0; v < w->num_vars; v++) {
+    char name[kWaveformNameLen] = {};
+    strncpy(name, names[v], sizeof(name) - 1);
+    if (fwrite(name, sizeof(name), 1, w->f) != 1) return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+// ============================================================================
+// Writer API Implementation
+// ============================================================================
+
+void WaveformOptionsInit(WaveformOptions* opts) {
+  if (!opts) return;
+  opts->format = kWaveformChunked;
+  opts->float32 = 0;
+  opts->compress = 0;
+  opts->chunk_points = kWaveformChunkPoints;
+  opts->append = 0;
+}
+
+WaveformWriter* WaveformWriterOpen(const char* path, const char* plot_name,
+                                   int num_vars, const char* const* names,
+                                   const WaveformOptions* opts) {
+  if (!path || !plot_name || num_vars < 1 || !names) return nullptr;
+  if (strlen(plot_name) >= (size_t)kWaveformNameLen) return nullptr;
+  for (int v = 0; v < num_vars; v++) {
+    if (!names[v] || !names[v][0] ||
+        strlen(names[v]) >= (size_t)kWaveformNameLen) {
+      return nullptr;
+    }
+  }
+
+  WaveformWriter* w = new WaveformWriter;
+  if (opts) {
+    w->opts = *opts;
+  } else {
+    WaveformOptionsInit(&w->opts);
+  }
+  if (w->opts.chunk_points <= 0) w->opts.chunk_points = kWaveformChunkPoints;
+  if (w->opts.format == kWaveformRaw) {
+    w->opts.float32 = 0;
+    w->opts.compress = 0;
+  }
+  w->num_vars = num_vars;
+
+  // Raw files are opened for update to patch the point count on close
+  if (w->opts.append) {
+    w->f = fopen(path, "r+b");
+    if (w->f && fseek(w->f, 0, SEEK_END) != 0) {
+      fclose(w->f);
+      w->f = nullptr;
+    }
+  }
+  if (!w->f) w->f = fopen(path, "w+b");
+  if (!w->f) {
+    fprintf(stderr, "Waveform error: Cannot create file: %s\n", path);
+    delete w;
+    return nullptr;
+  }
+
+  bool ok = w->opts.format == kWaveformRaw
+                ? WriteRawHeader(w, plot_name, names)
+                : WriteChunkedHeader(w, plot_name, names);
+  if (!ok) {
+    fprintf(stderr, "Waveform error: Cannot write file: %s\n", path);
+    fclose(w->f);
+    delete w;
+    return nullptr;
+  }
+
+  size_t size = (size_t)num_vars * w->opts.chunk_points;
+  w->buffers[0].columns.resize(size);
+  w->buffers[1].columns.resize(size);
+  w->thread = std::thread(WriterLoop, w);
+  return w;
+}
+
+int WaveformWriterAppend(WaveformWriter* w, const double* values) {
+  if (!w || !values || w->dropping) return -1;
+  WaveformBuffer* buf = &w->buffers[w->active];
+  int cap = w->opts.chunk_points;
+  for (int v = 0; v < w->num_vars; v++) {
+    buf->columns[(size_t)v * cap + buf->num_points] = values[v];
+  }
+  buf->num_points++;
+  w->num_points++;
+  if (buf->num_points == cap) return SubmitBuffer(w);
+  return 0;
+}
+
+long WaveformWriterNumPoints(const WaveformWriter* w) {
+  return w ? w->num_points : 0;
+}
+
+int WaveformWriterClose(WaveformWriter* w) {
+  if (!w) return -1;
+  int result = w->dropping ? -1 : 0;
+  if (w->buffers[w->active].num_points > 0 && SubmitBuffer(w) != 0) {
+    result = -1;
+  }
+  {
+    std::unique_lock<std::mutex> lock(w->mutex);
+    w->cv.wait(lock, [w] { return w->pending < 0; });
+    if (w->failed) result = -1;
+    w->stop = true;
+    w->cv.notify_all();
+  }
+  w->thread.join();
+
+  if (w->opts.format == kWaveformRaw && result == 0) {
+    // The field was written as 20 padded characters
+    if (fseek(w->f, w->points_field, SEEK_SET) != 0 ||
+        fprintf(w->f, "%-20ld", w->num_points) != 20) {
+      result = -1;
+    }
+  }
+  if (fclose(w->f) != 0) result = -1;
+  delete w;
+  return result;
+}
+
+// ============================================================================
+// Selection
+// ============================================================================
+
+void WaveformSelectionRelease(WaveformSelection* sel) {
+  if (!sel) return;
+  for (int i = 0; sel->names && i < sel->num_vars; i++) free(sel->names[i]);
+  free(sel->var_index);
+  free(sel->names);
+  sel->var_index = nullptr;
+  sel->names = nullptr;
+  sel->num_vars = 0;
+}
+
+// Add variable var named prefix(name) to sel (capacity checked by callers).
+// Returns 0 on success, -1 on allocation failure.
+static int SelectVar(WaveformSelection* sel, char prefix, const char* name,
+                     int var) {
+  size_t size = strlen(name) + 4;
+  char* label = (char*)malloc(size);
+  if (!label) return -1;
+  snprintf(label, size, "%c(%s)", prefix, name);
+  sel->names[sel->num_vars] = label;
+  sel->var_index[sel->num_vars++] = var;
+  return 0;
+}
+
+// Select one "V(node)" or "I(device)" of len bytes.
+// Returns 0 on success, -1 for an unknown name.
+static int SelectByName(Circuit* c, const char* spec, size_t len,
+                        WaveformSelection* sel) {
+  char kind = spec[0] == 'v' ? 'V' : spec[0] == 'i' ? 'I' : spec[0];
+  if (len < 4 || (kind != 'V' && kind != 'I') || spec[1] != '(' ||
+      spec[len - 1] != ')') {
+    return -1;
+  }
+  std::string inner(spec + 2, len - 3);
+
+  if (kind == 'V') {
+    int node = CircuitGetNode(c, inner.c_str());
+    int var = node > 0 ? CircuitGetVarIndex(c, node) : -1;
+    if (var < 0) return -1;
+    return SelectVar(sel, 'V', c->nodes[node].name, var);
+  }
+  Device* d = CircuitFindDevice(c, inner.c_str());
+  if (!d || d->extra_var < 0) return -1;
+  return SelectVar(sel, 'I', d->name, d->extra_var);
+}
+
+int CircuitSelectWaveform(Circuit* c, const char* list,
+                          WaveformSelection* sel) {
+  if (!c || !sel || !c->finalized) return -1;
+  sel->num_vars = 0;
+
+  // Capacity: every variable, or one per list entry
+  int capacity = c->num_vars;
+  if (list && list[0]) {
+    capacity = 1;
+    for (const char* p = list; *p; p++) capacity += *p == ',';
+  }
+  sel->var_index = (int*)malloc(capacity * sizeof(int));
+  sel->names = (char**)malloc(capacity * sizeof(char*));
+  if (!sel->var_index || !sel->names) {
+    WaveformSelectionRelease(sel);
+    return -1;
+  }
+
+  if (!list || !list[0]) {
+    int failed = 0;
+    for (int i = 1; !failed && i < c->num_nodes; i++) {
+      failed = SelectVar(sel, 'V', c->nodes[i].name, c->nodes[i].var_index);
+    }
+    for (Device* d = c->devices; !failed && d; d = d->next) {
+      if (d->extra_var >= 0) {
+        failed = SelectVar(sel, 'I', d->name, d->extra_var);
+      }
+    }
+    if (failed) WaveformSelectionRelease(sel);
+    return failed ? -1 : 0;
+  }
+
+  const char* p = list;
+  for (;;) {
+    while (*p == ' ' || *p == '\t') p++;
+    const char* end = strchr(p, ',');
+    if (!end) end = p + strlen(p);
+    const char* last = end;
+    while (last > p && (last[-1] == ' ' || last[-1] == '\t')) last--;
+    if (SelectByName(c, p, last - p, sel) != 0) {
+      fprintf(stderr, "Waveform error: Unknown variable: %.*s\n",
+              (int)(last - p), p);
+      WaveformSelectionRelease(sel);
+      return -1;
+    }
+    if (!*end) break;
+    p = end + 1;
+  }
+  return 0;
+}
+
+// ============================================================================
+// Reader
+// ============================================================================
+
+void WaveformDataRelease(WaveformData* data) {
+  if (!data) return;
+  free(data->names);
+  free(data->values);
+  data->names = nullptr;
+  data->values = nullptr;
+  data->num_vars = 0;
+  data->num_points = 0;
+}
+
+// Decode column v of a chunk of n points from bytes into out
+static bool DecodeColumn(const uint8_t* bytes, uint64_t size, int n,
+                         uint32_t flags, int v, std::vector<uint64_t>* words,
+                         double* out) {
+  int is_float = ColumnIsFloat(flags, v);
+  if (!(flags & kFlagCompress)) {
+    size_t width = is_float ? sizeof(float) : sizeof(double);
+    if (size != n * width) return false;
+    for (int i = 0; i < n; i++, bytes += width) {
+      if (is_float) {
+        float x;
+        memcpy(&x, bytes, sizeof(x));
+        out[i] = x;
+      } else {
+        memcpy(&out[i], bytes, sizeof(double));
+      }
+    }
+    return true;
+  }
+
+  words->resize(n);
+  if (!DecompressWords(bytes, size, n, is_float ? 32 : 64, words->data())) {
+    return false;
+  }
+  for (int i = 0; i < n; i++) {
+    if (is_float) {
+      uint32_t u = (uint32_t)(*words)[i];
+      float x;
+      memcpy(&x, &u, sizeof(x));
+      out[i] = x;
+    } else {
+      memcpy(&out[i], &(*words)[i], sizeof(double));
+    }
+  }
+  return true;
+}
+
+int WaveformReadFile(const char* path, int plot, WaveformData* data) {
+  if (!path || !data || plot < 0) return -1;
+  memset(data, 0, sizeof(*data));
+
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "Waveform error: Cannot open file: %s\n", path);
+    return -1;
+  }
+  std::vector<uint8_t> file;
+  uint8_t block[1 << 16];
+  size_t got;
+  while ((got = fread(block, 1, sizeof(block), f)) > 0) {
+    file.insert(file.end(), block, block + got);
+  }
+  bool read_error = ferror(f) != 0;
+  fclose(f);
+  if (read_error) return -1;
+
+  const uint8_t* base = file.data();
+  size_t size = file.size();
+  size_t pos = 0;
+  std::vector<std::vector<double>> columns;
+  std::vector<uint64_t> words;
+  for (int p = 0;; p++) {
+    WaveformHeader h;
+    if (size - pos < sizeof(h)) break;
+    memcpy(&h, base + pos, sizeof(h));
+    if (memcmp(h.magic, kWaveformMagic, sizeof(h.magic)) != 0 ||
+        h.version != kWaveformVersion || h.byte_order != kByteOrderMark ||
+        h.num_vars < 1 || h.plot_name[kWaveformNameLen - 1] != '\0') {
+      break;
+    }
+    size_t names_size = (size_t)h.num_vars * kWaveformNameLen;
+    if (size - pos - sizeof(h) < names_size) break;
+    const uint8_t* names = base + pos + sizeof(h);
+    pos += sizeof(h) + names_size;
+    if (p == plot) {
+      memcpy(data->plot_name, h.plot_name, sizeof(data->plot_name));
+      data->num_vars = h.num_vars;
+      data->names = (char(*)[kWaveformNameLen])malloc(names_size);
+      if (!data->names) return -1;
+      memcpy(data->names, names, names_size);
+      for (int v = 0; v < h.num_vars; v++) {
+        data->names[v][kWaveformNameLen - 1] = '\0';
+      }
+      columns.resize(h.num_vars);
+    }
+
+    // Chunks up to the next plot, the end, or a chunk cut short
+    size_t sizes_bytes = (size_t)h.num_vars * sizeof(uint64_t);
+    for (;;) {
+      ChunkHeader ch;
+      if (size - pos < sizeof(ch) + sizes_bytes) break;
+      memcpy(&ch, base + pos, sizeof(ch));
+      if (ch.tag != kChunkTag) break;
+      std::vector<uint64_t> sizes(h.num_vars);
+      memcpy(sizes.data(), base + pos + sizeof(ch), sizes_bytes);
+      size_t payload = pos + sizeof(ch) + sizes_bytes;
+      size_t end = payload;
+      bool complete = true;
+      for (int v = 0; v < h.num_vars; v++) {
+        if (sizes[v] > size - end) {
+          complete = false;
+          break;
+        }
+        end += sizes[v];
+      }
+      if (!complete) {
+        pos = size;  // Truncated file: keep the complete chunks
+        break;
+      }
+      if (p == plot) {
+        for (int v = 0; v < h.num_vars; v++) {
+          std::vector<double>& col = columns[v];
+          size_t start = col.size();
+          col.resize(start + ch.num_points);
+          if (!DecodeColumn(base + payload, sizes[v], ch.num_points, h.flags,
+                            v, &words, col.data() + start)) {
+            fprintf(stderr, "Waveform error: Corrupt chunk: %s\n", path);
+            WaveformDataRelease(data);
+            return -1;
+          }
+          payload += sizes[v];
+        }
+      }
+      pos = end;
+    }
+    if (p == plot) break;
+  }
+
+  if (!data->names) {
+    fprintf(stderr, "Waveform error: No plot %d in %s\n", plot, path);
+    return -1;
+  }
+  data->num_points = (long)columns[0].size();
+  size_t count = (size_t)data->num_vars * data->num_points;
+  data->values = (double*)malloc((count > 0 ? count : 1) * sizeof(double));
+  if (!data->values) {
+    WaveformDataRelease(data);
+    return -1;
+  }
+  for (int v = 0; v < data->num_vars; v++) {
+    memcpy(data->values + (size_t)v * data->num_points, columns[v].data(),
+           data->num_points * sizeof(double));
+  }
+  return 0;
+}
+
+}  // namespace minispice
@@ -0,0 +1,127 @@
+// waveform.h
+// Streaming binary waveform files for transient and sweep results
+//
+// A waveform writer takes one point at a time (the scale value, e.g. the
+// time, and the selected solution variables) into a columnar buffer of
+// chunk_points points. A full buffer is handed to a background thread that
+// encodes and writes it while the analysis fills the second buffer; the
+// analysis only waits when the disk falls a whole buffer behind.
+//
+// Two formats are written:
+//
+//   chunked  A header (names of the plot and of the variables) followed by
+//            chunks of up to chunk_points points. Each chunk stores every
+//            variable as one contiguous column, optionally as float (all
+//            variables but the scale, which keeps double precision) and
+//            optionally compressed without loss: the bits of every value
+//            are XORed with those of a linear extrapolation from the two
+//            previous values of its column and the result is packed with
+//            its leading and trailing zero bits removed (the Gorilla
+//            time-series encoding). Constant and linear stretches shrink to
+//            about a bit per point. A file cut short keeps every complete
+//            chunk. WaveformReadFile reads it back.
+//   raw      The binary SPICE raw format (ASCII header, then the points as
+//            rows of doubles), read by ngspice, its viewers and most
+//            waveform tools. It has no float or compressed variant.
+//
+// Several plots (e.g., a .DC sweep and a .TRAN run) can be written to one
+// file one after the other by opening the later ones with append.
+
+#ifndef MINI_SPICE_WAVEFORM_H_
+#define MINI_SPICE_WAVEFORM_H_
+
+#include <stdint.h>
+
+namespace minispice {
+
+struct Circuit;
+
+// Version of the chunked layout; bump on any change to it
+constexpr uint32_t kWaveformVersion = 1;
+
+// Longest variable or plot name, terminating NUL included
+constexpr int kWaveformNameLen = 80;
+
+// Default points per chunk (and per write buffer)
+constexpr int kWaveformChunkPoints = 4096;
+
+enum WaveformFormat { kWaveformChunked = 0, kWaveformRaw };
+
+struct WaveformOptions {
+  WaveformFormat format;
+  int float32;       // Chunked: store the variables after the scale as float
+  int compress;      // Chunked: XOR-compress every column of every chunk
+  int chunk_points;  // Points per buffer and chunk (kWaveformChunkPoints)
+  int append;        // Add a plot to the end of an existing file
+};
+
+// Fill opts with the defaults: chunked, double, uncompressed
+void WaveformOptionsInit(WaveformOptions* opts);
+
+struct WaveformWriter;
+
+// Create (or, with opts->append, extend) the waveform file at path for the
+// plot plot_name with num_vars variables: names[0] is the scale, names[1 ..]
+// the variables (e.g., "V(out)", "I(V1)"). opts may be nullptr for the
+// defaults. Starts the writer thread.
+// Returns nullptr on error (invalid arguments, names too long, I/O error).
+WaveformWriter* WaveformWriterOpen(const char* path, const char* plot_name,
+                                   int num_vars, const char* const* names,
+                                   const WaveformOptions* opts);
+
+// Add one point: values[0] is the scale value, values[1 .. num_vars - 1]
+// the variables in the order of the names.
+// Returns 0 on success, -1 once a write has failed (the point and every
+// later one are dropped).
+int WaveformWriterAppend(WaveformWriter* w, const double* values);
+
+// Points appended so far
+long WaveformWriterNumPoints(const WaveformWriter* w);
+
+// Write the buffered points, complete the file and free the writer.
+// Returns 0 on success, -1 if any write failed.
+int WaveformWriterClose(WaveformWriter* w);
+
+// Solution variables to record: the names "V(node)" and "I(device)" of a
+// finalized circuit (of any length; waveform files take those shorter than
+// kWaveformNameLen) and their indices in the solution vector
+struct WaveformSelection {
+  int num_vars;
+  int* var_index;
+  char** names;
+};
+
+// Select the variables of list, a comma-separated list of V(node) and
+// I(device) names (node names exact, device names in any case; I() only of
+// devices with a branch current: voltage sources and inductors), or every
+// node voltage and branch current in the order of CircuitPrintSolution if
+// list is nullptr or empty.
+// Returns 0 on success, -1 on error (unknown name, allocation failure).
+int CircuitSelectWaveform(Circuit* c, const char* list,
+                          WaveformSelection* sel);
+
+// Free the arrays of a selection
+void WaveformSelectionRelease(WaveformSelection* sel);
+
+// One plot of a chunked waveform file
+struct WaveformData {
+  char plot_name[kWaveformNameLen];
+  int num_vars;  // Scale included
+  long num_points;
+  char (*names)[kWaveformNameLen];
+  double* values;  // values[v * num_points + p]: variable v at point p
+};
+
+// Read plot number plot (0 for the first) of a chunked waveform file.
+// Float columns are widened back to double. A file cut short in the middle
+// of a chunk yields the points of the complete chunks.
+// Returns 0 on success, -1 on error (I/O error, not a waveform file of this
+// version, no such plot, corrupt chunk).
+int WaveformReadFile(const char* path, int plot, WaveformData* data);
+
+// Free the arrays of data read by WaveformReadFile
+void WaveformDataRelease(WaveformData* data);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_WAVEFORM_H_
@@ -0,0 +1,362 @@
+// waveform_test.cc
+// Unit tests for the binary waveform writer and reader
+
+#include "waveform.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "circuit.h"
+#include "device.h"
+#include "parser.h"
+#include "transient.h"
+
+using namespace minispice;
+
+static std::string WavePath(const char* name) {
+  return ::testing::TempDir() + name;
+}
+
+static std::vector<char> ReadFile(const std::string& path) {
+  std::vector<char> data;
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) return data;
+  char block[4096];
+  size_t got;
+  while ((got = fread(block, 1, sizeof(block), f)) > 0) {
+    data.insert(data.end(), block, block + got);
+  }
+  fclose(f);
+  return data;
+}
+
+static const char* kNames[] = {"time", "V(a)", "V(b)", "I(V1)"};
+
+// Point p of a smooth test waveform: variable v at time p * 1ns
+static double Sample(int p, int v) {
+  double t = p * 1e-9;
+  if (v == 0) return t;
+  return v * std::sin(2e6 * M_PI * t) + 0.25 * v;
+}
+
+// Write num_points points of Sample to path as one plot
+static void WriteSamples(const std::string& path, const WaveformOptions* opts,
+                         int num_points, const char* plot = "Transient") {
+  WaveformWriter* w = WaveformWriterOpen(path.c_str(), plot, 4, kNames, opts);
+  ASSERT_NE(w, nullptr);
+  for (int p = 0; p < num_points; p++) {
+    double row[4];
+    for (int v = 0; v < 4; v++) row[v] = Sample(p, v);
+    ASSERT_EQ(WaveformWriterAppend(w, row), 0);
+  }
+  EXPECT_EQ(WaveformWriterNumPoints(w), num_points);
+  ASSERT_EQ(WaveformWriterClose(w), 0);
+}
+
+TEST(WaveformTest, RoundTripsEveryEncoding) {
+  std::string path = WavePath("round.wave");
+  for (int float32 = 0; float32 <= 1; float32++) {
+    for (int compress = 0; compress <= 1; compress++) {
+      WaveformOptions opts;
+      WaveformOptionsInit(&opts);
+      opts.float32 = float32;
+      opts.compress = compress;
+      opts.chunk_points = 100;  // Several chunks and a partial last one
+      WriteSamples(path, &opts, 1234);
+
+      WaveformData data;
+      ASSERT_EQ(WaveformReadFile(path.c_str(), 0, &data), 0);
+      EXPECT_STREQ(data.plot_name, "Transient");
+      ASSERT_EQ(data.num_vars, 4);
+      ASSERT_EQ(data.num_points, 1234);
+      for (int v = 0; v < 4; v++) EXPECT_STREQ(data.names[v], kNames[v]);
+      for (int p = 0; p < 1234; p++) {
+        // The scale stays exact; floats round to their precision
+        EXPECT_EQ(data.values[p], Sample(p, 0));
+        for (int v = 1; v < 4; v++) {
+          double expected = Sample(p, v);
+          if (float32) expected = (float)expected;
+          ASSERT_EQ(data.values[v * data.num_points + p], expected)
+              << "float32 " << float32 << " compress " << compress;
+        }
+      }
+      WaveformDataRelease(&data);
+    }
+  }
+  remove(path.c_str());
+}
+
+TEST(WaveformTest, CompressionShrinksSmoothWaveforms) {
+  std::string plain = WavePath("plain.wave");
+  std::string packed = WavePath("packed.wave");
+  WaveformOptions opts;
+  WaveformOptionsInit(&opts);
+  opts.float32 = 1;
+  WriteSamples(plain, &opts, 10000);
+  opts.compress = 1;
+  WriteSamples(packed, &opts, 10000);
+  EXPECT_LT(ReadFile(packed).size(), ReadFile(plain).size() * 3 / 4);
+
+  // Constant columns cost about a bit per point
+  const char* names[] = {"time", "V(dc)"};
+  WaveformWriter* w =
+      WaveformWriterOpen(packed.c_str(), "DC", 2, names, &opts);
+  ASSERT_NE(w, nullptr);
+  for (int p = 0; p < 8000; p++) {
+    double row[2] = {p * 0.5, 3.3};
+    ASSERT_EQ(WaveformWriterAppend(w, row), 0);
+  }
+  ASSERT_EQ(WaveformWriterClose(w), 0);
+  EXPECT_LT(ReadFile(packed).size(), 8000u);
+
+  remove(plain.c_str());
+  remove(packed.c_str());
+}
+
+TEST(WaveformTest, AppendsPlots) {
+  std::string path = WavePath("plots.wave");
+  WaveformOptions opts;
+  WaveformOptionsInit(&opts);
+  opts.compress = 1;
+  WriteSamples(path, &opts, 10, "DC transfer characteristic");
+  opts.append = 1;
+  opts.compress = 0;
+  WriteSamples(path, &opts, 5000, "Transient Analysis");
+
+  WaveformData data;
+  ASSERT_EQ(WaveformReadFile(path.c_str(), 0, &data), 0);
+  EXPECT_STREQ(data.plot_name, "DC transfer characteristic");
+  EXPECT_EQ(data.num_points, 10);
+  WaveformDataRelease(&data);
+  ASSERT_EQ(WaveformReadFile(path.c_str(), 1, &data), 0);
+  EXPECT_STREQ(data.plot_name, "Transient Analysis");
+  ASSERT_EQ(data.num_points, 5000);
+  EXPECT_EQ(data.values[3 * 5000 + 4999], Sample(4999, 3));
+  WaveformDataRelease(&data);
+  EXPECT_EQ(WaveformReadFile(path.c_str(), 2, &data), -1);
+
+  remove(path.c_str());
+}
+
+TEST(WaveformTest, TruncatedFileKeepsCompleteChunks) {
+  std::string path = WavePath("cut.wave");
+  WaveformOptions opts;
+  WaveformOptionsInit(&opts);
+  opts.chunk_points = 64;
+  WriteSamples(path, &opts, 200);  // Chunks of 64, 64, 64 and 8 points
+
+  std::vector<char> file = ReadFile(path);
+  FILE* f = fopen(path.c_str(), "wb");
+  ASSERT_NE(f, nullptr);
+  fwrite(file.data(), 1, file.size() - 100, f);  // Cut into the last chunk
+  fclose(f);
+
+  WaveformData data;
+  ASSERT_EQ(WaveformReadFile(path.c_str(), 0, &data), 0);
+  ASSERT_EQ(data.num_points, 192);
+  EXPECT_EQ(data.values[2 * 192 + 191], Sample(191, 2));
+  WaveformDataRelease(&data);
+
+  // Not a waveform file
+  f = fopen(path.c_str(), "wb");
+  ASSERT_NE(f, nullptr);
+  fputs("Title: not a waveform\n", f);
+  fclose(f);
+  EXPECT_EQ(WaveformReadFile(path.c_str(), 0, &data), -1);
+  EXPECT_EQ(WaveformReadFile(WavePath("missing.wave").c_str(), 0, &data), -1);
+
+  remove(path.c_str());
+}
+
+TEST(WaveformTest, FailedWriteDropsLaterPoints) {
+  // Every write to /dev/full fails: once a chunk is lost, appends keep
+  // returning -1 without filling the buffer any further
+  FILE* probe = fopen("/dev/full", "wb");
+  if (!probe) GTEST_SKIP() << "no /dev/full";
+  fclose(probe);
+  for (int format : {kWaveformChunked, kWaveformRaw}) {
+    WaveformOptions opts;
+    WaveformOptionsInit(&opts);
+    opts.format = static_cast<WaveformFormat>(format);
+    WaveformWriter* w = WaveformWriterOpen("/dev/full", "Transient", 4,
+                                           kNames, &opts);
+    if (!w) continue;  // The header write already failed
+    int failures = 0;
+    for (int p = 0; p < 4 * opts.chunk_points; p++) {
+      double row[4];
+      for (int v = 0; v < 4; v++) row[v] = Sample(p, v);
+      if (WaveformWriterAppend(w, row) != 0) failures++;
+    }
+    EXPECT_GT(failures, opts.chunk_points);
+    EXPECT_EQ(WaveformWriterClose(w), -1);
+  }
+}
+
+TEST(WaveformTest, WritesSpiceRaw) {
+  std::string path = WavePath("out.raw");
+  WaveformOptions opts;
+  WaveformOptionsInit(&opts);
+  opts.format = kWaveformRaw;
+  opts.chunk_points = 16;
+  WriteSamples(path, &opts, 50);
+
+  std::vector<char> file = ReadFile(path);
+  std::string text(file.begin(), file.end());
+  size_t binary = text.find("Binary:\n");
+  ASSERT_NE(binary, std::string::npos);
+  std::string header = text.substr(0, binary);
+  EXPECT_EQ(header.find("Title: "), 0u);
+  EXPECT_NE(header.find("Plotname: Transient\n"), std::string::npos);
+  EXPECT_NE(header.find("Flags: real\n"), std::string::npos);
+  EXPECT_NE(header.find("No. Variables: 4\n"), std::string::npos);
+  EXPECT_NE(header.find("No. Points: 50 "), std::string::npos);
+  EXPECT_NE(header.find("\t0\ttime\ttime\n"), std::string::npos);
+  EXPECT_NE(header.find("\t1\tV(a)\tvoltage\n"), std::string::npos);
+  EXPECT_NE(header.find("\t3\tI(V1)\tcurrent\n"), std::string::npos);
+
+  // Rows of doubles after the header
+  size_t start = binary + strlen("Binary:\n");
+  ASSERT_EQ(file.size() - start, 50 * 4 * sizeof(double));
+  for (int p = 0; p < 50; p++) {
+    for (int v = 0; v < 4; v++) {
+      double value;
+      memcpy(&value, &file[start + (p * 4 + v) * sizeof(double)],
+             sizeof(value));
+      ASSERT_EQ(value, Sample(p, v));
+    }
+  }
+
+  // A second plot follows the first with its own header
+  opts.append = 1;
+  WriteSamples(path, &opts, 3, "DC");
+  file = ReadFile(path);
+  text.assign(file.begin(), file.end());
+  EXPECT_NE(text.find("No. Points: 50 "), std::string::npos);
+  EXPECT_NE(text.find("Plotname: DC\n"), std::string::npos);
+  EXPECT_NE(text.find("No. Points: 3 "), std::string::npos);
+
+  remove(path.c_str());
+}
+
+TEST(WaveformTest, InvalidArguments) {
+  std::string path = WavePath("bad.wave");
+  std::string long_name(kWaveformNameLen, 'x');
+  const char* names[] = {"time", long_name.c_str()};
+  EXPECT_EQ(WaveformWriterOpen(path.c_str(), "T", 2, names, nullptr), nullptr);
+  EXPECT_EQ(WaveformWriterOpen(path.c_str(), "T", 0, names, nullptr), nullptr);
+  EXPECT_EQ(WaveformWriterOpen((WavePath("no/such/dir") + "x").c_str(), "T",
+                               1, names, nullptr),
+            nullptr);
+  EXPECT_EQ(WaveformWriterAppend(nullptr, nullptr), -1);
+  EXPECT_EQ(WaveformWriterClose(nullptr), -1);
+}
+
+TEST(WaveformTest, SelectsCircuitVariables) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 1\nR1 in out 1k\nL1 out mid 1u\nR2 mid 0 1k\n");
+  ASSERT_NE(c, nullptr);
+
+  WaveformSelection sel;
+  ASSERT_EQ(CircuitSelectWaveform(c, nullptr, &sel), 0);
+  ASSERT_EQ(sel.num_vars, c->num_vars);
+  EXPECT_STREQ(sel.names[0], "V(in)");
+  EXPECT_EQ(sel.var_index[0], c->nodes[CircuitGetNode(c, "in")].var_index);
+  WaveformSelectionRelease(&sel);
+
+  ASSERT_EQ(CircuitSelectWaveform(c, "v(out), I(l1) ,V(in)", &sel), 0);
+  ASSERT_EQ(sel.num_vars, 3);
+  EXPECT_STREQ(sel.names[0], "V(out)");
+  EXPECT_STREQ(sel.names[1], "I(L1)");
+  EXPECT_EQ(sel.var_index[1], CircuitFindDevice(c, "L1")->extra_var);
+  EXPECT_STREQ(sel.names[2], "V(in)");
+  WaveformSelectionRelease(&sel);
+
+  // Unknown nodes, devices without a branch current, malformed names
+  EXPECT_EQ(CircuitSelectWaveform(c, "V(nope)", &sel), -1);
+  EXPECT_EQ(CircuitSelectWaveform(c, "I(R1)", &sel), -1);
+  EXPECT_EQ(CircuitSelectWaveform(c, "V(out),,V(in)", &sel), -1);
+  EXPECT_EQ(CircuitSelectWaveform(c, "out", &sel), -1);
+  EXPECT_EQ(CircuitSelectWaveform(c, "V(0)", &sel), -1);
+  circuit_free(c);
+
+  // Hierarchical names longer than the old fixed-size device names
+  Circuit* h = parse_netlist_string(
+      "V1 in 0 1\nXvery_long_instance_name_of_the_buffer in buf\n"
+      ".subckt buf p\nLfilter_inductor_of_the_buffer p q 1u\n"
+      "Rq q 0 1k\n.ends\n");
+  ASSERT_NE(h, nullptr);
+  const char* path =
+      "Xvery_long_instance_name_of_the_buffer.Lfilter_inductor_of_the_buffer";
+  std::string list = std::string("I(") + path + ")";
+  ASSERT_EQ(CircuitSelectWaveform(h, list.c_str(), &sel), 0);
+  ASSERT_EQ(sel.num_vars, 1);
+  EXPECT_EQ(sel.names[0], list);
+  EXPECT_EQ(sel.var_index[0], CircuitFindDevice(h, path)->extra_var);
+  WaveformSelectionRelease(&sel);
+  circuit_free(h);
+}
+
+// Context of RecordWave: the writer and the selection
+struct WaveSink {
+  WaveformWriter* w;
+  WaveformSelection sel;
+  std::vector<double> t;
+};
+
+static void RecordWave(void* user, double t, const double* x, int num_vars) {
+  WaveSink* s = static_cast<WaveSink*>(user);
+  std::vector<double> row(1 + s->sel.num_vars);
+  row[0] = t;
+  for (int v = 0; v < s->sel.num_vars; v++) {
+    ASSERT_LT(s->sel.var_index[v], num_vars);
+    row[1 + v] = x[s->sel.var_index[v]];
+  }
+  ASSERT_EQ(WaveformWriterAppend(s->w, row.data()), 0);
+  s->t.push_back(t);
+}
+
+TEST(WaveformTest, RecordsTransient) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 PULSE(0 1 1u 1n 1n 1 0)\nR1 in out 1k\nC1 out 0 1n\n");
+  ASSERT_NE(c, nullptr);
+  std::string path = WavePath("rc.wave");
+
+  WaveSink sink;
+  ASSERT_EQ(CircuitSelectWaveform(c, "V(out)", &sink.sel), 0);
+  const char* names[] = {"time", sink.sel.names[0]};
+  WaveformOptions opts;
+  WaveformOptionsInit(&opts);
+  opts.compress = 1;
+  opts.chunk_points = 32;
+  sink.w = WaveformWriterOpen(path.c_str(), "Transient Analysis", 2, names,
+                              &opts);
+  ASSERT_NE(sink.w, nullptr);
+
+  TransientOptions topts;
+  TransientOptionsInit(&topts, 0.1e-6, 10e-6);
+  std::vector<double> x(c->num_vars);
+  ASSERT_GT(CircuitTransientAnalysis(c, nullptr, &topts, x.data(), RecordWave,
+                                     &sink, nullptr),
+            0);
+  ASSERT_EQ(WaveformWriterClose(sink.w), 0);
+
+  WaveformData data;
+  ASSERT_EQ(WaveformReadFile(path.c_str(), 0, &data), 0);
+  ASSERT_EQ(data.num_points, (long)sink.t.size());
+  EXPECT_STREQ(data.names[1], "V(out)");
+  for (long p = 0; p < data.num_points; p++) {
+    EXPECT_EQ(data.values[p], sink.t[p]);
+  }
+  EXPECT_EQ(data.values[2 * data.num_points - 1],
+            x[sink.sel.var_index[0]]);
+  WaveformDataRelease(&data);
+
+  WaveformSelectionRelease(&sink.sel);
+  circuit_free(c);
+  remove(path.c_str());
+}
@@ -0,0 +1,1205 @@
+// Analysis workspace implementation
+//
+// Owns the stamp context, matrices and vectors used by the analyses and
+// implements assembly and the in-place dense/sparse linear solves.
+//
+
+#include "workspace.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "btf.h"
+#include "circuit.h"
+#include "device.h"
+#include "device_batch.h"
+#include "krylov.h"
+#include "sparse.h"
+#include "thread_pool.h"
+
+namespace minispice {
+
+// Per-thread state of parallel stamping: the iteration state handed to the
+// devices, a copy of the analysis' whose counts point at the thread's own
+struct StampWorker {
+  int transient;  // 1 for transient stamps (ts), 0 for DC stamps (it)
+  IterationState it;
+  TimeStepState ts;
+  DeviceEvalCounts counts;
+};
+
+// Low-rank updates of the linear fast path (SimWorkspace::low_rank_updates):
+// the entries of the assembled matrix that differ from matrix_ref, by
+// changed row, and the solves W of the kept factors for those rows
+struct LowRankUpdate {
+  int rank;                  // Number of changed rows
+  int rows[kMaxUpdateRank];  // Changed rows, in the order they were found
+  int* row_pos;              // Position of each row in rows, -1 if unchanged
+
+  // Differing entries: position of their row in rows, column, and the
+  // assembled value minus the reference value
+  int num_entries;
+  size_t entries_capacity;
+  int* entry_row;
+  int* entry_col;
+  double* entry_diff;
+
+  // W[a * n + i] = (A_ref^-1 e_{w_rows[a]})[i], computed for the w_rank
+  // rows w_rows (w_rank = 0 if not computed for the kept factors)
+  int w_rank;
+  int w_rows[kMaxUpdateRank];
+  double* W;
+
+  // Capacitance matrix I + D W (row-major rank x rank), factored in place,
+  // and its pivots
+  double S[kMaxUpdateRank * kMaxUpdateRank];
+  int s_pivots[kMaxUpdateRank];
+
+  // Scratch (length n): solves of the factors, residual, residual scale and
+  // unit vector (zero between uses)
+  double* y;
+  double* r;
+  double* scale;
+  double* e;
+};
+
+namespace {
+
+// Parallel stamping: devices per pool task
+constexpr int kStampChunkDevices = 128;
+
+// Mixed precision: most refinement steps before a dense solve falls back to
+// the double factorization
+constexpr int kMaxRefinementSteps = 10;
+
+// Low-rank updates: largest residual of an accepted solution, relative to
+// the magnitude of the terms of each row (|A| |x| + |z|), and most
+// refinement steps (each a further update solve with the residual) to reach
+// it before the matrix is refactored instead
+constexpr double kLowRankResidualTol = 1e-12;
+constexpr int kMaxLowRankRefinementSteps = 2;
+
+// In-place LU factorization (Gaussian elimination with partial pivoting) of
+// the row-major n x n matrix A, in the precision of T. On return A holds the
+// unit lower factor below the diagonal and the upper factor on and above it;
+// pivots[k] is the row swapped with row k at step k.
+// Returns 0 on success, -2 if the matrix is singular.
+template <typename T>
+static int DenseLuFactor(int n, T* A, int* pivots) {
+  for (int k = 0; k < n; k++) {
+    // Find pivot
+    int p = k;
+    double maxv = fabs(A[k * n + k]);
+    for (int i = k + 1; i < n; i++) {
+      double v = fabs(A[i * n + k]);
+      if (v > maxv) {
+        maxv = v;
+        p = i;
+      }
+    }
+
+    if (maxv < 1e-15) {
+      // Singular matrix
+      return -2;
+    }
+
+    // Swap rows if needed
+    pivots[k] = p;
+    if (p != k) {
+      for (int j = 0; j < n; j++) {
+        T tmp = A[k * n + j];
+        A[k * n + j] = A[p * n + j];
+        A[p * n + j] = tmp;
+      }
+    }
+
+    // Eliminate below pivot, keeping the multipliers in place
+    T pivot = A[k * n + k];
+    for (int i = k + 1; i < n; i++) {
+      T factor = A[i * n + k] / pivot;
+      A[i * n + k] = factor;
+      if (factor == 0) continue;
+      for (int j = k + 1; j < n; j++) {
+        A[i * n + j] -= factor * A[k * n + j];
+      }
+    }
+  }
+  return 0;
+}
+
+// Solve A * x = b with the factors computed by DenseLuFactor, in double
+// whatever the precision of the factors.
+// b and x are length n and may not alias.
+template <typename T>
+static void DenseLuSolve(int n, const T* LU, const int* pivots,
+                         const double* b, double* x) {
+  memcpy(x, b, n * sizeof(double));
+
+  // Forward substitution with the row swaps applied in order
+  for (int k = 0; k < n; k++) {
+    int p = pivots[k];
+    if (p != k) {
+      double tmp = x[k];
+      x[k] = x[p];
+      x[p] = tmp;
+    }
+    for (int j = 0; j < k; j++) {
+      x[k] -= LU[k * n + j] * x[j];
+    }
+  }
+
+  // Back substitution
+  for (int i = n - 1; i >= 0; i--) {
+    double sum = x[i];
+    for (int j = i + 1; j < n; j++) {
+      sum -= LU[i * n + j] * x[j];
+    }
+    x[i] = sum / LU[i * n + i];
+  }
+}
+
+// Mixed precision: factor the row-major n x n matrix A into the float
+// factors LU, leaving A intact, and return the infinity norm of A in
+// *a_norm.
+// Returns 0 on success, -2 if A is singular in float or has entries out of
+// its range.
+static int DenseLuFactorFloat(int n, const double* A, float* LU, int* pivots,
+                              double* a_norm) {
+  *a_norm = 0.0;
+  for (int i = 0; i < n; i++) {
+    double row_sum = 0.0;
+    for (int j = 0; j < n; j++) {
+      double a = A[i * n + j];
+      if (!(fabs(a) <= FLT_MAX)) return -2;
+      LU[i * n + j] = (float)a;
+      row_sum += fabs(a);
+    }
+    *a_norm = fmax(*a_norm, row_sum);
+  }
+  return DenseLuFactor(n, LU, pivots);
+}
+
+// Mixed precision: solve A * x = b with the float factors of A and refine x
+// against the double A (r = b - A x, x += LU \ r) until the corrections
+// reach the rounding of x or stop shrinking. The result is accepted if its
+// residual is then as small as a double factorization would leave it,
+// ||r|| <= ||x|| ||A|| eps sqrt(n). r and dx are length n scratch.
+// Returns the number of refinement steps, or -1 if refinement stalls
+// (the matrix is too ill-conditioned for float factors).
+static int DenseRefine(int n, const double* A, double a_norm, const float* LU,
+                       const int* pivots, const double* b, double* x,
+                       double* r, double* dx) {
+  DenseLuSolve(n, LU, pivots, b, x);
+  double tol = a_norm * DBL_EPSILON * sqrt((double)n);
+  double last_dx_norm = INFINITY;
+  for (int step = 0; step < kMaxRefinementSteps; step++) {
+    double r_norm = 0.0;
+    double x_norm = 0.0;
+    for (int i = 0; i < n; i++) {
+      const double* row = A + (size_t)i * n;
+      double sum = b[i];
+      for (int j = 0; j < n; j++) sum -= row[j] * x[j];
+      r[i] = sum;
+      r_norm = fmax(r_norm, fabs(sum));
+      x_norm = fmax(x_norm, fabs(x[i]));
+    }
+    if (!std::isfinite(r_norm)) return -1;
+
+    DenseLuSolve(n, LU, pivots, r, dx);
+    double dx_norm = 0.0;
+    for (int i = 0; i < n; i++) dx_norm = fmax(dx_norm, fabs(dx[i]));
+    if (dx_norm > 0.5 * last_dx_norm) {
+      // No longer converging: at the attainable accuracy or diverging
+      return r_norm <= x_norm * tol ? step : -1;
+    }
+    for (int i = 0; i < n; i++) x[i] += dx[i];
+    if (dx_norm <= DBL_EPSILON * x_norm) return step + 1;
+    last_dx_norm = dx_norm;
+  }
+  return -1;
+}
+
+// Make the sparse Jacobian hold the given triplets. The pattern, ordering
+// and LU object are kept when every triplet fits the existing pattern (only
+// the values are replaced) and rebuilt otherwise. A rebuilt pattern with a
+// block triangular form of several blocks is factored by blocks; otherwise
+// the LU object takes the circuit's kept ordering if it was computed for
+// the new pattern.
+static int SetupSparsePattern(SimWorkspace* ws, const Triplet* triplets,
+                              size_t count) {
+  if (ws->jacobian &&
+      SparseAssembleTriplets(ws->jacobian, triplets, count) == 0) {
+    return 0;
+  }
+
+  SparseLuFree(ws->lu);
+  SparseBtfFree(ws->btf);
+  KrylovSolverFree(ws->krylov);
+  SparseFree(ws->jacobian);
+  ws->lu = nullptr;
+  ws->btf = nullptr;
+  ws->krylov = nullptr;
+  ws->jacobian = SparseCreateFromTriplets(ws->n, triplets, count);
+  if (!ws->jacobian) return -1;
+
+  if (ws->x_krylov) {
+    ws->krylov = KrylovSolverCreate(ws->jacobian, &ws->solver);
+    if (ws->krylov) return 0;
+    SparseFree(ws->jacobian);
+    ws->jacobian = nullptr;
+    return -1;
+  }
+
+  ws->btf = SparseBtfCreate(ws->jacobian,
+                            (int)(kSparseBtfMaxBlockFraction * ws->n));
+  if (ws->btf) {
+    if (!ws->pool && ws->solver.threads != 1) {
+      // Without a pool the blocks are solved one after the other
+      ws->pool = ThreadPoolCreate(ws->solver.threads);
+    }
+    return 0;
+  }
+  if (ws->ordering) {
+    ws->lu = SparseLuCreateWithOrdering(ws->jacobian, ws->ordering);
+  }
+  if (!ws->lu) ws->lu = SparseLuCreate(ws->jacobian);
+  if (!ws->lu) {
+    SparseFree(ws->jacobian);
+    ws->jacobian = nullptr;
+    return -1;
+  }
+  return 0;
+}
+
+// 1 if the device at list position k is stamped by the batches
+static int IsBatched(const DeviceBatches* batches, int k) {
+  return batches && k < batches->num_devices && batches->batched[k];
+}
+
+// Stamp the gmin of gmin stepping of a DC iteration, numbered as device k
+// (one past the last device)
+static void StampGmin(Circuit* c, StampContext* ctx, const IterationState* it,
+                      const TimeStepState* ts, int k) {
+  if (ts || it->gmin <= 0.0) return;
+  CtxBeginDevice(ctx, k);
+  int num_node_vars = c->num_vars - c->num_extra_vars;
+  for (int i = 0; i < num_node_vars; i++) CtxAddA(ctx, i, i, it->gmin);
+}
+
+// Stamp every device for one NR iteration (ts == nullptr) or one transient
+// Newton iteration. Devices are numbered in list order so compiled stamping
+// can find each device's slots. Batched devices are skipped in the list walk
+// and stamped together afterwards. The gmin of gmin stepping is stamped last,
+// numbered as one more device.
+static void StampDevices(Circuit* c, StampContext* ctx, DeviceBatches* batches,
+                         IterationState* it, TimeStepState* ts) {
+  int k = 0;
+  for (Device* d = c->devices; d; d = d->next, k++) {
+    if (!d->vt || IsBatched(batches, k)) continue;
+    if (ts) {
+      if (!d->vt->StampTransient) continue;
+      CtxBeginDevice(ctx, k);
+      d->vt->StampTransient(d, ctx, ts);
+    } else if (d->vt->StampNonlinear) {
+      CtxBeginDevice(ctx, k);
+      d->vt->StampNonlinear(d, ctx, it);
+    }
+  }
+
+  if (batches) DeviceBatchesStamp(batches, ctx, it, ts);
+  StampGmin(c, ctx, it, ts, k);
+}
+
+// Number of kStampChunkDevices tasks of count devices
+static int StampChunks(int count) {
+  return (count + kStampChunkDevices - 1) / kStampChunkDevices;
+}
+
+// Parallel stamping task: one chunk of the vtable devices, then of the
+// batched devices, stamped into the worker context of the thread
+static void StampChunk(void* user, int thread, int index) {
+  SimWorkspace* ws = static_cast<SimWorkspace*>(user);
+  StampContext* ctx = ws->stamp_contexts[thread];
+  StampWorker* w = &ws->stamp_workers[thread];
+  int num_list_chunks = StampChunks(ws->num_stamp_devices);
+
+  if (index < num_list_chunks) {
+    int begin = index * kStampChunkDevices;
+    int end = begin + kStampChunkDevices;
+    if (end > ws->num_stamp_devices) end = ws->num_stamp_devices;
+    for (int j = begin; j < end; j++) {
+      Device* d = ws->stamp_devices[j];
+      if (w->transient) {
+        if (!d->vt->StampTransient) continue;
+        CtxBeginDevice(ctx, ws->stamp_device_index[j]);
+        d->vt->StampTransient(d, ctx, &w->ts);
+      } else if (d->vt->StampNonlinear) {
+        CtxBeginDevice(ctx, ws->stamp_device_index[j]);
+        d->vt->StampNonlinear(d, ctx, &w->it);
+      }
+    }
+    return;
+  }
+
+  int count = DeviceBatchesCount(ws->batches);
+  int begin = (index - num_list_chunks) * kStampChunkDevices;
+  int end = begin + kStampChunkDevices;
+  if (end > count) end = count;
+  DeviceBatchesStampRange(ws->batches, ctx, w->transient ? nullptr : &w->it,
+                          w->transient ? &w->ts : nullptr, begin, end);
+}
+
+// StampDevices on the stamp pool of a compiled workspace: the devices are
+// stamped in chunks into the worker contexts of a deferred assembly, the
+// gmin on the calling thread, and the stored calls are then summed in the
+// serial order.
+// Returns -1 (having stamped nothing) if the context is not compiled.
+static int StampDevicesParallel(SimWorkspace* ws, Circuit* c,
+                                IterationState* it, TimeStepState* ts) {
+  if (CtxBeginDeferred(ws->ctx) != 0) return -1;
+
+  DeviceEvalCounts* counts = ts ? ts->counts : it->counts;
+  int num_threads = ThreadPoolSize(ws->stamp_pool);
+  for (int t = 0; t < num_threads; t++) {
+    StampWorker* w = &ws->stamp_workers[t];
+    CtxBeginWorker(ws->stamp_contexts[t]);
+    w->transient = ts != nullptr;
+    w->counts.evaluations = 0;
+    w->counts.bypassed = 0;
+    if (ts) {
+      w->ts = *ts;
+      w->ts.counts = counts ? &w->counts : nullptr;
+    } else {
+      w->it = *it;
+      w->it.counts = counts ? &w->counts : nullptr;
+    }
+  }
+
+  int num_tasks = StampChunks(ws->num_stamp_devices) +
+                  StampChunks(DeviceBatchesCount(ws->batches));
+  ThreadPoolParallelFor(ws->stamp_pool, num_tasks, StampChunk, ws);
+
+  if (counts) {
+    for (int t = 0; t < num_threads; t++) {
+      counts->evaluations += ws->stamp_workers[t].counts.evaluations;
+      counts->bypassed += ws->stamp_workers[t].counts.bypassed;
+    }
+  }
+  StampGmin(c, ws->ctx, it, ts, c->num_devices);
+  return CtxResolveDeferred(ws->ctx, ws->stamp_contexts, num_threads);
+}
+
+// Parallel stamping: create the pool, worker contexts and vtable device list
+// of a workspace whose circuit asks for more than one stamp thread and has
+// enough devices (nothing otherwise).
+// Returns 0 on success, -1 on allocation failure.
+static int SetupParallelStamping(SimWorkspace* ws, const Circuit* c) {
+  if (c->stamp_threads == 1) return 0;
+
+  int num_list = 0;
+  int k = 0;
+  for (const Device* d = c->devices; d; d = d->next, k++) {
+    if (d->vt && !IsBatched(ws->batches, k)) num_list++;
+  }
+  if (num_list + DeviceBatchesCount(ws->batches) < kParallelStampMinDevices) {
+    return 0;
+  }
+
+  ws->stamp_pool = ThreadPoolCreate(c->stamp_threads);
+  if (!ws->stamp_pool) return -1;
+  int num_threads = ThreadPoolSize(ws->stamp_pool);
+  ws->stamp_contexts =
+      (StampContext**)calloc(num_threads, sizeof(StampContext*));
+  ws->stamp_workers = (StampWorker*)calloc(num_threads, sizeof(StampWorker));
+  ws->stamp_devices = (Device**)calloc(num_list > 0 ? num_list : 1,
+                                       sizeof(Device*));
+  ws->stamp_device_index = (int*)calloc(num_list > 0 ? num_list : 1,
+                                        sizeof(int));
+  if (!ws->stamp_contexts || !ws->stamp_workers || !ws->stamp_devices ||
+      !ws->stamp_device_index) {
+    return -1;
+  }
+  for (int t = 0; t < num_threads; t++) {
+    ws->stamp_contexts[t] = CtxCreateWorker(ws->ctx);
+    if (!ws->stamp_contexts[t]) return -1;
+  }
+
+  k = 0;
+  for (Device* d = c->devices; d; d = d->next, k++) {
+    if (!d->vt || IsBatched(ws->batches, k)) continue;
+    ws->stamp_devices[ws->num_stamp_devices] = d;
+    ws->stamp_device_index[ws->num_stamp_devices] = k;
+    ws->num_stamp_devices++;
+  }
+  return 0;
+}
+
+// Assemble the discovered triplets into the matrix storage and compile the
+// context against it
+static int CompileWorkspace(SimWorkspace* ws) {
+  size_t count;
+  const Triplet* triplets = CtxGetTriplets(ws->ctx, &count);
+  if (count > ws->slots_capacity) {
+    int* new_slots = (int*)realloc(ws->slots, count * sizeof(int));
+    if (!new_slots) return -1;
+    ws->slots = new_slots;
+    ws->slots_capacity = count;
+  }
+
+  // The slot layout may change: the kept factors no longer match
+  ws->factors_valid = 0;
+
+  int n = ws->n;
+  if (ws->use_sparse) {
+    if (SetupSparsePattern(ws, triplets, count) != 0) return -1;
+    if (SparseFindSlots(ws->jacobian, triplets, count, ws->slots) != 0) {
+      return -1;
+    }
+    size_t nnz = ws->jacobian->nnz;
+    if (ws->linear && nnz > ws->matrix_ref_size) {
+      double* ref = (double*)realloc(ws->matrix_ref, nnz * sizeof(double));
+      if (!ref) return -1;
+      ws->matrix_ref = ref;
+      ws->matrix_ref_size = nnz;
+    }
+    return CtxCompile(ws->ctx, ws->slots, ws->jacobian->values, nnz);
+  }
+
+  CtxAssembleDense(ws->ctx, ws->A);
+  for (size_t k = 0; k < count; k++) {
+    ws->slots[k] = triplets[k].row * n + triplets[k].col;
+  }
+  return CtxCompile(ws->ctx, ws->slots, ws->A, (size_t)n * n);
+}
+
+// Phase timer: start time if the workspace profiles, 0 otherwise
+static double PhaseStart(const SimWorkspace* ws) {
+  return ws->profile ? SimClockSeconds() : 0.0;
+}
+
+// Phase timer: add the time since start to the phase
+static void PhaseEnd(SimWorkspace* ws, SimPhase phase, double start) {
+  if (!ws->profile) return;
+  ws->stats.phase_seconds[phase] += SimClockSeconds() - start;
+  ws->stats.phase_calls[phase]++;
+}
+
+// StampDevices, on the stamp pool once compiled, plus the per-type stamp
+// counts
+static void StampAndCount(SimWorkspace* ws, Circuit* c, IterationState* it,
+                          TimeStepState* ts) {
+  if (!ws->stamp_pool || !ws->compiled ||
+      StampDevicesParallel(ws, c, it, ts) != 0) {
+    StampDevices(c, ws->ctx, ws->batches, it, ts);
+  }
+  for (int k = 0; k < kNumDeviceTypes; k++) {
+    ws->stats.device_stamps[k] += ws->devices_by_type[k];
+  }
+}
+
+// Shared assembly for DC and transient stamps
+static int Assemble(SimWorkspace* ws, Circuit* c, IterationState* it,
+                    TimeStepState* ts) {
+  if (c->num_vars != ws->n) return -1;
+
+  // Device params edited since the batches read them
+  if (ws->param_edits != c->param_edits) {
+    DeviceBatchesUpdateParams(ws->batches, c);
+    ws->param_edits = c->param_edits;
+  }
+
+  // Reset and stamp. Once compiled the stamps accumulate directly into the
+  // matrix storage.
+  double start = PhaseStart(ws);
+  if (ws->compiled) {
+    CtxReset(ws->ctx);
+  } else {
+    CtxBeginDiscovery(ws->ctx);
+  }
+  StampAndCount(ws, c, it, ts);
+
+  if (ws->compiled && CtxGetPatternMisses(ws->ctx) > 0) {
+    // A device stamped outside its recorded positions (e.g., the switch
+    // from DC to transient stamps): rediscover
+    ws->compiled = 0;
+    CtxBeginDiscovery(ws->ctx);
+    StampAndCount(ws, c, it, ts);
+  }
+  PhaseEnd(ws, kSimPhaseStamp, start);
+
+  if (!ws->compiled) {
+    start = PhaseStart(ws);
+    int result = CompileWorkspace(ws);
+    PhaseEnd(ws, kSimPhaseAssemble, start);
+    if (result != 0) return -1;
+    ws->compiled = 1;
+    ws->stats.pattern_compiles++;
+  }
+  return 0;
+}
+
+// Assembled matrix values and their count
+static const double* MatrixValues(const SimWorkspace* ws, size_t* size) {
+  if (ws->use_sparse) {
+    *size = ws->jacobian->nnz;
+    return ws->jacobian->values;
+  }
+  *size = (size_t)ws->n * ws->n;
+  return ws->A;
+}
+
+// Sparse path: numerically factor the Jacobian, by blocks or reusing the
+// pivot sequence of the last factorization when its pivots stay acceptable
+static int FactorSparse(SimWorkspace* ws) {
+  if (ws->btf) return SparseBtfFactor(ws->btf, ws->jacobian, ws->pool);
+  int result = SparseLuRefactor(ws->lu, ws->jacobian);
+  if (result != 0) result = SparseLuFactor(ws->lu, ws->jacobian);
+  return result;
+}
+
+// Sparse path: solve A x = z with the factors of FactorSparse
+static int SolveSparse(SimWorkspace* ws, const double* z, double* x) {
+  if (ws->btf) return SparseBtfSolve(ws->btf, z, x, ws->pool);
+  return SparseLuSolve(ws->lu, z, x);
+}
+
+// Linear fast path: 1 if the kept factors belong to the assembled matrix
+static int FactorsMatch(const SimWorkspace* ws) {
+  if (!ws->factors_valid) return 0;
+  size_t size;
+  const double* values = MatrixValues(ws, &size);
+  return memcmp(values, ws->matrix_ref, size * sizeof(double)) == 0;
+}
+
+// Linear fast path: factor the assembled matrix, leaving it intact, and
+// remember its values
+static int FactorLinear(SimWorkspace* ws) {
+  size_t size;
+  const double* values = MatrixValues(ws, &size);
+  ws->factors_valid = 0;
+
+  int result;
+  if (ws->krylov) {
+    result = KrylovSolverSetup(ws->krylov, ws->jacobian);
+  } else if (ws->use_sparse) {
+    result = FactorSparse(ws);
+  } else {
+    ws->factors_float = 0;
+    if (ws->LU32) {
+      result = DenseLuFactorFloat(ws->n, values, ws->LU32, ws->pivots,
+                                  &ws->a_norm);
+      if (result == 0) {
+        ws->factors_float = 1;
+      } else {
+        ws->stats.precision_fallbacks++;
+      }
+    }
+    if (!ws->factors_float) {
+      memcpy(ws->LU, values, size * sizeof(double));
+      result = DenseLuFactor(ws->n, ws->LU, ws->pivots);
+    }
+  }
+  ws->num_factorizations++;
+  if (ws->low_rank) ws->low_rank->w_rank = 0;
+  if (result != 0) return result;
+
+  memcpy(ws->matrix_ref, values, size * sizeof(double));
+  ws->factors_valid = 1;
+  return 0;
+}
+
+// Linear fast path, dense: solve with the kept factors. Float factors are
+// refined against A; if refinement stalls the matrix is refactored in double
+// and the double factors are kept instead.
+static int SolveDenseLinear(SimWorkspace* ws, const double* z) {
+  int n = ws->n;
+  if (ws->factors_float) {
+    int steps = DenseRefine(n, ws->A, ws->a_norm, ws->LU32, ws->pivots, z,
+                            ws->x_new, ws->refine_r, ws->refine_dx);
+    if (steps >= 0) {
+      ws->stats.refinement_steps += steps;
+      return 0;
+    }
+    ws->stats.precision_fallbacks++;
+    ws->factors_float = 0;
+    memcpy(ws->LU, ws->A, (size_t)n * n * sizeof(double));
+    ws->num_factorizations++;
+    if (ws->low_rank) ws->low_rank->w_rank = 0;
+    int result = DenseLuFactor(n, ws->LU, ws->pivots);
+    if (result != 0) {
+      ws->factors_valid = 0;
+      return result;
+    }
+  }
+  DenseLuSolve(n, ws->LU, ws->pivots, z, ws->x_new);
+  return 0;
+}
+
+// Linear fast path: solve matrix_ref x = b with the kept factors (b and x
+// may not alias). Float factors are refined against matrix_ref.
+// Returns 0 on success, -1 if refinement stalls or the solve fails.
+static int SolveFactors(SimWorkspace* ws, const double* b, double* x) {
+  if (ws->use_sparse) return SolveSparse(ws, b, x);
+  if (!ws->factors_float) {
+    DenseLuSolve(ws->n, ws->LU, ws->pivots, b, x);
+    return 0;
+  }
+  int steps = DenseRefine(ws->n, ws->matrix_ref, ws->a_norm, ws->LU32,
+                          ws->pivots, b, x, ws->refine_r, ws->refine_dx);
+  if (steps < 0) return -1;
+  ws->stats.refinement_steps += steps;
+  return 0;
+}
+
+static void LowRankFree(LowRankUpdate* lr) {
+  if (!lr) return;
+  free(lr->row_pos);
+  free(lr->entry_row);
+  free(lr->entry_col);
+  free(lr->entry_diff);
+  free(lr->W);
+  free(lr->y);
+  free(lr->r);
+  free(lr->scale);
+  free(lr->e);
+  free(lr);
+}
+
+static LowRankUpdate* LowRankCreate(int n) {
+  LowRankUpdate* lr = (LowRankUpdate*)calloc(1, sizeof(LowRankUpdate));
+  if (!lr) return nullptr;
+  lr->row_pos = (int*)malloc(n * sizeof(int));
+  lr->W = (double*)calloc((size_t)kMaxUpdateRank * n, sizeof(double));
+  lr->y = (double*)calloc(n, sizeof(double));
+  lr->r = (double*)calloc(n, sizeof(double));
+  lr->scale = (double*)calloc(n, sizeof(double));
+  lr->e = (double*)calloc(n, sizeof(double));
+  if (!lr->row_pos || !lr->W || !lr->y || !lr->r || !lr->scale || !lr->e) {
+    LowRankFree(lr);
+    return nullptr;
+  }
+  for (int i = 0; i < n; i++) lr->row_pos[i] = -1;
+  return lr;
+}
+
+// Record the entry (row, col) of the assembled matrix, which differs from
+// the reference by diff.
+// Returns -1 if its row is one more than kMaxUpdateRank changed rows.
+static int AddUpdateEntry(LowRankUpdate* lr, int row, int col, double diff) {
+  int a = lr->row_pos[row];
+  if (a < 0) {
+    if (lr->rank == kMaxUpdateRank) return -1;
+    a = lr->rank++;
+    lr->rows[a] = row;
+    lr->row_pos[row] = a;
+  }
+  lr->entry_row[lr->num_entries] = a;
+  lr->entry_col[lr->num_entries] = col;
+  lr->entry_diff[lr->num_entries] = diff;
+  lr->num_entries++;
+  return 0;
+}
+
+// Find the entries of the assembled matrix that differ from matrix_ref.
+// Returns 0 on success, -1 if more than kMaxUpdateRank rows differ or on
+// allocation failure.
+static int FindChangedRows(SimWorkspace* ws, LowRankUpdate* lr) {
+  for (int a = 0; a < lr->rank; a++) lr->row_pos[lr->rows[a]] = -1;
+  lr->rank = 0;
+  lr->num_entries = 0;
+
+  size_t size;
+  const double* values = MatrixValues(ws, &size);
+  if (size > lr->entries_capacity) {
+    int* rows = (int*)realloc(lr->entry_row, size * sizeof(int));
+    if (rows) lr->entry_row = rows;
+    int* cols = (int*)realloc(lr->entry_col, size * sizeof(int));
+    if (cols) lr->entry_col = cols;
+    double* diffs = (double*)realloc(lr->entry_diff, size * sizeof(double));
+    if (diffs) lr->entry_diff = diffs;
+    if (!rows || !cols || !diffs) return -1;
+    lr->entries_capacity = size;
+  }
+
+  const double* ref = ws->matrix_ref;
+  int n = ws->n;
+  if (ws->use_sparse) {
+    const SparseMatrix* A = ws->jacobian;
+    for (int j = 0; j < n; j++) {
+      for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+        if (values[p] == ref[p]) continue;
+        if (AddUpdateEntry(lr, A->row_idx[p], j, values[p] - ref[p]) != 0) {
+          return -1;
+        }
+      }
+    }
+    return 0;
+  }
+  for (size_t p = 0; p < size; p++) {
+    if (values[p] == ref[p]) continue;
+    if (AddUpdateEntry(lr, (int)(p / n), (int)(p % n), values[p] - ref[p]) !=
+        0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// One update solve: x += A^-1 b for the assembled A = A_ref + U D, as
+// y - W (I + D W)^-1 D y with y = A_ref^-1 b
+static int LowRankCorrect(SimWorkspace* ws, LowRankUpdate* lr,
+                          const double* b, double* x) {
+  int n = ws->n;
+  int k = lr->rank;
+  if (SolveFactors(ws, b, lr->y) != 0) return -1;
+
+  double t[kMaxUpdateRank] = {0.0};
+  double w[kMaxUpdateRank];
+  for (int e = 0; e < lr->num_entries; e++) {
+    t[lr->entry_row[e]] += lr->entry_diff[e] * lr->y[lr->entry_col[e]];
+  }
+  DenseLuSolve(k, lr->S, lr->s_pivots, t, w);
+  for (int i = 0; i < n; i++) {
+    double sum = lr->y[i];
+    for (int b_col = 0; b_col < k; b_col++) {
+      sum -= lr->W[(size_t)b_col * n + i] * w[b_col];
+    }
+    x[i] += sum;
+  }
+  return 0;
+}
+
+// Residual r = z - A x of the assembled matrix A.
+// Returns 1 if it is within kLowRankResidualTol of the row magnitudes.
+static int LowRankAccepts(SimWorkspace* ws, LowRankUpdate* lr,
+                          const double* z, const double* x) {
+  int n = ws->n;
+  size_t size;
+  const double* values = MatrixValues(ws, &size);
+  double* r = lr->r;
+  double* scale = lr->scale;
+  for (int i = 0; i < n; i++) {
+    r[i] = z[i];
+    scale[i] = fabs(z[i]);
+  }
+  if (ws->use_sparse) {
+    const SparseMatrix* A = ws->jacobian;
+    for (int j = 0; j < n; j++) {
+      for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+        double term = values[p] * x[j];
+        r[A->row_idx[p]] -= term;
+        scale[A->row_idx[p]] += fabs(term);
+      }
+    }
+  } else {
+    for (int i = 0; i < n; i++) {
+      const double* row = values + (size_t)i * n;
+      for (int j = 0; j < n; j++) {
+        double term = row[j] * x[j];
+        r[i] -= term;
+        scale[i] += fabs(term);
+      }
+    }
+  }
+
+  double max_scale = 0.0;
+  double r_norm = 0.0;
+  for (int i = 0; i < n; i++) {
+    max_scale = fmax(max_scale, scale[i]);
+    r_norm = fmax(r_norm, fabs(r[i]));
+  }
+  return r_norm <= kLowRankResidualTol * max_scale;
+}
+
+// Linear fast path: solve the assembled matrix, which differs from
+// matrix_ref in at most kMaxUpdateRank rows, by a Sherman-Morrison-Woodbury
+// update of the kept factors, refining while the residual is too large.
+// Returns 0 on success, -1 if the update does not apply or is not accurate
+// enough (the matrix is then to be refactored).
+static int SolveLowRank(SimWorkspace* ws, const double* z) {
+  if (!ws->low_rank) {
+    ws->low_rank = LowRankCreate(ws->n);
+    if (!ws->low_rank) return -1;
+  }
+  LowRankUpdate* lr = ws->low_rank;
+  if (FindChangedRows(ws, lr) != 0) return -1;
+
+  // Solves of the factors for the changed rows, reused while the same rows
+  // differ from the reference
+  int n = ws->n;
+  int k = lr->rank;
+  if (lr->w_rank != k || memcmp(lr->w_rows, lr->rows, k * sizeof(int)) != 0) {
+    lr->w_rank = 0;
+    for (int a = 0; a < k; a++) {
+      lr->e[lr->rows[a]] = 1.0;
+      int result = SolveFactors(ws, lr->e, lr->W + (size_t)a * n);
+      lr->e[lr->rows[a]] = 0.0;
+      if (result != 0) return -1;
+    }
+    memcpy(lr->w_rows, lr->rows, k * sizeof(int));
+    lr->w_rank = k;
+  }
+
+  // Capacitance matrix I + D W
+  for (int a = 0; a < k; a++) {
+    for (int b = 0; b < k; b++) lr->S[a * k + b] = a == b ? 1.0 : 0.0;
+  }
+  for (int e = 0; e < lr->num_entries; e++) {
+    double* row = lr->S + lr->entry_row[e] * k;
+    const double* w = lr->W + lr->entry_col[e];
+    for (int b = 0; b < k; b++) row[b] += lr->entry_diff[e] * w[(size_t)b * n];
+  }
+  if (DenseLuFactor(k, lr->S, lr->s_pivots) != 0) return -1;
+
+  double* x = ws->x_new;
+  memset(x, 0, n * sizeof(double));
+  const double* b = z;
+  for (int step = 0; step <= kMaxLowRankRefinementSteps; step++) {
+    if (LowRankCorrect(ws, lr, b, x) != 0) return -1;
+    if (LowRankAccepts(ws, lr, z, x)) return 0;
+    b = lr->r;
+  }
+  return -1;
+}
+
+// Iterative path: set the preconditioner up for the assembled matrix (kept
+// while a linear circuit's matrix is unchanged) and solve from the previous
+// solution
+static int SolveKrylov(SimWorkspace* ws, const double* z) {
+  double start = PhaseStart(ws);
+  if (!ws->linear || !FactorsMatch(ws)) {
+    int result;
+    if (ws->linear) {
+      result = FactorLinear(ws);
+    } else {
+      result = KrylovSolverSetup(ws->krylov, ws->jacobian);
+      ws->num_factorizations++;
+    }
+    PhaseEnd(ws, kSimPhaseFactor, start);
+    if (result != 0) return -1;
+    start = PhaseStart(ws);
+  }
+
+  int iterations = KrylovSolverSolve(ws->krylov, ws->jacobian, z, ws->x_krylov);
+  PhaseEnd(ws, kSimPhaseSolve, start);
+  if (iterations < 0) {
+    // Restart the next solve from zero rather than from a diverged iterate
+    memset(ws->x_krylov, 0, ws->n * sizeof(double));
+    return -1;
+  }
+  ws->stats.krylov_iterations += iterations;
+  memcpy(ws->x_new, ws->x_krylov, ws->n * sizeof(double));
+  return 0;
+}
+
+}  // namespace
+
+// ============================================================================
+// SimWorkspace API Implementation
+// ============================================================================
+
+SimWorkspace* SimWorkspaceCreate(const Circuit* c) {
+  if (!c || !c->finalized || c->num_vars <= 0) return nullptr;
+
+  SimWorkspace* ws = (SimWorkspace*)calloc(1, sizeof(SimWorkspace));
+  if (!ws) return nullptr;
+
+  int n = c->num_vars;
+  ws->n = n;
+
+  // Large systems are solved with the sparse LU and never form the dense
+  // n x n matrix; the Krylov solvers always work on the sparse matrix
+  ws->solver = c->linear_solver;
+  int iterative = ws->solver.method != kLinearSolverDirect;
+  ws->use_sparse = n >= kSparseSolverThreshold || iterative;
+  ws->linear = c->is_linear;
+  ws->ordering = c->sparse_ordering;
+  ws->profile = c->profile;
+  ws->param_edits = c->param_edits;
+  for (const Device* d = c->devices; d; d = d->next) {
+    int type = DeviceTypeId(d);
+    if (type >= 0) ws->devices_by_type[type]++;
+  }
+
+  ws->ctx = CtxCreate(n);
+  ws->batches = DeviceBatchesCreate(c);
+  if (ws->ctx && SetupParallelStamping(ws, c) != 0) {
+    SimWorkspaceFree(ws);
+    return nullptr;
+  }
+  ws->x_new = (double*)calloc(n, sizeof(double));
+  ws->delta = (double*)calloc(n, sizeof(double));
+  ws->x_continuation = (double*)calloc(n, sizeof(double));
+  if (iterative) ws->x_krylov = (double*)calloc(n, sizeof(double));
+  if (!ws->use_sparse) {
+    ws->A = (double*)calloc((size_t)n * n, sizeof(double));
+    ws->pivots = (int*)calloc(n, sizeof(int));
+    if (ws->linear) {
+      // Sparse storage is sized once the pattern is known (CompileWorkspace)
+      ws->LU = (double*)calloc((size_t)n * n, sizeof(double));
+      ws->matrix_ref = (double*)calloc((size_t)n * n, sizeof(double));
+      ws->matrix_ref_size = (size_t)n * n;
+    }
+    if (ws->solver.mixed_precision) {
+      ws->LU32 = (float*)calloc((size_t)n * n, sizeof(float));
+      ws->refine_r = (double*)calloc(n, sizeof(double));
+      ws->refine_dx = (double*)calloc(n, sizeof(double));
+    }
+  }
+
+  if (!ws->ctx || !ws->x_new || !ws->delta || !ws->x_continuation ||
+      (iterative && !ws->x_krylov) ||
+      (!ws->use_sparse && (!ws->A || !ws->pivots)) ||
+      (!ws->use_sparse && ws->linear && (!ws->LU || !ws->matrix_ref)) ||
+      (!ws->use_sparse && ws->solver.mixed_precision &&
+       (!ws->LU32 || !ws->refine_r || !ws->refine_dx))) {
+    SimWorkspaceFree(ws);
+    return nullptr;
+  }
+
+  return ws;
+}
+
+void SimWorkspaceFree(SimWorkspace* ws) {
+  if (!ws) return;
+
+  if (ws->stamp_contexts) {
+    int num_threads = ThreadPoolSize(ws->stamp_pool);
+    for (int t = 0; t < num_threads; t++) CtxFree(ws->stamp_contexts[t]);
+  }
+  free(ws->stamp_contexts);
+  free(ws->stamp_workers);
+  free(ws->stamp_devices);
+  free(ws->stamp_device_index);
+  ThreadPoolFree(ws->stamp_pool);
+  CtxFree(ws->ctx);
+  DeviceBatchesFree(ws->batches);
+  SparseLuFree(ws->lu);
+  SparseBtfFree(ws->btf);
+  ThreadPoolFree(ws->pool);
+  KrylovSolverFree(ws->krylov);
+  SparseFree(ws->jacobian);
+  free(ws->slots);
+  free(ws->A);
+  free(ws->pivots);
+  free(ws->LU);
+  free(ws->LU32);
+  free(ws->refine_r);
+  free(ws->refine_dx);
+  free(ws->matrix_ref);
+  LowRankFree(ws->low_rank);
+  free(ws->x_new);
+  free(ws->delta);
+  free(ws->x_continuation);
+  free(ws->x_krylov);
+  free(ws);
+}
+
+void SimWorkspaceGetStats(const SimWorkspace* ws, SimStats* stats) {
+  if (!stats) return;
+  SimStatsClear(stats);
+  if (!ws) return;
+
+  *stats = ws->stats;
+  stats->factorizations = ws->num_factorizations;
+  stats->device_evaluations = ws->eval_counts.evaluations;
+  stats->bypassed_evaluations = ws->eval_counts.bypassed;
+  stats->num_vars = ws->n;
+  stats->sparse = ws->use_sparse;
+  if (ws->use_sparse) {
+    stats->matrix_nnz = ws->jacobian ? ws->jacobian->nnz : 0;
+    stats->lu_nnz = ws->krylov ? KrylovSolverNnz(ws->krylov)
+                    : ws->btf  ? SparseBtfNnz(ws->btf)
+                    : ws->lu   ? SparseLuNnz(ws->lu)
+                               : 0;
+    stats->blocks = ws->btf ? SparseBtfNumBlocks(ws->btf) : 1;
+  } else {
+    stats->matrix_nnz = (long)ws->n * ws->n;
+    stats->lu_nnz = (long)ws->n * ws->n;
+    stats->blocks = 1;
+  }
+  stats->mixed_precision = !ws->use_sparse && ws->solver.mixed_precision;
+}
+
+void SimWorkspaceClearStats(SimWorkspace* ws) {
+  if (!ws) return;
+  SimStatsClear(&ws->stats);
+  ws->num_factorizations = 0;
+  ws->eval_counts.evaluations = 0;
+  ws->eval_counts.bypassed = 0;
+}
+
+int SimWorkspaceAssemble(SimWorkspace* ws, Circuit* c, IterationState* it) {
+  if (!ws || !c || !it) return -1;
+  return Assemble(ws, c, it, nullptr);
+}
+
+int SimWorkspaceAssembleTransient(SimWorkspace* ws, Circuit* c,
+                                  TimeStepState* ts) {
+  if (!ws || !c || !ts) return -1;
+  return Assemble(ws, c, nullptr, ts);
+}
+
+SparseOrdering* SimWorkspaceDiscoverOrdering(SimWorkspace* ws, Circuit* c) {
+  if (!ws || !c || !ws->use_sparse) return nullptr;
+  if (!ws->jacobian) {
+    double* x = (double*)calloc(ws->n, sizeof(double));
+    if (!x) return nullptr;
+    IterationState it = {0, x, 0.0, 0.0, NewtonPolicy{}, nullptr, 0.0};
+    int status = Assemble(ws, c, &it, nullptr);
+    free(x);
+    if (status != 0) return nullptr;
+  }
+  if (!ws->jacobian) return nullptr;
+  if (!ws->lu) return SparseOrderingCompute(ws->jacobian);
+  return SparseOrderingCreate(ws->jacobian, ws->lu);
+}
+
+int SimWorkspaceSolve(SimWorkspace* ws) {
+  if (!ws || !ws->compiled) return -1;
+  ws->stats.newton_iterations++;
+
+  const double* z = CtxGetZ(ws->ctx);
+  if (ws->krylov) return SolveKrylov(ws, z);
+
+  int result = 0;
+  double start = PhaseStart(ws);
+  if (ws->linear) {
+    // Only the RHS changed since the last factorization in the common case
+    if (!FactorsMatch(ws)) {
+      // After parameter edits only a few rows may have changed
+      if (ws->low_rank_updates && ws->factors_valid &&
+          SolveLowRank(ws, z) == 0) {
+        ws->stats.low_rank_solves++;
+        PhaseEnd(ws, kSimPhaseSolve, start);
+        return 0;
+      }
+      result = FactorLinear(ws);
+      PhaseEnd(ws, kSimPhaseFactor, start);
+      if (result != 0) return result;
+      start = PhaseStart(ws);
+    }
+    if (ws->use_sparse) {
+      result = SolveSparse(ws, z, ws->x_new);
+    } else {
+      result = SolveDenseLinear(ws, z);
+    }
+    PhaseEnd(ws, kSimPhaseSolve, start);
+    return result;
+  }
+
+  ws->num_factorizations++;
+  if (ws->LU32) {
+    // Mixed precision: float factors of the intact A, refined in double
+    result = DenseLuFactorFloat(ws->n, ws->A, ws->LU32, ws->pivots,
+                                &ws->a_norm);
+    PhaseEnd(ws, kSimPhaseFactor, start);
+    if (result == 0) {
+      start = PhaseStart(ws);
+      int steps = DenseRefine(ws->n, ws->A, ws->a_norm, ws->LU32, ws->pivots,
+                              z, ws->x_new, ws->refine_r, ws->refine_dx);
+      PhaseEnd(ws, kSimPhaseSolve, start);
+      if (steps >= 0) {
+        ws->stats.refinement_steps += steps;
+        return 0;
+      }
+    }
+
+    // Singular in float or too ill-conditioned: factor in double
+    ws->stats.precision_fallbacks++;
+    ws->num_factorizations++;
+    start = PhaseStart(ws);
+  }
+  if (ws->use_sparse) {
+    // Symbolic reuse: after the first factorization of the pattern only a
+    // numeric refactorization is run; pivots are re-chosen if a reused
+    // pivot degrades
+    result = FactorSparse(ws);
+  } else {
+    result = DenseLuFactor(ws->n, ws->A, ws->pivots);
+  }
+  PhaseEnd(ws, kSimPhaseFactor, start);
+  if (result != 0) return result;
+
+  start = PhaseStart(ws);
+  if (ws->use_sparse) {
+    result = SolveSparse(ws, z, ws->x_new);
+  } else {
+    DenseLuSolve(ws->n, ws->A, ws->pivots, z, ws->x_new);
+  }
+  PhaseEnd(ws, kSimPhaseSolve, start);
+  return result;
+}
+
+double SimWorkspaceResidualNorm(SimWorkspace* ws, const double* x) {
+  if (!ws || !ws->compiled || !x) return INFINITY;
+
+  int n = ws->n;
+  const double* z = CtxGetZ(ws->ctx);
+  double norm = 0.0;
+  if (ws->use_sparse) {
+    // Column-wise product into x_new, which the next solve overwrites
+    const SparseMatrix* A = ws->jacobian;
+    double* r = ws->x_new;
+    for (int i = 0; i < n; i++) r[i] = -z[i];
+    for (int j = 0; j < n; j++) {
+      for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+        r[A->row_idx[p]] += A->values[p] * x[j];
+      }
+    }
+    for (int i = 0; i < n; i++) norm = fmax(norm, fabs(r[i]));
+    return norm;
+  }
+
+  for (int i = 0; i < n; i++) {
+    const double* row = ws->A + (size_t)i * n;
+    double r = -z[i];
+    for (int j = 0; j < n; j++) r += row[j] * x[j];
+    norm = fmax(norm, fabs(r));
+  }
+  return norm;
+}
+
+int SimWorkspaceLineSearch(SimWorkspace* ws, Circuit* c, IterationState* it,
+                           TimeStepState* ts, double* residual) {
+  if (!ws || !c || !residual || (!it && !ts)) return -1;
+  const NewtonPolicy* policy = ts ? &ts->policy : &it->policy;
+  double* x = ts ? ts->x_current : it->x_current;
+
+  // NaN (overflowed device currents) counts as an increase
+  double r = SimWorkspaceResidualNorm(ws, x);
+  for (int k = 0; !(r <= *residual) && k < policy->max_backtracks; k++) {
+    for (int i = 0; i < ws->n; i++) {
+      ws->delta[i] *= 0.5;
+      x[i] -= ws->delta[i];
+    }
+    if (Assemble(ws, c, it, ts) != 0) return -1;
+    r = SimWorkspaceResidualNorm(ws, x);
+  }
+  *residual = r;
+  return 0;
+}
+
+void SimWorkspaceUpdateSolution(SimWorkspace* ws, double* x,
+                                const NewtonPolicy* policy) {
+  if (!ws || !x) return;
+
+  int n = ws->n;
+  double scale = 1.0;
+  if (policy && policy->damping == kNewtonDampingMaxStep &&
+      policy->max_step > 0.0) {
+    double max_delta = 0.0;
+    for (int i = 0; i < n; i++) {
+      max_delta = fmax(max_delta, fabs(ws->x_new[i] - x[i]));
+    }
+    if (max_delta > policy->max_step) scale = policy->max_step / max_delta;
+  }
+  for (int i = 0; i < n; i++) {
+    ws->delta[i] = scale * (ws->x_new[i] - x[i]);
+    x[i] += ws->delta[i];
+  }
+}
+
+}  // namespace minispice
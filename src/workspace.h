@@ -0,0 +1,261 @@
+// workspace.h
+// Reusable analysis workspace
+//
+// A SimWorkspace owns every buffer an analysis needs for a finalized circuit:
+// the stamp context, the MNA matrix (dense or sparse), the LU factors and the
+// Newton-Raphson vectors. All storage is allocated once by
+// SimWorkspaceCreate; repeated analyses with the same workspace perform no
+// heap allocations in the steady state. The matrix is factored in place.
+//
+// For linear circuits (Circuit::is_linear) the workspace keeps the factors
+// of the last factored matrix and a copy of its values. Solve compares the
+// newly assembled matrix against that copy and runs only the forward/back
+// substitution when it is unchanged, so a DC sweep or a run of equal time
+// steps factors once.
+//
+// With low_rank_updates set (see CircuitDcResolve), a linear matrix that
+// differs from the factored one in at most kMaxUpdateRank rows, as after a
+// parameter edit of a few devices, is solved from the kept factors by a
+// Sherman-Morrison-Woodbury update instead of being refactored: with U the
+// columns of the identity at the changed rows and D those rows of the
+// difference, x = y - W (I + D W)^-1 D y for y = A^-1 z and W = A^-1 U. W
+// costs one solve per changed row and is reused while the same rows differ;
+// each solve then costs one solve with the factors plus O(nnz). A solution
+// whose residual is not near that of a factorization is discarded and the
+// matrix refactored, which also makes it the new reference.
+//
+// A sparse Jacobian whose block triangular form splits it into blocks of at
+// most kSparseBtfMaxBlockFraction of the variables (disconnected or one-way
+// coupled sub-networks, see btf.h) is factored block by block instead, the
+// independent blocks in parallel on LinearSolverOptions::threads workers.
+//
+// Circuits with at least kParallelStampMinDevices devices stamp them on
+// Circuit::stamp_threads threads once the context is compiled, each thread
+// into its own worker context of a deferred assembly (see
+// CtxBeginDeferred). The assembled systems are bit-identical to the serial
+// ones.
+//
+// With LinearSolverOptions::mixed_precision the dense LU is computed in
+// float, halving its memory traffic, and every solution is refined in
+// double against the assembled matrix until its residual is that of a
+// double factorization (see DenseRefine in workspace.cc). When the float
+// factors are singular or refinement stalls (a matrix too ill-conditioned
+// for float), the solve falls back to the double LU. The sparse and
+// Krylov paths always solve in double; SimStats::mixed_precision tells
+// which one a workspace took.
+//
+// With an iterative Circuit::linear_solver the sparse matrix is used at any
+// size and solved by a preconditioned Krylov method (see krylov.h) instead
+// of the LU; the preconditioner takes the place of the factors above.
+
+#ifndef MINI_SPICE_WORKSPACE_H_
+#define MINI_SPICE_WORKSPACE_H_
+
+#include <stddef.h>
+
+#include "krylov.h"
+#include "sim_stats.h"
+#include "stamp.h"
+
+namespace minispice {
+
+struct Circuit;
+struct Device;
+struct DeviceBatches;
+struct KrylovSolver;
+struct LowRankUpdate;
+struct SparseBtf;
+struct SparseMatrix;
+struct SparseLu;
+struct SparseOrdering;
+struct StampWorker;
+struct ThreadPool;
+
+// Fewest devices (vtable and batched) for which the workspace stamps on
+// more than one thread: below it the stamps take less time than waking the
+// pool
+constexpr int kParallelStampMinDevices = 512;
+
+// Most changed rows of a linear matrix solved by a low-rank update of the
+// kept factors (SimWorkspace::low_rank_updates); beyond it refactoring is
+// cheaper than the solves of the update
+constexpr int kMaxUpdateRank = 16;
+
+// How a DC analysis reached its solution
+enum DcStrategy {
+  kDcNewton = 0,       // Newton from the initial guess
+  kDcGminStepping,     // Newton through decreasing node-to-ground gmin
+  kDcSourceStepping,   // Newton through sources ramped up from zero
+};
+
+// Analysis workspace for one finalized circuit
+struct SimWorkspace {
+  int n;            // Number of MNA variables of the circuit
+  int use_sparse;   // 1 if the system is solved with the sparse LU
+  StampContext* ctx;  // Stamp context, compiled after the first assembly
+  int compiled;       // 1 if ctx stamps directly into the matrix storage
+
+  // SoA batches of the circuit's diodes, or nullptr if all devices are
+  // stamped through their vtables (see device_batch.h)
+  DeviceBatches* batches;
+
+  // Parallel stamping: the pool (nullptr if the devices are stamped on the
+  // calling thread), a worker context and per-thread state for each pool
+  // thread, and the devices stamped through their vtables with their list
+  // positions
+  ThreadPool* stamp_pool;
+  StampContext** stamp_contexts;
+  StampWorker* stamp_workers;
+  Device** stamp_devices;
+  int* stamp_device_index;
+  int num_stamp_devices;
+
+  // Matrix storage slot of every recorded stamp call (see CtxCompile)
+  int* slots;
+  size_t slots_capacity;
+
+  // Dense path: row-major n x n matrix, overwritten by its LU factors on
+  // solve, and the row permutation of the factorization
+  double* A;
+  int* pivots;
+
+  // Sparse path: Jacobian pattern and LU factorization (ordering, fill-in
+  // pattern, pivot sequence), built on the first assembly and reused across
+  // NR iterations and analyses
+  SparseMatrix* jacobian;
+  SparseLu* lu;
+
+  // Block triangular form of the Jacobian, in place of lu when its blocks
+  // are small enough, and the pool its blocks are factored and solved on
+  // (nullptr for one worker; created with the first such form)
+  SparseBtf* btf;
+  ThreadPool* pool;
+
+  // Column ordering kept by the circuit (Circuit::sparse_ordering), used
+  // instead of computing one when the Jacobian has its pattern
+  const SparseOrdering* ordering;
+
+  // Iterative path: the Krylov solver of the sparse Jacobian (in place of
+  // lu) and its last solution, the initial guess of the next solve, which
+  // survives pattern changes (length n)
+  LinearSolverOptions solver;
+  KrylovSolver* krylov;
+  double* x_krylov;
+
+  // Linear fast path (only allocated for linear circuits)
+  int linear;          // 1 if the circuit is linear
+  int factors_valid;   // 1 if the factors belong to matrix_ref
+  double* matrix_ref;  // Matrix values the factors were computed from
+  size_t matrix_ref_size;
+  double* LU;          // Dense path: factors, kept apart from A
+
+  // Low-rank updates of the kept factors: 1 if enabled, and their storage
+  // (allocated by the first update)
+  int low_rank_updates;
+  LowRankUpdate* low_rank;
+
+  // Circuit::param_edits when the batches last read the device params
+  long param_edits;
+
+  // Mixed precision (LinearSolverOptions::mixed_precision, dense path only):
+  // float factors of A, which stays intact for the refinement residuals,
+  // the norm of A, 1 if the kept factors of the linear fast path are the
+  // float ones (0 for LU), and the refinement scratch (length n)
+  float* LU32;
+  double a_norm;
+  int factors_float;
+  double* refine_r;
+  double* refine_dx;
+
+  // Number of LU factorizations run by SimWorkspaceSolve
+  long num_factorizations;
+
+  // Diode and MOSFET model evaluations and bypasses of the Newton
+  // iterations run with this workspace (NewtonPolicy::bypass)
+  DeviceEvalCounts eval_counts;
+
+  // Profiling (see sim_stats.h): the phase timers run if profile is set.
+  // stats holds the counters kept here; SimWorkspaceGetStats adds the
+  // counters above and the matrix sizes.
+  int profile;
+  SimStats stats;
+  long devices_by_type[kNumDeviceTypes];  // Devices of each DeviceTypeId
+
+  // Newton-Raphson vectors (length n)
+  double* x_new;  // Solution of the linearized system
+  double* delta;  // Step applied to x by the last update (the damped
+                  // x_new - x)
+
+  // DC continuation: last converged solution of source stepping (length n)
+  // and the strategy that solved the last DC analysis
+  double* x_continuation;
+  DcStrategy dc_strategy;
+};
+
+// Create a workspace for a finalized circuit.
+// Returns nullptr if the circuit is not finalized or on allocation failure.
+SimWorkspace* SimWorkspaceCreate(const Circuit* c);
+
+// Free a workspace and all its buffers
+void SimWorkspaceFree(SimWorkspace* ws);
+
+// Statistics of the analyses run with the workspace since its creation or
+// the last SimWorkspaceClearStats, with the current matrix sizes
+void SimWorkspaceGetStats(const SimWorkspace* ws, SimStats* stats);
+
+// Zero the statistics and the counters they are built from
+// (num_factorizations, eval_counts)
+void SimWorkspaceClearStats(SimWorkspace* ws);
+
+// Stamp every device of the circuit for one NR iteration into the workspace
+// matrix and the context RHS. The first call discovers the stamp pattern and
+// compiles the context against the matrix storage; later calls stamp in
+// compiled mode and rediscover only if a device changes its pattern.
+// Returns 0 on success, -1 on failure.
+int SimWorkspaceAssemble(SimWorkspace* ws, Circuit* c, IterationState* it);
+
+// Same as SimWorkspaceAssemble with the transient stamps of every device
+// for one Newton iteration of a time step.
+// Returns 0 on success, -1 on failure.
+int SimWorkspaceAssembleTransient(SimWorkspace* ws, Circuit* c,
+                                  TimeStepState* ts);
+
+// Column ordering of the sparse Jacobian pattern of a workspace of c, found
+// by one assembly at x = 0 if nothing has been assembled yet: the ordering
+// of its LU object, or one computed for the pattern when the workspace
+// factors by blocks or iterates. The caller frees it with
+// SparseOrderingFree.
+// Returns nullptr for a dense workspace or on failure.
+SparseOrdering* SimWorkspaceDiscoverOrdering(SimWorkspace* ws, Circuit* c);
+
+// Factor the assembled matrix in place and solve for ws->x_new.
+// Returns 0 on success, -1 on failure, -2 if the matrix is singular.
+int SimWorkspaceSolve(SimWorkspace* ws);
+
+// Infinity norm of the residual A x - z of the assembled system, i.e. of
+// the KCL residual at x when the devices were linearized at x. Call before
+// SimWorkspaceSolve, which factors the matrix in place; uses ws->x_new as
+// scratch on the sparse path.
+// Returns INFINITY if nothing has been assembled.
+double SimWorkspaceResidualNorm(SimWorkspace* ws, const double* x);
+
+// Backtracking of kNewtonDampingLineSearch, after the assembly at the
+// iterate x (it->x_current or ts->x_current) reached by the step
+// ws->delta: while the residual norm at x exceeds *residual (the norm at
+// the previous iterate; INFINITY before the first step) or is NaN, halve
+// the step, moving x back, and reassemble, at most policy.max_backtracks
+// times.
+// *residual receives the norm at the accepted x.
+// Returns 0 on success, -1 on failure.
+int SimWorkspaceLineSearch(SimWorkspace* ws, Circuit* c, IterationState* it,
+                           TimeStepState* ts, double* residual);
+
+// Newton update after SimWorkspaceSolve: the step x_new - x, scaled so
+// that no variable moves by more than policy->max_step under
+// kNewtonDampingMaxStep, is stored in ws->delta and added to x.
+void SimWorkspaceUpdateSolution(SimWorkspace* ws, double* x,
+                                const NewtonPolicy* policy);
+
+}  // namespace minispice
+
+#endif  // MINI_SPICE_WORKSPACE_H_
@@ -0,0 +1,342 @@
+// workspace_test.cc
+// Unit tests for the reusable analysis workspace
+
+#include "workspace.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "circuit.h"
+#include "device.h"
+#include "parser.h"
+#include "transient.h"
+
+using namespace minispice;
+
+TEST(WorkspaceTest, RequiresFinalizedCircuit) {
+  Circuit* c = circuit_create();
+  ASSERT_NE(c, nullptr);
+  CircuitAddNode(c, "1");
+
+  EXPECT_EQ(SimWorkspaceCreate(nullptr), nullptr);
+  EXPECT_EQ(SimWorkspaceCreate(c), nullptr);
+
+  circuit_free(c);
+}
+
+TEST(WorkspaceTest, DenseSolveWithPivoting) {
+  // Voltage source rows have a zero diagonal and need row pivoting
+  Circuit* c = parse_netlist_string("V1 1 0 5\nR1 1 2 1k\nR2 2 0 1k\n");
+  ASSERT_NE(c, nullptr);
+
+  SimWorkspace* ws = SimWorkspaceCreate(c);
+  ASSERT_NE(ws, nullptr);
+  EXPECT_EQ(ws->use_sparse, 0);
+  EXPECT_NE(ws->A, nullptr);
+
+  double x[3];
+  int iters = CircuitDcAnalysisWithWorkspace(c, ws, x, 100, 1e-9, 1e-6);
+  EXPECT_GT(iters, 0);
+
+  EXPECT_NEAR(x[c->nodes[CircuitGetNode(c, "1")].var_index], 5.0, 1e-9);
+  EXPECT_NEAR(x[c->nodes[CircuitGetNode(c, "2")].var_index], 2.5, 1e-9);
+
+  SimWorkspaceFree(ws);
+  circuit_free(c);
+}
+
+TEST(WorkspaceTest, RepeatedAnalysesReuseBuffers) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 5\nR1 in a 1k\nD1 a 0 Is=1e-14 n=1\n");
+  ASSERT_NE(c, nullptr);
+
+  SimWorkspace* ws = SimWorkspaceCreate(c);
+  ASSERT_NE(ws, nullptr);
+
+  double x1[3];
+  int iters = CircuitDcAnalysisWithWorkspace(c, ws, x1, 100, 1e-12, 1e-9);
+  ASSERT_GT(iters, 2);
+  EXPECT_EQ(ws->compiled, 1);
+
+  const int* slots = ws->slots;
+  const double* A = ws->A;
+  const double* x_new = ws->x_new;
+
+  // Second analysis stays compiled and uses the same storage
+  double x2[3];
+  EXPECT_EQ(CircuitDcAnalysisWithWorkspace(c, ws, x2, 100, 1e-12, 1e-9),
+            iters);
+  EXPECT_EQ(ws->compiled, 1);
+  EXPECT_EQ(ws->slots, slots);
+  EXPECT_EQ(ws->A, A);
+  EXPECT_EQ(ws->x_new, x_new);
+  for (int i = 0; i < 3; i++) EXPECT_DOUBLE_EQ(x1[i], x2[i]);
+
+  SimWorkspaceFree(ws);
+  circuit_free(c);
+}
+
+TEST(WorkspaceTest, DefaultWorkspaceIsKeptOnCircuit) {
+  Circuit* c = parse_netlist_string("I1 0 1 1m\nR1 1 0 1k\n");
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(c->workspace, nullptr);
+
+  double x[1];
+  ASSERT_GT(CircuitDcAnalysis(c, x, 100, 1e-9, 1e-6), 0);
+  SimWorkspace* ws = c->workspace;
+  ASSERT_NE(ws, nullptr);
+  EXPECT_NEAR(x[0], 1.0, 1e-9);
+
+  ASSERT_GT(CircuitDcAnalysis(c, x, 100, 1e-9, 1e-6), 0);
+  EXPECT_EQ(c->workspace, ws);
+  EXPECT_NEAR(x[0], 1.0, 1e-9);
+
+  circuit_free(c);
+}
+
+TEST(WorkspaceTest, MismatchedWorkspaceIsRejected) {
+  Circuit* a = parse_netlist_string("I1 0 1 1m\nR1 1 0 1k\n");
+  Circuit* b = parse_netlist_string("I1 0 1 1m\nR1 1 2 1k\nR2 2 0 1k\n");
+  ASSERT_NE(a, nullptr);
+  ASSERT_NE(b, nullptr);
+
+  SimWorkspace* ws = SimWorkspaceCreate(a);
+  ASSERT_NE(ws, nullptr);
+
+  double x[2];
+  EXPECT_EQ(CircuitDcAnalysisWithWorkspace(b, ws, x, 100, 1e-9, 1e-6), -1);
+
+  SimWorkspaceFree(ws);
+  circuit_free(a);
+  circuit_free(b);
+}
+
+TEST(WorkspaceTest, LinearityDetectedAtFinalize) {
+  Circuit* lin = parse_netlist_string(
+      "V1 in 0 5\nR1 in a 1k\nC1 a 0 1n\nL1 a b 1u\nI1 b 0 1m\n");
+  Circuit* nonlin = parse_netlist_string("V1 in 0 5\nR1 in a 1k\nD1 a 0\n");
+  ASSERT_NE(lin, nullptr);
+  ASSERT_NE(nonlin, nullptr);
+  EXPECT_EQ(lin->is_linear, 1);
+  EXPECT_EQ(nonlin->is_linear, 0);
+
+  Circuit* copy = CircuitClone(lin);
+  ASSERT_NE(copy, nullptr);
+  EXPECT_EQ(copy->is_linear, 1);
+
+  circuit_free(copy);
+  circuit_free(lin);
+  circuit_free(nonlin);
+}
+
+TEST(WorkspaceTest, LinearCircuitFactorsOnce) {
+  Circuit* c = parse_netlist_string("V1 1 0 5\nR1 1 2 1k\nR2 2 0 1k\n");
+  ASSERT_NE(c, nullptr);
+
+  SimWorkspace* ws = SimWorkspaceCreate(c);
+  ASSERT_NE(ws, nullptr);
+  EXPECT_EQ(ws->linear, 1);
+
+  int n2 = c->nodes[CircuitGetNode(c, "2")].var_index;
+  double x[3];
+  EXPECT_EQ(CircuitDcAnalysisWithWorkspace(c, ws, x, 100, 1e-9, 1e-6), 1);
+  EXPECT_NEAR(x[n2], 2.5, 1e-12);
+  EXPECT_EQ(ws->num_factorizations, 1);
+
+  // A new source value only changes the RHS: back-substitution only
+  ASSERT_EQ(DeviceSetValue(CircuitFindDevice(c, "V1"), 3.0), 0);
+  EXPECT_EQ(CircuitDcAnalysisWithWorkspace(c, ws, x, 100, 1e-9, 1e-6), 1);
+  EXPECT_NEAR(x[n2], 1.5, 1e-12);
+  EXPECT_EQ(ws->num_factorizations, 1);
+
+  SimWorkspaceFree(ws);
+  circuit_free(c);
+}
+
+TEST(WorkspaceTest, NonlinearCircuitRefactorsEveryIteration) {
+  Circuit* c = parse_netlist_string(
+      "V1 in 0 5\nR1 in a 1k\nD1 a 0 Is=1e-14 n=1\n");
+  ASSERT_NE(c, nullptr);
+
+  SimWorkspace* ws = SimWorkspaceCreate(c);
+  ASSERT_NE(ws, nullptr);
+  EXPECT_EQ(ws->linear, 0);
+  EXPECT_EQ(ws->LU, nullptr);
+
+  double x[3];
+  int iters = CircuitDcAnalysisWithWorkspace(c, ws, x, 100, 1e-12, 1e-9);
+  ASSERT_GT(iters, 2);
+  EXPECT_EQ(ws->num_factorizations, iters);
+
+  SimWorkspaceFree(ws);
+  circuit_free(c);
+}
+
+TEST(WorkspaceTest, SparseLinearSweepFactorsOnce) {
+  // Resistor ladder on the sparse path swept over its source
+  const int kResistors = 2 * kSparseSolverThreshold;
+  std::string netlist = "V1 n0 0 1\n";
+  for (int k = 0; k < kResistors - 1; k++) {
+    netlist += "R" + std::to_string(k) + " n" + std::to_string(k) + " n" +
+               std::to_string(k + 1) + " 1k\n";
+  }
+  netlist += "Rlast n" + std::to_string(kResistors - 1) + " 0 1k\n";
+
+  Circuit* c = parse_netlist_string(netlist.c_str());
+  ASSERT_NE(c, nullptr);
+  SimWorkspace* ws = SimWorkspaceCreate(c);
+  ASSERT_NE(ws, nullptr);
+  ASSERT_EQ(ws->use_sparse, 1);
+
+  struct Check {
+    int var;
+    double worst;
+  } check = {c->nodes[CircuitGetNode(c, "n1")].var_index, 0.0};
+  DcSweep sweep = {"V1", 0.0, 2.0, 0.25};
+  double* x = (double*)calloc(c->num_vars, sizeof(double));
+  ASSERT_NE(x, nullptr);
+  int points = CircuitDcSweep(
+      c, ws, &sweep, 1, x, 100, 1e-9, 1e-6,
+      [](void* user, const double* values, const double* sol, int) {
+        Check* ch = static_cast<Check*>(user);
+        double expected = values[0] * (2.0 * kSparseSolverThreshold - 1) /
+                          (2.0 * kSparseSolverThreshold);
+        ch->worst = std::fmax(ch->worst, std::fabs(sol[ch->var] - expected));
+      },
+      &check);
+  EXPECT_EQ(points, 9);
+  EXPECT_LT(check.worst, 1e-9);
+  EXPECT_EQ(ws->num_factorizations, 1);
+
+  free(x);
+  SimWorkspaceFree(ws);
+  circuit_free(c);
+}
+
+// Ladder of stages loaded by a diode and a capacitor, every fourth driving
+// a MOSFET: enough vtable and batched devices to stamp on the pool
+static std::string StampLadder(int stages) {
+  std::string netlist = "V1 n0 0 PULSE(0 2 1n 1n 1n 5n 20n)\n";
+  for (int k = 0; k < stages; k++) {
+    std::string s = std::to_string(k);
+    std::string a = "n" + s;
+    std::string b = "n" + std::to_string(k + 1);
+    netlist += "R" + s + " " + a + " " + b + " 1k\n";
+    netlist += "D" + s + " " + b + " 0 Is=1e-14 n=1\n";
+    netlist += "C" + s + " " + b + " 0 1p\n";
+    if (k % 4 == 0) {
+      netlist += "M" + s + " vdd " + b + " 0 0 W=1e-5\n";
+    }
+  }
+  netlist += "VDD vdd 0 3\n";
+  return netlist;
+}
+
+TEST(WorkspaceTest, ParallelStampingMatchesSerialBitForBit) {
+  std::string netlist = StampLadder(200);
+  std::vector<double> dc[2], tran[2];
+  SimStats stats[2];
+  const int threads[2] = {1, 4};
+  for (int run = 0; run < 2; run++) {
+    Circuit* c = parse_netlist_string(netlist.c_str());
+    ASSERT_NE(c, nullptr);
+    c->stamp_threads = threads[run];
+    c->workspace = SimWorkspaceCreate(c);
+    ASSERT_NE(c->workspace, nullptr);
+    EXPECT_EQ(c->workspace->stamp_pool != nullptr, run == 1);
+
+    dc[run].assign(c->num_vars, 0.0);
+    ASSERT_GT(CircuitDcAnalysis(c, dc[run].data(), 100, 1e-12, 1e-9), 0);
+    TransientOptions opts;
+    TransientOptionsInit(&opts, 0.5e-9, 10e-9);
+    tran[run] = dc[run];
+    ASSERT_GT(CircuitTransientAnalysis(c, nullptr, &opts, tran[run].data(),
+                                       nullptr, nullptr, nullptr),
+              0);
+    SimWorkspaceGetStats(c->workspace, &stats[run]);
+    circuit_free(c);
+  }
+
+  ASSERT_EQ(dc[0].size(), dc[1].size());
+  for (size_t i = 0; i < dc[0].size(); i++) {
+    EXPECT_EQ(dc[1][i], dc[0][i]);
+    EXPECT_EQ(tran[1][i], tran[0][i]);
+  }
+  EXPECT_EQ(stats[1].newton_iterations, stats[0].newton_iterations);
+  EXPECT_EQ(stats[1].device_evaluations, stats[0].device_evaluations);
+  EXPECT_EQ(stats[1].bypassed_evaluations, stats[0].bypassed_evaluations);
+}
+
+// DC solution of a netlist and the stats of its workspace
+static std::vector<double> SolveDc(const char* netlist, int mixed_precision,
+                                   SimStats* stats) {
+  Circuit* c = parse_netlist_string(netlist);
+  EXPECT_NE(c, nullptr);
+  if (!c) return {};
+  c->linear_solver.mixed_precision = mixed_precision;
+  std::vector<double> x(c->num_vars, 0.0);
+  EXPECT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+  SimWorkspaceGetStats(c->workspace, stats);
+  circuit_free(c);
+  return x;
+}
+
+TEST(WorkspaceTest, MixedPrecisionRefinesToDoubleAccuracy) {
+  // Nonlinear (refactored every iteration) and linear (factors kept)
+  const char* netlists[] = {
+      "V1 a 0 5\nR1 a b 1k\nD1 b c Is=1e-14 n=1\nR2 c 0 10k\n"
+      "R3 b 0 1meg\nD2 c 0 Is=1e-12 n=2\n",
+      "V1 a 0 1\nR1 a b 1\nR2 b c 1e-6\nR3 c 0 1e6\nR4 b 0 1e7\n"
+      "R5 c d 1e-6\nR6 d 0 1\n"};
+  for (const char* netlist : netlists) {
+    SimStats ref, mixed;
+    std::vector<double> x = SolveDc(netlist, 0, &ref);
+    std::vector<double> y = SolveDc(netlist, 1, &mixed);
+    ASSERT_EQ(x.size(), y.size());
+    for (size_t i = 0; i < x.size(); i++) {
+      EXPECT_NEAR(y[i], x[i], 1e-12 * (1.0 + std::fabs(x[i])));
+    }
+    EXPECT_EQ(ref.refinement_steps, 0);
+    EXPECT_EQ(ref.mixed_precision, 0);
+    EXPECT_GT(mixed.refinement_steps, 0);
+    EXPECT_EQ(mixed.mixed_precision, 1);
+    EXPECT_EQ(mixed.precision_fallbacks, 0);
+  }
+}
+
+TEST(WorkspaceTest, MixedPrecisionFallsBackToDouble) {
+  // Too ill-conditioned for float factors (a near-cancelling negative
+  // resistor), and a conductance beyond the float range
+  const char* netlists[] = {
+      "I1 0 a 1\nR1 a b 1\nR2 a 0 1e9\nR3 b 0 1e9\nR4 a c 1\n"
+      "R5 c b -0.99999999\nR6 c 0 1e9\n",
+      "V1 a 0 1\nR1 a b 1e-40\nD1 b 0 Is=1e-14 n=1\nR2 b 0 1\n"};
+  for (const char* netlist : netlists) {
+    SimStats ref, mixed;
+    std::vector<double> x = SolveDc(netlist, 0, &ref);
+    std::vector<double> y = SolveDc(netlist, 1, &mixed);
+    ASSERT_EQ(x.size(), y.size());
+    for (size_t i = 0; i < x.size(); i++) EXPECT_EQ(y[i], x[i]);
+    EXPECT_GT(mixed.precision_fallbacks, 0);
+  }
+}
+
+TEST(WorkspaceTest, MixedPrecisionIsReportedOffOnTheSparsePath) {
+  // The Krylov solvers always run on the sparse matrix, in double
+  Circuit* c = parse_netlist_string("V1 a 0 1\nR1 a b 1k\nR2 b 0 2k\n");
+  ASSERT_NE(c, nullptr);
+  c->linear_solver.method = kLinearSolverGmres;
+  c->linear_solver.mixed_precision = 1;
+  std::vector<double> x(c->num_vars, 0.0);
+  EXPECT_GT(CircuitDcAnalysis(c, x.data(), 100, 1e-12, 1e-9), 0);
+  SimStats stats;
+  SimWorkspaceGetStats(c->workspace, &stats);
+  EXPECT_EQ(stats.sparse, 1);
+  EXPECT_EQ(stats.mixed_precision, 0);
+  EXPECT_EQ(stats.refinement_steps, 0);
+  circuit_free(c);
+}